@@ -5405,7 +5405,7 @@ do_depref(void *input)
 				dhc6_marshall_values("cur_", client, lease,
 						     ia, addr);
 				script_write_requested6(client);
-				script_go(client);
+				script_go_async(client);
 
 				addr->flags |= DHC6_ADDR_DEPREFFED;
 
@@ -5461,7 +5461,7 @@ do_expire(void *input)
 				dhc6_marshall_values("old_", client, lease,
 						     ia, addr);
 				script_write_requested6(client);
-				script_go(client);
+				script_go_async(client);
 
 				addr->flags |= DHC6_ADDR_EXPIRED;
 
@@ -5657,7 +5657,7 @@ start_informed(struct client_state *client)
 				     client->old_lease->options);
 	script_write_params6(client, "new_", client->active_lease->options);
 	script_write_requested6(client);
-	script_go(client);
+	script_go_async(client);
 
 #ifdef DHCP4o6
 	if (dhcpv4_over_dhcpv6)
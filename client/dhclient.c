@@ -170,19 +170,19 @@ static const char use_v6command[] = "Command not used for DHCPv4: %s";
 #define DHCLIENT_USAGE0 \
 "[-4|-6] [-SNTPRI1dvrxi] [-nw] -4o6 <port>] [-p <port>] [-D LL|LLT]\n" \
 "                [--dad-wait-time <seconds>] [--prefix-len-hint <length>]\n" \
-"                [--decline-wait-time <seconds>]\n" \
+"                [--decline-wait-time <seconds>] [--script-jobs <count>]\n" \
 "                [--address-prefix-len <length>]\n"
 #else /* DHCP4o6 */
 #define DHCLIENT_USAGE0 \
 "[-4|-6] [-SNTPRI1dvrxi] [-nw] [-p <port>] [-D LL|LLT]\n" \
 "                [--dad-wait-time <seconds>] [--prefix-len-hint <length>]\n" \
-"                [--decline-wait-time <seconds>]\n" \
+"                [--decline-wait-time <seconds>] [--script-jobs <count>]\n" \
 "                [--address-prefix-len <length>]\n"
 #endif
 #else /* DHCPv6 */
 #define DHCLIENT_USAGE0 \
 "[-I1dvrxi] [-nw] [-p <port>] [-D LL|LLT] \n" \
-"                [--decline-wait-time <seconds>]\n"
+"                [--decline-wait-time <seconds>] [--script-jobs <count>]\n"
 #endif
 
 #define DHCLIENT_USAGEC \
@@ -545,6 +545,17 @@ main(int argc, char **argv) {
 				usage("Invalid value for "
 				      "--decline-wait-time: %s", argv[i]);
 			}
+		} else if (!strcmp(argv[i], "--script-jobs")) {
+			if (++i == argc) {
+				usage(use_noarg, argv[i-1]);
+			}
+
+			errno = 0;
+			script_jobs = (int)strtol(argv[i], &s, 10);
+			if (errno || (*s != '\0') || (script_jobs < 0)) {
+				usage("Invalid value for "
+				      "--script-jobs: %s", argv[i]);
+			}
 		} else if (!strcmp(argv[i], "-D")) {
 			duid_v4 = 1;
 			if (++i == argc)
@@ -2458,7 +2469,7 @@ void dhcpnak (packet)
 	script_write_requested(client);
 	if (client->alias)
 		script_write_params(client, "alias_", client->alias);
-	script_go(client);
+	script_go_async(client);
 
 	destroy_client_lease (client -> active);
 	client -> active = (struct client_lease *)0;
@@ -2812,7 +2823,7 @@ void state_panic (cpp)
 	script_init(client, "FAIL", (struct string_list *)0);
 	if (client -> alias)
 		script_write_params(client, "alias_", client -> alias);
-	script_go(client);
+	script_go_async(client);
 	client -> state = S_INIT;
 	tv.tv_sec = cur_tv.tv_sec + ((client->config->retry_interval + 1) / 2 +
 		    (random() % client->config->retry_interval));
@@ -2884,7 +2895,7 @@ void send_request (cpp)
 		if (client -> alias)
 			script_write_params(client, "alias_",
 					    client -> alias);
-		script_go(client);
+		script_go_async(client);
 
 		/* Now do a preinit on the interface so that we can
 		   discover a new address. */
@@ -3713,19 +3724,41 @@ void destroy_client_lease (lease)
 FILE *leaseFile = NULL;
 int leases_written = 0;
 
-void rewrite_client_leases ()
+/*
+ * The lease file is a journal: each lease is appended to it when it
+ * changes, and a later entry for an interface supersedes an earlier
+ * one when the file is read back.  Once as many leases have been
+ * appended as the file held when it was last rewritten (or
+ * MIN_LEASE_JOURNAL, if that's more), it is compacted by writing out
+ * the current leases afresh.  So the file stays within about twice its
+ * compacted size, and with many interfaces the cost of the rewrite is
+ * spread over as many writes as there are leases.
+ *
+ * The rewrite goes to a new file that then replaces the old one, so a
+ * crash part way through doesn't lose the leases.  If the new file
+ * can't be made, the old one is truncated and rewritten in place.
+ */
+static int leases_compacted = 0;
+
+/* Count a lease appended to the journal, and say whether it's time to
+   compact it. */
+static int
+lease_journal_full(void)
+{
+	return (leases_written++ >
+		(leases_compacted > MIN_LEASE_JOURNAL ?
+		 leases_compacted : MIN_LEASE_JOURNAL));
+}
+
+/* Write out the default DUID and all the leases we know of, and return
+   the number of leases. */
+static int
+write_all_client_leases(void)
 {
 	struct interface_info *ip;
 	struct client_state *client;
 	struct client_lease *lp;
-
-	if (leaseFile != NULL)
-		fclose (leaseFile);
-	leaseFile = fopen (path_dhclient_db, "w");
-	if (leaseFile == NULL) {
-		log_error ("can't create %s: %m", path_dhclient_db);
-		return;
-	}
+	int count = 0;
 
 	/* If there is a default duid, write it out. */
 	if (default_duid.len != 0)
@@ -3737,15 +3770,20 @@ void rewrite_client_leases ()
 		for (client = ip -> client; client; client = client -> next) {
 			for (lp = client -> leases; lp; lp = lp -> next) {
 				write_client_lease (client, lp, 1, 0);
+				count++;
 			}
-			if (client -> active)
+			if (client -> active) {
 				write_client_lease (client,
 						    client -> active, 1, 0);
+				count++;
+			}
 
-			if (client->active_lease != NULL)
+			if (client->active_lease != NULL) {
 				write_client6_lease(client,
 						    client->active_lease,
 						    1, 0);
+				count++;
+			}
 
 			/* Reset last_write after rewrites. */
 			client->last_write = 0;
@@ -3758,21 +3796,67 @@ void rewrite_client_leases ()
 		for (client = ip -> client; client; client = client -> next) {
 			for (lp = client -> leases; lp; lp = lp -> next) {
 				write_client_lease (client, lp, 1, 0);
+				count++;
 			}
-			if (client -> active)
+			if (client -> active) {
 				write_client_lease (client,
 						    client -> active, 1, 0);
+				count++;
+			}
 
-			if (client->active_lease != NULL)
+			if (client->active_lease != NULL) {
 				write_client6_lease(client,
 						    client->active_lease,
 						    1, 0);
+				count++;
+			}
 
 			/* Reset last_write after rewrites. */
 			client->last_write = 0;
 		}
 	}
 	fflush (leaseFile);
+	return count;
+}
+
+void rewrite_client_leases ()
+{
+	char *newpath;
+
+	if (leaseFile != NULL)
+		fclose (leaseFile);
+	leaseFile = NULL;
+
+	/* Write the leases to a new file, and move it over the old. */
+	newpath = dmalloc(strlen(path_dhclient_db) + 5, MDL);
+	if (newpath != NULL) {
+		sprintf(newpath, "%s.new", path_dhclient_db);
+		leaseFile = fopen(newpath, "w");
+		if (leaseFile != NULL) {
+			leases_compacted = write_all_client_leases();
+			if (ferror(leaseFile) ||
+			    fsync(fileno(leaseFile)) < 0 ||
+			    rename(newpath, path_dhclient_db) < 0) {
+				log_error("can't replace %s: %m",
+					  path_dhclient_db);
+				fclose(leaseFile);
+				leaseFile = NULL;
+				unlink(newpath);
+			}
+		} else
+			log_debug("can't create %s: %m", newpath);
+		dfree(newpath, MDL);
+	}
+
+	/* Failing that, rewrite the old file in place. */
+	if (leaseFile == NULL) {
+		leaseFile = fopen (path_dhclient_db, "w");
+		if (leaseFile == NULL) {
+			log_error ("can't create %s: %m", path_dhclient_db);
+			return;
+		}
+		leases_compacted = write_all_client_leases();
+	}
 }
 
 void write_lease_option (struct option_cache *oc,
@@ -3951,7 +4035,7 @@ write_client6_lease(struct client_state *client, struct dhc6_lease *lease,
 	const char *ianame;
 
 	/* This should include the current lease. */
-	if (!rewrite && (leases_written++ > 20)) {
+	if (!rewrite && lease_journal_full()) {
 		rewrite_client_leases();
 		leases_written = 0;
 		return ISC_R_SUCCESS;
@@ -4108,7 +4192,7 @@ int write_client_lease (client, lease, rewrite, makesure)
 	const char *tval;
 
 	if (!rewrite) {
-		if (leases_written++ > 20) {
+		if (lease_journal_full()) {
 			rewrite_client_leases ();
 			leases_written = 0;
 		}
@@ -4487,19 +4571,55 @@ void script_write_requested(struct client_state *client)
 	}
 }
 
-/**
- * @brief Calls external script.
+/*
+ * Scripts run in the background.
  *
- * External script is specified either using -sf command line or
- * script parameter in the configuration file.
+ * With --script-jobs, the scripts for events whose exit status dhclient
+ * doesn't act on (EXPIRE, FAIL, DEPREF6, EXPIRE6 and the DHCPv6
+ * informed case) are queued rather than waited for, so that a slow
+ * script for one interface doesn't hold up the others.  At most
+ * script_jobs of them run at once, and the scripts for any one client
+ * run one at a time in the order of the events.  If an event comes in
+ * while one for the same reason and the same addresses is still queued,
+ * the queued one is given the new parameters rather than the script
+ * being run twice.
  *
- * @param client specifies client information (environment variables,
- *        and other parameters will be extracted and passed to the script.
- * @return If positive, it contains exit code of the process running script.
- *         If negative, returns the signal number that cause the script process
- *         to terminate.
+ * Children are reaped when SIGCHLD arrives, by way of a pipe that the
+ * dispatcher watches.  Before running a script whose exit status it
+ * needs, dhclient waits for any of the same client's scripts that are
+ * still queued or running.
  */
-int script_go(struct client_state *client)
+struct script_job {
+	struct script_job *next;
+	struct client_state *client;
+	struct string_list *env;
+	int envc;
+	pid_t pid;			/* zero until the script starts */
+};
+
+int script_jobs = 0;
+static struct script_job *script_queue;
+static int script_running;
+static int script_pipe [2] = { -1, -1 };
+static omapi_object_type_t *script_type;
+static omapi_object_t *script_object;
+
+static void
+script_free_env(struct string_list *env)
+{
+	struct string_list *next;
+
+	for (; env; env = next) {
+		next = env -> next;
+		dfree (env, MDL);
+	}
+}
+
+/* Start the script with the given environment, and return the process
+   ID of the child, or -1 if it couldn't be started. */
+static pid_t
+script_start(struct client_state *client, struct string_list *env,
+	     int envc)
 {
 	char *scriptName;
 	char *argv [2];
@@ -4507,19 +4627,19 @@ int script_go(struct client_state *client)
 	char reason [] = "REASON=NBI";
 	static char client_path [] = CLIENT_PATH;
 	int i;
-	struct string_list *sp, *next;
-	int pid, wpid, wstatus;
+	struct string_list *sp;
+	pid_t pid;
 
 	if (client)
 		scriptName = client -> config -> script_name;
 	else
 		scriptName = top_level_config.script_name;
 
-	envp = dmalloc (((client ? client -> envc : 2) +
+	envp = dmalloc (((client ? envc : 2) +
 			 client_env_count + 2) * sizeof (char *), MDL);
 	if (!envp) {
 		log_error ("No memory for client script environment.");
-		return 0;
+		return -1;
 	}
 	i = 0;
 	/* Copy out the environment specified on the command line,
@@ -4529,7 +4649,7 @@ int script_go(struct client_state *client)
 	}
 	/* Copy out the environment specified by dhclient. */
 	if (client) {
-		for (sp = client -> env; sp; sp = sp -> next) {
+		for (sp = env; sp; sp = sp -> next) {
 			envp [i++] = sp -> string;
 		}
 	} else {
@@ -4545,16 +4665,7 @@ int script_go(struct client_state *client)
 	pid = fork ();
 	if (pid < 0) {
 		log_error ("fork: %m");
-		wstatus = 0;
-	} else if (pid) {
-		do {
-			wpid = wait (&wstatus);
-		} while (wpid != pid && wpid > 0);
-		if (wpid < 0) {
-			log_error ("wait: %m");
-			wstatus = 0;
-		}
-	} else {
+	} else if (pid == 0) {
 		/* We don't want to pass an open file descriptor for
 		 * dhclient.leases when executing dhclient-script.
 		 */
@@ -4565,15 +4676,63 @@ int script_go(struct client_state *client)
 		exit (0);
 	}
 
+	dfree (envp, MDL);
+	return pid;
+}
+
+/* Wait for a script to exit, and return its wait status. */
+static int
+script_reap(pid_t pid, int flags, int *wstatus)
+{
+	pid_t wpid;
+
+	do {
+		wpid = waitpid (pid, wstatus, flags);
+	} while (wpid < 0 && errno == EINTR);
+	if (wpid < 0) {
+		log_error ("wait: %m");
+		*wstatus = 0;
+	}
+	return wpid != 0;
+}
+
+/**
+ * @brief Calls external script.
+ *
+ * External script is specified either using -sf command line or
+ * script parameter in the configuration file.  Any of the client's
+ * scripts that were queued by @ref script_go_async are run first.
+ *
+ * @param client specifies client information (environment variables,
+ *        and other parameters will be extracted and passed to the script.
+ * @return If positive, it contains exit code of the process running script.
+ *         If negative, returns the signal number that cause the script process
+ *         to terminate.
+ */
+int script_go(struct client_state *client)
+{
+	char *scriptName;
+	pid_t pid;
+	int wstatus;
+
 	if (client) {
-		for (sp = client -> env; sp; sp = next) {
-			next = sp -> next;
-			dfree (sp, MDL);
-		}
+		scriptName = client -> config -> script_name;
+		script_wait(client);
+	} else
+		scriptName = top_level_config.script_name;
+
+	pid = script_start(client, client ? client -> env : NULL,
+			   client ? client -> envc : 0);
+	if (pid < 0)
+		wstatus = 0;
+	else
+		script_reap(pid, 0, &wstatus);
+
+	if (client) {
+		script_free_env(client -> env);
 		client -> env = (struct string_list *)0;
 		client -> envc = 0;
 	}
-	dfree (envp, MDL);
 	gettimeofday(&cur_tv, NULL);
 
     if (!WIFEXITED(wstatus)) {
@@ -4585,6 +4744,271 @@ int script_go(struct client_state *client)
     return (WEXITSTATUS(wstatus));
 }
 
+/* Whether an environment variable names the event or one of the
+   addresses it is for. */
+static int
+script_key_var(const char *s)
+{
+	static const char *suffixes [] = {
+		"ip_address", "ip6_address", "ip6_prefix", NULL
+	};
+	const char *eq;
+	size_t len, slen;
+	int i;
+
+	eq = strchr(s, '=');
+	if (eq == NULL)
+		return 0;
+	len = eq - s;
+	if (len == 6 && !strncmp(s, "reason", 6))
+		return 1;
+	for (i = 0; suffixes [i]; i++) {
+		slen = strlen(suffixes [i]);
+		if (len >= slen && !strncmp(eq - slen, suffixes [i], slen))
+			return 1;
+	}
+	return 0;
+}
+
+/* Whether two script environments are for the same event on the same
+   addresses. */
+static int
+script_same_event(struct string_list *a, struct string_list *b)
+{
+	struct string_list *sp, *tp;
+	int na = 0, nb = 0;
+
+	for (sp = a; sp; sp = sp -> next) {
+		if (!script_key_var(sp -> string))
+			continue;
+		na++;
+		for (tp = b; tp; tp = tp -> next)
+			if (!strcmp(sp -> string, tp -> string))
+				break;
+		if (tp == NULL)
+			return 0;
+	}
+	for (tp = b; tp; tp = tp -> next)
+		if (script_key_var(tp -> string))
+			nb++;
+	return na == nb;
+}
+
+static void
+script_job_free(struct script_job *job)
+{
+	script_free_env(job -> env);
+	dfree (job, MDL);
+}
+
+/* Note how a background script ended. */
+static void
+script_done(struct script_job *job, int wstatus)
+{
+	const char *name = job -> client -> interface ?
+			   job -> client -> interface -> name : "";
+
+	script_running--;
+	if (!WIFEXITED(wstatus))
+		log_error ("%s script for %s was terminated by signal %d",
+			   job -> client -> config -> script_name, name,
+			   WTERMSIG(wstatus));
+	else if (WEXITSTATUS(wstatus) != 0)
+		log_debug ("%s script for %s exited with status %d",
+			   job -> client -> config -> script_name, name,
+			   WEXITSTATUS(wstatus));
+}
+
+/* Start as many queued scripts as the limit allows, skipping those for
+   clients that have an earlier script still to finish. */
+static void
+script_run_queue(void)
+{
+	struct script_job *job, *jp, **jpp;
+
+	jpp = &script_queue;
+	while ((job = *jpp) != NULL && script_running < script_jobs) {
+		if (job -> pid == 0) {
+			for (jp = script_queue; jp != job; jp = jp -> next)
+				if (jp -> client == job -> client)
+					break;
+			if (jp == job) {
+				job -> pid = script_start(job -> client,
+							  job -> env,
+							  job -> envc);
+				if (job -> pid < 0) {
+					*jpp = job -> next;
+					script_job_free(job);
+					continue;
+				}
+				script_running++;
+			}
+		}
+		jpp = &job -> next;
+	}
+}
+
+/* Run, or wait for, all the queued scripts for a client. */
+void
+script_wait(struct client_state *client)
+{
+	struct script_job *job, **jpp;
+	int wstatus;
+
+	jpp = &script_queue;
+	while ((job = *jpp) != NULL) {
+		if (job -> client != client) {
+			jpp = &job -> next;
+			continue;
+		}
+		if (job -> pid == 0) {
+			job -> pid = script_start(client, job -> env,
+						  job -> envc);
+			if (job -> pid > 0)
+				script_running++;
+		}
+		if (job -> pid > 0) {
+			script_reap(job -> pid, 0, &wstatus);
+			script_done(job, wstatus);
+		}
+		*jpp = job -> next;
+		script_job_free(job);
+	}
+	script_run_queue();
+}
+
+static void
+script_sigchld(int sig)
+{
+	int saved_errno = errno;
+	char c = 0;
+
+	IGNORE_UNUSED(sig);
+	IGNORE_RET (write(script_pipe [1], &c, 1));
+	errno = saved_errno;
+}
+
+static int
+script_readsocket(omapi_object_t *h)
+{
+	IGNORE_UNUSED(h);
+	return script_pipe [0];
+}
+
+/* Called when SIGCHLD has been caught: collect the scripts that have
+   finished and start any that can now run. */
+static isc_result_t
+script_children(omapi_object_t *h)
+{
+	struct script_job *job, **jpp;
+	char buf [64];
+	int wstatus;
+
+	IGNORE_UNUSED(h);
+	while (read(script_pipe [0], buf, sizeof buf) > 0)
+		;
+
+	jpp = &script_queue;
+	while ((job = *jpp) != NULL) {
+		if (job -> pid > 0 &&
+		    script_reap(job -> pid, WNOHANG, &wstatus)) {
+			script_done(job, wstatus);
+			*jpp = job -> next;
+			script_job_free(job);
+			continue;
+		}
+		jpp = &job -> next;
+	}
+	script_run_queue();
+	return ISC_R_SUCCESS;
+}
+
+static void
+script_setup(void)
+{
+	struct sigaction sa;
+	isc_result_t status;
+	int i;
+
+	if (pipe(script_pipe) < 0)
+		log_fatal("Can't create script pipe: %m");
+	for (i = 0; i < 2; i++) {
+		if (fcntl(script_pipe [i], F_SETFD, FD_CLOEXEC) < 0 ||
+		    fcntl(script_pipe [i], F_SETFL, O_NONBLOCK) < 0)
+			log_fatal("Can't set up script pipe: %m");
+	}
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = script_sigchld;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	if (sigaction(SIGCHLD, &sa, NULL) < 0)
+		log_fatal("Can't catch SIGCHLD: %m");
+
+	status = omapi_object_type_register(&script_type, "script",
+					    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+					    sizeof(*script_object),
+					    0, RC_MISC);
+	if (status != ISC_R_SUCCESS)
+		log_fatal("Can't register script type: %s",
+			  isc_result_totext(status));
+	status = omapi_object_allocate(&script_object, script_type, 0, MDL);
+	if (status != ISC_R_SUCCESS)
+		log_fatal("Can't allocate script object: %s",
+			  isc_result_totext(status));
+	status = omapi_register_io_object(script_object, script_readsocket,
+					  0, script_children, 0, 0);
+	if (status != ISC_R_SUCCESS)
+		log_fatal("Can't register script handle: %s",
+			  isc_result_totext(status));
+}
+
+/**
+ * @brief Calls external script without waiting for it.
+ *
+ * For events whose exit status doesn't matter.  Unless --script-jobs
+ * was given, this is the same as @ref script_go.
+ *
+ * @param client specifies client information
+ * @return The exit status from @ref script_go if the script was run
+ *         straight away, otherwise zero.
+ */
+int script_go_async(struct client_state *client)
+{
+	struct script_job *job, *last = NULL, **jpp;
+
+	if (script_jobs <= 0 || client == NULL)
+		return script_go(client);
+
+	if (script_pipe [0] == -1)
+		script_setup();
+
+	for (jpp = &script_queue; *jpp; jpp = &(*jpp) -> next)
+		if ((*jpp) -> client == client)
+			last = *jpp;
+
+	if (last && last -> pid == 0 &&
+	    script_same_event(last -> env, client -> env)) {
+		script_free_env(last -> env);
+		job = last;
+	} else {
+		job = dmalloc (sizeof *job, MDL);
+		if (job == NULL) {
+			log_error ("No memory to queue client script.");
+			return script_go(client);
+		}
+		job -> client = client;
+		*jpp = job;
+	}
+	job -> env = client -> env;
+	job -> envc = client -> envc;
+	client -> env = (struct string_list *)0;
+	client -> envc = 0;
+
+	script_run_queue();
+	return 0;
+}
+
 void client_envadd (struct client_state *client,
 		    const char *prefix, const char *name, const char *fmt, ...)
 {
@@ -5086,6 +5510,7 @@ isc_result_t dhcp_set_control_state (control_object_state_t oldstate,
 		    return ISC_R_SUCCESS;
 
 		  case server_running:
+		  case server_reload:
 		    return ISC_R_SUCCESS;
 
 		  case server_shutdown:
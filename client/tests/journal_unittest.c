@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+#include <atf-c.h>
+#include <omapip/omapip_p.h>
+#include "dhcpd.h"
+#include <sys/stat.h>
+
+/*
+ * Tests for the compaction of the lease file.  One interface with one
+ * active lease is set up, and that lease is written to the file over
+ * and over, as it would be at each renewal, until the file is
+ * rewritten with just the one lease in it.
+ */
+
+#define JOURNAL_TEST_DB		"journal_test.leases"
+#define JOURNAL_TEST_NEW	JOURNAL_TEST_DB ".new"
+
+static struct client_state *
+setup(void) {
+	struct interface_info *ip;
+	struct client_state *client;
+	struct client_lease *lease;
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+	initialize_common_option_spaces();
+
+	path_dhclient_db = JOURNAL_TEST_DB;
+	unlink(JOURNAL_TEST_DB);
+	rmdir(JOURNAL_TEST_NEW);
+	unlink(JOURNAL_TEST_NEW);
+
+	ip = dmalloc(sizeof(*ip), MDL);
+	client = dmalloc(sizeof(*client), MDL);
+	lease = dmalloc(sizeof(*lease), MDL);
+	ATF_REQUIRE(ip != NULL && client != NULL && lease != NULL);
+	ATF_REQUIRE(option_state_allocate(&lease->options, MDL));
+
+	strcpy(ip->name, "eth0");
+	ip->client = client;
+	client->interface = ip;
+	client->active = lease;
+
+	lease->address.len = 4;
+	memcpy(lease->address.iabuf, "\300\000\002\012", 4);
+	lease->renewal = cur_time + 1800;
+	lease->rebind = cur_time + 3150;
+	lease->expiry = cur_time + 3600;
+
+	interfaces = ip;
+	return (client);
+}
+
+/* The number of leases in the lease file. */
+static int
+count_leases(void) {
+	char buf[256];
+	FILE *f;
+	int count = 0;
+
+	f = fopen(JOURNAL_TEST_DB, "r");
+	ATF_REQUIRE(f != NULL);
+	while (fgets(buf, sizeof(buf), f) != NULL)
+		if (strcmp(buf, "lease {\n") == 0)
+			count++;
+	fclose(f);
+	return (count);
+}
+
+static ino_t
+file_inode(const char *path) {
+	struct stat st;
+
+	ATF_REQUIRE(stat(path, &st) == 0);
+	return (st.st_ino);
+}
+
+/* Renew the lease until the file is one write short of compaction. */
+static void
+fill_journal(struct client_state *client) {
+	int i;
+
+	for (i = 0; i <= MIN_LEASE_JOURNAL; i++)
+		ATF_REQUIRE(write_client_lease(client, client->active, 0, 0));
+	ATF_REQUIRE_EQ(count_leases(), MIN_LEASE_JOURNAL + 1);
+}
+
+ATF_TC(journal_compact);
+
+ATF_TC_HEAD(journal_compact, tc) {
+	atf_tc_set_md_var(tc, "descr", "The lease file is replaced by a "
+			  "compacted one once it's full.");
+}
+
+ATF_TC_BODY(journal_compact, tc) {
+	struct client_state *client;
+	ino_t ino;
+
+	client = setup();
+	fill_journal(client);
+	ino = file_inode(JOURNAL_TEST_DB);
+
+	/* The next write compacts the file to the one active lease, and
+	   then appends the lease it was asked to write. */
+	ATF_REQUIRE(write_client_lease(client, client->active, 0, 0));
+	ATF_CHECK_EQ(count_leases(), 2);
+
+	/* The new file was moved over the old one. */
+	ATF_CHECK(file_inode(JOURNAL_TEST_DB) != ino);
+	ATF_CHECK(access(JOURNAL_TEST_NEW, F_OK) < 0);
+
+	/* And appending to it carries on where it left off. */
+	ATF_REQUIRE(write_client_lease(client, client->active, 0, 0));
+	ATF_CHECK_EQ(count_leases(), 3);
+
+	unlink(JOURNAL_TEST_DB);
+}
+
+ATF_TC(journal_compact_in_place);
+
+ATF_TC_HEAD(journal_compact_in_place, tc) {
+	atf_tc_set_md_var(tc, "descr", "The lease file is compacted in place "
+			  "if the new file can't be made.");
+}
+
+ATF_TC_BODY(journal_compact_in_place, tc) {
+	struct client_state *client;
+	ino_t ino;
+
+	client = setup();
+	fill_journal(client);
+	ino = file_inode(JOURNAL_TEST_DB);
+
+	/* A directory where the new file would go can't be written. */
+	ATF_REQUIRE(mkdir(JOURNAL_TEST_NEW, 0755) == 0);
+
+	ATF_REQUIRE(write_client_lease(client, client->active, 0, 0));
+	ATF_CHECK_EQ(count_leases(), 2);
+	ATF_CHECK(file_inode(JOURNAL_TEST_DB) == ino);
+
+	rmdir(JOURNAL_TEST_NEW);
+	unlink(JOURNAL_TEST_DB);
+}
+
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, journal_compact);
+	ATF_TP_ADD_TC(tp, journal_compact_in_place);
+
+	return (atf_no_error());
+}
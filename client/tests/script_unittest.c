@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+#include <atf-c.h>
+#include <omapip/omapip_p.h>
+#include "dhcpd.h"
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/*
+ * Tests for the scripts dhclient runs in the background with
+ * --script-jobs.  The client script used here appends its reason, its
+ * tag and, for the tests that look at coalescing, its address to a log
+ * file, and then sleeps for as many seconds as it is told to.
+ */
+
+#define SCRIPT_TEST_SCRIPT	"script_test.sh"
+#define SCRIPT_TEST_LOG		"script_test.log"
+
+static char script_name[] = "./" SCRIPT_TEST_SCRIPT;
+
+static void
+setup(int jobs) {
+	FILE *f;
+
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+
+	f = fopen(SCRIPT_TEST_SCRIPT, "w");
+	ATF_REQUIRE(f != NULL);
+	fprintf(f, "#!/bin/sh\n"
+		   "echo \"$reason $tag $old_ip_address\" >> %s\n"
+		   "if [ \"$delay\" != 0 ]; then /bin/sleep $delay; fi\n"
+		   "exit 0\n", SCRIPT_TEST_LOG);
+	fclose(f);
+	ATF_REQUIRE(chmod(SCRIPT_TEST_SCRIPT, 0755) == 0);
+	unlink(SCRIPT_TEST_LOG);
+
+	script_jobs = jobs;
+}
+
+static struct client_state *
+new_client(void) {
+	struct client_state *client;
+	struct client_config *config;
+
+	client = dmalloc(sizeof(*client), MDL);
+	config = dmalloc(sizeof(*config), MDL);
+	ATF_REQUIRE(client != NULL && config != NULL);
+	config->script_name = script_name;
+	client->config = config;
+	return (client);
+}
+
+/* Set up the environment for an event, as script_init() would. */
+static void
+event(struct client_state *client, const char *reason, const char *tag,
+      const char *address, int delay) {
+	client_envadd(client, "", "reason", "%s", reason);
+	client_envadd(client, "", "tag", "%s", tag);
+	client_envadd(client, "old_", "ip_address", "%s", address);
+	client_envadd(client, "", "delay", "%d", delay);
+}
+
+/* Read the log into buf, and return the number of lines in it. */
+static int
+read_log(char *buf, size_t len) {
+	FILE *f;
+	size_t n;
+	int i, lines;
+
+	buf[0] = '\0';
+	f = fopen(SCRIPT_TEST_LOG, "r");
+	if (f == NULL)
+		return (0);
+	n = fread(buf, 1, len - 1, f);
+	fclose(f);
+	buf[n] = '\0';
+	for (i = lines = 0; buf[i] != '\0'; i++)
+		if (buf[i] == '\n')
+			lines++;
+	return (lines);
+}
+
+/* Wait, for at most ten seconds, until the log has this many lines. */
+static void
+wait_for_log(int lines) {
+	char buf[1024];
+	int i;
+
+	for (i = 0; i < 100 && read_log(buf, sizeof(buf)) < lines; i++)
+		usleep(100000);
+	ATF_REQUIRE_EQ(read_log(buf, sizeof(buf)), lines);
+}
+
+/* Whether there are no children left, running or waiting to be reaped. */
+static int
+no_children(void) {
+	siginfo_t info;
+
+	return (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) < 0 &&
+		errno == ECHILD);
+}
+
+ATF_TC(script_queue);
+ATF_TC_HEAD(script_queue, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify queued scripts don't hold up "
+			  "the caller, and run in order for each client");
+}
+
+ATF_TC_BODY(script_queue, tc)
+{
+	struct client_state *client;
+	char buf[1024];
+	time_t start;
+
+	setup(2);
+	client = new_client();
+
+	start = time(NULL);
+	event(client, "EXPIRE", "one", "192.0.2.1", 2);
+	ATF_CHECK_EQ(script_go_async(client), 0);
+	event(client, "FAIL", "two", "192.0.2.1", 0);
+	ATF_CHECK_EQ(script_go_async(client), 0);
+	ATF_CHECK(time(NULL) - start < 2);
+
+	/* The second script for the client waits for the first, even
+	   though the limit would let it run. */
+	wait_for_log(1);
+	ATF_CHECK_EQ(read_log(buf, sizeof(buf)), 1);
+
+	/* A script whose status is used runs after the queued ones. */
+	event(client, "BOUND", "three", "192.0.2.1", 0);
+	ATF_CHECK_EQ(script_go(client), 0);
+	ATF_CHECK_EQ(read_log(buf, sizeof(buf)), 3);
+	ATF_CHECK_STREQ(buf, "EXPIRE one 192.0.2.1\n"
+			     "FAIL two 192.0.2.1\n"
+			     "BOUND three 192.0.2.1\n");
+	ATF_CHECK(no_children());
+}
+
+ATF_TC(script_coalesce);
+ATF_TC_HEAD(script_coalesce, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify a queued event is replaced by "
+			  "a new one for the same reason and addresses");
+}
+
+ATF_TC_BODY(script_coalesce, tc)
+{
+	struct client_state *client;
+	char buf[1024];
+
+	setup(1);
+	client = new_client();
+
+	/* The first script runs straight away, and the rest wait. */
+	event(client, "FAIL", "running", "", 1);
+	script_go_async(client);
+	event(client, "EXPIRE", "first", "192.0.2.1", 0);
+	script_go_async(client);
+	event(client, "EXPIRE", "second", "192.0.2.1", 0);
+	script_go_async(client);
+	event(client, "EXPIRE", "other", "192.0.2.2", 0);
+	script_go_async(client);
+
+	script_wait(client);
+	ATF_CHECK_EQ(read_log(buf, sizeof(buf)), 3);
+	ATF_CHECK_STREQ(buf, "FAIL running \n"
+			     "EXPIRE second 192.0.2.1\n"
+			     "EXPIRE other 192.0.2.2\n");
+	ATF_CHECK(no_children());
+}
+
+ATF_TC(script_reap);
+ATF_TC_HEAD(script_reap, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify the dispatcher reaps finished "
+			  "scripts and starts the ones waiting for them");
+}
+
+ATF_TC_BODY(script_reap, tc)
+{
+	struct client_state *a, *b;
+	struct timeval deadline;
+	char buf[1024];
+	int i;
+
+	setup(1);
+	a = new_client();
+	b = new_client();
+
+	event(a, "EXPIRE", "a", "192.0.2.1", 0);
+	script_go_async(a);
+	event(b, "EXPIRE", "b", "192.0.2.2", 0);
+	script_go_async(b);
+
+	/* Until the first script is reaped the limit keeps the second
+	   one from starting. */
+	wait_for_log(1);
+	usleep(200000);
+	ATF_CHECK_EQ(read_log(buf, sizeof(buf)), 1);
+	ATF_CHECK(!no_children());
+
+	for (i = 0; i < 100; i++) {
+		gettimeofday(&deadline, NULL);
+		deadline.tv_usec += 100000;
+		if (deadline.tv_usec >= 1000000) {
+			deadline.tv_sec++;
+			deadline.tv_usec -= 1000000;
+		}
+		omapi_one_dispatch(NULL, &deadline);
+		if (read_log(buf, sizeof(buf)) == 2 && no_children())
+			break;
+	}
+	ATF_CHECK_STREQ(buf, "EXPIRE a 192.0.2.1\n"
+			     "EXPIRE b 192.0.2.2\n");
+	ATF_CHECK(no_children());
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, script_queue);
+	ATF_TP_ADD_TC(tp, script_coalesce);
+	ATF_TP_ADD_TC(tp, script_reap);
+	return (atf_no_error());
+}
@@ -242,6 +242,76 @@ struct bpf_insn *bpf_fddi_filter = NULL;
 #endif
 
 int dhcp_bpf_filter_len = sizeof dhcp_bpf_filter / sizeof (struct bpf_insn);
+
+/* Networks that the giaddr of a relayed packet must be in for the
+   receive filter to pass it, as pairs of address and netmask in host
+   byte order.  The server sets these from its subnets when it is asked
+   to drop packets from unknown relays.  With none, the filter doesn't
+   look at the giaddr. */
+u_int32_t *dhcp_bpf_giaddrs = NULL;
+int dhcp_bpf_giaddr_count = 0;
+
+#if !defined (BPF_MAXINSNS)
+# define BPF_MAXINSNS 512
+#endif
+
+/*
+ * Build a receive filter that runs the fixed filter base and then drops
+ * relayed packets whose giaddr is in none of dhcp_bpf_giaddrs.  The
+ * accept at the end of base becomes a jump over its drop to the giaddr
+ * checks.  The giaddr is found from the UDP port load in base, so the
+ * link layer header may be of any length.
+ *
+ * Returns the new program, which the caller frees once it is installed,
+ * and its length in *len; or NULL to use base as it is.
+ */
+struct bpf_insn *
+dhcp_bpf_giaddr_filter(const struct bpf_insn *base, int base_len, int *len) {
+	struct bpf_insn *prog, *insn;
+	u_int32_t giaddr;
+	int i;
+
+	if (dhcp_bpf_giaddr_count == 0)
+		return NULL;
+	*len = base_len + 5 + 4 * dhcp_bpf_giaddr_count;
+	if (*len > BPF_MAXINSNS) {
+		log_info("Too many subnets to check giaddrs in the packet "
+			 "filter; they are checked as packets are read.");
+		return NULL;
+	}
+	prog = dmalloc(*len * sizeof(*prog), MDL);
+	if (prog == NULL) {
+		log_error("No memory for the giaddr packet filter.");
+		return NULL;
+	}
+
+	/* The fixed part, down to its final accept and drop. */
+	memcpy(prog, base, (base_len - 2) * sizeof(*prog));
+	insn = prog + base_len - 2;
+	*insn++ = (struct bpf_insn)BPF_JUMP(BPF_JMP + BPF_JA, 1, 0, 0);
+	*insn++ = (struct bpf_insn)BPF_STMT(BPF_RET + BPF_K, 0);
+
+	/* A packet with no giaddr wasn't relayed. */
+	giaddr = prog[7].k + (8 + offsetof(struct dhcp_packet, giaddr) - 2);
+	*insn++ = (struct bpf_insn)BPF_STMT(BPF_LD + BPF_W + BPF_IND, giaddr);
+	*insn++ = (struct bpf_insn)BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+					    0, 0, 1);
+	*insn++ = (struct bpf_insn)BPF_STMT(BPF_RET + BPF_K, (u_int)-1);
+	*insn++ = (struct bpf_insn)BPF_STMT(BPF_ST, 0);
+
+	for (i = 0; i < dhcp_bpf_giaddr_count; i++) {
+		*insn++ = (struct bpf_insn)BPF_STMT(BPF_LD + BPF_MEM, 0);
+		*insn++ = (struct bpf_insn)BPF_STMT(BPF_ALU + BPF_AND + BPF_K,
+						    dhcp_bpf_giaddrs[2*i + 1]);
+		*insn++ = (struct bpf_insn)BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+						    dhcp_bpf_giaddrs[2*i],
+						    0, 1);
+		*insn++ = (struct bpf_insn)BPF_STMT(BPF_RET + BPF_K,
+						    (u_int)-1);
+	}
+	*insn++ = (struct bpf_insn)BPF_STMT(BPF_RET + BPF_K, 0);
+	return prog;
+}
 #if defined (HAVE_TR_SUPPORT)
 struct bpf_insn dhcp_bpf_tr_filter [] = {
         /* accept all token ring packets due to variable length header */
@@ -260,18 +330,16 @@ int dhcp_bpf_tr_filter_len = (sizeof dhcp_bpf_tr_filter /
 #endif /* USE_LPF_RECEIVE || USE_BPF_RECEIVE */
 
 #if defined (USE_BPF_RECEIVE)
+static void bpf_filter_setup (struct interface_info *);
+
 void if_register_receive (info)
 	struct interface_info *info;
 {
 	int flag = 1;
 	struct bpf_version v;
-	struct bpf_program p;
 #ifdef NEED_OSF_PFILT_HACKS
 	u_int32_t bits;
 #endif
-#ifdef DEC_FDDI
-	int link_layer;
-#endif /* DEC_FDDI */
 
 	/* Open a BPF device and hang it on this interface... */
 	info -> rfdesc = if_register_bpf (info);
@@ -315,6 +383,36 @@ void if_register_receive (info)
 	info -> rbuf_offset = 0;
 	info -> rbuf_len = 0;
 
+	bpf_filter_setup (info);
+
+	if (!quiet_interface_discovery)
+		log_info ("Listening on BPF/%s/%s%s%s",
+		      info -> name,
+		      print_hw_addr (info -> hw_address.hbuf [0],
+				     info -> hw_address.hlen - 1,
+				     &info -> hw_address.hbuf [1]),
+		      (info -> shared_network ? "/" : ""),
+		      (info -> shared_network ?
+		       info -> shared_network -> name : ""));
+}
+
+/* Install the filter again, after the server's subnets have changed. */
+void if_refresh_receive_filter (info)
+	struct interface_info *info;
+{
+	bpf_filter_setup (info);
+}
+
+static void bpf_filter_setup (info)
+	struct interface_info *info;
+{
+	struct bpf_program p;
+	struct bpf_insn *giaddr_filter;
+	int giaddr_len;
+#ifdef DEC_FDDI
+	int link_layer;
+#endif /* DEC_FDDI */
+
 	/* Set up the bpf filter program structure. */
 	p.bf_len = dhcp_bpf_filter_len;
 
@@ -362,17 +460,18 @@ void if_register_receive (info)
 #endif
 	p.bf_insns [8].k = ntohs (local_port);
 
+	/* Add the server's check of relayed packets' giaddrs, if any. */
+	giaddr_filter = dhcp_bpf_giaddr_filter (p.bf_insns, p.bf_len,
+						&giaddr_len);
+	if (giaddr_filter) {
+		p.bf_insns = giaddr_filter;
+		p.bf_len = giaddr_len;
+	}
+
 	if (ioctl (info -> rfdesc, BIOCSETF, &p) < 0)
 		log_fatal ("Can't install packet filter program: %m");
-	if (!quiet_interface_discovery)
-		log_info ("Listening on BPF/%s/%s%s%s",
-		      info -> name,
-		      print_hw_addr (info -> hw_address.hbuf [0],
-				     info -> hw_address.hlen - 1,
-				     &info -> hw_address.hbuf [1]),
-		      (info -> shared_network ? "/" : ""),
-		      (info -> shared_network ?
-		       info -> shared_network -> name : ""));
+	if (giaddr_filter)
+		dfree (giaddr_filter, MDL);
 }
 
 void if_deregister_receive (info)
@@ -449,7 +449,8 @@ isc_result_t dhcp_control_set_value  (omapi_object_t *h,
 		if (status != ISC_R_SUCCESS)
 			return status;
 		status = dhcp_set_control_state (control -> state, newstate);
-		if (status == ISC_R_SUCCESS)
+		/* A reload is an action; the server stays in its state. */
+		if (status == ISC_R_SUCCESS && newstate != server_reload)
 			control -> state = value -> u.integer;
 		return status;
 	}
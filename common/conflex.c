@@ -37,6 +37,43 @@ static enum dhcp_token read_string (struct parse *);
 static enum dhcp_token read_number (int, struct parse *);
 static enum dhcp_token read_num_or_name (int, struct parse *);
 static enum dhcp_token intern (char *, enum dhcp_token);
+static void new_line(struct parse *);
+static void skip_chars(struct parse *, size_t);
+
+/*
+ * Character classes for scanning runs of characters straight out of
+ * the input buffer.  These match what isspace() and isalnum() etc.
+ * give for ASCII; outside ASCII only LC_STRING is used.
+ */
+#define LC_SPACE	1	/* isspace() */
+#define LC_NAME		2	/* isalnum(), '-' or '_' */
+#define LC_HEX		4	/* isxdigit() */
+#define LC_STRING	8	/* anything in a string but '"' and '\\' */
+
+static u_int8_t lex_class[256];
+static int lex_class_ready = 0;
+
+static void
+lex_class_init(void) {
+	int c;
+
+	for (c = 0; c < 256; c++) {
+		if (!isascii(c)) {
+			if (c != 0xff)
+				lex_class[c] = LC_STRING;
+			continue;
+		}
+		if (isspace(c))
+			lex_class[c] |= LC_SPACE;
+		if (isalnum(c) || c == '-' || c == '_')
+			lex_class[c] |= LC_NAME;
+		if (isxdigit(c))
+			lex_class[c] |= LC_HEX;
+		if (c != '"' && c != '\\')
+			lex_class[c] |= LC_STRING;
+	}
+	lex_class_ready = 1;
+}
 
 isc_result_t new_parse (cfile, file, inbuf, buflen, name, eolp)
 	struct parse **cfile;
@@ -54,6 +91,9 @@ isc_result_t new_parse (cfile, file, inbuf, buflen, name, eolp)
 		return (ISC_R_NOMEMORY);
 	}
 
+	if (!lex_class_ready)
+		lex_class_init();
+
 	/*
 	 * We don't need to initialize things to zero here, since
 	 * dmalloc() returns memory that is set to zero.
@@ -201,16 +241,7 @@ static int get_char (cfile)
 
 	if (!cfile->ugflag) {
 		if (c == EOL) {
-			if (cfile->cur_line == cfile->line1) {
-				cfile->cur_line = cfile->line2;
-				cfile->prev_line = cfile->line1;
-			} else {
-				cfile->cur_line = cfile->line1;
-				cfile->prev_line = cfile->line2;
-			}
-			cfile->line++;
-			cfile->lpos = 1;
-			cfile->cur_line [0] = 0;
+			new_line(cfile);
 		} else if (c != EOF) {
 			if (cfile->lpos <= 80) {
 				cfile->cur_line [cfile->lpos - 1] = c;
@@ -223,6 +254,89 @@ static int get_char (cfile)
 	return c;
 }
 
+/*
+ * Start a new line: the current line becomes the previous one.
+ */
+static void
+new_line(struct parse *cfile) {
+	if (cfile->cur_line == cfile->line1) {
+		cfile->cur_line = cfile->line2;
+		cfile->prev_line = cfile->line1;
+	} else {
+		cfile->cur_line = cfile->line1;
+		cfile->prev_line = cfile->line2;
+	}
+	cfile->line++;
+	cfile->lpos = 1;
+	cfile->cur_line [0] = 0;
+}
+
+/*
+ * Move past n characters of the input buffer that the caller has
+ * already looked at, doing the same line and position bookkeeping that
+ * get_char() would have done had they been read one at a time.
+ */
+static void
+skip_chars(struct parse *cfile, size_t n) {
+	const char *p = cfile->inbuf + cfile->bufix;
+	const char *end = p + n;
+	const char *nl;
+	size_t len, room;
+
+	cfile->bufix += n;
+
+	/* The first character may have been put back, in which case it
+	   has already been accounted for. */
+	if (cfile->ugflag && p < end) {
+		cfile->ugflag = 0;
+		p++;
+	}
+
+	while (p < end) {
+		nl = memchr(p, EOL, end - p);
+		len = (nl != NULL ? nl : end) - p;
+		if (len > 0) {
+			if (cfile->lpos <= 80) {
+				room = 81 - cfile->lpos;
+				if (room > len)
+					room = len;
+				memcpy(cfile->cur_line + cfile->lpos - 1,
+				       p, room);
+				cfile->cur_line [cfile->lpos - 1 + room] = 0;
+			}
+			cfile->lpos += len;
+			p += len;
+		}
+		if (nl != NULL) {
+			new_line(cfile);
+			p++;
+		}
+	}
+}
+
+/*
+ * Count the characters of class cls at the read position.  Sets *endp
+ * if the run stops before the end of the buffer, i.e. we have seen the
+ * character that ends it.  Like the character at a time readers, the
+ * callers read that character and put it back, so that it is counted
+ * in the line position.  When the run reaches the end of the buffer
+ * the callers fall back to reading a character at a time, which deals
+ * with end of file and with buffers that can grow (LDAP).
+ */
+static size_t
+scan_run(struct parse *cfile, int cls, int *endp) {
+	const unsigned char *p, *start, *end;
+
+	start = (const unsigned char *)cfile->inbuf + cfile->bufix;
+	end = (const unsigned char *)cfile->inbuf + cfile->buflen;
+	for (p = start; p < end && (lex_class[*p] & cls); p++)
+		;
+	/* get_char() can't tell a 0xff byte from EOF, so leave those to
+	   it too. */
+	*endp = (p < end && *p != 0xff);
+	return (p - start);
+}
+
 /*
  * Return a character to our input buffer.
  */
@@ -459,6 +573,23 @@ static void skip_to_eol (cfile)
 	struct parse *cfile;
 {
 	int c;
+	const char *nl;
+
+	/* Comments are the longest runs we skip, so find the end of
+	   the line with memchr() rather than a character at a time. */
+	if (!cfile->ugflag && cfile->bufix < cfile->buflen) {
+		nl = memchr(cfile->inbuf + cfile->bufix, EOL,
+			    cfile->buflen - cfile->bufix);
+		/* get_char() returns a 0xff byte as EOF, which also ends
+		   a comment. */
+		if (nl != NULL &&
+		    memchr(cfile->inbuf + cfile->bufix, 0xff,
+			   nl - (cfile->inbuf + cfile->bufix)) == NULL) {
+			skip_chars(cfile, nl - (cfile->inbuf + cfile->bufix) + 1);
+			return;
+		}
+	}
+
 	do {
 		c = get_char (cfile);
 		if (c == EOF)
@@ -472,6 +603,31 @@ static void skip_to_eol (cfile)
 static enum dhcp_token
 read_whitespace(int c, struct parse *cfile) {
 	int ofs;
+	size_t n;
+	int ended;
+
+	/*
+	 * Take the whole run from the buffer if we can see where it ends.
+	 * A newline ends it if newlines are tokens of their own.
+	 */
+	n = scan_run(cfile, LC_SPACE, &ended);
+	if (cfile->eol_token) {
+		const char *nl = memchr(cfile->inbuf + cfile->bufix, EOL, n);
+		if (nl != NULL) {
+			n = nl - (cfile->inbuf + cfile->bufix);
+			ended = 1;
+		}
+	}
+	if (ended && n + 1 < sizeof(cfile->tokbuf)) {
+		cfile->tokbuf[0] = c;
+		memcpy(cfile->tokbuf + 1, cfile->inbuf + cfile->bufix, n);
+		skip_chars(cfile, n + 1);
+		unget_char(cfile, cfile->inbuf[cfile->bufix - 1]);
+		cfile->tokbuf[n + 1] = '\0';
+		cfile->tlen = n + 1;
+		cfile->tval = cfile->tokbuf;
+		return WHITESPACE;
+	}
 
 	/*
 	 * Read as much whitespace as we have available.
@@ -517,6 +673,21 @@ static enum dhcp_token read_string (cfile)
 	int c;
 	int value = 0;
 	int hex = 0;
+	size_t n;
+	int ended;
+
+	/* Most strings have no escapes; copy those straight from the
+	   buffer. */
+	n = scan_run(cfile, LC_STRING, &ended);
+	if (ended && cfile->inbuf[cfile->bufix + n] == '"' &&
+	    n < sizeof(cfile->tokbuf)) {
+		memcpy(cfile->tokbuf, cfile->inbuf + cfile->bufix, n);
+		skip_chars(cfile, n + 1);
+		cfile->tokbuf[n] = 0;
+		cfile->tlen = n;
+		cfile->tval = cfile->tokbuf;
+		return STRING;
+	}
 
 	for (i = 0; i < sizeof cfile -> tokbuf; i++) {
 	      again:
@@ -623,10 +794,28 @@ static enum dhcp_token read_number (c, cfile)
 {
 	int i = 0;
 	int token = NUMBER;
+	size_t n;
+	int ended, fast;
+
+	/* Every character that can continue a number, however it ends up
+	   being classified, is a name character, so when we can see the
+	   end of the run of those we can take the characters from the
+	   buffer. */
+	n = scan_run(cfile, LC_NAME, &ended);
+	fast = ended && (n + 1 < sizeof cfile -> tokbuf);
 
 	cfile -> tokbuf [i++] = c;
 	for (; i < sizeof cfile -> tokbuf; i++) {
-		c = get_char (cfile);
+		if (fast) {
+			if (i > n) {
+				skip_chars(cfile, n + 1);
+				unget_char(cfile,
+					   cfile->inbuf[cfile->bufix - 1]);
+				goto end_read;
+			}
+			c = (unsigned char)cfile->inbuf[cfile->bufix + i - 1];
+		} else
+			c = get_char (cfile);
 
 		/* Promote NUMBER -> NUMBER_OR_NAME -> NAME, never demote.
 		 * Except in the case of '0x' syntax hex, which gets called
@@ -698,6 +887,28 @@ static enum dhcp_token read_num_or_name (c, cfile)
 {
 	int i = 0;
 	enum dhcp_token rv = NUMBER_OR_NAME;
+	size_t n, j;
+	int ended;
+
+	n = scan_run(cfile, LC_NAME, &ended);
+	if (ended && n + 1 < sizeof(cfile->tokbuf)) {
+		/* As below, the first character doesn't decide whether
+		   this could be a number. */
+		cfile->tokbuf[0] = c;
+		memcpy(cfile->tokbuf + 1, cfile->inbuf + cfile->bufix, n);
+		for (j = 1; j <= n && rv != NAME; j++) {
+			if (!(lex_class[(unsigned char)cfile->tokbuf[j]] &
+			      LC_HEX))
+				rv = NAME;
+		}
+		skip_chars(cfile, n + 1);
+		unget_char(cfile, cfile->inbuf[cfile->bufix - 1]);
+		cfile->tokbuf[n + 1] = 0;
+		cfile->tlen = n + 1;
+		cfile->tval = cfile->tokbuf;
+		return intern(cfile->tval, rv);
+	}
+
 	cfile -> tokbuf [i++] = c;
 	for (; i < sizeof cfile -> tokbuf; i++) {
 		c = get_char (cfile);
@@ -720,852 +931,434 @@ static enum dhcp_token read_num_or_name (c, cfile)
 	return intern(cfile->tval, rv);
 }
 
-static enum dhcp_token
-intern(char *atom, enum dhcp_token dfv) {
-	if (!isascii(atom[0]))
-		return dfv;
+/*
+ * Keywords recognized by intern().  Matching is case insensitive;
+ * anything not in this table is returned as the default token.
+ */
+static const struct keyword {
+	const char *name;
+	enum dhcp_token token;
+} keywords[] = {
+	{ "abandoned",				TOKEN_ABANDONED },
+	{ "active",				TOKEN_ACTIVE },
+	{ "add",				TOKEN_ADD },
+	{ "address",				ADDRESS },
+	{ "after",				AFTER },
+	{ "algorithm",				ALGORITHM },
+	{ "alias",				ALIAS },
+	{ "all",				ALL },
+	{ "allow",				ALLOW },
+	{ "also",				TOKEN_ALSO },
+	{ "and",				AND },
+	{ "anycast-mac",			ANYCAST_MAC },
+	{ "append",				APPEND },
+	{ "array",				ARRAY },
+	{ "at",					AT },
+	{ "atsfp",				ATSFP },
+	{ "authenticated",			AUTHENTICATED },
+	{ "authentication",			AUTHENTICATION },
+	{ "authoring-byte-order",		AUTHORING_BYTE_ORDER },
+	{ "authoritative",			AUTHORITATIVE },
+	{ "auto-partner-down",			AUTO_PARTNER_DOWN },
+	{ "backoff-cutoff",			BACKOFF_CUTOFF },
+	{ "backup",				TOKEN_BACKUP },
+	{ "balance",				BALANCE },
+	{ "big-endian",				TOKEN_BIG_ENDIAN },
+	{ "billing",				BILLING },
+	{ "binary-to-ascii",			BINARY_TO_ASCII },
+	{ "binding",				BINDING },
+	{ "boolean",				BOOLEAN },
+	{ "boot-unknown-clients",		BOOT_UNKNOWN_CLIENTS },
+	{ "booting",				BOOTING },
+	{ "bootp",				TOKEN_BOOTP },
+	{ "bound",				BOUND },
+	{ "break",				BREAK },
+	{ "case",				CASE },
+	{ "check",				CHECK },
+	{ "ciaddr",				CIADDR },
+	{ "class",				CLASS },
+	{ "client-hostname",			CLIENT_HOSTNAME },
+	{ "client-identifier",			CLIENT_IDENTIFIER },
+	{ "client-state",			CLIENT_STATE },
+	{ "client-updates",			CLIENT_UPDATES },
+	{ "clients",				CLIENTS },
+	{ "close",				TOKEN_CLOSE },
+	{ "cltt",				CLTT },
+	{ "code",				CODE },
+	{ "commit",				COMMIT },
+	{ "communications-interrupted",		COMMUNICATIONS_INTERRUPTED },
+	{ "compressed",				COMPRESSED },
+	{ "concat",				CONCAT },
+	{ "config-option",			CONFIG_OPTION },
+	{ "conflict-done",			CONFLICT_DONE },
+	{ "connect",				CONNECT },
+	{ "create",				TOKEN_CREATE },
+	{ "db-time-format",			DB_TIME_FORMAT },
+	{ "debug",				TOKEN_DEBUG },
+	{ "declines",				DECLINES },
+	{ "default",				DEFAULT },
+	{ "default-duid",			DEFAULT_DUID },
+	{ "default-lease-time",			DEFAULT_LEASE_TIME },
+	{ "define",				DEFINE },
+	{ "defined",				DEFINED },
+	{ "delete",				TOKEN_DELETE },
+	{ "deleted",				TOKEN_DELETED },
+	{ "deny",				DENY },
+	{ "disconnect",				DISCONNECT },
+	/* do-forward-update is included for historical reasons */
+	{ "do-forward-update",			DO_FORWARD_UPDATE },
+	{ "do-forward-updates",			DO_FORWARD_UPDATE },
+	{ "domain",				DOMAIN },
+	{ "domain-list",			DOMAIN_LIST },
+	{ "domain-name",			DOMAIN_NAME },
+	{ "duplicates",				DUPLICATES },
+	{ "dynamic",				DYNAMIC },
+	{ "dynamic-bootp",			DYNAMIC_BOOTP },
+	{ "dynamic-bootp-lease-cutoff",		DYNAMIC_BOOTP_LEASE_CUTOFF },
+	{ "dynamic-bootp-lease-length",		DYNAMIC_BOOTP_LEASE_LENGTH },
+	{ "else",				ELSE },
+	{ "elsif",				ELSIF },
+	{ "en",					EN },
+	{ "encapsulate",			ENCAPSULATE },
+	{ "encode-int",				ENCODE_INT },
+	{ "ends",				ENDS },
+	{ "epoch",				EPOCH },
+	{ "error",				ERROR },
+	{ "ethernet",				ETHERNET },
+	{ "eval",				EVAL },
+	{ "execute",				EXECUTE },
+	{ "exists",				EXISTS },
+	{ "expire",				EXPIRE },
+	{ "expired",				TOKEN_EXPIRED },
+	{ "expiry",				EXPIRY },
+	{ "extract-int",			EXTRACT_INT },
+	{ "failover",				FAILOVER },
+	{ "fatal",				FATAL },
+	{ "fddi",				TOKEN_FDDI },
+	{ "filename",				FILENAME },
+	{ "fixed-address",			FIXED_ADDR },
+	{ "fixed-address6",			FIXED_ADDR6 },
+	{ "fixed-prefix6",			FIXED_PREFIX6 },
+	{ "formerr",				NS_FORMERR },
+	{ "free",				TOKEN_FREE },
+	{ "function",				FUNCTION },
+	{ "get-lease-hostnames",		GET_LEASE_HOSTNAMES },
+	{ "gethostbyname",			GETHOSTBYNAME },
+	{ "gethostname",			GETHOSTNAME },
+	{ "giaddr",				GIADDR },
+	{ "group",				GROUP },
+	{ "hardware",				HARDWARE },
+	{ "hash",				HASH },
+	{ "hba",				HBA },
+	{ "help",				TOKEN_HELP },
+	{ "hex",				TOKEN_HEX },
+	{ "host",				HOST },
+	{ "host-decl-name",			HOST_DECL_NAME },
+	{ "host-identifier",			HOST_IDENTIFIER },
+	{ "hostname",				HOSTNAME },
+	{ "ia-na",				IA_NA },
+	{ "ia-pd",				IA_PD },
+	{ "ia-ta",				IA_TA },
+	{ "iaaddr",				IAADDR },
+	{ "iaprefix",				IAPREFIX },
+	{ "identifier",				IDENTIFIER },
+	{ "if",					IF },
+	{ "ignore",				IGNORE },
+	{ "include",				INCLUDE },
+	{ "infiniband",				TOKEN_INFINIBAND },
+	{ "infinite",				INFINITE },
+	{ "info",				INFO },
+	{ "initial-delay",			INITIAL_DELAY },
+	{ "initial-interval",			INITIAL_INTERVAL },
+	{ "integer",				INTEGER },
+	{ "interface",				INTERFACE },
+	{ "ip-address",				IP_ADDRESS },
+	{ "ip6-address",			IP6_ADDRESS },
+	{ "is",					IS },
+	{ "key",				KEY },
+	{ "key-algorithm",			KEY_ALGORITHM },
+	{ "known",				KNOWN },
+	{ "known-clients",			KNOWN_CLIENTS },
+	{ "lcase",				LCASE },
+	{ "lease",				LEASE },
+	{ "lease-id-format",			LEASE_ID_FORMAT },
+	{ "lease-time",				LEASE_TIME },
+	{ "lease6",				LEASE6 },
+	{ "leased-address",			LEASED_ADDRESS },
+	{ "leasequery",				LEASEQUERY },
+	{ "length",				LENGTH },
+	{ "let",				LET },
+	{ "limit",				LIMIT },
+	{ "little-endian",			TOKEN_LITTLE_ENDIAN },
+	{ "ll",					LL },
+	{ "llt",				LLT },
+	{ "load",				LOAD },
+	{ "local",				LOCAL },
+	{ "log",				LOG },
+	{ "match",				MATCH },
+	{ "max",				TOKEN_MAX },
+	{ "max-balance",			MAX_BALANCE },
+	{ "max-lease-misbalance",		MAX_LEASE_MISBALANCE },
+	{ "max-lease-ownership",		MAX_LEASE_OWNERSHIP },
+	{ "max-lease-time",			MAX_LEASE_TIME },
+	{ "max-life",				MAX_LIFE },
+	{ "max-response-delay",			MAX_RESPONSE_DELAY },
+	{ "max-transmit-idle",			MAX_TRANSMIT_IDLE },
+	{ "max-unacked-updates",		MAX_UNACKED_UPDATES },
+	{ "mclt",				MCLT },
+	{ "media",				MEDIA },
+	{ "medium",				MEDIUM },
+	{ "members",				MEMBERS },
+	{ "min-balance",			MIN_BALANCE },
+	{ "min-lease-time",			MIN_LEASE_TIME },
+	{ "min-secs",				MIN_SECS },
+	{ "my",					MY },
+	{ "nameserver",				NAMESERVER },
+	{ "netmask",				NETMASK },
+	{ "never",				NEVER },
+	{ "new",				TOKEN_NEW },
+	{ "next",				TOKEN_NEXT },
+	{ "next-server",			NEXT_SERVER },
+	{ "no",					TOKEN_NO },
+	{ "noerror",				NS_NOERROR },
+	{ "normal",				NORMAL },
+	{ "not",				TOKEN_NOT },
+	{ "notauth",				NS_NOTAUTH },
+	{ "notimp",				NS_NOTIMP },
+	{ "notzone",				NS_NOTZONE },
+	{ "null",				TOKEN_NULL },
+	{ "nxdomain",				NS_NXDOMAIN },
+	{ "nxrrset",				NS_NXRRSET },
+	{ "octal",				TOKEN_OCTAL },
+	{ "of",					OF },
+	{ "omapi",				OMAPI },
+	{ "on",					ON },
+	{ "one-lease-per-client",		ONE_LEASE_PER_CLIENT },
+	{ "open",				TOKEN_OPEN },
+	{ "option",				OPTION },
+	{ "or",					OR },
+	{ "owner",				OWNER },
+	{ "packet",				PACKET },
+	{ "parse-vendor-option",		PARSE_VENDOR_OPT },
+	{ "partner",				PARTNER },
+	{ "partner-down",			PARTNER_DOWN },
+	{ "paused",				PAUSED },
+	{ "peer",				PEER },
+	{ "pick",				PICK },
+	{ "pick-first-value",			PICK },
+	{ "pool",				POOL },
+	{ "pool6",				POOL6 },
+	{ "port",				PORT },
+	{ "potential-conflict",			POTENTIAL_CONFLICT },
+	{ "preferred-life",			PREFERRED_LIFE },
+	{ "prefix6",				PREFIX6 },
+	{ "prepend",				PREPEND },
+	{ "primary",				PRIMARY },
+	{ "primary6",				PRIMARY6 },
+	{ "pseudo",				PSEUDO },
+	{ "range",				RANGE },
+	{ "range6",				RANGE6 },
+	{ "rebind",				REBIND },
+	{ "reboot",				REBOOT },
+	{ "recontact-interval",			RECONTACT_INTERVAL },
+	{ "recover",				RECOVER },
+	{ "recover-done",			RECOVER_DONE },
+	{ "recover-wait",			RECOVER_WAIT },
+	{ "refresh",				REFRESH },
+	{ "refused",				NS_REFUSED },
+	{ "reject",				REJECT },
+	{ "release",				RELEASE },
+	{ "released",				TOKEN_RELEASED },
+	{ "remove",				REMOVE },
+	{ "renew",				RENEW },
+	{ "request",				REQUEST },
+	{ "require",				REQUIRE },
+	{ "reserved",				TOKEN_RESERVED },
+	{ "reset",				TOKEN_RESET },
+	{ "resolution-interrupted",		RESOLUTION_INTERRUPTED },
+	{ "retry",				RETRY },
+	{ "return",				RETURN },
+	{ "reverse",				REVERSE },
+	{ "rewind",				REWIND },
+	{ "script",				SCRIPT },
+	{ "search",				SEARCH },
+	{ "secondary",				SECONDARY },
+	{ "secondary6",				SECONDARY6 },
+	{ "seconds",				SECONDS },
+	{ "secret",				SECRET },
+	{ "select",				SELECT },
+	{ "select-timeout",			SELECT_TIMEOUT },
+	{ "send",				SEND },
+	{ "server",				TOKEN_SERVER },
+	{ "server-duid",			SERVER_DUID },
+	{ "server-identifier",			SERVER_IDENTIFIER },
+	{ "server-name",			SERVER_NAME },
+	{ "servfail",				NS_SERVFAIL },
+	{ "set",				TOKEN_SET },
+	{ "shared-network",			SHARED_NETWORK },
+	{ "shutdown",				SHUTDOWN },
+	{ "siaddr",				SIADDR },
+	{ "signed",				SIGNED },
+	{ "size",				SIZE },
+	{ "space",				SPACE },
+	{ "spawn",				SPAWN },
+	{ "split",				SPLIT },
+	{ "starts",				STARTS },
+	{ "startup",				STARTUP },
+	{ "state",				STATE },
+	{ "static",				STATIC },
+	{ "string",				STRING_TOKEN },
+	{ "subclass",				SUBCLASS },
+	{ "subnet",				SUBNET },
+	{ "subnet6",				SUBNET6 },
+	{ "substring",				SUBSTRING },
+	{ "suffix",				SUFFIX },
+	{ "supersede",				SUPERSEDE },
+	{ "switch",				SWITCH },
+	{ "temporary",				TEMPORARY },
+	{ "text",				TEXT },
+	{ "timeout",				TIMEOUT },
+	{ "timestamp",				TIMESTAMP },
+	{ "token-ring",				TOKEN_RING },
+	{ "transmission",			TRANSMISSION },
+	{ "tsfp",				TSFP },
+	{ "tstp",				TSTP },
+	{ "ucase",				UCASE },
+	{ "uid",				UID },
+	{ "unauthenticated",			UNAUTHENTICATED },
+	{ "unknown",				UNKNOWN },
+	{ "unknown-clients",			UNKNOWN_CLIENTS },
+	{ "unknown-state",			UNKNOWN_STATE },
+	{ "unset",				UNSET },
+	{ "unsigned",				UNSIGNED },
+	{ "update",				UPDATE },
+	{ "use-host-decl-names",		USE_HOST_DECL_NAMES },
+	{ "use-lease-addr-for-default-route",	USE_LEASE_ADDR_FOR_DEFAULT_ROUTE },
+	{ "user-class",				USER_CLASS },
+	{ "v6relay",				V6RELAY },
+	{ "v6relopt",				V6RELOPT },
+	{ "vendor",				VENDOR },
+	{ "vendor-class",			VENDOR_CLASS },
+	{ "width",				WIDTH },
+	{ "with",				WITH },
+	{ "yiaddr",				YIADDR },
+	{ "yxdomain",				NS_YXDOMAIN },
+	{ "yxrrset",				NS_YXRRSET },
+	{ "zerolen",				ZEROLEN },
+	{ "zone",				ZONE },
+};
+
+#define NUM_KEYWORDS (sizeof(keywords) / sizeof(keywords[0]))
 
-	switch (tolower((unsigned char)atom[0])) {
-	      case '-':
-		if (atom [1] == 0)
-			return MINUS;
-		break;
-
-	      case 'a':
-		if (!strcasecmp(atom + 1, "bandoned"))
-			return TOKEN_ABANDONED;
-		if (!strcasecmp(atom + 1, "ctive"))
-			return TOKEN_ACTIVE;
-		if (!strncasecmp(atom + 1, "dd", 2)) {
-			if (atom[3] == '\0')
-				return TOKEN_ADD;
-			else if (!strcasecmp(atom + 3, "ress"))
-				return ADDRESS;
-			break;
-		}
-		if (!strcasecmp(atom + 1, "fter"))
-			return AFTER;
-		if (isascii(atom[1]) &&
-		    (tolower((unsigned char)atom[1]) == 'l')) {
-			if (!strcasecmp(atom + 2, "gorithm"))
-				return ALGORITHM;
-			if (!strcasecmp(atom + 2, "ias"))
-				return ALIAS;
-			if (isascii(atom[2]) &&
-			    (tolower((unsigned char)atom[2]) == 'l')) {
-				if (atom[3] == '\0')
-					return ALL;
-				else if (!strcasecmp(atom + 3, "ow"))
-					return ALLOW;
-				break;
-			}
-			if (!strcasecmp(atom + 2, "so"))
-				return TOKEN_ALSO;
-			break;
-		}
-		if (isascii(atom[1]) &&
-		    (tolower((unsigned char)atom[1]) == 'n')) {
-			if (!strcasecmp(atom + 2, "d"))
-				return AND;
-			if (!strcasecmp(atom + 2, "ycast-mac"))
-				return ANYCAST_MAC;
-			break;
-		}
-		if (!strcasecmp(atom + 1, "ppend"))
-			return APPEND;
-		if (!strcasecmp(atom + 1, "rray"))
-			return ARRAY;
-		if (isascii(atom[1]) &&
-		    (tolower((unsigned char)atom[1]) == 't')) {
-			if (atom[2] == '\0')
-				return AT;
-			if (!strcasecmp(atom + 2, "sfp"))
-				return ATSFP;
-			break;
-		}
-		if (!strcasecmp(atom + 1, "uthoring-byte-order"))
-			return AUTHORING_BYTE_ORDER;
-		if (!strncasecmp(atom + 1, "ut", 2)) {
-			if (isascii(atom[3]) &&
-			    (tolower((unsigned char)atom[3]) == 'h')) {
-				if (!strncasecmp(atom + 4, "enticat", 7)) {
-					if (!strcasecmp(atom + 11, "ed"))
-						return AUTHENTICATED;
-					if (!strcasecmp(atom + 11, "ion"))
-						return AUTHENTICATION;
-					break;
-				}
-				if (!strcasecmp(atom + 4, "oritative"))
-					return AUTHORITATIVE;
-				break;
-			}
-			if (!strcasecmp(atom + 3, "o-partner-down"))
-				return AUTO_PARTNER_DOWN;
-			break;
-		}
-		break;
-	      case 'b':
-		if (!strcasecmp (atom + 1, "ackup"))
-			return TOKEN_BACKUP;
-		if (!strcasecmp (atom + 1, "ootp"))
-			return TOKEN_BOOTP;
-		if (!strcasecmp (atom + 1, "inding"))
-			return BINDING;
-		if (!strcasecmp (atom + 1, "inary-to-ascii"))
-			return BINARY_TO_ASCII;
-		if (!strcasecmp (atom + 1, "ackoff-cutoff"))
-			return BACKOFF_CUTOFF;
-		if (!strcasecmp (atom + 1, "ooting"))
-			return BOOTING;
-		if (!strcasecmp (atom + 1, "oot-unknown-clients"))
-			return BOOT_UNKNOWN_CLIENTS;
-		if (!strcasecmp (atom + 1, "reak"))
-			return BREAK;
-		if (!strcasecmp (atom + 1, "illing"))
-			return BILLING;
-		if (!strcasecmp (atom + 1, "oolean"))
-			return BOOLEAN;
-		if (!strcasecmp (atom + 1, "alance"))
-			return BALANCE;
-		if (!strcasecmp (atom + 1, "ound"))
-			return BOUND;
-		if (!strcasecmp(atom+1, "ig-endian")) {
-			return TOKEN_BIG_ENDIAN;
-		}
-		break;
-	      case 'c':
-		if (!strcasecmp(atom + 1, "ase"))
-			return CASE;
-		if (!strcasecmp(atom + 1, "heck"))
-			return CHECK;
-		if (!strcasecmp(atom + 1, "iaddr"))
-			return CIADDR;
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 'l') {
-			if (!strcasecmp(atom + 2, "ass"))
-				return CLASS;
-			if (!strncasecmp(atom + 2, "ient", 4)) {
-				if (!strcasecmp(atom + 6, "s"))
-					return CLIENTS;
-				if (atom[6] == '-') {
-					if (!strcasecmp(atom + 7, "hostname"))
-						return CLIENT_HOSTNAME;
-					if (!strcasecmp(atom + 7, "identifier"))
-						return CLIENT_IDENTIFIER;
-					if (!strcasecmp(atom + 7, "state"))
-						return CLIENT_STATE;
-					if (!strcasecmp(atom + 7, "updates"))
-						return CLIENT_UPDATES;
-					break;
-				}
-				break;
-			}
-			if (!strcasecmp(atom + 2, "ose"))
-				return TOKEN_CLOSE;
-			if (!strcasecmp(atom + 2, "tt"))
-				return CLTT;
-			break;
-		}
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 'o') {
-			if (!strcasecmp(atom + 2, "de"))
-				return CODE;
-			if (isascii(atom[2]) &&
-			    tolower((unsigned char)atom[2]) == 'm') {
-				if (!strcasecmp(atom + 3, "mit"))
-					return COMMIT;
-				if (!strcasecmp(atom + 3,
-						"munications-interrupted"))
-					return COMMUNICATIONS_INTERRUPTED;
-				if (!strcasecmp(atom + 3, "pressed"))
-					return COMPRESSED;
-				break;
-			}
-			if (isascii(atom[2]) &&
-			    tolower((unsigned char)atom[2]) == 'n') {
-				if (!strcasecmp(atom + 3, "cat"))
-					return CONCAT;
-				if (!strcasecmp(atom + 3, "fig-option"))
-					return CONFIG_OPTION;
-				if (!strcasecmp(atom + 3, "flict-done"))
-					return CONFLICT_DONE;
-				if (!strcasecmp(atom + 3, "nect"))
-					return CONNECT;
-				break;
-			}
-			break;
-		}
-		if (!strcasecmp(atom + 1, "reate"))
-			return TOKEN_CREATE;
-		break;
-	      case 'd':
-		if (!strcasecmp(atom + 1, "b-time-format"))
-			return DB_TIME_FORMAT;
-		if (!strcasecmp (atom + 1, "omain"))
-			return DOMAIN;
-		if (!strncasecmp (atom + 1, "omain-", 6)) {
-			if (!strcasecmp(atom + 7, "name"))
-				return DOMAIN_NAME;
-			if (!strcasecmp(atom + 7, "list"))
-				return DOMAIN_LIST;
-		}
-		if (!strcasecmp (atom + 1, "o-forward-updates"))
-			return DO_FORWARD_UPDATE;
-		/* do-forward-update is included for historical reasons */
-		if (!strcasecmp (atom + 1, "o-forward-update"))
-			return DO_FORWARD_UPDATE;
-		if (!strcasecmp (atom + 1, "ebug"))
-			return TOKEN_DEBUG;
-		if (!strcasecmp (atom + 1, "eny"))
-			return DENY;
-		if (!strcasecmp (atom + 1, "eleted"))
-			return TOKEN_DELETED;
-		if (!strcasecmp (atom + 1, "elete"))
-			return TOKEN_DELETE;
-		if (!strncasecmp (atom + 1, "efault", 6)) {
-			if (!atom [7])
-				return DEFAULT;
-			if (!strcasecmp(atom + 7, "-duid"))
-				return DEFAULT_DUID;
-			if (!strcasecmp (atom + 7, "-lease-time"))
-				return DEFAULT_LEASE_TIME;
-			break;
-		}
-		if (!strncasecmp (atom + 1, "ynamic", 6)) {
-			if (!atom [7])
-				return DYNAMIC;
-			if (!strncasecmp (atom + 7, "-bootp", 6)) {
-				if (!atom [13])
-					return DYNAMIC_BOOTP;
-				if (!strcasecmp (atom + 13, "-lease-cutoff"))
-					return DYNAMIC_BOOTP_LEASE_CUTOFF;
-				if (!strcasecmp (atom + 13, "-lease-length"))
-					return DYNAMIC_BOOTP_LEASE_LENGTH;
-				break;
-			}
-		}
-		if (!strcasecmp (atom + 1, "uplicates"))
-			return DUPLICATES;
-		if (!strcasecmp (atom + 1, "eclines"))
-			return DECLINES;
-		if (!strncasecmp (atom + 1, "efine", 5)) {
-			if (!strcasecmp (atom + 6, "d"))
-				return DEFINED;
-			if (!atom [6])
-				return DEFINE;
-		}
-		if (!strcasecmp (atom + 1, "isconnect"))
-			return DISCONNECT;
-		break;
-	      case 'e':
-		if (isascii (atom [1]) &&
-		    tolower((unsigned char)atom[1]) == 'x') {
-			if (!strcasecmp (atom + 2, "tract-int"))
-				return EXTRACT_INT;
-			if (!strcasecmp (atom + 2, "ists"))
-				return EXISTS;
-			if (!strcasecmp (atom + 2, "piry"))
-				return EXPIRY;
-			if (!strcasecmp (atom + 2, "pire"))
-				return EXPIRE;
-			if (!strcasecmp (atom + 2, "pired"))
-				return TOKEN_EXPIRED;
-		}
-		if (!strcasecmp (atom + 1, "ncode-int"))
-			return ENCODE_INT;
-		if (!strcasecmp(atom + 1, "poch"))
-			return EPOCH;
-		if (!strcasecmp (atom + 1, "thernet"))
-			return ETHERNET;
-		if (!strcasecmp (atom + 1, "nds"))
-			return ENDS;
-		if (!strncasecmp (atom + 1, "ls", 2)) {
-			if (!strcasecmp (atom + 3, "e"))
-				return ELSE;
-			if (!strcasecmp (atom + 3, "if"))
-				return ELSIF;
-			break;
-		}
-		if (!strcasecmp (atom + 1, "rror"))
-			return ERROR;
-		if (!strcasecmp (atom + 1, "val"))
-			return EVAL;
-		if (!strcasecmp (atom + 1, "ncapsulate"))
-			return ENCAPSULATE;
-		if (!strcasecmp(atom + 1, "xecute"))
-			return EXECUTE;
-		if (!strcasecmp(atom+1, "n")) {
-			return EN;
-		}
-		break;
-	      case 'f':
-		if (!strcasecmp (atom + 1, "atal"))
-			return FATAL;
-		if (!strcasecmp (atom + 1, "ilename"))
-			return FILENAME;
-		if (!strcasecmp (atom + 1, "ixed-address"))
-			return FIXED_ADDR;
-		if (!strcasecmp (atom + 1, "ixed-address6"))
-			return FIXED_ADDR6;
-		if (!strcasecmp (atom + 1, "ixed-prefix6"))
-			return FIXED_PREFIX6;
-		if (!strcasecmp (atom + 1, "ddi"))
-			return TOKEN_FDDI;
-		if (!strcasecmp (atom + 1, "ormerr"))
-			return NS_FORMERR;
-		if (!strcasecmp (atom + 1, "unction"))
-			return FUNCTION;
-		if (!strcasecmp (atom + 1, "ailover"))
-			return FAILOVER;
-		if (!strcasecmp (atom + 1, "ree"))
-			return TOKEN_FREE;
-		break;
-	      case 'g':
-		if (!strncasecmp(atom + 1, "et", 2)) {
-			if (!strcasecmp(atom + 3, "-lease-hostnames"))
-				return GET_LEASE_HOSTNAMES;
-			if (!strcasecmp(atom + 3, "hostbyname"))
-				return GETHOSTBYNAME;
-			if (!strcasecmp(atom + 3, "hostname"))
-				return GETHOSTNAME;
-			break;
-		}
-		if (!strcasecmp (atom + 1, "iaddr"))
-			return GIADDR;
-		if (!strcasecmp (atom + 1, "roup"))
-			return GROUP;
-		break;
-	      case 'h':
-		if (!strcasecmp(atom + 1, "ash"))
-			return HASH;
-		if (!strcasecmp (atom + 1, "ba"))
-			return HBA;
-		if (!strcasecmp (atom + 1, "ost"))
-			return HOST;
-		if (!strcasecmp (atom + 1, "ost-decl-name"))
-			return HOST_DECL_NAME;
-		if (!strcasecmp(atom + 1, "ost-identifier"))
-			return HOST_IDENTIFIER;
-		if (!strcasecmp (atom + 1, "ardware"))
-			return HARDWARE;
-		if (!strcasecmp (atom + 1, "ostname"))
-			return HOSTNAME;
-		if (!strcasecmp (atom + 1, "elp"))
-			return TOKEN_HELP;
-		if (!strcasecmp (atom + 1, "ex")) {
-			return TOKEN_HEX;
-		}
-		break;
-	      case 'i':
-	      	if (!strcasecmp(atom+1, "a-na"))
-			return IA_NA;
-	      	if (!strcasecmp(atom+1, "a-ta"))
-			return IA_TA;
-	      	if (!strcasecmp(atom+1, "a-pd"))
-			return IA_PD;
-	      	if (!strcasecmp(atom+1, "aaddr"))
-			return IAADDR;
-	      	if (!strcasecmp(atom+1, "aprefix"))
-			return IAPREFIX;
-		if (!strcasecmp (atom + 1, "nclude"))
-			return INCLUDE;
-		if (!strcasecmp (atom + 1, "nteger"))
-			return INTEGER;
-		if (!strcasecmp (atom  + 1, "nfiniband"))
-			return TOKEN_INFINIBAND;
-		if (!strcasecmp (atom + 1, "nfinite"))
-			return INFINITE;
-		if (!strcasecmp (atom + 1, "nfo"))
-			return INFO;
-		if (!strcasecmp (atom + 1, "p-address"))
-			return IP_ADDRESS;
-		if (!strcasecmp (atom + 1, "p6-address"))
-			return IP6_ADDRESS;
-		if (!strcasecmp (atom + 1, "nitial-interval"))
-			return INITIAL_INTERVAL;
-		if (!strcasecmp (atom + 1, "nitial-delay"))
-			return INITIAL_DELAY;
-		if (!strcasecmp (atom + 1, "nterface"))
-			return INTERFACE;
-		if (!strcasecmp (atom + 1, "dentifier"))
-			return IDENTIFIER;
-		if (!strcasecmp (atom + 1, "f"))
-			return IF;
-		if (!strcasecmp (atom + 1, "s"))
-			return IS;
-		if (!strcasecmp (atom + 1, "gnore"))
-			return IGNORE;
-		break;
-	      case 'k':
-		if (!strncasecmp (atom + 1, "nown", 4)) {
-			if (!strcasecmp (atom + 5, "-clients"))
-				return KNOWN_CLIENTS;
-			if (!atom[5])
-				return KNOWN;
-			break;
-		}
-		if (!strcasecmp (atom + 1, "ey"))
-			return KEY;
-		if (!strcasecmp (atom + 1, "ey-algorithm"))
-			return KEY_ALGORITHM;
-		break;
-	      case 'l':
-		if (!strcasecmp (atom + 1, "case"))
-			return LCASE;
-		if (!strcasecmp (atom + 1, "ease"))
-			return LEASE;
-		if (!strcasecmp(atom + 1, "ease6"))
-			return LEASE6;
-		if (!strcasecmp (atom + 1, "eased-address"))
-			return LEASED_ADDRESS;
-		if (!strcasecmp (atom + 1, "ease-time"))
-			return LEASE_TIME;
-		if (!strcasecmp(atom + 1, "easequery"))
-			return LEASEQUERY;
-		if (!strcasecmp(atom + 1, "ength"))
-			return LENGTH;
-		if (!strcasecmp (atom + 1, "imit"))
-			return LIMIT;
-		if (!strcasecmp (atom + 1, "et"))
-			return LET;
-		if (!strcasecmp (atom + 1, "oad"))
-			return LOAD;
-		if (!strcasecmp(atom + 1, "ocal"))
-			return LOCAL;
-		if (!strcasecmp (atom + 1, "og"))
-			return LOG;
-		if (!strcasecmp(atom+1, "lt")) {
-			return LLT;
-		}
-		if (!strcasecmp(atom+1, "l")) {
-			return LL;
-		}
-		if (!strcasecmp(atom+1, "ittle-endian")) {
-			return TOKEN_LITTLE_ENDIAN;
-		}
-		if (!strcasecmp (atom + 1, "ease-id-format")) {
-			return LEASE_ID_FORMAT;
-		}
-		break;
-	      case 'm':
-		if (!strncasecmp (atom + 1, "ax", 2)) {
-			if (!atom [3])
-				return TOKEN_MAX;
-			if (!strcasecmp (atom + 3, "-balance"))
-				return MAX_BALANCE;
-			if (!strncasecmp (atom + 3, "-lease-", 7)) {
-				if (!strcasecmp(atom + 10, "misbalance"))
-					return MAX_LEASE_MISBALANCE;
-				if (!strcasecmp(atom + 10, "ownership"))
-					return MAX_LEASE_OWNERSHIP;
-				if (!strcasecmp(atom + 10, "time"))
-					return MAX_LEASE_TIME;
-			}
-			if (!strcasecmp(atom + 3, "-life"))
-				return MAX_LIFE;
-			if (!strcasecmp (atom + 3, "-transmit-idle"))
-				return MAX_TRANSMIT_IDLE;
-			if (!strcasecmp (atom + 3, "-response-delay"))
-				return MAX_RESPONSE_DELAY;
-			if (!strcasecmp (atom + 3, "-unacked-updates"))
-				return MAX_UNACKED_UPDATES;
-		}
-		if (!strncasecmp (atom + 1, "in-", 3)) {
-			if (!strcasecmp (atom + 4, "balance"))
-				return MIN_BALANCE;
-			if (!strcasecmp (atom + 4, "lease-time"))
-				return MIN_LEASE_TIME;
-			if (!strcasecmp (atom + 4, "secs"))
-				return MIN_SECS;
-			break;
-		}
-		if (!strncasecmp (atom + 1, "edi", 3)) {
-			if (!strcasecmp (atom + 4, "a"))
-				return MEDIA;
-			if (!strcasecmp (atom + 4, "um"))
-				return MEDIUM;
-			break;
-		}
-		if (!strcasecmp (atom + 1, "atch"))
-			return MATCH;
-		if (!strcasecmp (atom + 1, "embers"))
-			return MEMBERS;
-		if (!strcasecmp (atom + 1, "y"))
-			return MY;
-		if (!strcasecmp (atom + 1, "clt"))
-			return MCLT;
-		break;
-	      case 'n':
-		if (!strcasecmp (atom + 1, "ormal"))
-			return NORMAL;
-		if (!strcasecmp (atom + 1, "ameserver"))
-			return NAMESERVER;
-		if (!strcasecmp (atom + 1, "etmask"))
-			return NETMASK;
-		if (!strcasecmp (atom + 1, "ever"))
-			return NEVER;
-		if (!strcasecmp (atom + 1, "ext-server"))
-			return NEXT_SERVER;
-		if (!strcasecmp (atom + 1, "ot"))
-			return TOKEN_NOT;
-		if (!strcasecmp (atom + 1, "o"))
-			return TOKEN_NO;
-		if (!strcasecmp (atom + 1, "oerror"))
-			return NS_NOERROR;
-		if (!strcasecmp (atom + 1, "otauth"))
-			return NS_NOTAUTH;
-		if (!strcasecmp (atom + 1, "otimp"))
-			return NS_NOTIMP;
-		if (!strcasecmp (atom + 1, "otzone"))
-			return NS_NOTZONE;
-		if (!strcasecmp (atom + 1, "xdomain"))
-			return NS_NXDOMAIN;
-		if (!strcasecmp (atom + 1, "xrrset"))
-			return NS_NXRRSET;
-		if (!strcasecmp (atom + 1, "ull"))
-			return TOKEN_NULL;
-		if (!strcasecmp (atom + 1, "ext"))
-			return TOKEN_NEXT;
-		if (!strcasecmp (atom + 1, "ew"))
-			return TOKEN_NEW;
-		break;
-	      case 'o':
-		if (!strcasecmp (atom + 1, "mapi"))
-			return OMAPI;
-		if (!strcasecmp (atom + 1, "r"))
-			return OR;
-		if (!strcasecmp (atom + 1, "n"))
-			return ON;
-		if (!strcasecmp (atom + 1, "pen"))
-			return TOKEN_OPEN;
-		if (!strcasecmp (atom + 1, "ption"))
-			return OPTION;
-		if (!strcasecmp (atom + 1, "ne-lease-per-client"))
-			return ONE_LEASE_PER_CLIENT;
-		if (!strcasecmp (atom + 1, "f"))
-			return OF;
-		if (!strcasecmp (atom + 1, "wner"))
-			return OWNER;
-		if (!strcasecmp (atom + 1, "ctal")) {
-			return TOKEN_OCTAL;
-		}
-		break;
-	      case 'p':
-		if (!strcasecmp (atom + 1, "arse-vendor-option"))
-			return PARSE_VENDOR_OPT;
-		if (!strcasecmp (atom + 1, "repend"))
-			return PREPEND;
-		if (!strcasecmp(atom + 1, "referred-life"))
-			return PREFERRED_LIFE;
-		if (!strcasecmp (atom + 1, "acket"))
-			return PACKET;
-		if (!strcasecmp (atom + 1, "ool"))
-			return POOL;
-		if (!strcasecmp (atom + 1, "ool6"))
-			return POOL6;
-		if (!strcasecmp (atom + 1, "refix6"))
-			return PREFIX6;
-		if (!strcasecmp (atom + 1, "seudo"))
-			return PSEUDO;
-		if (!strcasecmp (atom + 1, "eer"))
-			return PEER;
-		if (!strcasecmp (atom + 1, "rimary"))
-			return PRIMARY;
-		if (!strcasecmp (atom + 1, "rimary6"))
-			return PRIMARY6;
-		if (!strncasecmp (atom + 1, "artner", 6)) {
-			if (!atom [7])
-				return PARTNER;
-			if (!strcasecmp (atom + 7, "-down"))
-				return PARTNER_DOWN;
-		}
-		if (!strcasecmp (atom + 1, "ort"))
-			return PORT;
-		if (!strcasecmp (atom + 1, "otential-conflict"))
-			return POTENTIAL_CONFLICT;
-		if (!strcasecmp (atom + 1, "ick-first-value") ||
-		    !strcasecmp (atom + 1, "ick"))
-			return PICK;
-		if (!strcasecmp (atom + 1, "aused"))
-			return PAUSED;
-		break;
-	      case 'r':
-		if (!strcasecmp(atom + 1, "ange"))
-			return RANGE;
-		if (!strcasecmp(atom + 1, "ange6"))
-			return RANGE6;
-		if (isascii(atom[1]) &&
-		    (tolower((unsigned char)atom[1]) == 'e')) {
-			if (!strcasecmp(atom + 2, "bind"))
-				return REBIND;
-			if (!strcasecmp(atom + 2, "boot"))
-				return REBOOT;
-			if (!strcasecmp(atom + 2, "contact-interval"))
-				return RECONTACT_INTERVAL;
-			if (!strncasecmp(atom + 2, "cover", 5)) {
-				if (atom[7] == '\0')
-					return RECOVER;
-				if (!strcasecmp(atom + 7, "-done"))
-					return RECOVER_DONE;
-				if (!strcasecmp(atom + 7, "-wait"))
-					return RECOVER_WAIT;
-				break;
-			}
-			if (!strcasecmp(atom + 2, "fresh"))
-				return REFRESH;
-			if (!strcasecmp(atom + 2, "fused"))
-				return NS_REFUSED;
-			if (!strcasecmp(atom + 2, "ject"))
-				return REJECT;
-			if (!strcasecmp(atom + 2, "lease"))
-				return RELEASE;
-			if (!strcasecmp(atom + 2, "leased"))
-				return TOKEN_RELEASED;
-			if (!strcasecmp(atom + 2, "move"))
-				return REMOVE;
-			if (!strcasecmp(atom + 2, "new"))
-				return RENEW;
-			if (!strcasecmp(atom + 2, "quest"))
-				return REQUEST;
-			if (!strcasecmp(atom + 2, "quire"))
-				return REQUIRE;
-			if (isascii(atom[2]) &&
-			    (tolower((unsigned char)atom[2]) == 's')) {
-				if (!strcasecmp(atom + 3, "erved"))
-					return TOKEN_RESERVED;
-				if (!strcasecmp(atom + 3, "et"))
-					return TOKEN_RESET;
-				if (!strcasecmp(atom + 3,
-						"olution-interrupted"))
-					return RESOLUTION_INTERRUPTED;
-				break;
-			}
-			if (!strcasecmp(atom + 2, "try"))
-				return RETRY;
-			if (!strcasecmp(atom + 2, "turn"))
-				return RETURN;
-			if (!strcasecmp(atom + 2, "verse"))
-				return REVERSE;
-			if (!strcasecmp(atom + 2, "wind"))
-				return REWIND;
-			break;
-		}
-		break;
-	      case 's':
-		if (!strcasecmp(atom + 1, "cript"))
-			return SCRIPT;
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 'e') {
-			if (!strcasecmp(atom + 2, "arch"))
-				return SEARCH;
-			if (isascii(atom[2]) &&
-			    tolower((unsigned char)atom[2]) == 'c') {
-				if (!strncasecmp(atom + 3, "ond", 3)) {
-                                        if (!strcasecmp(atom + 6, "ary"))
-						return SECONDARY;
-                                        if (!strcasecmp(atom + 6, "ary6"))
-						return SECONDARY6;
-                                        if (!strcasecmp(atom + 6, "s"))
-                                                return SECONDS;
+/*
+ * intern() looks keywords up through a perfect hash: each keyword's
+ * hash picks a bucket, and each bucket has a displacement chosen so
+ * that every keyword ends up in a slot of its own.  Recognizing an
+ * atom therefore costs one pass over it and at most one comparison.
+ * The displacements depend only on the table above, so they are
+ * computed the first time intern() is called.
+ */
+#define KW_BUCKETS	128
+#define KW_SLOTS	1024	/* both must be powers of two */
+
+static u_int16_t kw_disp[KW_BUCKETS];
+static int16_t kw_slot[KW_SLOTS];
+static int kw_ready = 0;
+
+static u_int32_t
+kw_hash(const char *atom) {
+	u_int32_t h = 2166136261U;
+	const unsigned char *p;
+
+	for (p = (const unsigned char *)atom; *p != '\0'; p++) {
+		h ^= (*p >= 'A' && *p <= 'Z') ? (*p | 0x20) : *p;
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+static unsigned
+kw_slot_of(u_int32_t h, unsigned disp) {
+	h ^= disp * 0x9e3779b9U;
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	return (h & (KW_SLOTS - 1));
+}
+
+static void
+kw_init(void) {
+	u_int32_t hashes[NUM_KEYWORDS];
+	unsigned order[KW_BUCKETS], count[KW_BUCKETS];
+	unsigned slots[NUM_KEYWORDS];
+	unsigned b, i, j, k, n, disp, t;
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < NUM_KEYWORDS; i++) {
+		hashes[i] = kw_hash(keywords[i].name);
+		count[hashes[i] & (KW_BUCKETS - 1)]++;
+	}
+	for (i = 0; i < KW_SLOTS; i++)
+		kw_slot[i] = -1;
+
+	/* Place the fullest buckets first, while most slots are free. */
+	for (b = 0; b < KW_BUCKETS; b++)
+		order[b] = b;
+	for (i = 1; i < KW_BUCKETS; i++) {
+		t = order[i];
+		for (j = i; j > 0 && count[order[j - 1]] < count[t]; j--)
+			order[j] = order[j - 1];
+		order[j] = t;
+	}
+
+	for (k = 0; k < KW_BUCKETS && count[order[k]] != 0; k++) {
+		b = order[k];
+		for (disp = 1; disp < 65536; disp++) {
+			n = 0;
+			for (i = 0; i < NUM_KEYWORDS; i++) {
+				if ((hashes[i] & (KW_BUCKETS - 1)) != b)
+					continue;
+				t = kw_slot_of(hashes[i], disp);
+				if (kw_slot[t] != -1)
 					break;
-				}
-                                if (!strcasecmp(atom + 3, "ret"))
-                                        return SECRET;
-				break;
-			}
-			if (!strncasecmp(atom + 2, "lect", 4)) {
-                                if (atom[6] == '\0')
-                                        return SELECT;
-                                if (!strcasecmp(atom + 6, "-timeout"))
-                                        return SELECT_TIMEOUT;
-				break;
-			}
-                        if (!strcasecmp(atom + 2, "nd"))
-                                return SEND;
-			if (!strncasecmp(atom + 2, "rv", 2)) {
-				if (!strncasecmp(atom + 4, "er", 2)) {
-                                        if (atom[6] == '\0')
-                                                return TOKEN_SERVER;
-					if (atom[6] == '-') {
-						if (!strcasecmp(atom + 7,
-								"duid"))
-							return SERVER_DUID;
-                                                if (!strcasecmp(atom + 7,
-								"name"))
-                                                        return SERVER_NAME;
-                                                if (!strcasecmp(atom + 7,
-								"identifier"))
-                                                      return SERVER_IDENTIFIER;
+				for (j = 0; j < n; j++) {
+					if (slots[j] == t)
 						break;
-					}
-					break;
-				}
-                                if (!strcasecmp(atom + 4, "fail"))
-                                        return NS_SERVFAIL;
-				break;
-			}
-                        if (!strcasecmp(atom + 2, "t"))
-                                return TOKEN_SET;
-			break;
-		}
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 'h') {
-                        if (!strcasecmp(atom + 2, "ared-network"))
-                                return SHARED_NETWORK;
-                        if (!strcasecmp(atom + 2, "utdown"))
-                                return SHUTDOWN;
-			break;
-		}
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 'i') {
-                        if (!strcasecmp(atom + 2, "addr"))
-                                return SIADDR;
-                        if (!strcasecmp(atom + 2, "gned"))
-                                return SIGNED;
-                        if (!strcasecmp(atom + 2, "ze"))
-                                return SIZE;
-			break;
-		}
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 'p') {
-			if (isascii(atom[2]) &&
-			    tolower((unsigned char)atom[2]) == 'a') {
-                                if (!strcasecmp(atom + 3, "ce"))
-                                        return SPACE;
-                                if (!strcasecmp(atom + 3, "wn"))
-                                        return SPAWN;
-				break;
-			}
-                        if (!strcasecmp(atom + 2, "lit"))
-                                return SPLIT;
-			break;
-		}
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 't') {
-			if (isascii(atom[2]) &&
-			    tolower((unsigned char)atom[2]) == 'a') {
-				if(!strncasecmp(atom + 3, "rt", 2)) {
-                                         if (!strcasecmp(atom + 5, "s"))
-                                                 return STARTS;
-                                         if (!strcasecmp(atom + 5, "up"))
-                                                 return STARTUP;
-					break;
 				}
-				if (isascii(atom[3]) &&
-				    tolower((unsigned char)atom[3]) == 't') {
-                                        if (!strcasecmp(atom + 4, "e"))
-                                                return STATE;
-                                        if (!strcasecmp(atom + 4, "ic"))
-                                                return STATIC;
+				if (j < n)
 					break;
-				}
+				slots[n++] = t;
 			}
-                        if (!strcasecmp(atom + 2, "ring"))
-                                return STRING_TOKEN;
-			break;
-		}
-                if (!strncasecmp(atom + 1, "ub", 2)) {
-                        if (!strcasecmp(atom + 3, "class"))
-                                return SUBCLASS;
-                        if (!strcasecmp(atom + 3, "net"))
-                                return SUBNET;
-                        if (!strcasecmp(atom + 3, "net6"))
-                                return SUBNET6;
-                        if (!strcasecmp(atom + 3, "string"))
-                                return SUBSTRING;
-                        break;
-                }
-		if (isascii(atom[1]) &&
-		    tolower((unsigned char)atom[1]) == 'u') {
-                        if (!strcasecmp(atom + 2, "ffix"))
-                                return SUFFIX;
-                        if (!strcasecmp(atom + 2, "persede"))
-                                return SUPERSEDE;
-		}
-                if (!strcasecmp(atom + 1, "witch"))
-                        return SWITCH;
-		break;
-	      case 't':
-		if (!strcasecmp (atom + 1, "imestamp"))
-			return TIMESTAMP;
-		if (!strcasecmp (atom + 1, "imeout"))
-			return TIMEOUT;
-		if (!strcasecmp (atom + 1, "oken-ring"))
-			return TOKEN_RING;
-		if (!strcasecmp (atom + 1, "ext"))
-			return TEXT;
-		if (!strcasecmp (atom + 1, "stp"))
-			return TSTP;
-		if (!strcasecmp (atom + 1, "sfp"))
-			return TSFP;
-		if (!strcasecmp (atom + 1, "ransmission"))
-			return TRANSMISSION;
-		if (!strcasecmp(atom + 1, "emporary"))
-			return TEMPORARY;
-		break;
-	      case 'u':
-		if (!strcasecmp (atom + 1, "case"))
-			return UCASE;
-		if (!strcasecmp (atom + 1, "nset"))
-			return UNSET;
-		if (!strcasecmp (atom + 1, "nsigned"))
-			return UNSIGNED;
-		if (!strcasecmp (atom + 1, "id"))
-			return UID;
-		if (!strncasecmp (atom + 1, "se", 2)) {
-			if (!strcasecmp (atom + 3, "r-class"))
-				return USER_CLASS;
-			if (!strcasecmp (atom + 3, "-host-decl-names"))
-				return USE_HOST_DECL_NAMES;
-			if (!strcasecmp (atom + 3,
-					 "-lease-addr-for-default-route"))
-				return USE_LEASE_ADDR_FOR_DEFAULT_ROUTE;
-			break;
+			if (i == NUM_KEYWORDS)
+				break;
 		}
-		if (!strncasecmp (atom + 1, "nknown", 6)) {
-			if (!strcasecmp (atom + 7, "-clients"))
-				return UNKNOWN_CLIENTS;
-			if (!strcasecmp (atom + 7, "-state"))
-				return UNKNOWN_STATE;
-			if (!atom [7])
-				return UNKNOWN;
-			break;
+		if (disp == 65536)
+			log_fatal("Can't build the keyword table.");
+
+		kw_disp[b] = disp;
+		n = 0;
+		for (i = 0; i < NUM_KEYWORDS; i++) {
+			if ((hashes[i] & (KW_BUCKETS - 1)) == b)
+				kw_slot[slots[n++]] = i;
 		}
-		if (!strcasecmp (atom + 1, "nauthenticated"))
-			return UNAUTHENTICATED;
-		if (!strcasecmp (atom + 1, "pdate"))
-			return UPDATE;
-		break;
-	      case 'v':
-		if (!strcasecmp (atom + 1, "6relay"))
-			return V6RELAY;
-		if (!strcasecmp (atom + 1, "6relopt"))
-			return V6RELOPT;
-		if (!strcasecmp (atom + 1, "endor-class"))
-			return VENDOR_CLASS;
-		if (!strcasecmp (atom + 1, "endor"))
-			return VENDOR;
-		break;
-	      case 'w':
-		if (!strcasecmp (atom + 1, "ith"))
-			return WITH;
-		if (!strcasecmp(atom + 1, "idth"))
-			return WIDTH;
-		break;
-	      case 'y':
-		if (!strcasecmp (atom + 1, "iaddr"))
-			return YIADDR;
-		if (!strcasecmp (atom + 1, "xdomain"))
-			return NS_YXDOMAIN;
-		if (!strcasecmp (atom + 1, "xrrset"))
-			return NS_YXRRSET;
-		break;
-	      case 'z':
-		if (!strcasecmp (atom + 1, "erolen"))
-			return ZEROLEN;
-		if (!strcasecmp (atom + 1, "one"))
-			return ZONE;
-		break;
 	}
+	kw_ready = 1;
+}
+
+static enum dhcp_token
+intern(char *atom, enum dhcp_token dfv) {
+	u_int32_t h;
+	int16_t i;
+
+	if (!isascii(atom[0]))
+		return dfv;
+
+	if (!kw_ready)
+		kw_init();
+
+	h = kw_hash(atom);
+	i = kw_slot[kw_slot_of(h, kw_disp[h & (KW_BUCKETS - 1)])];
+	if (i >= 0 && !strcasecmp(atom, keywords[i].name))
+		return keywords[i].token;
 	return dfv;
 }
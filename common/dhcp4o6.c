@@ -26,14 +26,22 @@
  */
 
 #include "dhcpd.h"
+#include <sys/uio.h>
+#if defined (DHCP4o6_RING)
+#include <sys/mman.h>
+#endif
 
 #ifdef DHCP4o6
 
 int dhcp4o6_fd = -1;
 omapi_object_t *dhcp4o6_object = NULL;
 omapi_object_type_t *dhcp4o6_type = NULL;
+const char *dhcp4o6_ring_file = NULL;
 
 static int dhcp4o6_readsocket(omapi_object_t *);
+#if defined (DHCP4o6_RING)
+static void dhcp4o6_ring_setup(void);
+#endif
 
 /*
  * DHCPv4 over DHCPv6 Inter Process Communication setup
@@ -107,10 +115,273 @@ void dhcp4o6_setup(u_int16_t port) {
 	if (status != ISC_R_SUCCESS)
 		log_fatal("Can't register dhcp4o6 handle: %s",
 			  isc_result_totext(status));
+
+#if defined (DHCP4o6_RING)
+	if (dhcp4o6_ring_file != NULL)
+		dhcp4o6_ring_setup();
+#endif
 }
 
 static int dhcp4o6_readsocket(omapi_object_t *h) {
 	IGNORE_UNUSED(h);
 	return dhcp4o6_fd;
 }
+
+#if defined (DHCP4o6_RING)
+/*
+ * Shared memory rings
+ *
+ * When both sides are given the same file with -4o6-ring, it is mapped
+ * into both processes and holds a ring of messages in each direction.
+ * A message is put on the ring rather than sent on the socket, and the
+ * socket only carries a short doorbell when the ring was empty, so a
+ * side that is kept busy takes a whole burst of messages for one wakeup
+ * and the messages are never copied through the kernel.  When a ring is
+ * full the message goes on the socket as before.
+ *
+ * Each ring has a count of the bytes ever put on it, which only the
+ * sending side changes, and a count of the bytes taken off it, which
+ * only the receiving side changes, so either side can be restarted
+ * while the other runs.  A message is a four byte length, in host
+ * order, followed by the message padded to a multiple of four bytes.
+ *
+ * A side only puts messages on a ring once the other side has marked
+ * it ready, so a server paired with one that wasn't given -4o6-ring
+ * keeps using the socket.  The doorbell holds the magic number and the
+ * file's cookie, so that a server that is sent a doorbell for a ring it
+ * doesn't read, because it has no ring or another file, can say so.
+ * The layout of the file is in dhcpd.h.
+ */
+
+static struct dhcp4o6_rings *dhcp4o6_rings = NULL;
+static struct dhcp4o6_ring *dhcp4o6_tx = NULL;
+static struct dhcp4o6_ring *dhcp4o6_rx = NULL;
+
+static void dhcp4o6_ring_setup(void) {
+	struct dhcp4o6_rings *rings;
+	struct stat st;
+	int fd;
+
+	fd = open(dhcp4o6_ring_file, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		log_fatal("Can't open dhcp4o6 ring %s: %m",
+			  dhcp4o6_ring_file);
+	if (fstat(fd, &st) < 0)
+		log_fatal("Can't stat dhcp4o6 ring %s: %m",
+			  dhcp4o6_ring_file);
+	if (st.st_size == 0 &&
+	    ftruncate(fd, sizeof(struct dhcp4o6_rings)) < 0)
+		log_fatal("Can't size dhcp4o6 ring %s: %m",
+			  dhcp4o6_ring_file);
+	else if (st.st_size != 0 &&
+		 st.st_size != sizeof(struct dhcp4o6_rings))
+		log_fatal("dhcp4o6 ring %s has the wrong size.",
+			  dhcp4o6_ring_file);
+
+	rings = mmap(NULL, sizeof(*rings), PROT_READ | PROT_WRITE,
+		     MAP_SHARED, fd, 0);
+	if (rings == MAP_FAILED)
+		log_fatal("Can't map dhcp4o6 ring %s: %m",
+			  dhcp4o6_ring_file);
+	close(fd);
+
+	/* Whichever side comes first marks the file; both write the same
+	   thing if they race. */
+	if (rings->magic == 0) {
+		rings->size = DHCP4o6_RING_SIZE;
+		rings->cookie = ((u_int32_t)getpid() << 16) ^
+				(u_int32_t)time(NULL) ^ 1;
+		rings->magic = DHCP4o6_RING_MAGIC;
+	} else if (rings->magic != DHCP4o6_RING_MAGIC ||
+		   rings->size != DHCP4o6_RING_SIZE)
+		log_fatal("dhcp4o6 ring %s was made by a different build.",
+			  dhcp4o6_ring_file);
+
+	if (local_family == AF_INET6) {
+		dhcp4o6_tx = &rings->ring[0];
+		dhcp4o6_rx = &rings->ring[1];
+	} else {
+		dhcp4o6_tx = &rings->ring[1];
+		dhcp4o6_rx = &rings->ring[0];
+	}
+
+	/* Anything left on our ring from before we started is stale. */
+	__atomic_store_n(&dhcp4o6_rx->taken,
+			 __atomic_load_n(&dhcp4o6_rx->put, __ATOMIC_SEQ_CST),
+			 __ATOMIC_SEQ_CST);
+	__atomic_store_n(&dhcp4o6_rx->ready, 1, __ATOMIC_SEQ_CST);
+	dhcp4o6_rings = rings;
+
+	log_info("DHCPv4 over DHCPv6 messages use the ring in %s",
+		 dhcp4o6_ring_file);
+}
+
+/* Copy to or from a ring at a byte count, wrapping at the end. */
+static void ring_write(struct dhcp4o6_ring *ring, u_int32_t at,
+		       const void *buf, unsigned len) {
+	unsigned ofs = at % DHCP4o6_RING_SIZE;
+	unsigned first = DHCP4o6_RING_SIZE - ofs;
+
+	if (first > len)
+		first = len;
+	memcpy(ring->data + ofs, buf, first);
+	memcpy(ring->data, (const unsigned char *)buf + first, len - first);
+}
+
+static void ring_read(const struct dhcp4o6_ring *ring, u_int32_t at,
+		      void *buf, unsigned len) {
+	unsigned ofs = at % DHCP4o6_RING_SIZE;
+	unsigned first = DHCP4o6_RING_SIZE - ofs;
+
+	if (first > len)
+		first = len;
+	memcpy(buf, ring->data + ofs, first);
+	memcpy((unsigned char *)buf + first, ring->data, len - first);
+}
+
+/* Put a message on the ring.  Returns zero if it doesn't fit. */
+static int ring_put(const unsigned char *hdr, unsigned hdr_len,
+		    const unsigned char *data, unsigned data_len) {
+	struct dhcp4o6_ring *ring = dhcp4o6_tx;
+	u_int32_t put, taken, len, need;
+	u_int32_t bell[2];
+
+	if (!__atomic_load_n(&ring->ready, __ATOMIC_SEQ_CST))
+		return 0;
+
+	len = hdr_len + data_len;
+	need = 4 + ((len + 3) & ~3);
+	put = ring->put;
+	taken = __atomic_load_n(&ring->taken, __ATOMIC_SEQ_CST);
+	if (DHCP4o6_RING_SIZE - (put - taken) < need)
+		return 0;
+
+	ring_write(ring, put, &len, 4);
+	ring_write(ring, put + 4, hdr, hdr_len);
+	ring_write(ring, put + 4 + hdr_len, data, data_len);
+	__atomic_store_n(&ring->put, put + need, __ATOMIC_SEQ_CST);
+
+	/* If the receiver had taken everything before this message it may
+	   be waiting on the socket, so wake it up.  Otherwise it will find
+	   this message when it looks for the next one. */
+	if (__atomic_load_n(&ring->taken, __ATOMIC_SEQ_CST) == put) {
+		bell[0] = DHCP4o6_RING_MAGIC;
+		bell[1] = dhcp4o6_rings->cookie;
+		if (send(dhcp4o6_fd, bell, sizeof(bell), 0) < 0)
+			log_error("dhcp4o6: doorbell send(): %m");
+	}
+	return 1;
+}
+
+/*
+ * \brief Take the next message off the ring
+ *
+ * Called whenever the socket is readable, until it returns zero, since
+ * messages may be waiting on the ring whatever woke the receiver up.
+ *
+ * \param raw a data string that is filled with the message
+ * \return 1 if there was a message, 0 if the ring is empty
+ */
+int dhcp4o6_ring_get(struct data_string *raw) {
+	struct dhcp4o6_ring *ring = dhcp4o6_rx;
+	u_int32_t put, taken, len, need;
+
+	if (ring == NULL)
+		return 0;
+	taken = ring->taken;
+	put = __atomic_load_n(&ring->put, __ATOMIC_SEQ_CST);
+	if (put == taken)
+		return 0;
+
+	ring_read(ring, taken, &len, 4);
+	need = 4 + ((len + 3) & ~3);
+	if (len > 65535 || put - taken < need) {
+		log_error("dhcp4o6: bad message on the ring, "
+			  "discarding the ring.");
+		__atomic_store_n(&ring->taken, put, __ATOMIC_SEQ_CST);
+		return 0;
+	}
+
+	memset(raw, 0, sizeof(*raw));
+	if (!buffer_allocate(&raw->buffer, len, MDL)) {
+		log_error("dhcp4o6: no memory for a message on the ring.");
+		__atomic_store_n(&ring->taken, taken + need, __ATOMIC_SEQ_CST);
+		return 0;
+	}
+	raw->data = raw->buffer->data;
+	raw->len = len;
+	ring_read(ring, taken + 4, raw->buffer->data, len);
+	__atomic_store_n(&ring->taken, taken + need, __ATOMIC_SEQ_CST);
+	return 1;
+}
+#endif /* DHCP4o6_RING */
+
+/*
+ * \brief Check for a doorbell
+ *
+ * A doorbell is sent on the socket to say there are messages on the
+ * ring.  It is too short to be a message, so the receive handler asks
+ * about anything that short before discarding it.  This is built even
+ * without ring support, so that a server that doesn't read the ring the
+ * other one writes to can say why no messages are getting through.
+ *
+ * \param buf what was received
+ * \param len its length
+ * \return 1 if it was a doorbell, 0 if not
+ */
+int dhcp4o6_doorbell(const char *buf, int len) {
+	static int warned = 0;
+	u_int32_t bell[2];
+
+	if (len != sizeof(bell))
+		return 0;
+	memcpy(bell, buf, sizeof(bell));
+	if (bell[0] != DHCP4o6_RING_MAGIC)
+		return 0;
+
+#if defined (DHCP4o6_RING)
+	if (dhcp4o6_rings != NULL) {
+		if (bell[1] == dhcp4o6_rings->cookie)
+			return 1;
+		if (!warned)
+			log_error("dhcp4o6: the other server is using a "
+				  "different -4o6-ring file from %s, so its "
+				  "messages are lost.", dhcp4o6_ring_file);
+	} else
+#endif
+	if (!warned)
+		log_error("dhcp4o6: the other server is using -4o6-ring "
+			  "but this one isn't, so its messages are lost.");
+	warned = 1;
+	return 1;
+}
+
+/*
+ * \brief Send a message to the other side
+ *
+ * The message is a header followed by the data, so the callers need not
+ * copy the two together.  It goes on the ring if there is one and it
+ * fits, otherwise on the socket.
+ *
+ * \return the length sent, or -1 with errno set
+ */
+int dhcp4o6_send(const unsigned char *hdr, unsigned hdr_len,
+		 const unsigned char *data, unsigned data_len) {
+	struct iovec iov[2];
+	struct msghdr msg;
+
+#if defined (DHCP4o6_RING)
+	if (dhcp4o6_tx != NULL && ring_put(hdr, hdr_len, data, data_len))
+		return hdr_len + data_len;
+#endif
+
+	iov[0].iov_base = (void *)hdr;
+	iov[0].iov_len = hdr_len;
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = data_len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	return sendmsg(dhcp4o6_fd, &msg, 0);
+}
 #endif /* DHCP4o6 */
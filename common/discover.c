@@ -67,16 +67,32 @@ struct in6_addr local_address6;
 int bind_local_address6 = 0;
 #endif /* DHCPv6 */
 
-void (*bootp_packet_handler) (struct interface_info *,
-			      struct dhcp_packet *, unsigned,
-			      unsigned int,
-			      struct iaddr, struct hardware *);
+bootp_handler_t bootp_packet_handler;
 
 #ifdef DHCPv6
-void (*dhcpv6_packet_handler)(struct interface_info *,
-			      const char *, int,
-			      int, const struct iaddr *,
-			      isc_boolean_t);
+dhcpv6_handler_t dhcpv6_packet_handler;
+#endif /* DHCPv6 */
+
+/* Put a handler in front of the one packets are handed to now, which is
+   kept in *next for it to pass them on to.  Nothing is done if *next is
+   already set, so a handler is only put in once however often it is set
+   up. */
+void
+push_packet_handler(bootp_handler_t *next, bootp_handler_t handler) {
+	if (*next == NULL) {
+		*next = bootp_packet_handler;
+		bootp_packet_handler = handler;
+	}
+}
+
+#ifdef DHCPv6
+void
+push_packet_handler6(dhcpv6_handler_t *next, dhcpv6_handler_t handler) {
+	if (*next == NULL) {
+		*next = dhcpv6_packet_handler;
+		dhcpv6_packet_handler = handler;
+	}
+}
 #endif /* DHCPv6 */
 
 
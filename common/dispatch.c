@@ -33,6 +33,78 @@
 struct timeout *timeouts;
 static struct timeout *free_timeouts;
 
+/*
+ * Timeouts are found by the object they are for as well as being on the
+ * timeouts list, so that adding or cancelling one doesn't mean a search
+ * of every timeout there is.  This matters to a dhclient looking after
+ * thousands of interfaces, each with its own timeouts.  The list is
+ * linked both ways so that a timeout can be taken off it directly.
+ */
+#define TIMEOUT_HASH_SIZE 1024
+static struct timeout *timeout_hash [TIMEOUT_HASH_SIZE];
+
+static struct timeout **
+timeout_bucket(void *what)
+{
+	return &timeout_hash[((unsigned long)what >> 4) % TIMEOUT_HASH_SIZE];
+}
+
+/* Put a timeout on the list in front of *where, and in the hash. */
+static void
+timeout_link(struct timeout **where, struct timeout *q)
+{
+	struct timeout **bp;
+
+	q->next = *where;
+	q->pprev = where;
+	if (q->next)
+		q->next->pprev = &q->next;
+	*where = q;
+
+	bp = timeout_bucket(q->what);
+	q->hnext = *bp;
+	*bp = q;
+}
+
+/* Take a timeout off the list and out of the hash. */
+static void
+timeout_unlink(struct timeout *q)
+{
+	struct timeout **bp;
+
+	*q->pprev = q->next;
+	if (q->next)
+		q->next->pprev = q->pprev;
+	q->pprev = NULL;
+
+	for (bp = timeout_bucket(q->what); *bp; bp = &(*bp)->hnext) {
+		if (*bp == q) {
+			*bp = q->hnext;
+			break;
+		}
+	}
+	q->hnext = NULL;
+}
+
+/* Find the timeout that calls where with what.  A null where matches
+   any function. */
+static struct timeout *
+timeout_find(void (*where) (void *), void *what)
+{
+	struct timeout *q;
+
+	if (where == NULL) {
+		for (q = timeouts; q; q = q->next)
+			if (q->what == what)
+				return q;
+		return NULL;
+	}
+	for (q = *timeout_bucket(what); q; q = q->hnext)
+		if (q->func == where && q->what == what)
+			return q;
+	return NULL;
+}
+
 void set_time(TIME t)
 {
 	/* Do any outstanding timeouts. */
@@ -55,7 +127,7 @@ struct timeval *process_outstanding_timeouts (struct timeval *tvp)
 		    ((timeouts -> when . tv_sec == cur_tv . tv_sec) &&
 		     (timeouts -> when . tv_usec <= cur_tv . tv_usec))) {
 			t = timeouts;
-			timeouts = timeouts -> next;
+			timeout_unlink(t);
 			(*(t -> func)) (t -> what);
 			if (t -> unref)
 				(*t -> unref) (&t -> what, MDL);
@@ -119,6 +191,18 @@ dispatch(void)
 		 * case. That is a normal behavior.
 		 */
 
+		if (status == ISC_R_RELOAD && reload_signal != 0 &&
+		    shutdown_signal == 0) {
+			/*
+			 * The context was stopped by a reload request
+			 * (SIGHUP) rather than a shutdown signal.
+			 */
+			reload_signal = 0;
+			(void) dhcp_set_control_state(server_running,
+						      server_reload);
+			continue;
+		}
+
 		if (status == ISC_R_RELOAD) {
 			/*
 			 * dhcp_set_control_state() will do the job.
@@ -140,26 +224,18 @@ isclib_timer_callback(isc_task_t  *taskp,
 		      isc_event_t *eventp)
 {
 	struct timeout *t = (struct timeout *)eventp->ev_arg;
-	struct timeout *q, *r;
+	struct timeout *q = NULL;
 
 	/* Get the current time... */
 	gettimeofday (&cur_tv, (struct timezone *)0);
 
 	/*
-	 * Find the timeout on the dhcp list and remove it.
-	 * As the list isn't ordered we search the entire list
+	 * Take the timeout off the dhcp list, if it's still there.
 	 */
 
-	r = NULL;
-	for (q = timeouts; q; q = q->next) {
-		if (q == t) {
-			if (r)
-				r->next = q->next;
-			else
-				timeouts = q->next;
-			break;
-		}
-		r = q;
+	if (t->pprev != NULL) {
+		timeout_unlink(t);
+		q = t;
 	}
 
 	/*
@@ -201,7 +277,10 @@ void add_timeout (when, where, what, ref, unref)
 	tvref_t ref;
 	tvunref_t unref;
 {
-	struct timeout *t, *q;
+	struct timeout *q;
+#if defined (TRACING)
+	struct timeout **tp;
+#endif
 	int usereset = 0;
 	isc_result_t status;
 	int64_t sec;
@@ -210,18 +289,10 @@ void add_timeout (when, where, what, ref, unref)
 	isc_time_t expires;
 
 	/* See if this timeout supersedes an existing timeout. */
-	t = (struct timeout *)0;
-	for (q = timeouts; q; q = q->next) {
-		if ((where == NULL || q->func == where) &&
-		    q->what == what) {
-			if (t)
-				t->next = q->next;
-			else
-				timeouts = q->next;
-			usereset = 1;
-			break;
-		}
-		t = q;
+	q = timeout_find(where, what);
+	if (q) {
+		timeout_unlink(q);
+		usereset = 1;
 	}
 
 	/* If we didn't supersede a timeout, allocate a timeout
@@ -308,29 +379,13 @@ void add_timeout (when, where, what, ref, unref)
 		 * it's the best we can do for now.
 		 */
 
-		/* Beginning of list? */
-		if (!timeouts || (timeouts->when.tv_sec > q-> when.tv_sec) ||
-		    ((timeouts->when.tv_sec == q->when.tv_sec) &&
-		     (timeouts->when.tv_usec > q->when.tv_usec))) {
-			q->next = timeouts;
-			timeouts = q;
-			return;
-		}
-
-		/* Middle of list? */
-		for (t = timeouts; t->next; t = t->next) {
-			if ((t->next->when.tv_sec > q->when.tv_sec) ||
-			    ((t->next->when.tv_sec == q->when.tv_sec) &&
-			     (t->next->when.tv_usec > q->when.tv_usec))) {
-				q->next = t->next;
-				t->next = q;
-				return;
-			}
+		for (tp = &timeouts; *tp; tp = &(*tp)->next) {
+			if (((*tp)->when.tv_sec > q->when.tv_sec) ||
+			    (((*tp)->when.tv_sec == q->when.tv_sec) &&
+			     ((*tp)->when.tv_usec > q->when.tv_usec)))
+				break;
 		}
-
-		/* End of list. */
-		t->next = q;
-		q->next = (struct timeout *)0;
+		timeout_link(tp, q);
 		return;
 	}
 #endif
@@ -340,8 +395,7 @@ void add_timeout (when, where, what, ref, unref)
 	 * to the native ISC timer functions, if it becomes a performance
 	 * problem before then we may need to order the list.
 	 */
-	q->next  = timeouts;
-	timeouts = q;
+	timeout_link(&timeouts, q);
 
 	isc_interval_set(&interval, sec, usec * 1000);
 	status = isc_time_nowplusinterval(&expires, &interval);
@@ -378,20 +432,12 @@ void cancel_timeout (where, what)
 	void (*where) (void *);
 	void *what;
 {
-	struct timeout *t, *q;
-
-	/* Look for this timeout on the list, and unlink it if we find it. */
-	t = (struct timeout *)0;
-	for (q = timeouts; q; q = q -> next) {
-		if (q->func == where && q->what == what) {
-			if (t)
-				t->next = q->next;
-			else
-				timeouts = q->next;
-			break;
-		}
-		t = q;
-	}
+	struct timeout *q;
+
+	/* Look for this timeout, and unlink it if we find it. */
+	q = timeout_find(where, what);
+	if (q)
+		timeout_unlink(q);
 
 	/*
 	 * If we found the timeout, cancel it and put it on the free list.
@@ -420,6 +466,7 @@ void cancel_all_timeouts ()
 	struct timeout *t, *n;
 	for (t = timeouts; t; t = n) {
 		n = t->next;
+		timeout_unlink(t);
 		isc_timer_detach(&t->isc_timeout);
 		if (t->unref && t->what)
 			(*t->unref) (&t->what, MDL);
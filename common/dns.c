@@ -30,6 +30,7 @@
  */
 #include "dhcpd.h"
 #include "arpa/nameser.h"
+#include <sys/time.h>
 #include <isc/md5.h>
 #include <isc/sha2.h>
 #include <dns/result.h>
@@ -189,6 +190,8 @@ typedef struct dhcp_ddns_ns {
 	int num_addrs;
 	int num_addrs6;
 	int ttl;
+	int refresh;                  /* refreshing a cached zone, don't
+					 look for a parent zone */
 
 	void *transaction;             /* transaction id for DNS calls */
 } dhcp_ddns_ns_t;
@@ -271,9 +274,15 @@ find_in_ns_queue(dhcp_ddns_ns_t *ns_cb)
 }
 
 void cache_found_zone (dhcp_ddns_ns_t *);
+static isc_result_t find_zone_begin (dhcp_ddns_ns_t *);
+static isc_result_t find_zone_refresh (struct dns_zone *);
 #endif
 
 void ddns_interlude(isc_task_t *, isc_event_t *);
+static isc_result_t ddns_submit(dhcp_ddns_cb_t *, const char *, int);
+static isc_result_t ddns_send_fwd(dhcp_ddns_cb_t *, const char *, int);
+static isc_result_t ddns_send_ptr(dhcp_ddns_cb_t *, const char *, int);
+static void ddns_complete(dhcp_ddns_cb_t *, isc_result_t);
 
 #if defined (TRACING)
 /*
@@ -957,6 +966,8 @@ find_zone_addrs(isc_task_t *taskp,
 	if ((ns_cb->num_addrs != 0) ||
 	    (ns_cb->num_addrs6 != 0))
 		cache_found_zone(ns_cb);
+	else if (ns_cb->refresh == 0)
+		cache_negative_zone((const char *)ns_cb->oname.data);
 
 	dns_client_freeresanswer(dhcp_gbl_ctx.dnsclient,
 				 &ns_cb->eventp->answerlist);
@@ -1002,6 +1013,11 @@ find_zone_ns(isc_task_t *taskp,
 	if (ddns_event->result != ISC_R_SUCCESS) {
 		/* We didn't find any nameservers, try again */
 
+		/* Unless we were refreshing a zone we already know,
+		 * in which case we keep what we have until it expires */
+		if (ns_cb->refresh)
+			goto cleanup;
+
 		/* Remove a label and continue */
 		ns_cb->zname = strchr(ns_cb->zname, '.');
 		if ((ns_cb->zname == NULL) ||
@@ -1060,6 +1076,11 @@ find_zone_ns(isc_task_t *taskp,
 			     ISC_R_SUCCESS))
 				continue;
 
+			/* The zone is only good as long as its NS
+			 * records, zone_addr_to_ns() may lower this */
+			if ((ns_cb->ttl == 0) || (ns_cb->ttl > rdataset->ttl))
+				ns_cb->ttl = rdataset->ttl;
+
 			dns_rdataset_current(rdataset, &rdata);
 			if (dns_rdata_tostruct(&rdata, &ns, NULL) !=
 			    ISC_R_SUCCESS)
@@ -1107,6 +1128,9 @@ find_zone_ns(isc_task_t *taskp,
 	 * requests we will need to remove any that
 	 * were waiting for this resolution */
 
+	if (ns_cb->refresh == 0)
+		cache_negative_zone((const char *)ns_cb->oname.data);
+
 	dns_client_freeresanswer(dhcp_gbl_ctx.dnsclient,
 				 &ddns_event->answerlist);
 	isc_event_free(&eventp);
@@ -1130,10 +1154,7 @@ find_zone_ns(isc_task_t *taskp,
 isc_result_t
 find_zone_start(dhcp_ddns_cb_t *ddns_cb, int direction)
 {
-	isc_result_t status = ISC_R_NOTFOUND;
 	dhcp_ddns_ns_t *ns_cb;
-	dns_fixedname_t zname0;
-	dns_name_t *zname = NULL;
 
 	/*
 	 * We don't validate np as that was already done in find_cached_zone()
@@ -1145,7 +1166,6 @@ find_zone_start(dhcp_ddns_cb_t *ddns_cb, int direction)
 		log_error("find_zone_start: unable to allocate cb");
 		return(ISC_R_FAILURE);
 	}
-	ns_cb->rdtype = dns_rdatatype_a;
 
 	/* Copy the data string so the NS lookup is independent of the DDNS */
 	if (direction == FIND_FORWARD) {
@@ -1153,6 +1173,54 @@ find_zone_start(dhcp_ddns_cb_t *ddns_cb, int direction)
 	} else {
 		data_string_copy(&ns_cb->oname,  &ddns_cb->rev_name, MDL);
 	}
+
+	return (find_zone_begin(ns_cb));
+}
+
+/*
+ * Start looking up a zone we already have again, before it expires.
+ * Unlike a normal lookup we only ask about the zone itself.
+ */
+static isc_result_t
+find_zone_refresh(struct dns_zone *zone)
+{
+	dhcp_ddns_ns_t *ns_cb;
+	unsigned len;
+
+	if (dhcp_gbl_ctx.dnsclient == NULL)
+		return (ISC_R_NOTCONNECTED);
+
+	ns_cb = dmalloc(sizeof(*ns_cb), MDL);
+	if (ns_cb == NULL) {
+		log_error("find_zone_refresh: unable to allocate cb");
+		return(ISC_R_FAILURE);
+	}
+
+	len = strlen(zone->name);
+	if (!buffer_allocate(&ns_cb->oname.buffer, len + 1, MDL)) {
+		dfree(ns_cb, MDL);
+		return (ISC_R_NOMEMORY);
+	}
+	ns_cb->oname.data = ns_cb->oname.buffer->data;
+	ns_cb->oname.len = len;
+	memcpy(ns_cb->oname.buffer->data, zone->name, len + 1);
+	ns_cb->refresh = 1;
+
+	return (find_zone_begin(ns_cb));
+}
+
+/*
+ * Common code for the above.  The control block is either put on the
+ * outstanding queue or freed.
+ */
+static isc_result_t
+find_zone_begin(dhcp_ddns_ns_t *ns_cb)
+{
+	isc_result_t status = ISC_R_NOTFOUND;
+	dns_fixedname_t zname0;
+	dns_name_t *zname = NULL;
+
+	ns_cb->rdtype = dns_rdatatype_a;
 	ns_cb->zname = (char *)ns_cb->oname.data;
 
 	/*
@@ -1245,6 +1313,17 @@ find_cached_zone(dhcp_ddns_cb_t *ddns_cb, int direction)
 		return (ISC_R_FAILURE);
 	}
 
+#if defined (DNS_ZONE_LOOKUP)
+	/* If a zone we found ourselves is getting old start looking
+	 * it up again, we keep using the current information until the
+	 * answer comes back. */
+	if ((zone->refresh != 0) && (zone->refresh <= cur_time) &&
+	    ((zone->flags & DNS_ZONE_REFRESHING) == 0)) {
+		zone->flags |= DNS_ZONE_REFRESHING;
+		(void) find_zone_refresh(zone);
+	}
+#endif
+
 	/* Make sure the zone name will fit. */
 	if (strlen(zone->name) >= sizeof(ddns_cb->zone_name)) {
 		dns_zone_dereference(&zone, MDL);
@@ -1365,14 +1444,22 @@ void repudiate_zone (struct dns_zone **zone)
 	dns_zone_dereference(zone, MDL);
 }
 
-#if defined (DNS_ZONE_LOOKUP)
-void cache_found_zone(dhcp_ddns_ns_t *ns_cb)
+/*
+ * Enter a zone we found through the DNS, or read back from the zone
+ * cache file, into the zone hash.  If we already have a dynamic zone
+ * by that name its addresses are replaced.  Zones from the
+ * configuration file are left alone.
+ */
+static void
+cache_zone(const char *name, TIME timeout, TIME refresh,
+	   struct in_addr *addrs, int num_addrs,
+	   struct in6_addr *addrs6, int num_addrs6)
 {
 	struct dns_zone *zone = NULL;
 	int len, remove_zone = 0;
 
 	/* See if there's already such a zone. */
-	if (dns_zone_lookup(&zone, ns_cb->zname) == ISC_R_SUCCESS) {
+	if (dns_zone_lookup(&zone, name) == ISC_R_SUCCESS) {
 		/* If it's not a dynamic zone, leave it alone. */
 		if (zone->timeout == 0) {
 			goto cleanup;
@@ -1395,24 +1482,28 @@ void cache_found_zone(dhcp_ddns_ns_t *ns_cb)
 		 */
 
 		/* allocate space for the name */
-		len = strlen(ns_cb->zname);
+		len = strlen(name);
 		zone->name = dmalloc(len + 2, MDL);
 		if (zone->name == NULL) {
 			goto cleanup;
 		}
 
 		/* Copy the name and add a trailing '.' if necessary */
-		strcpy(zone->name, ns_cb->zname);
+		strcpy(zone->name, name);
 		if (zone->name[len-1] != '.') {
 			zone->name[len] = '.';
 			zone->name[len+1] = 0;
 		}
 	}
 
-	zone->timeout = cur_time + ns_cb->ttl;
+	/* The new information replaces any negative entry and ends
+	 * any refresh that was in progress */
+	zone->flags = DNS_ZONE_ACTIVE;
+	zone->timeout = timeout;
+	zone->refresh = refresh;
 
-	if (ns_cb->num_addrs != 0) {
-		len = ns_cb->num_addrs * sizeof(struct in_addr);
+	if (num_addrs != 0) {
+		len = num_addrs * sizeof(struct in_addr);
 		if ((!option_cache_allocate(&zone->primary, MDL)) ||
 		    (!buffer_allocate(&zone->primary->data.buffer,
 				      len, MDL))) {
@@ -1420,13 +1511,13 @@ void cache_found_zone(dhcp_ddns_ns_t *ns_cb)
 				remove_dns_zone(zone);
 			goto cleanup;
 		}
-		memcpy(zone->primary->data.buffer->data, ns_cb->addrs, len);
+		memcpy(zone->primary->data.buffer->data, addrs, len);
 		zone->primary->data.data =
 			&zone->primary->data.buffer->data[0];
 		zone->primary->data.len = len;
 	}
-	if (ns_cb->num_addrs6 != 0) {
-		len = ns_cb->num_addrs6 * sizeof(struct in6_addr);
+	if (num_addrs6 != 0) {
+		len = num_addrs6 * sizeof(struct in6_addr);
 		if ((!option_cache_allocate(&zone->primary6, MDL)) ||
 		    (!buffer_allocate(&zone->primary6->data.buffer,
 				      len, MDL))) {
@@ -1434,7 +1525,7 @@ void cache_found_zone(dhcp_ddns_ns_t *ns_cb)
 				remove_dns_zone(zone);
 			goto cleanup;
 		}
-		memcpy(zone->primary6->data.buffer->data, ns_cb->addrs6, len);
+		memcpy(zone->primary6->data.buffer->data, addrs6, len);
 		zone->primary6->data.data =
 			&zone->primary6->data.buffer->data[0];
 		zone->primary6->data.len = len;
@@ -1446,8 +1537,279 @@ void cache_found_zone(dhcp_ddns_ns_t *ns_cb)
 	dns_zone_dereference(&zone, MDL);
 	return;
 }
+
+#if defined (DNS_ZONE_LOOKUP)
+void cache_found_zone(dhcp_ddns_ns_t *ns_cb)
+{
+	TIME refresh = 0;
+
+	/* Start looking again when 7/8 of the TTL has gone by so that
+	 * the answer is normally in before the zone expires. */
+	if (ns_cb->ttl >= 8)
+		refresh = cur_time + ns_cb->ttl - ns_cb->ttl / 8;
+
+	cache_zone(ns_cb->zname, cur_time + ns_cb->ttl, refresh,
+		   ns_cb->addrs, ns_cb->num_addrs,
+		   ns_cb->addrs6, ns_cb->num_addrs6);
+
+	dns_zone_cache_changed();
+}
+
+/*
+ * We couldn't find any name servers for a name.  Remember that for
+ * the domain the name is in (the name less its first label) so that
+ * other names in that domain don't repeat the whole search while the
+ * DNS is unavailable.  The entry looks like a repudiated zone, so
+ * find_cached_zone() fails updates for it until it times out.  Failing
+ * to refresh a zone we already have doesn't come here.
+ */
+void
+cache_negative_zone(const char *name)
+{
+	struct dns_zone *zone = NULL;
+	const char *np, *dot;
+	int len;
+
+	if ((dns_zone_negative_ttl == 0) || (name == NULL))
+		return;
+
+	/* Don't cache anything for a top level domain */
+	np = strchr(name, '.');
+	if ((np == NULL) || (np[1] == 0))
+		return;
+	np++;
+	dot = strchr(np, '.');
+	if ((dot == NULL) || (dot[1] == 0))
+		return;
+
+	/* Leave any zone we already have alone */
+	if (dns_zone_lookup(&zone, np) == ISC_R_SUCCESS) {
+		dns_zone_dereference(&zone, MDL);
+		return;
+	}
+
+	if (dns_zone_allocate(&zone, MDL) == 0)
+		return;
+	len = strlen(np);
+	zone->name = dmalloc(len + 2, MDL);
+	if (zone->name == NULL) {
+		dns_zone_dereference(&zone, MDL);
+		return;
+	}
+	strcpy(zone->name, np);
+	if (zone->name[len-1] != '.') {
+		zone->name[len] = '.';
+		zone->name[len+1] = 0;
+	}
+	zone->flags = DNS_ZONE_INACTIVE | DNS_ZONE_NEGATIVE;
+	zone->timeout = cur_time + dns_zone_negative_ttl;
+
+	log_info("DDNS: no name servers found for %s, not looking "
+		 "again for %u seconds", zone->name,
+		 (unsigned)dns_zone_negative_ttl);
+
+	enter_dns_zone(zone);
+	dns_zone_dereference(&zone, MDL);
+}
 #endif
 
+/*
+ * The zone cache file keeps the zones we found through the DNS across
+ * restarts.  It's a text file with one zone per line: the zone name,
+ * the time (in seconds since the epoch) the entry expires and the
+ * addresses of up to DHCP_MAXNS name servers.  Lines starting with a
+ * '#' are comments.
+ */
+u_int32_t dns_zone_negative_ttl = DEFAULT_DDNS_ZONE_NEGATIVE_TTL;
+const char *dns_zone_cache_file = NULL;
+
+static FILE *zone_cache_fp = NULL;
+static int zone_cache_dirty = 0;
+
+static isc_result_t
+dns_zone_cache_write(const void *name, unsigned len, void *object)
+{
+	struct dns_zone *zone = (struct dns_zone *)object;
+	char abuf[INET6_ADDRSTRLEN];
+	unsigned i;
+
+	/* Only zones we found ourselves, and only good ones. */
+	if ((zone->timeout == 0) || (zone->timeout <= cur_time) ||
+	    ((zone->flags & DNS_ZONE_INACTIVE) != 0))
+		return (ISC_R_SUCCESS);
+
+	fprintf(zone_cache_fp, "%s %lu", zone->name,
+		(unsigned long)zone->timeout);
+	if (zone->primary != NULL) {
+		for (i = 0; i + 4 <= zone->primary->data.len; i += 4) {
+			if (inet_ntop(AF_INET, &zone->primary->data.data[i],
+				      abuf, sizeof(abuf)) != NULL)
+				fprintf(zone_cache_fp, " %s", abuf);
+		}
+	}
+	if (zone->primary6 != NULL) {
+		for (i = 0; i + 16 <= zone->primary6->data.len; i += 16) {
+			if (inet_ntop(AF_INET6, &zone->primary6->data.data[i],
+				      abuf, sizeof(abuf)) != NULL)
+				fprintf(zone_cache_fp, " %s", abuf);
+		}
+	}
+	fprintf(zone_cache_fp, "\n");
+	return (ISC_R_SUCCESS);
+}
+
+static void
+dns_zone_cache_timer(void *unused)
+{
+	dns_zone_cache_save();
+}
+
+/*
+ * A zone was added or updated.  Rewriting the whole file is too slow
+ * to do for every zone while updates are waiting, so the file is
+ * written DDNS_ZONE_CACHE_SAVE_DELAY seconds after the first change
+ * and at shutdown.
+ */
+void
+dns_zone_cache_changed(void)
+{
+	struct timeval tv;
+
+	if ((dns_zone_cache_file == NULL) || zone_cache_dirty)
+		return;
+
+	zone_cache_dirty = 1;
+	tv.tv_sec = cur_tv.tv_sec + DDNS_ZONE_CACHE_SAVE_DELAY;
+	tv.tv_usec = cur_tv.tv_usec;
+	add_timeout(&tv, dns_zone_cache_timer, NULL, 0, 0);
+}
+
+/*
+ * Write out the zone cache.  We write a new file and rename it over
+ * the old one so that a crash never leaves a partial cache behind.
+ */
+void
+dns_zone_cache_save(void)
+{
+	char *tmpname;
+	FILE *fp;
+	int len;
+
+	if (zone_cache_dirty) {
+		zone_cache_dirty = 0;
+		cancel_timeout(dns_zone_cache_timer, NULL);
+	}
+
+	if ((dns_zone_cache_file == NULL) || (dns_zone_hash == NULL))
+		return;
+
+	len = strlen(dns_zone_cache_file) + 5;
+	tmpname = dmalloc(len, MDL);
+	if (tmpname == NULL)
+		return;
+	snprintf(tmpname, len, "%s.tmp", dns_zone_cache_file);
+
+	fp = fopen(tmpname, "w");
+	if (fp == NULL) {
+		log_error("Can't create DDNS zone cache %s: %m", tmpname);
+		dfree(tmpname, MDL);
+		return;
+	}
+
+	fprintf(fp, "# DDNS zone cache written by dhcpd.\n"
+		    "# name expires name-server...\n");
+	zone_cache_fp = fp;
+	dns_zone_hash_foreach(dns_zone_hash, dns_zone_cache_write);
+	zone_cache_fp = NULL;
+
+	if ((fclose(fp) != 0) || (rename(tmpname, dns_zone_cache_file) != 0)) {
+		log_error("Can't write DDNS zone cache %s: %m",
+			  dns_zone_cache_file);
+		unlink(tmpname);
+	}
+	dfree(tmpname, MDL);
+}
+
+/*
+ * Read the zone cache back at startup.  Expired entries are skipped
+ * and zones from the configuration file take precedence.  The zones
+ * we load are refreshed the first time they are used so that we pick
+ * up any changes made while we were down.
+ */
+void
+dns_zone_cache_load(void)
+{
+	struct in_addr addrs[DHCP_MAXNS], a4;
+	struct in6_addr addrs6[DHCP_MAXNS], a6;
+	struct dns_zone *zone;
+	char line[1024], *name, *tok, *ep;
+	unsigned long expires;
+	int num_addrs, num_addrs6, lineno = 0, loaded = 0;
+	FILE *fp;
+
+	if (dns_zone_cache_file == NULL)
+		return;
+
+	fp = fopen(dns_zone_cache_file, "r");
+	if (fp == NULL) {
+		if (errno != ENOENT)
+			log_error("Can't open DDNS zone cache %s: %m",
+				  dns_zone_cache_file);
+		return;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		name = strtok(line, " \t\r\n");
+		if ((name == NULL) || (*name == '#'))
+			continue;
+
+		tok = strtok(NULL, " \t\r\n");
+		if (tok == NULL)
+			goto bad;
+		expires = strtoul(tok, &ep, 10);
+		if (*ep != 0)
+			goto bad;
+
+		num_addrs = num_addrs6 = 0;
+		while ((tok = strtok(NULL, " \t\r\n")) != NULL) {
+			if (inet_pton(AF_INET, tok, &a4) == 1) {
+				if (num_addrs + num_addrs6 < DHCP_MAXNS)
+					addrs[num_addrs++] = a4;
+			} else if (inet_pton(AF_INET6, tok, &a6) == 1) {
+				if (num_addrs + num_addrs6 < DHCP_MAXNS)
+					addrs6[num_addrs6++] = a6;
+			} else {
+				goto bad;
+			}
+		}
+
+		if (((TIME)expires <= cur_time) ||
+		    (num_addrs + num_addrs6 == 0))
+			continue;
+
+		zone = NULL;
+		if (dns_zone_lookup(&zone, name) == ISC_R_SUCCESS) {
+			dns_zone_dereference(&zone, MDL);
+			continue;
+		}
+
+		cache_zone(name, (TIME)expires, cur_time,
+			   addrs, num_addrs, addrs6, num_addrs6);
+		loaded++;
+		continue;
+
+	      bad:
+		log_error("%s line %d: malformed zone cache entry",
+			  dns_zone_cache_file, lineno);
+	}
+	fclose(fp);
+
+	if (loaded != 0)
+		log_info("Loaded %d zones from DDNS zone cache %s",
+			 loaded, dns_zone_cache_file);
+}
+
 /*!
  * \brief Create an id for a client
  *
@@ -2432,6 +2794,7 @@ void ddns_interlude(isc_task_t  *taskp,
 
 	/* This transaction is complete, clear the value */
 	dns_client_destroyupdatetrans(&ddns_cb->transaction);
+	ddns_complete(ddns_cb, eresult);
 
 	/* If we cancelled or tried to cancel the operation we just
 	 * need to clean up. */
@@ -2510,29 +2873,17 @@ isc_result_t
 ddns_modify_fwd(dhcp_ddns_cb_t *ddns_cb, const char *file, int line)
 {
 	isc_result_t result;
-	dns_tsec_t *tsec_key = NULL;
 
 #if defined (DEBUG_DNS_UPDATES)
 	log_info("DDNS: ddns_modify_fwd");
 #endif
 
-	unsigned char *clientname;
-	dhcp_ddns_data_t *dataspace = NULL;
-	dns_namelist_t prereqlist, updatelist;
-	dns_fixedname_t zname0, pname0, uname0;
-	dns_name_t *zname = NULL, *pname, *uname;
-
-	isc_sockaddrlist_t *zlist = NULL;
-
 	/* Creates client context if we need to */
 	result = dns_client_init();
 	if (result != ISC_R_SUCCESS) {
 		return result;
 	}
 
-	/* Get a pointer to the clientname to make things easier. */
-	clientname = (unsigned char *)ddns_cb->fwd_name.data;
-
 	/* Extract and validate the type of the address. */
 	if (ddns_cb->address.len == 4) {
 		ddns_cb->address_type = dns_rdatatype_a;
@@ -2576,6 +2927,42 @@ ddns_modify_fwd(dhcp_ddns_cb_t *ddns_cb, const char *file, int line)
 			goto cleanup;
 	}
 
+	/*
+	 * Hand the update to the flow control code, it either sends it
+	 * now or holds it until the server has room for another one.
+	 */
+	return (ddns_submit(ddns_cb, file, line));
+
+ cleanup:
+#if defined (DEBUG_DNS_UPDATES)
+	if (result != ISC_R_SUCCESS) {
+		log_info("DDNS: %s(%d): error in ddns_modify_fwd %s for %p",
+			 file, line, isc_result_totext(result), ddns_cb);
+	}
+#endif
+
+	return(result);
+}
+
+/*
+ * Build and send the update for a forward record once we know which
+ * zone it belongs to.
+ */
+static isc_result_t
+ddns_send_fwd(dhcp_ddns_cb_t *ddns_cb, const char *file, int line)
+{
+	isc_result_t result;
+	dns_tsec_t *tsec_key = NULL;
+	unsigned char *clientname;
+	dhcp_ddns_data_t *dataspace = NULL;
+	dns_namelist_t prereqlist, updatelist;
+	dns_fixedname_t zname0, pname0, uname0;
+	dns_name_t *zname = NULL, *pname, *uname;
+	isc_sockaddrlist_t *zlist = NULL;
+
+	/* Get a pointer to the clientname to make things easier. */
+	clientname = (unsigned char *)ddns_cb->fwd_name.data;
+
 	/*
 	 * If we have a zone try to get any information we need
 	 * from it - name, addresses and the key.  The address
@@ -2745,7 +3132,7 @@ ddns_modify_fwd(dhcp_ddns_cb_t *ddns_cb, const char *file, int line)
  cleanup:
 #if defined (DEBUG_DNS_UPDATES)
 	if (result != ISC_R_SUCCESS) {
-		log_info("DDNS: %s(%d): error in ddns_modify_fwd %s for %p",
+		log_info("DDNS: %s(%d): error in ddns_send_fwd %s for %p",
 			 file, line, isc_result_totext(result), ddns_cb);
 	}
 #endif
@@ -2762,15 +3149,6 @@ isc_result_t
 ddns_modify_ptr(dhcp_ddns_cb_t *ddns_cb, const char *file, int line)
 {
 	isc_result_t result;
-	dns_tsec_t *tsec_key  = NULL;
-	unsigned char *ptrname;
-	dhcp_ddns_data_t *dataspace = NULL;
-	dns_namelist_t updatelist;
-	dns_fixedname_t zname0, uname0;
-	dns_name_t *zname = NULL, *uname;
-	isc_sockaddrlist_t *zlist = NULL;
-	unsigned char buf[256];
-	int buflen;
 
 #if defined (DEBUG_DNS_UPDATES)
 	log_info("DDNS: ddns_modify_ptr");
@@ -2813,74 +3191,61 @@ ddns_modify_ptr(dhcp_ddns_cb_t *ddns_cb, const char *file, int line)
 	if (result != ISC_R_SUCCESS)
 		goto cleanup;
 
+	/*
+	 * PTR updates have no prerequisites so updates for the same
+	 * zone may be combined, otherwise this is the same as the
+	 * forward case.
+	 */
+	return (ddns_submit(ddns_cb, file, line));
 
-	if ((result == ISC_R_SUCCESS) &&
-	    !(ISC_LIST_EMPTY(ddns_cb->zone_server_list))) {
-		/* Set up the zone name for use by DNS */
-		result = dhcp_isc_name(ddns_cb->zone_name, &zname0, &zname);
-		if (result != ISC_R_SUCCESS) {
-			log_error("Unable to build name for zone for "
-				  "fwd update: %s %s",
-				  ddns_cb->zone_name,
-				  isc_result_totext(result));
-			goto cleanup;
-		}
-		/* If we have any addresses get them */
-		if (!(ISC_LIST_EMPTY(ddns_cb->zone_server_list))) {
-			zlist = &ddns_cb->zone_server_list;
-		}
-
-		/*
-		 * If we now have a zone try to get the key, NULL is okay,
-		 * having a key but not a tsec is odd so we warn.
-		 */
-		/*sar*/
-		/* should we do the warning if we have a key but no tsec? */
-		if ((ddns_cb->zone != NULL) && (ddns_cb->zone->key != NULL)) {
-			tsec_key = ddns_cb->zone->key->tsec_key;
-			if (tsec_key == NULL) {
-				log_error("No tsec for use with key %s",
-					  ddns_cb->zone->key->name);
-			}
-		}
+ cleanup:
+#if defined (DEBUG_DNS_UPDATES)
+	if (result != ISC_R_SUCCESS) {
+		log_info("DDNS: %s(%d): error in ddns_modify_ptr %s for %p",
+			 file, line, isc_result_totext(result), ddns_cb);
 	}
+#endif
+
+	return(result);
+}
+
+/*
+ * Build the update list entry for a PTR record: delete whatever is
+ * there and, if we are adding, add the new one.  dataspace must have
+ * room for two entries and, like uname0, must stay around until the
+ * message has been handed to the DNS code.
+ */
+static isc_result_t
+ddns_build_ptr(dhcp_ddns_cb_t *ddns_cb, dhcp_ddns_data_t *dataspace,
+	       dns_fixedname_t *uname0, dns_name_t **uname)
+{
+	isc_result_t result;
+	unsigned char *ptrname;
+	unsigned char buf[256];
+	int buflen;
 
 	/* We must have a name for the update list */
 	/* Get a pointer to the ptrname to make things easier. */
 	ptrname = (unsigned char *)ddns_cb->rev_name.data;
 
-	if ((result = dhcp_isc_name(ptrname, &uname0, &uname))
+	if ((result = dhcp_isc_name(ptrname, uname0, uname))
 	     != ISC_R_SUCCESS) {
 		log_error("Unable to build name for fwd update: %s %s",
 			  ptrname, isc_result_totext(result));
-		goto cleanup;
+		return (result);
 	}
 
 	/*
-	 * Allocate the various isc dns library structures we may require.
-	 * Allocating one blob avoids being halfway through the process
-	 * and being unable to allocate as well as making the free easy.
-	 */
-	dataspace = isc_mem_get(dhcp_gbl_ctx.mctx, sizeof(*dataspace) * 2);
-	if (dataspace == NULL) {
-		log_error("Unable to allocate memory for fwd update");
-		result = ISC_R_NOMEMORY;
-		goto cleanup;
-	}
-
-	ISC_LIST_INIT(updatelist);
-
-	/*
-	 * Construct the update list
-	 * We always delete what's currently there
-	 * Delete PTR RR.
+	 * Construct the update list
+	 * We always delete what's currently there
+	 * Delete PTR RR.
 	 */
 	result = make_dns_dataset(dns_rdataclass_any, dns_rdatatype_ptr,
 				  &dataspace[0], NULL, 0, 0);
 	if (result != ISC_R_SUCCESS) {
-		goto cleanup;
+		return (result);
 	}
-	ISC_LIST_APPEND(uname->list, &dataspace[0].rdataset, link);
+	ISC_LIST_APPEND((*uname)->list, &dataspace[0].rdataset, link);
 
 	/*
 	 * If we are updating the pointer we then add the new one
@@ -2892,7 +3257,7 @@ ddns_modify_ptr(dhcp_ddns_cb_t *ddns_cb, const char *file, int line)
 		 */
 		if (MRns_name_pton((char *)ddns_cb->fwd_name.data,
 				   buf, 256) == -1) {
-			goto cleanup;
+			return (DHCP_R_INVALIDARG);
 		}
 		buflen = 0;
 		while (buf[buflen] != 0) {
@@ -2905,11 +3270,90 @@ ddns_modify_ptr(dhcp_ddns_cb_t *ddns_cb, const char *file, int line)
 					  &dataspace[1],
 					  buf, buflen, ddns_cb->ttl);
 		if (result != ISC_R_SUCCESS) {
-			goto cleanup;
+			return (result);
+		}
+		ISC_LIST_APPEND((*uname)->list, &dataspace[1].rdataset, link);
+	}
+
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Get the zone name, server list and key for an update from the
+ * information find_cached_zone() left in the control block.
+ */
+static isc_result_t
+ddns_zone_args(dhcp_ddns_cb_t *ddns_cb, dns_fixedname_t *zname0,
+	       dns_name_t **zname, isc_sockaddrlist_t **zlist,
+	       dns_tsec_t **tsec_key)
+{
+	isc_result_t result;
+
+	if (ISC_LIST_EMPTY(ddns_cb->zone_server_list))
+		return (ISC_R_SUCCESS);
+
+	/* Set up the zone name for use by DNS */
+	result = dhcp_isc_name(ddns_cb->zone_name, zname0, zname);
+	if (result != ISC_R_SUCCESS) {
+		log_error("Unable to build name for zone for "
+			  "fwd update: %s %s",
+			  ddns_cb->zone_name,
+			  isc_result_totext(result));
+		return (result);
+	}
+	/* If we have any addresses get them */
+	*zlist = &ddns_cb->zone_server_list;
+
+	/*
+	 * If we now have a zone try to get the key, NULL is okay,
+	 * having a key but not a tsec is odd so we warn.
+	 */
+	/*sar*/
+	/* should we do the warning if we have a key but no tsec? */
+	if ((ddns_cb->zone != NULL) && (ddns_cb->zone->key != NULL)) {
+		*tsec_key = ddns_cb->zone->key->tsec_key;
+		if (*tsec_key == NULL) {
+			log_error("No tsec for use with key %s",
+				  ddns_cb->zone->key->name);
 		}
-		ISC_LIST_APPEND(uname->list, &dataspace[1].rdataset, link);
 	}
 
+	return (ISC_R_SUCCESS);
+}
+
+static isc_result_t
+ddns_send_ptr(dhcp_ddns_cb_t *ddns_cb, const char *file, int line)
+{
+	isc_result_t result;
+	dns_tsec_t *tsec_key  = NULL;
+	dhcp_ddns_data_t *dataspace = NULL;
+	dns_namelist_t updatelist;
+	dns_fixedname_t zname0, uname0;
+	dns_name_t *zname = NULL, *uname;
+	isc_sockaddrlist_t *zlist = NULL;
+
+	result = ddns_zone_args(ddns_cb, &zname0, &zname, &zlist, &tsec_key);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup;
+
+	/*
+	 * Allocate the various isc dns library structures we may require.
+	 * Allocating one blob avoids being halfway through the process
+	 * and being unable to allocate as well as making the free easy.
+	 */
+	dataspace = isc_mem_get(dhcp_gbl_ctx.mctx, sizeof(*dataspace) * 2);
+	if (dataspace == NULL) {
+		log_error("Unable to allocate memory for fwd update");
+		result = ISC_R_NOMEMORY;
+		goto cleanup;
+	}
+
+	ISC_LIST_INIT(updatelist);
+
+	result = ddns_build_ptr(ddns_cb, dataspace, &uname0, &uname);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup;
+
 	ISC_LIST_APPEND(updatelist, uname, link);
 
 	/*sar*/
@@ -2939,7 +3383,7 @@ ddns_modify_ptr(dhcp_ddns_cb_t *ddns_cb, const char *file, int line)
  cleanup:
 #if defined (DEBUG_DNS_UPDATES)
 	if (result != ISC_R_SUCCESS) {
-		log_info("DDNS: %s(%d): error in ddns_modify_ptr %s for %p",
+		log_info("DDNS: %s(%d): error in ddns_send_ptr %s for %p",
 			 file, line, isc_result_totext(result), ddns_cb);
 	}
 #endif
@@ -2966,6 +3410,589 @@ ddns_cancel(dhcp_ddns_cb_t *ddns_cb, const char *file, int line) {
 #endif
 }
 
+/*
+ * DDNS batching and flow control.
+ *
+ * Once the zone for an update is known it is handed to ddns_submit().
+ * Updates are counted against the server they go to, the first address
+ * in the zone's server list or a single shared entry for updates where
+ * we leave it to the DNS code to find the server.  If that server
+ * already has ddns-max-outstanding updates waiting for an answer the
+ * control block is put on the server's wait list and sent when one of
+ * the earlier updates completes.
+ *
+ * If ddns-batch-window is set, PTR updates for zones with configured
+ * servers are held for up to that many milliseconds, or until
+ * ddns-batch-size of them are waiting, and then sent to the zone as a
+ * single UPDATE message.  PTR updates have no prerequisites, so
+ * combining them doesn't change what they do.  Forward updates are
+ * never combined as one failed prerequisite would fail all of the
+ * updates in the message.  Batching is not done while a trace is being
+ * recorded or played back as the trace code works on single control
+ * blocks.
+ *
+ * Control blocks cancelled while they are queued or part of a batch
+ * only get marked by ddns_cancel(); they are freed when they reach
+ * the front of the queue or when their batch completes.
+ */
+
+typedef struct ddns_server {
+	struct ddns_server *next;
+	isc_sockaddr_t addr;
+	int has_addr;
+	u_int32_t outstanding;
+	dhcp_ddns_cb_t *wait_head, *wait_tail;
+} ddns_server_t;
+
+typedef struct ddns_batch {
+	struct ddns_batch *next;
+	unsigned char zone_name[DHCP_MAXDNS_WIRE];
+	ddns_server_t *server;
+	dhcp_ddns_cb_t *head, *tail;
+	u_int32_t count;
+	void *transaction;
+} ddns_batch_t;
+
+struct ddns_stats ddns_stats;
+u_int32_t ddns_batch_window = DEFAULT_DDNS_BATCH_WINDOW;
+u_int32_t ddns_batch_size = DEFAULT_DDNS_BATCH_SIZE;
+u_int32_t ddns_max_outstanding = DEFAULT_DDNS_MAX_OUTSTANDING;
+
+static ddns_server_t *ddns_servers = NULL;
+static ddns_batch_t *ddns_batches = NULL;	/* collecting, one per zone */
+
+static void ddns_batch_flush(void *);
+static void ddns_batch_interlude(isc_task_t *, isc_event_t *);
+
+static int
+ddns_is_ptr(dhcp_ddns_cb_t *ddns_cb) {
+	return ((ddns_cb->state == DDNS_STATE_ADD_PTR) ||
+		(ddns_cb->state == DDNS_STATE_REM_PTR));
+}
+
+static void
+ddns_queue_depth(int delta) {
+	ddns_stats.queue_depth += delta;
+	if (ddns_stats.queue_depth > ddns_stats.queue_max)
+		ddns_stats.queue_max = ddns_stats.queue_depth;
+}
+
+/* Free a control block that was cancelled while it was queued. */
+static void
+ddns_cb_discard(dhcp_ddns_cb_t *ddns_cb) {
+	if (ddns_cb->next_op != NULL) {
+		ddns_cb_free(ddns_cb->next_op, MDL);
+	}
+	ddns_cb_free(ddns_cb, MDL);
+}
+
+/* Milliseconds since the update was submitted. */
+static u_int32_t
+ddns_elapsed(dhcp_ddns_cb_t *ddns_cb) {
+	struct timeval now;
+	long ms;
+
+	gettimeofday(&now, NULL);
+	ms = (now.tv_sec - ddns_cb->submitted.tv_sec) * 1000 +
+	     (now.tv_usec - ddns_cb->submitted.tv_usec) / 1000;
+	return ((ms > 0) ? (u_int32_t)ms : 0);
+}
+
+/* Record the result and latency of an update message. */
+static void
+ddns_account(dhcp_ddns_cb_t *ddns_cb, isc_result_t eresult) {
+	u_int32_t ms = ddns_elapsed(ddns_cb);
+
+	ddns_stats.completed++;
+	if (eresult != ISC_R_SUCCESS)
+		ddns_stats.failed++;
+	if (ddns_stats.outstanding > 0)
+		ddns_stats.outstanding--;
+	ddns_stats.latency_total += ms;
+	if (ms > ddns_stats.latency_max)
+		ddns_stats.latency_max = ms;
+}
+
+/*
+ * Find, or create, the flow control entry for the server an update
+ * will go to.  Returns NULL if we are out of memory, in which case
+ * the update just isn't counted.
+ */
+static ddns_server_t *
+ddns_server_find(dhcp_ddns_cb_t *ddns_cb) {
+	ddns_server_t *server;
+	isc_sockaddr_t *addr;
+
+	addr = ISC_LIST_HEAD(ddns_cb->zone_server_list);
+	for (server = ddns_servers; server != NULL; server = server->next) {
+		if (addr == NULL) {
+			if (!server->has_addr)
+				return (server);
+		} else if (server->has_addr &&
+			   isc_sockaddr_equal(&server->addr, addr)) {
+			return (server);
+		}
+	}
+
+	server = dmalloc(sizeof(*server), MDL);
+	if (server == NULL)
+		return (NULL);
+	if (addr != NULL) {
+		server->addr = *addr;
+		ISC_LINK_INIT(&server->addr, link);
+		server->has_addr = 1;
+	}
+	server->next = ddns_servers;
+	ddns_servers = server;
+	return (server);
+}
+
+/* Build and send a single update and count it against its server. */
+static isc_result_t
+ddns_send(dhcp_ddns_cb_t *ddns_cb, ddns_server_t *server,
+	  const char *file, int line) {
+	isc_result_t result;
+
+	if (ddns_is_ptr(ddns_cb)) {
+		result = ddns_send_ptr(ddns_cb, file, line);
+	} else {
+		result = ddns_send_fwd(ddns_cb, file, line);
+	}
+
+	if (result == ISC_R_SUCCESS) {
+		ddns_cb->server = server;
+		if (server != NULL)
+			server->outstanding++;
+		ddns_stats.sent++;
+		ddns_stats.records++;
+		ddns_stats.outstanding++;
+	}
+	return (result);
+}
+
+/*
+ * A server has answered one of our messages (or it timed out); send
+ * whatever was waiting for a free slot.
+ */
+static void
+ddns_server_done(ddns_server_t *server) {
+	dhcp_ddns_cb_t *ddns_cb;
+	isc_result_t result;
+
+	if (server == NULL)
+		return;
+	if (server->outstanding > 0)
+		server->outstanding--;
+
+	while ((server->wait_head != NULL) &&
+	       ((ddns_max_outstanding == 0) ||
+		(server->outstanding < ddns_max_outstanding))) {
+		ddns_cb = server->wait_head;
+		server->wait_head = ddns_cb->queue_next;
+		if (server->wait_head == NULL)
+			server->wait_tail = NULL;
+		ddns_cb->queue_next = NULL;
+		ddns_queue_depth(-1);
+
+		if ((ddns_cb->flags & DDNS_ABORT) != 0) {
+			ddns_cb_discard(ddns_cb);
+			continue;
+		}
+
+		result = ddns_send(ddns_cb, server, MDL);
+		if (result != ISC_R_SUCCESS) {
+			/* let the next function clean it up */
+			log_info("DDNS: Failed to send queued update: %s",
+				 isc_result_totext(result));
+			ddns_cb->cur_func(ddns_cb, result);
+		}
+	}
+}
+
+/* Called from ddns_interlude() when a single update completes. */
+static void
+ddns_complete(dhcp_ddns_cb_t *ddns_cb, isc_result_t eresult) {
+	ddns_server_t *server = (ddns_server_t *)ddns_cb->server;
+
+	ddns_account(ddns_cb, eresult);
+	ddns_cb->server = NULL;
+	ddns_server_done(server);
+}
+
+static void
+ddns_batch_timeout(ddns_batch_t *batch, u_int32_t msecs) {
+	struct timeval tv;
+
+	tv.tv_sec = cur_tv.tv_sec + msecs / 1000;
+	tv.tv_usec = cur_tv.tv_usec + (msecs % 1000) * 1000;
+	if (tv.tv_usec >= 1000000) {
+		tv.tv_sec++;
+		tv.tv_usec -= 1000000;
+	}
+	add_timeout(&tv, ddns_batch_flush, batch, 0, 0);
+}
+
+/*
+ * Add a PTR update to the batch for its zone.  We never send from
+ * here: our caller still has to finish with the control block, so a
+ * full batch is flushed from the timer queue instead.
+ */
+static isc_result_t
+ddns_batch_add(dhcp_ddns_cb_t *ddns_cb) {
+	ddns_batch_t *batch;
+
+	for (batch = ddns_batches; batch != NULL; batch = batch->next) {
+		if (strcmp((char *)batch->zone_name,
+			   (char *)ddns_cb->zone_name) == 0)
+			break;
+	}
+
+	if (batch == NULL) {
+		batch = dmalloc(sizeof(*batch), MDL);
+		if (batch == NULL)
+			return (ISC_R_NOMEMORY);
+		strcpy((char *)batch->zone_name, (char *)ddns_cb->zone_name);
+		batch->next = ddns_batches;
+		ddns_batches = batch;
+		ddns_batch_timeout(batch, ddns_batch_window);
+	}
+
+	ddns_cb->queue_next = NULL;
+	if (batch->tail == NULL) {
+		batch->head = ddns_cb;
+	} else {
+		batch->tail->queue_next = ddns_cb;
+	}
+	batch->tail = ddns_cb;
+	batch->count++;
+	ddns_queue_depth(1);
+
+	if (batch->count == ddns_batch_size) {
+		ddns_batch_timeout(batch, 0);
+	}
+	return (ISC_R_SUCCESS);
+}
+
+static isc_result_t
+ddns_submit(dhcp_ddns_cb_t *ddns_cb, const char *file, int line) {
+	ddns_server_t *server;
+
+	gettimeofday(&ddns_cb->submitted, NULL);
+
+	if ((ddns_batch_window != 0) && ddns_is_ptr(ddns_cb) &&
+	    (ddns_cb->zone != NULL) &&
+	    !(ISC_LIST_EMPTY(ddns_cb->zone_server_list))
+#if defined (TRACING)
+	    && (trace_record() == 0) && (trace_playback() == 0)
+#endif
+	    ) {
+		if (ddns_batch_add(ddns_cb) == ISC_R_SUCCESS)
+			return (ISC_R_SUCCESS);
+	}
+
+	server = ddns_server_find(ddns_cb);
+	if ((server != NULL) && (ddns_max_outstanding != 0) &&
+	    (server->outstanding >= ddns_max_outstanding)) {
+#if defined (DEBUG_DNS_UPDATES)
+		log_info("DDNS: %s(%d): deferring %p, %u outstanding",
+			 file, line, ddns_cb, server->outstanding);
+#endif
+		ddns_cb->queue_next = NULL;
+		if (server->wait_tail == NULL) {
+			server->wait_head = ddns_cb;
+		} else {
+			server->wait_tail->queue_next = ddns_cb;
+		}
+		server->wait_tail = ddns_cb;
+		ddns_stats.deferred++;
+		ddns_queue_depth(1);
+		return (ISC_R_SUCCESS);
+	}
+
+	return (ddns_send(ddns_cb, server, file, line));
+}
+
+/*
+ * Send up to ddns-batch-size of the updates collected for a zone as
+ * one message.  Anything left over stays in the batch and is sent on
+ * the next pass.
+ */
+static void
+ddns_batch_flush(void *vbatch) {
+	ddns_batch_t *batch = (ddns_batch_t *)vbatch, *sent, **bp;
+	dhcp_ddns_cb_t *ddns_cb, *next, *failed = NULL, **cbp;
+	ddns_server_t *server;
+	dhcp_ddns_data_t *dataspace = NULL;
+	dns_fixedname_t *unames = NULL;
+	dns_fixedname_t zname0;
+	dns_name_t *zname = NULL, *uname;
+	dns_namelist_t updatelist;
+	isc_sockaddrlist_t *zlist = NULL;
+	dns_tsec_t *tsec_key = NULL;
+	isc_result_t result;
+	u_int32_t count, i;
+
+	/* Drop anything that was cancelled while it waited. */
+	for (cbp = &batch->head; *cbp != NULL; ) {
+		ddns_cb = *cbp;
+		if ((ddns_cb->flags & DDNS_ABORT) != 0) {
+			*cbp = ddns_cb->queue_next;
+			batch->count--;
+			ddns_queue_depth(-1);
+			ddns_cb_discard(ddns_cb);
+		} else {
+			cbp = &ddns_cb->queue_next;
+		}
+	}
+	batch->tail = NULL;
+	for (ddns_cb = batch->head; ddns_cb != NULL;
+	     ddns_cb = ddns_cb->queue_next)
+		batch->tail = ddns_cb;
+
+	if (batch->head == NULL) {
+		for (bp = &ddns_batches; *bp != NULL; bp = &(*bp)->next) {
+			if (*bp == batch) {
+				*bp = batch->next;
+				break;
+			}
+		}
+		dfree(batch, MDL);
+		return;
+	}
+
+	/* If the server is busy wait for another window. */
+	server = ddns_server_find(batch->head);
+	if ((server != NULL) && (ddns_max_outstanding != 0) &&
+	    (server->outstanding >= ddns_max_outstanding)) {
+		ddns_batch_timeout(batch, ddns_batch_window);
+		return;
+	}
+
+	sent = dmalloc(sizeof(*sent), MDL);
+	if (sent == NULL) {
+		ddns_batch_timeout(batch, ddns_batch_window);
+		return;
+	}
+
+	/* Move the updates we are about to send to their own batch. */
+	count = batch->count;
+	if ((ddns_batch_size != 0) && (count > ddns_batch_size))
+		count = ddns_batch_size;
+	sent->head = batch->head;
+	for (ddns_cb = batch->head, i = 1; i < count; i++)
+		ddns_cb = ddns_cb->queue_next;
+	sent->tail = ddns_cb;
+	batch->head = ddns_cb->queue_next;
+	ddns_cb->queue_next = NULL;
+	sent->count = count;
+	sent->server = server;
+	batch->count -= count;
+	ddns_queue_depth(-(int)count);
+
+	if (batch->head == NULL) {
+		for (bp = &ddns_batches; *bp != NULL; bp = &(*bp)->next) {
+			if (*bp == batch) {
+				*bp = batch->next;
+				break;
+			}
+		}
+		dfree(batch, MDL);
+	} else {
+		ddns_batch_timeout(batch, 0);
+	}
+
+	dataspace = isc_mem_get(dhcp_gbl_ctx.mctx,
+				sizeof(*dataspace) * 2 * count);
+	unames = isc_mem_get(dhcp_gbl_ctx.mctx, sizeof(*unames) * count);
+	if ((dataspace == NULL) || (unames == NULL)) {
+		log_error("Unable to allocate memory for batched update");
+		result = ISC_R_NOMEMORY;
+		goto fail;
+	}
+
+	/* All of the updates are for the same zone, the first one
+	   tells us where to send them. */
+	result = ddns_zone_args(sent->head, &zname0, &zname, &zlist,
+				&tsec_key);
+	if (result != ISC_R_SUCCESS)
+		goto fail;
+
+	/* Updates we can't build are failed individually. */
+	ISC_LIST_INIT(updatelist);
+	i = 0;
+	for (cbp = &sent->head; *cbp != NULL; ) {
+		ddns_cb = *cbp;
+		result = ddns_build_ptr(ddns_cb, &dataspace[i * 2],
+					&unames[i], &uname);
+		if (result != ISC_R_SUCCESS) {
+			*cbp = ddns_cb->queue_next;
+			ddns_cb->queue_next = failed;
+			failed = ddns_cb;
+			continue;
+		}
+		ISC_LIST_APPEND(updatelist, uname, link);
+		cbp = &ddns_cb->queue_next;
+		i++;
+	}
+	sent->count = i;
+
+	if (sent->head == NULL) {
+		dfree(sent, MDL);
+		sent = NULL;
+		result = ISC_R_SUCCESS;
+		goto done;
+	}
+
+#if defined (DEBUG_DNS_UPDATES)
+	log_info("DDNS: sending %u updates for zone %s",
+		 sent->count, sent->head->zone_name);
+#endif
+
+	result = dns_client_startupdate((dns_client_t *)dhcp_gbl_ctx.dnsclient,
+					dns_rdataclass_in, zname,
+					NULL, &updatelist,
+					zlist, tsec_key,
+					DNS_CLIENTUPDOPT_ALLOWRUN,
+					dhcp_gbl_ctx.task,
+					ddns_batch_interlude, (void *)sent,
+					(dns_clientupdatetrans_t **)
+					&sent->transaction);
+	if (result == ISC_R_SUCCESS) {
+		if (server != NULL)
+			server->outstanding++;
+		ddns_stats.sent++;
+		ddns_stats.records += sent->count;
+		ddns_stats.batched += sent->count;
+		ddns_stats.outstanding++;
+		sent = NULL;
+		goto done;
+	}
+
+	if (result == ISC_R_FAMILYNOSUPPORT) {
+		log_info("Unable to perform DDNS update, "
+			 "address family not supported");
+	}
+
+ fail:
+	/* Nothing was sent, fail everything that was to go. */
+	for (ddns_cb = sent->head; ddns_cb != NULL; ddns_cb = next) {
+		next = ddns_cb->queue_next;
+		ddns_cb->queue_next = failed;
+		failed = ddns_cb;
+	}
+	dfree(sent, MDL);
+
+ done:
+	if (dataspace != NULL) {
+		isc_mem_put(dhcp_gbl_ctx.mctx, dataspace,
+			    sizeof(*dataspace) * 2 * count);
+	}
+	if (unames != NULL) {
+		isc_mem_put(dhcp_gbl_ctx.mctx, unames,
+			    sizeof(*unames) * count);
+	}
+
+	for (ddns_cb = failed; ddns_cb != NULL; ddns_cb = next) {
+		next = ddns_cb->queue_next;
+		ddns_cb->queue_next = NULL;
+		log_info("DDNS: unable to send batched update: %s",
+			 isc_result_totext(result == ISC_R_SUCCESS ?
+					   ISC_R_FAILURE : result));
+		ddns_cb->cur_func(ddns_cb, (result == ISC_R_SUCCESS) ?
+				  ISC_R_FAILURE : result);
+	}
+}
+
+/*
+ * The batched version of ddns_interlude(), pass the result of the
+ * message to each of the updates it carried.
+ */
+static void
+ddns_batch_interlude(isc_task_t *taskp, isc_event_t *eventp) {
+	ddns_batch_t *batch = (ddns_batch_t *)eventp->ev_arg;
+	dns_clientupdateevent_t *ddns_event = (dns_clientupdateevent_t *)eventp;
+	isc_result_t eresult = ddns_event->result;
+	dhcp_ddns_cb_t *ddns_cb, *next;
+	isc_result_t result;
+	int i, repudiated = 0;
+
+	isc_event_free(&eventp);
+	dns_client_destroyupdatetrans((dns_clientupdatetrans_t **)
+				      &batch->transaction);
+
+#if defined (DEBUG_DNS_UPDATES)
+	log_info("DDNS: batch of %u updates complete: %s",
+		 batch->count, isc_result_totext(eresult));
+#endif
+
+	/* The first update is the oldest so it gives the latency. */
+	ddns_account(batch->head, eresult);
+	ddns_server_done(batch->server);
+
+	for (ddns_cb = batch->head; ddns_cb != NULL; ddns_cb = next) {
+		next = ddns_cb->queue_next;
+		ddns_cb->queue_next = NULL;
+
+		if ((ddns_cb->flags & DDNS_ABORT) != 0) {
+			ddns_cb_discard(ddns_cb);
+			continue;
+		}
+
+		/* As in ddns_interlude(), retry after a zone problem. */
+		if ((eresult == DNS_R_NOTAUTH) ||
+		    (eresult == DNS_R_NOTZONE)) {
+			if (!repudiated) {
+				log_error("DDNS: bad zone information, "
+					  "repudiating zone %s",
+					  ddns_cb->zone_name);
+				repudiated = 1;
+			}
+			repudiate_zone(&ddns_cb->zone);
+			ddns_cb->zone_name[0] = 0;
+			ISC_LIST_INIT(ddns_cb->zone_server_list);
+			for (i = 0; i < DHCP_MAXNS; i++) {
+				ISC_LINK_INIT(&ddns_cb->zone_addrs[i], link);
+			}
+
+			result = ddns_modify_ptr(ddns_cb, MDL);
+			if (result != ISC_R_SUCCESS) {
+				log_info("DDNS: Failed to retry after zone "
+					 "failure");
+				ddns_cb->cur_func(ddns_cb, result);
+			}
+			continue;
+		}
+
+		ddns_cb->cur_func(ddns_cb, eresult);
+	}
+
+	dfree(batch, MDL);
+}
+
+/* Summarize the batching and flow control counters. */
+void
+ddns_log_stats(void) {
+	if (ddns_stats.sent == 0)
+		return;
+
+	log_info("DDNS: %llu update messages sent carrying %llu records "
+		 "(%llu batched), %llu deferred, %llu of %llu completed "
+		 "messages failed",
+		 (unsigned long long)ddns_stats.sent,
+		 (unsigned long long)ddns_stats.records,
+		 (unsigned long long)ddns_stats.batched,
+		 (unsigned long long)ddns_stats.deferred,
+		 (unsigned long long)ddns_stats.failed,
+		 (unsigned long long)ddns_stats.completed);
+	log_info("DDNS: %u records queued (max %u), %u messages "
+		 "outstanding, latency avg %llu ms max %u ms",
+		 ddns_stats.queue_depth, ddns_stats.queue_max,
+		 ddns_stats.outstanding,
+		 (unsigned long long)(ddns_stats.completed == 0 ? 0 :
+			ddns_stats.latency_total / ddns_stats.completed),
+		 ddns_stats.latency_max);
+}
+
 #endif /* NSUPDATE */
 
 HASH_FUNCTIONS (dns_zone, const char *, struct dns_zone, dns_zone_hash_t,
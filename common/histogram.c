@@ -0,0 +1,87 @@
+/* histogram.c
+
+   Histograms of times in microseconds. */
+
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/*
+ * The histograms kept by "dhcpd -bench", the server's metrics and the
+ * dhcpload tool have sixteen buckets for each power of two of
+ * microseconds, so a percentile is reported to within about 6%.  Nothing
+ * here uses the rest of the library, so a program that only needs the
+ * histograms can link with it without the server.
+ */
+
+#include "dhcpd.h"
+
+/* The histogram bucket for a time in microseconds. */
+unsigned
+replay_bucket(u_int32_t usecs) {
+	unsigned bits;
+
+	if (usecs < 16)
+		return (usecs);
+	for (bits = 4; bits < 31 && (usecs >> (bits + 1)) != 0; bits++)
+		;
+	return ((bits - 3) * 16 + ((usecs >> (bits - 4)) & 15));
+}
+
+/* The longest time that goes in a bucket. */
+u_int32_t
+replay_bucket_limit(unsigned bucket) {
+	unsigned bits;
+	u_int32_t low;
+
+	if (bucket < 16)
+		return (bucket);
+	bits = bucket / 16 + 3;
+	low = (u_int32_t)(16 + bucket % 16) << (bits - 4);
+	return (low + (((u_int32_t)1 << (bits - 4)) - 1));
+}
+
+/* The time within which the given percentage of the messages were
+   handled, or zero if there were none. */
+u_int32_t
+replay_percentile(const struct replay_stats *stats, double percent) {
+	u_int64_t want, seen;
+	unsigned i;
+
+	if (stats->count == 0)
+		return (0);
+	want = (u_int64_t)(stats->count * percent / 100.0);
+	if (want < stats->count * percent / 100.0)
+		want++;
+	if (want == 0)
+		want = 1;
+
+	seen = 0;
+	for (i = 0; i < REPLAY_BUCKETS; i++) {
+		seen += stats->buckets[i];
+		if (seen >= want)
+			break;
+	}
+	if (i == REPLAY_BUCKETS || replay_bucket_limit(i) > stats->max)
+		return (stats->max);
+	return (replay_bucket_limit(i));
+}
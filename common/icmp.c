@@ -127,6 +127,21 @@ int icmp_readsocket (h)
 
 int icmp_echorequest (addr)
 	struct iaddr *addr;
+{
+	u_int16_t id;
+
+#if SIZEOF_STRUCT_IADDR_P == 8
+	id = (((u_int32_t)(u_int64_t)addr) ^
+	      (u_int32_t)(((u_int64_t)addr) >> 32));
+#else
+	id = (u_int32_t)addr;
+#endif
+	return icmp_echorequest_seq (addr, id, 0);
+}
+
+/* Send an echo request with the given identifier and sequence number,
+   which the reply will carry back to us unchanged. */
+int icmp_echorequest_seq (struct iaddr *addr, u_int16_t id, u_int16_t seq)
 {
 	struct sockaddr_in to;
 	struct icmp icmp;
@@ -151,13 +166,8 @@ int icmp_echorequest (addr)
 	icmp.icmp_type = ICMP_ECHO;
 	icmp.icmp_code = 0;
 	icmp.icmp_cksum = 0;
-	icmp.icmp_seq = 0;
-#if SIZEOF_STRUCT_IADDR_P == 8
-	icmp.icmp_id = (((u_int32_t)(u_int64_t)addr) ^
-  			(u_int32_t)(((u_int64_t)addr) >> 32));
-#else
-	icmp.icmp_id = (u_int32_t)addr;
-#endif
+	icmp.icmp_seq = seq;
+	icmp.icmp_id = id;
 	memset (&icmp.icmp_dun, 0, sizeof icmp.icmp_dun);
 
 	icmp.icmp_cksum = wrapsum (checksum ((unsigned char *)&icmp,
@@ -176,6 +176,8 @@ void if_deregister_send (info)
    in bpf includes... */
 extern struct sock_filter dhcp_bpf_filter [];
 extern int dhcp_bpf_filter_len;
+extern struct sock_filter *dhcp_bpf_giaddr_filter (const struct sock_filter *,
+						   int, int *);
 
 #if defined(RELAY_PORT)
 extern struct sock_filter dhcp_bpf_relay_filter [];
@@ -246,10 +248,23 @@ void if_deregister_receive (info)
 			   info -> shared_network -> name : ""));
 }
 
+/* Install the filter again, after the server's subnets have changed. */
+void if_refresh_receive_filter (info)
+	struct interface_info *info;
+{
+#if defined (HAVE_TR_SUPPORT)
+	if (info -> hw_address.hbuf [0] == HTYPE_IEEE802)
+		return;
+#endif
+	lpf_gen_filter_setup (info);
+}
+
 static void lpf_gen_filter_setup (info)
 	struct interface_info *info;
 {
 	struct sock_fprog p;
+	struct sock_filter *giaddr_filter;
+	int giaddr_len;
 
 	memset(&p, 0, sizeof(p));
 
@@ -275,6 +290,13 @@ static void lpf_gen_filter_setup (info)
 #endif
 	dhcp_bpf_filter [8].k = ntohs (local_port);
 
+	/* Add the server's check of relayed packets' giaddrs, if any. */
+	giaddr_filter = dhcp_bpf_giaddr_filter (p.filter, p.len, &giaddr_len);
+	if (giaddr_filter) {
+		p.filter = giaddr_filter;
+		p.len = giaddr_len;
+	}
+
 	if (setsockopt (info -> rfdesc, SOL_SOCKET, SO_ATTACH_FILTER, &p,
 			sizeof p) < 0) {
 		if (errno == ENOPROTOOPT || errno == EPROTONOSUPPORT ||
@@ -289,6 +311,8 @@ static void lpf_gen_filter_setup (info)
 		}
 		log_fatal ("Can't install packet filter program: %m");
 	}
+	if (giaddr_filter)
+		dfree (giaddr_filter, MDL);
 }
 
 #if defined (HAVE_TR_SUPPORT)
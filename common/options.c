@@ -3995,6 +3995,75 @@ void linked_option_space_foreach (struct packet *packet, struct lease *lease,
 	}
 }
 
+#if defined (USDT_PROBES)
+/* Arguments for the probes in probes.h: a packet's transaction ID and a
+   hash (FNV-1a) of its client's identity. */
+
+static u_int32_t
+probe_hash(const unsigned char *data, unsigned len) {
+	u_int32_t hash = 2166136261U;
+
+	while (len-- > 0) {
+		hash ^= *data++;
+		hash *= 16777619U;
+	}
+	return (hash);
+}
+
+u_int32_t
+probe_xid(const struct packet *packet) {
+	const unsigned char *id;
+
+	if (packet->dhcpv6_msg_type != 0) {
+		if ((packet->dhcpv6_msg_type == DHCPV6_RELAY_FORW) ||
+		    (packet->dhcpv6_msg_type == DHCPV6_RELAY_REPL))
+			return (0);
+		id = packet->dhcpv6_transaction_id;
+		return (((u_int32_t)id[0] << 16) | (id[1] << 8) | id[2]);
+	}
+	if (packet->raw != NULL)
+		return (ntohl(packet->raw->xid));
+	return (0);
+}
+
+u_int32_t
+probe_key(const struct packet *packet) {
+	struct option_cache *oc;
+	unsigned char hbuf[1 + sizeof(packet->raw->chaddr)];
+
+	if (packet->dhcpv6_msg_type != 0) {
+		oc = lookup_option(&dhcpv6_universe, packet->options,
+				   D6O_CLIENTID);
+		if (oc == NULL || oc->data.len == 0)
+			return (0);
+		return (probe_hash(oc->data.data, oc->data.len));
+	}
+	if (packet->raw == NULL || packet->raw->hlen == 0 ||
+	    packet->raw->hlen > sizeof(packet->raw->chaddr))
+		return (0);
+
+	/* The same as a lease's hardware_addr. */
+	hbuf[0] = packet->raw->htype;
+	memcpy(hbuf + 1, packet->raw->chaddr, packet->raw->hlen);
+	return (probe_hash(hbuf, packet->raw->hlen + 1));
+}
+
+u_int32_t
+probe_lease_xid(const struct lease *lease) {
+	if (lease->state != NULL)
+		return (ntohl(lease->state->xid));
+	return (0);
+}
+
+u_int32_t
+probe_lease_key(const struct lease *lease) {
+	if (lease->hardware_addr.hlen == 0)
+		return (0);
+	return (probe_hash(lease->hardware_addr.hbuf,
+			   lease->hardware_addr.hlen));
+}
+#endif /* USDT_PROBES */
+
 void do_packet (interface, packet, len, from_port, from, hfrom)
 	struct interface_info *interface;
 	struct dhcp_packet *packet;
@@ -4031,6 +4100,9 @@ void do_packet (interface, packet, len, from_port, from, hfrom)
 		return;
 	}
 
+	PROBE_PACKET(PACKET_START, decoded_packet);
+	PROBE_PACKET(PARSE_START, decoded_packet);
+
 	/* Allocate packet->options now so it is non-null for all packets */
 	decoded_packet->options_valid = 0;
 	if (!option_state_allocate (&decoded_packet->options, MDL)) {
@@ -4062,6 +4134,8 @@ void do_packet (interface, packet, len, from_port, from, hfrom)
 		}
 	}
 
+	PROBE_PACKET(PARSE_DONE, decoded_packet);
+
 	if (validate_packet(decoded_packet) != 0) {
 		if (decoded_packet->packet_type)
 			dhcp(decoded_packet);
@@ -4069,6 +4143,8 @@ void do_packet (interface, packet, len, from_port, from, hfrom)
 			bootp(decoded_packet);
 	}
 
+	PROBE_PACKET(PACKET_DONE, decoded_packet);
+
 	/* If the caller kept the packet, they'll have upped the refcnt. */
 	packet_dereference(&decoded_packet, MDL);
 
@@ -4105,6 +4181,64 @@ packet6_len_okay(const char *packet, int len) {
 	}
 }
 
+/*
+ * Find an option among the DHCPv6 options in a raw buffer, without
+ * decoding them.  Returns the option's data and sets *olen to its length,
+ * or returns NULL if it isn't there.
+ */
+const unsigned char *
+packet6_find_option(const unsigned char *opts, unsigned len, unsigned code,
+		    unsigned *olen) {
+	unsigned c, l;
+
+	while (len >= 4) {
+		c = getUShort(opts);
+		l = getUShort(opts + 2);
+		if (len - 4 < l)
+			break;
+		if (c == code) {
+			*olen = l;
+			return (opts + 4);
+		}
+		opts += 4 + l;
+		len -= 4 + l;
+	}
+	return (NULL);
+}
+
+/*
+ * Find the client's message in a raw DHCPv6 message, looking inside any
+ * relay messages it is wrapped in.  Returns the client's message and sets
+ * *mlen to its length, or returns NULL if it is malformed or too deeply
+ * relayed.  If link is not NULL it is set to the link-address of the
+ * outermost relay message, or left alone if there is none.
+ */
+const unsigned char *
+packet6_client_msg(const unsigned char *buf, unsigned len, unsigned *mlen,
+		   const unsigned char **link) {
+	const unsigned relay_hdr = offsetof(struct dhcpv6_relay_packet,
+					    options);
+	unsigned hops;
+
+	for (hops = 0; len > 0 &&
+	     (buf[0] == DHCPV6_RELAY_FORW || buf[0] == DHCPV6_RELAY_REPL);
+	     hops++) {
+		if (hops > HOP_COUNT_LIMIT || len < relay_hdr)
+			return (NULL);
+		if (hops == 0 && link != NULL)
+			*link = ((const struct dhcpv6_relay_packet *)buf)->
+				link_address;
+		buf = packet6_find_option(buf + relay_hdr, len - relay_hdr,
+					  D6O_RELAY_MSG, &len);
+		if (buf == NULL)
+			return (NULL);
+	}
+	if (len < offsetof(struct dhcpv6_packet, options))
+		return (NULL);
+	*mlen = len;
+	return (buf);
+}
+
 #ifdef DHCPv6
 void
 do_packet6(struct interface_info *interface, const char *packet,
@@ -4155,7 +4289,15 @@ do_packet6(struct interface_info *interface, const char *packet,
 
 	decoded_packet->unicast = was_unicast;
 
+	/* The options haven't been parsed, so the client isn't known. */
 	msg_type = packet[0];
+	PROBE_ARGS(PACKET_START, (msg_type == DHCPV6_RELAY_FORW ||
+				  msg_type == DHCPV6_RELAY_REPL) ? 0 :
+		   (((u_int32_t)(unsigned char)packet[1] << 16) |
+		    ((unsigned char)packet[2] << 8) |
+		    (unsigned char)packet[3]), 0);
+	PROBE(PARSE_START);
+
 	if ((msg_type == DHCPV6_RELAY_FORW) ||
 	    (msg_type == DHCPV6_RELAY_REPL)) {
 		int relaylen = (int)(offsetof(struct dhcpv6_relay_packet, options));
@@ -4219,7 +4361,9 @@ do_packet6(struct interface_info *interface, const char *packet,
 		}
 	}
 
+	PROBE_PACKET(PARSE_DONE, decoded_packet);
 	dhcpv6(decoded_packet);
+	PROBE_PACKET(PACKET_DONE, decoded_packet);
 
 	packet_dereference(&decoded_packet, MDL);
 
@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+#include <atf-c.h>
+#include "dhcpd.h"
+
+#if defined (USE_BPF_RECEIVE) || defined (USE_LPF_RECEIVE)
+# if defined (USE_LPF_RECEIVE)
+#  include <asm/types.h>
+#  include <linux/filter.h>
+#  define bpf_insn sock_filter
+# else
+#  include <sys/ioctl.h>
+#  include <net/bpf.h>
+# endif
+# include <netinet/in_systm.h>
+# include "includes/netinet/ip.h"
+# include "includes/netinet/if_ether.h"
+
+/* Defined in bpf.c. */
+extern struct bpf_insn dhcp_bpf_filter [];
+extern int dhcp_bpf_filter_len;
+extern struct bpf_insn *dhcp_bpf_giaddr_filter (const struct bpf_insn *,
+						int, int *);
+#if defined (RELAY_PORT)
+extern struct bpf_insn dhcp_bpf_relay_filter [];
+extern int dhcp_bpf_relay_filter_len;
+#endif
+
+#if !defined (BPF_MAXINSNS)
+# define BPF_MAXINSNS 512
+#endif
+
+/*
+ * Check the receive filter built by dhcp_bpf_giaddr_filter() by running
+ * it, and the fixed filter it was built from, over packets of each kind
+ * the fixed filters look at.  The built filter must give the same answer
+ * as the fixed one, except that it drops relayed packets whose giaddr is
+ * in none of the networks it was given.
+ */
+
+#define TEST_RELAY_PORT	1067
+
+/* Room for the longest IP header. */
+#define PACKET_SIZE	(14 + 60 + 8 + sizeof(struct dhcp_packet))
+
+/* The networks the giaddr must be in, as the server would set them. */
+static u_int32_t test_giaddrs[] = {
+	0x0a000000, 0xff000000,		/* 10.0.0.0/8 */
+	0xc0000200, 0xffffff00,		/* 192.0.2.0/24 */
+};
+
+static u_int32_t test_addrs[] = {
+	0,				/* not relayed */
+	0x0a010203,			/* 10.1.2.3 */
+	0xc0000209,			/* 192.0.2.9 */
+	0xc0000309,			/* 192.0.3.9 */
+	0xc6336401,			/* 198.51.100.1 */
+};
+
+/* Run a filter program over a packet, and return what it returns. */
+static u_int32_t
+run_filter(const struct bpf_insn *prog, int len,
+	   const unsigned char *pkt, unsigned pkt_len) {
+	u_int32_t a = 0, x = 0, mem[16];
+	const struct bpf_insn *insn;
+	u_int32_t k;
+	int pc;
+
+	memset(mem, 0, sizeof(mem));
+	for (pc = 0; pc < len; pc++) {
+		insn = &prog[pc];
+		k = insn->k;
+		switch (insn->code) {
+		case BPF_LD + BPF_B + BPF_ABS:
+			if (k + 1 > pkt_len)
+				return (0);
+			a = pkt[k];
+			break;
+		case BPF_LD + BPF_H + BPF_ABS:
+			if (k + 2 > pkt_len)
+				return (0);
+			a = getUShort(pkt + k);
+			break;
+		case BPF_LD + BPF_H + BPF_IND:
+			if (x + k + 2 > pkt_len)
+				return (0);
+			a = getUShort(pkt + x + k);
+			break;
+		case BPF_LD + BPF_W + BPF_IND:
+			if (x + k + 4 > pkt_len)
+				return (0);
+			a = getULong(pkt + x + k);
+			break;
+		case BPF_LDX + BPF_B + BPF_MSH:
+			if (k + 1 > pkt_len)
+				return (0);
+			x = (pkt[k] & 0xf) * 4;
+			break;
+		case BPF_LD + BPF_MEM:
+			a = mem[k];
+			break;
+		case BPF_ST:
+			mem[k] = a;
+			break;
+		case BPF_ALU + BPF_AND + BPF_K:
+			a &= k;
+			break;
+		case BPF_JMP + BPF_JA:
+			pc += k;
+			break;
+		case BPF_JMP + BPF_JEQ + BPF_K:
+			pc += (a == k) ? insn->jt : insn->jf;
+			break;
+		case BPF_JMP + BPF_JSET + BPF_K:
+			pc += (a & k) ? insn->jt : insn->jf;
+			break;
+		case BPF_RET + BPF_K:
+			return (k);
+		default:
+			atf_tc_fail("unexpected instruction %#x at %d",
+				    (unsigned)insn->code, pc);
+		}
+	}
+	atf_tc_fail("ran off the end of the program");
+	return (0);
+}
+
+/* Build an Ethernet frame holding a DHCP packet, and return its length. */
+static unsigned
+make_packet(unsigned char *pkt, int ip_words, int proto, int frag,
+	    int port, u_int32_t giaddr) {
+	unsigned char *ip, *udp;
+	struct dhcp_packet *dhcp;
+
+	memset(pkt, 0, PACKET_SIZE);
+	putUShort(pkt + 12, ETHERTYPE_IP);
+	ip = pkt + 14;
+	ip[0] = 0x40 | ip_words;
+	ip[9] = proto;
+	putUShort(ip + 6, frag);
+	udp = ip + ip_words * 4;
+	putUShort(udp, 68);
+	putUShort(udp + 2, port);
+	dhcp = (struct dhcp_packet *)(udp + 8);
+	dhcp->op = BOOTREQUEST;
+	putULong((unsigned char *)&dhcp->giaddr, giaddr);
+	return (udp + 8 + sizeof(*dhcp) - pkt);
+}
+
+/* Whether giaddr is in one of the test networks. */
+static int
+known_giaddr(u_int32_t giaddr) {
+	unsigned i;
+
+	for (i = 0; i < sizeof(test_giaddrs) / sizeof(test_giaddrs[0]);
+	     i += 2)
+		if ((giaddr & test_giaddrs[i + 1]) == test_giaddrs[i])
+			return (1);
+	return (0);
+}
+
+/* Compare the filter built from base with base, over every kind of
+   packet.  Returns how many packets base passed. */
+static int
+check_filter(const struct bpf_insn *base, int base_len) {
+	static const int ports[] = { 67, 68, TEST_RELAY_PORT };
+	unsigned char pkt[PACKET_SIZE];
+	struct bpf_insn *prog;
+	int prog_len, ip_words, proto, frag, passed = 0;
+	unsigned i, j, len;
+	int want, got;
+
+	prog = dhcp_bpf_giaddr_filter(base, base_len, &prog_len);
+	ATF_REQUIRE(prog != NULL);
+	ATF_REQUIRE_EQ(prog_len, base_len + 5 +
+		       4 * (int)(sizeof(test_giaddrs) /
+				 (2 * sizeof(test_giaddrs[0]))));
+
+	for (ip_words = 5; ip_words <= 6; ip_words++)
+	for (proto = IPPROTO_UDP; proto <= IPPROTO_UDP + 1; proto++)
+	for (frag = 0; frag <= 1; frag++)
+	for (i = 0; i < sizeof(ports) / sizeof(ports[0]); i++)
+	for (j = 0; j < sizeof(test_addrs) / sizeof(test_addrs[0]); j++) {
+		len = make_packet(pkt, ip_words, proto, frag, ports[i],
+				  test_addrs[j]);
+		want = run_filter(base, base_len, pkt, len) != 0;
+		passed += want;
+		if (test_addrs[j] != 0 && !known_giaddr(test_addrs[j]))
+			want = 0;
+		got = run_filter(prog, prog_len, pkt, len) != 0;
+		ATF_CHECK_MSG(got == want, "header %d bytes, protocol %d, "
+			      "fragment %d, port %d, giaddr %08x: %s",
+			      ip_words * 4, proto, frag, ports[i],
+			      (unsigned)test_addrs[j],
+			      got ? "passed" : "dropped");
+	}
+	dfree(prog, MDL);
+	return (passed);
+}
+
+ATF_TC(bpf_giaddr_none);
+ATF_TC_HEAD(bpf_giaddr_none, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify no giaddr filter is built "
+			  "without networks, or with too many");
+}
+
+ATF_TC_BODY(bpf_giaddr_none, tc)
+{
+	u_int32_t *many;
+	int len, count;
+
+	dhcp_bpf_giaddrs = NULL;
+	dhcp_bpf_giaddr_count = 0;
+	ATF_CHECK(dhcp_bpf_giaddr_filter(dhcp_bpf_filter,
+					 dhcp_bpf_filter_len, &len) == NULL);
+
+	/* More networks than a filter program may hold instructions for. */
+	count = BPF_MAXINSNS / 4 + 1;
+	many = dmalloc(2 * count * sizeof(*many), MDL);
+	ATF_REQUIRE(many != NULL);
+	dhcp_bpf_giaddrs = many;
+	dhcp_bpf_giaddr_count = count;
+	ATF_CHECK(dhcp_bpf_giaddr_filter(dhcp_bpf_filter,
+					 dhcp_bpf_filter_len, &len) == NULL);
+	dfree(many, MDL);
+}
+
+ATF_TC(bpf_giaddr_filter);
+ATF_TC_HEAD(bpf_giaddr_filter, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify the giaddr filter built from "
+			  "dhcp_bpf_filter drops unknown relays and nothing "
+			  "else");
+}
+
+ATF_TC_BODY(bpf_giaddr_filter, tc)
+{
+	dhcp_bpf_giaddrs = test_giaddrs;
+	dhcp_bpf_giaddr_count = sizeof(test_giaddrs) /
+				(2 * sizeof(test_giaddrs[0]));
+
+	/* The fixed filter passes unfragmented UDP to port 67, with
+	   either header length and any giaddr. */
+	ATF_CHECK_EQ(check_filter(dhcp_bpf_filter, dhcp_bpf_filter_len),
+		     2 * 5);
+}
+
+ATF_TC(bpf_giaddr_relay_filter);
+ATF_TC_HEAD(bpf_giaddr_relay_filter, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify the giaddr filter built from "
+			  "dhcp_bpf_relay_filter drops unknown relays and "
+			  "nothing else");
+}
+
+ATF_TC_BODY(bpf_giaddr_relay_filter, tc)
+{
+#if defined (RELAY_PORT)
+	dhcp_bpf_giaddrs = test_giaddrs;
+	dhcp_bpf_giaddr_count = sizeof(test_giaddrs) /
+				(2 * sizeof(test_giaddrs[0]));
+
+	/* As if_register_receive() patches it for a relay port.  The
+	   fixed filter then passes packets to that port as well. */
+	dhcp_bpf_relay_filter[10].k = TEST_RELAY_PORT;
+	ATF_CHECK_EQ(check_filter(dhcp_bpf_relay_filter,
+				  dhcp_bpf_relay_filter_len), 2 * 2 * 5);
+#else
+	atf_tc_skip("relay port support is not built");
+#endif
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, bpf_giaddr_none);
+	ATF_TP_ADD_TC(tp, bpf_giaddr_filter);
+	ATF_TP_ADD_TC(tp, bpf_giaddr_relay_filter);
+	return (atf_no_error());
+}
+
+#else /* USE_BPF_RECEIVE || USE_LPF_RECEIVE */
+
+ATF_TC(bpf_giaddr_filter);
+ATF_TC_HEAD(bpf_giaddr_filter, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify the giaddr packet filter");
+}
+
+ATF_TC_BODY(bpf_giaddr_filter, tc)
+{
+	atf_tc_skip("packet filters are not built on this system");
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, bpf_giaddr_filter);
+	return (atf_no_error());
+}
+
+#endif /* USE_BPF_RECEIVE || USE_LPF_RECEIVE */
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+#include <atf-c.h>
+#include "dhcpd.h"
+
+struct expected_token {
+	enum dhcp_token token;
+	const char *text;
+	int line;
+	int lpos;
+};
+
+/*
+ * Lex text and check each token and where it was found.  Note that the
+ * column reported for a token that follows one ended by reading and
+ * putting back a character is one past where it really starts.
+ */
+static void
+check_tokens(const char *text, int eolp, int raw,
+	     const struct expected_token *expected) {
+	struct parse *cfile = NULL;
+	const char *val;
+	unsigned len;
+	enum dhcp_token token;
+	int i;
+
+	if (new_parse(&cfile, -1, (char *)text, strlen(text), "test",
+		      eolp) != ISC_R_SUCCESS)
+		atf_tc_fail("new_parse failed");
+
+	for (i = 0; ; i++) {
+		if (raw)
+			token = next_raw_token(&val, &len, cfile);
+		else
+			token = next_token(&val, &len, cfile);
+
+		if (token != expected[i].token)
+			atf_tc_fail("token %d: got %d, expected %d (%s)", i,
+				    token, expected[i].token, expected[i].text);
+		if (token == END_OF_FILE)
+			break;
+		if (len != strlen(expected[i].text) ||
+		    memcmp(val, expected[i].text, len) != 0)
+			atf_tc_fail("token %d: got \"%.*s\", expected \"%s\"",
+				    i, (int)len, val, expected[i].text);
+		if (expected[i].line != 0 &&
+		    (cfile->lexline != expected[i].line ||
+		     cfile->lexchar != expected[i].lpos))
+			atf_tc_fail("token %d: at %d:%d, expected %d:%d", i,
+				    cfile->lexline, cfile->lexchar,
+				    expected[i].line, expected[i].lpos);
+	}
+
+	end_parse(&cfile);
+}
+
+ATF_TC(conflex_keywords);
+
+ATF_TC_HEAD(conflex_keywords, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify keyword recognition.");
+}
+
+ATF_TC_BODY(conflex_keywords, tc)
+{
+	/* Keywords are case insensitive; anything else is a name, or a
+	   number-or-name if it is all hex digits after the first
+	   character. */
+	static const struct expected_token expected[] = {
+		{ LEASE, "lease", 0, 0 },
+		{ TOKEN_ABANDONED, "ABANDONED", 0, 0 },
+		{ TOKEN_ACTIVE, "Active", 0, 0 },
+		{ DO_FORWARD_UPDATE, "do-forward-update", 0, 0 },
+		{ DO_FORWARD_UPDATE, "do-forward-updates", 0, 0 },
+		{ USE_LEASE_ADDR_FOR_DEFAULT_ROUTE,
+		  "use-lease-addr-for-default-route", 0, 0 },
+		{ ZONE, "zone", 0, 0 },
+		{ NAME, "zones", 0, 0 },
+		{ NAME, "leas", 0, 0 },
+		{ NAME, "fooBar", 0, 0 },
+		{ NUMBER_OR_NAME, "abc", 0, 0 },
+		{ NUMBER_OR_NAME, "gab", 0, 0 },
+		{ NUMBER_OR_NAME, "0x1f", 0, 0 },
+		{ NUMBER, "123", 0, 0 },
+		{ NUMBER, "-5", 0, 0 },
+		{ NAME, "10-a_z", 0, 0 },
+		{ SEMI, ";", 0, 0 },
+		{ END_OF_FILE, "", 0, 0 }
+	};
+
+	check_tokens("lease ABANDONED Active do-forward-update "
+		     "do-forward-updates use-lease-addr-for-default-route "
+		     "zone zones leas fooBar abc gab 0x1f 123 -5 10-a_z;",
+		     0, 0, expected);
+}
+
+ATF_TC(conflex_strings);
+
+ATF_TC_HEAD(conflex_strings, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify string constants.");
+}
+
+ATF_TC_BODY(conflex_strings, tc)
+{
+	static const struct expected_token expected[] = {
+		{ STRING, "plain", 1, 1 },
+		{ STRING, "a\tb\"c", 1, 10 },
+		{ STRING, "\001\021", 1, 20 },
+		{ STRING, "two\nlines", 1, 31 },
+		{ STRING, "", 2, 9 },
+		{ END_OF_FILE, "", 0, 0 }
+	};
+
+	check_tokens("\"plain\" \"a\\tb\\\"c\" \"\\001\\x11\" \"two\nlines\" \"\"",
+		     0, 0, expected);
+}
+
+ATF_TC(conflex_lines);
+
+ATF_TC_HEAD(conflex_lines, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+			  "Verify comments, whitespace and positions.");
+}
+
+ATF_TC_BODY(conflex_lines, tc)
+{
+	static const struct expected_token expected[] = {
+		{ HOST, "host", 2, 4 },
+		{ NAME, "foo", 2, 9 },
+		{ LBRACE, "{", 2, 13 },
+		{ FIXED_ADDR, "fixed-address", 4, 3 },
+		{ NUMBER, "10", 4, 17 },
+		{ DOT, ".", 4, 19 },
+		{ NUMBER, "0", 4, 19 },
+		{ SEMI, ";", 4, 21 },
+		{ RBRACE, "}", 5, 2 },
+		{ END_OF_FILE, "", 0, 0 }
+	};
+
+	/* Whitespace and newlines as tokens.  A comment takes its
+	   newline with it. */
+	static const struct expected_token raw_expected[] = {
+		{ NUMBER_OR_NAME, "a", 1, 1 },
+		{ WHITESPACE, " \t ", 0, 0 },
+		{ NUMBER_OR_NAME, "b", 1, 6 },
+		{ EOL, "\n", 0, 0 },
+		{ WHITESPACE, "  ", 0, 0 },
+		{ NUMBER, "1", 2, 4 },
+		{ WHITESPACE, " ", 0, 0 },
+		{ END_OF_FILE, "", 0, 0 }
+	};
+
+	check_tokens("# a comment\n  host foo {  # another\n\n"
+		     "\tfixed-address 10.0;\n}\n", 0, 0, expected);
+	check_tokens("a \t b\n  1 # comment\n", 1, 1, raw_expected);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, conflex_keywords);
+	ATF_TP_ADD_TC(tp, conflex_strings);
+	ATF_TP_ADD_TC(tp, conflex_lines);
+
+	return (atf_no_error());
+}
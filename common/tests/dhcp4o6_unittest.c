@@ -0,0 +1,374 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+#include <atf-c.h>
+#include "dhcpd.h"
+
+#if defined (DHCP4o6_RING)
+#include <sys/mman.h>
+
+/*
+ * Tests for the DHCPv4 over DHCPv6 shared memory rings.  The code under
+ * test is the DHCPv6 side, which puts messages on ring 0 and takes them
+ * off ring 1.  The test plays the DHCPv4 side: it maps the same ring
+ * file, and has a socket connected to the DHCPv6 side's for doorbells
+ * and for the messages that don't go on the ring.
+ */
+
+#define RING_TEST_FILE	"dhcp4o6_ring_test"
+
+static struct dhcp4o6_rings *rings;
+static int peer = -1;
+
+/* Make and map an empty ring file, for the test to set up before the
+   code under test sees it. */
+static void
+make_rings(void) {
+	int fd;
+
+	unlink(RING_TEST_FILE);
+	fd = open(RING_TEST_FILE, O_RDWR | O_CREAT, 0600);
+	ATF_REQUIRE(fd >= 0);
+	ATF_REQUIRE(ftruncate(fd, sizeof(*rings)) == 0);
+	rings = mmap(NULL, sizeof(*rings), PROT_READ | PROT_WRITE,
+		     MAP_SHARED, fd, 0);
+	ATF_REQUIRE(rings != MAP_FAILED);
+	close(fd);
+
+	rings->magic = DHCP4o6_RING_MAGIC;
+	rings->size = DHCP4o6_RING_SIZE;
+	rings->cookie = 0x12345678;
+}
+
+/* Bind the test's socket to a free port one above another free one,
+   and set up the DHCPv6 side on that other one. */
+static void
+setup(void) {
+	struct sockaddr_in6 sin6;
+	int probe, i;
+	u_int16_t port = 0;
+
+	peer = socket(PF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+	if (peer < 0)
+		atf_tc_skip("no IPv6 sockets");
+	memset(&sin6, 0, sizeof(sin6));
+	sin6.sin6_family = AF_INET6;
+	sin6.sin6_addr.s6_addr[15] = 1;
+
+	for (i = 0; i < 100 && port == 0; i++) {
+		port = 20000 + (getpid() + i * 97) % 40000;
+		sin6.sin6_port = htons(port + 1);
+		if (bind(peer, (struct sockaddr *)&sin6, sizeof(sin6)) < 0) {
+			if (errno == EADDRNOTAVAIL)
+				atf_tc_skip("no IPv6 loopback address");
+			port = 0;
+			continue;
+		}
+		probe = socket(PF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+		ATF_REQUIRE(probe >= 0);
+		sin6.sin6_port = htons(port);
+		if (bind(probe, (struct sockaddr *)&sin6, sizeof(sin6)) < 0) {
+			close(peer);
+			peer = socket(PF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+			ATF_REQUIRE(peer >= 0);
+			port = 0;
+		}
+		close(probe);
+	}
+	ATF_REQUIRE(port != 0);
+	sin6.sin6_port = htons(port);
+	ATF_REQUIRE(connect(peer, (struct sockaddr *)&sin6,
+			    sizeof(sin6)) == 0);
+	ATF_REQUIRE(fcntl(peer, F_SETFL, O_NONBLOCK) == 0);
+
+	ATF_REQUIRE(dhcp_context_create(DHCP_CONTEXT_PRE_DB |
+					DHCP_CONTEXT_POST_DB,
+					NULL, NULL) == ISC_R_SUCCESS);
+	ATF_REQUIRE(omapi_init() == ISC_R_SUCCESS);
+	local_family = AF_INET6;
+	dhcp4o6_ring_file = RING_TEST_FILE;
+	dhcp4o6_setup(htons(port));
+}
+
+/* Copy to or from a ring, a byte at a time so as not to share the code
+   under test's arithmetic. */
+static void
+peer_write(struct dhcp4o6_ring *ring, u_int32_t at, const void *buf,
+	   unsigned len) {
+	unsigned i;
+
+	for (i = 0; i < len; i++)
+		ring->data[(at + i) % DHCP4o6_RING_SIZE] =
+			((const unsigned char *)buf)[i];
+}
+
+static void
+peer_read(const struct dhcp4o6_ring *ring, u_int32_t at, void *buf,
+	  unsigned len) {
+	unsigned i;
+
+	for (i = 0; i < len; i++)
+		((unsigned char *)buf)[i] =
+			ring->data[(at + i) % DHCP4o6_RING_SIZE];
+}
+
+/* Put a message on the ring to the DHCPv6 side. */
+static void
+peer_put(const unsigned char *msg, u_int32_t len) {
+	struct dhcp4o6_ring *ring = &rings->ring[1];
+
+	peer_write(ring, ring->put, &len, 4);
+	peer_write(ring, ring->put + 4, msg, len);
+	__atomic_store_n(&ring->put, ring->put + 4 + ((len + 3) & ~3),
+			 __ATOMIC_SEQ_CST);
+}
+
+/* Take a message off the ring from the DHCPv6 side, returning its
+   length, or -1 if there is none. */
+static int
+peer_get(unsigned char *msg, unsigned size) {
+	struct dhcp4o6_ring *ring = &rings->ring[0];
+	u_int32_t len;
+
+	if (ring->put == ring->taken)
+		return (-1);
+	peer_read(ring, ring->taken, &len, 4);
+	ATF_REQUIRE(len <= size);
+	peer_read(ring, ring->taken + 4, msg, len);
+	__atomic_store_n(&ring->taken, ring->taken + 4 + ((len + 3) & ~3),
+			 __ATOMIC_SEQ_CST);
+	return (len);
+}
+
+/* Fill a message with a pattern that depends on n. */
+static void
+pattern(unsigned char *msg, unsigned len, int n) {
+	unsigned i;
+
+	for (i = 0; i < len; i++)
+		msg[i] = (unsigned char)(n * 31 + i);
+}
+
+ATF_TC(dhcp4o6_ring_stale);
+ATF_TC_HEAD(dhcp4o6_ring_stale, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify messages left on the ring "
+			  "from before a side starts are discarded");
+}
+
+ATF_TC_BODY(dhcp4o6_ring_stale, tc)
+{
+	struct data_string raw;
+	unsigned char msg[100];
+
+	make_rings();
+	pattern(msg, sizeof(msg), 1);
+	peer_put(msg, sizeof(msg));
+	ATF_REQUIRE(rings->ring[1].put != 0);
+
+	setup();
+	ATF_CHECK_EQ(rings->ring[1].taken, rings->ring[1].put);
+	ATF_CHECK_EQ(rings->ring[1].ready, 1);
+	ATF_CHECK_EQ(dhcp4o6_ring_get(&raw), 0);
+
+	/* A message put on after that is taken off. */
+	pattern(msg, sizeof(msg), 2);
+	peer_put(msg, 50);
+	ATF_REQUIRE_EQ(dhcp4o6_ring_get(&raw), 1);
+	ATF_CHECK_EQ(raw.len, 50);
+	ATF_CHECK(memcmp(raw.data, msg, 50) == 0);
+	data_string_forget(&raw, MDL);
+	ATF_CHECK_EQ(dhcp4o6_ring_get(&raw), 0);
+	unlink(RING_TEST_FILE);
+}
+
+ATF_TC(dhcp4o6_ring_wrap);
+ATF_TC_HEAD(dhcp4o6_ring_wrap, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify messages that straddle the "
+			  "end of the ring, and the byte counts wrapping, "
+			  "come through intact");
+}
+
+ATF_TC_BODY(dhcp4o6_ring_wrap, tc)
+{
+	unsigned char hdr[4], msg[100], got[200];
+	u_int32_t bell[2];
+	struct data_string raw;
+	int i;
+
+	/* Both rings 40 bytes short of the end, which is also where the
+	   byte counts wrap. */
+	make_rings();
+	rings->ring[0].put = rings->ring[0].taken = 0U - 40;
+	rings->ring[1].put = rings->ring[1].taken = 0U - 40;
+	rings->ring[0].ready = 1;
+	setup();
+
+	for (i = 0; i < 3; i++) {
+		pattern(msg, sizeof(msg), i);
+		peer_put(msg, sizeof(msg) - i);
+	}
+	ATF_CHECK(rings->ring[1].put < 1000);
+	for (i = 0; i < 3; i++) {
+		pattern(msg, sizeof(msg), i);
+		ATF_REQUIRE_EQ(dhcp4o6_ring_get(&raw), 1);
+		ATF_CHECK_EQ(raw.len, sizeof(msg) - i);
+		ATF_CHECK(memcmp(raw.data, msg, raw.len) == 0);
+		data_string_forget(&raw, MDL);
+	}
+	ATF_CHECK_EQ(dhcp4o6_ring_get(&raw), 0);
+
+	/* The other way, with a header that lands before the end and data
+	   that straddles it. */
+	for (i = 0; i < 3; i++) {
+		pattern(hdr, sizeof(hdr), i + 10);
+		pattern(msg, sizeof(msg), i + 20);
+		ATF_CHECK_EQ(dhcp4o6_send(hdr, sizeof(hdr), msg, sizeof(msg)),
+			     sizeof(hdr) + sizeof(msg));
+	}
+	ATF_CHECK(rings->ring[0].put < 1000);
+	for (i = 0; i < 3; i++) {
+		pattern(hdr, sizeof(hdr), i + 10);
+		pattern(msg, sizeof(msg), i + 20);
+		ATF_REQUIRE_EQ(peer_get(got, sizeof(got)),
+			       sizeof(hdr) + sizeof(msg));
+		ATF_CHECK(memcmp(got, hdr, sizeof(hdr)) == 0);
+		ATF_CHECK(memcmp(got + sizeof(hdr), msg, sizeof(msg)) == 0);
+	}
+	ATF_CHECK_EQ(peer_get(got, sizeof(got)), -1);
+
+	/* Only the first message, put on an empty ring, rang the bell. */
+	ATF_REQUIRE_EQ(recv(peer, bell, sizeof(bell), 0), sizeof(bell));
+	ATF_CHECK_EQ(bell[0], DHCP4o6_RING_MAGIC);
+	ATF_CHECK_EQ(bell[1], rings->cookie);
+	ATF_CHECK(recv(peer, bell, sizeof(bell), 0) < 0);
+	unlink(RING_TEST_FILE);
+}
+
+ATF_TC(dhcp4o6_ring_full);
+ATF_TC_HEAD(dhcp4o6_ring_full, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify messages go on the socket "
+			  "until the ring is ready, and when it is full");
+}
+
+ATF_TC_BODY(dhcp4o6_ring_full, tc)
+{
+	static unsigned char msg[60000], got[60004];
+	unsigned char hdr[4];
+	u_int32_t put;
+	int i, sent, on_ring;
+
+	make_rings();
+	setup();
+	pattern(hdr, sizeof(hdr), 1);
+	pattern(msg, sizeof(msg), 2);
+
+	/* The other side hasn't said it reads the ring. */
+	ATF_CHECK_EQ(dhcp4o6_send(hdr, sizeof(hdr), msg, 100), 104);
+	ATF_CHECK_EQ(rings->ring[0].put, 0);
+	ATF_CHECK_EQ(recv(peer, got, sizeof(got), 0), 104);
+
+	rings->ring[0].ready = 1;
+	sent = DHCP4o6_RING_SIZE / (4 + sizeof(hdr) + sizeof(msg)) + 3;
+	for (i = 0; i < sent; i++) {
+		put = rings->ring[0].put;
+		ATF_CHECK_EQ(dhcp4o6_send(hdr, sizeof(hdr), msg, sizeof(msg)),
+			     sizeof(got));
+		if (rings->ring[0].put == put)
+			break;
+	}
+	on_ring = i;
+	ATF_CHECK_EQ(on_ring, DHCP4o6_RING_SIZE / (4 + sizeof(got)));
+	ATF_CHECK(rings->ring[0].put <= DHCP4o6_RING_SIZE);
+
+	/* The doorbell, then the message that didn't fit. */
+	ATF_CHECK_EQ(recv(peer, got, sizeof(got), 0), 8);
+	ATF_REQUIRE_EQ(recv(peer, got, sizeof(got), 0), sizeof(got));
+	ATF_CHECK(memcmp(got + sizeof(hdr), msg, sizeof(msg)) == 0);
+	ATF_CHECK(recv(peer, got, sizeof(got), 0) < 0);
+
+	/* Once there is room, messages go on the ring again. */
+	ATF_REQUIRE_EQ(peer_get(got, sizeof(got)), sizeof(got));
+	put = rings->ring[0].put;
+	ATF_CHECK_EQ(dhcp4o6_send(hdr, sizeof(hdr), msg, sizeof(msg)),
+		     sizeof(got));
+	ATF_CHECK(rings->ring[0].put != put);
+	unlink(RING_TEST_FILE);
+}
+
+ATF_TC(dhcp4o6_ring_doorbell);
+ATF_TC_HEAD(dhcp4o6_ring_doorbell, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify doorbells are recognized, "
+			  "whether or not they are for this ring");
+}
+
+ATF_TC_BODY(dhcp4o6_ring_doorbell, tc)
+{
+	u_int32_t bell[2];
+
+	make_rings();
+	setup();
+
+	bell[0] = DHCP4o6_RING_MAGIC;
+	bell[1] = rings->cookie;
+	ATF_CHECK_EQ(dhcp4o6_doorbell((char *)bell, sizeof(bell)), 1);
+
+	/* One for another ring file is still taken for a doorbell, so it
+	   isn't handled as a message. */
+	bell[1] = rings->cookie ^ 1;
+	ATF_CHECK_EQ(dhcp4o6_doorbell((char *)bell, sizeof(bell)), 1);
+	ATF_CHECK_EQ(dhcp4o6_doorbell((char *)bell, sizeof(bell)), 1);
+
+	/* Anything else isn't a doorbell. */
+	ATF_CHECK_EQ(dhcp4o6_doorbell((char *)bell, sizeof(bell) - 1), 0);
+	bell[0] = ~DHCP4o6_RING_MAGIC;
+	ATF_CHECK_EQ(dhcp4o6_doorbell((char *)bell, sizeof(bell)), 0);
+	unlink(RING_TEST_FILE);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, dhcp4o6_ring_stale);
+	ATF_TP_ADD_TC(tp, dhcp4o6_ring_wrap);
+	ATF_TP_ADD_TC(tp, dhcp4o6_ring_full);
+	ATF_TP_ADD_TC(tp, dhcp4o6_ring_doorbell);
+	return (atf_no_error());
+}
+
+#else /* DHCP4o6_RING */
+
+ATF_TC(dhcp4o6_ring);
+ATF_TC_HEAD(dhcp4o6_ring, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "DHCPv4 over DHCPv6 rings");
+}
+
+ATF_TC_BODY(dhcp4o6_ring, tc)
+{
+	atf_tc_skip("DHCPv4 over DHCPv6 rings are not built");
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, dhcp4o6_ring);
+	return (atf_no_error());
+}
+
+#endif /* DHCP4o6_RING */
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+#include <atf-c.h>
+#include "dhcpd.h"
+#include <sys/time.h>
+
+/*
+ * Tests for the timeout list and the hash that timeouts are found in
+ * by the object they are for.  The objects are spaced so that they all
+ * fall in the same hash bucket, which makes the hash chain as long as
+ * the list.
+ */
+
+#define OBJECTS 4
+#define OBJECT_SPACING (16 * 1024)
+
+static char objects[OBJECTS * OBJECT_SPACING];
+
+#define OBJECT(n) ((void *)&objects[(n) * OBJECT_SPACING])
+
+static void
+tick(void *what) {
+}
+
+static void
+tock(void *what) {
+}
+
+static void
+setup(void) {
+	isc_result_t status;
+
+	status = dhcp_context_create(DHCP_CONTEXT_PRE_DB, NULL, NULL);
+	ATF_REQUIRE_MSG(status == ISC_R_SUCCESS, "dhcp_context_create: %s",
+			isc_result_totext(status));
+	gettimeofday(&cur_tv, NULL);
+}
+
+static void
+add(void (*func)(void *), int n, int secs) {
+	struct timeval tv;
+
+	tv.tv_sec = cur_tv.tv_sec + secs;
+	tv.tv_usec = cur_tv.tv_usec;
+	add_timeout(&tv, func, OBJECT(n), 0, 0);
+}
+
+/* Check that every timeout's back pointer points at what points to
+   it, and return the number on the list. */
+static int
+check_list(void) {
+	struct timeout **pp, *q;
+	int count = 0;
+
+	for (pp = &timeouts; (q = *pp) != NULL; pp = &q->next) {
+		ATF_CHECK(q->pprev == pp);
+		count++;
+	}
+	return (count);
+}
+
+/* The timeout on the list for func and object n, if there is one. */
+static struct timeout *
+listed(void (*func)(void *), int n) {
+	struct timeout *q;
+
+	for (q = timeouts; q != NULL; q = q->next)
+		if (q->func == func && q->what == OBJECT(n))
+			return (q);
+	return (NULL);
+}
+
+ATF_TC(timeout_readd);
+
+ATF_TC_HEAD(timeout_readd, tc) {
+	atf_tc_set_md_var(tc, "descr", "Adding a timeout for the same "
+			  "function and object replaces it.");
+}
+
+ATF_TC_BODY(timeout_readd, tc) {
+	struct timeout *q;
+
+	setup();
+
+	add(tick, 0, 10);
+	ATF_CHECK_EQ(check_list(), 1);
+
+	/* The same pair again moves the timeout... */
+	add(tick, 0, 20);
+	ATF_CHECK_EQ(check_list(), 1);
+	q = listed(tick, 0);
+	ATF_REQUIRE(q != NULL);
+	ATF_CHECK(q->when.tv_sec == cur_tv.tv_sec + 20);
+
+	/* ...but another function for the object is another timeout. */
+	add(tock, 0, 10);
+	ATF_CHECK_EQ(check_list(), 2);
+
+	cancel_timeout(tick, OBJECT(0));
+	ATF_CHECK_EQ(check_list(), 1);
+	ATF_CHECK(listed(tick, 0) == NULL);
+	ATF_CHECK(listed(tock, 0) != NULL);
+
+	/* Cancelling what isn't there does nothing. */
+	cancel_timeout(tick, OBJECT(0));
+	ATF_CHECK_EQ(check_list(), 1);
+
+	/* Once cancelled it can be added again, and found to replace. */
+	add(tick, 0, 30);
+	add(tick, 0, 40);
+	ATF_CHECK_EQ(check_list(), 2);
+	q = listed(tick, 0);
+	ATF_REQUIRE(q != NULL);
+	ATF_CHECK(q->when.tv_sec == cur_tv.tv_sec + 40);
+
+	cancel_timeout(tick, OBJECT(0));
+	cancel_timeout(tock, OBJECT(0));
+	ATF_CHECK_EQ(check_list(), 0);
+	ATF_CHECK(timeouts == NULL);
+}
+
+ATF_TC(timeout_unlink_middle);
+
+ATF_TC_HEAD(timeout_unlink_middle, tc) {
+	atf_tc_set_md_var(tc, "descr", "Timeouts can be taken off the "
+			  "middle, head and tail of the list.");
+}
+
+ATF_TC_BODY(timeout_unlink_middle, tc) {
+	int i;
+
+	setup();
+
+	/* Each is put at the front, so the list is 3, 2, 1, 0. */
+	for (i = 0; i < OBJECTS; i++)
+		add(tick, i, 10 + i);
+	ATF_REQUIRE_EQ(check_list(), OBJECTS);
+	ATF_REQUIRE(timeouts == listed(tick, OBJECTS - 1));
+
+	/* From the middle, of the list and of the hash chain. */
+	cancel_timeout(tick, OBJECT(2));
+	ATF_CHECK_EQ(check_list(), OBJECTS - 1);
+	ATF_CHECK(listed(tick, 2) == NULL);
+	ATF_CHECK(listed(tick, 3)->next == listed(tick, 1));
+
+	/* The others are still found in the hash: adding them again
+	   doesn't make new timeouts. */
+	for (i = 0; i < OBJECTS; i++)
+		if (i != 2)
+			add(tick, i, 20 + i);
+	ATF_CHECK_EQ(check_list(), OBJECTS - 1);
+
+	/* The head... */
+	cancel_timeout(tick, OBJECT(3));
+	ATF_CHECK_EQ(check_list(), OBJECTS - 2);
+	ATF_CHECK(timeouts == listed(tick, 1));
+	ATF_CHECK(timeouts->pprev == &timeouts);
+
+	/* ...and the tail. */
+	cancel_timeout(tick, OBJECT(0));
+	ATF_CHECK_EQ(check_list(), 1);
+	ATF_CHECK(timeouts == listed(tick, 1));
+	ATF_CHECK(timeouts->next == NULL);
+
+	/* The one in the middle comes back as a new timeout. */
+	add(tick, 2, 30);
+	ATF_CHECK_EQ(check_list(), 2);
+	ATF_CHECK(timeouts == listed(tick, 2));
+
+	cancel_timeout(tick, OBJECT(1));
+	cancel_timeout(tick, OBJECT(2));
+	ATF_CHECK(timeouts == NULL);
+}
+
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, timeout_readd);
+	ATF_TP_ADD_TC(tp, timeout_unlink_middle);
+
+	return (atf_no_error());
+}
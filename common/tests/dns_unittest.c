@@ -17,6 +17,7 @@
 #include <config.h>
 #include <atf-c.h>
 #include "dhcpd.h"
+#include <sys/time.h>
 
 /*
  * This file provides unit tests for the dns and ddns code.
@@ -29,6 +30,10 @@
  *
  * The tests for the standard dhcid records compare to values
  * from rfc 4701
+ *
+ * The batching and flow control tests send PTR updates for a zone
+ * whose server is 127.0.0.1.  No answer is needed: the counters show
+ * what was sent, and an update is completed by cancelling it.
  */
 
 #if defined (NSUPDATE)
@@ -165,6 +170,442 @@ ATF_TC_BODY(interim_dhcid, tc)
 
 }
 
+/* Enter a zone into the zone cache, with a single server if addr is
+   given.  A timeout of 0 is a zone from the configuration file. */
+static void
+add_zone(const char *name, TIME timeout, u_int16_t flags, const char *addr)
+{
+	struct dns_zone *zone = NULL;
+	struct in_addr ia;
+
+	ATF_REQUIRE(dns_zone_allocate(&zone, MDL));
+	zone->name = dmalloc(strlen(name) + 1, MDL);
+	ATF_REQUIRE(zone->name != NULL);
+	strcpy(zone->name, name);
+	zone->timeout = timeout;
+	zone->flags = flags;
+
+	if (addr != NULL) {
+		ATF_REQUIRE(inet_pton(AF_INET, addr, &ia) == 1);
+		ATF_REQUIRE(option_cache_allocate(&zone->primary, MDL));
+		ATF_REQUIRE(buffer_allocate(&zone->primary->data.buffer,
+					    sizeof(ia), MDL));
+		memcpy(zone->primary->data.buffer->data, &ia, sizeof(ia));
+		zone->primary->data.data = zone->primary->data.buffer->data;
+		zone->primary->data.len = sizeof(ia);
+	}
+
+	ATF_REQUIRE(enter_dns_zone(zone) == ISC_R_SUCCESS);
+	dns_zone_dereference(&zone, MDL);
+}
+
+static void
+ddns_setup(void)
+{
+	isc_result_t result;
+
+	result = dhcp_context_create(DHCP_CONTEXT_PRE_DB |
+				     DHCP_CONTEXT_POST_DB, NULL, NULL);
+	ATF_REQUIRE_MSG(result == ISC_R_SUCCESS, "dhcp_context_create: %s",
+			isc_result_totext(result));
+	gettimeofday(&cur_tv, NULL);
+
+	add_zone("2.0.192.in-addr.arpa.", 0, DNS_ZONE_ACTIVE, "127.0.0.1");
+}
+
+static void
+stop_loop(void *unused)
+{
+	isc_app_ctxsuspend(dhcp_gbl_ctx.actx);
+}
+
+/* Run the timers and the DNS code for msecs milliseconds. */
+static void
+run_loop(u_int32_t msecs)
+{
+	struct timeval tv;
+
+	gettimeofday(&cur_tv, NULL);
+	tv.tv_sec = cur_tv.tv_sec + msecs / 1000;
+	tv.tv_usec = cur_tv.tv_usec + (msecs % 1000) * 1000;
+	if (tv.tv_usec >= 1000000) {
+		tv.tv_sec++;
+		tv.tv_usec -= 1000000;
+	}
+	add_timeout(&tv, stop_loop, NULL, 0, 0);
+	(void) isc_app_ctxrun(dhcp_gbl_ctx.actx);
+}
+
+static int updates_done;
+
+static void
+update_done(dhcp_ddns_cb_t *ddns_cb, isc_result_t eresult)
+{
+	updates_done++;
+	ddns_cb_free(ddns_cb, MDL);
+}
+
+static void
+set_name(struct data_string *ds, const char *name)
+{
+	unsigned len = strlen(name);
+
+	ATF_REQUIRE(buffer_allocate(&ds->buffer, len + 1, MDL));
+	memcpy(ds->buffer->data, name, len + 1);
+	ds->data = ds->buffer->data;
+	ds->len = len;
+}
+
+/* Start adding the PTR record for 192.0.2.octet. */
+static dhcp_ddns_cb_t *
+send_ptr(int octet)
+{
+	dhcp_ddns_cb_t *ddns_cb;
+	char name[64];
+	isc_result_t result;
+
+	ddns_cb = ddns_cb_alloc(MDL);
+	ATF_REQUIRE(ddns_cb != NULL);
+	ddns_cb->state = DDNS_STATE_ADD_PTR;
+	ddns_cb->cur_func = update_done;
+	ddns_cb->ttl = 300;
+	snprintf(name, sizeof(name), "%d.2.0.192.in-addr.arpa.", octet);
+	set_name(&ddns_cb->rev_name, name);
+	snprintf(name, sizeof(name), "host%d.example.com.", octet);
+	set_name(&ddns_cb->fwd_name, name);
+
+	result = ddns_modify_ptr(ddns_cb, MDL);
+	ATF_REQUIRE_MSG(result == ISC_R_SUCCESS, "ddns_modify_ptr: %s",
+			isc_result_totext(result));
+	return (ddns_cb);
+}
+
+ATF_TC(ddns_batch_size);
+
+ATF_TC_HEAD(ddns_batch_size, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "A full batch is sent at once, "
+			  "ddns-batch-size updates per message.");
+}
+
+ATF_TC_BODY(ddns_batch_size, tc)
+{
+	int i;
+
+	ddns_setup();
+	ddns_batch_window = 100000;
+	ddns_batch_size = 3;
+
+	for (i = 1; i <= 5; i++)
+		(void) send_ptr(i);
+	ATF_CHECK_EQ(ddns_stats.sent, 0);
+	ATF_CHECK_EQ(ddns_stats.queue_depth, 5);
+
+	/* The batch filled up at the third update; the two left over
+	   go in a second message straight after the first. */
+	run_loop(200);
+	ATF_CHECK_EQ(ddns_stats.sent, 2);
+	ATF_CHECK_EQ(ddns_stats.records, 5);
+	ATF_CHECK_EQ(ddns_stats.batched, 5);
+	ATF_CHECK_EQ(ddns_stats.queue_depth, 0);
+	ATF_CHECK_EQ(ddns_stats.queue_max, 5);
+}
+
+ATF_TC(ddns_batch_window);
+
+ATF_TC_HEAD(ddns_batch_window, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "A batch that doesn't fill up is "
+			  "sent when ddns-batch-window has passed.");
+}
+
+ATF_TC_BODY(ddns_batch_window, tc)
+{
+	ddns_setup();
+	ddns_batch_window = 500;
+	ddns_batch_size = 32;
+
+	(void) send_ptr(1);
+	(void) send_ptr(2);
+
+	run_loop(100);
+	ATF_CHECK_EQ(ddns_stats.sent, 0);
+	ATF_CHECK_EQ(ddns_stats.queue_depth, 2);
+
+	run_loop(1000);
+	ATF_CHECK_EQ(ddns_stats.sent, 1);
+	ATF_CHECK_EQ(ddns_stats.batched, 2);
+	ATF_CHECK_EQ(ddns_stats.queue_depth, 0);
+}
+
+ATF_TC(ddns_batch_busy);
+
+ATF_TC_HEAD(ddns_batch_busy, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "A batch waits while its server has "
+			  "ddns-max-outstanding messages in flight.");
+}
+
+ATF_TC_BODY(ddns_batch_busy, tc)
+{
+	int i;
+
+	ddns_setup();
+	ddns_batch_window = 100000;
+	ddns_batch_size = 2;
+	ddns_max_outstanding = 1;
+
+	for (i = 1; i <= 4; i++)
+		(void) send_ptr(i);
+
+	/* The first message is never answered, so the second batch
+	   is put off for another window. */
+	run_loop(200);
+	ATF_CHECK_EQ(ddns_stats.sent, 1);
+	ATF_CHECK_EQ(ddns_stats.batched, 2);
+	ATF_CHECK_EQ(ddns_stats.queue_depth, 2);
+}
+
+ATF_TC(ddns_max_outstanding);
+
+ATF_TC_HEAD(ddns_max_outstanding, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Updates over ddns-max-outstanding "
+			  "are queued and sent as earlier ones complete.");
+}
+
+ATF_TC_BODY(ddns_max_outstanding, tc)
+{
+	dhcp_ddns_cb_t *first;
+
+	ddns_setup();
+	ddns_batch_window = 0;
+	ddns_max_outstanding = 2;
+
+	first = send_ptr(1);
+	(void) send_ptr(2);
+	(void) send_ptr(3);
+	ATF_CHECK_EQ(ddns_stats.sent, 2);
+	ATF_CHECK_EQ(ddns_stats.deferred, 1);
+	ATF_CHECK_EQ(ddns_stats.queue_depth, 1);
+	ATF_CHECK_EQ(ddns_stats.outstanding, 2);
+
+	/* Completing the first one lets the third go. */
+	ddns_cancel(first, MDL);
+	run_loop(200);
+	ATF_CHECK_EQ(ddns_stats.sent, 3);
+	ATF_CHECK_EQ(ddns_stats.queue_depth, 0);
+	ATF_CHECK(ddns_stats.completed >= 1);
+}
+
+/* Look up the zone for a name the way an update does. */
+static isc_result_t
+find_zone_for(const char *name)
+{
+	dhcp_ddns_cb_t *ddns_cb;
+	isc_result_t result;
+
+	ddns_cb = ddns_cb_alloc(MDL);
+	ATF_REQUIRE(ddns_cb != NULL);
+	set_name(&ddns_cb->fwd_name, name);
+	result = find_cached_zone(ddns_cb, FIND_FORWARD);
+	ddns_cb_free(ddns_cb, MDL);
+	return (result);
+}
+
+#if defined (DNS_ZONE_LOOKUP)
+ATF_TC(dns_zone_negative);
+
+ATF_TC_HEAD(dns_zone_negative, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "A domain without name servers is "
+			  "not looked up again until the entry expires.");
+}
+
+ATF_TC_BODY(dns_zone_negative, tc)
+{
+	struct dns_zone *zone = NULL;
+
+	gettimeofday(&cur_tv, NULL);
+	dns_zone_negative_ttl = 60;
+
+	/* The entry is for the domain the name is in. */
+	cache_negative_zone("host.sub.example.com.");
+	ATF_REQUIRE(dns_zone_lookup(&zone, "sub.example.com.") ==
+		    ISC_R_SUCCESS);
+	ATF_CHECK(zone->flags == (DNS_ZONE_INACTIVE | DNS_ZONE_NEGATIVE));
+	ATF_CHECK(zone->timeout == cur_time + 60);
+	ATF_CHECK(zone->primary == NULL);
+	dns_zone_dereference(&zone, MDL);
+	ATF_CHECK(find_zone_for("other.sub.example.com.") == ISC_R_FAILURE);
+
+	/* Still there at the end of the TTL, gone after it. */
+	cur_tv.tv_sec += 60;
+	ATF_CHECK(find_zone_for("other.sub.example.com.") == ISC_R_FAILURE);
+	cur_tv.tv_sec++;
+	ATF_CHECK(find_zone_for("other.sub.example.com.") == ISC_R_NOTFOUND);
+	ATF_CHECK(dns_zone_lookup(&zone, "sub.example.com.") ==
+		  ISC_R_NOTFOUND);
+
+	/* Nothing is cached for a top level domain... */
+	cache_negative_zone("host.com.");
+	ATF_CHECK(dns_zone_lookup(&zone, "com.") == ISC_R_NOTFOUND);
+
+	/* ...a zone we already have is left alone... */
+	add_zone("example.org.", 0, DNS_ZONE_ACTIVE, "192.0.2.1");
+	cache_negative_zone("host.example.org.");
+	ATF_CHECK(find_zone_for("host.example.org.") == ISC_R_SUCCESS);
+
+	/* ...and nothing at all with a TTL of 0. */
+	dns_zone_negative_ttl = 0;
+	cache_negative_zone("host.example.net.");
+	ATF_CHECK(dns_zone_lookup(&zone, "example.net.") == ISC_R_NOTFOUND);
+}
+#endif /* DNS_ZONE_LOOKUP */
+
+#define ZONE_CACHE_TEST_FILE "zone_cache_test"
+
+/* Check that a zone was loaded with one server. */
+static void
+check_loaded(const char *name, TIME timeout, const char *addr)
+{
+	struct dns_zone *zone = NULL;
+	struct in_addr ia;
+
+	ATF_REQUIRE_MSG(dns_zone_lookup(&zone, name) == ISC_R_SUCCESS,
+			"%s was not loaded", name);
+	ATF_CHECK(zone->timeout == timeout);
+	ATF_CHECK(zone->flags == DNS_ZONE_ACTIVE);
+	ATF_REQUIRE(inet_pton(AF_INET, addr, &ia) == 1);
+	ATF_REQUIRE(zone->primary != NULL);
+	ATF_CHECK(zone->primary->data.len == sizeof(ia));
+	ATF_CHECK(memcmp(zone->primary->data.data, &ia, sizeof(ia)) == 0);
+	dns_zone_dereference(&zone, MDL);
+}
+
+/* Drop a zone from the cache by expiring it. */
+static void
+forget_zone_named(const char *name)
+{
+	struct dns_zone *zone = NULL;
+
+	ATF_REQUIRE(dns_zone_lookup(&zone, name) == ISC_R_SUCCESS);
+	zone->timeout = 1;
+	dns_zone_dereference(&zone, MDL);
+	ATF_REQUIRE(dns_zone_lookup(&zone, name) == ISC_R_NOTFOUND);
+}
+
+ATF_TC(dns_zone_cache_round_trip);
+
+ATF_TC_HEAD(dns_zone_cache_round_trip, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "The zones we found are saved to "
+			  "the zone cache file and read back.");
+}
+
+ATF_TC_BODY(dns_zone_cache_round_trip, tc)
+{
+	struct dns_zone *zone = NULL;
+	TIME expires;
+
+	gettimeofday(&cur_tv, NULL);
+	dns_zone_cache_file = ZONE_CACHE_TEST_FILE;
+	expires = cur_time + 3600;
+
+	add_zone("found.example.", expires, DNS_ZONE_ACTIVE, "192.0.2.1");
+	add_zone("other.example.", expires + 1, DNS_ZONE_ACTIVE,
+		 "192.0.2.2");
+	/* None of these are saved. */
+	add_zone("config.example.", 0, DNS_ZONE_ACTIVE, "192.0.2.3");
+	add_zone("bad.example.", expires, DNS_ZONE_INACTIVE, "192.0.2.4");
+	add_zone("old.example.", cur_time, DNS_ZONE_ACTIVE, "192.0.2.5");
+
+	dns_zone_cache_save();
+	ATF_CHECK(access(ZONE_CACHE_TEST_FILE ".tmp", F_OK) != 0);
+
+	forget_zone_named("found.example.");
+	forget_zone_named("other.example.");
+	forget_zone_named("config.example.");
+	forget_zone_named("bad.example.");
+	forget_zone_named("old.example.");
+
+	dns_zone_cache_load();
+	check_loaded("found.example.", expires, "192.0.2.1");
+	check_loaded("other.example.", expires + 1, "192.0.2.2");
+	ATF_CHECK(dns_zone_lookup(&zone, "config.example.") ==
+		  ISC_R_NOTFOUND);
+	ATF_CHECK(dns_zone_lookup(&zone, "bad.example.") == ISC_R_NOTFOUND);
+	ATF_CHECK(dns_zone_lookup(&zone, "old.example.") == ISC_R_NOTFOUND);
+
+	/* A zone from the configuration file wins over the cache. */
+	forget_zone_named("found.example.");
+	add_zone("found.example.", 0, DNS_ZONE_ACTIVE, "192.0.2.9");
+	dns_zone_cache_load();
+	check_loaded("found.example.", 0, "192.0.2.9");
+}
+
+ATF_TC(dns_zone_cache_corrupt);
+
+ATF_TC_HEAD(dns_zone_cache_corrupt, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Malformed and truncated lines in "
+			  "the zone cache file are skipped.");
+}
+
+ATF_TC_BODY(dns_zone_cache_corrupt, tc)
+{
+	struct dns_zone *zone = NULL;
+	unsigned long expires;
+	FILE *fp;
+
+	gettimeofday(&cur_tv, NULL);
+	dns_zone_cache_file = ZONE_CACHE_TEST_FILE;
+	expires = (unsigned long)cur_time + 3600;
+
+	fp = fopen(ZONE_CACHE_TEST_FILE, "w");
+	ATF_REQUIRE(fp != NULL);
+	fprintf(fp, "# a comment\n\n");
+	fprintf(fp, "good.example. %lu 192.0.2.1\n", expires);
+	fprintf(fp, "noexpiry.example.\n");
+	fprintf(fp, "badexpiry.example. 12x 192.0.2.1\n");
+	fprintf(fp, "badaddr.example. %lu 192.0.2.999\n", expires);
+	fprintf(fp, "noaddr.example. %lu\n", expires);
+	fprintf(fp, "expired.example. %lu 192.0.2.1\n",
+		(unsigned long)cur_time - 1);
+	fprintf(fp, "\377\376\001 garbage\n");
+	fprintf(fp, "good2.example. %lu 192.0.2.2\n", expires);
+	/* The file ends part way through an address. */
+	fprintf(fp, "trunc.example. %lu 192.0.2", expires);
+	ATF_REQUIRE(fclose(fp) == 0);
+
+	dns_zone_cache_load();
+	check_loaded("good.example.", expires, "192.0.2.1");
+	check_loaded("good2.example.", expires, "192.0.2.2");
+	ATF_CHECK(dns_zone_lookup(&zone, "noexpiry.example.") ==
+		  ISC_R_NOTFOUND);
+	ATF_CHECK(dns_zone_lookup(&zone, "badexpiry.example.") ==
+		  ISC_R_NOTFOUND);
+	ATF_CHECK(dns_zone_lookup(&zone, "badaddr.example.") ==
+		  ISC_R_NOTFOUND);
+	ATF_CHECK(dns_zone_lookup(&zone, "noaddr.example.") ==
+		  ISC_R_NOTFOUND);
+	ATF_CHECK(dns_zone_lookup(&zone, "expired.example.") ==
+		  ISC_R_NOTFOUND);
+	ATF_CHECK(dns_zone_lookup(&zone, "trunc.example.") ==
+		  ISC_R_NOTFOUND);
+
+	/* A file that is cut off in the first name loads nothing. */
+	forget_zone_named("good.example.");
+	forget_zone_named("good2.example.");
+	fp = fopen(ZONE_CACHE_TEST_FILE, "w");
+	ATF_REQUIRE(fp != NULL);
+	fprintf(fp, "goo");
+	ATF_REQUIRE(fclose(fp) == 0);
+	dns_zone_cache_load();
+	ATF_CHECK(dns_zone_lookup(&zone, "goo.") == ISC_R_NOTFOUND);
+	ATF_CHECK(dns_zone_lookup(&zone, "good.example.") == ISC_R_NOTFOUND);
+}
+
 /* This macro defines main() method that will call specified
    test cases. tp and simple_test_case names can be whatever you want
    as long as it is a valid variable identifier. */
@@ -172,6 +613,15 @@ ATF_TP_ADD_TCS(tp)
 {
     ATF_TP_ADD_TC(tp, interim_dhcid);
     ATF_TP_ADD_TC(tp, standard_dhcid);
+    ATF_TP_ADD_TC(tp, ddns_batch_size);
+    ATF_TP_ADD_TC(tp, ddns_batch_window);
+    ATF_TP_ADD_TC(tp, ddns_batch_busy);
+    ATF_TP_ADD_TC(tp, ddns_max_outstanding);
+#if defined (DNS_ZONE_LOOKUP)
+    ATF_TP_ADD_TC(tp, dns_zone_negative);
+#endif
+    ATF_TP_ADD_TC(tp, dns_zone_cache_round_trip);
+    ATF_TP_ADD_TC(tp, dns_zone_cache_corrupt);
 
     return (atf_no_error());
 }
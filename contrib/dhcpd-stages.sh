@@ -0,0 +1,138 @@
+#!/bin/sh
+#
+# dhcpd-stages.sh
+#
+# Trace a running dhcpd through its stage probes (see includes/probes.h)
+# and write the time spent in each stage as folded stacks, ready for
+# Brendan Gregg's flamegraph.pl:
+#
+#	dhcpd-stages.sh -t 30 `pidof dhcpd` > stages.folded
+#	flamegraph.pl --countname=us stages.folded > stages.svg
+#
+# Each stack is the nesting of stages in which the time was spent, such
+# as "packet;ack;lease_update;commit", and its count is the time spent in
+# the innermost stage itself, in microseconds.  A summary of how often
+# each stage ran and how long it took is written to standard error.
+#
+# The server must be configured with --enable-usdt-probes.
+# bpftrace is used by default, with dhcpd-stages.bt from the same
+# directory as this script; -p uses perf instead, which needs the path to
+# the dhcpd binary if it can't be found from the process.
+#
+# Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+usage() {
+	echo "usage: $0 [-t seconds] [-p [-b dhcpd-binary]] pid" >&2
+	exit 1
+}
+
+secs=10
+perf=no
+exe=
+while getopts "t:pb:" opt; do
+	case $opt in
+	t) secs=$OPTARG ;;
+	p) perf=yes ;;
+	b) exe=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+shift `expr $OPTIND - 1`
+[ $# -eq 1 ] || usage
+pid=$1
+
+# Write each probe as "<nanoseconds> <probe> <xid> <client key>".
+events() {
+	if [ $perf = no ]; then
+		timeout -s INT $secs \
+			bpftrace -p $pid "`dirname $0`/dhcpd-stages.bt" |
+			grep '^[0-9]'
+		return
+	fi
+
+	[ -n "$exe" ] || exe=`readlink /proc/$pid/exe`
+	data=`mktemp` || exit 1
+	perf buildid-cache --add "$exe" &&
+		perf probe -q -x "$exe" --add 'sdt_dhcpd:*' || exit 1
+	perf record -q -o $data -e 'sdt_dhcpd:*' -p $pid -- sleep $secs
+	perf script -i $data -F time,event,trace 2>/dev/null |
+		awk '{
+			sub(/:$/, "", $1)
+			split($1, t, ".")
+			name = $2
+			sub(/^sdt_dhcpd:/, "", name)
+			sub(/:$/, "", name)
+			xid = key = 0
+			for (i = 3; i <= NF; i++) {
+				if ($i ~ /^arg1=/)
+					xid = substr($i, 6)
+				else if ($i ~ /^arg2=/)
+					key = substr($i, 6)
+			}
+			printf "%s%s %s %s %s\n", t[1],
+			       substr(t[2] "000000000", 1, 9), name, xid, key
+		}'
+	perf probe -q --del 'sdt_dhcpd:*'
+	rm -f $data
+}
+
+events | awk '
+function stackname(n,	i, s) {
+	s = stage[1]
+	for (i = 2; i <= n; i++)
+		s = s ";" stage[i]
+	return s
+}
+
+{
+	ns = $1
+	name = $2
+	if (name ~ /_start$/) {
+		sub(/_start$/, "", name)
+
+		# A packet or a run of delayed acks is the bottom of the
+		# stack; anything left open from the last one had returned
+		# early without reaching its _done probe.
+		if (name == "packet" || name == "delayed_acks")
+			depth = 0
+		depth++
+		stage[depth] = name
+		begin[depth] = ns
+		child[depth] = 0
+		next
+	}
+	if (name !~ /_done$/)
+		next
+	sub(/_done$/, "", name)
+
+	# Close any stages that were left open inside this one.
+	for (d = depth; d > 0 && stage[d] != name; d--)
+		;
+	if (d == 0)
+		next
+	depth = d
+
+	elapsed = (ns - begin[depth]) / 1000
+	folded[stackname(depth)] += elapsed - child[depth]
+	count[name]++
+	total[name] += elapsed
+	if (elapsed > max[name])
+		max[name] = elapsed
+	depth--
+	if (depth > 0)
+		child[depth] += elapsed
+}
+
+END {
+	for (s in folded)
+		printf "%s %d\n", s, folded[s]
+	printf "%-20s %10s %12s %12s\n", "stage", "count", "avg us",
+	       "max us" > "/dev/stderr"
+	for (s in count)
+		printf "%-20s %10d %12.1f %12.1f\n", s, count[s],
+		       total[s] / count[s], max[s] > "/dev/stderr"
+}'
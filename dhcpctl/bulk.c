@@ -0,0 +1,240 @@
+/* bulk.c
+
+   Opening many objects with one message. */
+
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+#include "dhcpd.h"
+#include <omapip/omapip_p.h>
+#include "dhcpctl.h"
+
+/* dhcpctl_new_bulk
+
+   synchronous - creates a local handle for a group of objects of one
+   type that are to be opened on the server with a single message.
+   returns nonzero status code if the handle couldn't be created
+   stores the handle through h if successful, and returns zero.
+   object_type is the ascii name of the type of the objects that will
+   be added to it - e.g., "host" */
+
+dhcpctl_status dhcpctl_new_bulk (dhcpctl_handle *h,
+				 dhcpctl_handle connection,
+				 const char *object_type)
+{
+	dhcpctl_bulk_object_t *b;
+	isc_result_t status;
+
+	b = (dhcpctl_bulk_object_t *)0;
+	status = omapi_object_allocate ((omapi_object_t **)&b,
+					dhcpctl_bulk_type, 0, MDL);
+	if (status != ISC_R_SUCCESS)
+		return status;
+
+	status = omapi_typed_data_new (MDL, &b -> rtype,
+				       omapi_datatype_string,
+				       object_type);
+	if (status == ISC_R_SUCCESS)
+		status = omapi_object_array_allocate (&b -> objects, MDL);
+	if (status == ISC_R_SUCCESS)
+		status = omapi_object_reference (h, (omapi_object_t *)b, MDL);
+	omapi_object_dereference ((omapi_object_t **)&b, MDL);
+	return status;
+}
+
+/* dhcpctl_bulk_add
+
+   synchronous
+   adds an object created with dhcpctl_new_object, with whatever values
+   are needed to look it up, create it or update it already set, to the
+   group.  Objects are opened in the order in which they were added, and
+   an object's index in that order is the one dhcpctl_bulk_status takes.
+   A group holds at most OMAPI_BULK_MAX objects.
+   returns nonzero status code if the object couldn't be added */
+
+dhcpctl_status dhcpctl_bulk_add (dhcpctl_handle bulk, dhcpctl_handle h)
+{
+	dhcpctl_bulk_object_t *b;
+
+	if (bulk -> type != dhcpctl_bulk_type ||
+	    h -> type != dhcpctl_remote_type)
+		return DHCP_R_INVALIDARG;
+	b = (dhcpctl_bulk_object_t *)bulk;
+	if (b -> objects -> count >= OMAPI_BULK_MAX)
+		return ISC_R_NOSPACE;
+
+	return omapi_object_array_extend (b -> objects, h, (int *)0, MDL);
+}
+
+/* dhcpctl_bulk_open
+
+   asynchronous - just queues the request
+   returns nonzero status code if the open couldn't be queued
+   returns zero if the open was queued
+   Opens every object in the group as dhcpctl_open_object would, but
+   with one message to the server and one reply, and with the changes
+   committed to the server's lease file together.  flags are as for
+   dhcpctl_open_object and apply to every object.  Once the request has
+   completed, the status from dhcpctl_wait_for_completion is success if
+   every object was opened, and each object has been updated with its
+   values on the server as if it had been opened on its own. */
+
+dhcpctl_status dhcpctl_bulk_open (dhcpctl_handle bulk,
+				  dhcpctl_handle connection,
+				  int flags)
+{
+	isc_result_t status;
+	omapi_object_t *message = (omapi_object_t *)0;
+	dhcpctl_bulk_object_t *b;
+	dhcpctl_remote_object_t *remote;
+	int i;
+
+	if (bulk -> type != dhcpctl_bulk_type)
+		return DHCP_R_INVALIDARG;
+	b = (dhcpctl_bulk_object_t *)bulk;
+
+	status = omapi_message_new (&message, MDL);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_set_int_value (message, (omapi_object_t *)0,
+				      "op", OMAPI_OP_BULK);
+	if (status == ISC_R_SUCCESS)
+		status = omapi_set_object_value (message, (omapi_object_t *)0,
+						 "notify-object", bulk);
+	if (status == ISC_R_SUCCESS && (flags & DHCPCTL_CREATE))
+		status = omapi_set_boolean_value (message, (omapi_object_t *)0,
+						  "create", 1);
+	if (status == ISC_R_SUCCESS && (flags & DHCPCTL_UPDATE))
+		status = omapi_set_boolean_value (message, (omapi_object_t *)0,
+						  "update", 1);
+	if (status == ISC_R_SUCCESS && (flags & DHCPCTL_EXCL))
+		status = omapi_set_boolean_value (message, (omapi_object_t *)0,
+						  "exclusive", 1);
+	if (status == ISC_R_SUCCESS)
+		status = omapi_set_value_str (message, (omapi_object_t *)0,
+					      "type", b -> rtype);
+
+	/* Until the answer comes, the objects have no status of their
+	   own. */
+	for (i = 0; status == ISC_R_SUCCESS && i < b -> objects -> count;
+	     i++) {
+		remote = (dhcpctl_remote_object_t *)b -> objects -> data [i];
+		remote -> waitstatus = ISC_R_INPROGRESS;
+		status = omapi_message_add_object (message,
+						   (omapi_object_t *)remote);
+	}
+
+	if (status == ISC_R_SUCCESS) {
+		b -> waitstatus = ISC_R_INPROGRESS;
+		status = omapi_message_register (message);
+	}
+	if (status == ISC_R_SUCCESS) {
+		status = omapi_protocol_send_message (connection -> outer,
+						      (omapi_object_t *)0,
+						      message,
+						      (omapi_object_t *)0);
+		if (status != ISC_R_SUCCESS)
+			omapi_message_unregister (message);
+	}
+
+	omapi_object_dereference (&message, MDL);
+	return status;
+}
+
+/* dhcpctl_bulk_status
+
+   synchronous
+   stores through s the result of opening the object with the given
+   index in the group, once the bulk open has completed.  If the server
+   didn't get as far as opening the objects, that is the status of the
+   whole request.
+   returns nonzero status code if there's no such object */
+
+dhcpctl_status dhcpctl_bulk_status (dhcpctl_handle bulk, int index,
+				    dhcpctl_status *s)
+{
+	dhcpctl_bulk_object_t *b;
+	dhcpctl_remote_object_t *remote;
+
+	if (bulk -> type != dhcpctl_bulk_type)
+		return DHCP_R_INVALIDARG;
+	b = (dhcpctl_bulk_object_t *)bulk;
+
+	if (index < 0 || index >= b -> objects -> count)
+		return DHCP_R_INVALIDARG;
+	remote = (dhcpctl_remote_object_t *)b -> objects -> data [index];
+
+	if (remote -> waitstatus == ISC_R_INPROGRESS)
+		*s = b -> waitstatus;
+	else
+		*s = remote -> waitstatus;
+	return ISC_R_SUCCESS;
+}
+
+/* Callback methods (not meant to be called directly) */
+
+isc_result_t dhcpctl_bulk_signal_handler (omapi_object_t *o,
+					  const char *name, va_list ap)
+{
+	dhcpctl_bulk_object_t *p;
+	omapi_typed_data_t *tv;
+
+	if (o -> type != dhcpctl_bulk_type)
+		return DHCP_R_INVALIDARG;
+	p = (dhcpctl_bulk_object_t *)o;
+
+	if (!strcmp (name, "status")) {
+		p -> waitstatus = va_arg (ap, isc_result_t);
+		if (p -> message)
+			omapi_typed_data_dereference (&p -> message, MDL);
+		tv = va_arg (ap, omapi_typed_data_t *);
+		if (tv)
+			omapi_typed_data_reference (&p -> message, tv, MDL);
+		if (o -> inner)
+			return omapi_signal_in (o -> inner, "ready");
+		return ISC_R_SUCCESS;
+	}
+
+	if (p -> inner && p -> inner -> type -> signal_handler)
+		return (*(p -> inner -> type -> signal_handler))
+			(p -> inner, name, ap);
+
+	return ISC_R_SUCCESS;
+}
+
+isc_result_t dhcpctl_bulk_destroy (omapi_object_t *h,
+				   const char *file, int line)
+{
+	dhcpctl_bulk_object_t *p;
+
+	if (h -> type != dhcpctl_bulk_type)
+		return DHCP_R_INVALIDARG;
+	p = (dhcpctl_bulk_object_t *)h;
+	if (p -> rtype)
+		omapi_typed_data_dereference (&p -> rtype, file, line);
+	if (p -> message)
+		omapi_typed_data_dereference (&p -> message, file, line);
+	if (p -> objects)
+		omapi_object_array_free (&p -> objects, file, line);
+	return ISC_R_SUCCESS;
+}
@@ -35,6 +35,7 @@
 
 omapi_object_type_t *dhcpctl_callback_type;
 omapi_object_type_t *dhcpctl_remote_type;
+omapi_object_type_t *dhcpctl_bulk_type;
 
 /* dhcpctl_initialize ()
 
@@ -81,6 +82,17 @@ dhcpctl_status dhcpctl_initialize ()
 	if (status != ISC_R_SUCCESS)
 		return status;
 
+	status = omapi_object_type_register (&dhcpctl_bulk_type,
+					     "dhcpctl-bulk",
+					     0, 0,
+					     dhcpctl_bulk_destroy,
+					     dhcpctl_bulk_signal_handler,
+					     0, 0, 0, 0, 0, 0, 0,
+					     sizeof (dhcpctl_bulk_object_t),
+					     0, RC_MISC);
+	if (status != ISC_R_SUCCESS)
+		return status;
+
 	return ISC_R_SUCCESS;
 }
 
@@ -222,6 +234,8 @@ dhcpctl_status dhcpctl_wait_for_completion (dhcpctl_handle h,
 	}
 	if (h -> type == dhcpctl_remote_type)
 		*s = ((dhcpctl_remote_object_t *)h) -> waitstatus;
+	else if (h -> type == dhcpctl_bulk_type)
+		*s = ((dhcpctl_bulk_object_t *)h) -> waitstatus;
 
 	return ISC_R_SUCCESS;
 }
@@ -276,6 +290,8 @@ dhcpctl_status dhcpctl_timed_wait_for_completion (dhcpctl_handle h,
 
 	if (h->type == dhcpctl_remote_type) {
 		*s = ((dhcpctl_remote_object_t *)h)->waitstatus;
+	} else if (h->type == dhcpctl_bulk_type) {
+		*s = ((dhcpctl_bulk_object_t *)h)->waitstatus;
 	}
 
 	return ISC_R_SUCCESS;
@@ -56,8 +56,17 @@ typedef struct {
 	omapi_handle_t remote_handle;
 } dhcpctl_remote_object_t;
 
+typedef struct {
+	OMAPI_OBJECT_PREAMBLE;
+	omapi_typed_data_t *rtype;
+	isc_result_t waitstatus;
+	omapi_typed_data_t *message;
+	omapi_array_t *objects;
+} dhcpctl_bulk_object_t;
+
 extern omapi_object_type_t *dhcpctl_callback_type;
 extern omapi_object_type_t *dhcpctl_remote_type;
+extern omapi_object_type_t *dhcpctl_bulk_type;
 
 dhcpctl_status dhcpctl_initialize (void);
 dhcpctl_status dhcpctl_connect (dhcpctl_handle *,
@@ -126,6 +135,15 @@ isc_result_t dhcpctl_remote_stuff_values (omapi_object_t *,
 isc_result_t dhcpctl_data_string_dereference (dhcpctl_data_string *,
 					      const char *, int);
 
+dhcpctl_status dhcpctl_new_bulk (dhcpctl_handle *,
+				 dhcpctl_handle, const char *);
+dhcpctl_status dhcpctl_bulk_add (dhcpctl_handle, dhcpctl_handle);
+dhcpctl_status dhcpctl_bulk_open (dhcpctl_handle, dhcpctl_handle, int);
+dhcpctl_status dhcpctl_bulk_status (dhcpctl_handle, int, dhcpctl_status *);
+isc_result_t dhcpctl_bulk_destroy (omapi_object_t *, const char *, int);
+isc_result_t dhcpctl_bulk_signal_handler (omapi_object_t *,
+					  const char *, va_list);
+
 dhcpctl_status dhcpctl_disconnect (dhcpctl_handle *, int);
 
 #endif /* _DHCPCTL_H_ */
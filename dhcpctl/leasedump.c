@@ -0,0 +1,160 @@
+/* leasedump.c
+
+   Print the contents of a dhcpd lease snapshot file. */
+
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "leasesnap.h"
+
+static void usage(const char *);
+static void print_time(const char *, int64_t);
+static void print_hex(const char *, const uint8_t *, unsigned);
+
+static void
+usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [-a] [-s state] snapshot-file\n", prog);
+	exit(1);
+}
+
+static void
+print_time(const char *label, int64_t t) {
+	char buf[32];
+	struct tm *tm;
+	time_t tt = (time_t)t;
+
+	if (t == 0) {
+		printf(" %s never", label);
+		return;
+	}
+	tm = gmtime(&tt);
+	if (tm == NULL ||
+	    strftime(buf, sizeof(buf), "%Y/%m/%d %H:%M:%S", tm) == 0) {
+		printf(" %s %lld", label, (long long)t);
+		return;
+	}
+	printf(" %s %s", label, buf);
+}
+
+static void
+print_hex(const char *label, const uint8_t *buf, unsigned len) {
+	unsigned i;
+
+	printf(" %s ", label);
+	for (i = 0; i < len; i++)
+		printf("%s%02x", i ? ":" : "", buf[i]);
+}
+
+int
+main(int argc, char **argv) {
+	leasesnap_t *snap = NULL;
+	struct leasesnap_record rec;
+	char abuf[INET6_ADDRSTRLEN];
+	const char *want_state = NULL;
+	int all = 0;
+	uint32_t slot, nslots, shown = 0;
+	int ch, status;
+
+	while ((ch = getopt(argc, argv, "as:")) != -1) {
+		switch (ch) {
+		case 'a':
+			all = 1;
+			break;
+		case 's':
+			want_state = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind + 1 != argc)
+		usage(argv[0]);
+
+	if (leasesnap_open(&snap, argv[optind]) < 0) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		exit(1);
+	}
+
+	nslots = leasesnap_slots(snap);
+	printf("# server pid %ld, generation %llu, %u slots in use\n",
+	       (long)leasesnap_pid(snap),
+	       (unsigned long long)leasesnap_generation(snap), nslots);
+
+	for (slot = 0; slot < nslots; slot++) {
+		status = leasesnap_read(snap, slot, &rec);
+		if (status < 0) {
+			fprintf(stderr, "slot %u: %s\n", slot,
+				strerror(errno));
+			continue;
+		}
+		if (status == 0)
+			continue;
+		if (want_state != NULL &&
+		    strcmp(want_state, leasesnap_state_name(rec.state)) != 0)
+			continue;
+		if (!all && want_state == NULL &&
+		    rec.state == LEASESNAP_STATE_FREE)
+			continue;
+
+		if (rec.family == LEASESNAP_FAMILY_INET)
+			inet_ntop(AF_INET, rec.addr, abuf, sizeof(abuf));
+		else
+			inet_ntop(AF_INET6, rec.addr, abuf, sizeof(abuf));
+		if (rec.ia_type == 25)	/* D6O_IA_PD */
+			printf("%s/%u", abuf, rec.plen);
+		else
+			printf("%s", abuf);
+		printf(" %s", leasesnap_state_name(rec.state));
+		if (rec.family == LEASESNAP_FAMILY_INET)
+			print_time("starts", rec.starts);
+		print_time("ends", rec.ends);
+		print_time("cltt", rec.cltt);
+		if (rec.family == LEASESNAP_FAMILY_INET6)
+			printf(" preferred %u valid %u", rec.prefer, rec.valid);
+		if (rec.hw_len != 0)
+			print_hex("hw", rec.hw_addr, rec.hw_len);
+		if (rec.id_len != 0)
+			print_hex(rec.family == LEASESNAP_FAMILY_INET ?
+				  "uid" : "iaid-duid", rec.id, rec.id_len);
+		if (rec.flags & LEASESNAP_FLAG_ID_TRUNCATED)
+			printf("...");
+		printf("\n");
+		shown++;
+	}
+
+	printf("# %u leases\n", shown);
+	leasesnap_close(&snap);
+	exit(0);
+}
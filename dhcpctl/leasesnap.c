@@ -0,0 +1,187 @@
+/* leasesnap.c
+
+   Read-only access to the shared-memory lease snapshot. */
+
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "leasesnap.h"
+
+/* Number of times to retry a record that is being rewritten before
+   giving up and reporting EAGAIN to the caller. */
+#define LEASESNAP_READ_RETRIES 1000
+
+struct leasesnap {
+	void *base;
+	size_t size;
+	const volatile struct leasesnap_header *header;
+	const volatile struct leasesnap_record *records;
+};
+
+static const char *state_names[] = {
+	"none", "free", "active", "expired", "released", "abandoned",
+	"reset", "backup" };
+
+/*
+ * Map the snapshot file at path and check that it has a format we
+ * understand.  Returns 0 on success, or -1 with errno set.
+ */
+int
+leasesnap_open(leasesnap_t **snap, const char *path) {
+	struct leasesnap *ls;
+	struct stat st;
+	const struct leasesnap_header *hdr;
+	int fd;
+
+	if (snap == NULL || *snap != NULL || path == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if ((size_t)st.st_size < sizeof(*hdr)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	ls = calloc(1, sizeof(*ls));
+	if (ls == NULL) {
+		close(fd);
+		errno = ENOMEM;
+		return -1;
+	}
+	ls->size = (size_t)st.st_size;
+	ls->base = mmap(NULL, ls->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ls->base == MAP_FAILED) {
+		free(ls);
+		return -1;
+	}
+
+	hdr = ls->base;
+	if (hdr->magic != LEASESNAP_MAGIC ||
+	    hdr->version != LEASESNAP_VERSION ||
+	    hdr->record_size != sizeof(struct leasesnap_record) ||
+	    hdr->header_size < sizeof(*hdr) ||
+	    hdr->header_size +
+	    (size_t)hdr->nslots * hdr->record_size > ls->size) {
+		munmap(ls->base, ls->size);
+		free(ls);
+		errno = EINVAL;
+		return -1;
+	}
+
+	ls->header = hdr;
+	ls->records = (const struct leasesnap_record *)
+		((const char *)ls->base + hdr->header_size);
+	*snap = ls;
+	return 0;
+}
+
+void
+leasesnap_close(leasesnap_t **snap) {
+	if (snap == NULL || *snap == NULL)
+		return;
+	munmap((*snap)->base, (*snap)->size);
+	free(*snap);
+	*snap = NULL;
+}
+
+/*
+ * Only slots below the high water mark have ever been written, so
+ * callers need not look past it.
+ */
+uint32_t
+leasesnap_slots(leasesnap_t *snap) {
+	uint32_t hw = snap->header->high_water;
+
+	return (hw < snap->header->nslots) ? hw : snap->header->nslots;
+}
+
+uint64_t
+leasesnap_generation(leasesnap_t *snap) {
+	return snap->header->generation;
+}
+
+int32_t
+leasesnap_pid(leasesnap_t *snap) {
+	return snap->header->pid;
+}
+
+/*
+ * Copy a consistent image of record number slot into *rec.  Returns 1
+ * if the record describes a lease, 0 if the slot is unused, or -1 with
+ * errno set if the slot is out of range or could not be read because
+ * the server kept rewriting it.
+ */
+int
+leasesnap_read(leasesnap_t *snap, uint32_t slot, struct leasesnap_record *rec) {
+	const volatile struct leasesnap_record *src;
+	uint32_t seq1, seq2;
+	int i;
+
+	if (slot >= snap->header->nslots) {
+		errno = ERANGE;
+		return -1;
+	}
+	src = &snap->records[slot];
+
+	for (i = 0; i < LEASESNAP_READ_RETRIES; i++) {
+		seq1 = src->seq;
+		if (seq1 & 1)
+			continue;
+		LEASESNAP_BARRIER();
+		memcpy(rec, (const void *)src, sizeof(*rec));
+		LEASESNAP_BARRIER();
+		seq2 = src->seq;
+		if (seq1 == seq2) {
+			rec->seq = seq1;
+			return (rec->family != LEASESNAP_FAMILY_NONE);
+		}
+	}
+
+	errno = EAGAIN;
+	return -1;
+}
+
+const char *
+leasesnap_state_name(unsigned state) {
+	if (state >= sizeof(state_names) / sizeof(state_names[0]))
+		return "unknown";
+	return state_names[state];
+}
@@ -0,0 +1,125 @@
+/* leasesnap.h
+
+   Definitions for the shared-memory lease snapshot exported by dhcpd. */
+
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/*
+ * The lease snapshot is a file that dhcpd maps with mmap() and keeps
+ * up to date as leases change.  Other processes may map the same file
+ * read-only and walk the records without talking to the server.
+ *
+ * The file consists of a fixed header followed by an array of fixed
+ * size records.  Each record is protected by a sequence counter: the
+ * server makes the counter odd before it touches the record and even
+ * again when it is done.  A reader copies the record and then checks
+ * that the counter was even and unchanged across the copy; if not it
+ * simply tries again.
+ *
+ * This header deliberately does not depend on any of the dhcpd or
+ * BIND headers so that it may be used by external programs.
+ */
+
+#ifndef _LEASESNAP_H_
+#define _LEASESNAP_H_
+
+#include <stdint.h>
+
+#define LEASESNAP_MAGIC		0x444c534eU	/* "DLSN" */
+#define LEASESNAP_VERSION	1
+
+/* Values for the family field of a record.  A record whose family is
+   LEASESNAP_FAMILY_NONE is unused. */
+#define LEASESNAP_FAMILY_NONE	0
+#define LEASESNAP_FAMILY_INET	4
+#define LEASESNAP_FAMILY_INET6	6
+
+/* Values for the state field; these match the server's FTS_ values. */
+#define LEASESNAP_STATE_FREE		1
+#define LEASESNAP_STATE_ACTIVE		2
+#define LEASESNAP_STATE_EXPIRED		3
+#define LEASESNAP_STATE_RELEASED	4
+#define LEASESNAP_STATE_ABANDONED	5
+#define LEASESNAP_STATE_RESET		6
+#define LEASESNAP_STATE_BACKUP		7
+
+/* Values for the flags field. */
+#define LEASESNAP_FLAG_ID_TRUNCATED	0x01
+#define LEASESNAP_FLAG_BOOTP		0x02
+#define LEASESNAP_FLAG_RESERVED		0x04
+#define LEASESNAP_FLAG_STATIC		0x08
+
+#define LEASESNAP_HWADDR_LEN	16
+#define LEASESNAP_ID_LEN	40
+
+struct leasesnap_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t header_size;
+	uint32_t nslots;	/* number of records in the file */
+	uint32_t high_water;	/* records past this were never used */
+	int32_t  pid;		/* pid of the writing server */
+	int64_t  created;	/* time the snapshot was created */
+	uint64_t generation;	/* bumped on every record update */
+	uint8_t  reserved[24];
+};
+
+struct leasesnap_record {
+	uint32_t seq;		/* odd while the server is writing */
+	uint8_t  family;	/* LEASESNAP_FAMILY_* */
+	uint8_t  state;		/* LEASESNAP_STATE_* */
+	uint8_t  plen;		/* prefix length; 32 or 128 for addresses */
+	uint8_t  ia_type;	/* DHCPv6 IA option code, 0 for DHCPv4 */
+	uint8_t  addr[16];	/* IPv4 address in the first four bytes */
+	int64_t  starts;
+	int64_t  ends;
+	int64_t  cltt;
+	int64_t  tstp;
+	uint32_t prefer;	/* DHCPv6 preferred lifetime */
+	uint32_t valid;		/* DHCPv6 valid lifetime */
+	uint8_t  hw_type;
+	uint8_t  hw_len;
+	uint8_t  id_len;
+	uint8_t  flags;		/* LEASESNAP_FLAG_* */
+	uint8_t  hw_addr[LEASESNAP_HWADDR_LEN];
+	uint8_t  id[LEASESNAP_ID_LEN];	/* client-id, or IAID+DUID */
+	uint32_t reserved;
+};
+
+/* Compiler and memory barrier used around sequence counter updates. */
+#define LEASESNAP_BARRIER()	__sync_synchronize()
+
+/* Reader interface, implemented in libdhcpctl. */
+typedef struct leasesnap leasesnap_t;
+
+int leasesnap_open(leasesnap_t **, const char *);
+void leasesnap_close(leasesnap_t **);
+uint32_t leasesnap_slots(leasesnap_t *);
+uint64_t leasesnap_generation(leasesnap_t *);
+int32_t leasesnap_pid(leasesnap_t *);
+int leasesnap_read(leasesnap_t *, uint32_t, struct leasesnap_record *);
+const char *leasesnap_state_name(unsigned);
+
+#endif /* _LEASESNAP_H_ */
@@ -78,7 +78,7 @@ typedef struct hash_table option_name_hash_t;
 typedef struct hash_table option_code_hash_t;
 typedef struct hash_table dns_zone_hash_t;
 typedef struct hash_table lease_ip_hash_t;
-typedef struct hash_table lease_id_hash_t;
+typedef struct hash_table client_leases_hash_t;
 typedef struct hash_table host_hash_t;
 typedef struct hash_table class_hash_t;
 
@@ -521,7 +521,8 @@ typedef enum {
 	server_running = 1,
 	server_shutdown = 2,
 	server_hibernate = 3,
-	server_awaken = 4
+	server_awaken = 4,
+	server_reload = 5
 } control_object_state_t;
 
 typedef struct {
@@ -560,7 +561,6 @@ struct lease {
 	struct lease *prev;
 	struct leasechain *lc;
 #endif
-	struct lease *n_uid, *n_hw;
 
 	struct iaddr ip_addr;
 	TIME starts, ends, sort_time;
@@ -647,6 +647,22 @@ struct lease {
 
 	/* Set when a lease has been disqualified for cache-threshold reuse */
 	unsigned short cannot_reuse;
+
+	/* Slot in the lease snapshot plus one, or zero if none. */
+	u_int32_t snap_slot;
+};
+
+/* The leases that have one client identifier or hardware address, most
+   preferred first (see client_lease_preferred() in mdb.c), so the first
+   lease is the one to give back to the client.  The set holds a reference
+   to each of its leases, and belongs to the entry for its identifier in
+   lease_uid_hash or lease_hw_addr_hash, which is keyed by the copy of the
+   identifier kept here. */
+struct client_leases {
+	unsigned count, max;
+	struct lease **leases;
+	unsigned len;
+	unsigned char id [1];
 };
 
 struct lease_state {
@@ -677,6 +693,9 @@ struct lease_state {
 	u_int8_t hops;
 	u_int8_t offer;
 	struct iaddr from;
+
+	/* The duplicate cache entry for the request, if any. */
+	u_int32_t dup_slot, dup_serial;
 };
 
 #define	ROOT_GROUP	0
@@ -817,6 +836,25 @@ struct lease_state {
 #define SV_BIND_LOCAL_ADDRESS6		98
 #define SV_PING_CLTT_SECS		99
 #define SV_PING_TIMEOUT_MS		100
+#define SV_LEASE_SNAPSHOT_FILE		101
+#define SV_LEASE_SNAPSHOT_SIZE		102
+#define SV_DDNS_BATCH_WINDOW		103
+#define SV_DDNS_BATCH_SIZE		104
+#define SV_DDNS_MAX_OUTSTANDING		105
+#define SV_DDNS_ZONE_NEGATIVE_TTL	106
+#define SV_DDNS_ZONE_CACHE_FILE		107
+#define SV_PING_AHEAD			108
+#define SV_PING_VERIFIED_LIFETIME	109
+#define SV_EXPIRY_BATCH_SIZE		110
+#define SV_DROP_UNKNOWN_RELAYS		111
+#define SV_ADMISSION_RATE		112
+#define SV_ADMISSION_CLIENT_RATE	113
+#define SV_ADMISSION_CLIENT_BURST	114
+#define SV_ADMISSION_CLIENTS		115
+#define SV_DUPLICATE_CACHE_TIME		116
+#define SV_DUPLICATE_CACHE_SIZE		117
+#define SV_METRICS_PORT			118
+#define SV_METRICS_ADDRESS		119
 
 #if !defined (DEFAULT_PING_TIMEOUT)
 # define DEFAULT_PING_TIMEOUT 1
@@ -830,6 +868,56 @@ struct lease_state {
 # define DEFAULT_PING_CLTT_SECS 60  /* in seconds */
 #endif
 
+#if !defined (DEFAULT_PING_AHEAD)
+# define DEFAULT_PING_AHEAD 0	/* 0 disables pinging ahead */
+#endif
+
+#if !defined (DEFAULT_PING_VERIFIED_LIFETIME)
+# define DEFAULT_PING_VERIFIED_LIFETIME 60  /* in seconds */
+#endif
+
+#if !defined (DEFAULT_LEASE_SNAPSHOT_SIZE)
+# define DEFAULT_LEASE_SNAPSHOT_SIZE 65536
+#endif
+
+#if !defined (DEFAULT_DDNS_BATCH_WINDOW)
+# define DEFAULT_DDNS_BATCH_WINDOW 0	/* milliseconds, 0 disables batching */
+#endif
+
+#if !defined (DEFAULT_DDNS_BATCH_SIZE)
+# define DEFAULT_DDNS_BATCH_SIZE 32
+#endif
+
+#if !defined (DEFAULT_DDNS_MAX_OUTSTANDING)
+# define DEFAULT_DDNS_MAX_OUTSTANDING 0	/* 0 is unlimited */
+#endif
+
+#if !defined (DEFAULT_DDNS_ZONE_NEGATIVE_TTL)
+# define DEFAULT_DDNS_ZONE_NEGATIVE_TTL 60
+#endif
+
+/* How long after a zone is found before the zone cache file is
+   rewritten, so that a burst of discoveries is written once. */
+#if !defined (DDNS_ZONE_CACHE_SAVE_DELAY)
+# define DDNS_ZONE_CACHE_SAVE_DELAY 60
+#endif
+
+#if !defined (DEFAULT_EXPIRY_BATCH_SIZE)
+# define DEFAULT_EXPIRY_BATCH_SIZE 0	/* 0 is unlimited */
+#endif
+
+#if !defined (DEFAULT_ADMISSION_CLIENT_BURST)
+# define DEFAULT_ADMISSION_CLIENT_BURST 4
+#endif
+
+#if !defined (DEFAULT_ADMISSION_CLIENTS)
+# define DEFAULT_ADMISSION_CLIENTS 65536
+#endif
+
+#if !defined (DEFAULT_DUPCACHE_SIZE)
+# define DEFAULT_DUPCACHE_SIZE 4096
+#endif
+
 #if !defined (DEFAULT_DELAYED_ACK)
 # define DEFAULT_DELAYED_ACK 0  /* default 0 disables delayed acking */
 #endif
@@ -873,6 +961,23 @@ struct lease_state {
 # define MIN_LEASE_WRITE 15
 #endif
 
+/* The fewest leases dhclient appends to its lease file before
+   rewriting it. */
+#if !defined (MIN_LEASE_JOURNAL)
+# define MIN_LEASE_JOURNAL 20
+#endif
+
+/* DHCPv4 over DHCPv6 messages can pass through shared memory rings
+   where the compiler has atomic builtins.  Each ring holds this many
+   bytes, which must be a power of two. */
+#if defined (DHCP4o6) && defined (__ATOMIC_SEQ_CST) && \
+    !defined (DHCP4o6_NO_RING)
+# define DHCP4o6_RING
+#endif
+#if !defined (DHCP4o6_RING_SIZE)
+# define DHCP4o6_RING_SIZE 1048576
+#endif
+
 #if !defined (DEFAULT_ABANDON_LEASE_TIME)
 # define DEFAULT_ABANDON_LEASE_TIME 86400
 #endif
@@ -1011,6 +1116,31 @@ struct permit {
 };
 
 #if defined (BINARY_LEASES)
+#if defined (LEASECHAIN_BLOCKS)
+/* A leasechain kept as a list of blocks of entries, each holding the sort
+   key of its lease so that a search reads only the entries. */
+#define LC_BLOCK_SIZE 64
+
+struct lc_entry {
+	TIME sort_time;
+	long int sort_tiebreaker;
+	struct lease *lease;
+};
+
+struct lc_block {
+	size_t nelem;
+	struct lc_entry list [LC_BLOCK_SIZE];
+};
+
+struct leasechain {
+	struct lc_block **blocks; /* blocks in order */
+	struct lc_entry *last;	  /* a copy of the last entry of each block */
+	size_t nblocks;		  /* the number of blocks in use */
+	size_t maxblocks;	  /* the size of the blocks and last arrays */
+	size_t nelem;		  /* the number of leases */
+	size_t growth;		  /* as below, in leases */
+};
+#else
 struct leasechain {
 	struct lease **list; /* lease list */
 	size_t total;	     /* max number of elements in this list,
@@ -1021,6 +1151,31 @@ struct leasechain {
 			      * creatin an array.  */
 };
 #endif
+#endif
+
+/* The addresses of a range that have never been leased, kept as a bitmap
+   rather than as lease structures.  A lease structure is made for an
+   address when it is first used, and its bit is cleared. */
+struct lease_range {
+	struct lease_range *next;	/* next range in the same pool */
+	struct pool *pool;
+	struct subnet *subnet;
+	u_int32_t low;			/* first address, host order */
+	u_int32_t count;		/* number of addresses */
+	u_int32_t left;			/* number of bits still set */
+	u_int32_t cursor;		/* no bit below this one is set */
+	unsigned seq;			/* order of declaration */
+	u_int32_t bits [1];
+};
+
+/* All the ranges of a configuration, for finding one by address. */
+struct lease_range_table {
+	struct lease_range **ranges;	/* by first address when sorted */
+	u_int32_t *reach;		/* last address of ranges [0..i] */
+	unsigned count;
+	unsigned max;
+	int sorted;
+};
 
 struct pool {
 	OMAPI_OBJECT_PREAMBLE;
@@ -1048,6 +1203,8 @@ struct pool {
 #endif
 	int logged;		/* already logged a message */
 	int low_threshold;	/* low threshold to restart logging */
+	struct lease_range *ranges;	/* addresses never leased */
+	int unused_leases;	/* bits set in ranges */
 };
 
 struct shared_network {
@@ -1446,6 +1603,9 @@ typedef void (*tvref_t)(void *, void *, const char *, int);
 typedef void (*tvunref_t)(void *, const char *, int);
 struct timeout {
 	struct timeout *next;
+	struct timeout **pprev;		/* what points to us, or NULL if we
+					   aren't on the list */
+	struct timeout *hnext;		/* next with the same what hash */
 	struct timeval when;
 	void (*func) (void *);
 	void *what;
@@ -1509,9 +1669,12 @@ struct dns_query {
 
 #define DNS_ZONE_ACTIVE  0
 #define DNS_ZONE_INACTIVE 1
+#define DNS_ZONE_NEGATIVE 2	/* no name servers could be found */
+#define DNS_ZONE_REFRESHING 4	/* background lookup in progress */
 struct dns_zone {
 	int refcnt;
 	TIME timeout;
+	TIME refresh;		/* when to look the zone up again */
 	char *name;
 	struct option_cache *primary;
 	struct option_cache *secondary;
@@ -1528,6 +1691,7 @@ struct icmp_state {
 };
 
 #include "ctrace.h"
+#include "probes.h"
 
 /* Bitmask of dhcp option codes. */
 typedef unsigned char option_mask [16];
@@ -1668,6 +1832,9 @@ struct iasubopt {
 	/* space for the on * executable statements */
 	struct on_star on_star;
 	int static_lease;
+
+	/* Slot in the lease snapshot plus one, or zero if none. */
+	u_int32_t snap_slot;
 };
 
 struct ia_xx {
@@ -1841,6 +2008,11 @@ typedef struct dhcp_ddns_cb {
 	dns_rdataclass_t other_dhcid_class;
 	char *lease_tag;
 	struct ia_xx *fixed6_ia;
+
+	/* Batching and flow control state, see common/dns.c */
+	struct dhcp_ddns_cb *queue_next;
+	void *server;
+	struct timeval submitted;
 } dhcp_ddns_cb_t;
 
 extern struct ipv6_pool **pools;
@@ -1857,8 +2029,8 @@ HASH_FUNCTIONS_DECL (option_code, const unsigned *, struct option,
 HASH_FUNCTIONS_DECL (dns_zone, const char *, struct dns_zone, dns_zone_hash_t)
 HASH_FUNCTIONS_DECL(lease_ip, const unsigned char *, struct lease,
 		    lease_ip_hash_t)
-HASH_FUNCTIONS_DECL(lease_id, const unsigned char *, struct lease,
-		    lease_id_hash_t)
+HASH_FUNCTIONS_DECL(client_leases, const unsigned char *,
+		    struct client_leases, client_leases_hash_t)
 HASH_FUNCTIONS_DECL (host, const unsigned char *, struct host_decl, host_hash_t)
 HASH_FUNCTIONS_DECL (class, const char *, struct class, class_hash_t)
 
@@ -2087,6 +2259,10 @@ void do_packet (struct interface_info *,
 void do_packet6(struct interface_info *, const char *,
 		int, int, const struct iaddr *, isc_boolean_t);
 int packet6_len_okay(const char *, int);
+const unsigned char *packet6_find_option(const unsigned char *, unsigned,
+					 unsigned, unsigned *);
+const unsigned char *packet6_client_msg(const unsigned char *, unsigned,
+					unsigned *, const unsigned char **);
 
 int validate_packet(struct packet *);
 
@@ -2108,6 +2284,36 @@ extern int dhcp4o6_fd;
 extern omapi_object_t *dhcp4o6_object;
 extern omapi_object_type_t *dhcp4o6_type;
 extern void dhcp4o6_setup(u_int16_t);
+extern const char *dhcp4o6_ring_file;
+extern int dhcp4o6_send(const unsigned char *, unsigned,
+			const unsigned char *, unsigned);
+extern int dhcp4o6_doorbell(const char *, int);
+
+/* The first word of a doorbell, and of a -4o6-ring file. */
+#define DHCP4o6_RING_MAGIC	0x346f3652	/* "4o6R" */
+
+#if defined (DHCP4o6_RING)
+/* The layout of a -4o6-ring file, which both servers map; see the
+   comment on the rings in dhcp4o6.c. */
+struct dhcp4o6_ring {
+	u_int32_t taken;	/* bytes taken off, by the receiver */
+	u_int32_t ready;	/* set by the receiver once it reads */
+	unsigned char pad1[56];
+	u_int32_t put;		/* bytes put on, by the sender */
+	unsigned char pad2[60];
+	unsigned char data[DHCP4o6_RING_SIZE];
+};
+
+struct dhcp4o6_rings {
+	u_int32_t magic;
+	u_int32_t size;
+	u_int32_t cookie;	/* set when the file is made */
+	unsigned char pad[52];
+	struct dhcp4o6_ring ring[2];	/* 0 carries messages to v4 */
+};
+
+extern int dhcp4o6_ring_get(struct data_string *);
+#endif
 
 /* dependency */
 extern isc_result_t dhcpv4o6_handler(omapi_object_t *);
@@ -2116,6 +2322,9 @@ extern isc_result_t dhcpv4o6_handler(omapi_object_t *);
 /* dhcpd.c */
 extern struct timeval cur_tv;
 #define cur_time cur_tv.tv_sec
+/* The current time in milliseconds, wrapping every 49 days. */
+#define cur_ms ((u_int32_t)cur_tv.tv_sec * 1000 + \
+		(u_int32_t)(cur_tv.tv_usec / 1000))
 
 extern int ddns_update_style;
 #if defined (NSUPDATE)
@@ -2140,6 +2349,8 @@ extern u_int32_t abandon_lease_time;
 extern const char *path_dhcpd_conf;
 extern const char *path_dhcpd_db;
 extern const char *path_dhcpd_pid;
+extern const char *path_lease_snapshot;
+extern u_int32_t lease_snapshot_size;
 
 extern int dhcp_max_agent_option_packet_length;
 extern struct eventqueue *rw_queue_empty;
@@ -2150,6 +2361,7 @@ extern gid_t set_gid;
 #endif
 
 int main(int, char **);
+void root_group_setup(void);
 void postconf_initialization(int);
 void postdb_startup(void);
 void cleanup (void);
@@ -2416,7 +2628,10 @@ int concat_dclists (struct data_string *, struct data_string *,
                     struct data_string *);
 
 /* dhcp.c */
+extern const char *dhcp_type_names [];
+extern const int dhcp_type_name_max;
 extern int outstanding_pings;
+extern int outstanding_acks;
 extern int max_outstanding_acks;
 extern int max_ack_delay_secs;
 extern int max_ack_delay_usecs;
@@ -2446,6 +2661,8 @@ int allocate_lease (struct lease **, struct packet *,
 		    struct pool *, int *);
 int permitted (struct packet *, struct permit *);
 int locate_network (struct packet *);
+extern int drop_unknown_relays;
+void relay_filter_setup (int);
 int parse_agent_information_option (struct packet *, int, u_int8_t *);
 unsigned cons_agent_information_options (struct option_state *,
 					 struct dhcp_packet *,
@@ -2725,10 +2942,15 @@ ssize_t send_packet (struct interface_info *,
 		     struct in_addr,
 		     struct sockaddr_in *, struct hardware *);
 #endif
+#if defined (USE_BPF_RECEIVE) || defined (USE_LPF_RECEIVE)
+extern u_int32_t *dhcp_bpf_giaddrs;
+extern int dhcp_bpf_giaddr_count;
+#endif
 #ifdef USE_BPF_RECEIVE
 void if_reinitialize_receive (struct interface_info *);
 void if_register_receive (struct interface_info *);
 void if_deregister_receive (struct interface_info *);
+void if_refresh_receive_filter (struct interface_info *);
 ssize_t receive_packet (struct interface_info *,
 			unsigned char *, size_t,
 			struct sockaddr_in *, struct hardware *);
@@ -2757,6 +2979,7 @@ ssize_t send_packet (struct interface_info *,
 void if_reinitialize_receive (struct interface_info *);
 void if_register_receive (struct interface_info *);
 void if_deregister_receive (struct interface_info *);
+void if_refresh_receive_filter (struct interface_info *);
 ssize_t receive_packet (struct interface_info *,
 			unsigned char *, size_t,
 			struct sockaddr_in *, struct hardware *);
@@ -2862,13 +3085,19 @@ extern int (*dhcp_interface_setup_hook) (struct interface_info *,
 extern int (*dhcp_interface_discovery_hook) (struct interface_info *);
 extern isc_result_t (*dhcp_interface_startup_hook) (struct interface_info *);
 
-extern void (*bootp_packet_handler) (struct interface_info *,
-				     struct dhcp_packet *, unsigned,
-				     unsigned int,
-				     struct iaddr, struct hardware *);
-extern void (*dhcpv6_packet_handler)(struct interface_info *,
-				     const char *, int,
-				     int, const struct iaddr *, isc_boolean_t);
+typedef void (*bootp_handler_t) (struct interface_info *,
+				 struct dhcp_packet *, unsigned,
+				 unsigned int,
+				 struct iaddr, struct hardware *);
+typedef void (*dhcpv6_handler_t) (struct interface_info *,
+				  const char *, int,
+				  int, const struct iaddr *, isc_boolean_t);
+extern bootp_handler_t bootp_packet_handler;
+extern dhcpv6_handler_t dhcpv6_packet_handler;
+void push_packet_handler (bootp_handler_t *, bootp_handler_t);
+#ifdef DHCPv6
+void push_packet_handler6 (dhcpv6_handler_t *, dhcpv6_handler_t);
+#endif
 extern struct timeout *timeouts;
 extern omapi_object_type_t *dhcp_type_interface;
 #if defined (TRACING)
@@ -2974,6 +3203,7 @@ const char *pin6_addr (const struct in6_addr*);
 
 /* dhclient.c */
 extern int nowait;
+extern int script_jobs;
 
 extern int wanted_ia_na;
 extern int wanted_ia_ta;
@@ -3045,6 +3275,8 @@ void script_write_params (struct client_state *, const char *,
 			  struct client_lease *);
 void script_write_requested (struct client_state *);
 int script_go (struct client_state *);
+int script_go_async (struct client_state *);
+void script_wait (struct client_state *);
 void client_envadd (struct client_state *,
 		    const char *, const char *, const char *, ...)
 	__attribute__((__format__(__printf__,4,5)));
@@ -3094,12 +3326,186 @@ void write_billing_classes (void);
 int write_billing_class (struct class *);
 void commit_leases_timeout (void *);
 int commit_leases (void);
+void hold_commits (void);
+int release_commits (void);
 int commit_leases_timed (void);
 void db_startup (int);
 int new_lease_file (int test_mode);
 int group_writer (struct group_object *);
 int write_ia(const struct ia_xx *);
 
+/* leasesnap.c */
+isc_result_t lease_snapshot_open(const char *, u_int32_t);
+void lease_snapshot_lease(struct lease *);
+void lease_snapshot_iasubopt(const struct ia_xx *, struct iasubopt *);
+void lease_snapshot_release(u_int32_t *);
+void lease_snapshot_close(void);
+
+/* ping.c */
+#define PING_OFFER	1	/* holding up an offer */
+#define PING_AHEAD	2	/* pinging a free lease in advance */
+#define PING_VERIFIED	3	/* ping ahead went unanswered */
+
+void ping_send(struct lease *, int, struct timeval *, u_int32_t);
+void ping_ahead(struct pool *, int, struct timeval *, u_int32_t);
+int ping_verified(struct iaddr *);
+int ping_match(struct iaddr, u_int8_t *, int, struct lease **);
+void ping_cancel(struct lease *);
+int ping_outstanding(void);
+
+/* admission.c */
+#define SET_WAYS 4		/* entries in a set of a table */
+
+#define SET_FOUND 0		/* the entry in use for the hash */
+#define SET_FREE 1		/* a free entry, to be filled in */
+#define SET_EVICTED 2		/* an entry in use, to be replaced */
+
+/* The start of each entry in a set-associative table. */
+struct set_way {
+	u_int32_t hash;			/* never 0 for an entry in use */
+	u_int32_t stamp;		/* when last used, in milliseconds */
+};
+
+struct admission_stats {
+	u_int64_t admitted [2];		/* by urgency: new, urgent */
+	u_int64_t client_dropped [2];	/* over the client's rate */
+	u_int64_t overload_dropped [2];	/* over the server's rate */
+	u_int64_t evicted;		/* clients pushed out of the table */
+};
+
+extern u_int32_t admission_rate;
+extern u_int32_t admission_client_rate;
+extern u_int32_t admission_client_burst;
+extern u_int32_t admission_clients;
+extern struct admission_stats admission_stats;
+
+u_int32_t admission_key(const unsigned char *, unsigned);
+int set_assoc_find(void *, size_t, u_int32_t, u_int32_t, u_int32_t,
+		   int (*)(const struct set_way *, const void *),
+		   const void *, struct set_way **);
+int admission_admit(u_int32_t, int);
+int admission_classify(const struct dhcp_packet *, unsigned, u_int32_t *);
+#ifdef DHCPv6
+int admission_classify6(const unsigned char *, unsigned, u_int32_t *);
+#endif
+int admission_init(void);
+void admission_setup(void);
+void admission_log_stats(void);
+
+/* dupcache.c */
+#define DUPCACHE_KEY_MAX 192
+
+#define DUPCACHE_NEW 0		/* not seen before; now remembered */
+#define DUPCACHE_PENDING 1	/* seen, not yet answered */
+#define DUPCACHE_REPLIED 2	/* seen and answered */
+
+struct dupcache_entry;
+
+struct dupcache_stats {
+	u_int64_t stored;		/* replies kept */
+	u_int64_t resent;		/* duplicates answered from the cache */
+	u_int64_t dropped;		/* duplicates dropped while pending */
+	u_int64_t evicted;		/* live entries pushed out */
+};
+
+extern u_int32_t dupcache_time;
+extern u_int32_t dupcache_size;
+extern struct dupcache_stats dupcache_stats;
+
+unsigned dupcache_key4(int, const struct dhcp_packet *, unsigned,
+		       unsigned char *);
+#ifdef DHCPv6
+unsigned dupcache_key6(int, const unsigned char *, unsigned, int,
+		       const struct iaddr *, int, unsigned char *);
+#endif
+int dupcache_check(const unsigned char *, unsigned,
+		   struct dupcache_entry **);
+void dupcache_current(u_int32_t *, u_int32_t *);
+void dupcache_forget(u_int32_t, u_int32_t);
+void dupcache_reply4(u_int32_t, u_int32_t, struct interface_info *,
+		     const struct dhcp_packet *, unsigned, struct in_addr,
+		     const struct sockaddr_in *, const struct hardware *);
+#ifdef DHCPv6
+void dupcache_reply6(struct interface_info *, const unsigned char *,
+		     unsigned, const struct sockaddr_in6 *);
+#endif
+void dupcache_flush(void);
+int dupcache_init(void);
+void dupcache_setup(void);
+void dupcache_log_stats(void);
+
+/* reload.c */
+isc_result_t reload_config(void);
+
+/* histogram.c */
+#define REPLAY_BUCKETS 464	/* enough for any 32-bit time */
+
+struct replay_stats {
+	u_int64_t count;		/* packets handled */
+	u_int64_t usecs;		/* total time taken */
+	u_int64_t allocs;		/* memory blocks allocated */
+	u_int32_t max;			/* longest time, in microseconds */
+	u_int32_t buckets [REPLAY_BUCKETS];
+};
+
+unsigned replay_bucket(u_int32_t);
+u_int32_t replay_bucket_limit(unsigned);
+u_int32_t replay_percentile(const struct replay_stats *, double);
+
+/* replay.c */
+#define REPLAY_TYPES 20		/* BOOTP, DHCP message types, others */
+
+extern struct replay_stats replay_stats [REPLAY_TYPES];
+
+int replay_message_type(const struct dhcp_packet *, unsigned);
+void replay_record(int, u_int64_t, unsigned long);
+#if defined (TRACING)
+void replay_set_time(TIME);
+void replay_bench_start(double);
+void replay_bench_report(void);
+#endif
+
+/* metrics.c */
+#define METRICS_PARSE 0		/* received to dhcp() or dhcpv6() */
+#define METRICS_CLASSIFY 1	/* classify_client() */
+#define METRICS_ALLOCATE 2	/* finding or allocating a lease */
+#define METRICS_COMMIT 3	/* writing a lease to the lease file */
+#define METRICS_FSYNC 4		/* flushing the lease file to disk */
+#define METRICS_SEND 5		/* sending the reply */
+#define METRICS_PACKET 6	/* all of the above and the rest */
+#define METRICS_STAGES 7
+#define METRICS_TYPES6 32	/* DHCPv6 message types counted */
+
+struct metrics_stats {
+	u_int64_t packets [REPLAY_TYPES];
+	u_int64_t packets6 [METRICS_TYPES6];
+	struct replay_stats stages [METRICS_STAGES];
+};
+
+struct metrics_buffer {
+	char *data;
+	unsigned len, size;
+	int failed;
+};
+
+extern u_int16_t metrics_port;
+extern struct in_addr metrics_address;
+extern int metrics_enabled;
+extern struct metrics_stats metrics_stats;
+
+/* Time a stage of handling a packet, if metrics are being served. */
+#define METRICS_START(tv) \
+	do { if (metrics_enabled) gettimeofday(&(tv), NULL); } while (0)
+#define METRICS_STOP(stage, tv) \
+	do { if (metrics_enabled) metrics_record((stage), &(tv)); } while (0)
+
+void metrics_record(int, const struct timeval *);
+void metrics_parsed(void);
+void metrics_printf(struct metrics_buffer *, const char *, ...)
+	__attribute__((__format__(__printf__,2,3)));
+int metrics_render(struct metrics_buffer *);
+void metrics_setup(void);
+
 /* packet.c */
 u_int32_t checksum (unsigned char *, unsigned, u_int32_t);
 u_int32_t wrapsum (u_int32_t);
@@ -3195,6 +3601,7 @@ extern struct icmp_state *icmp_state;
 void icmp_startup (int, void (*) (struct iaddr, u_int8_t *, int));
 int icmp_readsocket (omapi_object_t *);
 int icmp_echorequest (struct iaddr *);
+int icmp_echorequest_seq (struct iaddr *, u_int16_t, u_int16_t);
 isc_result_t icmp_echoreply (omapi_object_t *);
 
 /* dns.c */
@@ -3205,6 +3612,9 @@ int dns_zone_dereference (struct dns_zone **, const char *, int);
 #define FIND_FORWARD 0
 #define FIND_REVERSE 1
 isc_result_t find_cached_zone (dhcp_ddns_cb_t *, int);
+#if defined (DNS_ZONE_LOOKUP)
+void cache_negative_zone (const char *);
+#endif
 void forget_zone (struct dns_zone **);
 void repudiate_zone (struct dns_zone **);
 int get_dhcid (dhcp_ddns_cb_t *, int, const u_int8_t *, unsigned);
@@ -3216,6 +3626,33 @@ isc_result_t ddns_update_fwd(struct data_string *, struct iaddr,
 isc_result_t ddns_remove_fwd(struct data_string *,
 			     struct iaddr, struct data_string *);
 char *ddns_state_name(int state);
+
+/* DDNS batching and flow control counters. */
+struct ddns_stats {
+	u_int64_t sent;			/* update messages sent */
+	u_int64_t records;		/* records carried by them */
+	u_int64_t batched;		/* records sent as part of a batch */
+	u_int64_t deferred;		/* held for lack of a server slot */
+	u_int64_t completed;		/* messages answered or timed out */
+	u_int64_t failed;		/* ... with a result other than success */
+	u_int64_t latency_total;	/* submit to completion, milliseconds */
+	u_int32_t latency_max;
+	u_int32_t queue_depth;		/* records waiting to be sent */
+	u_int32_t queue_max;
+	u_int32_t outstanding;		/* messages awaiting an answer */
+};
+
+extern struct ddns_stats ddns_stats;
+extern u_int32_t ddns_batch_window;
+extern u_int32_t ddns_batch_size;
+extern u_int32_t ddns_max_outstanding;
+void ddns_log_stats (void);
+
+extern u_int32_t dns_zone_negative_ttl;
+extern const char *dns_zone_cache_file;
+void dns_zone_cache_save (void);
+void dns_zone_cache_changed (void);
+void dns_zone_cache_load (void);
 #endif /* NSUPDATE */
 
 dhcp_ddns_cb_t *ddns_cb_alloc(const char *file, int line);
@@ -3258,6 +3695,7 @@ isc_result_t find_class (struct class **, const char *,
 			 const char *, int);
 void unbill_class (struct lease *);
 int bill_class (struct lease *, struct class *);
+int spawn_subclass (struct class **, struct class *, struct data_string *);
 
 /* execute.c */
 int execute_statements (struct binding_value **result,
@@ -3381,6 +3819,7 @@ extern omapi_object_type_t *dhcp_type_lease;
 extern omapi_object_type_t *dhcp_type_pool;
 extern omapi_object_type_t *dhcp_type_class;
 extern omapi_object_type_t *dhcp_type_subclass;
+extern omapi_object_type_t *dhcp_type_lease_cursor;
 
 #if defined (FAILOVER_PROTOCOL)
 extern omapi_object_type_t *dhcp_type_failover_state;
@@ -3526,19 +3965,29 @@ extern struct shared_network *shared_networks;
 extern host_hash_t *host_hw_addr_hash;
 extern host_hash_t *host_uid_hash;
 extern host_hash_t *host_name_hash;
-extern lease_id_hash_t *lease_uid_hash;
+extern client_leases_hash_t *lease_uid_hash;
 extern lease_ip_hash_t *lease_ip_addr_hash;
-extern lease_id_hash_t *lease_hw_addr_hash;
+extern client_leases_hash_t *lease_hw_addr_hash;
 
 extern omapi_object_type_t *dhcp_type_host;
 
 extern int numclasseswritten;
 
+/* The host declaration lookup tables, as a unit, so that they can be set
+   aside while a new configuration is read. */
+struct host_tables {
+	host_hash_t *hw_addr_hash;
+	host_hash_t *uid_hash;
+	host_hash_t *name_hash;
+	void *id_info;
+};
 
 isc_result_t enter_class (struct class *, int, int);
 isc_result_t delete_class (struct class *, int);
 isc_result_t enter_host (struct host_decl *, int, int);
 isc_result_t delete_host (struct host_decl *, int);
+void swap_host_tables (struct host_tables *);
+void free_host_tables (struct host_tables *);
 void change_host_uid(struct host_decl *host, const char *data, int len);
 int find_hosts_by_haddr (struct host_decl **, int,
 			 const unsigned char *, unsigned,
@@ -3553,6 +4002,14 @@ int find_host_for_network (struct subnet **, struct host_decl **,
 void new_address_range (struct parse *, struct iaddr, struct iaddr,
 			struct subnet *, struct pool *,
 			struct lease **);
+isc_result_t check_lease_ranges (void);
+int find_range_lease (struct lease **, struct iaddr, int);
+int use_unused_lease (struct pool *);
+void move_lease_ranges (struct pool *, struct pool *);
+int lease_ranges_match (struct pool *, struct pool *);
+void free_lease_ranges (struct pool *);
+void swap_lease_range_tables (struct lease_range_table *);
+void free_lease_range_table (struct lease_range_table *);
 isc_result_t dhcp_lease_free (omapi_object_t *, const char *, int);
 isc_result_t dhcp_lease_get (omapi_object_t **, const char *, int);
 int find_grouped_subnet (struct subnet **, struct shared_network *,
@@ -3575,12 +4032,35 @@ void abandon_lease (struct lease *, const char *);
 void dissociate_lease (struct lease *);
 #endif
 void pool_timer (void *);
+
+/* Lease expiry counters, kept by pool_timer(). */
+struct expiry_stats {
+	u_int64_t runs;			/* runs that expired something */
+	u_int64_t transitions;		/* state changes made by them */
+	u_int64_t deferred;		/* runs stopped by expiry-batch-size */
+	u_int64_t lag_total;		/* due to done, seconds */
+	u_int32_t batch_max;
+	u_int32_t lag_max;
+};
+
+extern struct expiry_stats expiry_stats;
+extern u_int32_t expiry_batch_size;
+void expiry_log_stats (void);
 int find_lease_by_uid (struct lease **, const unsigned char *,
 		       unsigned, const char *, int);
 int find_lease_by_hw_addr (struct lease **, const unsigned char *,
 			   unsigned, const char *, int);
+struct client_leases *find_client_leases_by_uid (const unsigned char *,
+						 unsigned);
+struct client_leases *find_client_leases_by_hw_addr (const unsigned char *,
+						     unsigned);
+unsigned client_leases_index (const struct client_leases *,
+			      const struct lease *);
 int find_lease_by_ip_addr (struct lease **, struct iaddr,
 			   const char *, int);
+int use_lease_by_ip_addr (struct lease **, struct iaddr,
+			  const char *, int);
+int find_address_pool (struct pool **, struct iaddr);
 void uid_hash_add (struct lease *);
 void uid_hash_delete (struct lease *);
 void hw_hash_add (struct lease *);
@@ -3594,6 +4074,10 @@ void lease_remove_all(struct lease **);
 #endif
 int lease_enqueue (struct lease *);
 isc_result_t lease_instantiate(const void *, unsigned, void *);
+#if defined (BINARY_LEASES)
+void pool_init_growth (struct pool *);
+void pool_init_all_growth (void);
+#endif
 void expire_all_pools (void);
 void dump_subnets (void);
 #if defined (DEBUG_MEMORY_LEAKAGE) || \
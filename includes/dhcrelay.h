@@ -0,0 +1,41 @@
+/* dhcrelay.h
+
+   Definitions shared by the DHCPv6 relay code and its unit tests. */
+
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/* The options of a Relay-Reply that the relay looks at, as found in the
+   received packet. */
+struct relay6_repl {
+	const unsigned char *msg;	/* Relay Message */
+	unsigned msg_len;
+	const unsigned char *if_id;	/* Interface-Id */
+	unsigned if_id_len;
+	const unsigned char *port;	/* Relay Source Port */
+	unsigned port_len;
+};
+
+int relay6_put_option(unsigned char *, unsigned *, unsigned, unsigned,
+		      const void *, unsigned);
+int relay6_parse_repl(const unsigned char *, unsigned, struct relay6_repl *);
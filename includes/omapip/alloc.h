@@ -89,6 +89,9 @@ struct rc_history_entry {
 #define rc_register_mdl(reference, addr, refcnt, d, f)
 #endif
 
+extern unsigned long dmalloc_count;
+extern unsigned long dfree_count;
+
 #if defined (DEBUG_MEMORY_LEAKAGE) || defined (DEBUG_MALLOC_POOL) || \
 		defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
 extern struct dmalloc_preamble *dmalloc_list;
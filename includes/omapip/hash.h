@@ -83,6 +83,7 @@ int name##_hash_lookup (type **, hashtype *, bufarg, unsigned,		      \
 unsigned char * name##_hash_report(hashtype *);				      \
 int name##_hash_foreach (hashtype *, hash_foreach_func);		      \
 int name##_new_hash (hashtype **, unsigned, const char *, int);		      \
+int name##_rehash (hashtype **, unsigned, const char *, int);		      \
 void name##_free_hash_table (hashtype **, const char *, int);
 
 
@@ -128,6 +129,11 @@ int name##_new_hash (hashtype **tp, unsigned c, const char *file, int line)   \
 			 hasher, file, line);				      \
 }									      \
 									      \
+int name##_rehash (hashtype **tp, unsigned c, const char *file, int line)     \
+{									      \
+	return rehash ((struct hash_table **)tp, c, file, line);	      \
+}									      \
+									      \
 void name##_free_hash_table (hashtype **table, const char *file, int line)    \
 {									      \
 	free_hash_table ((struct hash_table **)table, file, line);	      \
@@ -142,6 +148,7 @@ int new_hash(struct hash_table **,
 	     hash_reference, hash_dereference, unsigned,
 	     unsigned (*do_hash)(const void *, unsigned, unsigned),
 	     const char *, int);
+int rehash(struct hash_table **, unsigned, const char *, int);
 unsigned do_string_hash(const void *, unsigned, unsigned);
 unsigned do_case_hash(const void *, unsigned, unsigned);
 unsigned do_id_hash(const void *, unsigned, unsigned);
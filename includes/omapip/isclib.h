@@ -141,6 +141,7 @@ void isclib_cleanup(void);
 
 void dhcp_signal_handler(int signal);
 extern int shutdown_signal;
+extern int reload_signal;
 
 #if defined (NSUPDATE)
 isc_result_t dns_client_init();
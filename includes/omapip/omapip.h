@@ -436,6 +436,8 @@ isc_result_t omapi_message_stuff_values (omapi_object_t *,
 isc_result_t omapi_message_register (omapi_object_t *);
 isc_result_t omapi_message_unregister (omapi_object_t *);
 isc_result_t omapi_message_process (omapi_object_t *, omapi_object_t *);
+isc_result_t omapi_message_add_object (omapi_object_t *, omapi_object_t *);
+extern isc_result_t (*omapi_bulk_hook) (int);
 
 OMAPI_OBJECT_ALLOC_DECL (omapi_auth_key,
 			 omapi_auth_key_t, omapi_type_auth_key)
@@ -94,6 +94,10 @@ typedef struct {
 #define OMAPI_OP_NOTIFY		4
 #define OMAPI_OP_STATUS		5
 #define OMAPI_OP_DELETE		6
+#define OMAPI_OP_BULK		7
+
+/* The most objects a bulk message may carry. */
+#define OMAPI_BULK_MAX		1024
 
 typedef enum {
 	omapi_connection_unconnected,
@@ -127,6 +131,8 @@ typedef struct __omapi_message_object {
 	u_int32_t h;
 	u_int32_t id;
 	u_int32_t rid;
+	omapi_array_t *objects;	/* Objects carried by a bulk message, */
+	u_int32_t count;	/* ... and how many there are to come. */
 } omapi_message_object_t;
 
 typedef struct __omapi_remote_auth {
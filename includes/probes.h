@@ -0,0 +1,75 @@
+/* probes.h
+
+   Static tracepoints at the stages of handling a packet. */
+
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/*
+ * When the build is configured with --enable-usdt-probes the server has
+ * SystemTap-style static probes, under the provider "dhcpd", made from
+ * probes.d by dtrace.  A probe is a single no-op instruction until a
+ * tracer such as bpftrace or perf attaches to it, and its arguments are
+ * only worked out while one is attached; otherwise the macros below
+ * compile to nothing.
+ *
+ * The probes come in pairs, <stage>_start and <stage>_done, around the
+ * stages of handling a packet.  Each carries two arguments: the packet's
+ * transaction ID and a 32-bit hash of the client's identity.  For DHCPv4
+ * that is the hardware type and address, so that probes on a lease give
+ * the same hash as those on its client's packets; for DHCPv6 it is the
+ * client identifier.  Either is zero if it isn't known.  Probes that
+ * aren't about any one packet, such as those around committing the lease
+ * file, carry zeros; a tracer attributes them to the packet whose stage
+ * they fall within, if any.
+ *
+ * The macros take the probe's name in capitals, as dtrace -h writes it.
+ *
+ * contrib/dhcpd-stages.bt and contrib/dhcpd-stages.sh use these to
+ * draw flame graphs of where the time handling packets went.
+ */
+
+#if defined (USDT_PROBES)
+#include "probes-dtrace.h"
+
+u_int32_t probe_xid(const struct packet *);
+u_int32_t probe_key(const struct packet *);
+u_int32_t probe_lease_xid(const struct lease *);
+u_int32_t probe_lease_key(const struct lease *);
+
+#define PROBE(name) DHCPD_##name(0, 0)
+#define PROBE_ARGS(name, xid, key) \
+	do { \
+		if (DHCPD_##name##_ENABLED()) \
+			DHCPD_##name(xid, key); \
+	} while (0)
+#define PROBE_PACKET(name, packet) \
+	PROBE_ARGS(name, probe_xid(packet), probe_key(packet))
+#define PROBE_LEASE(name, lease) \
+	PROBE_ARGS(name, probe_lease_xid(lease), probe_lease_key(lease))
+#else
+#define PROBE(name) do { } while (0)
+#define PROBE_ARGS(name, xid, key) do { } while (0)
+#define PROBE_PACKET(name, packet) do { } while (0)
+#define PROBE_LEASE(name, lease) do { } while (0)
+#endif
@@ -120,6 +120,13 @@
 /* #define DEBUG_CHECKSUM_VERBOSE */
 
 
+/* Define this, along with --enable-binary-leases, to keep each lease
+   queue as a list of small blocks of entries that hold the sort key of
+   their lease, rather than as one array of lease pointers.  Searching a
+   queue then reads only the entries rather than every lease it compares,
+   and adding or removing a lease moves at most one block's entries. */
+/* #define LEASECHAIN_BLOCKS */
+
 /* Define this if you want DHCP failover protocol support in the DHCP
    server. */
 
@@ -218,6 +225,14 @@
 
 #define COMPACT_LEASES
 
+/* Define this to keep the addresses of each range statement in a bitmap
+   and only make a lease for an address when it is first used, rather
+   than making one for every address as the configuration is read.  This
+   saves a lot of memory and startup time for large ranges that are
+   mostly unused. */
+
+#define LAZY_RANGES
+
 /* Define this if you want to be able to save and playback server operational
    traces. */
 
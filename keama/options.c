@@ -393,6 +393,25 @@ struct option_def configs[] = {
         { "bind-local-address6", "f",           "server",  98, 0},
 	{ "ping-cltt-secs", "T",		"server",  99, 0},
 	{ "ping-timeout-ms", "T",		"server", 100, 0},
+	{ "lease-snapshot-file", "t",		"server", 101, 0},
+	{ "lease-snapshot-size", "L",		"server", 102, 0},
+	{ "ddns-batch-window", "L",		"server", 103, 0},
+	{ "ddns-batch-size", "L",		"server", 104, 0},
+	{ "ddns-max-outstanding", "L",		"server", 105, 0},
+	{ "ddns-zone-negative-ttl", "T",		"server", 106, 0},
+	{ "ddns-zone-cache-file", "t",		"server", 107, 0},
+	{ "ping-ahead", "L",			"server", 108, 0},
+	{ "ping-verified-lifetime", "T",		"server", 109, 0},
+	{ "expiry-batch-size", "L",		"server", 110, 0},
+	{ "drop-unknown-relays", "f",		"server", 111, 0},
+	{ "admission-rate", "L",		"server", 112, 0},
+	{ "admission-client-rate", "L",		"server", 113, 0},
+	{ "admission-client-burst", "L",	"server", 114, 0},
+	{ "admission-clients", "L",		"server", 115, 0},
+	{ "duplicate-cache-time", "L",		"server", 116, 0},
+	{ "duplicate-cache-size", "L",		"server", 117, 0},
+	{ "metrics-port", "S",			"server", 118, 0},
+	{ "metrics-address", "I",		"server", 119, 0},
 	{ NULL, NULL, NULL, 0, 0 }
 };
 
@@ -53,6 +53,10 @@ static void print_rc_hist_entry (int);
 static int dmalloc_failures;
 static char out_of_memory[] = "Run out of memory.";
 
+/* How many blocks have been allocated and freed, for benchmarks. */
+unsigned long dmalloc_count;
+unsigned long dfree_count;
+
 void *
 dmalloc(size_t size, const char *file, int line) {
 	unsigned char *foo;
@@ -87,6 +91,7 @@ dmalloc(size_t size, const char *file, int line) {
 	}
 	bar = (void *)(foo + DMDOFFSET);
 	memset (bar, 0, size);
+	dmalloc_count++;
 
 #if defined (DEBUG_MEMORY_LEAKAGE) || defined (DEBUG_MALLOC_POOL) || \
 		defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
@@ -147,6 +152,7 @@ dfree(void *ptr, const char *file, int line) {
 		log_error ("dfree %s(%d): free on null pointer.", file, line);
 		return;
 	}
+	dfree_count++;
 #if defined (DEBUG_MEMORY_LEAKAGE) || defined (DEBUG_MALLOC_POOL) || \
 		defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
 	{
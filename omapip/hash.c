@@ -236,6 +236,43 @@ int new_hash(struct hash_table **rp,
 	return 1;
 }
 
+/* Move the entries of a hash table into a new table with count buckets,
+ * for a table that has grown well past the size it was created with.
+ * The entries keep their buckets and references; only the bucket array
+ * is replaced.  This must not be done while the table is being walked
+ * with hash_foreach().
+ */
+int rehash(struct hash_table **tp, unsigned count, const char *file, int line)
+{
+	struct hash_table *old = *tp, *rval = NULL;
+	struct hash_bucket *bp, *next;
+	unsigned i, hashno;
+
+	if (old == NULL || count == old->hash_count)
+		return 1;
+
+	if (!new_hash_table(&rval, count, file, line))
+		return 0;
+	memset(rval->buckets, 0, count * sizeof(struct hash_bucket *));
+	rval->referencer = old->referencer;
+	rval->dereferencer = old->dereferencer;
+	rval->cmp = old->cmp;
+	rval->do_hash = old->do_hash;
+
+	for (i = 0; i < old->hash_count; i++) {
+		for (bp = old->buckets[i]; bp != NULL; bp = next) {
+			next = bp->next;
+			hashno = (*rval->do_hash)(bp->name, bp->len, count);
+			bp->next = rval->buckets[hashno];
+			rval->buckets[hashno] = bp;
+		}
+	}
+
+	dfree(old, file, line);
+	*tp = rval;
+	return 1;
+}
+
 unsigned
 do_case_hash(const void *name, unsigned len, unsigned size)
 {
@@ -32,6 +32,7 @@
 
 dhcp_context_t dhcp_gbl_ctx;
 int shutdown_signal = 0;
+int reload_signal = 0;
 
 #if defined (NSUPDATE)
 
@@ -381,6 +382,16 @@ void dhcp_signal_handler(int signal) {
 		return;
 	}
 
+	/* SIGHUP asks for a reload rather than a shutdown; dispatch()
+	   tells the two apart once the context has stopped. */
+	if (signal == SIGHUP) {
+		reload_signal = signal;
+		if (dhcp_gbl_ctx.actx_running == ISC_TRUE) {
+			(void) isc_app_ctxsuspend(dhcp_gbl_ctx.actx);
+		}
+		return;
+	}
+
 	/* Possible race but does it matter? */
 	shutdown_signal = signal;
 
@@ -35,6 +35,14 @@ OMAPI_OBJECT_ALLOC (omapi_message,
 
 omapi_message_object_t *omapi_registered_messages;
 
+OMAPI_ARRAY_TYPE (omapi_object, omapi_object_t)
+
+/* If set, called with 1 before the objects in a bulk message are opened
+   and with 0 once they all have been, so that the application can commit
+   the changes to them together.  The result of the second call is
+   returned to the client if it isn't success. */
+isc_result_t (*omapi_bulk_hook) (int);
+
 isc_result_t omapi_message_new (omapi_object_t **o, const char *file, int line)
 {
 	omapi_message_object_t *m;
@@ -222,6 +230,8 @@ isc_result_t omapi_message_destroy (omapi_object_t *h,
 		omapi_object_dereference (&m -> notify_object, file, line);
 	if (m -> protocol_object)
 		omapi_protocol_dereference (&m -> protocol_object, file, line);
+	if (m -> objects)
+		omapi_object_array_free (&m -> objects, file, line);
 	return ISC_R_SUCCESS;
 }
 
@@ -264,6 +274,26 @@ isc_result_t omapi_message_stuff_values (omapi_object_t *c,
 	return ISC_R_SUCCESS;
 }
 
+/* Add an object to the list carried by a bulk message. */
+
+isc_result_t omapi_message_add_object (omapi_object_t *mo,
+				       omapi_object_t *o)
+{
+	omapi_message_object_t *m;
+	isc_result_t status;
+
+	if (mo -> type != omapi_type_message)
+		return DHCP_R_INVALIDARG;
+	m = (omapi_message_object_t *)mo;
+
+	if (!m -> objects) {
+		status = omapi_object_array_allocate (&m -> objects, MDL);
+		if (status != ISC_R_SUCCESS)
+			return status;
+	}
+	return omapi_object_array_extend (m -> objects, o, (int *)0, MDL);
+}
+
 isc_result_t omapi_message_register (omapi_object_t *mo)
 {
 	omapi_message_object_t *m;
@@ -347,6 +377,7 @@ const char *omapi_message_op_name(int op) {
 	case OMAPI_OP_STATUS:  return "OMAPI_OP_STATUS";
 	case OMAPI_OP_DELETE:  return "OMAPI_OP_DELETE";
 	case OMAPI_OP_NOTIFY:  return "OMAPI_OP_NOTIFY";
+	case OMAPI_OP_BULK:    return "OMAPI_OP_BULK";
 	default:               return "(unknown op)";
 	}
 }
@@ -354,6 +385,18 @@ const char *omapi_message_op_name(int op) {
 
 static isc_result_t
 omapi_message_process_internal (omapi_object_t *, omapi_object_t *);
+static isc_result_t
+omapi_message_open_object (omapi_object_t **, omapi_object_t *,
+			   omapi_object_type_t *, omapi_object_t *,
+			   omapi_handle_t, unsigned long, unsigned long,
+			   unsigned long, const char **);
+static isc_result_t
+omapi_message_process_bulk (omapi_message_object_t *, omapi_object_t *,
+			    omapi_object_type_t *, unsigned long,
+			    unsigned long, unsigned long);
+static isc_result_t
+omapi_message_bulk_response (omapi_message_object_t *,
+			     omapi_message_object_t *);
 
 isc_result_t omapi_message_process (omapi_object_t *mo, omapi_object_t *po)
 {
@@ -390,6 +433,7 @@ omapi_message_process_internal (omapi_object_t *mo, omapi_object_t *po)
 	unsigned long wsi;
 	isc_result_t status, waitstatus;
 	omapi_object_type_t *type;
+	const char *msg;
 
 	if (mo -> type != omapi_type_message)
 		return DHCP_R_INVALIDARG;
@@ -430,6 +474,12 @@ omapi_message_process_internal (omapi_object_t *mo, omapi_object_t *po)
 	}
 
 	switch (message -> op) {
+	      case OMAPI_OP_BULK:
+		if (m)
+			return omapi_message_bulk_response (message, m);
+		/* Otherwise it's opened like an OPEN, once per object. */
+		/* FALLTHROUGH */
+
 	      case OMAPI_OP_OPEN:
 		if (m) {
 			return omapi_protocol_send_status
@@ -519,85 +569,30 @@ omapi_message_process_internal (omapi_object_t *mo, omapi_object_t *po)
 					 message->id,
 					 "type required on create");
 			}
+			if (message -> op == OMAPI_OP_BULK) {
+				return omapi_protocol_send_status
+					(po, message->id_object,
+					 DHCP_R_INVALIDARG,
+					 message->id,
+					 "type required on bulk open");
+			}
 			goto refresh;
 		}
 
-		/* If the type doesn't provide a lookup method, we can't
-		   look up the object. */
-		if (!type -> lookup) {
-			return omapi_protocol_send_status
-				(po, message -> id_object,
-				 ISC_R_NOTIMPLEMENTED, message -> id,
-				 "unsearchable object type");
-		}
-
-		status = (*(type -> lookup)) (&object, message -> id_object,
-					      message -> object);
+		if (message -> op == OMAPI_OP_BULK)
+			return omapi_message_process_bulk (message, po, type,
+							   create, update,
+							   exclusive);
 
-		if (status != ISC_R_SUCCESS &&
-		    status != ISC_R_NOTFOUND &&
-		    status != DHCP_R_NOKEYS) {
-			return omapi_protocol_send_status
-				(po, message -> id_object,
-				 status, message -> id,
-				 "object lookup failed");
-		}
-
-		/* If we didn't find the object and we aren't supposed to
-		   create it, return an error. */
-		if (status == ISC_R_NOTFOUND && !create) {
-			return omapi_protocol_send_status
-				(po, message -> id_object,
-				 ISC_R_NOTFOUND, message -> id,
-				 "no object matches specification");
-		}
-
-		/* If we found an object, we're supposed to be creating an
-		   object, and we're not supposed to have found an object,
-		   return an error. */
-		if (status == ISC_R_SUCCESS && create && exclusive) {
-			omapi_object_dereference (&object, MDL);
+		status = omapi_message_open_object (&object,
+						    message -> id_object,
+						    type, message -> object,
+						    message -> h, create,
+						    update, exclusive, &msg);
+		if (status != ISC_R_SUCCESS) {
 			return omapi_protocol_send_status
 				(po, message -> id_object,
-				 ISC_R_EXISTS, message -> id,
-				 "specified object already exists");
-		}
-
-		/* If we're creating the object, do it now. */
-		if (!object) {
-			status = omapi_object_create (&object,
-						      message -> id_object,
-						      type);
-			if (status != ISC_R_SUCCESS) {
-				return omapi_protocol_send_status
-					(po, message -> id_object,
-					 status, message -> id,
-					 "can't create new object");
-			}
-		}
-
-		/* If we're updating it, do so now. */
-		if (create || update) {
-			/* This check does not belong here. */
-			if (object -> type == omapi_type_auth_key) {
-				omapi_object_dereference (&object, MDL);
-				return omapi_protocol_send_status
-					(po, message -> id_object,
-					 status, message -> id,
-					 "can't update object");
-			}
-
-			status = omapi_object_update (object,
-						      message -> id_object,
-						      message -> object,
-						      message -> h);
-			if (status != ISC_R_SUCCESS) {
-				omapi_object_dereference (&object, MDL);
-				return omapi_protocol_send_status
-					(po, message -> id_object,
-					 status, message -> id,
-					 "can't update object");
-			}
+				 status, message -> id, msg);
 		}
 
 		/* If this is an authenticator object, add it to the active
@@ -636,6 +631,11 @@ omapi_message_process_internal (omapi_object_t *mo, omapi_object_t *po)
 				 status, message -> id,
 				 "no matching handle");
 		}
+
+		/* Let the object know it's being asked for again, as
+		   opposed to being sent back after an open. */
+		if (message -> op == OMAPI_OP_REFRESH)
+			(void) omapi_signal (object, "refresh");
 	      send:
 		status = omapi_protocol_send_update (po, message -> id_object,
 						     message -> id, object);
@@ -760,3 +760,291 @@ omapi_message_process_internal (omapi_object_t *mo, omapi_object_t *po)
 	}
 	return ISC_R_NOTIMPLEMENTED;
 }
+
+/* Find, create and/or update the object an OPEN message (or one of the
+   objects in a bulk message) asks for.  On failure, *msg says why. */
+
+static isc_result_t
+omapi_message_open_object (omapi_object_t **object, omapi_object_t *id,
+			   omapi_object_type_t *type, omapi_object_t *key,
+			   omapi_handle_t handle, unsigned long create,
+			   unsigned long update, unsigned long exclusive,
+			   const char **msg)
+{
+	isc_result_t status;
+
+	/* If the type doesn't provide a lookup method, we can't
+	   look up the object. */
+	if (!type -> lookup) {
+		*msg = "unsearchable object type";
+		return ISC_R_NOTIMPLEMENTED;
+	}
+
+	status = (*(type -> lookup)) (object, id, key);
+
+	if (status != ISC_R_SUCCESS &&
+	    status != ISC_R_NOTFOUND &&
+	    status != DHCP_R_NOKEYS) {
+		*msg = "object lookup failed";
+		return status;
+	}
+
+	/* If we didn't find the object and we aren't supposed to
+	   create it, return an error. */
+	if (status == ISC_R_NOTFOUND && !create) {
+		*msg = "no object matches specification";
+		return ISC_R_NOTFOUND;
+	}
+
+	/* If we found an object, we're supposed to be creating an
+	   object, and we're not supposed to have found an object,
+	   return an error. */
+	if (status == ISC_R_SUCCESS && create && exclusive) {
+		omapi_object_dereference (object, MDL);
+		*msg = "specified object already exists";
+		return ISC_R_EXISTS;
+	}
+
+	/* If we're creating the object, do it now. */
+	if (!*object) {
+		status = omapi_object_create (object, id, type);
+		if (status != ISC_R_SUCCESS) {
+			*msg = "can't create new object";
+			return status;
+		}
+	}
+
+	/* If we're updating it, do so now. */
+	if (create || update) {
+		/* This check does not belong here. */
+		if ((*object) -> type == omapi_type_auth_key) {
+			omapi_object_dereference (object, MDL);
+			*msg = "can't update object";
+			return ISC_R_NOPERM;
+		}
+
+		status = omapi_object_update (*object, id, key, handle);
+		if (status != ISC_R_SUCCESS) {
+			omapi_object_dereference (object, MDL);
+			*msg = "can't update object";
+			return status;
+		}
+	}
+
+	return ISC_R_SUCCESS;
+}
+
+/* Open each of the objects in a bulk message, and answer with a bulk
+   message carrying the result and handle of each one, in the "results"
+   and "handles" values, along with the object itself.  Objects that
+   couldn't be opened are answered with an empty object.  The changes are
+   committed together once all of the objects have been opened. */
+
+static isc_result_t
+omapi_message_process_bulk (omapi_message_object_t *message,
+			    omapi_object_t *po, omapi_object_type_t *type,
+			    unsigned long create, unsigned long update,
+			    unsigned long exclusive)
+{
+	omapi_object_t *reply = (omapi_object_t *)0;
+	omapi_object_t *key = (omapi_object_t *)0;
+	omapi_object_t *object = (omapi_object_t *)0;
+	omapi_typed_data_t *results = (omapi_typed_data_t *)0;
+	omapi_typed_data_t *handles = (omapi_typed_data_t *)0;
+	omapi_handle_t handle;
+	isc_result_t status, result, waitstatus;
+	const char *msg;
+	int i, count;
+
+	if (type == omapi_type_auth_key)
+		return omapi_protocol_send_status
+			(po, message -> id_object,
+			 DHCP_R_INVALIDARG, message -> id,
+			 "can't bulk open authenticators");
+
+	count = message -> objects ? message -> objects -> count : 0;
+	if (count > OMAPI_BULK_MAX)
+		return omapi_protocol_send_status
+			(po, message -> id_object,
+			 ISC_R_NOSPACE, message -> id,
+			 "too many objects in bulk open");
+
+	status = omapi_message_new (&reply, MDL);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_set_int_value (reply, (omapi_object_t *)0,
+				      "op", OMAPI_OP_BULK);
+	if (status == ISC_R_SUCCESS && count > 0)
+		status = omapi_typed_data_new (MDL, &results,
+					       omapi_datatype_data,
+					       count * 4);
+	if (status == ISC_R_SUCCESS && count > 0)
+		status = omapi_typed_data_new (MDL, &handles,
+					       omapi_datatype_data,
+					       count * 4);
+	if (status != ISC_R_SUCCESS)
+		goto out;
+
+	if (omapi_bulk_hook)
+		(void) (*omapi_bulk_hook) (1);
+
+	waitstatus = ISC_R_SUCCESS;
+	for (i = 0; i < count; i++) {
+		handle = 0;
+		result = omapi_object_array_lookup (&key, message -> objects,
+						    i, MDL);
+		if (result == ISC_R_SUCCESS) {
+			result = omapi_message_open_object
+				(&object, message -> id_object, type, key,
+				 0, create, update, exclusive, &msg);
+			omapi_object_dereference (&key, MDL);
+		}
+		if (result == ISC_R_SUCCESS) {
+			result = omapi_object_handle (&handle, object);
+			if (result != ISC_R_SUCCESS)
+				omapi_object_dereference (&object, MDL);
+		}
+		if (result != ISC_R_SUCCESS) {
+			handle = 0;
+			if (waitstatus == ISC_R_SUCCESS)
+				waitstatus = result;
+
+			/* Keep the objects in the answer lined up with the
+			   ones asked for. */
+			status = omapi_generic_new (&object, MDL);
+			if (status != ISC_R_SUCCESS)
+				break;
+		}
+		status = omapi_message_add_object (reply, object);
+		omapi_object_dereference (&object, MDL);
+		if (status != ISC_R_SUCCESS)
+			break;
+
+		putULong (&results -> u.buffer.value [i * 4], result);
+		putULong (&handles -> u.buffer.value [i * 4], handle);
+	}
+
+	if (omapi_bulk_hook) {
+		result = (*omapi_bulk_hook) (0);
+		if (result != ISC_R_SUCCESS)
+			waitstatus = result;
+	}
+	if (status != ISC_R_SUCCESS)
+		goto out;
+
+	status = omapi_set_int_value (reply, (omapi_object_t *)0,
+				      "result", (int)waitstatus);
+	if (status == ISC_R_SUCCESS && count > 0)
+		status = omapi_set_value_str (reply, (omapi_object_t *)0,
+					      "results", results);
+	if (status == ISC_R_SUCCESS && count > 0)
+		status = omapi_set_value_str (reply, (omapi_object_t *)0,
+					      "handles", handles);
+	if (status == ISC_R_SUCCESS)
+		status = omapi_protocol_send_message (po,
+						      message -> id_object,
+						      reply,
+						      (omapi_object_t *)message);
+
+      out:
+	if (results)
+		omapi_typed_data_dereference (&results, MDL);
+	if (handles)
+		omapi_typed_data_dereference (&handles, MDL);
+	omapi_object_dereference (&reply, MDL);
+	return status;
+}
+
+/* Hand the answer to a bulk message out to the objects that were sent
+   in it: each one is updated with the object that came back for it, or
+   gets a status signal if it couldn't be opened.  Then the message gets
+   a status signal with the overall result. */
+
+static isc_result_t
+omapi_message_bulk_response (omapi_message_object_t *message,
+			     omapi_message_object_t *m)
+{
+	omapi_value_t *tv = (omapi_value_t *)0;
+	omapi_value_t *rv = (omapi_value_t *)0;
+	omapi_value_t *hv = (omapi_value_t *)0;
+	omapi_object_t *object = (omapi_object_t *)0;
+	omapi_object_t *answer = (omapi_object_t *)0;
+	unsigned long wsi;
+	isc_result_t status, waitstatus, result;
+	omapi_handle_t handle = 0;
+	int i, count;
+
+	status = omapi_get_value_str ((omapi_object_t *)message,
+				      message -> id_object, "result", &tv);
+	if (status == ISC_R_SUCCESS) {
+		status = omapi_get_int_value (&wsi, tv -> value);
+		waitstatus = wsi;
+		omapi_value_dereference (&tv, MDL);
+		if (status != ISC_R_SUCCESS)
+			waitstatus = ISC_R_UNEXPECTED;
+	} else
+		waitstatus = ISC_R_UNEXPECTED;
+
+	count = m -> objects ? m -> objects -> count : 0;
+	if (count > 0) {
+		(void) omapi_get_value_str ((omapi_object_t *)message,
+					    message -> id_object,
+					    "results", &rv);
+		(void) omapi_get_value_str ((omapi_object_t *)message,
+					    message -> id_object,
+					    "handles", &hv);
+		if (!rv || !hv ||
+		    rv -> value -> type != omapi_datatype_data ||
+		    hv -> value -> type != omapi_datatype_data ||
+		    rv -> value -> u.buffer.len != count * 4 ||
+		    hv -> value -> u.buffer.len != count * 4 ||
+		    !message -> objects ||
+		    message -> objects -> count != count) {
+			if (waitstatus == ISC_R_SUCCESS)
+				waitstatus = ISC_R_UNEXPECTED;
+			if (rv)
+				omapi_value_dereference (&rv, MDL);
+			if (hv)
+				omapi_value_dereference (&hv, MDL);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (omapi_object_array_lookup (&object, m -> objects,
+					       i, MDL) != ISC_R_SUCCESS)
+			continue;
+		if (rv) {
+			result = getULong (&rv -> value -> u.buffer.value
+					   [i * 4]);
+			handle = getULong (&hv -> value -> u.buffer.value
+					   [i * 4]);
+		} else
+			result = waitstatus;
+
+		if (result == ISC_R_SUCCESS &&
+		    omapi_object_array_lookup (&answer, message -> objects,
+					       i, MDL) == ISC_R_SUCCESS) {
+			omapi_object_update (object, message -> id_object,
+					     answer, handle);
+			omapi_object_dereference (&answer, MDL);
+		} else
+			omapi_signal (object, "status", result,
+				      (omapi_typed_data_t *)0);
+		omapi_object_dereference (&object, MDL);
+	}
+	if (rv)
+		omapi_value_dereference (&rv, MDL);
+	if (hv)
+		omapi_value_dereference (&hv, MDL);
+
+	status = omapi_get_value_str ((omapi_object_t *)message,
+				      message -> id_object, "message", &tv);
+	omapi_signal ((omapi_object_t *)m, "status", waitstatus,
+		      status == ISC_R_SUCCESS ? tv -> value
+					      : (omapi_typed_data_t *)0);
+	if (status == ISC_R_SUCCESS)
+		omapi_value_dereference (&tv, MDL);
+
+	omapi_message_unregister ((omapi_object_t *)m);
+	return ISC_R_SUCCESS;
+}
@@ -157,6 +157,7 @@ isc_result_t omapi_protocol_send_message (omapi_object_t *po,
 	omapi_value_t *signature;
 	isc_result_t status;
 	unsigned auth_len;
+	int i;
 
 	if (po -> type != omapi_type_protocol ||
 	    !po -> outer || po -> outer -> type != omapi_type_connection ||
@@ -169,6 +170,16 @@ isc_result_t omapi_protocol_send_message (omapi_object_t *po,
 	m = (omapi_message_object_t *)mo;
 	om = (omapi_message_object_t *)omo;
 
+	/* A bulk message says how many objects it carries before it
+	   carries them. */
+	if (m -> op == OMAPI_OP_BULK) {
+		status = omapi_set_int_value (mo, (omapi_object_t *)0, "count",
+					      (m -> objects
+					       ? m -> objects -> count : 0));
+		if (status != ISC_R_SUCCESS)
+			return status;
+	}
+
 #ifdef DEBUG_PROTOCOL
 	log_debug ("omapi_protocol_send_message(): "
 		   "op=%s  handle=%#lx  id=%#lx  rid=%#lx",
@@ -286,8 +297,27 @@ isc_result_t omapi_protocol_send_message (omapi_object_t *po,
 	}
 
 	/* Stuff out all the published name/value pairs in the object that's
-	   being sent in the message, if there is one. */
-	if (m -> object) {
+	   being sent in the message, if there is one.  The objects in a
+	   bulk message are each ended by a zero-length name, except the
+	   last, which is ended by the one below. */
+	if (m -> op == OMAPI_OP_BULK) {
+		for (i = 0; m -> objects && i < m -> objects -> count; i++) {
+			if (i > 0) {
+				status = omapi_connection_put_uint16 (c, 0);
+				if (status != ISC_R_SUCCESS) {
+					omapi_disconnect (c, 1);
+					return status;
+				}
+			}
+			status = omapi_stuff_values
+				(c, id, (omapi_object_t *)
+				 m -> objects -> data [i]);
+			if (status != ISC_R_SUCCESS) {
+				omapi_disconnect (c, 1);
+				return status;
+			}
+		}
+	} else if (m -> object) {
 		status = omapi_stuff_values (c, id, m -> object);
 		if (status != ISC_R_SUCCESS) {
 			omapi_disconnect (c, 1);
@@ -340,6 +370,33 @@ isc_result_t omapi_protocol_send_message (omapi_object_t *po,
 }
 
 
+/* Get the number of objects a bulk message carries from its "count"
+   value, which has to come before them.  The count comes from the peer,
+   so more than OMAPI_BULK_MAX is a protocol error rather than a reason
+   to keep reading objects. */
+
+static isc_result_t omapi_protocol_bulk_count (omapi_message_object_t *m)
+{
+	omapi_value_t *tv = (omapi_value_t *)0;
+	unsigned long count;
+	isc_result_t status;
+
+	status = omapi_get_value_str ((omapi_object_t *)m, m -> id_object,
+				      "count", &tv);
+	if (status == ISC_R_NOTFOUND) {
+		m -> count = 0;
+		return ISC_R_SUCCESS;
+	}
+	if (status != ISC_R_SUCCESS)
+		return status;
+	status = omapi_get_int_value (&count, tv -> value);
+	omapi_value_dereference (&tv, MDL);
+	if (status != ISC_R_SUCCESS || count > OMAPI_BULK_MAX)
+		return DHCP_R_PROTOCOLERROR;
+	m -> count = count;
+	return ISC_R_SUCCESS;
+}
+
 isc_result_t omapi_protocol_signal_handler (omapi_object_t *h,
 					    const char *name, va_list ap)
 {
@@ -570,9 +627,44 @@ isc_result_t omapi_protocol_signal_handler (omapi_object_t *h,
 			   object. */
 			if (p -> reading_message_values) {
 				p -> reading_message_values = 0;
+				if (p -> message -> op == OMAPI_OP_BULK) {
+					status = omapi_protocol_bulk_count
+						(p -> message);
+					if (status != ISC_R_SUCCESS) {
+						omapi_disconnect (c, 1);
+						return status;
+					}
+				}
 				goto need_name_length;
 			}
 
+			/* A bulk message carries a number of objects, so
+			   keep reading until we have them all.  An object
+			   with no values still counts. */
+			if (p -> message -> op == OMAPI_OP_BULK &&
+			    p -> message -> count > 0) {
+				if (!p -> message -> object) {
+					status = (omapi_generic_new
+						  (&p -> message -> object,
+						   MDL));
+					if (status != ISC_R_SUCCESS) {
+						omapi_disconnect (c, 1);
+						return status;
+					}
+				}
+				status = (omapi_message_add_object
+					  ((omapi_object_t *)p -> message,
+					   p -> message -> object));
+				omapi_object_dereference
+					(&p -> message -> object, MDL);
+				if (status != ISC_R_SUCCESS) {
+					omapi_disconnect (c, 1);
+					return status;
+				}
+				if (--p -> message -> count > 0)
+					goto need_name_length;
+			}
+
 			/* If the authenticator length is zero, there's no
 			   signature to read in, so go straight to processing
 			   the message. */
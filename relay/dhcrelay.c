@@ -27,6 +27,7 @@
  */
 
 #include "dhcpd.h"
+#include "dhcrelay.h"
 #include <syslog.h>
 #include <signal.h>
 #include <sys/time.h>
@@ -102,8 +103,35 @@ extern u_int16_t remote_port;
 struct server_list {
 	struct server_list *next;
 	struct sockaddr_in to;
+	unsigned long requests_sent;	/* BOOTREQUESTs sent to the server. */
+	unsigned long request_errors;	/* Errors sending to the server. */
+	unsigned long replies_received;	/* BOOTREPLYs received from it. */
 } *servers;
 
+/* Per-interface state, kept in a hash table on the interface. */
+struct relay_if {
+	struct relay_if *next;		/* Hash chain by interface. */
+	struct relay_if *circuit_next;	/* Hash chain by circuit ID. */
+	struct interface_info *ifp;
+	unsigned long requests_received; /* Downstream: from clients, */
+	unsigned long requests_dropped;	/* ...not relayed, */
+	unsigned long replies_sent;	/* replies sent to clients, */
+	unsigned long reply_errors;	/* ...and errors sending them. */
+	unsigned long replies_received;	/* Upstream: from servers. */
+};
+
+/* An address of one of our interfaces, in a hash table on the address. */
+struct relay_addr {
+	struct relay_addr *next;
+	struct in_addr addr;
+	struct interface_info *ifp;
+};
+
+static struct relay_if **relay_if_hash = NULL;
+static struct relay_if **relay_circuit_hash = NULL;
+static struct relay_addr **relay_addr_hash = NULL;
+static unsigned relay_hash_size = 0;	/* A power of two. */
+
 struct interface_info *uplink = NULL;
 isc_boolean_t use_fake_gw = ISC_FALSE;
 struct in_addr gw = {0};
@@ -120,6 +148,8 @@ struct stream_list {
 static struct stream_list *parse_downstream(char *);
 static struct stream_list *parse_upstream(char *);
 static void setup_streams(void);
+static void relay6_packet(struct interface_info *, const char *, int, int,
+			  const struct iaddr *, isc_boolean_t);
 #endif /* UNIT_TEST */
 
 /*
@@ -147,6 +177,11 @@ extern int strip_relay_agent_options(struct interface_info *,
 				              struct interface_info **,
 				              struct dhcp_packet *, unsigned);
 
+extern void relay_index_interfaces(void);
+extern struct interface_info *find_interface_by_giaddr(struct in_addr);
+static struct relay_if *relay_if_lookup(struct interface_info *);
+static void relay_log_stats(void);
+
 #ifndef UNIT_TEST
 static void request_v4_interface(const char* name, int flags);
 
@@ -776,6 +811,9 @@ main(int argc, char **argv) {
 	/* Discover all the network interfaces. */
 	discover_interfaces(DISCOVER_RELAY);
 
+	if (local_family == AF_INET)
+		relay_index_interfaces();
+
 #ifdef DHCPv6
 	if (local_family == AF_INET6)
 		setup_streams();
@@ -830,7 +868,7 @@ main(int argc, char **argv) {
 		bootp_packet_handler = do_relay4;
 #ifdef DHCPv6
 	else
-		dhcpv6_packet_handler = do_packet6;
+		dhcpv6_packet_handler = relay6_packet;
 #endif
 
 #if defined(ENABLE_GENTLE_SHUTDOWN)
@@ -855,6 +893,15 @@ do_relay4(struct interface_info *ip, struct dhcp_packet *packet,
 	struct sockaddr_in to;
 	struct interface_info *out;
 	struct hardware hto, *htop;
+	struct relay_if *rif, *orif;
+
+	rif = relay_if_lookup(ip);
+	if (rif != NULL) {
+		if (packet->op == BOOTREPLY)
+			++rif->replies_received;
+		else
+			++rif->requests_received;
+	}
 
 	if (packet->hlen > sizeof packet->chaddr) {
 		log_info("Discarding packet with invalid hlen, received on "
@@ -870,20 +917,7 @@ do_relay4(struct interface_info *ip, struct dhcp_packet *packet,
 	/* Find the interface that corresponds to the giaddr
 	   in the packet. */
 	if (packet->giaddr.s_addr) {
-		for (out = interfaces; out; out = out->next) {
-			int i;
-
-			for (i = 0 ; i < out->address_count ; i++ ) {
-				if (out->addresses[i].s_addr ==
-				    packet->giaddr.s_addr) {
-					i = -1;
-					break;
-				}
-			}
-
-			if (i == -1)
-				break;
-		}
+		out = find_interface_by_giaddr(packet->giaddr);
 	} else {
 		out = NULL;
 	}
@@ -896,6 +930,13 @@ do_relay4(struct interface_info *ip, struct dhcp_packet *packet,
 		}
 
 		log_debug("BOOTREPLY giaddr: %s\n", inet_ntoa(packet->giaddr));
+		for (sp = servers; sp; sp = sp->next) {
+			if (from.len == sizeof(sp->to.sin_addr) &&
+			    !memcmp(&sp->to.sin_addr, from.iabuf, from.len)) {
+				++sp->replies_received;
+				break;
+			}
+		}
 		if (!(packet->flags & htons(BOOTP_BROADCAST)) &&
 			can_unicast_without_arp(out)) {
 			to.sin_addr = packet->yiaddr;
@@ -938,9 +979,12 @@ do_relay4(struct interface_info *ip, struct dhcp_packet *packet,
 			packet->giaddr = gw;
 		}
 
+		orif = relay_if_lookup(out);
 		if (send_packet(out, NULL, packet, length, out->addresses[0],
 				&to, htop) < 0) {
 			++server_packet_errors;
+			if (orif != NULL)
+				++orif->reply_errors;
 		} else {
 			log_debug("Forwarded BOOTREPLY for %s to %s",
 			       print_hw_addr(packet->htype, packet->hlen,
@@ -948,6 +992,8 @@ do_relay4(struct interface_info *ip, struct dhcp_packet *packet,
 			       inet_ntoa(to.sin_addr));
 
 			++server_packets_relayed;
+			if (orif != NULL)
+				++orif->replies_sent;
 		}
 		return;
 	}
@@ -959,6 +1005,8 @@ do_relay4(struct interface_info *ip, struct dhcp_packet *packet,
 
 	if (!(ip->flags & INTERFACE_DOWNSTREAM)) {
 		log_debug("Dropping request received on %s", ip->name);
+		if (rif != NULL)
+			++rif->requests_dropped;
 		return;
 	}
 
@@ -966,8 +1014,11 @@ do_relay4(struct interface_info *ip, struct dhcp_packet *packet,
 	 * drop the packet.  Note this may set packet->giaddr if RFC3527
 	 * is enabled. */
 	if (!(length = add_relay_agent_options(ip, packet, length,
-					       ip->addresses[0])))
+					       ip->addresses[0]))) {
+		if (rif != NULL)
+			++rif->requests_dropped;
 		return;
+	}
 
 	/* If giaddr is not already set, Set it so the server can
 	   figure out what net it's from and so that we can later
@@ -978,8 +1029,11 @@ do_relay4(struct interface_info *ip, struct dhcp_packet *packet,
 		packet->giaddr = ip->addresses[0];
 	if (packet->hops < max_hop_count)
 		packet->hops = packet->hops + 1;
-	else
+	else {
+		if (rif != NULL)
+			++rif->requests_dropped;
 		return;
+	}
 
 	/* Otherwise, it's a BOOTREQUEST, so forward it to all the
 	   servers. */
@@ -989,12 +1043,14 @@ do_relay4(struct interface_info *ip, struct dhcp_packet *packet,
 				 NULL, packet, length, ip->addresses[0],
 				 &sp->to, NULL) < 0) {
 			++client_packet_errors;
+			++sp->request_errors;
 		} else {
 			log_debug("Forwarded BOOTREQUEST for %s to %s",
 			       print_hw_addr(packet->htype, packet->hlen,
 					      packet->chaddr),
 			       inet_ntoa(sp->to.sin_addr));
 			++client_packets_relayed;
+			++sp->requests_sent;
 		}
 	}
 
@@ -1002,6 +1058,171 @@ do_relay4(struct interface_info *ip, struct dhcp_packet *packet,
 
 #endif /* UNIT_TEST */
 
+/* Log the per-server and per-interface counters. */
+static void
+relay_log_stats(void) {
+	struct server_list *sp;
+	struct interface_info *ip;
+	struct relay_if *rif;
+
+	log_info("Relayed %d requests (%d errors) and %d replies "
+		 "(%d errors); dropped %d replies to bogus giaddrs.",
+		 client_packets_relayed, client_packet_errors,
+		 server_packets_relayed, server_packet_errors,
+		 bogus_giaddr_drops);
+
+	for (sp = servers; sp; sp = sp->next) {
+		log_info("Server %s: %lu requests sent, %lu errors, "
+			 "%lu replies received.", inet_ntoa(sp->to.sin_addr),
+			 sp->requests_sent, sp->request_errors,
+			 sp->replies_received);
+	}
+
+	for (ip = interfaces; ip; ip = ip->next) {
+		rif = relay_if_lookup(ip);
+		if (rif == NULL)
+			continue;
+		if (ip->flags & INTERFACE_DOWNSTREAM) {
+			log_info("Downstream %s: %lu requests received, "
+				 "%lu dropped, %lu replies sent, %lu errors.",
+				 ip->name, rif->requests_received,
+				 rif->requests_dropped, rif->replies_sent,
+				 rif->reply_errors);
+		}
+		if (ip->flags & INTERFACE_UPSTREAM) {
+			log_info("Upstream %s: %lu replies received.",
+				 ip->name, rif->replies_received);
+		}
+	}
+}
+
+/*
+ * With many interfaces, scanning the interface list for every packet
+ * is expensive, so once the interfaces are known we build hash tables
+ * from our addresses and circuit IDs to the interfaces, and from each
+ * interface to its counters.  The relay never rediscovers interfaces,
+ * so the tables are built once.  Until then (and in the unit tests if
+ * they are never built) the lookups fall back to scanning the list.
+ */
+
+static unsigned
+relay_hash_bytes(const u_int8_t *buf, unsigned len) {
+	u_int32_t h = 5381;
+	unsigned i;
+
+	for (i = 0; i < len; i++)
+		h = (h * 33) ^ buf[i];
+	return (h & (relay_hash_size - 1));
+}
+
+static unsigned
+relay_hash_addr(struct in_addr addr) {
+	return (relay_hash_bytes((const u_int8_t *)&addr.s_addr,
+				 sizeof(addr.s_addr)));
+}
+
+static unsigned
+relay_hash_ifp(const struct interface_info *ifp) {
+	return (relay_hash_bytes((const u_int8_t *)&ifp, sizeof(ifp)));
+}
+
+void
+relay_index_interfaces(void) {
+	struct interface_info *ip;
+	struct relay_if *rif;
+	struct relay_addr *ra;
+	unsigned count = 0, h;
+	int i;
+
+	if (relay_hash_size != 0)
+		return;
+
+	for (ip = interfaces; ip; ip = ip->next)
+		count += 1 + ip->address_count;
+
+	/* Aim for chains of one or two entries. */
+	relay_hash_size = 64;
+	while (relay_hash_size < count)
+		relay_hash_size <<= 1;
+
+	relay_if_hash = dmalloc(relay_hash_size * sizeof(*relay_if_hash), MDL);
+	relay_circuit_hash = dmalloc(relay_hash_size *
+				     sizeof(*relay_circuit_hash), MDL);
+	relay_addr_hash = dmalloc(relay_hash_size *
+				  sizeof(*relay_addr_hash), MDL);
+	if (!relay_if_hash || !relay_circuit_hash || !relay_addr_hash)
+		log_fatal("No memory for interface hash tables.");
+
+	for (ip = interfaces; ip; ip = ip->next) {
+		rif = dmalloc(sizeof(*rif), MDL);
+		if (rif == NULL)
+			log_fatal("No memory for interface %s.", ip->name);
+		rif->ifp = ip;
+		h = relay_hash_ifp(ip);
+		rif->next = relay_if_hash[h];
+		relay_if_hash[h] = rif;
+
+		if (ip->circuit_id != NULL) {
+			h = relay_hash_bytes(ip->circuit_id,
+					     ip->circuit_id_len);
+			rif->circuit_next = relay_circuit_hash[h];
+			relay_circuit_hash[h] = rif;
+		}
+
+		for (i = 0; i < ip->address_count; i++) {
+			ra = dmalloc(sizeof(*ra), MDL);
+			if (ra == NULL)
+				log_fatal("No memory for interface %s.",
+					  ip->name);
+			ra->addr = ip->addresses[i];
+			ra->ifp = ip;
+			h = relay_hash_addr(ra->addr);
+			ra->next = relay_addr_hash[h];
+			relay_addr_hash[h] = ra;
+		}
+	}
+}
+
+/* Find the interface that has giaddr as one of its addresses. */
+struct interface_info *
+find_interface_by_giaddr(struct in_addr giaddr) {
+	struct interface_info *ip;
+	struct relay_addr *ra, *found = NULL;
+	int i;
+
+	if (relay_hash_size == 0) {
+		for (ip = interfaces; ip; ip = ip->next) {
+			for (i = 0 ; i < ip->address_count ; i++ ) {
+				if (ip->addresses[i].s_addr == giaddr.s_addr)
+					return (ip);
+			}
+		}
+		return (NULL);
+	}
+
+	/* Chains are in reverse order, so the last match is the one
+	   on the earliest interface in the list. */
+	for (ra = relay_addr_hash[relay_hash_addr(giaddr)]; ra; ra = ra->next) {
+		if (ra->addr.s_addr == giaddr.s_addr)
+			found = ra;
+	}
+	return (found ? found->ifp : NULL);
+}
+
+static struct relay_if *
+relay_if_lookup(struct interface_info *ifp) {
+	struct relay_if *rif;
+
+	if (relay_hash_size == 0 || ifp == NULL)
+		return (NULL);
+
+	for (rif = relay_if_hash[relay_hash_ifp(ifp)]; rif; rif = rif->next) {
+		if (rif->ifp == ifp)
+			return (rif);
+	}
+	return (NULL);
+}
+
 /* Strip any Relay Agent Information options from the DHCP packet
    option buffer.   If there is a circuit ID suboption, look up the
    outgoing interface based upon it. */
@@ -1181,14 +1402,32 @@ find_interface_by_agent_option(struct dhcp_packet *packet,
 		return (-1);
 	}
 
-	/* Scan the interface list looking for an interface whose
-	   name matches the one specified in circuit_id. */
-
-	for (ip = interfaces; ip; ip = ip->next) {
-		if (ip->circuit_id &&
-		    ip->circuit_id_len == circuit_id_len &&
-		    !memcmp(ip->circuit_id, circuit_id, circuit_id_len))
-			break;
+	/* Look for an interface whose name matches the one specified
+	   in circuit_id. */
+	ip = NULL;
+	if (relay_hash_size != 0) {
+		struct relay_if *rif, *found = NULL;
+
+		/* As with addresses, the last match in the chain is the
+		   earliest interface in the list. */
+		for (rif = relay_circuit_hash[relay_hash_bytes(circuit_id,
+							       circuit_id_len)];
+		     rif; rif = rif->circuit_next) {
+			if (rif->ifp->circuit_id_len == circuit_id_len &&
+			    !memcmp(rif->ifp->circuit_id, circuit_id,
+				    circuit_id_len))
+				found = rif;
+		}
+		if (found)
+			ip = found->ifp;
+	} else {
+		for (ip = interfaces; ip; ip = ip->next) {
+			if (ip->circuit_id &&
+			    ip->circuit_id_len == circuit_id_len &&
+			    !memcmp(ip->circuit_id, circuit_id,
+				    circuit_id_len))
+				break;
+		}
 	}
 
 	/* If we got a match, use it. */
@@ -1667,28 +1906,76 @@ setup_streams(void) {
 	}
 }
 
+#endif /* UNIT_TEST */
+
 /*
- * Add DHCPv6 agent options here.
+ * The relay's DHCPv6 fast path.  A Relay-Forward is written straight
+ * into a buffer that is kept for the purpose, and a Relay-Reply's
+ * options are found where they lie in the received packet, so neither
+ * direction builds an option state or allocates anything per packet.
  */
-static const int required_forw_opts[] = {
-	D6O_INTERFACE_ID,
-	D6O_SUBSCRIBER_ID,
-#if defined(RELAY_PORT)
-	D6O_RELAY_SOURCE_PORT,
-#endif
-	D6O_RELAY_MSG,
-	0
-};
+
+/* Append an option to a message being built in buf, which holds size
+   bytes and is filled up to *cursor.  Returns zero if it won't fit. */
+int
+relay6_put_option(unsigned char *buf, unsigned *cursor, unsigned size,
+		  unsigned code, const void *data, unsigned len) {
+	if (len > 0xffff || *cursor > size || size - *cursor < 4 + len)
+		return 0;
+	putUShort(buf + *cursor, code);
+	putUShort(buf + *cursor + 2, len);
+	memcpy(buf + *cursor + 4, data, len);
+	*cursor += 4 + len;
+	return 1;
+}
+
+/* Find the options the relay needs among a Relay-Reply's options.
+   Returns zero if an option runs past the end of the message. */
+int
+relay6_parse_repl(const unsigned char *opts, unsigned len,
+		  struct relay6_repl *repl) {
+	unsigned code, olen;
+
+	memset(repl, 0, sizeof(*repl));
+	while (len > 0) {
+		if (len < 4)
+			return 0;
+		code = getUShort(opts);
+		olen = getUShort(opts + 2);
+		if (len - 4 < olen)
+			return 0;
+		switch (code) {
+		      case D6O_RELAY_MSG:
+			repl->msg = opts + 4;
+			repl->msg_len = olen;
+			break;
+		      case D6O_INTERFACE_ID:
+			repl->if_id = opts + 4;
+			repl->if_id_len = olen;
+			break;
+		      case D6O_RELAY_SOURCE_PORT:
+			repl->port = opts + 4;
+			repl->port_len = olen;
+			break;
+		}
+		opts += 4 + olen;
+		len -= 4 + olen;
+	}
+	return 1;
+}
+
+#ifndef UNIT_TEST
+/* The Relay-Forward being built.  One message is sent to every
+   upstream, so one buffer serves them all. */
+static unsigned char forw_data[65535];
 
 /*
  * Process a packet upwards, i.e., from client to server.
  */
 static void
 process_up6(struct packet *packet, struct stream_list *dp) {
-	char forw_data[65535];
 	unsigned cursor;
 	struct dhcpv6_relay_packet *relay;
-	struct option_state *opts;
 	struct stream_list *up;
 	u_int16_t relay_client_port = 0;
 
@@ -1763,12 +2050,6 @@ process_up6(struct packet *packet, struct stream_list *dp) {
 	}
 	memcpy(&relay->peer_address, packet->client_addr.iabuf, 16);
 
-	/* Get an option state. */
-	opts = NULL;
-	if (!option_state_allocate(&opts, MDL)) {
-		log_fatal("No memory for upwards options.");
-	}
-
 	/* Add an interface-id (if used). */
 	if (use_if_id) {
 		int if_id;
@@ -1779,16 +2060,13 @@ process_up6(struct packet *packet, struct stream_list *dp) {
 			if_id = downstreams->id;
 		} else {
 			log_info("Don't know the interface.");
-			option_state_dereference(&opts, MDL);
 			return;
 		}
 
-		if (!save_option_buffer(&dhcpv6_universe, opts,
-					NULL, (unsigned char *) &if_id,
-					sizeof(int),
-					D6O_INTERFACE_ID, 0)) {
+		if (!relay6_put_option(forw_data, &cursor, sizeof(forw_data),
+				       D6O_INTERFACE_ID, &if_id,
+				       sizeof(int))) {
 			log_error("Can't save interface-id.");
-			option_state_dereference(&opts, MDL);
 			return;
 		}
 	}
@@ -1796,12 +2074,10 @@ process_up6(struct packet *packet, struct stream_list *dp) {
 	/* Add a subscriber-id if desired. */
 	/* This is for testing rather than general use */
 	if (dhcrelay_sub_id != NULL) {
-		if (!save_option_buffer(&dhcpv6_universe, opts, NULL,
-					(unsigned char *) dhcrelay_sub_id,
-					strlen(dhcrelay_sub_id),
-					D6O_SUBSCRIBER_ID, 0)) {
+		if (!relay6_put_option(forw_data, &cursor, sizeof(forw_data),
+				       D6O_SUBSCRIBER_ID, dhcrelay_sub_id,
+				       strlen(dhcrelay_sub_id))) {
 			log_error("Can't save subsriber-id.");
-			option_state_dereference(&opts, MDL);
 			return;
 		}
 	}
@@ -1817,12 +2093,11 @@ process_up6(struct packet *packet, struct stream_list *dp) {
 	 * with the correct UDP source port.
         */
 	if (relay_port || relay_client_port) {
-		if (!save_option_buffer(&dhcpv6_universe, opts, NULL,
-					(unsigned char *) &relay_client_port,
-					sizeof(u_int16_t),
-					D6O_RELAY_SOURCE_PORT, 0)) {
+		if (!relay6_put_option(forw_data, &cursor, sizeof(forw_data),
+				       D6O_RELAY_SOURCE_PORT,
+				       &relay_client_port,
+				       sizeof(u_int16_t))) {
 			log_error("Can't save relay-source-port.");
-			option_state_dereference(&opts, MDL);
 			return;
 		}
 	}
@@ -1831,27 +2106,18 @@ process_up6(struct packet *packet, struct stream_list *dp) {
 	(void)(relay_client_port);
 #endif
 
-	/* Add the relay-msg carrying the packet. */
-	if (!save_option_buffer(&dhcpv6_universe, opts,
-				NULL, (unsigned char *) packet->raw,
-				packet->packet_length,
-				D6O_RELAY_MSG, 0)) {
+	/* Add the relay-msg carrying the packet, which finishes the
+	   relay-forward message. */
+	if (!relay6_put_option(forw_data, &cursor, sizeof(forw_data),
+			       D6O_RELAY_MSG, packet->raw,
+			       packet->packet_length)) {
 		log_error("Can't save relay-msg.");
-		option_state_dereference(&opts, MDL);
 		return;
 	}
 
-	/* Finish the relay-forward message. */
-	cursor += store_options6(forw_data + cursor,
-				 sizeof(forw_data) - cursor,
-				 opts, packet,
-				 required_forw_opts, NULL);
-	option_state_dereference(&opts, MDL);
-
 	/* Send it to all upstreams. */
 	for (up = upstreams; up; up = up->next) {
-		send_packet6(up->ifp, (unsigned char *) forw_data,
-			     (size_t) cursor, &up->link);
+		send_packet6(up->ifp, forw_data, (size_t) cursor, &up->link);
 	}
 }
 
@@ -1861,13 +2127,9 @@ process_up6(struct packet *packet, struct stream_list *dp) {
 static void
 process_down6(struct packet *packet) {
 	struct stream_list *dp;
-	struct option_cache *oc;
-	struct data_string relay_msg;
+	struct relay6_repl repl;
+	const struct dhcpv6_relay_packet *relay;
 	const struct dhcpv6_packet *msg;
-	struct data_string if_id;
-#if defined(RELAY_PORT)
-	struct data_string down_port;
-#endif
 	struct sockaddr_in6 to;
 	struct iaddr peer;
 
@@ -1887,11 +2149,6 @@ process_down6(struct packet *packet) {
 	}
 
 	/* Inits. */
-	memset(&relay_msg, 0, sizeof(relay_msg));
-	memset(&if_id, 0, sizeof(if_id));
-#if defined(RELAY_PORT)
-	memset(&down_port, 0, sizeof(down_port));
-#endif
 	memset(&to, 0, sizeof(to));
 	to.sin6_family = AF_INET6;
 #ifdef HAVE_SA_LEN
@@ -1900,35 +2157,35 @@ process_down6(struct packet *packet) {
 	to.sin6_port = remote_port;
 	peer.len = 16;
 
+	/* Find the options in the packet. */
+	relay = (const struct dhcpv6_relay_packet *) packet->raw;
+	if (!relay6_parse_repl(relay->options, packet->packet_length -
+			       offsetof(struct dhcpv6_relay_packet, options),
+			       &repl)) {
+		log_info("Malformed relay-reply.");
+		return;
+	}
+
 	/* Get the relay-msg option (carrying the message to relay). */
-	oc = lookup_option(&dhcpv6_universe, packet->options, D6O_RELAY_MSG);
-	if (oc == NULL) {
+	if (repl.msg == NULL) {
 		log_info("No relay-msg.");
 		return;
 	}
-	if (!evaluate_option_cache(&relay_msg, packet, NULL, NULL,
-				   packet->options, NULL,
-				   &global_scope, oc, MDL) ||
-	    (relay_msg.len < offsetof(struct dhcpv6_packet, options))) {
+	if (repl.msg_len < offsetof(struct dhcpv6_packet, options)) {
 		log_error("Can't evaluate relay-msg.");
-		goto cleanup;
+		return;
 	}
-	msg = (const struct dhcpv6_packet *) relay_msg.data;
+	msg = (const struct dhcpv6_packet *) repl.msg;
 
 	/* Get the interface-id (if exists) and the downstream. */
-	oc = lookup_option(&dhcpv6_universe, packet->options,
-			   D6O_INTERFACE_ID);
-	if (oc != NULL) {
+	if (repl.if_id != NULL) {
 		int if_index;
 
-		if (!evaluate_option_cache(&if_id, packet, NULL, NULL,
-					   packet->options, NULL,
-					   &global_scope, oc, MDL) ||
-		    (if_id.len != sizeof(int))) {
+		if (repl.if_id_len != sizeof(int)) {
 			log_info("Can't evaluate interface-id.");
-			goto cleanup;
+			return;
 		}
-		memcpy(&if_index, if_id.data, sizeof(int));
+		memcpy(&if_index, repl.if_id, sizeof(int));
 		for (dp = downstreams; dp; dp = dp->next) {
 			if (dp->id == if_index)
 				break;
@@ -1937,7 +2194,7 @@ process_down6(struct packet *packet) {
 		if (use_if_id) {
 			/* Require an interface-id. */
 			log_info("No interface-id.");
-			goto cleanup;
+			return;
 		}
 		for (dp = downstreams; dp; dp = dp->next) {
 			/* Get the first matching one. */
@@ -1952,7 +2209,7 @@ process_down6(struct packet *packet) {
 		dp = downstreams;
 	if (!dp) {
 		log_info("Can't find the down interface.");
-		goto cleanup;
+		return;
 	}
 	memcpy(peer.iabuf, &packet->dhcpv6_peer_address, peer.len);
 	to.sin6_addr = packet->dhcpv6_peer_address;
@@ -1964,21 +2221,15 @@ process_down6(struct packet *packet) {
 		to.sin6_port = local_port;
 
 #if defined(RELAY_PORT)
-		oc = lookup_option(&dhcpv6_universe, packet->options,
-				   D6O_RELAY_SOURCE_PORT);
-		if (oc != NULL) {
+		if (repl.port != NULL) {
 			u_int16_t down_relay_port;
 
-			memset(&down_port, 0, sizeof(down_port));
-			if (!evaluate_option_cache(&down_port, packet, NULL,
-						   NULL, packet->options, NULL,
-						   &global_scope, oc, MDL) ||
-			    (down_port.len != sizeof(u_int16_t))) {
+			if (repl.port_len != sizeof(u_int16_t)) {
 				log_info("Can't evaluate down "
 					 "relay-source-port.");
-				goto cleanup;
+				return;
 			}
-			memcpy(&down_relay_port, down_port.data,
+			memcpy(&down_relay_port, repl.port,
 			       sizeof(u_int16_t));
 			/*
 			 * If the down_relay_port value is non-zero,
@@ -2021,25 +2272,59 @@ process_down6(struct packet *packet) {
 			 dhcpv6_type_names[msg->msg_type],
 			 piaddr(peer),
 			 ntohs(to.sin6_port));
-		goto cleanup;
+		return;
 
 	      default:
 		log_info("Unknown %d type to %s port %d down.",
 			 msg->msg_type,
 			 piaddr(peer),
 			 ntohs(to.sin6_port));
-		goto cleanup;
+		return;
 	}
 
 	/* Send the message to the downstream. */
-	send_packet6(dp->ifp, (unsigned char *) relay_msg.data,
-		     (size_t) relay_msg.len, &to);
-
-      cleanup:
-	if (relay_msg.data != NULL)
-		data_string_forget(&relay_msg, MDL);
-	if (if_id.data != NULL)
-		data_string_forget(&if_id, MDL);
+	send_packet6(dp->ifp, repl.msg, (size_t) repl.msg_len, &to);
+}
+
+/*
+ * Called by the dispatch code with each DHCPv6 packet received.  This
+ * is do_packet6() without the option parsing, which the relay does for
+ * itself where it needs to, so the packet is set up on the stack.
+ */
+static void
+relay6_packet(struct interface_info *ifp, const char *buf, int len,
+	      int from_port, const struct iaddr *from,
+	      isc_boolean_t was_unicast) {
+	struct packet packet;
+	const struct dhcpv6_relay_packet *relay;
+
+	if (!packet6_len_okay(buf, len)) {
+		log_info("relay6_packet: "
+			 "short packet from %s port %d, len %d, dropped",
+			 piaddr(*from), from_port, len);
+		return;
+	}
+
+	memset(&packet, 0, sizeof(packet));
+	packet.raw = (struct dhcp_packet *)buf;
+	packet.packet_length = (unsigned)len;
+	packet.client_port = from_port;
+	packet.client_addr = *from;
+	packet.interface = ifp;
+	packet.unicast = was_unicast;
+	packet.dhcpv6_msg_type = (unsigned char)buf[0];
+
+	if ((packet.dhcpv6_msg_type == DHCPV6_RELAY_FORW) ||
+	    (packet.dhcpv6_msg_type == DHCPV6_RELAY_REPL)) {
+		relay = (const struct dhcpv6_relay_packet *)buf;
+		packet.dhcpv6_hop_count = relay->hop_count;
+		memcpy(&packet.dhcpv6_link_address,
+		       relay->link_address, sizeof(relay->link_address));
+		memcpy(&packet.dhcpv6_peer_address,
+		       relay->peer_address, sizeof(relay->peer_address));
+	}
+
+	dhcpv6(&packet);
 }
 #endif /* UNIT_TEST */
 
@@ -2124,6 +2409,9 @@ dhcp_set_control_state(control_object_state_t oldstate,
 	/* Log shutdown on signal. */
 	log_info("Received signal %d, initiating shutdown.", shutdown_signal);
 
+	if (local_family == AF_INET)
+		relay_log_stats();
+
 	if (no_pid_file == ISC_FALSE)
 		(void) unlink(path_dhcrelay_pid);
 
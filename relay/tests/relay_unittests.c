@@ -25,6 +25,7 @@
 #include <atf-c.h>
 #include <omapip/omapip_p.h>
 #include "dhcpd.h"
+#include "dhcrelay.h"
 
 /* @brief Externs for dhcrelay.c functions under test */
 extern int add_agent_options;
@@ -40,6 +41,9 @@ extern int strip_relay_agent_options(struct interface_info *,
                                      struct interface_info **,
                                      struct dhcp_packet *, unsigned);
 
+extern void relay_index_interfaces(void);
+extern struct interface_info *find_interface_by_giaddr(struct in_addr);
+
 /* @brief Add the given option data to a DHCPv4 packet
 *
 * It first fills the packet.options buffer with the given pad character.
@@ -422,10 +426,163 @@ ATF_TC_BODY(gwaddr_override_test, tc) {
     }
 }
 
+ATF_TC(interface_index_test);
+
+ATF_TC_HEAD(interface_index_test, tc) {
+    atf_tc_set_md_var(tc, "descr", "tests interface lookups by giaddr and circuit ID");
+}
+
+/* Looks up interfaces by address and circuit ID, first by scanning the
+ * interface list and then through the hash tables, and checks that
+ * both give the same answers. */
+ATF_TC_BODY(interface_index_test, tc) {
+    struct interface_info ifaces[3];
+    struct in_addr addrs[3][2];
+    struct interface_info *out;
+    struct in_addr giaddr;
+    struct dhcp_packet packet;
+    unsigned char agent[] = { RAI_CIRCUIT_ID, 4, 'e', 't', 'h', '1' };
+    unsigned char bogus[] = { RAI_CIRCUIT_ID, 4, 'e', 't', 'h', '9' };
+    int i, pass;
+
+    memset(ifaces, 0, sizeof(ifaces));
+    for (i = 0; i < 3; i++) {
+        snprintf(ifaces[i].name, sizeof(ifaces[i].name), "eth%d", i);
+        ifaces[i].circuit_id = (u_int8_t *)ifaces[i].name;
+        ifaces[i].circuit_id_len = strlen(ifaces[i].name);
+        addrs[i][0].s_addr = htonl(0xc0000201 + i);   /* 192.0.2.1+i */
+        addrs[i][1].s_addr = htonl(0xc6336401 + i);   /* 198.51.100.1+i */
+        ifaces[i].addresses = addrs[i];
+        ifaces[i].address_count = 2;
+        ifaces[i].next = (i < 2) ? &ifaces[i + 1] : NULL;
+    }
+
+    /* eth2 shares an address with eth0; eth0 comes first in the list,
+     * so it should win. */
+    addrs[2][1] = addrs[0][0];
+    interfaces = &ifaces[0];
+
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            relay_index_interfaces();
+        }
+
+        giaddr.s_addr = htonl(0xc6336402);
+        if (find_interface_by_giaddr(giaddr) != &ifaces[1]) {
+            atf_tc_fail("pass %d: wrong interface for 198.51.100.2", pass);
+        }
+
+        giaddr = addrs[0][0];
+        if (find_interface_by_giaddr(giaddr) != &ifaces[0]) {
+            atf_tc_fail("pass %d: shared address not on first interface",
+                        pass);
+        }
+
+        giaddr.s_addr = htonl(0xcb007101);
+        if (find_interface_by_giaddr(giaddr) != NULL) {
+            atf_tc_fail("pass %d: found interface for unknown giaddr",
+                        pass);
+        }
+
+        out = NULL;
+        memset(&packet, 0, sizeof(packet));
+        if (find_interface_by_agent_option(&packet, &out, agent,
+                                           sizeof(agent)) != 1 ||
+            out != &ifaces[1]) {
+            atf_tc_fail("pass %d: circuit ID eth1 not found", pass);
+        }
+
+        out = NULL;
+        if (find_interface_by_agent_option(&packet, &out, bogus,
+                                           sizeof(bogus)) != -1 ||
+            out != NULL) {
+            atf_tc_fail("pass %d: bogus circuit ID found", pass);
+        }
+    }
+
+    interfaces = NULL;
+}
+
+#ifdef DHCPv6
+ATF_TC(relay6_options_test);
+
+ATF_TC_HEAD(relay6_options_test, tc) {
+    atf_tc_set_md_var(tc, "descr", "tests DHCPv6 relay option encoding "
+                      "and decoding");
+}
+
+ATF_TC_BODY(relay6_options_test, tc) {
+    unsigned char buf[64];
+    unsigned char msg[] = { DHCPV6_REPLY, 1, 2, 3, 0, 14, 0, 0 };
+    unsigned char bogus[] = { 0, D6O_RELAY_MSG, 0, 9, 1, 2, 3 };
+    int if_index = 7;
+    u_int16_t port = htons(547);
+    struct relay6_repl repl;
+    unsigned cursor = 0;
+
+    if (!relay6_put_option(buf, &cursor, sizeof(buf), D6O_INTERFACE_ID,
+                           &if_index, sizeof(if_index)) ||
+        !relay6_put_option(buf, &cursor, sizeof(buf), D6O_PREFERENCE,
+                           "x", 1) ||
+        !relay6_put_option(buf, &cursor, sizeof(buf), D6O_RELAY_SOURCE_PORT,
+                           &port, sizeof(port)) ||
+        !relay6_put_option(buf, &cursor, sizeof(buf), D6O_RELAY_MSG,
+                           msg, sizeof(msg))) {
+        atf_tc_fail("can't encode options");
+    }
+    if (cursor != 4 * 4 + sizeof(if_index) + 1 + sizeof(port) +
+                  sizeof(msg)) {
+        atf_tc_fail("wrong encoded length %u", cursor);
+    }
+
+    if (!relay6_parse_repl(buf, cursor, &repl)) {
+        atf_tc_fail("can't decode options");
+    }
+    if (repl.msg != buf + cursor - sizeof(msg) ||
+        repl.msg_len != sizeof(msg) ||
+        memcmp(repl.msg, msg, sizeof(msg)) != 0) {
+        atf_tc_fail("wrong relay-msg");
+    }
+    if (repl.if_id_len != sizeof(if_index) ||
+        memcmp(repl.if_id, &if_index, sizeof(if_index)) != 0) {
+        atf_tc_fail("wrong interface-id");
+    }
+    if (repl.port_len != sizeof(port) ||
+        memcmp(repl.port, &port, sizeof(port)) != 0) {
+        atf_tc_fail("wrong relay-source-port");
+    }
+
+    /* An option with no room left is refused and the cursor kept. */
+    if (relay6_put_option(buf, &cursor, sizeof(buf), D6O_RELAY_MSG,
+                          buf, sizeof(buf)) ||
+        cursor != 4 * 4 + sizeof(if_index) + 1 + sizeof(port) +
+                  sizeof(msg)) {
+        atf_tc_fail("oversized option accepted");
+    }
+
+    /* Options that run off the end are rejected. */
+    if (relay6_parse_repl(bogus, sizeof(bogus), &repl) ||
+        relay6_parse_repl(buf, cursor - 1, &repl) ||
+        relay6_parse_repl(buf, 3, &repl)) {
+        atf_tc_fail("truncated options accepted");
+    }
+
+    /* No options at all is fine, and finds nothing. */
+    if (!relay6_parse_repl(buf, 0, &repl) || repl.msg != NULL ||
+        repl.if_id != NULL || repl.port != NULL) {
+        atf_tc_fail("empty options mishandled");
+    }
+}
+#endif
+
 ATF_TP_ADD_TCS(tp) {
     ATF_TP_ADD_TC(tp, strip_relay_agent_options_test);
     ATF_TP_ADD_TC(tp, add_relay_agent_options_test);
     ATF_TP_ADD_TC(tp, gwaddr_override_test);
+    ATF_TP_ADD_TC(tp, interface_index_test);
+#ifdef DHCPv6
+    ATF_TP_ADD_TC(tp, relay6_options_test);
+#endif
 
     return (atf_no_error());
 }
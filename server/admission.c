@@ -0,0 +1,382 @@
+/* admission.c
+
+   Admission control in front of the packet handlers. */
+
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/*
+ * Every packet the server reads is handled in the order it came, so when
+ * a whole network of clients restarts at once the retransmissions of
+ * clients that have just started crowd out the requests of clients that
+ * are one packet away from having a lease.  Admission control decides,
+ * before a packet is decoded, whether to handle it at all:
+ *
+ * - Each client, known by its hardware address or DUID, has a token
+ *   bucket filled at admission-client-rate packets a minute and holding
+ *   up to admission-client-burst.  A client that sends faster than that
+ *   has the extra packets dropped.  The buckets are kept in a table of
+ *   admission-clients entries made at startup, four to a set, and a
+ *   client not in the table replaces the one in its set that was heard
+ *   from longest ago.
+ *
+ * - The server has a bucket filled at admission-rate packets a second,
+ *   holding a second's worth.  Packets that start an exchange (DHCPDISCOVER,
+ *   BOOTP and SOLICIT) are only let in while the bucket is at least half
+ *   full, so as the server falls behind they are dropped first, and the
+ *   rest of its capacity goes to packets that finish or keep a lease.
+ *
+ * Nothing is allocated per packet.  Tokens are counted in thousandths of
+ * a packet and time in milliseconds, taken from cur_tv.
+ */
+
+#include "dhcpd.h"
+
+/* The hash of a client's entry is its key, and the stamp is when it was
+   last heard from. */
+struct admission_client {
+	struct set_way way;
+	u_int32_t tokens;
+};
+
+u_int32_t admission_rate = 0;
+u_int32_t admission_client_rate = 0;
+u_int32_t admission_client_burst = DEFAULT_ADMISSION_CLIENT_BURST;
+u_int32_t admission_clients = DEFAULT_ADMISSION_CLIENTS;
+struct admission_stats admission_stats;
+
+static struct admission_client *client_table;
+static u_int32_t client_set_mask;
+static u_int32_t server_tokens;
+static u_int32_t server_seen;
+static int server_started;
+
+static bootp_handler_t admission_handler;
+#ifdef DHCPv6
+static dhcpv6_handler_t admission_handler6;
+#endif
+
+/* The key for a client identity: a hash that is never zero. */
+u_int32_t
+admission_key(const unsigned char *id, unsigned len) {
+	u_int32_t hash = 2166136261U;
+
+	while (len-- > 0) {
+		hash ^= *id++;
+		hash *= 16777619U;
+	}
+	return (hash != 0 ? hash : 1);
+}
+
+static int
+set_way_live(const struct set_way *way, u_int32_t now, u_int32_t lifetime) {
+	return (way->hash != 0 &&
+		(lifetime == 0 || (u_int32_t)(now - way->stamp) < lifetime));
+}
+
+/*
+ * \brief Look up an entry in a set of a set-associative table
+ *
+ * Each entry starts with a struct set_way, and is in use if its hash is
+ * nonzero and it was used less than lifetime milliseconds ago.  If no
+ * entry in use has the hash, a free entry is given, or failing that the
+ * one used longest ago, for the caller to fill in.
+ *
+ * \param set the first of the set's SET_WAYS entries
+ * \param size the size of an entry
+ * \param hash the hash of what is looked up, which mustn't be 0
+ * \param now the time, in milliseconds
+ * \param lifetime how long an entry lasts unused, or 0 for ever
+ * \param same if not NULL, called with arg for an entry with the hash,
+ *             and returns nonzero if it is the one looked up
+ * \param way set to the entry found or to be filled in
+ * \return SET_FOUND, SET_FREE or SET_EVICTED
+ */
+int
+set_assoc_find(void *set, size_t size, u_int32_t hash, u_int32_t now,
+	       u_int32_t lifetime,
+	       int (*same)(const struct set_way *, const void *),
+	       const void *arg, struct set_way **way) {
+	struct set_way *w, *victim = NULL;
+	int i;
+
+	for (i = 0; i < SET_WAYS; i++) {
+		w = (struct set_way *)((char *)set + i * size);
+		if (!set_way_live(w, now, lifetime)) {
+			if (victim == NULL ||
+			    set_way_live(victim, now, lifetime))
+				victim = w;
+			continue;
+		}
+		if (w->hash == hash && (same == NULL || (*same)(w, arg))) {
+			*way = w;
+			return (SET_FOUND);
+		}
+		if (victim == NULL ||
+		    (set_way_live(victim, now, lifetime) &&
+		     (u_int32_t)(now - w->stamp) >
+		     (u_int32_t)(now - victim->stamp)))
+			victim = w;
+	}
+
+	*way = victim;
+	return (set_way_live(victim, now, lifetime) ?
+		SET_EVICTED : SET_FREE);
+}
+
+/* Add the tokens earned since last to a bucket filled at rate thousandths
+   of a packet every per milliseconds, up to limit. */
+static u_int32_t
+admission_fill(u_int32_t tokens, u_int32_t last, u_int32_t now,
+	       u_int32_t rate, u_int32_t per, u_int32_t limit) {
+	u_int64_t more;
+
+	more = (u_int64_t)(u_int32_t)(now - last) * rate / per;
+	if (more >= limit || tokens >= limit - more)
+		return (limit);
+	return (tokens + (u_int32_t)more);
+}
+
+/* The client's bucket, found or made in the table. */
+static struct admission_client *
+admission_find(u_int32_t key, u_int32_t now) {
+	struct admission_client *client;
+	struct set_way *way;
+
+	client = &client_table[(key & client_set_mask) * SET_WAYS];
+	switch (set_assoc_find(client, sizeof(*client), key, now, 0,
+			       NULL, NULL, &way)) {
+	      case SET_FOUND:
+		return ((struct admission_client *)way);
+	      case SET_EVICTED:
+		admission_stats.evicted++;
+		break;
+	}
+
+	client = (struct admission_client *)way;
+	client->way.hash = key;
+	client->way.stamp = now;
+	client->tokens = admission_client_burst * 1000;
+	return (client);
+}
+
+/*
+ * \brief Decide whether to handle a packet
+ *
+ * \param key the client's key from admission_key(), or 0 if it has none
+ * \param urgent nonzero unless the packet starts an exchange
+ * \return 1 to handle the packet, 0 to drop it
+ */
+int
+admission_admit(u_int32_t key, int urgent) {
+	struct admission_client *client = NULL;
+	u_int32_t now = cur_ms;
+	u_int32_t limit;
+
+	urgent = urgent ? 1 : 0;
+
+	if (client_table != NULL && key != 0) {
+		client = admission_find(key, now);
+		/* Packets a minute are thousandths of a packet every sixty
+		   milliseconds. */
+		client->tokens = admission_fill(client->tokens,
+						client->way.stamp, now,
+						admission_client_rate, 60,
+						admission_client_burst * 1000);
+		client->way.stamp = now;
+		if (client->tokens < 1000) {
+			admission_stats.client_dropped[urgent]++;
+			return (0);
+		}
+	}
+
+	if (admission_rate != 0) {
+		limit = admission_rate * 1000;
+		if (!server_started) {
+			server_started = 1;
+			server_tokens = limit;
+		} else
+			server_tokens = admission_fill(server_tokens,
+						       server_seen, now,
+						       admission_rate, 1, limit);
+		server_seen = now;
+		if (server_tokens < 1000 ||
+		    (!urgent && server_tokens < limit / 2)) {
+			admission_stats.overload_dropped[urgent]++;
+			return (0);
+		}
+		server_tokens -= 1000;
+	}
+
+	if (client != NULL)
+		client->tokens -= 1000;
+	admission_stats.admitted[urgent]++;
+	return (1);
+}
+
+/* Whether a DHCPv4 packet is urgent, and its client's key. */
+int
+admission_classify(const struct dhcp_packet *raw, unsigned len,
+		   u_int32_t *key) {
+	int type;
+
+	*key = 0;
+	if (len < DHCP_FIXED_NON_UDP)
+		return (1);
+	if (raw->hlen > 0 && raw->hlen <= sizeof(raw->chaddr)) {
+		unsigned char id[1 + sizeof(raw->chaddr)];
+
+		id[0] = raw->htype;
+		memcpy(id + 1, raw->chaddr, raw->hlen);
+		*key = admission_key(id, 1 + raw->hlen);
+	}
+	type = replay_message_type(raw, len);
+	return (type != 0 && type != DHCPDISCOVER);
+}
+
+#ifdef DHCPv6
+/* Whether a DHCPv6 packet is urgent, and its client's key.  A relayed
+   message is judged by the client's message inside it. */
+int
+admission_classify6(const unsigned char *buf, unsigned len,
+		    u_int32_t *key) {
+	const unsigned msg_hdr = offsetof(struct dhcpv6_packet, options);
+	const unsigned char *duid;
+	unsigned dlen;
+
+	*key = 0;
+	buf = packet6_client_msg(buf, len, &len, NULL);
+	if (buf == NULL)
+		return (1);
+
+	duid = packet6_find_option(buf + msg_hdr, len - msg_hdr, D6O_CLIENTID,
+				   &dlen);
+	if (duid != NULL && dlen > 0)
+		*key = admission_key(duid, dlen);
+	return (buf[0] != DHCPV6_SOLICIT);
+}
+#endif /* DHCPv6 */
+
+static void
+admission_packet(struct interface_info *ip, struct dhcp_packet *raw,
+		 unsigned len, unsigned int from_port, struct iaddr from,
+		 struct hardware *hfrom)
+{
+	u_int32_t key;
+	int urgent;
+
+	urgent = admission_classify(raw, len, &key);
+	if (!admission_admit(key, urgent))
+		return;
+	(*admission_handler)(ip, raw, len, from_port, from, hfrom);
+}
+
+#ifdef DHCPv6
+static void
+admission_packet6(struct interface_info *ip, const char *buf, int len,
+		  int from_port, const struct iaddr *from,
+		  isc_boolean_t was_unicast)
+{
+	u_int32_t key;
+	int urgent;
+
+	if (len <= 0)
+		return;
+	urgent = admission_classify6((const unsigned char *)buf,
+				     (unsigned)len, &key);
+	if (!admission_admit(key, urgent))
+		return;
+	(*admission_handler6)(ip, buf, len, from_port, from, was_unicast);
+}
+#endif /* DHCPv6 */
+
+/* Make the client table.  Returns zero if there is nothing to do. */
+int
+admission_init(void) {
+	u_int32_t sets;
+
+	if (client_table != NULL) {
+		dfree(client_table, MDL);
+		client_table = NULL;
+	}
+	memset(&admission_stats, 0, sizeof(admission_stats));
+	server_started = 0;
+	if (admission_rate > 4000000)
+		admission_rate = 4000000;
+	if (admission_client_burst > 4000000)
+		admission_client_burst = 4000000;
+
+	if (admission_client_rate != 0) {
+		if (admission_client_burst == 0)
+			admission_client_burst = 1;
+		for (sets = 1; sets * 2 * SET_WAYS <= admission_clients;
+		     sets *= 2)
+			;
+		client_table = dmalloc(sets * SET_WAYS *
+				       sizeof(*client_table), MDL);
+		if (client_table == NULL)
+			log_fatal("No memory for %u admission control clients.",
+				  sets * SET_WAYS);
+		client_set_mask = sets - 1;
+	}
+	return (admission_rate != 0 || admission_client_rate != 0);
+}
+
+/* Put admission control in front of the packet handlers, if configured. */
+void
+admission_setup(void) {
+	if (!admission_init())
+		return;
+
+	push_packet_handler(&admission_handler, admission_packet);
+#ifdef DHCPv6
+	push_packet_handler6(&admission_handler6, admission_packet6);
+#endif
+	log_info("Admission control: %u packets/s, %u per client a minute "
+		 "(burst %u, %u clients)", admission_rate,
+		 admission_client_rate, admission_client_burst,
+		 client_table != NULL ?
+		 (client_set_mask + 1) * SET_WAYS : 0);
+}
+
+/* Summarize what admission control let in and kept out. */
+void
+admission_log_stats(void) {
+	const struct admission_stats *s = &admission_stats;
+
+	if (s->admitted[0] + s->admitted[1] + s->client_dropped[0] +
+	    s->client_dropped[1] + s->overload_dropped[0] +
+	    s->overload_dropped[1] == 0)
+		return;
+
+	log_info("Admission: %llu urgent and %llu new packets admitted, "
+		 "%llu and %llu dropped by client limit, %llu and %llu "
+		 "dropped by overload, %llu clients evicted",
+		 (unsigned long long)s->admitted[1],
+		 (unsigned long long)s->admitted[0],
+		 (unsigned long long)s->client_dropped[1],
+		 (unsigned long long)s->client_dropped[0],
+		 (unsigned long long)s->overload_dropped[1],
+		 (unsigned long long)s->overload_dropped[0],
+		 (unsigned long long)s->evicted);
+}
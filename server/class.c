@@ -27,6 +27,7 @@
  */
 
 #include "dhcpd.h"
+#include <sys/time.h>
 
 struct executable_statement *default_classification_rules;
 
@@ -55,8 +56,14 @@ void classification_setup ()
 void classify_client (packet)
 	struct packet *packet;
 {
+	struct timeval start;
+
+	PROBE_PACKET(CLASSIFY_START, packet);
+	METRICS_START(start);
 	execute_statements (NULL, packet, NULL, NULL, packet->options, NULL,
 			    &global_scope, default_classification_rules, NULL);
+	METRICS_STOP(METRICS_CLASSIFY, start);
+	PROBE_PACKET(CLASSIFY_DONE, packet);
 }
 
 int check_collection (packet, lease, collection)
@@ -144,44 +151,10 @@ int check_collection (packet, lease, collection)
 				log_info ("spawning subclass %s.",
 				      print_hex_1 (data.len, data.data, 60));
 #endif
-				status = class_allocate (&nc, MDL);
-				group_reference (&nc -> group,
-						 class -> group, MDL);
-				class_reference (&nc -> superclass,
-						 class, MDL);
-				nc -> lease_limit = class -> lease_limit;
-				nc -> dirty = 1;
-				if (nc -> lease_limit) {
-					nc -> billed_leases =
-						(dmalloc
-						 (nc -> lease_limit *
-						  sizeof (struct lease *),
-						  MDL));
-					if (!nc -> billed_leases) {
-						log_error ("no memory for%s",
-							   " billing");
-						data_string_forget
-							(&nc -> hash_string,
-							 MDL);
-						class_dereference (&nc, MDL);
-						data_string_forget (&data,
-								    MDL);
-						continue;
-					}
-					memset (nc -> billed_leases, 0,
-						(nc -> lease_limit *
-						 sizeof (struct lease *)));
+				if (!spawn_subclass (&nc, class, &data)) {
+					data_string_forget (&data, MDL);
+					continue;
 				}
-				data_string_copy (&nc -> hash_string, &data,
-						  MDL);
-				if (!class -> hash)
-				    class_new_hash(&class->hash,
-						   SCLASS_HASH_SIZE, MDL);
-				class_hash_add (class -> hash,
-						(const char *)
-						nc -> hash_string.data,
-						nc -> hash_string.len,
-						nc, MDL);
 				classify (packet, nc);
 				class_dereference (&nc, MDL);
 			}
@@ -192,6 +165,44 @@ int check_collection (packet, lease, collection)
 	return matched;
 }
 
+/* Create a subclass of a spawning class for the given submatch value and
+   add it to the class's subclass hash. */
+
+int spawn_subclass (ncp, class, data)
+	struct class **ncp;
+	struct class *class;
+	struct data_string *data;
+{
+	struct class *nc = (struct class *)0;
+
+	if (class_allocate (&nc, MDL) != ISC_R_SUCCESS)
+		return 0;
+	group_reference (&nc -> group, class -> group, MDL);
+	class_reference (&nc -> superclass, class, MDL);
+	nc -> lease_limit = class -> lease_limit;
+	nc -> dirty = 1;
+	if (nc -> lease_limit) {
+		nc -> billed_leases =
+			(dmalloc (nc -> lease_limit * sizeof (struct lease *),
+				  MDL));
+		if (!nc -> billed_leases) {
+			log_error ("no memory for%s", " billing");
+			class_dereference (&nc, MDL);
+			return 0;
+		}
+		memset (nc -> billed_leases, 0,
+			(nc -> lease_limit * sizeof (struct lease *)));
+	}
+	data_string_copy (&nc -> hash_string, data, MDL);
+	if (!class -> hash)
+		class_new_hash(&class->hash, SCLASS_HASH_SIZE, MDL);
+	class_hash_add (class -> hash, (const char *)nc -> hash_string.data,
+			nc -> hash_string.len, nc, MDL);
+	class_reference (ncp, nc, MDL);
+	class_dereference (&nc, MDL);
+	return 1;
+}
+
 void classify (packet, class)
 	struct packet *packet;
 	struct class *class;
@@ -70,10 +70,15 @@ isc_result_t readconf ()
 	if (res != ISC_R_SUCCESS)
 		return (res);
 
-	return ldap_read_config ();
-#else
-	return (res);
+	res = ldap_read_config ();
+#endif
+#if defined (LAZY_RANGES)
+	/* An address declared in two ranges is only found once they have
+	   all been read. */
+	if (res == ISC_R_SUCCESS)
+		res = check_lease_ranges ();
 #endif
+	return (res);
 }
 
 isc_result_t read_conf_file (const char *filename, struct group *group,
@@ -134,6 +139,17 @@ isc_result_t read_conf_file (const char *filename, struct group *group,
 
 	cfile = (struct parse *)0;
 #if defined (TRACING)
+	/* The contents only have to be copied into a buffer of our own
+	   if they are going into the trace file; otherwise parse them
+	   straight out of a mapping of the file. */
+	if (!trace_record ()) {
+		dbuf = (char *)0;
+		status = new_parse(&cfile, file, NULL, 0, filename, 0);
+		if (cfile == NULL)
+			close (file);
+		goto parse;
+	}
+
 	flen = lseek (file, (off_t)0, SEEK_END);
 	if (flen < 0) {
 	      boom:
@@ -173,6 +189,9 @@ isc_result_t read_conf_file (const char *filename, struct group *group,
 	status = new_parse(&cfile, -1, fbuf, ulen, filename, 0); /* XXX */
 #else
 	status = new_parse(&cfile, file, NULL, 0, filename, 0);
+#endif
+#if defined (TRACING)
+      parse:
 #endif
 	if (status != ISC_R_SUCCESS || cfile == NULL)
 		return status;
@@ -183,7 +202,8 @@ isc_result_t read_conf_file (const char *filename, struct group *group,
 		status = conf_file_subparse (cfile, group, group_type);
 	end_parse (&cfile);
 #if defined (TRACING)
-	dfree (dbuf, MDL);
+	if (dbuf)
+		dfree (dbuf, MDL);
 #endif
 	return status;
 }
@@ -1733,6 +1753,7 @@ void parse_pool_statement (cfile, group, type)
 	int declaration = 0;
 	isc_result_t status;
 	struct lease *lpchain = NULL, *lp;
+	int has_ranges;
 
 	pool = NULL;
 	status = pool_allocate(&pool, MDL);
@@ -1860,6 +1881,9 @@ void parse_pool_statement (cfile, group, type)
 		}
 	} while (!done);
 
+	/* The addresses of its ranges may not have leases yet. */
+	has_ranges = pool->ranges != NULL;
+
 	/* See if there's already a pool into which we can merge this one. */
 	for (pp = pool->shared_network->pools; pp; pp = pp->next) {
 		if (pp->group->statements != pool->group->statements)
@@ -1884,6 +1908,7 @@ void parse_pool_statement (cfile, group, type)
 			pool_dereference(&lp->pool, MDL);
 			pool_reference(&lp->pool, pp, MDL);
 		}
+		move_lease_ranges(pool, pp);
 
 #if defined (BINARY_LEASES)
 		/* If we are doing binary leases we also need to add the
@@ -1906,7 +1931,7 @@ void parse_pool_statement (cfile, group, type)
 
 	/* Don't allow a pool declaration with no addresses, since it is
 	   probably a configuration error. */
-	if (!lpchain) {
+	if (!lpchain && !has_ranges) {
 		parse_warn(cfile, "Pool declaration with no address range.");
 		log_error("Pool declarations must always contain at least");
 		log_error("one range statement.");
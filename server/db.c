@@ -29,6 +29,7 @@
 #include "dhcpd.h"
 #include <ctype.h>
 #include <errno.h>
+#include <sys/time.h>
 
 #define LEASE_REWRITE_PERIOD 3600
 
@@ -39,6 +40,8 @@ FILE *db_file;
 
 static int counting = 0;
 static int count = 0;
+static int commit_holds = 0;
+static int commit_held = 0;
 TIME write_time;
 int lease_file_is_corrupt = 0;
 
@@ -102,6 +105,7 @@ int write_lease (lease)
 	struct binding *b;
 	char *s;
 	const char *tval;
+	struct timeval start;
 
 	/* If the lease file is corrupt, don't try to write any more leases
 	   until we've written a good lease file. */
@@ -109,8 +113,10 @@ int write_lease (lease)
 		if (!new_lease_file (0))
 			return 0;
 
+	/* Writes made while rewriting the whole file aren't counted. */
 	if (counting)
 		++count;
+	METRICS_START(start);
 	errno = 0;
 	fprintf (db_file, "lease %s {", piaddr (lease -> ip_addr));
 	if (errno) {
@@ -292,6 +298,8 @@ int write_lease (lease)
 		lease_file_is_corrupt = 1;
         }
 
+	if (counting)
+		METRICS_STOP(METRICS_COMMIT, start);
 	return !errors;
 }
 
@@ -524,6 +532,7 @@ write_ia(const struct ia_xx *ia) {
 	const char *tval;
 	char *s;
 	int fprintf_ret;
+	struct timeval start;
 
 #ifdef EUI_64
 	/* If we're not writing EUI64 leases to the file, then
@@ -559,6 +568,7 @@ write_ia(const struct ia_xx *ia) {
 	if (counting) {
 		++count;
 	}
+	METRICS_START(start);
 
 	s = format_lease_id(ia->iaid_duid.data, ia->iaid_duid.len,
 			    lease_id_format, MDL);
@@ -688,11 +698,15 @@ write_ia(const struct ia_xx *ia) {
 
 		if (fprintf(db_file, "\n  }\n") < 0)
                         goto error_exit;
+
+		lease_snapshot_iasubopt(ia, iasubopt);
 	}
 	if (fprintf(db_file, "}\n\n") < 0)
                 goto error_exit;
 
 	fflush(db_file);
+	if (counting)
+		METRICS_STOP(METRICS_COMMIT, start);
 	return 1;
 
 error_exit:
@@ -1030,9 +1044,20 @@ void commit_leases_timeout (void *foo)
 
 int commit_leases ()
 {
+	struct timeval start;
+
+	/* If a group of changes is being made, commit them once they've
+	   all been written. */
+	if (commit_holds) {
+		commit_held = 1;
+		return (1);
+	}
+
 	/* Commit any outstanding writes to the lease database file.
 	   We need to do this even if we're rewriting the file below,
 	   just in case the rewrite fails. */
+	PROBE(COMMIT_START);
+	METRICS_START(start);
 	if (fflush (db_file) == EOF) {
 		log_info("commit_leases: unable to commit, fflush(): %m");
 		return (0);
@@ -1042,6 +1067,8 @@ int commit_leases ()
 		log_info ("commit_leases: unable to commit, fsync(): %m");
 		return (0);
 	}
+	METRICS_STOP(METRICS_FSYNC, start);
+	PROBE(COMMIT_DONE);
 
 	/* If we haven't rewritten the lease database in over an
 	   hour, rewrite it now.  (The length of time should probably
@@ -1054,6 +1081,24 @@ int commit_leases ()
 	return (1);
 }
 
+/* Hold back commit_leases() until release_commits() is called as many
+   times as this was, so that changes made together are committed
+   together. */
+void hold_commits ()
+{
+	commit_holds++;
+}
+
+/* Release a hold on commit_leases(), and commit if it was the last one
+   and there's anything to commit. */
+int release_commits ()
+{
+	if (commit_holds == 0 || --commit_holds > 0 || !commit_held)
+		return (1);
+	commit_held = 0;
+	return (commit_leases());
+}
+
 /*
  * rewrite the lease file about once an hour
  * This is meant as a quick patch for ticket 24887.  It allows
@@ -1124,9 +1169,9 @@ void db_startup (int test_mode)
 	log_info("Host UID hash:  %s", host_hash_report(host_uid_hash));
 	log_info("Lease IP hash:  %s",
 		 lease_ip_hash_report(lease_ip_addr_hash));
-	log_info("Lease UID hash: %s", lease_id_hash_report(lease_uid_hash));
+	log_info("Lease UID hash: %s", client_leases_hash_report(lease_uid_hash));
 	log_info("Lease HW hash:  %s",
-		 lease_id_hash_report(lease_hw_addr_hash));
+		 client_leases_hash_report(lease_hw_addr_hash));
 #endif
 }
 
@@ -151,6 +151,8 @@ ddns_updates(struct packet *packet, struct lease *lease, struct lease *old,
 	if (ddns_cb == NULL) {
 		return(0);
 	}
+	PROBE_PACKET(DDNS_START, packet);
+
 	/*
 	 * Assume that we shall update both the A and ptr records and,
 	 * as this is an update, set the active flag
@@ -791,6 +793,7 @@ ddns_updates(struct packet *packet, struct lease *lease, struct lease *old,
 	if (bp)
 		buffer_dereference(&bp, MDL);
 
+	PROBE_PACKET(DDNS_DONE, packet);
 	return result;
 }
 
@@ -70,7 +70,7 @@ static int site_code_min;
 static int find_min_site_code(struct universe *);
 static isc_result_t lowest_site_code(const void *, unsigned, void *);
 
-static const char *dhcp_type_names [] = {
+const char *dhcp_type_names [] = {
 	"DHCPDISCOVER",
 	"DHCPOFFER",
 	"DHCPREQUEST",
@@ -101,6 +101,8 @@ dhcp (struct packet *packet) {
 	const char *errmsg;
 	struct data_string data;
 
+	metrics_parsed();
+
 	if (!locate_network(packet) &&
 	    packet->packet_type != DHCPREQUEST &&
 	    packet->packet_type != DHCPINFORM &&
@@ -298,12 +300,18 @@ void dhcpdiscover (packet, ms_nulltp)
 	TIME when;
 	const char *s;
 	int peer_has_leases = 0;
+	int allocated;
+	struct timeval start;
 #if defined (FAILOVER_PROTOCOL)
 	dhcp_failover_state_t *peer;
 #endif
 
+	PROBE_PACKET(LEASE_FIND_START, packet);
+	METRICS_START(start);
 	find_lease (&lease, packet, packet -> shared_network,
 		    0, &peer_has_leases, (struct lease *)0, MDL);
+	METRICS_STOP(METRICS_ALLOCATE, start);
+	PROBE_PACKET(LEASE_FIND_DONE, packet);
 
 	if (lease && lease -> client_hostname) {
 		if ((strlen (lease -> client_hostname) <= 64) &&
@@ -392,9 +400,14 @@ void dhcpdiscover (packet, ms_nulltp)
 
 	/* If we didn't find a lease, try to allocate one... */
 	if (!lease) {
-		if (!allocate_lease (&lease, packet,
-				     packet -> shared_network -> pools,
-				     &peer_has_leases)) {
+		PROBE_PACKET(LEASE_ALLOCATE_START, packet);
+		METRICS_START(start);
+		allocated = allocate_lease (&lease, packet,
+					    packet -> shared_network -> pools,
+					    &peer_has_leases);
+		METRICS_STOP(METRICS_ALLOCATE, start);
+		PROBE_PACKET(LEASE_ALLOCATE_DONE, packet);
+		if (!allocated) {
 			if (peer_has_leases)
 				log_error ("%s: peer holds all free leases",
 					   msgbuf);
@@ -468,6 +481,7 @@ void dhcprequest (packet, ms_nulltp, ip_lease)
 	dhcp_failover_state_t *peer;
 #endif
 	int have_requested_addr = 0;
+	struct timeval start;
 
 	oc = lookup_option (&dhcp_universe, packet -> options,
 			    DHO_DHCP_REQUESTED_ADDRESS);
@@ -492,9 +506,14 @@ void dhcprequest (packet, ms_nulltp, ip_lease)
 
 	subnet = (struct subnet *)0;
 	lease = (struct lease *)0;
-	if (find_subnet (&subnet, cip, MDL))
+	if (find_subnet (&subnet, cip, MDL)) {
+		PROBE_PACKET(LEASE_FIND_START, packet);
+		METRICS_START(start);
 		find_lease (&lease, packet,
 			    subnet -> shared_network, &ours, 0, ip_lease, MDL);
+		METRICS_STOP(METRICS_ALLOCATE, start);
+		PROBE_PACKET(LEASE_FIND_DONE, packet);
+	}
 
 	if (lease && lease -> client_hostname) {
 		if ((strlen (lease -> client_hostname) <= 64) &&
@@ -777,7 +796,9 @@ void dhcprelease (packet, ms_nulltp)
 	struct packet *packet;
 	int ms_nulltp;
 {
-	struct lease *lease = (struct lease *)0, *next = (struct lease *)0;
+	struct lease *lease = (struct lease *)0;
+	struct client_leases *set;
+	unsigned i;
 	struct iaddr cip;
 	struct option_cache *oc;
 	struct data_string data;
@@ -804,26 +825,19 @@ void dhcprelease (packet, ms_nulltp)
 				   (struct client_state *)0,
 				   packet -> options, (struct option_state *)0,
 				   &global_scope, oc, MDL)) {
-		find_lease_by_uid (&lease, data.data, data.len, MDL);
+		set = find_client_leases_by_uid (data.data, data.len);
 		data_string_forget (&data, MDL);
 
 		/* See if we can find a lease that matches the IP address
 		   the client is claiming. */
-		while (lease) {
-			if (lease -> n_uid)
-				lease_reference (&next, lease -> n_uid, MDL);
+		for (i = 0; set && i < set -> count; i++) {
 			if (!memcmp (&packet -> raw -> ciaddr,
-				     lease -> ip_addr.iabuf, 4)) {
+				     set -> leases [i] -> ip_addr.iabuf, 4)) {
+				lease_reference (&lease, set -> leases [i],
+						 MDL);
 				break;
 			}
-			lease_dereference (&lease, MDL);
-			if (next) {
-				lease_reference (&lease, next, MDL);
-				lease_dereference (&next, MDL);
-			}
 		}
-		if (next)
-			lease_dereference (&next, MDL);
 	}
 
 	/* The client is supposed to pass a valid client-identifier,
@@ -1267,25 +1281,24 @@ void dhcpinform (packet, ms_nulltp)
 				    &global_scope, subnet->group,
 				    NULL, NULL);
 
-	/* If we have ciaddr, find its lease so we can find its pool. */
+	/* If we have ciaddr, find its pool.  The address needn't have a
+	   lease if it has never been used. */
 	if (zeroed_ciaddr == ISC_FALSE) {
-		struct lease* cip_lease = NULL;
-
-		find_lease_by_ip_addr (&cip_lease, cip, MDL);
+		struct pool *cip_pool = NULL;
 
-		/* Overlay with pool options if ciaddr mapped to a lease. */
-		if (cip_lease) {
-		 	if (cip_lease->pool && cip_lease->pool->group) {
+		/* Overlay with pool options if ciaddr is in a pool. */
+		if (find_address_pool (&cip_pool, cip)) {
+		 	if (cip_pool->group) {
 				execute_statements_in_scope(
 					NULL, packet, NULL, NULL,
 				    	packet->options, options,
 				    	&global_scope,
-				     	cip_lease->pool->group,
-					cip_lease->pool->shared_network->group,
+				     	cip_pool->group,
+					cip_pool->shared_network->group,
 					NULL);
 			}
 
-			lease_dereference (&cip_lease, MDL);
+			pool_dereference (&cip_pool, MDL);
 		}
 	}
 
@@ -2178,7 +2191,6 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 {
 	struct lease *lt;
 	struct lease_state *state;
-	struct lease *next;
 	struct host_decl *host = (struct host_decl *)0;
 	TIME lease_time;
 	TIME offered_lease_time;
@@ -2207,6 +2219,8 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 	if (lease -> state)
 		return;
 
+	PROBE_PACKET(ACK_START, packet);
+
 	/* Save original cltt for comparison later. */
 	original_cltt = lease->cltt;
 
@@ -2223,6 +2237,7 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 	state -> got_requested_address = packet -> got_requested_address;
 	shared_network_reference (&state -> shared_network,
 				  packet -> interface -> shared_network, MDL);
+	dupcache_current(&state->dup_slot, &state->dup_serial);
 
 	/* See if we got a server identifier option. */
 	if (lookup_option (&dhcp_universe,
@@ -2295,26 +2310,19 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 					   packet -> options,
 					   state -> options, &lease -> scope,
 					   oc, MDL)) {
+	    struct client_leases *set;
 	    struct lease *seek;
 	    if (lease -> uid_len) {
 		do {
-		    seek = (struct lease *)0;
-		    find_lease_by_uid (&seek, lease -> uid,
-				       lease -> uid_len, MDL);
-		    if (!seek)
-			break;
-		    if (seek == lease && !seek -> n_uid) {
-			lease_dereference (&seek, MDL);
+		    set = find_client_leases_by_uid (lease -> uid,
+						     lease -> uid_len);
+		    if (!set)
 			break;
-		    }
-		    next = (struct lease *)0;
 
 		    /* Don't release expired leases, and don't
 		       release the lease we're going to assign. */
-		    next = (struct lease *)0;
-		    while (seek) {
-			if (seek -> n_uid)
-			    lease_reference (&next, seek -> n_uid, MDL);
+		    for (j = 0; j < set -> count; j++) {
+			seek = set -> leases [j];
 			if (seek != lease &&
 			    seek -> binding_state != FTS_RELEASED &&
 			    seek -> binding_state != FTS_EXPIRED &&
@@ -2322,15 +2330,10 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 			    seek -> binding_state != FTS_FREE &&
 			    seek -> binding_state != FTS_BACKUP)
 				break;
-			lease_dereference (&seek, MDL);
-			if (next) {
-			    lease_reference (&seek, next, MDL);
-			    lease_dereference (&next, MDL);
-			}
 		    }
-		    if (next)
-			lease_dereference (&next, MDL);
-		    if (seek) {
+		    if (j < set -> count) {
+			seek = (struct lease *)0;
+			lease_reference (&seek, set -> leases [j], MDL);
 			release_lease (seek, packet);
 			lease_dereference (&seek, MDL);
 		    } else
@@ -2349,20 +2352,13 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 						 &lease -> scope,
 						 oc, MDL))) {
 		do {
-		    seek = (struct lease *)0;
-		    find_lease_by_hw_addr
-			    (&seek, lease -> hardware_addr.hbuf,
-			     lease -> hardware_addr.hlen, MDL);
-		    if (!seek)
+		    set = find_client_leases_by_hw_addr
+			    (lease -> hardware_addr.hbuf,
+			     lease -> hardware_addr.hlen);
+		    if (!set)
 			    break;
-		    if (seek == lease && !seek -> n_hw) {
-			    lease_dereference (&seek, MDL);
-			    break;
-		    }
-		    next = (struct lease *)0;
-		    while (seek) {
-			if (seek -> n_hw)
-			    lease_reference (&next, seek -> n_hw, MDL);
+		    for (j = 0; j < set -> count; j++) {
+			seek = set -> leases [j];
 			if (seek != lease &&
 			    seek -> binding_state != FTS_RELEASED &&
 			    seek -> binding_state != FTS_EXPIRED &&
@@ -2370,15 +2366,10 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 			    seek -> binding_state != FTS_FREE &&
 			    seek -> binding_state != FTS_BACKUP)
 				break;
-			lease_dereference (&seek, MDL);
-			if (next) {
-			    lease_reference (&seek, next, MDL);
-			    lease_dereference (&next, MDL);
-			}
 		    }
-		    if (next)
-			lease_dereference (&next, MDL);
-		    if (seek) {
+		    if (j < set -> count) {
+			seek = (struct lease *)0;
+			lease_reference (&seek, set -> leases [j], MDL);
 			release_lease (seek, packet);
 			lease_dereference (&seek, MDL);
 		    } else
@@ -3207,6 +3198,8 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 			commit = 0;
 		}
 
+		PROBE_PACKET(LEASE_UPDATE_START, packet);
+
 #if !defined(DELAYED_ACK)
 		/* Install the new information on 'lt' onto the lease at
 		 * 'lease'.  If this is a DHCPOFFER, it is a 'soft' promise,
@@ -3245,6 +3238,7 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 			lease_dereference (&lt, MDL);
 			return;
 		}
+		PROBE_PACKET(LEASE_UPDATE_DONE, packet);
 	}
 	lease_dereference (&lt, MDL);
 
@@ -3569,6 +3563,8 @@ void ack_lease (packet, lease, offer, when, msg, ms_nulltp, hp)
 	/* Hang the packet off the lease state. */
 	packet_reference (&lease -> state -> packet, packet, MDL);
 
+	PROBE_PACKET(ACK_DONE, packet);
+
 	/* If this is a DHCPOFFER, send a ping (if appropriate) to the
 	 * lease address before actually we send the offer. */
 	if ((offer == DHCPOFFER) &&
@@ -3619,6 +3615,8 @@ int do_ping_check(struct packet* packet, struct lease_state* state,
 	int ignorep;
 	int timeout_secs;
 	int timeout_ms;
+	int ahead = DEFAULT_PING_AHEAD;
+	u_int32_t verified_lifetime = DEFAULT_PING_VERIFIED_LIFETIME;
 
 	// Don't go any further if lease is active or static.
 	if (lease->binding_state == FTS_ACTIVE || lease->flags & STATIC_LEASE) {
@@ -3659,8 +3657,12 @@ int do_ping_check(struct packet* packet, struct lease_state* state,
 		}
 	}
 
-	// Send the ping.
-	icmp_echorequest (&lease->ip_addr);
+	// A recent ping ahead found nothing there, so don't wait again.
+	if (ping_verified(&lease->ip_addr)) {
+		log_debug ("%s was pinged ahead, not pinging it again.",
+			   piaddr(lease->ip_addr));
+		return (0);
+	}
 
 	/* Determine whether to use configured or default ping timeout. */
 	memset(&ds, 0, sizeof(ds));
@@ -3706,6 +3708,10 @@ int do_ping_check(struct packet* packet, struct lease_state* state,
 
 	tv.tv_sec = cur_tv.tv_sec + timeout_secs;
 	tv.tv_usec = cur_tv.tv_usec + (timeout_ms * 1000);
+	if (tv.tv_usec >= 1000000) {
+		tv.tv_sec++;
+		tv.tv_usec -= 1000000;
+	}
 
 #ifdef DEBUG
 	log_debug ("Pinging:%s, state: %d, same client? %s, "
@@ -3719,8 +3725,39 @@ int do_ping_check(struct packet* packet, struct lease_state* state,
 
 #endif
 
-	add_timeout (&tv, lease_ping_timeout, lease, (tvref_t)lease_reference,
-		     (tvunref_t)lease_dereference);
+	// Send the ping.
+	ping_send(lease, PING_OFFER, &tv, 0);
+
+	/* Ping the next few free leases in the pool while we wait, so
+	   that the offers after this one can go out straight away. */
+	oc = lookup_option (&server_universe, state->options, SV_PING_AHEAD);
+	if (oc &&
+	    (evaluate_option_cache (&ds, packet, lease, 0,
+				    packet->options, state->options,
+				    &lease->scope, oc, MDL))) {
+		if (ds.len == sizeof (u_int32_t)) {
+			ahead = getULong (ds.data);
+		}
+
+		data_string_forget (&ds, MDL);
+	}
+
+	if (ahead > 0) {
+		oc = lookup_option (&server_universe, state->options,
+				    SV_PING_VERIFIED_LIFETIME);
+		if (oc &&
+		    (evaluate_option_cache (&ds, packet, lease, 0,
+					    packet->options, state->options,
+					    &lease->scope, oc, MDL))) {
+			if (ds.len == sizeof (u_int32_t)) {
+				verified_lifetime = getULong (ds.data);
+			}
+
+			data_string_forget (&ds, MDL);
+		}
+
+		ping_ahead(lease->pool, ahead, &tv, verified_lifetime);
+	}
 
 	return (1);
 }
@@ -3821,6 +3858,8 @@ delayed_acks_timer(void *foo)
 		return;
 	}
 
+	PROBE(DELAYED_ACKS_START);
+
 	/* Commit the leases first */
 	commit_leases();
 
@@ -3852,7 +3891,9 @@ delayed_acks_timer(void *foo)
 			log_error("delayed ack for %s has gone stale",
 				  piaddr(ack->lease->ip_addr));
 		else {
+			PROBE_LEASE(DELAYED_ACK_START, ack->lease);
 			dhcp_reply(ack->lease);
+			PROBE_LEASE(DELAYED_ACK_DONE, ack->lease);
 		}
 
 		lease_dereference(&ack->lease, MDL);
@@ -3863,6 +3904,7 @@ delayed_acks_timer(void *foo)
 	ackqueue_head = NULL;
 	ackqueue_tail = NULL;
 	outstanding_acks = 0;
+	PROBE(DELAYED_ACKS_DONE);
 }
 
 #if defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
@@ -3901,6 +3943,7 @@ void dhcp_reply (lease)
 #endif
 	struct data_string d1;
 	const char *s;
+	struct timeval start;
 
 	if (!state)
 		log_fatal ("dhcp_reply was supplied lease with no state!");
@@ -4085,15 +4128,24 @@ void dhcp_reply (lease)
 			to.sin_port = remote_port; /* For debugging. */
 
 		if (fallback_interface) {
+			PROBE_LEASE(SEND_START, lease);
+			METRICS_START(start);
 			result = send_packet(fallback_interface, NULL, &raw,
 					     packet_length, raw.siaddr, &to,
 					     NULL);
+			METRICS_STOP(METRICS_SEND, start);
+			PROBE_LEASE(SEND_DONE, lease);
 			if (result < 0) {
 				log_error ("%s:%d: Failed to send %d byte long "
 					   "packet over %s interface.", MDL,
 					   packet_length,
 					   fallback_interface->name);
-			}
+			} else
+				dupcache_reply4(state->dup_slot,
+						state->dup_serial,
+						fallback_interface, &raw,
+						packet_length, raw.siaddr,
+						&to, NULL);
 
 
 			free_lease_state (state, MDL);
@@ -4123,15 +4175,24 @@ void dhcp_reply (lease)
 		to.sin_port = remote_port;
 
 		if (fallback_interface) {
+			PROBE_LEASE(SEND_START, lease);
+			METRICS_START(start);
 			result = send_packet(fallback_interface, NULL, &raw,
 					     packet_length, raw.siaddr, &to,
 					     NULL);
+			METRICS_STOP(METRICS_SEND, start);
+			PROBE_LEASE(SEND_DONE, lease);
 			if (result < 0) {
 				log_error("%s:%d: Failed to send %d byte long"
 					  " packet over %s interface.", MDL,
 					   packet_length,
 					   fallback_interface->name);
-			}
+			} else
+				dupcache_reply4(state->dup_slot,
+						state->dup_serial,
+						fallback_interface, &raw,
+						packet_length, raw.siaddr,
+						&to, NULL);
 
 			free_lease_state (state, MDL);
 			lease -> state = (struct lease_state *)0;
@@ -4157,13 +4218,20 @@ void dhcp_reply (lease)
 
 	memcpy (&from, state -> from.iabuf, sizeof from);
 
+	PROBE_LEASE(SEND_START, lease);
+	METRICS_START(start);
 	result = send_packet(state->ip, NULL, &raw, packet_length,
 			      from, &to, unicastp ? &hto : NULL);
+	METRICS_STOP(METRICS_SEND, start);
+	PROBE_LEASE(SEND_DONE, lease);
 	if (result < 0) {
 	    log_error ("%s:%d: Failed to send %d byte long "
 		       "packet over %s interface.", MDL,
 		       packet_length, state->ip->name);
-	}
+	} else
+		dupcache_reply4(state->dup_slot, state->dup_serial, state->ip,
+				&raw, packet_length, from, &to,
+				unicastp ? &hto : NULL);
 
 
 	/* Free all of the entries in the option_state structure
@@ -4187,6 +4255,9 @@ int find_lease (struct lease **lp,
 	struct host_decl *host = (struct host_decl *)0;
 	struct lease *fixed_lease = (struct lease *)0;
 	struct lease *next = (struct lease *)0;
+	struct client_leases *uid_set = (struct client_leases *)0;
+	struct client_leases *hw_set;
+	unsigned i;
 	struct option_cache *oc;
 	struct data_string d1;
 	int have_client_identifier = 0;
@@ -4268,8 +4339,8 @@ int find_lease (struct lease **lp,
 			host_dereference (&hp, MDL);
 		}
 
-		find_lease_by_uid (&uid_lease, client_identifier.data,
-				   client_identifier.len, MDL);
+		uid_set = find_client_leases_by_uid (client_identifier.data,
+						     client_identifier.len);
 	}
 
 	/* If we didn't find a fixed lease using the uid, try doing
@@ -4333,16 +4404,20 @@ int find_lease (struct lease **lp,
 
 	/*
 	 * If we found leases matching the client identifier, loop through
-	 * the n_uid pointer looking for one that's actually valid.   We
-	 * can't do this until we get here because we depend on
-	 * packet -> known, which may be set by either the uid host
-	 * lookup or the haddr host lookup.
+	 * them looking for one that's actually valid.   We can't do this
+	 * until we get here because we depend on packet -> known, which
+	 * may be set by either the uid host lookup or the haddr host
+	 * lookup.
 	 *
-	 * Note that the n_uid lease chain is sorted in order of
-	 * preference, so the first one is the best one.
+	 * Note that the client's set of leases is sorted in order of
+	 * preference, so the first one is the best one.  Releasing a
+	 * lease may move it within the set, so after a release we look
+	 * for the lease that followed it.
 	 */
-	while (uid_lease) {
+	i = 0;
+	while (uid_set && i < uid_set -> count) {
 		isc_boolean_t do_release = !packet->raw->ciaddr.s_addr;
+		lease_reference (&uid_lease, uid_set -> leases [i], MDL);
 #if defined (DEBUG_FIND_LEASE)
 		log_info ("trying next lease matching client id: %s",
 			  piaddr (uid_lease -> ip_addr));
@@ -4388,16 +4463,20 @@ int find_lease (struct lease **lp,
 				  piaddr (uid_lease -> ip_addr));
 #endif
 		       n_uid:
-			if (uid_lease -> n_uid)
-				lease_reference (&next,
-						 uid_lease -> n_uid, MDL);
-			if (do_release)
+			if (do_release) {
+				if (i + 1 < uid_set -> count)
+					lease_reference (&next,
+						uid_set -> leases [i + 1], MDL);
 				release_lease (uid_lease, packet);
+				uid_set = find_client_leases_by_uid
+					(client_identifier.data,
+					 client_identifier.len);
+				i = client_leases_index (uid_set, next);
+				if (next)
+					lease_dereference (&next, MDL);
+			} else
+				i++;
 			lease_dereference (&uid_lease, MDL);
-			if (next) {
-				lease_reference (&uid_lease, next, MDL);
-				lease_dereference (&next, MDL);
-			}
 			continue;
 		}
 		break;
@@ -4412,14 +4491,16 @@ int find_lease (struct lease **lp,
 	 * identifier matches (or equally doesn't have one), that's
 	 * permitted, and that's on the correct subnet.
 	 *
-	 * Note that the n_hw chain is sorted in order of preference, so
-	 * the first one found is the best one.
+	 * Note that the client's set of leases is sorted in order of
+	 * preference, so the first one found is the best one.
 	 */
 	h.hlen = packet -> raw -> hlen + 1;
 	h.hbuf [0] = packet -> raw -> htype;
 	memcpy (&h.hbuf [1], packet -> raw -> chaddr, packet -> raw -> hlen);
-	find_lease_by_hw_addr (&hw_lease, h.hbuf, h.hlen, MDL);
-	while (hw_lease) {
+	hw_set = find_client_leases_by_hw_addr (h.hbuf, h.hlen);
+	i = 0;
+	while (hw_set && i < hw_set -> count) {
+		lease_reference (&hw_lease, hw_set -> leases [i], MDL);
 #if defined (DEBUG_FIND_LEASE)
 		log_info ("trying next lease matching hw addr: %s",
 			  piaddr (hw_lease -> ip_addr));
@@ -4479,16 +4560,22 @@ int find_lease (struct lease **lp,
 			log_info ("not permitted: %s",
 				  piaddr (hw_lease -> ip_addr));
 #endif
-			if (!packet -> raw -> ciaddr.s_addr)
+			if (!packet -> raw -> ciaddr.s_addr) {
+				if (i + 1 < hw_set -> count)
+					lease_reference (&next,
+						hw_set -> leases [i + 1], MDL);
 				release_lease (hw_lease, packet);
+				hw_set = find_client_leases_by_hw_addr
+					(h.hbuf, h.hlen);
+				i = client_leases_index (hw_set, next);
+				if (next)
+					lease_dereference (&next, MDL);
+				lease_dereference (&hw_lease, MDL);
+				continue;
+			}
 		       n_hw:
-			if (hw_lease -> n_hw)
-				lease_reference (&next, hw_lease -> n_hw, MDL);
+			i++;
 			lease_dereference (&hw_lease, MDL);
-			if (next) {
-				lease_reference (&hw_lease, next, MDL);
-				lease_dereference (&next, MDL);
-			}
 			continue;
 		}
 		break;
@@ -4503,8 +4590,25 @@ int find_lease (struct lease **lp,
 	   IP address. */
 	if (ip_lease_in)
 		lease_reference (&ip_lease, ip_lease_in, MDL);
-	else if (cip.len)
-		find_lease_by_ip_addr (&ip_lease, cip, MDL);
+	else if (cip.len &&
+		 !find_lease_by_ip_addr (&ip_lease, cip, MDL)) {
+		struct pool *cip_pool = NULL;
+
+		/* An address that has never been used has no lease yet.
+		   Make one only if the address could be given to this
+		   client; otherwise it's enough to know it's ours. */
+		if (find_address_pool (&cip_pool, cip)) {
+			if (cip_pool -> shared_network == share)
+				use_lease_by_ip_addr (&ip_lease, cip, MDL);
+			else {
+				if (ours)
+					*ours = 1;
+				strcpy (dhcp_message,
+					"requested address on bad subnet");
+			}
+			pool_dereference (&cip_pool, MDL);
+		}
+	}
 
 #if defined (DEBUG_FIND_LEASE)
 	if (ip_lease)
@@ -5053,6 +5157,14 @@ int allocate_lease (struct lease **lp, struct packet *packet,
 		} else
 #endif
 		{
+#if defined (LAZY_RANGES)
+			/* Make a lease for a never-used address if there
+			   is no virgin lease already queued. */
+			if (pool->unused_leases > 0 &&
+			    (!LEASE_NOT_EMPTY(pool->free) ||
+			     LEASE_GET_FIRST(pool->free)->ends > MIN_TIME))
+				use_unused_lease(pool);
+#endif
 			if (LEASE_NOT_EMPTY(pool->free))
 				candl = LEASE_GET_FIRST(pool->free);
 			else
@@ -5399,6 +5511,104 @@ int locate_network (packet)
 	return 0;
 }
 
+/*
+ * Dropping packets from unknown relays
+ *
+ * With drop-unknown-relays on, a relayed packet whose giaddr is in none
+ * of our subnets, which locate_network() would fail on, is dropped as it
+ * is received rather than once its options have been parsed.  On LPF
+ * and BPF the giaddrs are also checked by the interfaces' packet
+ * filters, so the kernel drops such packets before they are ever read.
+ * The check here catches them on other systems, or when there are too
+ * many subnets to put in a filter.
+ *
+ * Only the giaddr is looked at, so relays that use the link selection
+ * or subnet selection options must have giaddrs in a configured subnet.
+ */
+int drop_unknown_relays = 0;
+
+static bootp_handler_t relay_filter_handler;
+
+static void
+relay_filter_packet(struct interface_info *ip, struct dhcp_packet *raw,
+		    unsigned len, unsigned int from_port, struct iaddr from,
+		    struct hardware *hfrom)
+{
+	struct subnet *subnet = NULL;
+	struct iaddr ia;
+
+	if (len >= DHCP_FIXED_NON_UDP && raw->giaddr.s_addr != 0) {
+		ia.len = 4;
+		memcpy(ia.iabuf, &raw->giaddr, 4);
+		if (!find_subnet(&subnet, ia, MDL))
+			return;
+		subnet_dereference(&subnet, MDL);
+	}
+
+	(*relay_filter_handler)(ip, raw, len, from_port, from, hfrom);
+}
+
+/* Set up the checks from the subnets in the configuration: before the
+   interfaces are registered, and again when the configuration has been
+   reloaded, which also puts the new filter on each interface. */
+void
+relay_filter_setup(int reloaded) {
+#if defined (USE_BPF_RECEIVE) || defined (USE_LPF_RECEIVE)
+	struct interface_info *ip;
+	struct subnet *subnet;
+	int count;
+#endif
+
+	if (!drop_unknown_relays || local_family != AF_INET ||
+	    dhcpv4_over_dhcpv6)
+		return;
+
+	push_packet_handler(&relay_filter_handler, relay_filter_packet);
+
+#if defined (USE_BPF_RECEIVE) || defined (USE_LPF_RECEIVE)
+	if (dhcp_bpf_giaddrs != NULL) {
+		dfree(dhcp_bpf_giaddrs, MDL);
+		dhcp_bpf_giaddrs = NULL;
+	}
+	dhcp_bpf_giaddr_count = 0;
+
+	count = 0;
+	for (subnet = subnets; subnet != NULL; subnet = subnet->next_subnet)
+		if (subnet->netmask.len == 4)
+			count++;
+	if (count == 0) {
+		/* Match no relay at all. */
+		count = 1;
+		dhcp_bpf_giaddrs = dmalloc(2 * sizeof(u_int32_t), MDL);
+		if (dhcp_bpf_giaddrs == NULL)
+			log_fatal("No memory for relay filter.");
+		dhcp_bpf_giaddrs[0] = 0xffffffff;
+		dhcp_bpf_giaddrs[1] = 0;
+	} else {
+		dhcp_bpf_giaddrs = dmalloc(2 * count * sizeof(u_int32_t), MDL);
+		if (dhcp_bpf_giaddrs == NULL)
+			log_fatal("No memory for relay filter.");
+		count = 0;
+		for (subnet = subnets; subnet != NULL;
+		     subnet = subnet->next_subnet) {
+			if (subnet->netmask.len != 4)
+				continue;
+			dhcp_bpf_giaddrs[2*count] =
+				getULong(subnet->net.iabuf);
+			dhcp_bpf_giaddrs[2*count + 1] =
+				getULong(subnet->netmask.iabuf);
+			count++;
+		}
+	}
+	dhcp_bpf_giaddr_count = count;
+
+	if (reloaded)
+		for (ip = interfaces; ip != NULL; ip = ip->next)
+			if (ip->rfdesc >= 0)
+				if_refresh_receive_filter(ip);
+#endif
+}
+
 /*
  * Try to figure out the source address to send packets from.
  *
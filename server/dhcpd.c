@@ -97,6 +97,8 @@ u_int32_t abandon_lease_time = DEFAULT_ABANDON_LEASE_TIME;
 const char *path_dhcpd_conf = _PATH_DHCPD_CONF;
 const char *path_dhcpd_db = _PATH_DHCPD_DB;
 const char *path_dhcpd_pid = _PATH_DHCPD_PID;
+const char *path_lease_snapshot = NULL;
+u_int32_t lease_snapshot_size = DEFAULT_LEASE_SNAPSHOT_SIZE;
 /* False (default) => we write and use a pid file */
 isc_boolean_t no_pid_file = ISC_FALSE;
 
@@ -155,7 +157,7 @@ static void omapi_listener_start (void *foo)
 #ifdef DHCPv6
 #ifdef DHCP4o6
 #define DHCPD_USAGE1 \
-"             [-4|-6] [-4o6 <port>]\n" \
+"             [-4|-6] [-4o6 <port>] [-4o6-ring <file>]\n" \
 "             [-cf config-file] [-lf lease-file]\n"
 #else /* DHCP4o6 */
 #define DHCPD_USAGE1 \
@@ -176,7 +178,7 @@ static void omapi_listener_start (void *foo)
 #if defined (TRACING)
 #define DHCPD_USAGET \
 "             [-tf trace-output-file]\n" \
-"             [-play trace-input-file]\n"
+"             [-play trace-input-file [-bench speed]]\n"
 #else
 #define DHCPD_USAGET ""
 #endif /* TRACING */
@@ -267,10 +269,6 @@ main(int argc, char **argv) {
 	isc_result_t result;
 	unsigned seed;
 	struct interface_info *ip;
-#if defined (NSUPDATE)
-	struct parse *parse;
-	int lose;
-#endif
 	int have_dhcpd_conf = 0;
 	int have_dhcpd_db = 0;
 	int have_dhcpd_pid = 0;
@@ -283,6 +281,7 @@ main(int argc, char **argv) {
 #if defined (TRACING)
 	char *traceinfile = (char *)0;
 	char *traceoutfile = (char *)0;
+	double bench_speed = -1;
 #endif
 
 #if defined (PARANOIA)
@@ -520,6 +519,16 @@ main(int argc, char **argv) {
 				  ntohs(dhcp4o6_port),
 				  ntohs(dhcp4o6_port) + 1);
 			dhcpv4_over_dhcpv6 = 1;
+		} else if (!strcmp(argv[i], "-4o6-ring")) {
+			if (++i == argc)
+				usage(use_noarg, argv[i-1]);
+#if defined (DHCP4o6_RING)
+			dhcp4o6_ring_file = argv[i];
+#else
+			log_error("DHCPv4 over DHCPv6 rings are not "
+				  "supported by this build, using the "
+				  "socket.");
+#endif
 #endif /* DHCP4o6 */
 #endif /* DHCPv6 */
 #if defined (TRACING)
@@ -532,6 +541,14 @@ main(int argc, char **argv) {
 				usage(use_noarg, argv[i-1]);
 			traceinfile = argv [i];
 			trace_replay_init ();
+		} else if (!strcmp (argv [i], "-bench")) {
+			char *end;
+
+			if (++i == argc)
+				usage(use_noarg, argv[i-1]);
+			bench_speed = strtod (argv [i], &end);
+			if (*end != '\0' || end == argv [i] || bench_speed < 0)
+				usage("Invalid replay speed %s", argv[i]);
 #endif /* TRACING */
 		} else if (argv [i][0] == '-') {
 			usage("Unknown command %s", argv[i]);
@@ -620,7 +637,9 @@ main(int argc, char **argv) {
 	}
 
 #if defined (TRACING)
-	trace_init (set_time, MDL);
+	if (bench_speed >= 0 && !traceinfile)
+		log_fatal ("-bench can only be used with -play.");
+	trace_init (bench_speed >= 0 ? replay_set_time : set_time, MDL);
 	if (traceoutfile) {
 		result = trace_begin (traceoutfile, MDL);
 		if (result != ISC_R_SUCCESS)
@@ -755,9 +774,7 @@ main(int argc, char **argv) {
 #endif
 #endif
 
-	if (!group_allocate (&root_group, MDL))
-		log_fatal ("Can't allocate root group!");
-	root_group -> authoritative = 0;
+	root_group_setup();
 
 	/* Set up various hooks. */
 	dhcp_interface_setup_hook = dhcpd_interface_setup_hook;
@@ -767,25 +784,6 @@ main(int argc, char **argv) {
 	dhcpv6_packet_handler = do_packet6;
 #endif /* DHCPv6 */
 
-#if defined (NSUPDATE)
-	/* Set up the standard name service updater routine. */
-	parse = NULL;
-	status = new_parse(&parse, -1, std_nsupdate, sizeof(std_nsupdate) - 1,
-			    "standard name service update routine", 0);
-	if (status != ISC_R_SUCCESS)
-		log_fatal ("can't begin parsing name service updater!");
-
-	if (parse != NULL) {
-		lose = 0;
-		if (!(parse_executable_statements(&root_group->statements,
-						  parse, &lose, context_any))) {
-			end_parse(&parse);
-			log_fatal("can't parse standard name service updater!");
-		}
-		end_parse(&parse);
-	}
-#endif
-
 	/* Initialize icmp support... */
 	if (!cftest && !lftest)
 		icmp_startup (1, lease_pinged);
@@ -798,7 +796,11 @@ main(int argc, char **argv) {
 		    log_error ("   Dhcpd will not overwrite your default");
 		    log_fatal ("   lease file when playing back a trace. **");
 	    }
+	    if (bench_speed >= 0)
+		    replay_bench_start (bench_speed);
 	    trace_file_replay (traceinfile);
+	    if (bench_speed >= 0)
+		    replay_bench_report ();
 
 #if defined (DEBUG_MEMORY_LEAKAGE) && \
                 defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
@@ -886,12 +888,28 @@ main(int argc, char **argv) {
 
 	group_write_hook = group_writer;
 
+	/* Open the lease snapshot before the lease file is read so that
+	   the leases loaded from it are entered into the snapshot. */
+	if ((lftest == 0) && (path_lease_snapshot != NULL) &&
+	    (lease_snapshot_open(path_lease_snapshot, lease_snapshot_size)
+	     != ISC_R_SUCCESS))
+		log_error("Lease snapshot %s disabled.", path_lease_snapshot);
+
 	/* Start up the database... */
 	db_startup (lftest);
 
 	if (lftest)
 		exit (0);
 
+	/* The duplicate cache goes in front of the packet handlers,
+	   admission control in front of that, and the check for unknown
+	   relays in front of both.  Metrics count every packet received,
+	   so they go in front of everything. */
+	dupcache_setup();
+	admission_setup();
+	relay_filter_setup(0);
+	metrics_setup();
+
 	/* Discover all the network interfaces and initialize them. */
 #if defined(DHCPv6) && defined(DHCP4o6)
 	if (dhcpv4_over_dhcpv6) {
@@ -1053,6 +1071,7 @@ main(int argc, char **argv) {
 	signal(SIGINT, dhcp_signal_handler);   /* control-c */
 	signal(SIGTERM, dhcp_signal_handler);  /* kill */
 #endif
+	signal(SIGHUP, dhcp_signal_handler);   /* reload configuration */
 
 	/* Log that we are about to start working */
 	log_info("Server starting service.");
@@ -1068,6 +1087,41 @@ main(int argc, char **argv) {
 }
 #endif /* !UNIT_TEST */
 
+/* Allocate an empty root group, holding only the standard name service
+   update routine, for the configuration file to be read into. */
+
+void root_group_setup (void)
+{
+#if defined (NSUPDATE)
+	struct parse *parse;
+	isc_result_t status;
+	int lose;
+#endif
+
+	if (!group_allocate (&root_group, MDL))
+		log_fatal ("Can't allocate root group!");
+	root_group -> authoritative = 0;
+
+#if defined (NSUPDATE)
+	/* Set up the standard name service updater routine. */
+	parse = NULL;
+	status = new_parse(&parse, -1, std_nsupdate, sizeof(std_nsupdate) - 1,
+			    "standard name service update routine", 0);
+	if (status != ISC_R_SUCCESS)
+		log_fatal ("can't begin parsing name service updater!");
+
+	if (parse != NULL) {
+		lose = 0;
+		if (!(parse_executable_statements(&root_group->statements,
+						  parse, &lose, context_any))) {
+			end_parse(&parse);
+			log_fatal("can't parse standard name service updater!");
+		}
+		end_parse(&parse);
+	}
+#endif
+}
+
 void postconf_initialization (int quiet)
 {
 	struct option_state *options = NULL;
@@ -1306,6 +1360,74 @@ void postconf_initialization (int quiet)
 	 * to init ddns_cb::flags before for every DDNS transaction. */
 	ddns_conflict_mask = get_conflict_mask(options);
 
+	oc = lookup_option(&server_universe, options, SV_DDNS_BATCH_WINDOW);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 4) {
+			ddns_batch_window = getULong(db.data);
+		} else {
+			log_fatal("invalid ddns-batch-window");
+		}
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_DDNS_BATCH_SIZE);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 4) {
+			ddns_batch_size = getULong(db.data);
+		} else {
+			log_fatal("invalid ddns-batch-size");
+		}
+		data_string_forget(&db, MDL);
+		if (ddns_batch_size == 0) {
+			log_error("ddns-batch-size of 0 is invalid, "
+				  "using %d", DEFAULT_DDNS_BATCH_SIZE);
+			ddns_batch_size = DEFAULT_DDNS_BATCH_SIZE;
+		}
+	}
+
+	oc = lookup_option(&server_universe, options, SV_DDNS_MAX_OUTSTANDING);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 4) {
+			ddns_max_outstanding = getULong(db.data);
+		} else {
+			log_fatal("invalid ddns-max-outstanding");
+		}
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_DDNS_ZONE_NEGATIVE_TTL);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 4) {
+			dns_zone_negative_ttl = getULong(db.data);
+		} else {
+			log_fatal("invalid ddns-zone-negative-ttl");
+		}
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_DDNS_ZONE_CACHE_FILE);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		s = dmalloc(db.len + 1, MDL);
+		if (!s)
+			log_fatal("no memory for zone cache filename.");
+		memcpy(s, db.data, db.len);
+		s[db.len] = 0;
+		data_string_forget(&db, MDL);
+		dns_zone_cache_file = s;
+		if (ddns_update_style != DDNS_UPDATE_STYLE_NONE)
+			dns_zone_cache_load();
+	}
+
 #else
 	/* If we don't have support for updates compiled in tell the user */
 	if (ddns_update_style != DDNS_UPDATE_STYLE_NONE) {
@@ -1392,6 +1514,14 @@ void postconf_initialization (int quiet)
 		log_error("Not using fsync() to flush lease writes");
 	}
 
+	oc = lookup_option(&server_universe, options, SV_DROP_UNKNOWN_RELAYS);
+	if ((oc != NULL) &&
+	    evaluate_boolean_option_cache(NULL, NULL, NULL, NULL, options, NULL,
+					  &global_scope, oc, MDL)) {
+		log_info("Dropping packets from unknown relays");
+		drop_unknown_relays = 1;
+	}
+
        oc = lookup_option(&server_universe, options, SV_SERVER_ID_CHECK);
        if ((oc != NULL) &&
 	   evaluate_boolean_option_cache(NULL, NULL, NULL, NULL, options, NULL,
@@ -1469,6 +1599,137 @@ void postconf_initialization (int quiet)
 	}
 #endif
 
+	oc = lookup_option(&server_universe, options, SV_LEASE_SNAPSHOT_FILE);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		s = dmalloc(db.len + 1, MDL);
+		if (!s)
+			log_fatal("no memory for lease snapshot filename.");
+		memcpy(s, db.data, db.len);
+		s[db.len] = 0;
+		data_string_forget(&db, MDL);
+		path_lease_snapshot = s;
+	}
+
+	oc = lookup_option(&server_universe, options, SV_LEASE_SNAPSHOT_SIZE);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 4) {
+			lease_snapshot_size = getULong(db.data);
+		} else {
+			log_fatal("invalid lease-snapshot-size");
+		}
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_EXPIRY_BATCH_SIZE);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 4) {
+			expiry_batch_size = getULong(db.data);
+		} else {
+			log_fatal("invalid expiry-batch-size");
+		}
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_ADMISSION_RATE);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 4) {
+			admission_rate = getULong(db.data);
+		} else {
+			log_fatal("invalid admission-rate");
+		}
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_ADMISSION_CLIENT_RATE);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 4) {
+			admission_client_rate = getULong(db.data);
+		} else {
+			log_fatal("invalid admission-client-rate");
+		}
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_ADMISSION_CLIENT_BURST);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 4) {
+			admission_client_burst = getULong(db.data);
+		} else {
+			log_fatal("invalid admission-client-burst");
+		}
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_ADMISSION_CLIENTS);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 4) {
+			admission_clients = getULong(db.data);
+		} else {
+			log_fatal("invalid admission-clients");
+		}
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_DUPLICATE_CACHE_TIME);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 4) {
+			dupcache_time = getULong(db.data);
+		} else {
+			log_fatal("invalid duplicate-cache-time");
+		}
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_DUPLICATE_CACHE_SIZE);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 4) {
+			dupcache_size = getULong(db.data);
+		} else {
+			log_fatal("invalid duplicate-cache-size");
+		}
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_METRICS_PORT);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 2) {
+			metrics_port = getUShort(db.data);
+		} else
+			log_fatal("invalid metrics port data length");
+		data_string_forget(&db, MDL);
+	}
+
+	oc = lookup_option(&server_universe, options, SV_METRICS_ADDRESS);
+	if (oc &&
+	    evaluate_option_cache(&db, NULL, NULL, NULL, options, NULL,
+				  &global_scope, oc, MDL)) {
+		if (db.len == 4) {
+			memcpy(&metrics_address, db.data, 4);
+		} else
+			log_fatal("invalid metrics address data length");
+		data_string_forget(&db, MDL);
+	}
+
 	/* Don't need the options anymore. */
 	option_state_dereference(&options, MDL);
 }
@@ -1496,17 +1757,28 @@ void lease_pinged (from, packet, length)
 	u_int8_t *packet;
 	int length;
 {
-	struct lease *lp;
+	struct lease *lp = (struct lease *)0;
+
+	/* Only replies that match a ping we sent are looked at, so
+	   nobody can make us churn by forging repeated ICMP EchoReply
+	   packets for us to look up. */
+	switch (ping_match (from, packet, length, &lp)) {
+	      case PING_OFFER:
+		break;
+
+	      case PING_AHEAD:
+		/* Something is answering at a free address; abandon it
+		   before anyone is offered it. */
+		if (!lp -> state && lp -> binding_state == FTS_FREE)
+			abandon_lease (lp, "answered ping ahead");
+		goto out;
 
-	/* Don't try to look up a pinged lease if we aren't trying to
-	   ping one - otherwise somebody could easily make us churn by
-	   just forging repeated ICMP EchoReply packets for us to look
-	   up. */
-	if (!outstanding_pings)
+	      case PING_VERIFIED:
+		log_debug ("ICMP Echo Reply for %s after ping ahead "
+			   "timed out.", piaddr (from));
 		return;
 
-	lp = (struct lease *)0;
-	if (!find_lease_by_ip_addr (&lp, from, MDL)) {
+	      default:
 		log_debug ("unexpected ICMP Echo Reply from %s",
 			   piaddr (from));
 		return;
@@ -1534,7 +1806,6 @@ void lease_pinged (from, packet, length)
 	lp -> state = (struct lease_state *)0;
 
 	abandon_lease (lp, "pinged before offer");
-	cancel_timeout (lease_ping_timeout, lp);
 	--outstanding_pings;
       out:
 	lease_dereference (&lp, MDL);
@@ -1767,6 +2038,8 @@ isc_result_t dhcp_set_control_state (control_object_state_t oldstate,
 {
 	struct timeval tv;
 
+	if (newstate == server_reload)
+		return reload_config();
 	if (newstate != server_shutdown)
 		return DHCP_R_INVALIDARG;
 	/* Re-entry. */
@@ -1774,6 +2047,13 @@ isc_result_t dhcp_set_control_state (control_object_state_t oldstate,
 		return ISC_R_SUCCESS;
 	shutdown_time = cur_time;
 	shutdown_state = shutdown_listeners;
+	expiry_log_stats();
+	admission_log_stats();
+	dupcache_log_stats();
+#if defined (NSUPDATE)
+	ddns_log_stats();
+	dns_zone_cache_save();
+#endif
 	/* Called by user. */
 	if (shutdown_signal == 0) {
 		shutdown_signal = SIGUSR1;
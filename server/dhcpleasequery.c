@@ -46,37 +46,23 @@
  * second, so we might not actually give the very latest IP.
  */
 
-static struct lease*
-next_hw(const struct lease *lease) {
-	/* INSIST(lease != NULL); */
-	return lease->n_hw;
-}
-
-static struct lease*
-next_uid(const struct lease *lease) {
-	/* INSIST(lease != NULL); */
-	return lease->n_uid;
-}
-
 void
 get_newest_lease(struct lease **retval,
-		 struct lease *lease,
-		 struct lease *(*next)(const struct lease *)) {
+		 const struct client_leases *set) {
 
 	struct lease *p;
 	struct lease *newest;
-
-	/* INSIST(newest != NULL); */
-	/* INSIST(next != NULL); */
+	unsigned i;
 
 	*retval = NULL;
 
-	if (lease == NULL) {
+	if (set == NULL) {
 		return;
 	}
 
-	newest = lease;
-	for (p=next(lease); p != NULL; p=next(p)) {
+	newest = set->leases[0];
+	for (i = 1; i < set->count; i++) {
+		p = set->leases[i];
 		if (newest->binding_state == FTS_ACTIVE) {
 			if ((p->binding_state == FTS_ACTIVE) && 
 		    	(p->cltt > newest->cltt)) {
@@ -93,24 +79,24 @@ get_newest_lease(struct lease **retval,
 }
 
 static int
-get_associated_ips(const struct lease *lease,
-		   struct lease *(*next)(const struct lease *), 
+get_associated_ips(const struct client_leases *set,
 		   const struct lease *newest,
 		   u_int32_t *associated_ips,
 		   unsigned int associated_ips_size) {
 
 	const struct lease *p;
+	unsigned i;
 	int cnt;
 
-	/* INSIST(next != NULL); */
 	/* INSIST(associated_ips != NULL); */
 
-	if (lease == NULL) {
+	if (set == NULL) {
 		return 0;
 	}
 
 	cnt = 0;
-	for (p=lease; p != NULL; p=next(p)) {
+	for (i = 0; i < set->count; i++) {
+		p = set->leases[i];
 		if ((p->binding_state == FTS_ACTIVE) && (p != newest)) {
 			if (cnt < associated_ips_size) {
 				memcpy(&associated_ips[cnt],
@@ -132,8 +118,10 @@ dhcpleasequery(struct packet *packet, int ms_nulltp) {
 	struct iaddr gip;
 	struct data_string uid;
 	struct hardware h;
-	struct lease *tmp_lease;
+	struct client_leases *set;
 	struct lease *lease;
+	struct pool *cip_pool = NULL;
+	int in_pool = 0;
 	int want_associated_ip;
 	int assoc_ip_cnt;
 	u_int32_t assoc_ips[40];  /* XXXSK: arbitrary maximum number of IPs */
@@ -256,7 +244,7 @@ dhcpleasequery(struct packet *packet, int ms_nulltp) {
 	 * are looking for information about that IP address.
 	 */
 	assoc_ip_cnt = 0;
-	lease = tmp_lease = NULL;
+	lease = NULL;
 	if (memcmp(cip.iabuf, "\0\0\0", 4)) {
 
 		want_associated_ip = 0;
@@ -264,6 +252,13 @@ dhcpleasequery(struct packet *packet, int ms_nulltp) {
 		snprintf(dbg_info, sizeof(dbg_info), "IP %s", piaddr(cip));
 		find_lease_by_ip_addr(&lease, cip, MDL);
 
+		/* An address in a pool that has never been used has no
+		   lease, but is still unassigned rather than unknown. */
+		if ((lease == NULL) && find_address_pool(&cip_pool, cip)) {
+			in_pool = 1;
+			pool_dereference(&cip_pool, MDL);
+		}
+
 
 	} else {
 
@@ -293,11 +288,10 @@ dhcpleasequery(struct packet *packet, int ms_nulltp) {
 				 "client-id %s",
 				 print_hex_1(uid.len, uid.data, 60));
 
-			find_lease_by_uid(&tmp_lease, uid.data, uid.len, MDL);
+			set = find_client_leases_by_uid(uid.data, uid.len);
 			data_string_forget(&uid, MDL);
-			get_newest_lease(&lease, tmp_lease, next_uid);
-			assoc_ip_cnt = get_associated_ips(tmp_lease,
-							  next_uid, 
+			get_newest_lease(&lease, set);
+			assoc_ip_cnt = get_associated_ips(set,
 							  lease,
 							  assoc_ips, 
 							  nassoc_ips);
@@ -324,18 +318,15 @@ dhcpleasequery(struct packet *packet, int ms_nulltp) {
 					       h.hlen - 1, 
 					       &h.hbuf[1]));
 
-			find_lease_by_hw_addr(&tmp_lease, h.hbuf, h.hlen, MDL);
-			get_newest_lease(&lease, tmp_lease, next_hw);
-			assoc_ip_cnt = get_associated_ips(tmp_lease,
-							  next_hw, 
+			set = find_client_leases_by_hw_addr(h.hbuf, h.hlen);
+			get_newest_lease(&lease, set);
+			assoc_ip_cnt = get_associated_ips(set,
 							  lease,
 							  assoc_ips, 
 							  nassoc_ips);
 
 		}
 
-		lease_dereference(&tmp_lease, MDL);
-
 		if (lease != NULL) {
 			memcpy(&packet->raw->ciaddr, 
 			       lease->ip_addr.iabuf,
@@ -364,7 +355,10 @@ dhcpleasequery(struct packet *packet, int ms_nulltp) {
 	/*
 	 * Figure our our return type.
 	 */
-	if (lease == NULL) {
+	if ((lease == NULL) && in_pool) {
+		dhcpMsgType = DHCPLEASEUNASSIGNED;
+		dhcp_msg_type_name = "DHCPLEASEUNASSIGNED";
+	} else if (lease == NULL) {
 		dhcpMsgType = DHCPLEASEUNKNOWN;
 		dhcp_msg_type_name = "DHCPLEASEUNKNOWN";
 	} else {
@@ -17,6 +17,7 @@
 /*! \file server/dhcpv6.c */
 
 #include "dhcpd.h"
+#include <sys/time.h>
 
 #ifdef DHCPv6
 
@@ -204,7 +205,9 @@ static void ddns_update_static6(struct reply_state* reply);
  * The inter-process communication receive handler.
  * Get the message, put it into the raw data_string
  * and call \ref send_dhcpv4_response() (DHCPv6 side) or
- * \ref recv_dhcpv4_query() (DHCPv4 side)
+ * \ref recv_dhcpv4_query() (DHCPv4 side).  Any messages on the shared
+ * memory ring are handled first; a doorbell on the socket only says
+ * that there are some.
  *
  * \param h the OMAPI object
  * \return a result for I/O success or error (used by the I/O subsystem)
@@ -219,6 +222,24 @@ isc_result_t dhcpv4o6_handler(omapi_object_t *h) {
 
 	cc = recv(dhcp4o6_fd, buf, sizeof(buf), 0);
 
+#if defined (DHCP4o6_RING)
+	/* Whatever woke us up, take the messages off the ring first: a
+	   message that came on the socket because the ring was full was
+	   sent after them. */
+	while (dhcp4o6_ring_get(&raw)) {
+		if (raw.len >= DHCP_FIXED_NON_UDP + offset_data4o6) {
+			if (local_family == AF_INET6)
+				send_dhcpv4_response(&raw);
+			else
+				recv_dhcpv4_query(&raw);
+		}
+		data_string_forget(&raw, MDL);
+	}
+#endif
+
+	if (cc > 0 && dhcp4o6_doorbell(buf, cc))
+		return ISC_R_SUCCESS;
+
 	if (cc < DHCP_FIXED_NON_UDP + offset_data4o6)
 		return ISC_R_UNEXPECTED;
 	memset(&raw, 0, sizeof(raw));
@@ -1993,6 +2014,7 @@ reply_process_ia_na(struct reply_state *reply, struct option_cache *ia) {
 	struct option_state *packet_ia;
 	struct option_cache *oc;
 	struct data_string ia_data, data;
+	struct timeval start;
 
 	/* Initialize values that will get cleaned up on return. */
 	packet_ia = NULL;
@@ -2141,7 +2163,11 @@ reply_process_ia_na(struct reply_state *reply, struct option_cache *ia) {
 	 * an address, give it one now.
 	 */
 	if ((status != ISC_R_CANCELED) && (reply->client_resources == 0)) {
+		PROBE_PACKET(LEASE_FIND_START, reply->packet);
+		METRICS_START(start);
 		status = find_client_address(reply);
+		METRICS_STOP(METRICS_ALLOCATE, start);
+		PROBE_PACKET(LEASE_FIND_DONE, reply->packet);
 
 		if (status == ISC_R_NORESOURCES) {
 			switch (reply->packet->dhcpv6_msg_type) {
@@ -2376,7 +2402,9 @@ reply_process_ia_na(struct reply_state *reply, struct option_cache *ia) {
 		/* If we couldn't reuse all of the iasubopts, we
 		* must update udpate the lease db */
 		if (must_commit) {
+			PROBE_PACKET(LEASE_UPDATE_START, reply->packet);
 			write_ia(reply->ia);
+			PROBE_PACKET(LEASE_UPDATE_DONE, reply->packet);
 		}
 	} else {
 		/* write the IA_NA in wire-format to the outbound buffer */
@@ -2834,6 +2862,7 @@ reply_process_ia_ta(struct reply_state *reply, struct option_cache *ia) {
 	struct data_string iaaddr;
 	u_int32_t pref_life, valid_life;
 	struct iaddr tmp_addr;
+	struct timeval start;
 
 	/* Initialize values that will get cleaned up on return. */
 	packet_ia = NULL;
@@ -2978,7 +3007,11 @@ reply_process_ia_ta(struct reply_state *reply, struct option_cache *ia) {
 	 */
 	if (reply->client_resources != 0)
 		goto store;
+	PROBE_PACKET(LEASE_FIND_START, reply->packet);
+	METRICS_START(start);
 	status = find_client_temporaries(reply);
+	METRICS_STOP(METRICS_ALLOCATE, start);
+	PROBE_PACKET(LEASE_FIND_DONE, reply->packet);
 	if (status == ISC_R_NORESOURCES) {
 		switch (reply->packet->dhcpv6_msg_type) {
 		      case DHCPV6_SOLICIT:
@@ -3158,7 +3191,9 @@ reply_process_ia_ta(struct reply_state *reply, struct option_cache *ia) {
 		/* If we couldn't reuse all of the iasubopts, we
 		* must update udpate the lease db */
 		if (must_commit) {
+			PROBE_PACKET(LEASE_UPDATE_START, reply->packet);
 			write_ia(reply->ia);
+			PROBE_PACKET(LEASE_UPDATE_DONE, reply->packet);
 		}
 	} else {
 		/* write the IA_TA in wire-format to the outbound buffer */
@@ -4069,6 +4104,7 @@ reply_process_ia_pd(struct reply_state *reply, struct option_cache *ia) {
 	struct option_state *packet_ia;
 	struct option_cache *oc;
 	struct data_string ia_data, data;
+	struct timeval start;
 
 	/* Initialize values that will get cleaned up on return. */
 	packet_ia = NULL;
@@ -4192,7 +4228,11 @@ reply_process_ia_pd(struct reply_state *reply, struct option_cache *ia) {
 	 * a prefix, give it one now.
 	 */
 	if ((status != ISC_R_CANCELED) && (reply->client_resources == 0)) {
+		PROBE_PACKET(LEASE_FIND_START, reply->packet);
+		METRICS_START(start);
 		status = find_client_prefix(reply);
+		METRICS_STOP(METRICS_ALLOCATE, start);
+		PROBE_PACKET(LEASE_FIND_DONE, reply->packet);
 
 		if (status == ISC_R_NORESOURCES) {
 			switch (reply->packet->dhcpv6_msg_type) {
@@ -4384,7 +4424,9 @@ reply_process_ia_pd(struct reply_state *reply, struct option_cache *ia) {
 		/* If we couldn't reuse all of the iasubopts, we
 		* must udpate the lease db */
 		if (must_commit) {
+			PROBE_PACKET(LEASE_UPDATE_START, reply->packet);
 			write_ia(reply->ia);
+			PROBE_PACKET(LEASE_UPDATE_DONE, reply->packet);
 		}
 	} else {
 		/* write the IA_PD in wire-format to the outbound buffer */
@@ -7512,9 +7554,8 @@ exit:
  * \brief packet the DHCPv6 DHCPv4-query message
  */
 static void forw_dhcpv4_query(struct packet *packet) {
-	struct data_string ds;
+	unsigned char hdr[36];
 	struct udp_data4o6 udp_data;
-	unsigned len;
 	int cc;
 
 	/* Get the initial message. */
@@ -7529,33 +7570,20 @@ static void forw_dhcpv4_query(struct packet *packet) {
 		return;
 	}
 
-	/* Get a buffer. */
-	len = packet->packet_length + 36;
-	memset(&ds, 0, sizeof(ds));
-	if (!buffer_allocate(&ds.buffer, len, MDL)) {
-		log_error("forw_dhcpv4_query: "
-			  "no memory for encapsulating packet.");
-		return;
-	}
-	ds.data = ds.buffer->data;
-	ds.len = len;
-
-	/* Fill the buffer. */
-	strncpy((char *)ds.buffer->data, packet->interface->name, 16);
-	memcpy(ds.buffer->data + 16,
-	       packet->client_addr.iabuf, 16);
+	/* Fill the header. */
+	memset(hdr, 0, sizeof(hdr));
+	strncpy((char *)hdr, packet->interface->name, 16);
+	memcpy(hdr + 16, packet->client_addr.iabuf, 16);
 	memset(&udp_data, 0, sizeof(udp_data));
 	udp_data.src_port = packet->client_port;
-	memcpy(ds.buffer->data + 32, &udp_data, 4);
-	memcpy(ds.buffer->data + 36,
-	       (unsigned char *)packet->raw,
-	       packet->packet_length);
+	memcpy(hdr + 32, &udp_data, 4);
 
 	/* Forward to the DHCPv4 server. */
-	cc = send(dhcp4o6_fd, ds.data, ds.len, 0);
+	cc = dhcp4o6_send(hdr, sizeof(hdr),
+			  (unsigned char *)packet->raw,
+			  packet->packet_length);
 	if (cc < 0)
 		log_error("forw_dhcpv4_query: send(): %m");
-	data_string_forget(&ds, MDL);
 }
 #endif
 
@@ -7730,6 +7758,9 @@ dhcpv6(struct packet *packet) {
 	struct data_string reply;
 	struct sockaddr_in6 to_addr;
 	int send_ret;
+	struct timeval start;
+
+	metrics_parsed();
 
 	/*
 	 * Log a message that we received this packet.
@@ -7739,7 +7770,9 @@ dhcpv6(struct packet *packet) {
 	/*
 	 * Build our reply packet.
 	 */
+	PROBE_PACKET(REPLY_BUILD_START, packet);
 	build_dhcpv6_reply(&reply, packet);
+	PROBE_PACKET(REPLY_BUILD_DONE, packet);
 
 	if (reply.data != NULL) {
 		/*
@@ -7782,12 +7815,18 @@ dhcpv6(struct packet *packet) {
 			 piaddr(packet->client_addr),
 			 ntohs(to_addr.sin6_port));
 
+		PROBE_PACKET(SEND_START, packet);
+		METRICS_START(start);
 		send_ret = send_packet6(packet->interface,
 					reply.data, reply.len, &to_addr);
+		METRICS_STOP(METRICS_SEND, start);
+		PROBE_PACKET(SEND_DONE, packet);
 		if (send_ret != reply.len) {
 			log_error("dhcpv6: send_packet6() sent %d of %d bytes",
 				  send_ret, reply.len);
-		}
+		} else
+			dupcache_reply6(packet->interface, reply.data,
+					reply.len, &to_addr);
 		data_string_forget(&reply, MDL);
 	}
 }
@@ -7815,7 +7854,7 @@ static void recv_dhcpv4_query(struct data_string *raw) {
 	struct data_string reply;
 	struct data_string ds;
 	struct udp_data4o6 udp_data;
-	unsigned len;
+	unsigned char hdr[36];
 	int cc;
 
 	memset(name, 0, sizeof(name));
@@ -7974,31 +8013,20 @@ static void recv_dhcpv4_query(struct data_string *raw) {
 	/*
 	 * Forward the response.
 	 */
-	len = reply.len + 36;
-	memset(&ds, 0, sizeof(ds));
-	if (!buffer_allocate(&ds.buffer, len, MDL)) {
-		log_error("recv_dhcpv4_query: no memory.");
-		packet_dereference(&packet, MDL);
-		return;
-	}
-	ds.data = ds.buffer->data;
-	ds.len = len;
-
-	memcpy(ds.buffer->data, name, 16);
-	memcpy(ds.buffer->data + 16, iaddr.iabuf, 16);
+	memcpy(hdr, name, 16);
+	memcpy(hdr + 16, iaddr.iabuf, 16);
 	udp_data.rsp_opt_exist = packet->relay_source_port ? 1 : 0;
-	memcpy(ds.buffer->data + 32, &udp_data, 4);
-	memcpy(ds.buffer->data + 36, reply.data, reply.len);
+	memcpy(hdr + 32, &udp_data, 4);
 
 	/*
 	 * Now we can release the packet.
 	 */
 	packet_dereference(&packet, MDL);
 
-	cc = send(dhcp4o6_fd, ds.data, ds.len, 0);
+	cc = dhcp4o6_send(hdr, sizeof(hdr), reply.data, reply.len);
 	if (cc < 0)
 		log_error("recv_dhcpv4_query: send(): %m");
-	data_string_forget(&ds, MDL);
+	data_string_forget(&reply, MDL);
 }
 #endif /* DHCP4o6 */
 
@@ -0,0 +1,585 @@
+/* dupcache.c
+
+   Suppression of retransmitted and duplicated client messages. */
+
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/*
+ * Clients retransmit with the same transaction ID, and relays sometimes
+ * pass on a packet twice.  Each copy would otherwise be run through
+ * class evaluation and lease lookup again, and a DHCPDISCOVER would get
+ * a new ping check and perhaps a different offer.  When
+ * duplicate-cache-time is set, each message is identified by:
+ *
+ * - the interface it came in on, its message type and transaction ID;
+ * - for DHCPv4, the giaddr, hardware address and client identifier;
+ * - for DHCPv6, the source address and port, whether it was unicast,
+ *   the link-address of the first relay and the client's DUID.
+ *
+ * The first copy is handled as usual and the reply sent for it is kept.
+ * A copy that arrives while the first is still being handled (usually
+ * because a ping check is outstanding) is dropped, and one that arrives
+ * within duplicate-cache-time of the reply gets the kept reply sent again
+ * the same way.
+ *
+ * Only DHCPDISCOVER and DHCPREQUEST are remembered for DHCPv4, as those
+ * are the messages answered through ack_lease(); the lease state carries
+ * the entry to dhcp_reply(), which may run after a ping check.  DHCPv6
+ * messages are answered before the handler returns, so the entry in use
+ * is simply remembered for dhcpv6() to fill in.
+ *
+ * A message that gets no reply, because it was NAKed, was for the peer
+ * server or was dropped, is forgotten when the handler returns, unless a
+ * lease state took the entry to answer it later; then it is forgotten if
+ * the lease state is freed without answering.  A retransmission is then
+ * handled afresh rather than dropped as a duplicate.
+ *
+ * The entries are kept in a table of duplicate-cache-size entries made at
+ * startup, four to a set.  Reply buffers are kept with the entries and
+ * reused, so once the table has warmed up nothing is allocated per
+ * packet.  The table is emptied when the configuration is reloaded.
+ */
+
+#include "dhcpd.h"
+
+#if defined (TRACING)
+# define send_packet trace_packet_send
+#endif
+
+/* The hash of an entry is that of its key, and the stamp is when it was
+   made or when the reply was sent. */
+struct dupcache_entry {
+	struct set_way way;
+	u_int32_t serial;	/* 0 if the entry is free */
+	int held;		/* taken by a lease state */
+	int replied;
+	unsigned key_len;
+	unsigned char key [DUPCACHE_KEY_MAX];
+
+	/* How the reply was sent. */
+	struct interface_info *ip;
+	struct in_addr from;
+	struct sockaddr_in to;
+	struct hardware hto;
+	int unicast;
+#ifdef DHCPv6
+	struct sockaddr_in6 to6;
+#endif
+	unsigned char *reply;
+	unsigned reply_len, reply_size;
+};
+
+u_int32_t dupcache_time = 0;
+u_int32_t dupcache_size = DEFAULT_DUPCACHE_SIZE;
+struct dupcache_stats dupcache_stats;
+
+static struct dupcache_entry *dup_table;
+static u_int32_t dup_set_mask;
+static u_int32_t dup_serial;
+
+/* The entry the packet being handled was put in, if any. */
+static u_int32_t current_slot, current_serial;
+
+static bootp_handler_t dupcache_handler;
+#ifdef DHCPv6
+static dhcpv6_handler_t dupcache_handler6;
+#endif
+
+/* What dupcache_check() is looking for. */
+struct dupcache_probe {
+	const unsigned char *key;
+	unsigned len;
+};
+
+static int
+dupcache_same(const struct set_way *way, const void *arg) {
+	const struct dupcache_entry *e = (const struct dupcache_entry *)way;
+	const struct dupcache_probe *probe = arg;
+
+	return (e->key_len == probe->len &&
+		memcmp(e->key, probe->key, probe->len) == 0);
+}
+
+static void
+dupcache_release(struct dupcache_entry *e) {
+	if (e->ip != NULL)
+		interface_dereference(&e->ip, MDL);
+	e->way.hash = 0;
+	e->serial = 0;
+	e->held = 0;
+	e->replied = 0;
+}
+
+/* The entry in a slot, if it is still the one it was. */
+static struct dupcache_entry *
+dupcache_entry(u_int32_t slot, u_int32_t serial) {
+	if (dup_table == NULL || serial == 0 ||
+	    slot >= (dup_set_mask + 1) * SET_WAYS ||
+	    dup_table[slot].serial != serial)
+		return (NULL);
+	return (&dup_table[slot]);
+}
+
+static void
+key_put(unsigned char *key, unsigned *len, const void *data, unsigned n) {
+	if (*len + n > DUPCACHE_KEY_MAX) {
+		*len = DUPCACHE_KEY_MAX + 1;
+		return;
+	}
+	memcpy(key + *len, data, n);
+	*len += n;
+}
+
+/*
+ * \brief Make the key for a DHCPv4 message
+ *
+ * \param index the index of the interface it arrived on
+ * \param raw the message
+ * \param len its length
+ * \param key where to put the key, DUPCACHE_KEY_MAX bytes
+ * \return the length of the key, or 0 if the message isn't remembered
+ */
+unsigned
+dupcache_key4(int index, const struct dhcp_packet *raw, unsigned len,
+	      unsigned char *key) {
+	const unsigned char *opt, *end;
+	unsigned char type;
+	unsigned klen = 0;
+
+	switch (replay_message_type(raw, len)) {
+	      case DHCPDISCOVER:
+		type = DHCPDISCOVER;
+		break;
+	      case DHCPREQUEST:
+		type = DHCPREQUEST;
+		break;
+	      default:
+		return (0);
+	}
+	if (raw->hlen > sizeof(raw->chaddr))
+		return (0);
+
+	key_put(key, &klen, "\4", 1);
+	key_put(key, &klen, &index, sizeof(index));
+	key_put(key, &klen, &type, 1);
+	key_put(key, &klen, &raw->xid, sizeof(raw->xid));
+	key_put(key, &klen, &raw->giaddr, sizeof(raw->giaddr));
+	key_put(key, &klen, &raw->htype, 1);
+	key_put(key, &klen, &raw->hlen, 1);
+	key_put(key, &klen, raw->chaddr, raw->hlen);
+
+	/* Add the client identifier, if there is one. */
+	opt = raw->options + 4;
+	end = (const unsigned char *)raw + len;
+	while (opt < end && *opt != DHO_END) {
+		if (*opt == DHO_PAD) {
+			opt++;
+			continue;
+		}
+		if (end - opt < 2 || end - opt < 2 + opt[1])
+			break;
+		if (*opt == DHO_DHCP_CLIENT_IDENTIFIER) {
+			key_put(key, &klen, opt + 1, 1 + opt[1]);
+			break;
+		}
+		opt += 2 + opt[1];
+	}
+
+	return (klen <= DUPCACHE_KEY_MAX ? klen : 0);
+}
+
+#ifdef DHCPv6
+/*
+ * \brief Make the key for a DHCPv6 message
+ *
+ * A relayed message is known by the client's message inside it and the
+ * link-address of the relay closest to the server.
+ *
+ * \param index the index of the interface it arrived on
+ * \param buf the message
+ * \param len its length
+ * \param from_port the port it came from
+ * \param from the address it came from
+ * \param was_unicast whether it was sent to a unicast address
+ * \param key where to put the key, DUPCACHE_KEY_MAX bytes
+ * \return the length of the key, or 0 if the message isn't remembered
+ */
+unsigned
+dupcache_key6(int index, const unsigned char *buf, unsigned len,
+	      int from_port, const struct iaddr *from, int was_unicast,
+	      unsigned char *key) {
+	static const unsigned char no_link [16];
+	const unsigned char *link = no_link;
+	const unsigned char *duid;
+	unsigned char flag = was_unicast ? 1 : 0;
+	u_int16_t port = (u_int16_t)from_port;
+	unsigned dlen, klen = 0;
+	const unsigned msg_hdr = offsetof(struct dhcpv6_packet, options);
+
+	/* Only clients and relays send to a server. */
+	if (len > 0 && buf[0] == DHCPV6_RELAY_REPL)
+		return (0);
+	buf = packet6_client_msg(buf, len, &len, &link);
+	if (buf == NULL)
+		return (0);
+
+	switch (buf[0]) {
+	      case DHCPV6_SOLICIT:
+	      case DHCPV6_REQUEST:
+	      case DHCPV6_CONFIRM:
+	      case DHCPV6_RENEW:
+	      case DHCPV6_REBIND:
+	      case DHCPV6_RELEASE:
+	      case DHCPV6_DECLINE:
+	      case DHCPV6_INFORMATION_REQUEST:
+		break;
+	      default:
+		return (0);
+	}
+
+	duid = packet6_find_option(buf + msg_hdr, len - msg_hdr, D6O_CLIENTID,
+				   &dlen);
+	if (duid == NULL || dlen == 0 || from->len != 16)
+		return (0);
+
+	key_put(key, &klen, "\6", 1);
+	key_put(key, &klen, &index, sizeof(index));
+	key_put(key, &klen, buf, msg_hdr);	/* type and transaction ID */
+	key_put(key, &klen, from->iabuf, 16);
+	key_put(key, &klen, &port, sizeof(port));
+	key_put(key, &klen, &flag, 1);
+	key_put(key, &klen, link, 16);
+	key_put(key, &klen, duid, dlen);
+
+	return (klen <= DUPCACHE_KEY_MAX ? klen : 0);
+}
+#endif /* DHCPv6 */
+
+/*
+ * \brief Look up a message, remembering it if it is new
+ *
+ * A new message is put in the table and made the current one, for
+ * dupcache_current() and dupcache_reply6() to find while it is handled.
+ *
+ * \param key the message's key
+ * \param len the length of the key
+ * \param entry set to the entry found, for dupcache_resend()
+ * \return DUPCACHE_NEW, DUPCACHE_PENDING or DUPCACHE_REPLIED
+ */
+int
+dupcache_check(const unsigned char *key, unsigned len,
+	       struct dupcache_entry **entry) {
+	struct dupcache_probe probe;
+	struct dupcache_entry *e;
+	struct set_way *way;
+	u_int32_t now = cur_ms;
+	u_int32_t hash = admission_key(key, len);
+
+	current_serial = 0;
+	probe.key = key;
+	probe.len = len;
+
+	e = &dup_table[(hash & dup_set_mask) * SET_WAYS];
+	switch (set_assoc_find(e, sizeof(*e), hash, now, dupcache_time * 1000,
+			       dupcache_same, &probe, &way)) {
+	      case SET_FOUND:
+		e = (struct dupcache_entry *)way;
+		*entry = e;
+		if (!e->replied) {
+			dupcache_stats.dropped++;
+			return (DUPCACHE_PENDING);
+		}
+		return (DUPCACHE_REPLIED);
+	      case SET_EVICTED:
+		dupcache_stats.evicted++;
+		break;
+	}
+
+	e = (struct dupcache_entry *)way;
+	dupcache_release(e);
+
+	if (++dup_serial == 0)
+		dup_serial = 1;
+	e->serial = dup_serial;
+	e->way.hash = hash;
+	e->way.stamp = now;
+	e->key_len = len;
+	memcpy(e->key, key, len);
+
+	current_slot = e - dup_table;
+	current_serial = e->serial;
+	*entry = e;
+	return (DUPCACHE_NEW);
+}
+
+/* The entry made for the packet being handled, to be handed to
+   dupcache_reply4() along with the lease state; zero if there is none.
+   The entry is then kept when the handler returns, until the lease state
+   is answered or freed. */
+void
+dupcache_current(u_int32_t *slot, u_int32_t *serial) {
+	struct dupcache_entry *e;
+
+	*slot = current_slot;
+	*serial = current_serial;
+	e = dupcache_entry(current_slot, current_serial);
+	if (e != NULL)
+		e->held = 1;
+}
+
+/* Forget the entry a lease state carries, if no reply was kept for it,
+   as the lease state is freed. */
+void
+dupcache_forget(u_int32_t slot, u_int32_t serial) {
+	struct dupcache_entry *e;
+
+	e = dupcache_entry(slot, serial);
+	if (e != NULL && !e->replied)
+		dupcache_release(e);
+}
+
+/* The handler has returned.  Forget the message it was handling if it
+   wasn't answered and no lease state took it to answer later. */
+static void
+dupcache_done(void) {
+	struct dupcache_entry *e;
+
+	e = dupcache_entry(current_slot, current_serial);
+	if (e != NULL && !e->replied && !e->held)
+		dupcache_release(e);
+	current_serial = 0;
+}
+
+/* Keep a reply in an entry, if the entry is still the one it was. */
+static struct dupcache_entry *
+dupcache_keep(u_int32_t slot, u_int32_t serial, struct interface_info *ip,
+	      const void *reply, unsigned len) {
+	struct dupcache_entry *e;
+
+	e = dupcache_entry(slot, serial);
+	if (e == NULL || e->replied)
+		return (NULL);
+
+	if (e->reply_size < len) {
+		if (e->reply != NULL)
+			dfree(e->reply, MDL);
+		e->reply = dmalloc(len, MDL);
+		if (e->reply == NULL) {
+			e->reply_size = 0;
+			return (NULL);
+		}
+		e->reply_size = len;
+	}
+	memcpy(e->reply, reply, len);
+	e->reply_len = len;
+	if (e->ip != NULL)
+		interface_dereference(&e->ip, MDL);
+	interface_reference(&e->ip, ip, MDL);
+	e->replied = 1;
+	e->way.stamp = cur_ms;
+	dupcache_stats.stored++;
+	return (e);
+}
+
+/* Keep the DHCPv4 reply just sent for the entry a lease state carries,
+   with what send_packet() was given to send it. */
+void
+dupcache_reply4(u_int32_t slot, u_int32_t serial, struct interface_info *ip,
+		const struct dhcp_packet *raw, unsigned len,
+		struct in_addr from, const struct sockaddr_in *to,
+		const struct hardware *hto) {
+	struct dupcache_entry *e;
+
+	e = dupcache_keep(slot, serial, ip, raw, len);
+	if (e == NULL)
+		return;
+	e->from = from;
+	e->to = *to;
+	e->unicast = (hto != NULL);
+	if (hto != NULL)
+		e->hto = *hto;
+}
+
+#ifdef DHCPv6
+/* Keep the DHCPv6 reply just sent for the message being handled. */
+void
+dupcache_reply6(struct interface_info *ip, const unsigned char *raw,
+		unsigned len, const struct sockaddr_in6 *to) {
+	struct dupcache_entry *e;
+
+	e = dupcache_keep(current_slot, current_serial, ip, raw, len);
+	if (e != NULL)
+		e->to6 = *to;
+}
+#endif
+
+/* Send a kept reply again. */
+static void
+dupcache_resend(struct dupcache_entry *e) {
+	int result;
+
+	dupcache_stats.resent++;
+#ifdef DHCPv6
+	if (e->key[0] == 6) {
+		result = send_packet6(e->ip, e->reply, e->reply_len, &e->to6);
+		if (result < 0)
+			log_error("Failed to resend %u byte reply over %s "
+				  "interface.", e->reply_len, e->ip->name);
+		return;
+	}
+#endif
+	result = send_packet(e->ip, NULL, (struct dhcp_packet *)e->reply,
+			     e->reply_len, e->from, &e->to,
+			     e->unicast ? &e->hto : NULL);
+	if (result < 0)
+		log_error("Failed to resend %u byte reply over %s interface.",
+			  e->reply_len, e->ip->name);
+}
+
+static void
+dupcache_packet(struct interface_info *ip, struct dhcp_packet *raw,
+		unsigned len, unsigned int from_port, struct iaddr from,
+		struct hardware *hfrom)
+{
+	unsigned char key [DUPCACHE_KEY_MAX];
+	struct dupcache_entry *e;
+	unsigned klen;
+
+	klen = dupcache_key4(ip->index, raw, len, key);
+	if (klen != 0) {
+		switch (dupcache_check(key, klen, &e)) {
+		      case DUPCACHE_PENDING:
+			return;
+		      case DUPCACHE_REPLIED:
+			dupcache_resend(e);
+			return;
+		}
+	}
+	(*dupcache_handler)(ip, raw, len, from_port, from, hfrom);
+	dupcache_done();
+}
+
+#ifdef DHCPv6
+static void
+dupcache_packet6(struct interface_info *ip, const char *buf, int len,
+		 int from_port, const struct iaddr *from,
+		 isc_boolean_t was_unicast)
+{
+	unsigned char key [DUPCACHE_KEY_MAX];
+	struct dupcache_entry *e;
+	unsigned klen = 0;
+
+	if (len > 0)
+		klen = dupcache_key6(ip->index, (const unsigned char *)buf,
+				     (unsigned)len, from_port, from,
+				     was_unicast == ISC_TRUE, key);
+	if (klen != 0) {
+		switch (dupcache_check(key, klen, &e)) {
+		      case DUPCACHE_PENDING:
+			return;
+		      case DUPCACHE_REPLIED:
+			dupcache_resend(e);
+			return;
+		}
+	}
+	(*dupcache_handler6)(ip, buf, len, from_port, from, was_unicast);
+	dupcache_done();
+}
+#endif /* DHCPv6 */
+
+/* Forget every message, as when the configuration is reloaded and the
+   kept replies may no longer be what the server would send. */
+void
+dupcache_flush(void) {
+	u_int32_t i;
+
+	if (dup_table == NULL)
+		return;
+	for (i = 0; i < (dup_set_mask + 1) * SET_WAYS; i++)
+		dupcache_release(&dup_table[i]);
+	current_serial = 0;
+}
+
+/* Make the table.  Returns zero if there is nothing to do. */
+int
+dupcache_init(void) {
+	u_int32_t sets, i;
+
+	if (dup_table != NULL) {
+		for (i = 0; i < (dup_set_mask + 1) * SET_WAYS; i++) {
+			dupcache_release(&dup_table[i]);
+			if (dup_table[i].reply != NULL)
+				dfree(dup_table[i].reply, MDL);
+		}
+		dfree(dup_table, MDL);
+		dup_table = NULL;
+	}
+	memset(&dupcache_stats, 0, sizeof(dupcache_stats));
+	current_serial = 0;
+	if (dupcache_time > 3600)
+		dupcache_time = 3600;
+	if (dupcache_time == 0)
+		return (0);
+
+	for (sets = 1; sets * 2 * SET_WAYS <= dupcache_size &&
+	     sets < 0x1000000; sets *= 2)
+		;
+	dup_table = dmalloc(sets * SET_WAYS * sizeof(*dup_table), MDL);
+	if (dup_table == NULL)
+		log_fatal("No memory for %u duplicate cache entries.",
+			  sets * SET_WAYS);
+	dup_set_mask = sets - 1;
+	return (1);
+}
+
+/* Put the duplicate cache in front of the packet handlers, if
+   configured. */
+void
+dupcache_setup(void) {
+	if (!dupcache_init())
+		return;
+
+	push_packet_handler(&dupcache_handler, dupcache_packet);
+#ifdef DHCPv6
+	push_packet_handler6(&dupcache_handler6, dupcache_packet6);
+#endif
+	log_info("Duplicate cache: %u seconds, %u entries", dupcache_time,
+		 (dup_set_mask + 1) * SET_WAYS);
+}
+
+/* Summarize what the duplicate cache did. */
+void
+dupcache_log_stats(void) {
+	const struct dupcache_stats *s = &dupcache_stats;
+
+	if (s->stored + s->resent + s->dropped == 0)
+		return;
+
+	log_info("Duplicate cache: %llu replies kept, %llu resent, "
+		 "%llu duplicates dropped while pending, %llu evicted",
+		 (unsigned long long)s->stored,
+		 (unsigned long long)s->resent,
+		 (unsigned long long)s->dropped,
+		 (unsigned long long)s->evicted);
+}
@@ -4681,6 +4681,8 @@ isc_result_t dhcp_failover_send_bind_update (dhcp_failover_state_t *state,
 	if (!link -> outer || link -> outer -> type != omapi_type_connection)
 		return DHCP_R_INVALIDARG;
 
+	PROBE_LEASE(FAILOVER_UPDATE_START, lease);
+
 	transmit_state = lease->desired_binding_state;
 	if (lease->flags & RESERVED_LEASE) {
 		/* If we are listing an allocable (not yet ACTIVE etc) lease
@@ -4779,6 +4781,7 @@ isc_result_t dhcp_failover_send_bind_update (dhcp_failover_state_t *state,
 		log_debug ("%s", obuf);
 	}
 #endif
+	PROBE_LEASE(FAILOVER_UPDATE_DONE, lease);
 	return status;
 }
 
@@ -5191,7 +5194,7 @@ isc_result_t dhcp_failover_process_bind_update (dhcp_failover_state_t *state,
 	ia.len = sizeof msg -> assigned_addr;
 	memcpy (ia.iabuf, &msg -> assigned_addr, ia.len);
 
-	if (!find_lease_by_ip_addr (&lease, ia, MDL)) {
+	if (!use_lease_by_ip_addr (&lease, ia, MDL)) {
 		message = "unknown IP address";
 		reason = FTR_ILLEGAL_IP_ADDR;
 		goto bad;
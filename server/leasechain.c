@@ -95,44 +95,45 @@ lc_not_empty( struct leasechain *lc ) {
 
 /*!
  *
- * \brief Get the first lease from a leasechain
+ * \brief Get the next lease from the chain, based on the lease passed in.
  *
  * \param lc The leasechain to check
+ * \param lp The lease to start from
  *
- * \return A pointer to the first lease from a lease chain, or NULL if none found
+ * \return The next lease in the ordered list after lp
  */
 struct lease *
-lc_get_first_lease(struct leasechain *lc) {
+lc_get_next(struct leasechain *lc, struct lease *lp) {
 #if defined (DEBUG_BINARY_LEASES)
-	log_debug("LC Get first %s:%d", MDL);
+	log_debug("LC Get next %s:%d", MDL);
 	INSIST(lc != NULL);
-	INSIST(lc->total >= lc->nelem);
+	INSIST(lp != NULL);
 #endif
 
-	if (lc->nelem > 0) {
-		return (lc->list)[0];
-	}
-	return (NULL);
+	return lp->next;
 }
 
+#if !defined (LEASECHAIN_BLOCKS)
 /*!
  *
- * \brief Get the next lease from the chain, based on the lease passed in.
+ * \brief Get the first lease from a leasechain
  *
  * \param lc The leasechain to check
- * \param lp The lease to start from
  *
- * \return The next lease in the ordered list after lp
+ * \return A pointer to the first lease from a lease chain, or NULL if none found
  */
 struct lease *
-lc_get_next(struct leasechain *lc, struct lease *lp) {
+lc_get_first_lease(struct leasechain *lc) {
 #if defined (DEBUG_BINARY_LEASES)
-	log_debug("LC Get next %s:%d", MDL);
+	log_debug("LC Get first %s:%d", MDL);
 	INSIST(lc != NULL);
-	INSIST(lp != NULL);
+	INSIST(lc->total >= lc->nelem);
 #endif
 
-	return lp->next;
+	if (lc->nelem > 0) {
+		return (lc->list)[0];
+	}
+	return (NULL);
 }
 
 /*!
@@ -679,6 +680,464 @@ lc_delete_all(struct leasechain *lc) {
 	lc->nelem = 0;
 }
 
+#else /* LEASECHAIN_BLOCKS */
+/*
+ * The leasechain as a list of blocks.  Each block holds up to
+ * LC_BLOCK_SIZE entries in order, and each entry holds a copy of the
+ * sort key of its lease.  The last entry of each block is also copied
+ * into the last array, so finding a lease takes a binary search of that
+ * array and then of one block, and reads no leases.  Adding a lease moves
+ * the entries after it in its block; a full block is split in two, and a
+ * block is merged with its neighbour when they have few entries between
+ * them.  The leases are also kept on their linked list as above.
+ */
+
+/*!
+ *
+ * \brief Compare the key of an entry to the key of a lease
+ *
+ * \return less than, equal to or greater than zero as the entry sorts
+ * before, with or after the lease
+ */
+static int
+lc_entry_cmp(const struct lc_entry *e, TIME sort_time, long int tiebreaker) {
+	if (e->sort_time != sort_time)
+		return (e->sort_time < sort_time ? -1 : 1);
+	if (e->sort_tiebreaker != tiebreaker)
+		return (e->sort_tiebreaker < tiebreaker ? -1 : 1);
+	return (0);
+}
+
+/*!
+ *
+ * \brief Find the first block whose last entry sorts after a key, or
+ * with it if equal is set
+ *
+ * \return The index of the block, or nblocks if there is none
+ */
+static size_t
+lc_find_block(struct leasechain *lc, TIME sort_time, long int tiebreaker,
+	      int equal) {
+	size_t lo = 0, hi = lc->nblocks, mid;
+	int c;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		c = lc_entry_cmp(&lc->last[mid], sort_time, tiebreaker);
+		if (c < 0 || (c == 0 && !equal))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+/*!
+ *
+ * \brief Find the first entry in a block that sorts after a key, or with
+ * it if equal is set
+ */
+static size_t
+lc_find_entry(struct lc_block *b, TIME sort_time, long int tiebreaker,
+	      int equal) {
+	size_t lo = 0, hi = b->nelem, mid;
+	int c;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		c = lc_entry_cmp(&b->list[mid], sort_time, tiebreaker);
+		if (c < 0 || (c == 0 && !equal))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+/*!
+ *
+ * \brief Insert an empty block into the list at position n
+ *
+ * If we are unable to allocate memory we log a fatal error, as the
+ * array version does.
+ */
+static struct lc_block *
+lc_new_block(struct leasechain *lc, size_t n) {
+	struct lc_block *b;
+	struct lc_block **blocks;
+	struct lc_entry *last;
+	size_t max;
+
+	if (lc->nblocks == lc->maxblocks) {
+		max = lc->maxblocks + lc->growth / LC_BLOCK_SIZE;
+		if (max < lc->maxblocks * 2)
+			max = lc->maxblocks * 2;
+		if (max < 4)
+			max = 4;
+		blocks = dmalloc(sizeof(*blocks) * max, MDL);
+		last = dmalloc(sizeof(*last) * max, MDL);
+		if (blocks == NULL || last == NULL) {
+			log_fatal("LC grow, unable to allocated memory %s:%d",
+				  MDL);
+		}
+		if (lc->blocks != NULL) {
+			memcpy(blocks, lc->blocks,
+			       sizeof(*blocks) * lc->nblocks);
+			memcpy(last, lc->last, sizeof(*last) * lc->nblocks);
+			dfree(lc->blocks, MDL);
+			dfree(lc->last, MDL);
+		}
+		lc->blocks = blocks;
+		lc->last = last;
+		lc->maxblocks = max;
+	}
+
+	b = dmalloc(sizeof(*b), MDL);
+	if (b == NULL) {
+		log_fatal("LC grow, unable to allocated memory %s:%d", MDL);
+	}
+
+	if (n < lc->nblocks) {
+		memmove(lc->blocks + n + 1, lc->blocks + n,
+			sizeof(*lc->blocks) * (lc->nblocks - n));
+		memmove(lc->last + n + 1, lc->last + n,
+			sizeof(*lc->last) * (lc->nblocks - n));
+	}
+	lc->blocks[n] = b;
+	lc->nblocks++;
+	return (b);
+}
+
+/*!
+ *
+ * \brief Remove the (empty) block at position n from the list and free it
+ */
+static void
+lc_free_block(struct leasechain *lc, size_t n) {
+	dfree(lc->blocks[n], MDL);
+	lc->nblocks--;
+	if (n < lc->nblocks) {
+		memmove(lc->blocks + n, lc->blocks + n + 1,
+			sizeof(*lc->blocks) * (lc->nblocks - n));
+		memmove(lc->last + n, lc->last + n + 1,
+			sizeof(*lc->last) * (lc->nblocks - n));
+	}
+}
+
+/*!
+ *
+ * \brief Move the entries of block n + 1 into block n if they fit
+ * comfortably, so that blocks don't stay nearly empty
+ */
+static void
+lc_merge_blocks(struct leasechain *lc, size_t n) {
+	struct lc_block *b, *next;
+
+	if (n + 1 >= lc->nblocks)
+		return;
+	b = lc->blocks[n];
+	next = lc->blocks[n + 1];
+	if (b->nelem + next->nelem > LC_BLOCK_SIZE / 2)
+		return;
+
+	memcpy(b->list + b->nelem, next->list,
+	       sizeof(next->list[0]) * next->nelem);
+	b->nelem += next->nelem;
+	lc->last[n] = lc->last[n + 1];
+	next->nelem = 0;
+	lc_free_block(lc, n + 1);
+}
+
+/*!
+ *
+ * \brief Get the first lease from a leasechain
+ *
+ * \param lc The leasechain to check
+ *
+ * \return A pointer to the first lease from a lease chain, or NULL if none found
+ */
+struct lease *
+lc_get_first_lease(struct leasechain *lc) {
+#if defined (DEBUG_BINARY_LEASES)
+	log_debug("LC Get first %s:%d", MDL);
+	INSIST(lc != NULL);
+#endif
+
+	if (lc->nelem > 0) {
+		return (lc->blocks[0]->list[0].lease);
+	}
+	return (NULL);
+}
+
+/*!
+ *
+ * \brief Add a lease into the sorted lease and lease chain
+ *
+ * The sort_tiebreaker is chosen as described for the array version
+ * above.
+ *
+ * \param lc The leasechain in which to insert the lease
+ * \param lp The lease to insert
+ */
+void
+lc_add_sorted_lease(struct leasechain *lc, struct lease *lp) {
+	struct lc_block *b, *nb;
+	struct lc_entry *tail;
+	struct lease *prev, *next;
+	size_t bn, pos, half;
+
+#if defined (DEBUG_BINARY_LEASES)
+	log_debug("LC add sorted %s:%d", MDL);
+	INSIST (lc != NULL);
+	INSIST (lp != NULL);
+#endif
+
+	if (lc->nelem == 0) {
+		lp->sort_tiebreaker = 0;
+		bn = lc->nblocks;
+		pos = 0;
+	} else {
+		tail = &lc->last[lc->nblocks - 1];
+		if (lp->sort_time > tail->sort_time) {
+			/* Adding to end of queue, with a different sort time */
+			lp->sort_tiebreaker = 0;
+		} else if (lp->sort_time == tail->sort_time) {
+			/* Adding to end of queue, with the same sort time */
+			if (tail->sort_tiebreaker < LONG_MAX)
+				lp->sort_tiebreaker = tail->sort_tiebreaker + 1;
+			else
+				lp->sort_tiebreaker = LONG_MAX;
+		} else {
+			/* Adding somewhere in the queue */
+			lp->sort_tiebreaker = random();
+		}
+
+		bn = lc_find_block(lc, lp->sort_time, lp->sort_tiebreaker, 0);
+		if (bn == lc->nblocks) {
+			/* After everything: append to the last block, or
+			 * start a new one if it is full rather than
+			 * splitting it, as leases mostly go on the end. */
+			bn = lc->nblocks - 1;
+			pos = lc->blocks[bn]->nelem;
+			if (pos == LC_BLOCK_SIZE) {
+				bn = lc->nblocks;
+				pos = 0;
+			}
+		} else {
+			pos = lc_find_entry(lc->blocks[bn], lp->sort_time,
+					    lp->sort_tiebreaker, 0);
+		}
+	}
+
+	if (bn == lc->nblocks) {
+		b = lc_new_block(lc, bn);
+		b->nelem = 0;
+	} else {
+		b = lc->blocks[bn];
+		if (b->nelem == LC_BLOCK_SIZE) {
+			/* Split the block, and carry on in whichever half
+			 * the lease goes in */
+			half = LC_BLOCK_SIZE / 2;
+			nb = lc_new_block(lc, bn + 1);
+			b = lc->blocks[bn];
+			memcpy(nb->list, b->list + half,
+			       sizeof(b->list[0]) * (LC_BLOCK_SIZE - half));
+			nb->nelem = LC_BLOCK_SIZE - half;
+			b->nelem = half;
+			lc->last[bn + 1] = lc->last[bn];
+			lc->last[bn] = b->list[half - 1];
+			if (pos > half) {
+				bn++;
+				pos -= half;
+				b = nb;
+			}
+		}
+	}
+
+	/* Find the neighbours in the linked list before moving things */
+	prev = NULL;
+	next = NULL;
+	if (pos > 0)
+		prev = b->list[pos - 1].lease;
+	else if (bn > 0)
+		prev = lc->last[bn - 1].lease;
+	if (pos < b->nelem)
+		next = b->list[pos].lease;
+	else if (bn + 1 < lc->nblocks)
+		next = lc->blocks[bn + 1]->list[0].lease;
+
+	if (pos < b->nelem) {
+		memmove(b->list + pos + 1, b->list + pos,
+			sizeof(b->list[0]) * (b->nelem - pos));
+	}
+	b->list[pos].sort_time = lp->sort_time;
+	b->list[pos].sort_tiebreaker = lp->sort_tiebreaker;
+	b->list[pos].lease = NULL;
+	lease_reference(&b->list[pos].lease, lp, MDL);
+	b->nelem++;
+	if (pos == b->nelem - 1)
+		lc->last[bn] = b->list[pos];
+	lc->nelem++;
+	lp->lc = lc;
+
+	/* and link it into the linked list */
+	if (prev != NULL) {
+		if (prev->next) {
+			lease_dereference(&prev->next, MDL);
+		}
+		lease_reference(&prev->next, lp, MDL);
+		lease_reference(&lp->prev, prev, MDL);
+	}
+	if (next != NULL) {
+		if (next->prev) {
+			lease_dereference(&next->prev, MDL);
+		}
+		lease_reference(&next->prev, lp, MDL);
+		lease_reference(&lp->next, next, MDL);
+	}
+
+#if defined (DEBUG_BINARY_LEASES)
+	log_debug("LC add sorted complete block %zu position %zu, "
+		  "elements %zu, %s:%d", bn, pos, lc->nelem, MDL);
+#endif
+}
+
+/*!
+ *
+ * \brief Remove the entry at a position from a leasechain and unlink its
+ * lease from the linked list
+ *
+ * \param lc The lease chain to update
+ * \param bn The block the entry is in
+ * \param pos The position of the entry in the block
+ */
+static void
+lc_unlink_entry(struct leasechain *lc, size_t bn, size_t pos) {
+	struct lc_block *b = lc->blocks[bn];
+	struct lease *lp = NULL;
+
+	lease_reference(&lp, b->list[pos].lease, MDL);
+	lp->lc = NULL;
+	lease_dereference(&b->list[pos].lease, MDL);
+
+	if (pos < b->nelem - 1) {
+		memmove(b->list + pos, b->list + pos + 1,
+			sizeof(b->list[0]) * (b->nelem - 1 - pos));
+	}
+	b->nelem--;
+	lc->nelem--;
+
+	if (b->nelem == 0) {
+		lc_free_block(lc, bn);
+	} else {
+		lc->last[bn] = b->list[b->nelem - 1];
+		if (b->nelem < LC_BLOCK_SIZE / 4) {
+			lc_merge_blocks(lc, bn);
+			if (bn > 0)
+				lc_merge_blocks(lc, bn - 1);
+		}
+	}
+
+	/* unlink from the linked list */
+	if (lp->next) {
+		lease_dereference(&lp->next->prev, MDL);
+		if (lp->prev)
+			lease_reference(&lp->next->prev, lp->prev, MDL);
+	}
+	if (lp->prev) {
+		lease_dereference(&lp->prev->next, MDL);
+		if (lp->next)
+			lease_reference(&lp->prev->next, lp->next, MDL);
+		lease_dereference(&lp->prev, MDL);
+	}
+	if (lp->next) {
+		lease_dereference(&lp->next, MDL);
+	}
+	lease_dereference(&lp, MDL);
+}
+
+/*!
+ *
+ * \brief Find a lease in the lease chain and then remove it
+ * If we can't find the lease on the given lease chain it's a fatal error.
+ *
+ * As sort_time/sort_tiebreaker may not be unique, we look at each entry
+ * with the lease's key, which may run on into the following blocks.
+ *
+ * \param lc The lease chain to update
+ * \param lp The lease to remove
+ */
+void
+lc_unlink_lease(struct leasechain *lc, struct lease *lp) {
+	struct lc_block *b;
+	size_t bn, pos;
+
+#if defined (DEBUG_BINARY_LEASES)
+	log_debug("LC unlink lease %s:%d", MDL);
+
+	INSIST(lc != NULL);
+	INSIST(lp != NULL );
+	INSIST(lp->lc != NULL );
+	INSIST(lp->lc == lc );
+#endif
+
+	bn = lc_find_block(lc, lp->sort_time, lp->sort_tiebreaker, 1);
+	if (bn < lc->nblocks) {
+		pos = lc_find_entry(lc->blocks[bn], lp->sort_time,
+				    lp->sort_tiebreaker, 1);
+		for (; bn < lc->nblocks; bn++, pos = 0) {
+			b = lc->blocks[bn];
+			for (; pos < b->nelem; pos++) {
+				if (b->list[pos].lease == lp) {
+					lc_unlink_entry(lc, bn, pos);
+					return;
+				}
+				if (lc_entry_cmp(&b->list[pos], lp->sort_time,
+						 lp->sort_tiebreaker) != 0)
+					break;
+			}
+			if (pos < b->nelem)
+				break;
+		}
+	}
+
+	/* fatal, lease not found in leasechain */
+	log_fatal("Lease with binding state %s not on its queue.",
+		  (lp->binding_state < 1 ||
+		   lp->binding_state > FTS_LAST)
+		  ? "unknown"
+		  : binding_state_names[lp->binding_state - 1]);
+}
+
+/*!
+ *
+ * \brief Unlink all the leases in the lease chain and free the
+ * lease chain structure.  The leases will be freed if and when
+ * any other references to them are cleared.
+ *
+ * \param lc the lease chain to clear
+ */
+void
+lc_delete_all(struct leasechain *lc) {
+	/* delete from the end, to avoid moving entries */
+	while (lc->nblocks > 0) {
+		lc_unlink_entry(lc, lc->nblocks - 1,
+				lc->blocks[lc->nblocks - 1]->nelem - 1);
+	}
+
+	if (lc->blocks != NULL) {
+		dfree(lc->blocks, MDL);
+		dfree(lc->last, MDL);
+		lc->blocks = NULL;
+		lc->last = NULL;
+	}
+
+	lc->maxblocks = 0;
+	lc->nelem = 0;
+}
+
+#endif /* LEASECHAIN_BLOCKS */
+
 /*!
  *
  * \brief Set the growth value.  This is the number of elements to
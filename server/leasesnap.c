@@ -0,0 +1,318 @@
+/* leasesnap.c
+
+   Maintain a shared-memory snapshot of the lease database. */
+
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/*! \file server/leasesnap.c
+ *
+ * \page leasesnap lease snapshot overview
+ *
+ * When lease-snapshot-file is configured the server creates that file,
+ * maps it shared and keeps one fixed size record per lease in it.  The
+ * layout is described in dhcpctl/leasesnap.h, which is also used by the
+ * reader side in libdhcpctl and by the leasedump utility.
+ *
+ * Records are updated from supersede_lease() for DHCPv4 and from
+ * write_ia() for DHCPv6, i.e. at the same points the lease is handed
+ * to the lease file.  Each lease remembers the slot it was given in
+ * its snap_slot field (slot + 1, so zero means no slot).  A DHCPv4
+ * lease's slot is returned when a configuration reload drops the lease
+ * because its address is no longer configured (see reload_drop_lease()
+ * in reload.c); DHCPv6 slots are returned when the iasubopt is freed.
+ *
+ * Free addresses that have never been touched do not appear in the
+ * snapshot at all; readers should treat a missing address as free.
+ */
+
+#include "dhcpd.h"
+#include "dhcpctl/leasesnap.h"
+#include <sys/mman.h>
+
+static struct leasesnap_header *snap_header = NULL;
+static volatile struct leasesnap_record *snap_records = NULL;
+static size_t snap_size = 0;
+static u_int32_t *snap_free = NULL;	/* stack of returned slots */
+static u_int32_t snap_nfree = 0;
+static int snap_full_logged = 0;
+
+static volatile struct leasesnap_record *snap_slot_get(u_int32_t *);
+static void snap_record_begin(volatile struct leasesnap_record *);
+static void snap_record_end(volatile struct leasesnap_record *);
+
+/*
+ * Create the snapshot file and map it.  Any existing file is replaced;
+ * readers notice the change through the pid and created fields.
+ */
+isc_result_t
+lease_snapshot_open(const char *path, u_int32_t nslots) {
+	int fd;
+	void *base;
+	size_t size;
+
+	if (snap_header != NULL)
+		return ISC_R_SUCCESS;
+
+	/* lease-snapshot-size comes from the configuration, so make
+	   sure the file size and the free slot stack can't overflow. */
+	if (nslots == 0 ||
+	    nslots > (SIZE_MAX - sizeof(struct leasesnap_header)) /
+		     sizeof(struct leasesnap_record) ||
+	    nslots > SIZE_MAX / sizeof(*snap_free)) {
+		log_error("Invalid lease snapshot size: %u slots",
+			  (unsigned)nslots);
+		return DHCP_R_INVALIDARG;
+	}
+
+	size = sizeof(struct leasesnap_header) +
+	       (size_t)nslots * sizeof(struct leasesnap_record);
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		log_error("Can't create lease snapshot %s: %m", path);
+		return ISC_R_IOERROR;
+	}
+	if (ftruncate(fd, (off_t)size) < 0) {
+		log_error("Can't size lease snapshot %s: %m", path);
+		close(fd);
+		return ISC_R_IOERROR;
+	}
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		log_error("Can't map lease snapshot %s: %m", path);
+		return ISC_R_IOERROR;
+	}
+
+	snap_free = dmalloc((size_t)nslots * sizeof(*snap_free), MDL);
+	if (snap_free == NULL) {
+		munmap(base, size);
+		return ISC_R_NOMEMORY;
+	}
+
+	/* ftruncate() gives us zeroed pages, so only the header needs
+	   filling in.  The magic number goes last so a reader never sees
+	   a valid magic number with a half built header. */
+	snap_header = base;
+	snap_header->version = LEASESNAP_VERSION;
+	snap_header->record_size = sizeof(struct leasesnap_record);
+	snap_header->header_size = sizeof(struct leasesnap_header);
+	snap_header->nslots = nslots;
+	snap_header->high_water = 0;
+	snap_header->pid = (int32_t)getpid();
+	snap_header->created = (int64_t)cur_time;
+	LEASESNAP_BARRIER();
+	snap_header->magic = LEASESNAP_MAGIC;
+
+	snap_records = (volatile struct leasesnap_record *)
+		((char *)base + sizeof(struct leasesnap_header));
+	snap_size = size;
+
+	log_info("Lease snapshot: %s (%u slots)", path, (unsigned)nslots);
+	return ISC_R_SUCCESS;
+}
+
+/*
+ * Find the record for a slot, allocating a slot first if the object
+ * doesn't have one yet.  Returns NULL if the snapshot is disabled or
+ * full.
+ */
+static volatile struct leasesnap_record *
+snap_slot_get(u_int32_t *slotp) {
+	u_int32_t slot;
+
+	if (snap_header == NULL)
+		return NULL;
+
+	if (*slotp != 0)
+		return &snap_records[*slotp - 1];
+
+	if (snap_nfree > 0) {
+		slot = snap_free[--snap_nfree];
+	} else if (snap_header->high_water < snap_header->nslots) {
+		slot = snap_header->high_water;
+		snap_records[slot].seq = 0;
+		LEASESNAP_BARRIER();
+		snap_header->high_water = slot + 1;
+	} else {
+		if (!snap_full_logged) {
+			log_error("Lease snapshot is full (%u slots); "
+				  "increase lease-snapshot-size.",
+				  (unsigned)snap_header->nslots);
+			snap_full_logged = 1;
+		}
+		return NULL;
+	}
+
+	*slotp = slot + 1;
+	return &snap_records[slot];
+}
+
+static void
+snap_record_begin(volatile struct leasesnap_record *rec) {
+	rec->seq++;
+	LEASESNAP_BARRIER();
+}
+
+static void
+snap_record_end(volatile struct leasesnap_record *rec) {
+	LEASESNAP_BARRIER();
+	rec->seq++;
+	snap_header->generation++;
+}
+
+/* Copy the current state of a DHCPv4 lease into its snapshot record. */
+void
+lease_snapshot_lease(struct lease *lease) {
+	volatile struct leasesnap_record *rec;
+	u_int8_t flags = 0;
+	unsigned len;
+
+	rec = snap_slot_get(&lease->snap_slot);
+	if (rec == NULL)
+		return;
+
+	snap_record_begin(rec);
+	rec->family = LEASESNAP_FAMILY_INET;
+	rec->state = lease->binding_state;
+	rec->plen = 32;
+	rec->ia_type = 0;
+	memset((void *)rec->addr, 0, sizeof(rec->addr));
+	memcpy((void *)rec->addr, lease->ip_addr.iabuf,
+	       lease->ip_addr.len > 16 ? 16 : lease->ip_addr.len);
+	rec->starts = (int64_t)lease->starts;
+	rec->ends = (int64_t)lease->ends;
+	rec->cltt = (int64_t)lease->cltt;
+	rec->tstp = (int64_t)lease->tstp;
+	rec->prefer = 0;
+	rec->valid = 0;
+
+	/* hbuf[0] holds the hardware type. */
+	if (lease->hardware_addr.hlen > 0) {
+		len = lease->hardware_addr.hlen - 1;
+		if (len > LEASESNAP_HWADDR_LEN)
+			len = LEASESNAP_HWADDR_LEN;
+		rec->hw_type = lease->hardware_addr.hbuf[0];
+		rec->hw_len = len;
+		memcpy((void *)rec->hw_addr, &lease->hardware_addr.hbuf[1],
+		       len);
+	} else {
+		rec->hw_type = 0;
+		rec->hw_len = 0;
+	}
+
+	len = lease->uid_len;
+	if (len > LEASESNAP_ID_LEN) {
+		len = LEASESNAP_ID_LEN;
+		flags |= LEASESNAP_FLAG_ID_TRUNCATED;
+	}
+	rec->id_len = len;
+	if (len != 0)
+		memcpy((void *)rec->id, lease->uid, len);
+
+	if (lease->flags & BOOTP_LEASE)
+		flags |= LEASESNAP_FLAG_BOOTP;
+	if (lease->flags & RESERVED_LEASE)
+		flags |= LEASESNAP_FLAG_RESERVED;
+	if (lease->flags & STATIC_LEASE)
+		flags |= LEASESNAP_FLAG_STATIC;
+	rec->flags = flags;
+	snap_record_end(rec);
+}
+
+/* Copy the current state of a DHCPv6 address or prefix into its
+   snapshot record. */
+void
+lease_snapshot_iasubopt(const struct ia_xx *ia, struct iasubopt *iasubopt) {
+	volatile struct leasesnap_record *rec;
+	u_int8_t flags = 0;
+	unsigned len;
+
+	rec = snap_slot_get(&iasubopt->snap_slot);
+	if (rec == NULL)
+		return;
+
+	snap_record_begin(rec);
+	rec->family = LEASESNAP_FAMILY_INET6;
+	rec->state = iasubopt->state;
+	rec->ia_type = (u_int8_t)ia->ia_type;
+	rec->plen = (ia->ia_type == D6O_IA_PD) ? iasubopt->plen : 128;
+	memcpy((void *)rec->addr, &iasubopt->addr, 16);
+	rec->starts = 0;
+	if ((iasubopt->state == FTS_ACTIVE) ||
+	    (iasubopt->state == FTS_ABANDONED) ||
+	    (iasubopt->hard_lifetime_end_time != 0))
+		rec->ends = (int64_t)iasubopt->hard_lifetime_end_time;
+	else
+		rec->ends = (int64_t)iasubopt->soft_lifetime_end_time;
+	rec->cltt = (int64_t)ia->cltt;
+	rec->tstp = 0;
+	rec->prefer = iasubopt->prefer;
+	rec->valid = iasubopt->valid;
+	rec->hw_type = 0;
+	rec->hw_len = 0;
+
+	len = ia->iaid_duid.len;
+	if (len > LEASESNAP_ID_LEN) {
+		len = LEASESNAP_ID_LEN;
+		flags |= LEASESNAP_FLAG_ID_TRUNCATED;
+	}
+	rec->id_len = len;
+	if (len != 0)
+		memcpy((void *)rec->id, ia->iaid_duid.data, len);
+
+	if (iasubopt->static_lease)
+		flags |= LEASESNAP_FLAG_STATIC;
+	rec->flags = flags;
+	snap_record_end(rec);
+}
+
+/* Mark a slot unused and make it available for reuse. */
+void
+lease_snapshot_release(u_int32_t *slotp) {
+	volatile struct leasesnap_record *rec;
+
+	if (snap_header == NULL || *slotp == 0)
+		return;
+
+	rec = &snap_records[*slotp - 1];
+	snap_record_begin(rec);
+	rec->family = LEASESNAP_FAMILY_NONE;
+	snap_record_end(rec);
+
+	snap_free[snap_nfree++] = *slotp - 1;
+	*slotp = 0;
+}
+
+void
+lease_snapshot_close(void) {
+	if (snap_header == NULL)
+		return;
+	munmap((void *)snap_header, snap_size);
+	dfree(snap_free, MDL);
+	snap_header = NULL;
+	snap_records = NULL;
+	snap_free = NULL;
+	snap_nfree = 0;
+}
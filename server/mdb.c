@@ -34,9 +34,14 @@ struct shared_network *shared_networks;
 host_hash_t *host_hw_addr_hash;
 host_hash_t *host_uid_hash;
 host_hash_t *host_name_hash;
-lease_id_hash_t *lease_uid_hash;
+client_leases_hash_t *lease_uid_hash;
 lease_ip_hash_t *lease_ip_addr_hash;
-lease_id_hash_t *lease_hw_addr_hash;
+client_leases_hash_t *lease_hw_addr_hash;
+
+/* The most lease state transitions pool_timer() makes before giving
+   way to other events, and what it has been doing. */
+u_int32_t expiry_batch_size = DEFAULT_EXPIRY_BATCH_SIZE;
+struct expiry_stats expiry_stats;
 
 /*
  * We allow users to specify any option as a host identifier.
@@ -628,6 +633,54 @@ isc_result_t delete_host (hd, commit)
 	return ISC_R_SUCCESS;
 }
 
+/* Exchange the host lookup tables with the ones in ht.  Passing a zeroed
+   structure detaches the running tables, so that the next enter_host()
+   starts new ones; passing it again puts them back. */
+
+void swap_host_tables (struct host_tables *ht)
+{
+	host_hash_t *hash;
+	host_id_info_t *info;
+
+	hash = host_hw_addr_hash;
+	host_hw_addr_hash = ht->hw_addr_hash;
+	ht->hw_addr_hash = hash;
+
+	hash = host_uid_hash;
+	host_uid_hash = ht->uid_hash;
+	ht->uid_hash = hash;
+
+	hash = host_name_hash;
+	host_name_hash = ht->name_hash;
+	ht->name_hash = hash;
+
+	info = host_id_info;
+	host_id_info = ht->id_info;
+	ht->id_info = info;
+}
+
+/* Release a set of host lookup tables set aside by swap_host_tables(). */
+
+void free_host_tables (struct host_tables *ht)
+{
+	host_id_info_t *info, *next;
+
+	if (ht->hw_addr_hash)
+		host_free_hash_table(&ht->hw_addr_hash, MDL);
+	if (ht->uid_hash)
+		host_free_hash_table(&ht->uid_hash, MDL);
+	if (ht->name_hash)
+		host_free_hash_table(&ht->name_hash, MDL);
+
+	for (info = ht->id_info; info != NULL; info = next) {
+		next = info->next;
+		option_dereference(&info->option, MDL);
+		host_free_hash_table(&info->values_hash, MDL);
+		dfree(info, MDL);
+	}
+	ht->id_info = NULL;
+}
+
 int find_hosts_by_haddr (struct host_decl **hp, int htype,
 			 const unsigned char *haddr, unsigned hlen,
 			 const char *file, int line)
@@ -778,6 +831,35 @@ int find_host_for_network (struct subnet **sp, struct host_decl **host,
 	return 0;
 }
 
+/* The number of leases made for addresses in ranges.  The lease hash
+   tables are created with LEASE_HASH_SIZE buckets; a configuration with
+   millions of addresses would leave long chains in them to be walked for
+   every lease added and every lookup after, so they are grown as leases
+   are made. */
+static unsigned range_addresses;
+
+#if defined (LAZY_RANGES)
+static void new_lease_range (struct parse *, struct iaddr, unsigned,
+			     struct subnet *, struct pool *);
+#endif
+
+static void grow_lease_hashes ()
+{
+	unsigned size;
+
+	if (range_addresses / 2 <= lease_ip_addr_hash -> hash_count)
+		return;
+	size = range_addresses | 1;
+
+	if (!lease_ip_rehash (&lease_ip_addr_hash, size, MDL) ||
+	    (lease_uid_hash -> hash_count < size &&
+	     !client_leases_rehash (&lease_uid_hash, size, MDL)) ||
+	    (lease_hw_addr_hash -> hash_count < size &&
+	     !client_leases_rehash (&lease_hw_addr_hash, size, MDL)))
+		log_error ("No memory to grow lease hash tables to %u.",
+			   size);
+}
+
 void new_address_range (cfile, low, high, subnet, pool, lpchain)
 	struct parse *cfile;
 	struct iaddr low, high;
@@ -806,17 +888,19 @@ void new_address_range (cfile, low, high, subnet, pool, lpchain)
 
 	/* Initialize the hash table if it hasn't been done yet. */
 	if (!lease_uid_hash) {
-		if (!lease_id_new_hash(&lease_uid_hash, LEASE_HASH_SIZE, MDL))
+		if (!client_leases_new_hash(&lease_uid_hash, LEASE_HASH_SIZE,
+					    MDL))
 			log_fatal ("Can't allocate lease/uid hash");
 	}
 	if (!lease_ip_addr_hash) {
 		if (!lease_ip_new_hash(&lease_ip_addr_hash, LEASE_HASH_SIZE,
 				       MDL))
 			log_fatal ("Can't allocate lease/ip hash");
+		range_addresses = 0;
 	}
 	if (!lease_hw_addr_hash) {
-		if (!lease_id_new_hash(&lease_hw_addr_hash, LEASE_HASH_SIZE,
-				       MDL))
+		if (!client_leases_new_hash(&lease_hw_addr_hash,
+					    LEASE_HASH_SIZE, MDL))
 			log_fatal ("Can't allocate lease/hw hash");
 	}
 
@@ -850,9 +934,20 @@ void new_address_range (cfile, low, high, subnet, pool, lpchain)
 	 * be overwritten when expire_all_pools is run
 	 */
 	num_addrs = max - min + 1;
+#if defined (LAZY_RANGES)
+	/* Keep the addresses as a bitmap until they are used.  They aren't
+	   counted for the lease chains; pool_init_all_growth() counts the
+	   leases that are made. */
+	new_lease_range (cfile, ip_addr (subnet -> net, subnet -> netmask,
+					 min), num_addrs, subnet, pool);
+	return;
+#else
 #if defined (BINARY_LEASES)
 	pool->lease_count += num_addrs;
 #endif
+	range_addresses += num_addrs;
+	grow_lease_hashes ();
+#endif
 
 	/* Get a lease structure for each address in the range. */
 #if defined (COMPACT_LEASES)
@@ -929,6 +1024,376 @@ void new_address_range (cfile, low, high, subnet, pool, lpchain)
 	}
 }
 
+/* The ranges of the configuration, for finding the one an address is
+   in.  They are sorted when first looked up after one has been added. */
+static struct lease_range_table range_table;
+
+/* Set once the leases read at startup have been put on their queues;
+   from then on, a lease made for an unused address is queued at once. */
+static int leases_queued;
+
+#define RANGE_BIT_SET(r, i) ((r) -> bits [(i) >> 5] & (1U << ((i) & 31)))
+
+static u_int32_t range_addr (struct iaddr addr)
+{
+	return (((u_int32_t)addr.iabuf [0] << 24) |
+		((u_int32_t)addr.iabuf [1] << 16) |
+		((u_int32_t)addr.iabuf [2] << 8) |
+		(u_int32_t)addr.iabuf [3]);
+}
+
+#if defined (LAZY_RANGES)
+static void new_lease_range (struct parse *cfile, struct iaddr low,
+			     unsigned count, struct subnet *subnet,
+			     struct pool *pool)
+{
+	struct lease_range *range, **rp;
+	unsigned words = (count + 31) / 32, max;
+	size_t size;
+
+	size = sizeof *range + (words - 1) * sizeof range -> bits [0];
+	if (words == 0 || (size - sizeof *range) / sizeof range -> bits [0]
+			  != words - 1) {
+		parse_warn (cfile, "%s is an overly large address range.",
+			    piaddr (low));
+		log_fatal ("Memory overflow.");
+	}
+
+	if (range_table.count == range_table.max) {
+		max = range_table.max ? range_table.max * 2 : 64;
+		rp = dmalloc (max * sizeof *rp, MDL);
+		if (!rp)
+			log_fatal ("No memory for address ranges.");
+		if (range_table.ranges) {
+			memcpy (rp, range_table.ranges,
+				range_table.count * sizeof *rp);
+			dfree (range_table.ranges, MDL);
+		}
+		range_table.ranges = rp;
+		range_table.max = max;
+		if (range_table.reach) {
+			dfree (range_table.reach, MDL);
+			range_table.reach = (u_int32_t *)0;
+		}
+	}
+
+	range = dmalloc (size, MDL);
+	if (!range)
+		log_fatal ("No memory for address range %s.", piaddr (low));
+	range -> pool = pool;
+	range -> subnet = subnet;
+	range -> low = range_addr (low);
+	range -> count = count;
+	range -> left = count;
+	range -> seq = range_table.count;
+	memset (range -> bits, 0xff, words * sizeof range -> bits [0]);
+	if (count % 32)
+		range -> bits [words - 1] = (1U << (count % 32)) - 1;
+
+	for (rp = &pool -> ranges; *rp; rp = &(*rp) -> next)
+		;
+	*rp = range;
+	pool -> unused_leases += count;
+
+	range_table.ranges [range_table.count++] = range;
+	range_table.sorted = 0;
+}
+#endif
+
+static void clear_range_bit (struct lease_range *range, u_int32_t i)
+{
+	range -> bits [i >> 5] &= ~(1U << (i & 31));
+	range -> left--;
+	range -> pool -> unused_leases--;
+}
+
+static int range_cmp (const void *a, const void *b)
+{
+	const struct lease_range *ra = *(const struct lease_range * const *)a;
+	const struct lease_range *rb = *(const struct lease_range * const *)b;
+
+	if (ra -> low != rb -> low)
+		return ra -> low < rb -> low ? -1 : 1;
+	return ra -> seq < rb -> seq ? -1 : 1;
+}
+
+/* Sort the ranges by first address.  An address in more than one range
+   belongs to the one declared first, as it did when every address had
+   a lease made for it as its range was read; return the number of
+   addresses that were declared twice. */
+static unsigned sort_lease_ranges ()
+{
+	struct lease_range *r, *o, *later;
+	unsigned i, k, dups = 0;
+	u_int32_t a, first, last, reach;
+	struct iaddr ia;
+
+	if (range_table.sorted)
+		return 0;
+	if (!range_table.reach) {
+		range_table.reach = dmalloc (range_table.max *
+					     sizeof *range_table.reach, MDL);
+		if (!range_table.reach)
+			log_fatal ("No memory for address ranges.");
+	}
+	qsort (range_table.ranges, range_table.count,
+	       sizeof *range_table.ranges, range_cmp);
+
+	reach = 0;
+	for (i = 0; i < range_table.count; i++) {
+		r = range_table.ranges [i];
+		for (k = i; k-- > 0 && range_table.reach [k] >= r -> low; ) {
+			o = range_table.ranges [k];
+			if (o -> low + (o -> count - 1) < r -> low)
+				continue;
+			later = o -> seq > r -> seq ? o : r;
+			first = r -> low;
+			last = o -> low + (o -> count - 1);
+			if (last > r -> low + (r -> count - 1))
+				last = r -> low + (r -> count - 1);
+			for (a = first; ; a++) {
+				if (RANGE_BIT_SET (later, a - later -> low) &&
+				    RANGE_BIT_SET (later == r ? o : r,
+						   a - (later == r ? o : r)
+						   -> low)) {
+					ia.len = 4;
+					putULong (ia.iabuf, a);
+					log_error ("lease %s is declared twice!",
+						   piaddr (ia));
+					clear_range_bit (later,
+							 a - later -> low);
+					dups++;
+				}
+				if (a == last)
+					break;
+			}
+		}
+		if (i == 0 || r -> low + (r -> count - 1) > reach)
+			reach = r -> low + (r -> count - 1);
+		range_table.reach [i] = reach;
+	}
+
+	range_table.sorted = 1;
+	return dups;
+}
+
+/* Called once the configuration has been read: fail if any address was
+   declared in more than one range. */
+isc_result_t check_lease_ranges ()
+{
+	return sort_lease_ranges () ? DHCP_R_BADPARSE : ISC_R_SUCCESS;
+}
+
+/* Find the range with an unused address, and the address's bit. */
+static struct lease_range *find_lease_range (struct iaddr addr,
+					     u_int32_t *bit)
+{
+	struct lease_range *r;
+	unsigned lo, hi, mid;
+	u_int32_t a;
+
+	if (addr.len != 4 || range_table.count == 0)
+		return (struct lease_range *)0;
+	sort_lease_ranges ();
+
+	a = range_addr (addr);
+
+	/* Find the last range that starts at or below the address. */
+	lo = 0;
+	hi = range_table.count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (range_table.ranges [mid] -> low <= a)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* Ranges only overlap where an address was declared twice, so this
+	   normally looks at one range. */
+	while (lo-- > 0 && range_table.reach [lo] >= a) {
+		r = range_table.ranges [lo];
+		if (a - r -> low < r -> count &&
+		    RANGE_BIT_SET (r, a - r -> low)) {
+			*bit = a - r -> low;
+			return r;
+		}
+	}
+	return (struct lease_range *)0;
+}
+
+/* Make a lease for an unused address, as new_address_range() used to
+   for every address in a range. */
+static int lease_from_range (struct lease **lp, struct lease_range *range,
+			     u_int32_t bit, int enqueue)
+{
+	struct lease *lease = (struct lease *)0;
+	struct iaddr addr;
+	isc_result_t status;
+
+	addr.len = 4;
+	putULong (addr.iabuf, range -> low + bit);
+
+	status = lease_allocate (&lease, MDL);
+	if (status != ISC_R_SUCCESS) {
+		log_error ("No memory for lease %s: %s", piaddr (addr),
+			   isc_result_totext (status));
+		return 0;
+	}
+	clear_range_bit (range, bit);
+	if (range -> cursor == bit)
+		range -> cursor++;
+
+	lease -> ip_addr = addr;
+	lease -> starts = MIN_TIME;
+	lease -> ends = MIN_TIME;
+	subnet_reference (&lease -> subnet, range -> subnet, MDL);
+	pool_reference (&lease -> pool, range -> pool, MDL);
+	lease -> binding_state = FTS_FREE;
+	lease -> next_binding_state = FTS_FREE;
+	lease -> rewind_binding_state = FTS_FREE;
+	lease -> flags = 0;
+
+	lease_ip_hash_add (lease_ip_addr_hash, lease -> ip_addr.iabuf,
+			   lease -> ip_addr.len, lease, MDL);
+	range_addresses++;
+	grow_lease_hashes ();
+
+	/* The address was counted as free while it was unused. */
+	if (enqueue) {
+		lease -> pool -> free_leases--;
+		lease_enqueue (lease);
+	}
+
+	if (lp)
+		lease_reference (lp, lease, MDL);
+	lease_dereference (&lease, MDL);
+	return 1;
+}
+
+/* If an address has never been used, make a lease for it.  It is put on
+   its pool's free queue if enqueue is set; otherwise the caller sees to
+   that. */
+int find_range_lease (struct lease **lp, struct iaddr addr, int enqueue)
+{
+	struct lease_range *range;
+	u_int32_t bit;
+
+	range = find_lease_range (addr, &bit);
+	if (!range)
+		return 0;
+	return lease_from_range (lp, range, bit, enqueue);
+}
+
+/* Make a lease for the next unused address in a pool, and put it at the
+   head of the pool's free queue, where allocate_lease() will find it. */
+int use_unused_lease (struct pool *pool)
+{
+	struct lease_range *range;
+	u_int32_t i;
+
+	for (range = pool -> ranges; range; range = range -> next) {
+		if (!range -> left)
+			continue;
+		for (i = range -> cursor; i < range -> count; i++) {
+			if (!range -> bits [i >> 5]) {
+				i |= 31;
+				continue;
+			}
+			if (RANGE_BIT_SET (range, i))
+				break;
+		}
+		range -> cursor = i;
+		if (i < range -> count)
+			return lease_from_range ((struct lease **)0, range,
+						 i, 1);
+	}
+	return 0;
+}
+
+#if defined (LAZY_RANGES) && defined (FAILOVER_PROTOCOL)
+/* Make leases for all the unused addresses in a pool.  They are put on
+   their queues along with those read from the lease file. */
+static void use_all_unused_leases (struct pool *pool)
+{
+	struct lease_range *range;
+	u_int32_t i;
+
+	for (range = pool -> ranges; range; range = range -> next)
+		for (i = 0; range -> left && i < range -> count; i++)
+			if (RANGE_BIT_SET (range, i))
+				lease_from_range ((struct lease **)0,
+						  range, i, 0);
+}
+#endif
+
+/* Move the ranges of a pool being merged into another. */
+void move_lease_ranges (struct pool *from, struct pool *to)
+{
+	struct lease_range *range, **rp;
+
+	for (range = from -> ranges; range; range = range -> next)
+		range -> pool = to;
+	for (rp = &to -> ranges; *rp; rp = &(*rp) -> next)
+		;
+	*rp = from -> ranges;
+	to -> unused_leases += from -> unused_leases;
+	from -> ranges = (struct lease_range *)0;
+	from -> unused_leases = 0;
+}
+
+/* Return nonzero if two pools have the same ranges with the same unused
+   addresses. */
+int lease_ranges_match (struct pool *a, struct pool *b)
+{
+	struct lease_range *ra, *rb;
+
+	if (a -> unused_leases != b -> unused_leases)
+		return 0;
+	for (ra = a -> ranges, rb = b -> ranges; ra && rb;
+	     ra = ra -> next, rb = rb -> next) {
+		if (ra -> low != rb -> low || ra -> count != rb -> count ||
+		    ra -> left != rb -> left ||
+		    memcmp (ra -> bits, rb -> bits,
+			    ((ra -> count + 31) / 32) * sizeof ra -> bits [0]))
+			return 0;
+	}
+	return ra == rb;
+}
+
+void free_lease_ranges (struct pool *pool)
+{
+	struct lease_range *range;
+
+	while (pool -> ranges) {
+		range = pool -> ranges;
+		pool -> ranges = range -> next;
+		dfree (range, MDL);
+	}
+	pool -> unused_leases = 0;
+}
+
+/* Exchange the range table with the one in rt, for a configuration
+   reload. */
+void swap_lease_range_tables (struct lease_range_table *rt)
+{
+	struct lease_range_table t;
+
+	t = range_table;
+	range_table = *rt;
+	*rt = t;
+}
+
+/* Free a range table; the ranges themselves belong to their pools. */
+void free_lease_range_table (struct lease_range_table *rt)
+{
+	if (rt -> ranges)
+		dfree (rt -> ranges, MDL);
+	if (rt -> reach)
+		dfree (rt -> reach, MDL);
+	memset (rt, 0, sizeof *rt);
+}
+
 int find_subnet (struct subnet **sp,
 		 struct iaddr addr, const char *file, int line)
 {
@@ -1113,7 +1578,7 @@ void enter_lease (lease)
 {
 	struct lease *comp = (struct lease *)0;
 
-	if (find_lease_by_ip_addr (&comp, lease -> ip_addr, MDL)) {
+	if (use_lease_by_ip_addr (&comp, lease -> ip_addr, MDL)) {
 		if (!comp -> pool) {
 			log_error ("undeclared lease found in database: %s",
 				   piaddr (lease -> ip_addr));
@@ -1422,6 +1887,9 @@ int supersede_lease (comp, lease, commit, propogate, pimmediate, from_pool)
 	if (!lease_enqueue (comp))
 		return 0;
 
+	/* Let external readers of the lease snapshot see the change. */
+	lease_snapshot_lease(comp);
+
 	/* If this is the next lease that will timeout on the pool,
 	   zap the old timeout and set the timeout on this pool to the
 	   time that the lease's next event will happen.
@@ -1925,6 +2393,8 @@ void pool_timer (vpool)
 #define RESERVED_LEASES 5
 	LEASE_STRUCT_PTR lptr[RESERVED_LEASES+1];
 	TIME next_expiry = MAX_TIME;
+	u_int32_t batch = 0;
+	int deferred = 0;
 	int i;
 	struct timeval tv;
 
@@ -1997,6 +2467,28 @@ void pool_timer (vpool)
 			{
 #if defined(FAILOVER_PROTOCOL)
 				dhcp_failover_state_t *peer = NULL;
+#endif
+
+				/* Leave the rest for the next run once we've
+				   done a batch, so that a lot of leases
+				   expiring at once doesn't hold up packet
+				   processing.  The lease file is read before
+				   we answer anything, so there's no point in
+				   holding back while the server is starting. */
+				if ((expiry_batch_size != 0) &&
+				    (batch >= expiry_batch_size) &&
+				    (server_starting == 0)) {
+					deferred = 1;
+					break;
+				}
+				batch++;
+				if (cur_time - lease->sort_time >
+				    expiry_stats.lag_max)
+					expiry_stats.lag_max =
+						cur_time - lease->sort_time;
+				expiry_stats.lag_total +=
+						cur_time - lease->sort_time;
+#if defined(FAILOVER_PROTOCOL)
 
 				if (lease->pool != NULL)
 					peer = lease->pool->failover_peer;
@@ -2025,6 +2517,29 @@ void pool_timer (vpool)
 			lease_dereference(&next, MDL);
 		if (lease)
 			lease_dereference(&lease, MDL);
+		if (deferred)
+			break;
+	}
+
+	if (batch != 0) {
+		expiry_stats.runs++;
+		expiry_stats.transitions += batch;
+		if (batch > expiry_stats.batch_max)
+			expiry_stats.batch_max = batch;
+	}
+
+	/* If we stopped with leases still to expire, come back as soon as
+	 * whatever is waiting has had its turn.  The timer goes on the
+	 * end of the event queue, so packets that arrived while we were
+	 * busy are answered first.
+	 */
+	if (deferred) {
+		expiry_stats.deferred++;
+		pool->next_event_time = cur_time;
+		add_timeout (&cur_tv, pool_timer, pool,
+			     (tvref_t)pool_reference,
+			     (tvunref_t)pool_dereference);
+		return;
 	}
 
 	/* If we found something to expire and its expiration time
@@ -2046,7 +2561,26 @@ void pool_timer (vpool)
 
 }
 
-/* Locate the lease associated with a given IP address... */
+/* Summarize the work done by pool_timer(). */
+void
+expiry_log_stats(void) {
+	if (expiry_stats.runs == 0)
+		return;
+
+	log_info("Expiry: %llu transitions in %llu batches (max %u), "
+		 "%llu batches cut short, lag avg %llu s max %u s",
+		 (unsigned long long)expiry_stats.transitions,
+		 (unsigned long long)expiry_stats.runs,
+		 expiry_stats.batch_max,
+		 (unsigned long long)expiry_stats.deferred,
+		 (unsigned long long)(expiry_stats.lag_total /
+				      expiry_stats.transitions),
+		 expiry_stats.lag_max);
+}
+
+/* Locate the lease associated with a given IP address.  An address in
+   a range that has never been used has no lease, and isn't given one
+   just for being looked up; see use_lease_by_ip_addr(). */
 
 int find_lease_by_ip_addr (struct lease **lp, struct iaddr addr,
 			   const char *file, int line)
@@ -2055,30 +2589,118 @@ int find_lease_by_ip_addr (struct lease **lp, struct iaddr addr,
 				    addr.len, file, line);
 }
 
+/* Locate the lease for an IP address that is about to be used: given to
+   a client, read from the lease file or bound by a failover peer.  If
+   the address is in a range but has never been used, a lease is made
+   for it. */
+
+int use_lease_by_ip_addr (struct lease **lp, struct iaddr addr,
+			  const char *file, int line)
+{
+	if (lease_ip_hash_lookup(lp, lease_ip_addr_hash, addr.iabuf,
+				 addr.len, file, line))
+		return 1;
+	return find_range_lease(lp, addr, leases_queued);
+}
+
+/* Find the pool an address belongs to, without making a lease for it if
+   it has never been used. */
+int find_address_pool (struct pool **pp, struct iaddr addr)
+{
+	struct lease *lease = (struct lease *)0;
+	struct lease_range *range;
+	u_int32_t bit;
+
+	if (lease_ip_hash_lookup(&lease, lease_ip_addr_hash, addr.iabuf,
+				 addr.len, MDL)) {
+		if (lease -> pool)
+			pool_reference (pp, lease -> pool, MDL);
+		lease_dereference (&lease, MDL);
+		return *pp != (struct pool *)0;
+	}
+
+	range = find_lease_range (addr, &bit);
+	if (!range || !range -> pool)
+		return 0;
+	pool_reference (pp, range -> pool, MDL);
+	return 1;
+}
+
+/* Find the most preferred lease with a client identifier. */
 int find_lease_by_uid (struct lease **lp, const unsigned char *uid,
 		       unsigned len, const char *file, int line)
 {
-	if (len == 0)
+	struct client_leases *set;
+
+	set = find_client_leases_by_uid (uid, len);
+	if (!set)
 		return 0;
-	return lease_id_hash_lookup (lp, lease_uid_hash, uid, len, file, line);
+	return lease_reference (lp, set -> leases [0], file, line) ==
+		ISC_R_SUCCESS;
 }
 
 int find_lease_by_hw_addr (struct lease **lp,
 			   const unsigned char *hwaddr, unsigned hwlen,
 			   const char *file, int line)
 {
-	if (hwlen == 0)
+	struct client_leases *set;
+
+	set = find_client_leases_by_hw_addr (hwaddr, hwlen);
+	if (!set)
 		return (0);
+	return (lease_reference (lp, set -> leases [0], file, line) ==
+		ISC_R_SUCCESS);
+}
+
+/* Find the set of leases with a client identifier or hardware address.
+   The set is not referenced: it may be changed or freed by anything that
+   adds a lease to or removes one from the uid or hardware address hash,
+   such as supersede_lease() or release_lease(), so it must be looked up
+   again after calling one of those. */
+struct client_leases *find_client_leases_by_uid (const unsigned char *uid,
+						 unsigned len)
+{
+	struct client_leases *set = NULL;
+
+	if (len == 0)
+		return NULL;
+	client_leases_hash_lookup (&set, lease_uid_hash, uid, len, MDL);
+	return set;
+}
+
+struct client_leases *find_client_leases_by_hw_addr (const unsigned char *hw,
+						     unsigned len)
+{
+	struct client_leases *set = NULL;
+
+	if (len == 0)
+		return (NULL);
 
 	/*
 	 * If it's an infiniband address don't bother
 	 * as we don't have a useful address to hash.
 	 */
-	if ((hwlen == 1) && (hwaddr[0] == HTYPE_INFINIBAND))
-		return (0);
+	if ((len == 1) && (hw[0] == HTYPE_INFINIBAND))
+		return (NULL);
+
+	client_leases_hash_lookup (&set, lease_hw_addr_hash, hw, len, MDL);
+	return (set);
+}
+
+/* The position of a lease in a set, or the size of the set if it isn't
+   there, so that a walk of the set that is looking for it comes to an
+   end. */
+unsigned client_leases_index (const struct client_leases *set,
+			      const struct lease *lease)
+{
+	unsigned i;
 
-	return (lease_id_hash_lookup(lp, lease_hw_addr_hash, hwaddr, hwlen,
-				     file, line));
+	if (!set)
+		return 0;
+	for (i = 0; i < set -> count; i++)
+		if (set -> leases [i] == lease)
+			break;
+	return i;
 }
 
 /* If the lease is preferred over the candidate, return truth.  The
@@ -2128,71 +2750,105 @@ client_lease_preferred(struct lease *cand, struct lease *lease)
 	return ISC_FALSE;
 }
 
-/* Add the specified lease to the uid hash. */
-void
-uid_hash_add(struct lease *lease)
+/* Add a lease to the set for its identifier, in order of preference,
+ * making the set if it's the first.  Finding the place is a walk of an
+ * array of pointers that takes no references, and as the hash table
+ * entry is for the set rather than the first lease, it stays put when
+ * the first lease changes.
+ */
+static void
+client_leases_add(client_leases_hash_t *table, const unsigned char *id,
+		  unsigned len, struct lease *lease)
 {
-	struct lease *head = NULL;
-	struct lease *cand = NULL;
-	struct lease *prev = NULL;
-	struct lease *next = NULL;
+	struct client_leases *set = NULL;
+	struct lease **leases;
+	unsigned i;
 
-	/* If it's not in the hash, just add it. */
-	if (!find_lease_by_uid (&head, lease -> uid, lease -> uid_len, MDL))
-		lease_id_hash_add(lease_uid_hash, lease->uid, lease->uid_len,
-				  lease, MDL);
-	else {
-		/* Otherwise, insert it into the list in order of its
-		 * preference for "resuming allocation to the client."
-		 *
-		 * Because we don't have control of the hash bucket index
-		 * directly, we have to remove and re-insert the client
-		 * id into the hash if we're inserting onto the head.
-		 */
-		lease_reference(&cand, head, MDL);
-		while (cand != NULL) {
-			if (client_lease_preferred(cand, lease))
-				break;
+	if (table == NULL || len == 0)
+		return;
 
-			if (prev != NULL)
-				lease_dereference(&prev, MDL);
-			lease_reference(&prev, cand, MDL);
+	if (!client_leases_hash_lookup(&set, table, id, len, MDL)) {
+		set = dmalloc(sizeof(*set) + len, MDL);
+		if (set == NULL)
+			log_fatal("No memory for the leases of a client.");
+		memcpy(set->id, id, len);
+		set->len = len;
+		client_leases_hash_add(table, set->id, len, set, MDL);
+	} else if (client_leases_index(set, lease) < set->count) {
+		/* Already there: the caller should have removed it first
+		 * if it was to move. */
+		return;
+	}
 
-			if (cand->n_uid != NULL)
-				lease_reference(&next, cand->n_uid, MDL);
+	if (set->count == set->max) {
+		leases = dmalloc((set->max ? set->max * 2 : 4) *
+				 sizeof(*leases), MDL);
+		if (leases == NULL)
+			log_fatal("No memory for the leases of a client.");
+		if (set->leases != NULL) {
+			memcpy(leases, set->leases,
+			       set->count * sizeof(*leases));
+			dfree(set->leases, MDL);
+		}
+		set->leases = leases;
+		set->max = set->max ? set->max * 2 : 4;
+	}
 
-			lease_dereference(&cand, MDL);
+	for (i = 0; i < set->count; i++)
+		if (client_lease_preferred(set->leases[i], lease))
+			break;
+	memmove(&set->leases[i + 1], &set->leases[i],
+		(set->count - i) * sizeof(*set->leases));
+	set->leases[i] = NULL;
+	lease_reference(&set->leases[i], lease, MDL);
+	set->count++;
+}
 
-			if (next != NULL) {
-				lease_reference(&cand, next, MDL);
-				lease_dereference(&next, MDL);
-			}
-		}
+static void
+client_leases_free(struct client_leases *set)
+{
+	if (set->leases != NULL)
+		dfree(set->leases, MDL);
+	dfree(set, MDL);
+}
 
-		/* If we want to insert 'before cand', and prev is NULL,
-		 * then it was the head of the list.  Assume that position.
-		 */
-		if (prev == NULL) {
-			lease_reference(&lease->n_uid, head, MDL);
-			lease_id_hash_delete(lease_uid_hash, lease->uid,
-					     lease->uid_len, MDL);
-			lease_id_hash_add(lease_uid_hash, lease->uid,
-					  lease->uid_len, lease, MDL);
-		} else /* (prev != NULL) */ {
-			if(prev->n_uid != NULL) {
-				lease_reference(&lease->n_uid, prev->n_uid,
-						MDL);
-				lease_dereference(&prev->n_uid, MDL);
-			}
-			lease_reference(&prev->n_uid, lease, MDL);
+/* Take a lease out of the set for its identifier, and the set out of the
+ * hash if that leaves it empty.
+ */
+static void
+client_leases_delete(client_leases_hash_t *table, const unsigned char *id,
+		     unsigned len, struct lease *lease)
+{
+	struct client_leases *set = NULL;
+	struct lease *gone;
+	unsigned i;
 
-			lease_dereference(&prev, MDL);
-		}
+	if (table == NULL || len == 0 ||
+	    !client_leases_hash_lookup(&set, table, id, len, MDL))
+		return;
 
-		if (cand != NULL)
-			lease_dereference(&cand, MDL);
-		lease_dereference(&head, MDL);
-	}
+	i = client_leases_index(set, lease);
+	if (i == set->count)
+		return;
+	gone = set->leases[i];
+	memmove(&set->leases[i], &set->leases[i + 1],
+		(set->count - i - 1) * sizeof(*set->leases));
+	set->leases[--set->count] = NULL;
+
+	/* The identifier may belong to the lease, so the set's own copy is
+	 * used to remove it, before the lease can go away. */
+	if (set->count == 0) {
+		client_leases_hash_delete(table, set->id, set->len, MDL);
+		client_leases_free(set);
+	}
+	lease_dereference(&gone, MDL);
+}
+
+/* Add the specified lease to the uid hash. */
+void
+uid_hash_add(struct lease *lease)
+{
+	client_leases_add(lease_uid_hash, lease->uid, lease->uid_len, lease);
 }
 
 /* Delete the specified lease from the uid hash. */
@@ -2200,46 +2856,7 @@ uid_hash_add(struct lease *lease)
 void uid_hash_delete (lease)
 	struct lease *lease;
 {
-	struct lease *head = (struct lease *)0;
-	struct lease *scan;
-
-	/* If it's not in the hash, we have no work to do. */
-	if (!find_lease_by_uid (&head, lease -> uid, lease -> uid_len, MDL)) {
-		if (lease -> n_uid)
-			lease_dereference (&lease -> n_uid, MDL);
-		return;
-	}
-
-	/* If the lease we're freeing is at the head of the list,
-	   remove the hash table entry and add a new one with the
-	   next lease on the list (if there is one). */
-	if (head == lease) {
-		lease_id_hash_delete(lease_uid_hash, lease->uid,
-				     lease->uid_len, MDL);
-		if (lease -> n_uid) {
-			lease_id_hash_add(lease_uid_hash, lease->n_uid->uid,
-					  lease->n_uid->uid_len, lease->n_uid,
-					  MDL);
-			lease_dereference (&lease -> n_uid, MDL);
-		}
-	} else {
-		/* Otherwise, look for the lease in the list of leases
-		   attached to the hash table entry, and remove it if
-		   we find it. */
-		for (scan = head; scan -> n_uid; scan = scan -> n_uid) {
-			if (scan -> n_uid == lease) {
-				lease_dereference (&scan -> n_uid, MDL);
-				if (lease -> n_uid) {
-					lease_reference (&scan -> n_uid,
-							 lease -> n_uid, MDL);
-					lease_dereference (&lease -> n_uid,
-							   MDL);
-				}
-				break;
-			}
-		}
-	}
-	lease_dereference (&head, MDL);
+	client_leases_delete(lease_uid_hash, lease->uid, lease->uid_len, lease);
 }
 
 /* Add the specified lease to the hardware address hash. */
@@ -2249,11 +2866,6 @@ void uid_hash_delete (lease)
 void
 hw_hash_add(struct lease *lease)
 {
-	struct lease *head = NULL;
-	struct lease *cand = NULL;
-	struct lease *prev = NULL;
-	struct lease *next = NULL;
-
 	/*
 	 * If it's an infiniband address don't bother
 	 * as we don't have a useful address to hash.
@@ -2262,67 +2874,8 @@ hw_hash_add(struct lease *lease)
 	    (lease->hardware_addr.hbuf[0] == HTYPE_INFINIBAND))
 		return;
 
-	/* If it's not in the hash, just add it. */
-	if (!find_lease_by_hw_addr (&head, lease -> hardware_addr.hbuf,
-				    lease -> hardware_addr.hlen, MDL))
-		lease_id_hash_add(lease_hw_addr_hash,
-				  lease->hardware_addr.hbuf,
-				  lease->hardware_addr.hlen, lease, MDL);
-	else {
-		/* Otherwise, insert it into the list in order of its
-		 * preference for "resuming allocation to the client."
-		 *
-		 * Because we don't have control of the hash bucket index
-		 * directly, we have to remove and re-insert the client
-		 * id into the hash if we're inserting onto the head.
-		 */
-		lease_reference(&cand, head, MDL);
-		while (cand != NULL) {
-			if (client_lease_preferred(cand, lease))
-				break;
-
-			if (prev != NULL)
-				lease_dereference(&prev, MDL);
-			lease_reference(&prev, cand, MDL);
-
-			if (cand->n_hw != NULL)
-				lease_reference(&next, cand->n_hw, MDL);
-
-			lease_dereference(&cand, MDL);
-
-			if (next != NULL) {
-				lease_reference(&cand, next, MDL);
-				lease_dereference(&next, MDL);
-			}
-		}
-
-		/* If we want to insert 'before cand', and prev is NULL,
-		 * then it was the head of the list.  Assume that position.
-		 */
-		if (prev == NULL) {
-			lease_reference(&lease->n_hw, head, MDL);
-			lease_id_hash_delete(lease_hw_addr_hash,
-					     lease->hardware_addr.hbuf,
-					     lease->hardware_addr.hlen, MDL);
-			lease_id_hash_add(lease_hw_addr_hash,
-					  lease->hardware_addr.hbuf,
-					  lease->hardware_addr.hlen,
-					  lease, MDL);
-		} else /* (prev != NULL) */ {
-			if(prev->n_hw != NULL) {
-				lease_reference(&lease->n_hw, prev->n_hw,
-						MDL);
-				lease_dereference(&prev->n_hw, MDL);
-			}
-			lease_reference(&prev->n_hw, lease, MDL);
-
-			lease_dereference(&prev, MDL);
-		}
-
-		if (cand != NULL)
-			lease_dereference(&cand, MDL);
-		lease_dereference(&head, MDL);
-	}
+	client_leases_add(lease_hw_addr_hash, lease->hardware_addr.hbuf,
+			  lease->hardware_addr.hlen, lease);
 }
 
 /* Delete the specified lease from the hardware address hash. */
@@ -2330,9 +2883,6 @@ hw_hash_add(struct lease *lease)
 void hw_hash_delete (lease)
 	struct lease *lease;
 {
-	struct lease *head = (struct lease *)0;
-	struct lease *next = (struct lease *)0;
-
 	/*
 	 * If it's an infiniband address don't bother
 	 * as we don't have a useful address to hash.
@@ -2341,51 +2891,8 @@ void hw_hash_delete (lease)
 	    (lease->hardware_addr.hbuf[0] == HTYPE_INFINIBAND))
 		return;
 
-	/* If it's not in the hash, we have no work to do. */
-	if (!find_lease_by_hw_addr (&head, lease -> hardware_addr.hbuf,
-				    lease -> hardware_addr.hlen, MDL)) {
-		if (lease -> n_hw)
-			lease_dereference (&lease -> n_hw, MDL);
-		return;
-	}
-
-	/* If the lease we're freeing is at the head of the list,
-	   remove the hash table entry and add a new one with the
-	   next lease on the list (if there is one). */
-	if (head == lease) {
-		lease_id_hash_delete(lease_hw_addr_hash,
-				     lease->hardware_addr.hbuf,
-				     lease->hardware_addr.hlen, MDL);
-		if (lease->n_hw) {
-			lease_id_hash_add(lease_hw_addr_hash,
-					  lease->n_hw->hardware_addr.hbuf,
-					  lease->n_hw->hardware_addr.hlen,
-					  lease->n_hw, MDL);
-			lease_dereference(&lease->n_hw, MDL);
-		}
-	} else {
-		/* Otherwise, look for the lease in the list of leases
-		   attached to the hash table entry, and remove it if
-		   we find it. */
-		while (head -> n_hw) {
-			if (head -> n_hw == lease) {
-				lease_dereference (&head -> n_hw, MDL);
-				if (lease -> n_hw) {
-					lease_reference (&head -> n_hw,
-							 lease -> n_hw, MDL);
-					lease_dereference (&lease -> n_hw,
-							   MDL);
-				}
-				break;
-			}
-			lease_reference (&next, head -> n_hw, MDL);
-			lease_dereference (&head, MDL);
-			lease_reference (&head, next, MDL);
-			lease_dereference (&next, MDL);
-		}
-	}
-	if (head)
-		lease_dereference (&head, MDL);
+	client_leases_delete(lease_hw_addr_hash, lease->hardware_addr.hbuf,
+			     lease->hardware_addr.hlen, lease);
 }
 
 /* Write v4 leases to permanent storage. */
@@ -2826,6 +3333,61 @@ lease_instantiate(const void *key, unsigned len, void *object)
 	return ISC_R_SUCCESS;
 }
 
+#if defined (BINARY_LEASES)
+/* Set up the growth factors for the binary leases of a pool.
+ * We use 100% for free, 50% for active and backup
+ * 20% for expired, abandoned and reserved
+ * but no less than 100, 50, and 20.
+ */
+void pool_init_growth (struct pool *p)
+{
+	size_t num_f = 100, num_a = 50, num_e = 20;
+
+	if (p->lease_count > 100) {
+		num_f = p->lease_count;
+		num_a = num_f / 2;
+		num_e = num_f / 5;
+	}
+	lc_init_growth(&p->free, num_f);
+	lc_init_growth(&p->active, num_a);
+	lc_init_growth(&p->expired, num_a);
+	lc_init_growth(&p->abandoned, num_e);
+	lc_init_growth(&p->backup, num_e);
+	lc_init_growth(&p->reserved, num_e);
+}
+
+#if defined (LAZY_RANGES)
+static isc_result_t pool_count_lease (const void *key, unsigned len,
+				      void *object)
+{
+	struct lease *lease = object;
+
+	if (lease -> pool)
+		lease -> pool -> lease_count++;
+	return ISC_R_SUCCESS;
+}
+#endif
+
+/* Set up the growth factors of every pool.  With LAZY_RANGES they are
+   sized from the leases that exist, so an address that has never been
+   used takes no room in the lease chains until a lease is made for it. */
+void pool_init_all_growth ()
+{
+	struct shared_network *s;
+	struct pool *p;
+
+#if defined (LAZY_RANGES)
+	for (s = shared_networks; s; s = s -> next)
+		for (p = s -> pools; p; p = p -> next)
+			p -> lease_count = 0;
+	lease_ip_hash_foreach(lease_ip_addr_hash, pool_count_lease);
+#endif
+	for (s = shared_networks; s; s = s -> next)
+		for (p = s -> pools; p; p = p -> next)
+			pool_init_growth(p);
+}
+#endif
+
 /* Run expiry events on every pool.   This is called on startup so that
    any expiry events that occurred after the server stopped and before it
    was restarted can be run.   At the same time, if failover support is
@@ -2842,30 +3404,20 @@ void expire_all_pools ()
 	/* Indicate that we are in the startup phase */
 	server_starting = SS_NOSYNC | SS_QFOLLOW;
 
-#if defined (BINARY_LEASES)
-	/* set up the growth factors for the binary leases.
-	 * We use 100% for free, 50% for active and backup
-	 * 20% for expired, abandoned and reserved
-	 * but no less than 100, 50, and 20.
-	 */
+#if defined (LAZY_RANGES) && defined (FAILOVER_PROTOCOL)
+	/* The failover peers balance the free leases of a pool between
+	   them, so a failover pool has a lease for every address. */
 	for (s = shared_networks; s; s = s -> next) {
-	    for (p = s -> pools; p != NULL; p = p -> next) {
-		size_t num_f = 100, num_a = 50, num_e = 20;
-		if (p->lease_count > 100) {
-		    num_f = p->lease_count;
-		    num_a = num_f / 2;
-		    num_e = num_f / 5;
-		}
-		lc_init_growth(&p->free, num_f);
-		lc_init_growth(&p->active, num_a);
-		lc_init_growth(&p->expired, num_a);
-		lc_init_growth(&p->abandoned, num_e);
-		lc_init_growth(&p->backup, num_e);
-		lc_init_growth(&p->reserved, num_e);
-	    }
+	    for (p = s -> pools; p != NULL; p = p -> next)
+		if (p -> failover_peer && p -> unused_leases)
+			use_all_unused_leases (p);
 	}
 #endif
 
+#if defined (BINARY_LEASES)
+	pool_init_all_growth();
+#endif
+
 	/* First, go over the hash list and actually put all the leases
 	   on the appropriate lists. */
 	lease_ip_hash_foreach(lease_ip_addr_hash, lease_instantiate);
@@ -2922,9 +3474,16 @@ void expire_all_pools ()
 #endif
 		    }
 		}
+
+		/* Addresses without leases yet are free. */
+		p -> lease_count += p -> unused_leases;
+		p -> free_leases += p -> unused_leases;
 	    }
 	}
 
+	/* Leases made from now on are queued as they are made. */
+	leases_queued = 1;
+
 	/* turn off startup phase */
 	server_starting = 0;
 }
@@ -2968,8 +3527,8 @@ void dump_subnets ()
 
 HASH_FUNCTIONS(lease_ip, const unsigned char *, struct lease, lease_ip_hash_t,
 	       lease_reference, lease_dereference, do_ip4_hash)
-HASH_FUNCTIONS(lease_id, const unsigned char *, struct lease, lease_id_hash_t,
-	       lease_reference, lease_dereference, do_id_hash)
+HASH_FUNCTIONS(client_leases, const unsigned char *, struct client_leases,
+	       client_leases_hash_t, 0, 0, do_id_hash)
 HASH_FUNCTIONS (host, const unsigned char *, struct host_decl, host_hash_t,
 		host_reference, host_dereference, do_string_hash)
 HASH_FUNCTIONS (class, const char *, struct class, class_hash_t,
@@ -2993,6 +3552,19 @@ extern int end;
 extern struct lease *lease_hunks;
 #endif
 
+/* Drop a client's lease set and its references to the leases. */
+static isc_result_t client_leases_release (const void *name, unsigned len,
+					   void *object)
+{
+	struct client_leases *set = object;
+	unsigned i;
+
+	for (i = 0; i < set -> count; i++)
+		lease_dereference (&set -> leases [i], MDL);
+	client_leases_free (set);
+	return ISC_R_SUCCESS;
+}
+
 void free_everything(void)
 {
 	struct subnet *sc = (struct subnet *)0, *sn = (struct subnet *)0;
@@ -3013,14 +3585,21 @@ void free_everything(void)
 	if (host_uid_hash)
 		host_free_hash_table (&host_uid_hash, MDL);
 	host_uid_hash = 0;
-	if (lease_uid_hash)
-		lease_id_free_hash_table (&lease_uid_hash, MDL);
+	if (lease_uid_hash) {
+		client_leases_hash_foreach (lease_uid_hash,
+					    client_leases_release);
+		client_leases_free_hash_table (&lease_uid_hash, MDL);
+	}
 	lease_uid_hash = 0;
 	if (lease_ip_addr_hash)
 		lease_ip_free_hash_table (&lease_ip_addr_hash, MDL);
 	lease_ip_addr_hash = 0;
-	if (lease_hw_addr_hash)
-		lease_id_free_hash_table (&lease_hw_addr_hash, MDL);
+	free_lease_range_table (&range_table);
+	if (lease_hw_addr_hash) {
+		client_leases_hash_foreach (lease_hw_addr_hash,
+					    client_leases_release);
+		client_leases_free_hash_table (&lease_hw_addr_hash, MDL);
+	}
 	lease_hw_addr_hash = 0;
 	if (host_name_hash)
 		host_free_hash_table (&host_name_hash, MDL);
@@ -3192,10 +3771,6 @@ void free_everything(void)
 				    if (lc -> state)
 					free_lease_state (lc -> state, MDL);
 				    lc -> state = (struct lease_state *)0;
-				    if (lc -> n_hw)
-					lease_dereference (&lc -> n_hw, MDL);
-				    if (lc -> n_uid)
-					lease_dereference (&lc -> n_uid, MDL);
 				    lease_dereference (&lc, MDL);
 				} while (ln);
 			    }
@@ -3222,6 +3797,7 @@ void free_everything(void)
 #if defined(DELAYED_ACK)
 	relinquish_ackqueue();
 #endif
+	lease_snapshot_close();
 	trace_free_all ();
 	group_dereference (&root_group, MDL);
 	executable_statement_dereference (&default_classification_rules, MDL);
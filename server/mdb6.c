@@ -275,6 +275,7 @@ iasubopt_dereference(struct iasubopt **iasubopt, const char *file, int line) {
 		tmp->refcnt = 0;
 	}
 	if (tmp->refcnt == 0) {
+		lease_snapshot_release(&tmp->snap_slot);
 		if (tmp->ia != NULL) {
 			ia_dereference(&(tmp->ia), file, line);
 		}
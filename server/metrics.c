@@ -0,0 +1,797 @@
+/* metrics.c
+
+   Counters and latency histograms, served over HTTP for Prometheus. */
+
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/*
+ * When metrics-port is set the server listens on it, on metrics-address
+ * or the loopback address, and answers "GET /metrics" with the Prometheus
+ * text format.  The listener and its connections are I/O objects in the
+ * dispatch loop like any other, so a scrape never blocks the server: the
+ * request is read and the reply written as the socket allows, and a
+ * connection that hasn't finished in METRICS_TIMEOUT seconds is closed.
+ *
+ * The reply is made when it is asked for from what the server already
+ * keeps: pool and pond lease counts (as check_pool_threshold() and
+ * check_pool6_threshold() use them), the delayed-ack, ping, failover and
+ * DDNS queues, and the admission, duplicate cache and expiry counters.
+ * What is kept here is a count of the packets received of each type and
+ * a histogram of the time taken by each stage of handling them: parsing,
+ * classification, finding or allocating a lease, writing it to the lease
+ * file, the fsync() of the lease file and sending the reply.  The stages
+ * are timed only while the listener is open, and cost two calls to
+ * gettimeofday() each.  The server has a single thread, so the counters
+ * are plain integers.
+ *
+ * The histograms are those of trace playback (common/histogram.c), with
+ * sixteen buckets to each power of two of microseconds, and are reported
+ * at the usual Prometheus boundaries to within that resolution.
+ */
+
+#include "dhcpd.h"
+#include <sys/time.h>
+#include <stdarg.h>
+
+#define METRICS_TIMEOUT 10		/* seconds to finish a scrape */
+#define METRICS_MAX_CONNECTIONS 8
+#define METRICS_REQUEST_MAX 2048
+#define METRICS_HEADER_MAX 128		/* room for the HTTP response header */
+
+struct metrics_connection {
+	OMAPI_OBJECT_PREAMBLE;
+	int socket;
+	int closed;
+	unsigned request_len;
+	char request [METRICS_REQUEST_MAX];
+	struct metrics_buffer out;
+	unsigned out_start, out_sent;
+};
+
+u_int16_t metrics_port = 0;
+struct in_addr metrics_address;
+int metrics_enabled = 0;
+struct metrics_stats metrics_stats;
+
+static int metrics_socket = -1;
+static omapi_object_t *metrics_listener;
+static omapi_object_type_t *metrics_listener_type;
+static omapi_object_type_t *metrics_connection_type;
+static int metrics_connections;
+
+/* The packet being handled, for the parse stage. */
+static struct timeval packet_start;
+static int parse_pending;
+
+OMAPI_OBJECT_ALLOC(metrics_connection, struct metrics_connection,
+		   metrics_connection_type)
+
+static bootp_handler_t metrics_handler;
+#ifdef DHCPv6
+static dhcpv6_handler_t metrics_handler6;
+#endif
+
+static const char *stage_names [METRICS_STAGES] = {
+	"parse", "classify", "allocate", "commit", "fsync", "send", "packet"
+};
+
+/* Histogram boundaries, in microseconds. */
+static const u_int32_t histogram_bounds [] = {
+	10, 25, 50, 100, 250, 500,
+	1000, 2500, 5000, 10000, 25000, 50000,
+	100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+
+/* Record the time since start in a stage's histogram. */
+void
+metrics_record(int stage, const struct timeval *start) {
+	struct replay_stats *stats = &metrics_stats.stages[stage];
+	struct timeval now;
+	long long usecs;
+
+	gettimeofday(&now, NULL);
+	usecs = (long long)(now.tv_sec - start->tv_sec) * 1000000 +
+		(now.tv_usec - start->tv_usec);
+	if (usecs < 0)
+		usecs = 0;
+	else if (usecs > 0xffffffffLL)
+		usecs = 0xffffffffLL;
+
+	stats->count++;
+	stats->usecs += usecs;
+	if ((u_int32_t)usecs > stats->max)
+		stats->max = (u_int32_t)usecs;
+	stats->buckets[replay_bucket((u_int32_t)usecs)]++;
+}
+
+/* Called by dhcp() and dhcpv6() once a packet has been parsed. */
+void
+metrics_parsed(void) {
+	if (parse_pending) {
+		parse_pending = 0;
+		metrics_record(METRICS_PARSE, &packet_start);
+	}
+}
+
+static void
+metrics_packet(struct interface_info *ip, struct dhcp_packet *raw,
+	       unsigned len, unsigned int from_port, struct iaddr from,
+	       struct hardware *hfrom)
+{
+	metrics_stats.packets[replay_message_type(raw, len)]++;
+	gettimeofday(&packet_start, NULL);
+	parse_pending = 1;
+	(*metrics_handler)(ip, raw, len, from_port, from, hfrom);
+	parse_pending = 0;
+	metrics_record(METRICS_PACKET, &packet_start);
+}
+
+#ifdef DHCPv6
+static void
+metrics_packet6(struct interface_info *ip, const char *buf, int len,
+		int from_port, const struct iaddr *from,
+		isc_boolean_t was_unicast)
+{
+	unsigned type = 0;
+
+	if (len > 0 && (unsigned char)buf[0] < METRICS_TYPES6)
+		type = (unsigned char)buf[0];
+	metrics_stats.packets6[type]++;
+	gettimeofday(&packet_start, NULL);
+	parse_pending = 1;
+	(*metrics_handler6)(ip, buf, len, from_port, from, was_unicast);
+	parse_pending = 0;
+	metrics_record(METRICS_PACKET, &packet_start);
+}
+#endif /* DHCPv6 */
+
+/* Append to the output, growing it as needed.  If memory runs out the
+   output is marked as failed and nothing more is added. */
+void
+metrics_printf(struct metrics_buffer *out, const char *fmt, ...) {
+	va_list args;
+	unsigned size;
+	char *data;
+	int len;
+
+	while (!out->failed) {
+		va_start(args, fmt);
+		len = vsnprintf(out->data + out->len, out->size - out->len,
+				fmt, args);
+		va_end(args);
+		if (len < 0) {
+			out->failed = 1;
+			break;
+		}
+		if ((unsigned)len < out->size - out->len) {
+			out->len += len;
+			break;
+		}
+
+		size = out->size * 2;
+		while (size <= out->len + len)
+			size *= 2;
+		data = dmalloc(size, MDL);
+		if (data == NULL) {
+			out->failed = 1;
+			break;
+		}
+		memcpy(data, out->data, out->len);
+		dfree(out->data, MDL);
+		out->data = data;
+		out->size = size;
+	}
+}
+
+/* Append a label value, escaped as the text format requires. */
+static void
+metrics_label(struct metrics_buffer *out, const char *s) {
+	const char *p;
+
+	for (p = s; *p != '\0'; p++) {
+		if (*p == '\\')
+			metrics_printf(out, "\\\\");
+		else if (*p == '"')
+			metrics_printf(out, "\\\"");
+		else if (*p == '\n')
+			metrics_printf(out, "\\n");
+		else
+			metrics_printf(out, "%c", *p);
+	}
+}
+
+static void
+metrics_family(struct metrics_buffer *out, const char *name,
+	       const char *type, const char *help) {
+	metrics_printf(out, "# HELP %s %s\n# TYPE %s %s\n",
+		       name, help, name, type);
+}
+
+/* Append a sample whose first label is a name from the configuration. */
+static void
+metrics_sample(struct metrics_buffer *out, const char *family,
+	       const char *key, const char *name, const char *labels,
+	       unsigned long long value)
+{
+	metrics_printf(out, "%s{%s=\"", family, key);
+	metrics_label(out, name != NULL ? name : "");
+	metrics_printf(out, "\",%s} %llu\n", labels, value);
+}
+
+static void
+render_packets(struct metrics_buffer *out) {
+	const char *s;
+	int i;
+
+	metrics_family(out, "dhcpd_packets_received_total", "counter",
+		       "Packets received, by message type.");
+	for (i = 0; i < REPLAY_TYPES; i++) {
+		if (metrics_stats.packets[i] == 0)
+			continue;
+		if (i == 0)
+			s = "BOOTP";
+		else if (i == REPLAY_TYPES - 1 || i > dhcp_type_name_max)
+			s = "other";
+		else
+			s = dhcp_type_names[i - 1];
+		metrics_printf(out, "dhcpd_packets_received_total"
+			       "{family=\"4\",type=\"%s\"} %llu\n", s,
+			       (unsigned long long)metrics_stats.packets[i]);
+	}
+#ifdef DHCPv6
+	for (i = 0; i < METRICS_TYPES6; i++) {
+		if (metrics_stats.packets6[i] == 0)
+			continue;
+		if (i == 0 || i >= dhcpv6_type_name_max)
+			s = "other";
+		else
+			s = dhcpv6_type_names[i];
+		metrics_printf(out, "dhcpd_packets_received_total"
+			       "{family=\"6\",type=\"%s\"} %llu\n", s,
+			       (unsigned long long)metrics_stats.packets6[i]);
+	}
+#endif
+
+	metrics_family(out, "dhcpd_packets_dropped_total", "counter",
+		       "Packets dropped before being handled, by reason.");
+	metrics_printf(out, "dhcpd_packets_dropped_total"
+		       "{reason=\"client-rate\"} %llu\n",
+		       (unsigned long long)
+		       (admission_stats.client_dropped[0] +
+			admission_stats.client_dropped[1]));
+	metrics_printf(out, "dhcpd_packets_dropped_total"
+		       "{reason=\"overload\"} %llu\n",
+		       (unsigned long long)
+		       (admission_stats.overload_dropped[0] +
+			admission_stats.overload_dropped[1]));
+	metrics_printf(out, "dhcpd_packets_dropped_total"
+		       "{reason=\"duplicate\"} %llu\n",
+		       (unsigned long long)dupcache_stats.dropped);
+
+	metrics_family(out, "dhcpd_duplicate_replies_resent_total", "counter",
+		       "Duplicate packets answered from the duplicate cache.");
+	metrics_printf(out, "dhcpd_duplicate_replies_resent_total %llu\n",
+		       (unsigned long long)dupcache_stats.resent);
+}
+
+static void
+render_pools(struct metrics_buffer *out) {
+	struct shared_network *share;
+	struct pool *pool;
+	char labels [128];
+	int i;
+#ifdef DHCPv6
+	struct ipv6_pond *pond;
+	struct ipv6_pool *pool6;
+	char addr [INET6_ADDRSTRLEN];
+	const char *type;
+	int j;
+#endif
+
+	metrics_family(out, "dhcpd_pool_leases", "gauge",
+		       "Leases in each DHCPv4 pool, by state.");
+	for (share = shared_networks; share != NULL; share = share->next) {
+		for (pool = share->pools, i = 0; pool != NULL;
+		     pool = pool->next, i++) {
+			snprintf(labels, sizeof(labels),
+				 "pool=\"%d\",state=\"total\"", i);
+			metrics_sample(out, "dhcpd_pool_leases",
+				       "shared_network", share->name, labels,
+				       pool->lease_count);
+			snprintf(labels, sizeof(labels),
+				 "pool=\"%d\",state=\"free\"", i);
+			metrics_sample(out, "dhcpd_pool_leases",
+				       "shared_network", share->name, labels,
+				       pool->free_leases);
+			snprintf(labels, sizeof(labels),
+				 "pool=\"%d\",state=\"backup\"", i);
+			metrics_sample(out, "dhcpd_pool_leases",
+				       "shared_network", share->name, labels,
+				       pool->backup_leases);
+		}
+	}
+
+#ifdef DHCPv6
+	metrics_family(out, "dhcpd_ipv6_pond_leases", "gauge",
+		       "Leases in each DHCPv6 pond, by state.  Ponds too "
+		       "large to count have no total.");
+	for (share = shared_networks; share != NULL; share = share->next) {
+		for (pond = share->ipv6_pond, i = 0; pond != NULL;
+		     pond = pond->next, i++) {
+			if (!pond->jumbo_range) {
+				snprintf(labels, sizeof(labels),
+					 "pond=\"%d\",state=\"total\"", i);
+				metrics_sample(out, "dhcpd_ipv6_pond_leases",
+					       "shared_network", share->name,
+					       labels, pond->num_total);
+			}
+			snprintf(labels, sizeof(labels),
+				 "pond=\"%d\",state=\"active\"", i);
+			metrics_sample(out, "dhcpd_ipv6_pond_leases",
+				       "shared_network", share->name, labels,
+				       pond->num_active);
+			snprintf(labels, sizeof(labels),
+				 "pond=\"%d\",state=\"abandoned\"", i);
+			metrics_sample(out, "dhcpd_ipv6_pond_leases",
+				       "shared_network", share->name, labels,
+				       pond->num_abandoned);
+		}
+	}
+
+	metrics_family(out, "dhcpd_ipv6_pool_leases", "gauge",
+		       "Leases in each DHCPv6 address range or prefix pool, "
+		       "by state.");
+	for (share = shared_networks; share != NULL; share = share->next) {
+		for (pond = share->ipv6_pond; pond != NULL;
+		     pond = pond->next) {
+			for (j = 0; pond->ipv6_pools != NULL &&
+			     pond->ipv6_pools[j] != NULL; j++) {
+				pool6 = pond->ipv6_pools[j];
+				if (pool6->pool_type == D6O_IA_TA)
+					type = "ta";
+				else if (pool6->pool_type == D6O_IA_PD)
+					type = "pd";
+				else
+					type = "na";
+				inet_ntop(AF_INET6, &pool6->start_addr,
+					  addr, sizeof(addr));
+
+				snprintf(labels, sizeof(labels),
+					 "pool=\"%s/%d\",type=\"%s\","
+					 "state=\"active\"",
+					 addr, pool6->bits, type);
+				metrics_sample(out, "dhcpd_ipv6_pool_leases",
+					       "shared_network", share->name,
+					       labels, pool6->num_active);
+				snprintf(labels, sizeof(labels),
+					 "pool=\"%s/%d\",type=\"%s\","
+					 "state=\"abandoned\"",
+					 addr, pool6->bits, type);
+				metrics_sample(out, "dhcpd_ipv6_pool_leases",
+					       "shared_network", share->name,
+					       labels, pool6->num_abandoned);
+			}
+		}
+	}
+#endif /* DHCPv6 */
+}
+
+static void
+render_queues(struct metrics_buffer *out) {
+#if defined (FAILOVER_PROTOCOL)
+	dhcp_failover_state_t *state;
+	struct lease *lp;
+	unsigned long updates;
+#endif
+
+	metrics_family(out, "dhcpd_pings_outstanding", "gauge",
+		       "Offers held for a ping check.");
+	metrics_printf(out, "dhcpd_pings_outstanding %d\n", outstanding_pings);
+
+	metrics_family(out, "dhcpd_delayed_acks_outstanding", "gauge",
+		       "Acks waiting for the lease file to be committed.");
+	metrics_printf(out, "dhcpd_delayed_acks_outstanding %d\n",
+		       outstanding_acks);
+
+#if defined (FAILOVER_PROTOCOL)
+	metrics_family(out, "dhcpd_failover_queue", "gauge",
+		       "Lease updates waiting to be sent to each failover "
+		       "peer, sent and not yet acknowledged by it, and "
+		       "received from it and not yet acknowledged.");
+	for (state = failover_states; state != NULL; state = state->next) {
+		updates = 0;
+		for (lp = state->update_queue_head; lp != NULL;
+		     lp = lp->next_pending)
+			updates++;
+		metrics_sample(out, "dhcpd_failover_queue", "peer",
+			       state->name, "queue=\"update\"", updates);
+		metrics_sample(out, "dhcpd_failover_queue", "peer",
+			       state->name, "queue=\"unacked\"",
+			       state->cur_unacked_updates);
+		metrics_sample(out, "dhcpd_failover_queue", "peer",
+			       state->name, "queue=\"toack\"",
+			       state->pending_acks);
+	}
+#endif
+
+#if defined (NSUPDATE)
+	metrics_family(out, "dhcpd_ddns_outstanding", "gauge",
+		       "DDNS update messages awaiting an answer.");
+	metrics_printf(out, "dhcpd_ddns_outstanding %lu\n",
+		       (unsigned long)ddns_stats.outstanding);
+	metrics_family(out, "dhcpd_ddns_queued", "gauge",
+		       "DDNS records waiting to be sent.");
+	metrics_printf(out, "dhcpd_ddns_queued %lu\n",
+		       (unsigned long)ddns_stats.queue_depth);
+	metrics_family(out, "dhcpd_ddns_messages_total", "counter",
+		       "DDNS update messages, by outcome.");
+	metrics_printf(out, "dhcpd_ddns_messages_total{result=\"sent\"} "
+		       "%llu\n", (unsigned long long)ddns_stats.sent);
+	metrics_printf(out, "dhcpd_ddns_messages_total{result=\"completed\"} "
+		       "%llu\n", (unsigned long long)ddns_stats.completed);
+	metrics_printf(out, "dhcpd_ddns_messages_total{result=\"failed\"} "
+		       "%llu\n", (unsigned long long)ddns_stats.failed);
+#endif
+
+	metrics_family(out, "dhcpd_lease_expiry_transitions_total", "counter",
+		       "Lease state changes made by pool expiry runs.");
+	metrics_printf(out, "dhcpd_lease_expiry_transitions_total %llu\n",
+		       (unsigned long long)expiry_stats.transitions);
+}
+
+static void
+render_stages(struct metrics_buffer *out) {
+	const struct replay_stats *stats;
+	u_int64_t seen;
+	unsigned b, i, next;
+	int stage;
+
+	metrics_family(out, "dhcpd_stage_duration_seconds", "histogram",
+		       "Time taken by each stage of handling a packet.");
+	for (stage = 0; stage < METRICS_STAGES; stage++) {
+		stats = &metrics_stats.stages[stage];
+		seen = 0;
+		next = 0;
+		for (b = 0; b < sizeof(histogram_bounds) /
+			     sizeof(histogram_bounds[0]); b++) {
+			/* Count the buckets up to the one the bound is in. */
+			for (i = replay_bucket(histogram_bounds[b]);
+			     next <= i; next++)
+				seen += stats->buckets[next];
+			metrics_printf(out, "dhcpd_stage_duration_seconds_bucket"
+				       "{stage=\"%s\",le=\"%g\"} %llu\n",
+				       stage_names[stage],
+				       histogram_bounds[b] / 1000000.0,
+				       (unsigned long long)seen);
+		}
+		metrics_printf(out, "dhcpd_stage_duration_seconds_bucket"
+			       "{stage=\"%s\",le=\"+Inf\"} %llu\n",
+			       stage_names[stage],
+			       (unsigned long long)stats->count);
+		metrics_printf(out, "dhcpd_stage_duration_seconds_sum"
+			       "{stage=\"%s\"} %.6f\n", stage_names[stage],
+			       stats->usecs / 1000000.0);
+		metrics_printf(out, "dhcpd_stage_duration_seconds_count"
+			       "{stage=\"%s\"} %llu\n", stage_names[stage],
+			       (unsigned long long)stats->count);
+	}
+}
+
+/*
+ * \brief Write all of the metrics in the Prometheus text format
+ *
+ * \param out the output, which is started if it is empty
+ * \return 1 if it was written, 0 if memory ran out
+ */
+int
+metrics_render(struct metrics_buffer *out) {
+	if (out->data == NULL) {
+		out->size = 16384;
+		out->data = dmalloc(out->size, MDL);
+		out->len = 0;
+		out->failed = (out->data == NULL);
+	}
+
+	render_packets(out);
+	render_pools(out);
+	render_queues(out);
+	render_stages(out);
+	return (!out->failed);
+}
+
+static int
+metrics_connection_readfd(omapi_object_t *h) {
+	return (((struct metrics_connection *)h)->socket);
+}
+
+static void
+metrics_connection_timeout(void *vc);
+
+/* Close a connection.  It may be freed, so it mustn't be used after. */
+static void
+metrics_close(struct metrics_connection *c) {
+	if (c->closed)
+		return;
+	c->closed = 1;
+	cancel_timeout(metrics_connection_timeout, c);
+	if (c->outer != NULL)
+		omapi_unregister_io_object((omapi_object_t *)c);
+}
+
+static void
+metrics_connection_timeout(void *vc) {
+	metrics_close((struct metrics_connection *)vc);
+}
+
+/* Make the reply to a request, leaving room in front for the header. */
+static void
+metrics_respond(struct metrics_connection *c) {
+	const char *status = "200 OK";
+	char header [METRICS_HEADER_MAX];
+	char *path, *end;
+	int len;
+
+	c->out.size = 16384;
+	c->out.data = dmalloc(c->out.size, MDL);
+	c->out.failed = (c->out.data == NULL);
+	c->out.len = METRICS_HEADER_MAX;
+
+	path = NULL;
+	if (strncmp(c->request, "GET ", 4) == 0) {
+		path = c->request + 4;
+		end = path + strcspn(path, " ?\r\n");
+		*end = '\0';
+	}
+	if (path == NULL)
+		status = "405 Method Not Allowed";
+	else if (strcmp(path, "/metrics") != 0 && strcmp(path, "/") != 0)
+		status = "404 Not Found";
+	else
+		metrics_render(&c->out);
+
+	if (c->out.failed) {
+		if (c->out.data != NULL)
+			dfree(c->out.data, MDL);
+		c->out.data = NULL;
+		c->out.len = c->out.size = 0;
+		return;
+	}
+
+	len = snprintf(header, sizeof(header),
+		       "HTTP/1.0 %s\r\n"
+		       "Content-Type: text/plain; version=0.0.4\r\n"
+		       "Content-Length: %u\r\n"
+		       "Connection: close\r\n\r\n",
+		       status, c->out.len - METRICS_HEADER_MAX);
+	c->out_start = METRICS_HEADER_MAX - len;
+	memcpy(c->out.data + c->out_start, header, len);
+	c->out_sent = c->out_start;
+}
+
+static isc_result_t
+metrics_connection_writer(omapi_object_t *h) {
+	struct metrics_connection *c = (struct metrics_connection *)h;
+	ssize_t sent;
+
+	if (c->closed || c->out.data == NULL)
+		return (ISC_R_SUCCESS);
+
+	sent = write(c->socket, c->out.data + c->out_sent,
+		     c->out.len - c->out_sent);
+	if (sent < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return (ISC_R_INPROGRESS);
+		metrics_close(c);
+		return (ISC_R_SUCCESS);
+	}
+	c->out_sent += sent;
+	if (c->out_sent < c->out.len)
+		return (ISC_R_INPROGRESS);
+
+	metrics_close(c);
+	return (ISC_R_SUCCESS);
+}
+
+static isc_result_t
+metrics_connection_reader(omapi_object_t *h) {
+	struct metrics_connection *c = (struct metrics_connection *)h;
+	ssize_t got;
+
+	if (c->closed || c->out.data != NULL)
+		return (ISC_R_SHUTTINGDOWN);
+
+	got = read(c->socket, c->request + c->request_len,
+		   sizeof(c->request) - 1 - c->request_len);
+	if (got < 0 &&
+	    (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return (ISC_R_SUCCESS);
+	if (got <= 0) {
+		metrics_close(c);
+		return (ISC_R_SHUTTINGDOWN);
+	}
+	c->request_len += got;
+	c->request[c->request_len] = '\0';
+
+	/* Wait for the end of the request header, unless it is too long,
+	   in which case the request line is all that is looked at. */
+	if (strstr(c->request, "\r\n\r\n") == NULL &&
+	    strstr(c->request, "\n\n") == NULL &&
+	    c->request_len < sizeof(c->request) - 1)
+		return (ISC_R_SUCCESS);
+
+	metrics_respond(c);
+	if (c->out.data == NULL) {
+		log_error("No memory for metrics reply.");
+		metrics_close(c);
+		return (ISC_R_SHUTTINGDOWN);
+	}
+	omapi_reregister_io_object(h, 0, metrics_connection_readfd,
+				   0, metrics_connection_writer, 0);
+	return (ISC_R_SHUTTINGDOWN);
+}
+
+static isc_result_t
+metrics_connection_destroy(omapi_object_t *h, const char *file, int line) {
+	struct metrics_connection *c = (struct metrics_connection *)h;
+
+	if (c->socket >= 0) {
+		close(c->socket);
+		c->socket = -1;
+		metrics_connections--;
+	}
+	if (c->out.data != NULL) {
+		dfree(c->out.data, file, line);
+		c->out.data = NULL;
+	}
+	return (ISC_R_SUCCESS);
+}
+
+static int
+metrics_listener_readfd(omapi_object_t *h) {
+	return (metrics_socket);
+}
+
+static isc_result_t
+metrics_accept(omapi_object_t *h) {
+	struct metrics_connection *c = NULL;
+	struct timeval tv;
+	isc_result_t status;
+	int fd, flags;
+
+	fd = accept(metrics_socket, NULL, NULL);
+	if (fd < 0)
+		return (ISC_R_SUCCESS);
+	if (metrics_connections >= METRICS_MAX_CONNECTIONS ||
+	    ((MAX_FD_VALUE != 0) && (fd > MAX_FD_VALUE))) {
+		close(fd);
+		return (ISC_R_SUCCESS);
+	}
+	if ((flags = fcntl(fd, F_GETFL, 0)) < 0 ||
+	    fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		close(fd);
+		return (ISC_R_SUCCESS);
+	}
+
+	if (metrics_connection_allocate(&c, MDL) != ISC_R_SUCCESS) {
+		close(fd);
+		return (ISC_R_SUCCESS);
+	}
+	c->socket = fd;
+	metrics_connections++;
+
+	status = omapi_register_io_object((omapi_object_t *)c,
+					  metrics_connection_readfd,
+					  metrics_connection_readfd,
+					  metrics_connection_reader,
+					  metrics_connection_writer, 0);
+	if (status != ISC_R_SUCCESS) {
+		metrics_connection_dereference(&c, MDL);
+		return (ISC_R_SUCCESS);
+	}
+
+	tv.tv_sec = cur_tv.tv_sec + METRICS_TIMEOUT;
+	tv.tv_usec = cur_tv.tv_usec;
+	add_timeout(&tv, metrics_connection_timeout, c,
+		    (tvref_t)metrics_connection_reference,
+		    (tvunref_t)metrics_connection_dereference);
+	metrics_connection_dereference(&c, MDL);
+	return (ISC_R_SUCCESS);
+}
+
+/* Open the listener and count packets as they arrive, if configured. */
+void
+metrics_setup(void) {
+	struct sockaddr_in addr;
+	isc_result_t status;
+	int flag;
+
+	if (metrics_port == 0)
+		return;
+
+	status = omapi_object_type_register(&metrics_listener_type,
+					    "metrics-listener",
+					    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+					    sizeof(omapi_object_t), 0,
+					    RC_MISC);
+	if (status == ISC_R_SUCCESS)
+		status = omapi_object_type_register(&metrics_connection_type,
+						    "metrics-connection",
+						    0, 0,
+						    metrics_connection_destroy,
+						    0, 0, 0, 0, 0, 0, 0, 0,
+						    sizeof(struct
+							   metrics_connection),
+						    0, RC_MISC);
+	if (status != ISC_R_SUCCESS)
+		log_fatal("Can't register metrics types: %s",
+			  isc_result_totext(status));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+#ifdef HAVE_SA_LEN
+	addr.sin_len = sizeof(addr);
+#endif
+	addr.sin_port = htons(metrics_port);
+	if (metrics_address.s_addr != 0)
+		addr.sin_addr = metrics_address;
+	else
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	metrics_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (metrics_socket < 0) {
+		log_error("Can't create metrics socket: %m");
+		return;
+	}
+	flag = 1;
+	if (setsockopt(metrics_socket, SOL_SOCKET, SO_REUSEADDR,
+		       (char *)&flag, sizeof(flag)) < 0)
+		log_error("Can't set SO_REUSEADDR on metrics socket: %m");
+	if (fcntl(metrics_socket, F_SETFL, O_NONBLOCK) < 0 ||
+	    bind(metrics_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(metrics_socket, METRICS_MAX_CONNECTIONS) < 0) {
+		log_error("Can't listen for metrics on %s port %u: %m",
+			  inet_ntoa(addr.sin_addr), metrics_port);
+		close(metrics_socket);
+		metrics_socket = -1;
+		return;
+	}
+
+	status = omapi_object_allocate(&metrics_listener,
+				       metrics_listener_type, 0, MDL);
+	if (status == ISC_R_SUCCESS)
+		status = omapi_register_io_object(metrics_listener,
+						  metrics_listener_readfd, 0,
+						  metrics_accept, 0, 0);
+	if (status != ISC_R_SUCCESS)
+		log_fatal("Can't register metrics listener: %s",
+			  isc_result_totext(status));
+
+	push_packet_handler(&metrics_handler, metrics_packet);
+#ifdef DHCPv6
+	push_packet_handler6(&metrics_handler6, metrics_packet6);
+#endif
+	metrics_enabled = 1;
+	log_info("Serving metrics on %s port %u.",
+		 inet_ntoa(addr.sin_addr), metrics_port);
+}
@@ -42,12 +42,95 @@ static isc_result_t class_lookup (omapi_object_t **,
 
 static isc_result_t update_lease_flags(struct lease* lease,
 				       omapi_typed_data_t *value);
+static isc_result_t dhcp_bulk_commit(int begin);
+
+/* Lease cursors, for reading every lease a page at a time.  A client
+   creates one, with whatever filters it wants, and gets the first page
+   in the reply; each refresh of the cursor brings the next page, until
+   "done" is set.  Sending the cursor for any other reason sends the same
+   page again.  The cursor walks the buckets of the IPv4 lease address
+   hash table, then those of each IPv6 pool's lease table, and remembers
+   the next bucket.  A lease stays in the same bucket for as long as it's
+   in a table and the table keeps its size, so a lease that is there for
+   the whole walk is reported exactly once, as it is when its page is put
+   together.  The IPv4 table is grown as leases are made for the
+   addresses in ranges (see grow_lease_hashes()), and is replaced by a
+   configuration reload; either ends the walk early, and the client has
+   to start again.  A refresh looks
+   at no more than LEASE_CURSOR_SCAN leases for each one the page can
+   hold, and no more than LEASE_CURSOR_BUCKETS buckets, so that a cursor
+   can't hold up the server; a page may come back short, or even empty,
+   before the cursor is done. */
+
+#if !defined (LEASE_CURSOR_PAGE)
+# define LEASE_CURSOR_PAGE	100	/* leases in a page by default */
+#endif
+#if !defined (LEASE_CURSOR_MAX_PAGE)
+# define LEASE_CURSOR_MAX_PAGE	1000
+#endif
+#if !defined (LEASE_CURSOR_SCAN)
+# define LEASE_CURSOR_SCAN	8
+#endif
+#if !defined (LEASE_CURSOR_BUCKETS)
+# define LEASE_CURSOR_BUCKETS	65536
+#endif
+#if !defined (LEASE_CURSOR_IDLE)
+# define LEASE_CURSOR_IDLE	300	/* seconds before an idle cursor
+					   gives up its leases */
+#endif
+
+struct lease_cursor {
+	OMAPI_OBJECT_PREAMBLE;
+
+	/* Which leases to report. */
+	binding_state_t state;		/* only those in this state, or 0 */
+	TIME since;			/* only those changed since, or 0 */
+	struct pool *pool;		/* only those in this pool... */
+	struct ipv6_pool *ipv6_pool;	/* ...or this one */
+	int page_size;
+
+	/* Where the cursor has got to. */
+	int started;
+	int v6;				/* past the IPv4 pools */
+	int done;
+	int interrupted;		/* done before the end */
+	struct shared_network *networks; /* shared_networks when started */
+	unsigned hash_count;		/* buckets in the IPv4 lease table */
+	struct ipv6_pool *current6;
+	int next6;			/* index of the next IPv6 pool */
+	unsigned bucket;		/* next bucket of the current table */
+
+	/* The leases of the last bucket, and the next one to look at. */
+	struct lease **leases;
+	struct iasubopt **iasubopts;
+	int count, max, next;
+
+	/* The page to be sent. */
+	struct lease **page;
+	struct iasubopt **page6;
+	int page_count, page_count6;
+};
+
+static isc_result_t lease_cursor_set_value(omapi_object_t *, omapi_object_t *,
+					   omapi_data_string_t *,
+					   omapi_typed_data_t *);
+static isc_result_t lease_cursor_destroy(omapi_object_t *, const char *, int);
+static isc_result_t lease_cursor_signal_handler(omapi_object_t *,
+						const char *, va_list);
+static isc_result_t lease_cursor_stuff_values(omapi_object_t *,
+					      omapi_object_t *,
+					      omapi_object_t *);
+static isc_result_t lease_cursor_lookup(omapi_object_t **, omapi_object_t *,
+					omapi_object_t *);
+static isc_result_t lease_cursor_create(omapi_object_t **, omapi_object_t *);
+static isc_result_t lease_cursor_remove(omapi_object_t *, omapi_object_t *);
 
 omapi_object_type_t *dhcp_type_lease;
 omapi_object_type_t *dhcp_type_pool;
 omapi_object_type_t *dhcp_type_class;
 omapi_object_type_t *dhcp_type_subclass;
 omapi_object_type_t *dhcp_type_host;
+omapi_object_type_t *dhcp_type_lease_cursor;
 #if defined (FAILOVER_PROTOCOL)
 omapi_object_type_t *dhcp_type_failover_state;
 omapi_object_type_t *dhcp_type_failover_link;
@@ -145,6 +228,23 @@ void dhcp_db_objects_setup ()
 		log_fatal ("Can't register host object type: %s",
 			   isc_result_totext (status));
 
+	status = omapi_object_type_register (&dhcp_type_lease_cursor,
+					     "lease-cursor",
+					     lease_cursor_set_value,
+					     0,
+					     lease_cursor_destroy,
+					     lease_cursor_signal_handler,
+					     lease_cursor_stuff_values,
+					     lease_cursor_lookup,
+					     lease_cursor_create,
+					     lease_cursor_remove, 0, 0, 0,
+					     sizeof (struct lease_cursor),
+					     0, RC_MISC);
+
+	if (status != ISC_R_SUCCESS)
+		log_fatal ("Can't register lease cursor object type: %s",
+			   isc_result_totext (status));
+
 #if defined (FAILOVER_PROTOCOL)
 	status = omapi_object_type_register (&dhcp_type_failover_state,
 					     "failover-state",
@@ -195,6 +295,28 @@ void dhcp_db_objects_setup ()
 		log_fatal ("Can't register failover listener object type: %s",
 			   isc_result_totext (status));
 #endif /* FAILOVER_PROTOCOL */
+
+	omapi_bulk_hook = dhcp_bulk_commit;
+}
+
+/*
+ * \brief Commits the changes made by a bulk OMAPI message together
+ *
+ * The objects in a bulk message are written to the lease file as they
+ * are opened, as usual, but the file is only flushed and synced once
+ * they all have been rather than once for each of them.
+ *
+ * \param begin 1 before the objects are opened, 0 after
+ *
+ * \return ISC_R_IOERROR if the changes couldn't be committed,
+ * ISC_R_SUCCESS otherwise
+ */
+static isc_result_t dhcp_bulk_commit(int begin) {
+	if (begin) {
+		hold_commits();
+		return (ISC_R_SUCCESS);
+	}
+	return (release_commits() ? ISC_R_SUCCESS : ISC_R_IOERROR);
 }
 
 isc_result_t dhcp_lease_set_value  (omapi_object_t *h,
@@ -513,7 +635,7 @@ isc_result_t dhcp_lease_destroy (omapi_object_t *h, const char *file, int line)
 		free_lease_state (lease->state, file, line);
 		lease->state = (struct lease_state *)0;
 
-		cancel_timeout (lease_ping_timeout, lease);
+		ping_cancel (lease);
 		--outstanding_pings; /* XXX */
 	}
 
@@ -528,10 +650,6 @@ isc_result_t dhcp_lease_destroy (omapi_object_t *h, const char *file, int line)
 		lease_dereference (&lease->next, file, line);
 	 */
 
-	if (lease->n_hw)
-		lease_dereference (&lease->n_hw, file, line);
-	if (lease->n_uid)
-		lease_dereference (&lease->n_uid, file, line);
 	if (lease->next_pending)
 		lease_dereference (&lease->next_pending, file, line);
 
@@ -751,6 +869,8 @@ isc_result_t dhcp_lease_lookup (omapi_object_t **lp,
 	omapi_value_t *tv = (omapi_value_t *)0;
 	isc_result_t status;
 	struct lease *lease;
+	struct client_leases *set;
+	struct iaddr ia;
 
 	if (!ref)
 		return DHCP_R_NOKEYS;
@@ -775,9 +895,13 @@ isc_result_t dhcp_lease_lookup (omapi_object_t **lp,
 	status = omapi_get_value_str (ref, id, "ip-address", &tv);
 	if (status == ISC_R_SUCCESS) {
 		lease = (struct lease *)0;
-		lease_ip_hash_lookup(&lease, lease_ip_addr_hash,
-				     tv->value->u.buffer.value,
-				     tv->value->u.buffer.len, MDL);
+		/* An address that has never been used has no lease, so it
+		   isn't found. */
+		if (tv->value->u.buffer.len <= sizeof ia.iabuf) {
+			ia.len = tv->value->u.buffer.len;
+			memcpy(ia.iabuf, tv->value->u.buffer.value, ia.len);
+			find_lease_by_ip_addr(&lease, ia, MDL);
+		}
 
 		omapi_value_dereference (&tv, MDL);
 
@@ -803,30 +927,23 @@ isc_result_t dhcp_lease_lookup (omapi_object_t **lp,
 	/* Now look for a client identifier. */
 	status = omapi_get_value_str (ref, id, "dhcp-client-identifier", &tv);
 	if (status == ISC_R_SUCCESS) {
-		lease = (struct lease *)0;
-		lease_id_hash_lookup(&lease, lease_uid_hash,
-				     tv->value->u.buffer.value,
-				     tv->value->u.buffer.len, MDL);
+		set = find_client_leases_by_uid (tv->value->u.buffer.value,
+						 tv->value->u.buffer.len);
 		omapi_value_dereference (&tv, MDL);
 
-		if (*lp && *lp != (omapi_object_t *)lease) {
+		if (*lp && (!set ||
+			    *lp != (omapi_object_t *)set -> leases [0])) {
 			omapi_object_dereference (lp, MDL);
-			lease_dereference (&lease, MDL);
 			return DHCP_R_KEYCONFLICT;
-		} else if (!lease) {
-			if (*lp)
-			    omapi_object_dereference (lp, MDL);
+		} else if (!set) {
 			return ISC_R_NOTFOUND;
-		} else if (lease -> n_uid) {
+		} else if (set -> count > 1) {
 			if (*lp)
 			    omapi_object_dereference (lp, MDL);
 			return DHCP_R_MULTIPLE;
 		} else if (!*lp) {
-			/* XXX fix so that hash lookup itself creates
-			   XXX the reference. */
-			omapi_object_reference (lp,
-						(omapi_object_t *)lease, MDL);
-			lease_dereference (&lease, MDL);
+			omapi_object_reference (lp, (omapi_object_t *)
+						set -> leases [0], MDL);
 		}
 	}
 
@@ -877,30 +994,22 @@ isc_result_t dhcp_lease_lookup (omapi_object_t **lp,
 			haddr[0] = HTYPE_ETHER;
 		}
 
-		lease = (struct lease *)0;
-		lease_id_hash_lookup(&lease, lease_hw_addr_hash, haddr, len,
-				     MDL);
+		set = find_client_leases_by_hw_addr (haddr, len);
 		dfree (haddr, MDL);
 
-		if (*lp && *lp != (omapi_object_t *)lease) {
+		if (*lp && (!set ||
+			    *lp != (omapi_object_t *)set -> leases [0])) {
 			omapi_object_dereference (lp, MDL);
-			lease_dereference (&lease, MDL);
 			return DHCP_R_KEYCONFLICT;
-		} else if (!lease) {
-			if (*lp)
-			    omapi_object_dereference (lp, MDL);
+		} else if (!set) {
 			return ISC_R_NOTFOUND;
-		} else if (lease -> n_hw) {
+		} else if (set -> count > 1) {
 			if (*lp)
 			    omapi_object_dereference (lp, MDL);
-			lease_dereference (&lease, MDL);
 			return DHCP_R_MULTIPLE;
 		} else if (!*lp) {
-			/* XXX fix so that hash lookup itself creates
-			   XXX the reference. */
-			omapi_object_reference (lp,
-						(omapi_object_t *)lease, MDL);
-			lease_dereference (&lease, MDL);
+			omapi_object_reference (lp, (omapi_object_t *)
+						set -> leases [0], MDL);
 		}
 	}
 
@@ -1691,6 +1800,8 @@ isc_result_t dhcp_pool_destroy (omapi_object_t *h, const char *file, int line)
 	}
 	pool -> prohibit_list = (struct permit *)0;
 
+	free_lease_ranges (pool);
+
 	return ISC_R_SUCCESS;
 }
 
@@ -2612,4 +2723,656 @@ isc_result_t binding_scope_stuff_values (omapi_object_t *c,
 	return ISC_R_SUCCESS;
 }
 
+/* Lease cursors; see the comment at the top of the file. */
+
+/* Add a lease to those gathered from the cursor's last bucket. */
+static isc_result_t
+lease_cursor_add(struct lease_cursor *cursor, struct lease *lease) {
+	struct lease **bigger;
+	int max;
+
+	if (cursor->count == cursor->max) {
+		max = cursor->max ? cursor->max * 2 : 16;
+		bigger = dmalloc(max * sizeof(*bigger), MDL);
+		if (bigger == NULL)
+			return (ISC_R_NOMEMORY);
+		if (cursor->leases != NULL) {
+			memcpy(bigger, cursor->leases,
+			       cursor->count * sizeof(*bigger));
+			dfree(cursor->leases, MDL);
+		}
+		cursor->leases = bigger;
+		cursor->max = max;
+	}
+	lease_reference(&cursor->leases[cursor->count++], lease, MDL);
+	return (ISC_R_SUCCESS);
+}
+
+/* The same for an IPv6 lease. */
+static isc_result_t
+lease_cursor_add6(struct lease_cursor *cursor, struct iasubopt *lease) {
+	struct iasubopt **bigger;
+	int max;
+
+	if (cursor->count == cursor->max) {
+		max = cursor->max ? cursor->max * 2 : 16;
+		bigger = dmalloc(max * sizeof(*bigger), MDL);
+		if (bigger == NULL)
+			return (ISC_R_NOMEMORY);
+		if (cursor->iasubopts != NULL) {
+			memcpy(bigger, cursor->iasubopts,
+			       cursor->count * sizeof(*bigger));
+			dfree(cursor->iasubopts, MDL);
+		}
+		cursor->iasubopts = bigger;
+		cursor->max = max;
+	}
+	iasubopt_reference(&cursor->iasubopts[cursor->count++], lease, MDL);
+	return (ISC_R_SUCCESS);
+}
+
+/* Let go of the gathered leases that haven't been looked at. */
+static void
+lease_cursor_drop_bucket(struct lease_cursor *cursor) {
+	int i;
+
+	for (i = cursor->next; i < cursor->count; i++) {
+		if (!cursor->v6)
+			lease_dereference(&cursor->leases[i], MDL);
+		else
+			iasubopt_dereference(&cursor->iasubopts[i], MDL);
+	}
+	cursor->count = cursor->next = 0;
+}
+
+/* Let go of the page that was sent last time. */
+static void
+lease_cursor_drop_page(struct lease_cursor *cursor) {
+	int i;
+
+	for (i = 0; i < cursor->page_count; i++)
+		lease_dereference(&cursor->page[i], MDL);
+	for (i = 0; i < cursor->page_count6; i++)
+		iasubopt_dereference(&cursor->page6[i], MDL);
+	cursor->page_count = cursor->page_count6 = 0;
+}
+
+static void lease_cursor_idle(void *);
+
+/* Mark the cursor done, and let go of everything but the page. */
+static void
+lease_cursor_finish(struct lease_cursor *cursor, int interrupted) {
+	if (!cursor->done)
+		cancel_timeout(lease_cursor_idle, cursor);
+	cursor->done = 1;
+	cursor->interrupted |= interrupted;
+	lease_cursor_drop_bucket(cursor);
+	if (cursor->leases != NULL)
+		dfree(cursor->leases, MDL);
+	if (cursor->iasubopts != NULL)
+		dfree(cursor->iasubopts, MDL);
+	cursor->leases = NULL;
+	cursor->iasubopts = NULL;
+	cursor->max = 0;
+	if (cursor->networks != NULL)
+		shared_network_dereference(&cursor->networks, MDL);
+	if (cursor->current6 != NULL)
+		ipv6_pool_dereference(&cursor->current6, MDL);
+}
+
+/* A client that stops reading a cursor shouldn't leave it holding on to
+   leases for ever. */
+static void
+lease_cursor_idle(void *vp) {
+	struct lease_cursor *cursor = vp;
+
+	log_info("Lease cursor unread for %d seconds; closing it.",
+		 LEASE_CURSOR_IDLE);
+	lease_cursor_drop_page(cursor);
+	lease_cursor_finish(cursor, 1);
+}
+
+/* Gather the leases in the cursor's next bucket of a lease table.
+   Returns zero when there are no more buckets. */
+static int
+lease_cursor_next_bucket(struct lease_cursor *cursor,
+			 struct hash_table *table, isc_result_t *status) {
+	struct hash_bucket *bp;
+
+	*status = ISC_R_SUCCESS;
+	if (table == NULL || cursor->bucket >= table->hash_count)
+		return (0);
+	for (bp = table->buckets[cursor->bucket++];
+	     bp != NULL && *status == ISC_R_SUCCESS; bp = bp->next) {
+		if (!cursor->v6)
+			*status = lease_cursor_add(cursor,
+						   (struct lease *)bp->value);
+		else
+			*status = lease_cursor_add6(cursor, (struct iasubopt *)
+							    bp->value);
+	}
+	return (1);
+}
+
+/* Move the cursor on to the next IPv6 pool, which a configuration reload
+   leaves alone.  Returns zero when there are no more pools. */
+static int
+lease_cursor_next_pool6(struct lease_cursor *cursor) {
+	struct ipv6_pool *pool;
+
+	if (cursor->pool != NULL)
+		return (0);
+	if (cursor->ipv6_pool != NULL) {
+		if (cursor->next6++ > 0)
+			return (0);
+		pool = cursor->ipv6_pool;
+	} else {
+		if (pools == NULL || pools[cursor->next6] == NULL)
+			return (0);
+		pool = pools[cursor->next6++];
+	}
+	if (cursor->current6 != NULL)
+		ipv6_pool_dereference(&cursor->current6, MDL);
+	ipv6_pool_reference(&cursor->current6, pool, MDL);
+	cursor->bucket = 0;
+	return (1);
+}
+
+/* Whether a lease passes the cursor's filters.  A lease has changed since
+   the given time if a client has used it since then, or if it started or
+   ended since then. */
+static int
+lease_cursor_match(struct lease_cursor *cursor, struct lease *lease) {
+	if (cursor->pool && lease->pool != cursor->pool)
+		return (0);
+	if (cursor->state && lease->binding_state != cursor->state)
+		return (0);
+	if (!cursor->since)
+		return (1);
+	return (lease->cltt >= cursor->since ||
+		lease->starts >= cursor->since ||
+		(lease->ends >= cursor->since && lease->ends <= cur_time));
+}
+
+static int
+lease_cursor_match6(struct lease_cursor *cursor, struct iasubopt *lease) {
+	struct iasubopt *found = NULL;
+
+	/* Leave out leases that have gone from the pool since they were
+	   gathered. */
+	if (!iasubopt_hash_lookup(&found, cursor->current6->leases,
+				  &lease->addr, sizeof(lease->addr), MDL))
+		return (0);
+	iasubopt_dereference(&found, MDL);
+
+	if (cursor->state && lease->state != cursor->state)
+		return (0);
+	if (!cursor->since)
+		return (1);
+	return ((lease->ia != NULL && lease->ia->cltt >= cursor->since) ||
+		(lease->hard_lifetime_end_time >= cursor->since &&
+		 lease->hard_lifetime_end_time <= cur_time));
+}
+
+/* Put the next page of leases together. */
+static void
+lease_cursor_fill(struct lease_cursor *cursor) {
+	isc_result_t status = ISC_R_SUCCESS;
+	struct timeval tv;
+	int work, limit, buckets;
+
+	lease_cursor_drop_page(cursor);
+	if (cursor->done)
+		return;
+
+	if (!cursor->started) {
+		cursor->started = 1;
+		cursor->page = dmalloc(cursor->page_size *
+				       sizeof(*cursor->page), MDL);
+		cursor->page6 = dmalloc(cursor->page_size *
+					sizeof(*cursor->page6), MDL);
+		if (cursor->page == NULL || cursor->page6 == NULL) {
+			log_error("No memory for a lease cursor page.");
+			lease_cursor_finish(cursor, 1);
+			return;
+		}
+		if (shared_networks != NULL)
+			shared_network_reference(&cursor->networks,
+						 shared_networks, MDL);
+		if (lease_ip_addr_hash != NULL)
+			cursor->hash_count = lease_ip_addr_hash->hash_count;
+		if (cursor->ipv6_pool != NULL)
+			cursor->v6 = 1;
+	}
+
+	/* A configuration reload replaces the IPv4 lease table, and
+	   growing it moves leases to other buckets, so the client has to
+	   start again. */
+	if (!cursor->v6 && shared_networks != cursor->networks) {
+		log_info("Lease cursor interrupted by a configuration "
+			 "reload.");
+		lease_cursor_finish(cursor, 1);
+		return;
+	}
+	if (!cursor->v6 && lease_ip_addr_hash != NULL &&
+	    lease_ip_addr_hash->hash_count != cursor->hash_count) {
+		log_info("Lease cursor interrupted by the lease table "
+			 "growing.");
+		lease_cursor_finish(cursor, 1);
+		return;
+	}
+
+	limit = cursor->page_size * LEASE_CURSOR_SCAN;
+	work = buckets = 0;
+	while (cursor->page_count + cursor->page_count6 < cursor->page_size &&
+	       work < limit) {
+		if (cursor->next < cursor->count) {
+			if (!cursor->v6) {
+				if (lease_cursor_match
+				    (cursor, cursor->leases[cursor->next]))
+					lease_reference
+					    (&cursor->page[cursor->page_count++],
+					     cursor->leases[cursor->next],
+					     MDL);
+				lease_dereference
+				    (&cursor->leases[cursor->next], MDL);
+			} else {
+				if (lease_cursor_match6
+				    (cursor, cursor->iasubopts[cursor->next]))
+					iasubopt_reference
+					    (&cursor->page6
+					     [cursor->page_count6++],
+					     cursor->iasubopts[cursor->next],
+					     MDL);
+				iasubopt_dereference
+				    (&cursor->iasubopts[cursor->next], MDL);
+			}
+			cursor->next++;
+			work++;
+			continue;
+		}
+
+		/* Most buckets are empty, and cost next to nothing to look
+		   at, so they get an allowance of their own. */
+		if (buckets++ == LEASE_CURSOR_BUCKETS)
+			break;
+		cursor->count = cursor->next = 0;
+		if (!cursor->v6) {
+			if (lease_cursor_next_bucket(cursor, lease_ip_addr_hash,
+						     &status))
+				goto gathered;
+			cursor->v6 = 1;
+		}
+		if (cursor->current6 != NULL &&
+		    lease_cursor_next_bucket(cursor, cursor->current6->leases,
+					     &status))
+			goto gathered;
+		if (lease_cursor_next_pool6(cursor))
+			continue;
+		lease_cursor_finish(cursor, 0);
+		return;
+
+	      gathered:
+		if (status != ISC_R_SUCCESS) {
+			log_error("No memory for a lease cursor.");
+			lease_cursor_finish(cursor, 1);
+			return;
+		}
+	}
+
+	tv.tv_sec = cur_tv.tv_sec + LEASE_CURSOR_IDLE;
+	tv.tv_usec = cur_tv.tv_usec;
+	add_timeout(&tv, lease_cursor_idle, cursor,
+		    (tvref_t)omapi_object_reference,
+		    (tvunref_t)omapi_object_dereference);
+}
+
+static isc_result_t
+lease_cursor_set_value(omapi_object_t *h, omapi_object_t *id,
+		       omapi_data_string_t *name, omapi_typed_data_t *value)
+{
+	struct lease_cursor *cursor;
+	struct iaddr addr;
+	struct in6_addr addr6;
+	unsigned long l;
+	isc_result_t status;
+
+	if (h->type != dhcp_type_lease_cursor)
+		return (DHCP_R_INVALIDARG);
+	cursor = (struct lease_cursor *)h;
+
+	if (!omapi_ds_strcmp(name, "state")) {
+		if (cursor->started)
+			return (DHCP_R_INVALIDARG);
+		status = omapi_get_int_value(&l, value);
+		if (status != ISC_R_SUCCESS)
+			return (status);
+		if (l > FTS_LAST)
+			return (DHCP_R_INVALIDARG);
+		cursor->state = l;
+		return (ISC_R_SUCCESS);
+	}
+
+	if (!omapi_ds_strcmp(name, "since")) {
+		if (cursor->started)
+			return (DHCP_R_INVALIDARG);
+		status = omapi_get_int_value(&l, value);
+		if (status != ISC_R_SUCCESS)
+			return (status);
+		cursor->since = l;
+		return (ISC_R_SUCCESS);
+	}
+
+	if (!omapi_ds_strcmp(name, "page-size")) {
+		if (cursor->started)
+			return (DHCP_R_INVALIDARG);
+		status = omapi_get_int_value(&l, value);
+		if (status != ISC_R_SUCCESS)
+			return (status);
+		if (l == 0)
+			return (DHCP_R_INVALIDARG);
+		cursor->page_size = l < LEASE_CURSOR_MAX_PAGE ?
+				    l : LEASE_CURSOR_MAX_PAGE;
+		return (ISC_R_SUCCESS);
+	}
+
+	/* Any address in the pool picks it. */
+	if (!omapi_ds_strcmp(name, "pool")) {
+		if (cursor->started || value->type != omapi_datatype_data)
+			return (DHCP_R_INVALIDARG);
+		if (cursor->pool != NULL)
+			pool_dereference(&cursor->pool, MDL);
+		if (cursor->ipv6_pool != NULL)
+			ipv6_pool_dereference(&cursor->ipv6_pool, MDL);
+
+		if (value->u.buffer.len == 4) {
+			addr.len = 4;
+			memcpy(addr.iabuf, value->u.buffer.value, 4);
+			if (!find_address_pool(&cursor->pool, addr))
+				return (ISC_R_NOTFOUND);
+			return (ISC_R_SUCCESS);
+		}
+		if (value->u.buffer.len == sizeof(addr6)) {
+			memcpy(&addr6, value->u.buffer.value, sizeof(addr6));
+			if (find_ipv6_pool(&cursor->ipv6_pool, D6O_IA_NA,
+					   &addr6) == ISC_R_SUCCESS ||
+			    find_ipv6_pool(&cursor->ipv6_pool, D6O_IA_TA,
+					   &addr6) == ISC_R_SUCCESS ||
+			    find_ipv6_pool(&cursor->ipv6_pool, D6O_IA_PD,
+					   &addr6) == ISC_R_SUCCESS)
+				return (ISC_R_SUCCESS);
+			return (ISC_R_NOTFOUND);
+		}
+		return (DHCP_R_INVALIDARG);
+	}
+
+	/* Try to find some inner object that can take the value. */
+	if (h->inner && h->inner->type->set_value) {
+		status = ((*(h->inner->type->set_value))
+			  (h->inner, id, name, value));
+		if (status == ISC_R_SUCCESS)
+			return (status);
+	}
+
+	return (ISC_R_NOTFOUND);
+}
+
+static isc_result_t
+lease_cursor_destroy(omapi_object_t *h, const char *file, int line) {
+	struct lease_cursor *cursor;
+
+	if (h->type != dhcp_type_lease_cursor)
+		return (DHCP_R_INVALIDARG);
+	cursor = (struct lease_cursor *)h;
+
+	lease_cursor_drop_page(cursor);
+	lease_cursor_finish(cursor, 0);
+	if (cursor->page != NULL)
+		dfree(cursor->page, file, line);
+	if (cursor->page6 != NULL)
+		dfree(cursor->page6, file, line);
+	if (cursor->pool != NULL)
+		pool_dereference(&cursor->pool, file, line);
+	if (cursor->ipv6_pool != NULL)
+		ipv6_pool_dereference(&cursor->ipv6_pool, file, line);
+	return (ISC_R_SUCCESS);
+}
+
+/* A cursor moves on to the next page only when it's refreshed.  The
+   first page is put together once the filters given when it was created
+   have been set. */
+static isc_result_t
+lease_cursor_signal_handler(omapi_object_t *h, const char *name, va_list ap)
+{
+	struct lease_cursor *cursor;
+	isc_result_t status;
+
+	if (h->type != dhcp_type_lease_cursor)
+		return (DHCP_R_INVALIDARG);
+	cursor = (struct lease_cursor *)h;
+
+	if (!strcmp(name, "updated")) {
+		if (!cursor->started)
+			lease_cursor_fill(cursor);
+		return (ISC_R_SUCCESS);
+	}
+	if (!strcmp(name, "refresh")) {
+		lease_cursor_fill(cursor);
+		return (ISC_R_SUCCESS);
+	}
+
+	/* Try to find some inner object that can take the signal. */
+	if (h->inner && h->inner->type->signal_handler) {
+		status = ((*(h->inner->type->signal_handler))
+			  (h->inner, name, ap));
+		if (status == ISC_R_SUCCESS)
+			return (status);
+	}
+	return (ISC_R_NOTFOUND);
+}
+
+/* Write out one value of the i'th lease on the page. */
+static isc_result_t
+lease_cursor_put(omapi_object_t *c, int i, const char *name,
+		 const void *data, unsigned len)
+{
+	char buf[64];
+	isc_result_t status;
+
+	snprintf(buf, sizeof(buf), "lease-%d.%s", i, name);
+	status = omapi_connection_put_name(c, buf);
+	if (status != ISC_R_SUCCESS)
+		return (status);
+	status = omapi_connection_put_uint32(c, len);
+	if (status != ISC_R_SUCCESS || len == 0)
+		return (status);
+	return (omapi_connection_copyin(c, data, len));
+}
+
+static isc_result_t
+lease_cursor_put_uint32(omapi_object_t *c, int i, const char *name,
+			u_int32_t value)
+{
+	unsigned char buf[4];
+
+	putULong(buf, value);
+	return (lease_cursor_put(c, i, name, buf, sizeof(buf)));
+}
+
+static isc_result_t
+lease_cursor_put_lease(omapi_object_t *c, int i, struct lease *lease) {
+	isc_result_t status;
+
+	status = lease_cursor_put_uint32(c, i, "state", lease->binding_state);
+	if (status == ISC_R_SUCCESS)
+		status = lease_cursor_put(c, i, "ip-address",
+					  lease->ip_addr.iabuf,
+					  lease->ip_addr.len);
+	if (status == ISC_R_SUCCESS)
+		status = lease_cursor_put_uint32(c, i, "starts",
+						 (u_int32_t)lease->starts);
+	if (status == ISC_R_SUCCESS)
+		status = lease_cursor_put_uint32(c, i, "ends",
+						 (u_int32_t)lease->ends);
+	if (status == ISC_R_SUCCESS)
+		status = lease_cursor_put_uint32(c, i, "cltt",
+						 (u_int32_t)lease->cltt);
+	if (status == ISC_R_SUCCESS && lease->hardware_addr.hlen) {
+		status = lease_cursor_put(c, i, "hardware-address",
+					  &lease->hardware_addr.hbuf[1],
+					  lease->hardware_addr.hlen - 1);
+		if (status == ISC_R_SUCCESS)
+			status = lease_cursor_put_uint32
+				(c, i, "hardware-type",
+				 lease->hardware_addr.hbuf[0]);
+	}
+	if (status == ISC_R_SUCCESS && lease->uid_len)
+		status = lease_cursor_put(c, i, "dhcp-client-identifier",
+					  lease->uid, lease->uid_len);
+	if (status == ISC_R_SUCCESS && lease->client_hostname)
+		status = lease_cursor_put(c, i, "client-hostname",
+					  lease->client_hostname,
+					  strlen(lease->client_hostname));
+	return (status);
+}
+
+static isc_result_t
+lease_cursor_put_lease6(omapi_object_t *c, int i, struct iasubopt *lease) {
+	isc_result_t status;
+
+	status = lease_cursor_put_uint32(c, i, "state", lease->state);
+	if (status == ISC_R_SUCCESS)
+		status = lease_cursor_put(c, i, "ip-address", &lease->addr,
+					  sizeof(lease->addr));
+	if (status == ISC_R_SUCCESS && lease->ipv6_pool != NULL &&
+	    lease->ipv6_pool->pool_type == D6O_IA_PD)
+		status = lease_cursor_put_uint32(c, i, "prefix-length",
+						 lease->plen);
+	if (status == ISC_R_SUCCESS)
+		status = lease_cursor_put_uint32
+			(c, i, "ends", (u_int32_t)lease->hard_lifetime_end_time);
+	if (status == ISC_R_SUCCESS && lease->ia != NULL) {
+		status = lease_cursor_put_uint32(c, i, "cltt",
+						 (u_int32_t)lease->ia->cltt);
+		if (status == ISC_R_SUCCESS)
+			status = lease_cursor_put_uint32(c, i, "ia-type",
+							 lease->ia->ia_type);
+		if (status == ISC_R_SUCCESS)
+			status = lease_cursor_put
+				(c, i, "iaid-duid", lease->ia->iaid_duid.data,
+				 lease->ia->iaid_duid.len);
+	}
+	return (status);
+}
+
+/* Sending the cursor sends its current page.  Each lease on the page has
+   its values named with a "lease-<n>." prefix, n counting from zero, and
+   "count" says how many leases there are. */
+static isc_result_t
+lease_cursor_stuff_values(omapi_object_t *c, omapi_object_t *id,
+			  omapi_object_t *h)
+{
+	struct lease_cursor *cursor;
+	isc_result_t status;
+	int i;
+
+	if (h->type != dhcp_type_lease_cursor)
+		return (DHCP_R_INVALIDARG);
+	cursor = (struct lease_cursor *)h;
+
+	status = omapi_connection_put_named_uint32
+		(c, "count", cursor->page_count + cursor->page_count6);
+	if (status != ISC_R_SUCCESS)
+		return (status);
+	status = omapi_connection_put_named_uint32(c, "done", cursor->done);
+	if (status != ISC_R_SUCCESS)
+		return (status);
+	if (cursor->interrupted) {
+		status = omapi_connection_put_named_uint32(c, "interrupted",
+							   1);
+		if (status != ISC_R_SUCCESS)
+			return (status);
+	}
+
+	for (i = 0; i < cursor->page_count; i++) {
+		status = lease_cursor_put_lease(c, i, cursor->page[i]);
+		if (status != ISC_R_SUCCESS)
+			return (status);
+	}
+	for (i = 0; i < cursor->page_count6; i++) {
+		status = lease_cursor_put_lease6(c, cursor->page_count + i,
+						 cursor->page6[i]);
+		if (status != ISC_R_SUCCESS)
+			return (status);
+	}
+
+	/* Write out the inner object, if any. */
+	if (h->inner && h->inner->type->stuff_values) {
+		status = ((*(h->inner->type->stuff_values))
+			  (c, id, h->inner));
+		if (status == ISC_R_SUCCESS)
+			return (status);
+	}
+
+	return (ISC_R_SUCCESS);
+}
+
+/* A cursor can only be found by its handle. */
+static isc_result_t
+lease_cursor_lookup(omapi_object_t **lp, omapi_object_t *id,
+		    omapi_object_t *ref)
+{
+	omapi_value_t *tv = NULL;
+	isc_result_t status;
+
+	if (!ref)
+		return (DHCP_R_NOKEYS);
+
+	status = omapi_get_value_str(ref, id, "handle", &tv);
+	if (status != ISC_R_SUCCESS)
+		return (DHCP_R_NOKEYS);
+	status = omapi_handle_td_lookup(lp, tv->value);
+	omapi_value_dereference(&tv, MDL);
+	if (status != ISC_R_SUCCESS)
+		return (status);
+
+	/* Don't return the object if the type is wrong. */
+	if ((*lp)->type != dhcp_type_lease_cursor) {
+		omapi_object_dereference(lp, MDL);
+		return (DHCP_R_INVALIDARG);
+	}
+	return (ISC_R_SUCCESS);
+}
+
+static isc_result_t
+lease_cursor_create(omapi_object_t **lp, omapi_object_t *id) {
+	struct lease_cursor *cursor = NULL;
+	isc_result_t status;
+
+	status = omapi_object_allocate((omapi_object_t **)&cursor,
+				       dhcp_type_lease_cursor, 0, MDL);
+	if (status != ISC_R_SUCCESS)
+		return (status);
+	cursor->page_size = LEASE_CURSOR_PAGE;
+	status = omapi_object_reference(lp, (omapi_object_t *)cursor, MDL);
+	omapi_object_dereference((omapi_object_t **)&cursor, MDL);
+	return (status);
+}
+
+/* Removing a cursor closes it; its handle stays valid, but there are no
+   more pages. */
+static isc_result_t
+lease_cursor_remove(omapi_object_t *lp, omapi_object_t *id) {
+	struct lease_cursor *cursor;
+
+	if (lp->type != dhcp_type_lease_cursor)
+		return (DHCP_R_INVALIDARG);
+	cursor = (struct lease_cursor *)lp;
+
+	lease_cursor_drop_page(cursor);
+	cursor->started = 1;
+	lease_cursor_finish(cursor, 0);
+	return (ISC_R_SUCCESS);
+}
+
 /* vim: set tabstop=8: */
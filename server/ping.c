@@ -0,0 +1,402 @@
+/* ping.c
+
+   Ping checks for addresses the server is about to offer. */
+
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/*! \file server/ping.c
+ *
+ * \page ping ping check overview
+ *
+ * Every echo request we send is described by a probe.  Probes are kept
+ * in a hash table on the target address and in a single list ordered
+ * by the time they expire, so one timer serves all of them and each
+ * time it fires every probe that has run out is handled in one pass.
+ * Each request carries our identifier and its own sequence number and
+ * a reply only counts if the address, identifier and sequence number
+ * all match a probe we sent.
+ *
+ * There are three kinds of probe:
+ *
+ * - PING_OFFER: the address is about to be offered and the offer is
+ *   held until the probe expires or is answered (lease_ping_timeout()
+ *   and lease_pinged() in dhcpd.c).
+ *
+ * - PING_AHEAD: when ping-ahead is set we also ping the next few free
+ *   leases in the pool, which are the ones most likely to be offered
+ *   next, while the current offer waits.
+ *
+ * - PING_VERIFIED: a PING_AHEAD probe that expired without an answer
+ *   turns into one of these.  It remembers for ping-verified-lifetime
+ *   seconds that the address didn't answer, and an offer of that
+ *   address made in that time is sent without waiting for a ping.
+ */
+
+#include "dhcpd.h"
+#include "netinet/ip.h"
+#include "netinet/ip_icmp.h"
+
+#define PING_HASH_SIZE	1024	/* must be a power of two */
+
+struct ping_probe {
+	struct ping_probe *hnext;		/* hash chain */
+	struct ping_probe *prev, *next;		/* expiry order */
+	struct iaddr addr;
+	u_int16_t id, seq;
+	int kind;
+	u_int32_t lifetime;			/* for PING_AHEAD */
+	struct timeval expires;
+	struct lease *lease;			/* not for PING_VERIFIED */
+};
+
+static struct ping_probe *ping_hash[PING_HASH_SIZE];
+static struct ping_probe *ping_head, *ping_tail;
+static struct ping_probe *ping_free_list;
+static int ping_pending;			/* offer and ahead probes */
+static u_int16_t ping_id, ping_seq;
+
+static void ping_timeout(void *);
+
+static unsigned
+ping_hash_addr(const struct iaddr *addr) {
+	u_int32_t h = 0;
+	unsigned i;
+
+	for (i = 0; i < addr->len; i++)
+		h = (h * 33) + addr->iabuf[i];
+	return ((h ^ (h >> 10)) & (PING_HASH_SIZE - 1));
+}
+
+static int
+tv_before(const struct timeval *a, const struct timeval *b) {
+	return ((a->tv_sec < b->tv_sec) ||
+		((a->tv_sec == b->tv_sec) && (a->tv_usec < b->tv_usec)));
+}
+
+/* Make sure the timer is set for the first probe to expire. */
+static void
+ping_schedule(void) {
+	if (ping_head == NULL) {
+		cancel_timeout(ping_timeout, NULL);
+		return;
+	}
+	add_timeout(&ping_head->expires, ping_timeout, NULL, 0, 0);
+}
+
+/* Insert a probe in expiry order; most probes go at the end. */
+static void
+ping_enqueue(struct ping_probe *probe) {
+	struct ping_probe *p;
+
+	for (p = ping_tail; p != NULL; p = p->prev) {
+		if (!tv_before(&probe->expires, &p->expires))
+			break;
+	}
+
+	probe->prev = p;
+	if (p == NULL) {
+		probe->next = ping_head;
+		ping_head = probe;
+	} else {
+		probe->next = p->next;
+		p->next = probe;
+	}
+	if (probe->next == NULL)
+		ping_tail = probe;
+	else
+		probe->next->prev = probe;
+
+	if (ping_head == probe)
+		ping_schedule();
+}
+
+static void
+ping_dequeue(struct ping_probe *probe) {
+	if (probe->prev == NULL)
+		ping_head = probe->next;
+	else
+		probe->prev->next = probe->next;
+	if (probe->next == NULL)
+		ping_tail = probe->prev;
+	else
+		probe->next->prev = probe->prev;
+	probe->prev = probe->next = NULL;
+}
+
+static void
+ping_unhash(struct ping_probe *probe) {
+	struct ping_probe **pp;
+
+	for (pp = &ping_hash[ping_hash_addr(&probe->addr)];
+	     *pp != NULL; pp = &(*pp)->hnext) {
+		if (*pp == probe) {
+			*pp = probe->hnext;
+			break;
+		}
+	}
+	probe->hnext = NULL;
+}
+
+/* Take a probe out of the tables and free it.  The caller deals with
+   the lease reference and the timer. */
+static void
+ping_release(struct ping_probe *probe) {
+	ping_unhash(probe);
+	ping_dequeue(probe);
+	if (probe->kind != PING_VERIFIED)
+		ping_pending--;
+	probe->next = ping_free_list;
+	ping_free_list = probe;
+}
+
+static struct ping_probe *
+ping_find(const struct iaddr *addr) {
+	struct ping_probe *probe;
+
+	for (probe = ping_hash[ping_hash_addr(addr)];
+	     probe != NULL; probe = probe->hnext) {
+		if ((probe->addr.len == addr->len) &&
+		    (memcmp(probe->addr.iabuf, addr->iabuf, addr->len) == 0))
+			return (probe);
+	}
+	return (NULL);
+}
+
+/*
+ * Ping an address.  For PING_OFFER the lease is handed to
+ * lease_ping_timeout() when the probe expires; for PING_AHEAD the
+ * address is remembered as verified for lifetime seconds.
+ */
+void
+ping_send(struct lease *lease, int kind, struct timeval *expires,
+	  u_int32_t lifetime) {
+	struct ping_probe *probe;
+
+	/* An address has at most one probe; a new ping replaces an older
+	   ping ahead or verification of the same address. */
+	probe = ping_find(&lease->ip_addr);
+	if (probe != NULL) {
+		if (probe->lease != NULL)
+			lease_dereference(&probe->lease, MDL);
+		ping_release(probe);
+	}
+
+	if (ping_free_list != NULL) {
+		probe = ping_free_list;
+		ping_free_list = probe->next;
+		memset(probe, 0, sizeof(*probe));
+	} else {
+		probe = dmalloc(sizeof(*probe), MDL);
+		if (probe == NULL)
+			log_fatal("No memory for ping probe.");
+	}
+
+	/* The identifier only has to tell our requests from anyone
+	   else's; the sequence number tells ours apart. */
+	if (ping_id == 0)
+		ping_id = (u_int16_t)((getpid() & 0xffff) | 1);
+
+	probe->addr = lease->ip_addr;
+	probe->id = ping_id;
+	probe->seq = ++ping_seq;
+	probe->kind = kind;
+	probe->lifetime = lifetime;
+	probe->expires = *expires;
+	lease_reference(&probe->lease, lease, MDL);
+
+	icmp_echorequest_seq(&probe->addr, probe->id, probe->seq);
+
+	probe->hnext = ping_hash[ping_hash_addr(&probe->addr)];
+	ping_hash[ping_hash_addr(&probe->addr)] = probe;
+	ping_pending++;
+	ping_enqueue(probe);
+}
+
+/*
+ * Ping up to count free leases from the front of the pool's free list,
+ * other than those we are already pinging or have recently verified.
+ */
+void
+ping_ahead(struct pool *pool, int count, struct timeval *expires,
+	   u_int32_t lifetime) {
+	struct lease *lp;
+	int scanned = 0, limit;
+
+	if ((pool == NULL) || (count <= 0))
+		return;
+
+	/* Leases that are being offered have state and are skipped, so
+	   look a little further than count to make up for them. */
+	limit = count * 2;
+	for (lp = LEASE_GET_FIRST(pool->free);
+	     (lp != NULL) && (count > 0) && (scanned < limit);
+	     lp = LEASE_GET_NEXT(pool->free, lp)) {
+		scanned++;
+		if ((lp->state != NULL) || (lp->flags & STATIC_LEASE))
+			continue;
+		if (ping_find(&lp->ip_addr) == NULL)
+			ping_send(lp, PING_AHEAD, expires, lifetime);
+		count--;
+	}
+}
+
+/*
+ * Returns 1 if a ping ahead recently found nothing at this address,
+ * in which case the offer need not wait for a ping.  The result is
+ * used up: if the offer isn't taken the address gets pinged again.
+ */
+int
+ping_verified(struct iaddr *addr) {
+	struct ping_probe *probe;
+	int was_head;
+
+	probe = ping_find(addr);
+	if ((probe == NULL) || (probe->kind != PING_VERIFIED) ||
+	    !tv_before(&cur_tv, &probe->expires))
+		return (0);
+
+	was_head = (ping_head == probe);
+	ping_release(probe);
+	if (was_head)
+		ping_schedule();
+	return (1);
+}
+
+/*
+ * Match an echo reply against our probes.  packet starts with the IP
+ * header and length is the length of the ICMP message.  If a probe
+ * matches it is removed and its kind returned, along with a reference
+ * to the lease.  Otherwise we return 0.
+ */
+int
+ping_match(struct iaddr from, u_int8_t *packet, int length,
+	   struct lease **lpp) {
+	struct ping_probe *probe;
+	struct icmp *icmp;
+	int hlen, kind, was_head, check_ids = 1;
+
+	probe = ping_find(&from);
+	if (probe == NULL)
+		return (0);
+
+#if defined (TRACING)
+	/* Played back replies carry the identifiers of the original
+	   run, so only the address can be checked. */
+	if (trace_playback())
+		check_ids = 0;
+#endif
+
+	if (check_ids) {
+		hlen = IP_HL((struct ip *)packet);
+		if (length < 8)
+			return (0);
+		icmp = (struct icmp *)(packet + hlen);
+		if ((icmp->icmp_id != probe->id) ||
+		    (icmp->icmp_seq != probe->seq)) {
+			log_debug("ICMP Echo Reply from %s doesn't match "
+				  "our request.", piaddr(from));
+			return (0);
+		}
+	}
+
+	kind = probe->kind;
+	if (probe->lease != NULL) {
+		lease_reference(lpp, probe->lease, MDL);
+		lease_dereference(&probe->lease, MDL);
+	}
+
+	was_head = (ping_head == probe);
+	ping_release(probe);
+	if (was_head)
+		ping_schedule();
+	return (kind);
+}
+
+/* Forget about any offer probe for a lease that is going away. */
+void
+ping_cancel(struct lease *lease) {
+	struct ping_probe *probe;
+	int was_head;
+
+	probe = ping_find(&lease->ip_addr);
+	if ((probe == NULL) || (probe->lease != lease))
+		return;
+
+	lease_dereference(&probe->lease, MDL);
+	was_head = (ping_head == probe);
+	ping_release(probe);
+	if (was_head)
+		ping_schedule();
+}
+
+/* Number of probes still waiting for an answer. */
+int
+ping_outstanding(void) {
+	return (ping_pending);
+}
+
+/* Handle every probe that has run out of time. */
+static void
+ping_timeout(void *vp) {
+	struct ping_probe *probe;
+	struct lease *lease;
+
+	while (((probe = ping_head) != NULL) &&
+	       !tv_before(&cur_tv, &probe->expires)) {
+		lease = probe->lease;
+		probe->lease = NULL;
+
+		switch (probe->kind) {
+		case PING_OFFER:
+			ping_release(probe);
+			lease_ping_timeout(lease);
+			break;
+
+		case PING_AHEAD:
+			/* Nobody answered, remember that for a while. */
+			ping_dequeue(probe);
+			ping_pending--;
+			probe->kind = PING_VERIFIED;
+			probe->expires.tv_sec = cur_tv.tv_sec + probe->lifetime;
+			probe->expires.tv_usec = cur_tv.tv_usec;
+			if (probe->lifetime != 0) {
+				ping_enqueue(probe);
+			} else {
+				ping_unhash(probe);
+				probe->next = ping_free_list;
+				ping_free_list = probe;
+			}
+			break;
+
+		default:
+			ping_release(probe);
+			break;
+		}
+
+		if (lease != NULL)
+			lease_dereference(&lease, MDL);
+	}
+
+	ping_schedule();
+}
@@ -0,0 +1,844 @@
+/* reload.c
+
+   Reload the server configuration without restarting. */
+
+/*
+ * Copyright (C) 2022 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/*! \file server/reload.c
+ *
+ * \page reload configuration reload overview
+ *
+ * A reload is requested with SIGHUP or by setting the state of the
+ * OMAPI control object to server_reload.  The tables built from the
+ * configuration file (the root group, shared networks, subnets, pools,
+ * classes, hosts and the lease address hash) are set aside and the file
+ * is read again into new ones.  If that fails the running tables are put
+ * back and nothing has changed.
+ *
+ * Otherwise the new tables are diffed against the old ones and the
+ * running state is carried over:
+ *
+ * - The lease structures already in memory are kept.  Each one replaces
+ *   the placeholder the parser created for its address and is re-homed
+ *   to the new subnet and pool.  Leases for addresses that are no longer
+ *   configured are dropped, as they would be by a restart.
+ *
+ * - A pool whose addresses are exactly those of one running pool takes
+ *   over that pool's lease queues whole.  Only pools whose ranges
+ *   changed have their leases sorted onto the queues again.
+ *
+ * - Hosts and classes created through OMAPI, configured hosts deleted
+ *   through OMAPI and spawned subclasses with billed leases survive, as
+ *   they would by being written to and read back from the lease file.
+ *
+ * Nothing is written to the lease file: the lease state is unchanged,
+ * and the next rewrite of the file reflects the new configuration.
+ *
+ * Before the real read, the file is read once in a child process, so
+ * that errors the parser treats as fatal at startup end the child and
+ * not the server.
+ *
+ * Reloading is refused for configurations whose state cannot be carried
+ * over this way: DHCPv6, DHCPv4-over-DHCPv6, failover, LDAP and tracing.
+ * Server-wide settings that are only read at startup, such as the lease
+ * and pid file names, keep their startup values.
+ */
+
+#include "dhcpd.h"
+#include <omapip/omapip_p.h>
+#include <syslog.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+/* The tables built from the configuration file. */
+struct config_tables {
+	struct group *root_group;
+	struct shared_network *shared_networks;
+	struct subnet *subnets;
+	struct class *classes;
+	lease_ip_hash_t *lease_ip_addr_hash;
+	struct lease_range_table ranges;
+	struct host_tables hosts;
+};
+
+/* What is known about a pool while the old and new tables are compared.
+   For a running pool, peer is the new pool its leases went to and
+   leases is the number it had; for a new pool, peer is the running pool
+   its leases came from and leases is the number of addresses in it.
+   split is set if there was more than one peer or if a lease has no
+   counterpart on the other side. */
+struct pool_pair {
+	struct pool_pair *next;
+	struct pool *pool;
+	struct pool *peer;
+	int leases;
+	int split;
+	int kept;		/* queues handed over whole */
+};
+
+static struct config_tables *running;
+static struct pool_pair **pool_pairs;
+static unsigned pool_pair_mask;
+
+static struct {
+	int pools_kept;
+	int pools_changed;
+	int leases_kept;
+	int leases_added;
+	int leases_dropped;
+	int hosts_kept;
+	int classes_kept;
+} reload_stats;
+
+static isc_result_t reload_refused(const char *);
+
+/* Exchange the configuration tables with the ones in ct. */
+
+static void
+swap_config_tables(struct config_tables *ct) {
+	struct group *group;
+	struct shared_network *share;
+	struct subnet *subnet;
+	struct class *class;
+	lease_ip_hash_t *hash;
+
+	group = root_group;
+	root_group = ct->root_group;
+	ct->root_group = group;
+
+	share = shared_networks;
+	shared_networks = ct->shared_networks;
+	ct->shared_networks = share;
+
+	subnet = subnets;
+	subnets = ct->subnets;
+	ct->subnets = subnet;
+
+	class = collections->classes;
+	collections->classes = ct->classes;
+	ct->classes = class;
+
+	hash = lease_ip_addr_hash;
+	lease_ip_addr_hash = ct->lease_ip_addr_hash;
+	ct->lease_ip_addr_hash = hash;
+
+	swap_lease_range_tables(&ct->ranges);
+	swap_host_tables(&ct->hosts);
+}
+
+static void
+release_config_tables(struct config_tables *ct) {
+	if (ct->lease_ip_addr_hash)
+		lease_ip_free_hash_table(&ct->lease_ip_addr_hash, MDL);
+	free_lease_range_table(&ct->ranges);
+	if (ct->subnets)
+		subnet_dereference(&ct->subnets, MDL);
+	if (ct->shared_networks)
+		shared_network_dereference(&ct->shared_networks, MDL);
+	if (ct->classes)
+		class_dereference(&ct->classes, MDL);
+	if (ct->root_group)
+		group_dereference(&ct->root_group, MDL);
+	free_host_tables(&ct->hosts);
+}
+
+/* Read the configuration file in a child process and report whether it
+   got to the end.  The child is silent: if it does, the file is read
+   again for real and any errors are reported then. */
+
+static int
+reload_check_config(void) {
+	pid_t pid;
+	int status;
+
+	/* Don't let the child's exit flush our buffered output again. */
+	fflush(NULL);
+
+	pid = fork();
+	if (pid < 0) {
+		log_error("Can't fork to check %s: %m", path_dhcpd_conf);
+		return 0;
+	}
+	if (pid == 0) {
+		log_perror = 0;
+		setlogmask(LOG_UPTO(LOG_EMERG));
+		(void) readconf();
+		_exit(0);
+	}
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			log_error("Can't check %s: %m", path_dhcpd_conf);
+			return 0;
+		}
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		log_error("%s has errors that would stop the server.",
+			  path_dhcpd_conf);
+		log_error("Run \"dhcpd -t\" to see them.");
+		return 0;
+	}
+	return 1;
+}
+
+/* Check that no interface would be connected to two shared networks by
+   the new subnets, which is fatal at startup. */
+
+static int
+reload_check_interfaces(void) {
+	struct interface_info *ip;
+	struct shared_network *share;
+	struct subnet *subnet;
+	struct iaddr ia;
+	int i;
+
+	for (ip = interfaces; ip != NULL; ip = ip->next) {
+		share = NULL;
+		for (i = 0; i < ip->address_count; i++) {
+			ia.len = 4;
+			memcpy(ia.iabuf, &ip->addresses[i], 4);
+			subnet = NULL;
+			if (!find_subnet(&subnet, ia, MDL))
+				continue;
+			if (share != NULL && share != subnet->shared_network) {
+				log_error("Interface %s matches multiple "
+					  "shared networks.", ip->name);
+				subnet_dereference(&subnet, MDL);
+				return 0;
+			}
+			share = subnet->shared_network;
+			subnet_dereference(&subnet, MDL);
+		}
+	}
+	return 1;
+}
+
+/* Connect the interfaces we are listening on to the new subnets, as
+   discover_interfaces() does at startup.  Interfaces are not discovered
+   again, so a subnet for an interface we aren't listening on still
+   needs a restart. */
+
+static void
+reload_link_interfaces(void) {
+	struct interface_info *ip;
+	struct iaddr ia;
+	int i;
+
+	for (ip = interfaces; ip != NULL; ip = ip->next) {
+		/* Leave the fallback interface alone. */
+		if (ip->address_count == 0)
+			continue;
+
+		if (ip->shared_network)
+			shared_network_dereference(&ip->shared_network, MDL);
+		for (i = 0; i < ip->address_count; i++) {
+			ia.len = 4;
+			memcpy(ia.iabuf, &ip->addresses[i], 4);
+			dhcpd_interface_setup_hook(ip, &ia);
+		}
+		if (ip->shared_network == NULL)
+			log_error("No subnet declaration for %s (%s); "
+				  "ignoring requests on it.", ip->name,
+				  inet_ntoa(ip->addresses[0]));
+	}
+}
+
+/* If *gp is, or directly inherits from, the group from, make it use the
+   group to instead. */
+
+static void
+reload_reparent(struct group **gp, struct group *from, struct group *to) {
+	if (*gp == NULL || from == NULL || to == NULL)
+		return;
+	if (*gp == from) {
+		group_dereference(gp, MDL);
+		group_reference(gp, to, MDL);
+	} else if ((*gp)->next == from) {
+		group_dereference(&(*gp)->next, MDL);
+		group_reference(&(*gp)->next, to, MDL);
+	}
+}
+
+static isc_result_t
+reload_regroup_named(const void *name, unsigned len, void *object) {
+	struct group_object *go = object;
+
+	reload_reparent(&go->group, running->root_group, root_group);
+	return ISC_R_SUCCESS;
+}
+
+/* Carry over a host from the running tables: hosts created through OMAPI
+   are entered into the new tables unless the configuration now declares
+   the same name, and configured hosts deleted through OMAPI stay
+   deleted. */
+
+static isc_result_t
+reload_carry_host(const void *name, unsigned len, void *object) {
+	struct host_decl *hd = object;
+	struct host_decl *hp = NULL;
+	struct group_object *go = NULL;
+
+	if (host_name_hash)
+		host_hash_lookup(&hp, host_name_hash, name, len, MDL);
+
+	if (hd->flags & HOST_DECL_DELETED) {
+		if ((hd->flags & HOST_DECL_STATIC) && hp &&
+		    !(hp->flags & HOST_DECL_DELETED))
+			delete_host(hp, 0);
+	} else if ((hd->flags & HOST_DECL_DYNAMIC) && !hp) {
+		if (hd->named_group == NULL) {
+			reload_reparent(&hd->group,
+					running->root_group, root_group);
+		} else if (group_name_hash &&
+			   group_hash_lookup(&go, group_name_hash,
+					     hd->named_group->name,
+					     strlen(hd->named_group->name),
+					     MDL)) {
+			if (go != hd->named_group &&
+			    !(go->flags & GROUP_OBJECT_DELETED)) {
+				reload_reparent(&hd->group,
+						hd->named_group->group,
+						go->group);
+				group_object_dereference(&hd->named_group,
+							 MDL);
+				group_object_reference(&hd->named_group,
+						       go, MDL);
+			}
+			group_object_dereference(&go, MDL);
+		}
+		if (enter_host(hd, 0, 0) == ISC_R_SUCCESS)
+			reload_stats.hosts_kept++;
+	}
+
+	if (hp)
+		host_dereference(&hp, MDL);
+	return ISC_R_SUCCESS;
+}
+
+/* Carry over the classes created through OMAPI that the configuration
+   doesn't declare. */
+
+static void
+reload_carry_classes(void) {
+	struct class *class = NULL, *next = NULL;
+
+	if (running->classes)
+		class_reference(&class, running->classes, MDL);
+	while (class) {
+		if (class->nic)
+			class_reference(&next, class->nic, MDL);
+		if ((class->flags & CLASS_DECL_DYNAMIC) &&
+		    !(class->flags & CLASS_DECL_DELETED) &&
+		    class->name != NULL) {
+			struct class *nc = NULL;
+
+			if (find_class(&nc, class->name, MDL) ==
+			    ISC_R_SUCCESS) {
+				class_dereference(&nc, MDL);
+			} else {
+				if (class->nic)
+					class_dereference(&class->nic, MDL);
+				if (enter_class(class, 0, 0) == ISC_R_SUCCESS)
+					reload_stats.classes_kept++;
+			}
+		}
+		class_dereference(&class, MDL);
+		if (next) {
+			class_reference(&class, next, MDL);
+			class_dereference(&next, MDL);
+		}
+	}
+}
+
+/* Find the class in the new configuration that corresponds to a class
+   from the running one: a class of the same name, or the subclass with
+   the same identifier of the superclass of the same name.  A subclass
+   the configuration doesn't declare is spawned again if the superclass
+   still spawns. */
+
+static void
+reload_find_class(struct class **cp, struct class *old) {
+	struct class *superclass = NULL;
+
+	if (old->superclass == NULL) {
+		if (old->name != NULL)
+			(void) find_class(cp, old->name, MDL);
+		return;
+	}
+
+	if (old->superclass->name == NULL ||
+	    find_class(&superclass, old->superclass->name, MDL) !=
+	    ISC_R_SUCCESS)
+		return;
+
+	if (superclass->hash == NULL ||
+	    !class_hash_lookup(cp, superclass->hash,
+			       (const char *)old->hash_string.data,
+			       old->hash_string.len, MDL)) {
+		if (superclass->spawning)
+			(void) spawn_subclass(cp, superclass,
+					      &old->hash_string);
+	}
+	class_dereference(&superclass, MDL);
+}
+
+/* Pool pairs are found by pool address in a small hash table. */
+
+static unsigned
+pool_pair_hash(const struct pool *pool) {
+	unsigned long v = (unsigned long)pool;
+
+	return ((unsigned)((v >> 4) * 2654435761UL) & pool_pair_mask);
+}
+
+static struct pool_pair *
+pool_pair_find(struct pool *pool) {
+	struct pool_pair *pp;
+
+	if (pool == NULL)
+		return NULL;
+	for (pp = pool_pairs[pool_pair_hash(pool)]; pp; pp = pp->next)
+		if (pp->pool == pool)
+			return pp;
+	return NULL;
+}
+
+static void
+pool_pairs_add(struct shared_network *share) {
+	struct pool *pool;
+	struct pool_pair *pp;
+	unsigned h;
+
+	for (; share != NULL; share = share->next) {
+		for (pool = share->pools; pool != NULL; pool = pool->next) {
+			pp = dmalloc(sizeof(*pp), MDL);
+			if (pp == NULL)
+				log_fatal("No memory for configuration "
+					  "reload.");
+			pp->pool = pool;
+			h = pool_pair_hash(pool);
+			pp->next = pool_pairs[h];
+			pool_pairs[h] = pp;
+		}
+	}
+}
+
+static void
+pool_pairs_setup(void) {
+	struct shared_network *share;
+	struct pool *pool;
+	unsigned count = 0, size = 64;
+
+	for (share = running->shared_networks; share; share = share->next)
+		for (pool = share->pools; pool; pool = pool->next)
+			count++;
+	for (share = shared_networks; share; share = share->next)
+		for (pool = share->pools; pool; pool = pool->next)
+			count++;
+	while (size < count * 2)
+		size <<= 1;
+
+	pool_pairs = dmalloc(size * sizeof(*pool_pairs), MDL);
+	if (pool_pairs == NULL)
+		log_fatal("No memory for configuration reload.");
+	pool_pair_mask = size - 1;
+
+	pool_pairs_add(running->shared_networks);
+	pool_pairs_add(shared_networks);
+}
+
+static void
+pool_pairs_free(void) {
+	struct pool_pair *pp, *next;
+	unsigned i;
+
+	for (i = 0; i <= pool_pair_mask; i++) {
+		for (pp = pool_pairs[i]; pp != NULL; pp = next) {
+			next = pp->next;
+			dfree(pp, MDL);
+		}
+	}
+	dfree(pool_pairs, MDL);
+	pool_pairs = NULL;
+}
+
+static void
+pool_pair_peer(struct pool_pair *pp, struct pool *peer) {
+	if (pp->peer == NULL)
+		pp->peer = peer;
+	else if (pp->peer != peer)
+		pp->split = 1;
+}
+
+/* Make a lease in the new configuration for each running lease whose
+   address has not been used there yet, so that the two can be paired. */
+
+static isc_result_t
+reload_use_range(const void *key, unsigned len, void *object) {
+	struct lease *lease = object;
+	struct lease *nl = NULL;
+
+	if (find_range_lease(&nl, lease->ip_addr, 0))
+		lease_dereference(&nl, MDL);
+	return ISC_R_SUCCESS;
+}
+
+/* For each address in the new configuration, count it against its pool
+   and note which running pool it came from.  Addresses that are new are
+   queued on their pool now; such a pool never takes over old queues. */
+
+static isc_result_t
+reload_count_new(const void *key, unsigned len, void *object) {
+	struct lease *lease = object;
+	struct lease *old = NULL;
+	struct pool_pair *pp;
+
+	pp = pool_pair_find(lease->pool);
+	if (pp != NULL)
+		pp->leases++;
+
+	if (lease_ip_hash_lookup(&old, running->lease_ip_addr_hash,
+				 lease->ip_addr.iabuf, lease->ip_addr.len,
+				 MDL)) {
+		if (pp != NULL)
+			pool_pair_peer(pp, old->pool);
+		lease_dereference(&old, MDL);
+	} else {
+		reload_stats.leases_added++;
+		lease_instantiate(key, len, object);
+	}
+	return ISC_R_SUCCESS;
+}
+
+/* For each running lease, count it against its pool and note which new
+   pool its address is in. */
+
+static isc_result_t
+reload_count_old(const void *key, unsigned len, void *object) {
+	struct lease *lease = object;
+	struct lease *nl = NULL;
+	struct pool_pair *pp;
+
+	pp = pool_pair_find(lease->pool);
+	if (pp == NULL)
+		return ISC_R_SUCCESS;
+	pp->leases++;
+
+	if (lease_ip_hash_lookup(&nl, lease_ip_addr_hash,
+				 lease->ip_addr.iabuf, lease->ip_addr.len,
+				 MDL)) {
+		pool_pair_peer(pp, nl->pool);
+		lease_dereference(&nl, MDL);
+	} else
+		pp->split = 1;
+	return ISC_R_SUCCESS;
+}
+
+/* Hand the lease queues of a running pool over to the new pool that has
+   exactly its addresses. */
+
+static void
+reload_move_queues(struct pool *from, struct pool *to) {
+	to->active = from->active;
+	to->expired = from->expired;
+	to->free = from->free;
+	to->backup = from->backup;
+	to->abandoned = from->abandoned;
+	to->reserved = from->reserved;
+	memset(&from->active, 0, sizeof(from->active));
+	memset(&from->expired, 0, sizeof(from->expired));
+	memset(&from->free, 0, sizeof(from->free));
+	memset(&from->backup, 0, sizeof(from->backup));
+	memset(&from->abandoned, 0, sizeof(from->abandoned));
+	memset(&from->reserved, 0, sizeof(from->reserved));
+
+	to->lease_count = from->lease_count;
+	to->free_leases = from->free_leases;
+	to->backup_leases = from->backup_leases;
+	to->logged = from->logged;
+	to->low_threshold = from->low_threshold;
+}
+
+/* Decide for each running pool whether its queues can be handed over
+   whole; empty the queues of the ones that can't so that their leases
+   can be queued again on their new pools. */
+
+static void
+reload_diff_pools(void) {
+	struct shared_network *share;
+	struct pool *pool;
+	struct pool_pair *pp, *np;
+
+	for (share = running->shared_networks; share; share = share->next) {
+	    for (pool = share->pools; pool; pool = pool->next) {
+		cancel_timeout(pool_timer, pool);
+
+		pp = pool_pair_find(pool);
+		np = NULL;
+		if (pp != NULL && !pp->split)
+			np = pool_pair_find(pp->peer);
+		if (np != NULL && !np->split && np->peer == pool &&
+		    np->leases == pp->leases &&
+		    lease_ranges_match(pool, np->pool)) {
+			reload_move_queues(pool, np->pool);
+			pp->kept = 1;
+			np->kept = 1;
+			continue;
+		}
+
+		POOL_DESTROYP(&pool->active);
+		POOL_DESTROYP(&pool->expired);
+		POOL_DESTROYP(&pool->free);
+		POOL_DESTROYP(&pool->backup);
+		POOL_DESTROYP(&pool->abandoned);
+		POOL_DESTROYP(&pool->reserved);
+		pool->free_leases = 0;
+		pool->backup_leases = 0;
+	    }
+	}
+
+	for (share = shared_networks; share; share = share->next) {
+		for (pool = share->pools; pool; pool = pool->next) {
+			np = pool_pair_find(pool);
+			if (np != NULL && np->kept) {
+				reload_stats.pools_kept++;
+			} else {
+				reload_stats.pools_changed++;
+				if (np != NULL)
+					pool->lease_count = np->leases +
+						pool->unused_leases;
+				pool->free_leases += pool->unused_leases;
+			}
+		}
+	}
+}
+
+/* Forget a running lease whose address is no longer configured. */
+
+static void
+reload_drop_lease(struct lease *lease) {
+	ping_cancel(lease);
+	if (lease->uid)
+		uid_hash_delete(lease);
+	if (lease->hardware_addr.hlen)
+		hw_hash_delete(lease);
+	if (lease->billing_class)
+		unbill_class(lease);
+	lease_snapshot_release(&lease->snap_slot);
+	reload_stats.leases_dropped++;
+}
+
+/* Move a lease's billing to the corresponding class in the new
+   configuration, if there is one with room for it. */
+
+static void
+reload_rebill(struct lease *lease) {
+	struct class *class = NULL;
+
+	reload_find_class(&class, lease->billing_class);
+	if (class == lease->billing_class) {
+		class_dereference(&class, MDL);
+		return;
+	}
+
+	unbill_class(lease);
+	if (class != NULL) {
+		(void) bill_class(lease, class);
+		class_dereference(&class, MDL);
+	}
+}
+
+/* Put a running lease in place of the new configuration's placeholder
+   for its address, or drop it if the address is gone. */
+
+static isc_result_t
+reload_rehome(const void *key, unsigned len, void *object) {
+	struct lease *lease = object;
+	struct lease *nl = NULL;
+	struct host_decl *hp = NULL;
+	struct pool_pair *pp;
+
+	if (!lease_ip_hash_lookup(&nl, lease_ip_addr_hash,
+				  lease->ip_addr.iabuf, lease->ip_addr.len,
+				  MDL)) {
+		reload_drop_lease(lease);
+		return ISC_R_SUCCESS;
+	}
+	pp = pool_pair_find(lease->pool);
+
+	lease_ip_hash_delete(lease_ip_addr_hash, lease->ip_addr.iabuf,
+			     lease->ip_addr.len, MDL);
+	lease_ip_hash_add(lease_ip_addr_hash, lease->ip_addr.iabuf,
+			  lease->ip_addr.len, lease, MDL);
+
+	if (lease->subnet)
+		subnet_dereference(&lease->subnet, MDL);
+	subnet_reference(&lease->subnet, nl->subnet, MDL);
+	if (lease->pool)
+		pool_dereference(&lease->pool, MDL);
+	pool_reference(&lease->pool, nl->pool, MDL);
+	lease_dereference(&nl, MDL);
+
+	if (pp == NULL || !pp->kept)
+		lease_enqueue(lease);
+
+	if (lease->billing_class)
+		reload_rebill(lease);
+
+	if (lease->host) {
+		if (lease->host->name && host_name_hash)
+			host_hash_lookup(&hp, host_name_hash,
+					 (unsigned char *)lease->host->name,
+					 strlen(lease->host->name), MDL);
+		if (hp != lease->host) {
+			host_dereference(&lease->host, MDL);
+			if (hp && !(hp->flags & HOST_DECL_DELETED))
+				host_reference(&lease->host, hp, MDL);
+		}
+		if (hp)
+			host_dereference(&hp, MDL);
+	}
+
+	reload_stats.leases_kept++;
+	return ISC_R_SUCCESS;
+}
+
+/* Carry the running state over to the new tables; the old ones are left
+   in *running for the caller to release. */
+
+static void
+reload_apply(void) {
+	struct shared_network *share;
+	struct pool *pool;
+
+	/* Things that were made at run time and would be read back from
+	   the lease file on a restart. */
+	if (running->hosts.name_hash)
+		host_hash_foreach(running->hosts.name_hash, reload_carry_host);
+	reload_carry_classes();
+	if (group_name_hash)
+		group_hash_foreach(group_name_hash, reload_regroup_named);
+
+	pool_pairs_setup();
+
+	if (running->lease_ip_addr_hash && lease_ip_addr_hash)
+		lease_ip_hash_foreach(running->lease_ip_addr_hash,
+				      reload_use_range);
+#if defined (BINARY_LEASES)
+	/* Now that the running leases have been made in the new ranges,
+	   the new pools' chains can be sized for them. */
+	pool_init_all_growth();
+#endif
+	if (lease_ip_addr_hash)
+		lease_ip_hash_foreach(lease_ip_addr_hash, reload_count_new);
+	if (running->lease_ip_addr_hash) {
+		lease_ip_hash_foreach(running->lease_ip_addr_hash,
+				      reload_count_old);
+		reload_diff_pools();
+		lease_ip_hash_foreach(running->lease_ip_addr_hash,
+				      reload_rehome);
+	} else
+		reload_diff_pools();
+	pool_pairs_free();
+
+	reload_link_interfaces();
+	relay_filter_setup(1);
+	dupcache_flush();
+
+	/* Run the expiry timer of every pool, which also schedules the
+	   next one. */
+	for (share = shared_networks; share; share = share->next)
+		for (pool = share->pools; pool; pool = pool->next)
+			pool_timer(pool);
+}
+
+isc_result_t
+reload_config(void) {
+	struct config_tables tables;
+	isc_result_t status;
+
+	if (shutdown_signal != 0)
+		return ISC_R_SHUTTINGDOWN;
+	if (local_family != AF_INET)
+		return reload_refused("for DHCPv6");
+#if defined (DHCPv6) && defined (DHCP4o6)
+	if (dhcpv4_over_dhcpv6)
+		return reload_refused("for DHCPv4-over-DHCPv6");
+#endif
+#if defined (FAILOVER_PROTOCOL)
+	if (failover_states != NULL)
+		return reload_refused("with failover peers");
+#endif
+#if defined (LDAP_CONFIGURATION)
+	return reload_refused("with LDAP configuration support");
+#endif
+#if defined (TRACING)
+	if (trace_record() || trace_playback())
+		return reload_refused("while tracing");
+#endif
+
+	log_info("Reloading configuration from %s.", path_dhcpd_conf);
+
+	/* Set the running tables aside and read the file into new ones. */
+	memset(&tables, 0, sizeof(tables));
+	swap_config_tables(&tables);
+	running = &tables;
+	root_group_setup();
+
+	status = DHCP_R_BADPARSE;
+	if (reload_check_config()) {
+		status = readconf();
+		if (status == ISC_R_SUCCESS && !reload_check_interfaces())
+			status = DHCP_R_BADPARSE;
+	}
+	if (status != ISC_R_SUCCESS) {
+		log_error("Configuration not reloaded: %s.",
+			  isc_result_totext(status));
+		swap_config_tables(&tables);
+		release_config_tables(&tables);
+		running = NULL;
+		return status;
+	}
+
+	memset(&reload_stats, 0, sizeof(reload_stats));
+	reload_apply();
+	release_config_tables(&tables);
+	running = NULL;
+
+	log_info("Configuration reloaded: %d pools unchanged, %d changed.",
+		 reload_stats.pools_kept, reload_stats.pools_changed);
+	log_info("Leases: %d kept, %d added, %d removed; "
+		 "%d dynamic hosts and %d dynamic classes kept.",
+		 reload_stats.leases_kept, reload_stats.leases_added,
+		 reload_stats.leases_dropped, reload_stats.hosts_kept,
+		 reload_stats.classes_kept);
+	return ISC_R_SUCCESS;
+}
+
+static isc_result_t
+reload_refused(const char *why) {
+	log_error("Configuration reload is not supported %s; "
+		  "restart the server instead.", why);
+	return ISC_R_NOTIMPLEMENTED;
+}
@@ -0,0 +1,226 @@
+/* replay.c
+
+   Replaying a trace as a benchmark. */
+
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT
+ * OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ *   Internet Systems Consortium, Inc.
+ *   PO Box 360
+ *   Newmarket, NH 03857 USA
+ *   <info@isc.org>
+ *   https://www.isc.org/
+ *
+ */
+
+/*
+ * When dhcpd plays back a trace with -bench, the packets in the trace are
+ * handed to the server as fast as it can take them, or at a multiple of
+ * the speed at which they were recorded.  The server's clock follows the
+ * times in the trace either way, so leases and timers behave as they did
+ * when the trace was made, and nothing is sent on the network.  At the
+ * end the time taken to handle each kind of message is reported, with
+ * the number of memory blocks allocated while doing so.  The times are
+ * kept in the histograms of common/histogram.c.
+ */
+
+#include "dhcpd.h"
+#include <sys/time.h>
+
+struct replay_stats replay_stats [REPLAY_TYPES];
+
+/* The kind of DHCPv4 message in a packet: its DHCP message type, or zero
+   for a BOOTP packet.  Unknown types are counted together as the last
+   one. */
+int
+replay_message_type(const struct dhcp_packet *raw, unsigned len) {
+	const unsigned char *opt, *end;
+
+	if (len < DHCP_FIXED_NON_UDP + 4 ||
+	    memcmp(raw->options, DHCP_OPTIONS_COOKIE, 4) != 0)
+		return (0);
+
+	opt = raw->options + 4;
+	end = (const unsigned char *)raw + len;
+	while (opt < end && *opt != DHO_END) {
+		if (*opt == DHO_PAD) {
+			opt++;
+			continue;
+		}
+		if (end - opt < 2 || end - opt < 2 + opt[1])
+			break;
+		if (*opt == DHO_DHCP_MESSAGE_TYPE && opt[1] == 1) {
+			if (opt[2] == 0 || opt[2] >= REPLAY_TYPES - 1)
+				return (REPLAY_TYPES - 1);
+			return (opt[2]);
+		}
+		opt += 2 + opt[1];
+	}
+	return (0);
+}
+
+/* Count a message and the time it took.  The total has the whole time,
+   but a time too long for the histogram is put in its last bucket. */
+void
+replay_record(int type, u_int64_t usecs, unsigned long allocs) {
+	struct replay_stats *stats = &replay_stats[type];
+	u_int32_t clamped;
+
+	clamped = usecs > 0xffffffff ? 0xffffffff : (u_int32_t)usecs;
+	stats->count++;
+	stats->usecs += usecs;
+	stats->allocs += allocs;
+	if (clamped > stats->max)
+		stats->max = clamped;
+	stats->buckets[replay_bucket(clamped)]++;
+}
+
+#if defined (TRACING)
+static double replay_speed;
+static int replay_started;
+static struct timeval replay_begun;	/* when the first packet came */
+static TIME replay_first;		/* its time in the trace */
+static u_int64_t replay_timer_usecs;	/* time spent running timers */
+static bootp_handler_t replay_handler;
+
+/* The microseconds from one time to another, or zero if the clock went
+   backwards. */
+static u_int64_t
+replay_usecs(const struct timeval *from, const struct timeval *to) {
+	int64_t usecs;
+
+	usecs = (int64_t)(to->tv_sec - from->tv_sec) * 1000000 +
+		(to->tv_usec - from->tv_usec);
+	return (usecs > 0 ? (u_int64_t)usecs : 0);
+}
+
+/* Move the clock on to the time of the next packet in the trace, running
+   whatever timers are due.  If the trace is being paced, wait until that
+   time, scaled by the speed, has passed since the first packet. */
+void
+replay_set_time(TIME t) {
+	struct timeval now, then;
+	struct timespec ts;
+	double wait;
+
+	if (replay_started && replay_speed > 0) {
+		gettimeofday(&now, NULL);
+		wait = (t - replay_first) / replay_speed -
+		       replay_usecs(&replay_begun, &now) / 1e6;
+		if (wait > 0) {
+			ts.tv_sec = (time_t)wait;
+			ts.tv_nsec = (long)((wait - ts.tv_sec) * 1e9);
+			nanosleep(&ts, NULL);
+		}
+	}
+
+	gettimeofday(&now, NULL);
+	set_time(t);
+	gettimeofday(&then, NULL);
+	replay_timer_usecs += replay_usecs(&now, &then);
+}
+
+static void
+replay_packet(struct interface_info *ip, struct dhcp_packet *raw,
+	      unsigned len, unsigned int from_port, struct iaddr from,
+	      struct hardware *hfrom)
+{
+	struct timeval before, after;
+	unsigned long allocs;
+	int type;
+
+	type = replay_message_type(raw, len);
+	allocs = dmalloc_count;
+	gettimeofday(&before, NULL);
+	if (!replay_started) {
+		replay_started = 1;
+		replay_begun = before;
+		replay_first = cur_time;
+	}
+
+	(*replay_handler)(ip, raw, len, from_port, from, hfrom);
+
+	gettimeofday(&after, NULL);
+	replay_record(type, replay_usecs(&before, &after),
+		      dmalloc_count - allocs);
+}
+
+/* Called once the packet handler has been set up, just before the trace
+   is played back.  A speed of zero means as fast as possible. */
+void
+replay_bench_start(double speed) {
+	replay_speed = speed;
+	push_packet_handler(&replay_handler, replay_packet);
+	memset(replay_stats, 0, sizeof(replay_stats));
+}
+
+void
+replay_bench_report(void) {
+	struct replay_stats *stats;
+	struct timeval now;
+	u_int64_t count = 0, usecs = 0, allocs = 0;
+	double elapsed;
+	char name[16];
+	const char *s;
+	int i;
+
+	for (i = 0; i < REPLAY_TYPES; i++) {
+		count += replay_stats[i].count;
+		usecs += replay_stats[i].usecs;
+		allocs += replay_stats[i].allocs;
+	}
+	if (count == 0) {
+		log_info("Replay: no DHCPv4 packets in the trace.");
+		return;
+	}
+
+	gettimeofday(&now, NULL);
+	elapsed = replay_usecs(&replay_begun, &now) / 1e6;
+	log_info("Replay: %llu packets in %.3f seconds, %.0f packets/s; "
+		 "%.3f seconds handling packets, %.3f running timers.",
+		 (unsigned long long)count, elapsed,
+		 elapsed > 0 ? count / elapsed : 0.0, usecs / 1e6,
+		 replay_timer_usecs / 1e6);
+	log_info("Replay: %.1f allocations per packet, %lu blocks "
+		 "allocated and %lu freed in all.",
+		 (double)allocs / count, dmalloc_count, dfree_count);
+
+	log_info("Replay: %-20s %10s %8s %8s %8s %8s %8s",
+		 "message", "count", "p50 us", "p90 us", "p99 us",
+		 "max us", "allocs");
+	for (i = 0; i < REPLAY_TYPES; i++) {
+		stats = &replay_stats[i];
+		if (stats->count == 0)
+			continue;
+		if (i == 0)
+			s = "BOOTP";
+		else if (i == REPLAY_TYPES - 1)
+			s = "other";
+		else if (i <= dhcp_type_name_max)
+			s = dhcp_type_names[i - 1];
+		else {
+			snprintf(name, sizeof(name), "type %d", i);
+			s = name;
+		}
+		log_info("Replay: %-20s %10llu %8lu %8lu %8lu %8lu %8.1f",
+			 s, (unsigned long long)stats->count,
+			 (unsigned long)replay_percentile(stats, 50),
+			 (unsigned long)replay_percentile(stats, 90),
+			 (unsigned long)replay_percentile(stats, 99),
+			 (unsigned long)stats->max,
+			 (double)stats->allocs / stats->count);
+	}
+}
+#endif /* TRACING */
@@ -32,6 +32,11 @@
 #if defined (COMPACT_LEASES)
 struct lease *free_leases;
 
+#if defined (LAZY_RANGES)
+/* The number of leases allocated at once when the free list is empty. */
+#define LEASE_HUNK 1024
+#endif
+
 #if defined (DEBUG_MEMORY_LEAKAGE_ON_EXIT)
 struct lease *lease_hunks;
 
@@ -123,6 +128,21 @@ isc_result_t dhcp_lease_get (omapi_object_t **lp,
 {
 	struct lease **lease = (struct lease **)lp;
 	struct lease *lt;
+#if defined (LAZY_RANGES)
+	unsigned i;
+
+	/* Leases for range addresses are made one at a time as they are
+	   used, so make them in hunks here instead. */
+	if (!free_leases) {
+		lt = new_leases (LEASE_HUNK, file, line);
+		if (lt) {
+			for (i = LEASE_HUNK; i-- > 0; ) {
+				lt [i].next = free_leases;
+				free_leases = &lt [i];
+			}
+		}
+	}
+#endif
 
 	if (free_leases) {
 		lt = free_leases;
@@ -200,6 +220,7 @@ void free_lease_state (ptr, file, line)
 	const char *file;
 	int line;
 {
+	dupcache_forget (ptr -> dup_slot, ptr -> dup_serial);
 	if (ptr -> options)
 		option_state_dereference (&ptr -> options, file, line);
 	if (ptr -> packet)
@@ -293,6 +293,25 @@ static struct option server_options[] = {
 	{ "bind-local-address6", "f",	&server_universe,  SV_BIND_LOCAL_ADDRESS6, 1 },
 	{ "ping-cltt-secs", "T",	&server_universe,  SV_PING_CLTT_SECS, 1 },
 	{ "ping-timeout-ms", "T",       &server_universe,  SV_PING_TIMEOUT_MS, 1 },
+	{ "lease-snapshot-file", "t",	&server_universe,  SV_LEASE_SNAPSHOT_FILE, 1 },
+	{ "lease-snapshot-size", "L",	&server_universe,  SV_LEASE_SNAPSHOT_SIZE, 1 },
+	{ "ddns-batch-window", "L",	&server_universe,  SV_DDNS_BATCH_WINDOW, 1 },
+	{ "ddns-batch-size", "L",	&server_universe,  SV_DDNS_BATCH_SIZE, 1 },
+	{ "ddns-max-outstanding", "L",	&server_universe,  SV_DDNS_MAX_OUTSTANDING, 1 },
+	{ "ddns-zone-negative-ttl", "T",	&server_universe,  SV_DDNS_ZONE_NEGATIVE_TTL, 1 },
+	{ "ddns-zone-cache-file", "t",	&server_universe,  SV_DDNS_ZONE_CACHE_FILE, 1 },
+	{ "ping-ahead", "L",		&server_universe,  SV_PING_AHEAD, 1 },
+	{ "ping-verified-lifetime", "T",	&server_universe,  SV_PING_VERIFIED_LIFETIME, 1 },
+	{ "expiry-batch-size", "L",	&server_universe,  SV_EXPIRY_BATCH_SIZE, 1 },
+	{ "drop-unknown-relays", "f",	&server_universe,  SV_DROP_UNKNOWN_RELAYS, 1 },
+	{ "admission-rate", "L",	&server_universe,  SV_ADMISSION_RATE, 1 },
+	{ "admission-client-rate", "L",	&server_universe,  SV_ADMISSION_CLIENT_RATE, 1 },
+	{ "admission-client-burst", "L",	&server_universe,  SV_ADMISSION_CLIENT_BURST, 1 },
+	{ "admission-clients", "L",	&server_universe,  SV_ADMISSION_CLIENTS, 1 },
+	{ "duplicate-cache-time", "L",	&server_universe,  SV_DUPLICATE_CACHE_TIME, 1 },
+	{ "duplicate-cache-size", "L",	&server_universe,  SV_DUPLICATE_CACHE_SIZE, 1 },
+	{ "metrics-port", "S",	&server_universe,  SV_METRICS_PORT, 1 },
+	{ "metrics-address", "I",	&server_universe,  SV_METRICS_ADDRESS, 1 },
 	{ NULL, NULL, NULL, 0, 0 }
 };
 
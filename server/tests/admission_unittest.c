@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <atf-c.h>
+
+/*
+ * Test admission control: the client and server token buckets, the
+ * client table, and how packets are sorted into new and urgent.
+ */
+
+static void
+set_now(long sec, long usec) {
+	cur_tv.tv_sec = sec;
+	cur_tv.tv_usec = usec;
+}
+
+static void
+configure(u_int32_t rate, u_int32_t client_rate, u_int32_t burst,
+	  u_int32_t clients) {
+	admission_rate = rate;
+	admission_client_rate = client_rate;
+	admission_client_burst = burst;
+	admission_clients = clients;
+	ATF_REQUIRE(admission_init());
+}
+
+ATF_TC(admission_client_limit);
+ATF_TC_HEAD(admission_client_limit, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify the per-client rate limit");
+}
+
+ATF_TC_BODY(admission_client_limit, tc)
+{
+	u_int32_t a = admission_key((const unsigned char *)"a", 1);
+	u_int32_t b = admission_key((const unsigned char *)"b", 1);
+
+	/* One packet a second, two at once. */
+	set_now(1000, 0);
+	configure(0, 60, 2, 64);
+
+	ATF_CHECK(admission_admit(a, 0));
+	ATF_CHECK(admission_admit(a, 1));
+	ATF_CHECK(!admission_admit(a, 0));
+	ATF_CHECK(!admission_admit(a, 1));
+
+	/* Other clients and packets without a client are unaffected. */
+	ATF_CHECK(admission_admit(b, 0));
+	ATF_CHECK(admission_admit(0, 0));
+	ATF_CHECK(admission_admit(0, 0));
+	ATF_CHECK(admission_admit(0, 0));
+
+	/* Half a second earns half a packet, a second a whole one. */
+	set_now(1000, 500000);
+	ATF_CHECK(!admission_admit(a, 0));
+	set_now(1001, 0);
+	ATF_CHECK(admission_admit(a, 0));
+	ATF_CHECK(!admission_admit(a, 0));
+
+	/* A long silence earns no more than the burst. */
+	set_now(2000, 0);
+	ATF_CHECK(admission_admit(a, 0));
+	ATF_CHECK(admission_admit(a, 0));
+	ATF_CHECK(!admission_admit(a, 0));
+
+	ATF_CHECK_EQ(admission_stats.admitted[0], 8);
+	ATF_CHECK_EQ(admission_stats.admitted[1], 1);
+	ATF_CHECK_EQ(admission_stats.client_dropped[0], 4);
+	ATF_CHECK_EQ(admission_stats.client_dropped[1], 1);
+	ATF_CHECK_EQ(admission_stats.overload_dropped[0], 0);
+}
+
+ATF_TC(admission_overload);
+ATF_TC_HEAD(admission_overload, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify new packets are shed first");
+}
+
+ATF_TC_BODY(admission_overload, tc)
+{
+	int i;
+
+	/* Ten packets a second: new ones only while five are left. */
+	set_now(1000, 0);
+	configure(10, 0, 0, 0);
+
+	for (i = 0; i < 6; i++)
+		ATF_CHECK(admission_admit(0, 0));
+	ATF_CHECK(!admission_admit(0, 0));
+	for (i = 0; i < 4; i++)
+		ATF_CHECK(admission_admit(0, 1));
+	ATF_CHECK(!admission_admit(0, 1));
+
+	/* A tenth of a second earns one packet. */
+	set_now(1000, 100000);
+	ATF_CHECK(!admission_admit(0, 0));
+	ATF_CHECK(admission_admit(0, 1));
+	ATF_CHECK(!admission_admit(0, 1));
+
+	ATF_CHECK_EQ(admission_stats.admitted[0], 6);
+	ATF_CHECK_EQ(admission_stats.admitted[1], 5);
+	ATF_CHECK_EQ(admission_stats.overload_dropped[0], 2);
+	ATF_CHECK_EQ(admission_stats.overload_dropped[1], 2);
+}
+
+ATF_TC(admission_table);
+ATF_TC_HEAD(admission_table, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify the client table evicts "
+			  "the least recently heard client");
+}
+
+ATF_TC_BODY(admission_table, tc)
+{
+	u_int32_t keys[5];
+	unsigned char id;
+	int i;
+
+	/* A single set of four. */
+	set_now(1000, 0);
+	configure(0, 1, 1, 4);
+
+	for (i = 0; i < 5; i++) {
+		id = (unsigned char)i;
+		keys[i] = admission_key(&id, 1);
+	}
+
+	/* Each of four clients uses its one packet. */
+	for (i = 0; i < 4; i++) {
+		set_now(1000 + i, 0);
+		ATF_CHECK(admission_admit(keys[i], 0));
+		ATF_CHECK(!admission_admit(keys[i], 0));
+	}
+	ATF_CHECK_EQ(admission_stats.evicted, 0);
+
+	/* Hearing from the first again makes the second the oldest, which
+	   the fifth replaces. */
+	set_now(1010, 0);
+	ATF_CHECK(!admission_admit(keys[0], 0));
+	ATF_CHECK(admission_admit(keys[4], 0));
+	ATF_CHECK_EQ(admission_stats.evicted, 1);
+
+	/* The first is still limited, the second starts again. */
+	ATF_CHECK(!admission_admit(keys[0], 0));
+	ATF_CHECK(admission_admit(keys[1], 0));
+	ATF_CHECK_EQ(admission_stats.evicted, 2);
+}
+
+ATF_TC(admission_classify);
+ATF_TC_HEAD(admission_classify, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify packets are sorted by urgency");
+}
+
+ATF_TC_BODY(admission_classify, tc)
+{
+	struct dhcp_packet raw;
+	static const unsigned char discover[] = { 53, 1, DHCPDISCOVER, 255 };
+	static const unsigned char request[] = { 53, 1, DHCPREQUEST, 255 };
+	u_int32_t key, key2;
+	unsigned len;
+
+	memset(&raw, 0, sizeof(raw));
+	raw.op = BOOTREQUEST;
+	raw.htype = HTYPE_ETHER;
+	raw.hlen = 6;
+	memcpy(raw.chaddr, "\x00\x11\x22\x33\x44\x55", 6);
+	memcpy(raw.options, DHCP_OPTIONS_COOKIE, 4);
+	len = DHCP_FIXED_NON_UDP + 4 + sizeof(discover);
+
+	memcpy(raw.options + 4, discover, sizeof(discover));
+	ATF_CHECK_EQ(admission_classify(&raw, len, &key), 0);
+	ATF_CHECK(key != 0);
+
+	memcpy(raw.options + 4, request, sizeof(request));
+	ATF_CHECK_EQ(admission_classify(&raw, len, &key2), 1);
+	ATF_CHECK_EQ(key, key2);
+
+	/* BOOTP starts an exchange too. */
+	raw.options[4] = 255;
+	ATF_CHECK_EQ(admission_classify(&raw, len, &key2), 0);
+
+	/* A different address is a different client. */
+	raw.chaddr[5] = 0x56;
+	ATF_CHECK_EQ(admission_classify(&raw, len, &key2), 0);
+	ATF_CHECK(key != key2);
+
+	/* No hardware address, no client. */
+	raw.hlen = 0;
+	ATF_CHECK_EQ(admission_classify(&raw, len, &key2), 0);
+	ATF_CHECK_EQ(key2, 0);
+}
+
+#ifdef DHCPv6
+ATF_TC(admission_classify6);
+ATF_TC_HEAD(admission_classify6, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify DHCPv6 packets are sorted "
+			  "by urgency");
+}
+
+ATF_TC_BODY(admission_classify6, tc)
+{
+	unsigned char solicit[] = {
+		DHCPV6_SOLICIT, 1, 2, 3,
+		0, D6O_ELAPSED_TIME, 0, 2, 0, 0,
+		0, D6O_CLIENTID, 0, 4, 0, 3, 0, 1
+	};
+	unsigned char relayed[34 + 4 + sizeof(solicit)];
+	u_int32_t key, key2;
+
+	ATF_CHECK_EQ(admission_classify6(solicit, sizeof(solicit), &key), 0);
+	ATF_CHECK_EQ(key, admission_key(solicit + 14, 4));
+
+	/* The same client's message, relayed. */
+	memset(relayed, 0, sizeof(relayed));
+	relayed[0] = DHCPV6_RELAY_FORW;
+	relayed[35] = D6O_RELAY_MSG;
+	relayed[37] = sizeof(solicit);
+	memcpy(relayed + 38, solicit, sizeof(solicit));
+	relayed[38] = DHCPV6_REQUEST;
+	ATF_CHECK_EQ(admission_classify6(relayed, sizeof(relayed), &key2), 1);
+	ATF_CHECK_EQ(key, key2);
+
+	/* A relay-msg that runs off the end isn't looked into. */
+	ATF_CHECK_EQ(admission_classify6(relayed, sizeof(relayed) - 1,
+					 &key2), 1);
+	ATF_CHECK_EQ(key2, 0);
+
+	/* No client identifier, no client. */
+	solicit[11] = D6O_SERVERID;
+	ATF_CHECK_EQ(admission_classify6(solicit, sizeof(solicit), &key), 0);
+	ATF_CHECK_EQ(key, 0);
+}
+#endif
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, admission_client_limit);
+	ATF_TP_ADD_TC(tp, admission_overload);
+	ATF_TP_ADD_TC(tp, admission_table);
+	ATF_TP_ADD_TC(tp, admission_classify);
+#ifdef DHCPv6
+	ATF_TP_ADD_TC(tp, admission_classify6);
+#endif
+	return (atf_no_error());
+}
@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+#include <omapip/omapip_p.h>
+#include "dhcpctl/dhcpctl.h"
+#include "omapi_loopback.h"
+
+#include <atf-c.h>
+
+/*
+ * Test bulk opens end to end, over a connection from omapi_loopback.c.
+ * The objects opened are of a type made up for the test, with a name to
+ * look them up by and a value.
+ */
+
+#define BULK_TEST_SLOTS	4
+
+typedef struct {
+	OMAPI_OBJECT_PREAMBLE;
+	char name [16];
+	unsigned long value;
+} bulk_test_object_t;
+
+static omapi_object_type_t *bulk_test_type;
+static bulk_test_object_t *bulk_test_table [BULK_TEST_SLOTS];
+static dhcpctl_handle connection;
+
+static isc_result_t
+bulk_test_set_value(omapi_object_t *h, omapi_object_t *id,
+		    omapi_data_string_t *name, omapi_typed_data_t *value)
+{
+	bulk_test_object_t *o = (bulk_test_object_t *)h;
+
+	if (!omapi_ds_strcmp(name, "name")) {
+		if (value -> type != omapi_datatype_data &&
+		    value -> type != omapi_datatype_string)
+			return DHCP_R_INVALIDARG;
+		if (value -> u.buffer.len >= sizeof(o -> name))
+			return ISC_R_NOSPACE;
+		memcpy(o -> name, value -> u.buffer.value,
+		       value -> u.buffer.len);
+		o -> name [value -> u.buffer.len] = 0;
+		return ISC_R_SUCCESS;
+	}
+	if (!omapi_ds_strcmp(name, "value"))
+		return omapi_get_int_value(&o -> value, value);
+	return ISC_R_NOTFOUND;
+}
+
+static isc_result_t
+bulk_test_get_value(omapi_object_t *h, omapi_object_t *id,
+		    omapi_data_string_t *name, omapi_value_t **value)
+{
+	bulk_test_object_t *o = (bulk_test_object_t *)h;
+
+	if (!omapi_ds_strcmp(name, "name"))
+		return omapi_make_string_value(value, name, o -> name, MDL);
+	if (!omapi_ds_strcmp(name, "value"))
+		return omapi_make_uint_value(value, name, o -> value, MDL);
+	return ISC_R_NOTFOUND;
+}
+
+static isc_result_t
+bulk_test_signal_handler(omapi_object_t *h, const char *name, va_list ap)
+{
+	return ISC_R_NOTFOUND;
+}
+
+static isc_result_t
+bulk_test_stuff_values(omapi_object_t *c, omapi_object_t *id,
+		       omapi_object_t *h)
+{
+	bulk_test_object_t *o = (bulk_test_object_t *)h;
+	isc_result_t status;
+
+	status = omapi_connection_put_name(c, "name");
+	if (status == ISC_R_SUCCESS)
+		status = omapi_connection_put_string(c, o -> name);
+	if (status == ISC_R_SUCCESS)
+		status = omapi_connection_put_named_uint32(c, "value",
+							   o -> value);
+	return status;
+}
+
+static isc_result_t
+bulk_test_lookup(omapi_object_t **lp, omapi_object_t *id,
+		 omapi_object_t *ref)
+{
+	omapi_value_t *tv = NULL;
+	isc_result_t status;
+	int i;
+
+	status = omapi_get_value_str(ref, id, "name", &tv);
+	if (status != ISC_R_SUCCESS)
+		return DHCP_R_NOKEYS;
+
+	status = ISC_R_NOTFOUND;
+	for (i = 0; i < BULK_TEST_SLOTS; i++) {
+		if (bulk_test_table [i] &&
+		    !omapi_td_strcmp(tv -> value,
+				     bulk_test_table [i] -> name)) {
+			status = omapi_object_reference
+				(lp, (omapi_object_t *)bulk_test_table [i],
+				 MDL);
+			break;
+		}
+	}
+	omapi_value_dereference(&tv, MDL);
+	return status;
+}
+
+static isc_result_t
+bulk_test_create(omapi_object_t **lp, omapi_object_t *id)
+{
+	isc_result_t status;
+	int i;
+
+	for (i = 0; i < BULK_TEST_SLOTS; i++) {
+		if (!bulk_test_table [i])
+			break;
+	}
+	if (i == BULK_TEST_SLOTS)
+		return ISC_R_NOSPACE;
+
+	status = omapi_object_allocate((omapi_object_t **)
+				       &bulk_test_table [i],
+				       bulk_test_type, 0, MDL);
+	if (status != ISC_R_SUCCESS)
+		return status;
+	return omapi_object_reference(lp, (omapi_object_t *)
+				      bulk_test_table [i], MDL);
+}
+
+static void
+setup(void) {
+	isc_result_t status;
+
+	status = dhcpctl_initialize();
+	ATF_REQUIRE_MSG(status == ISC_R_SUCCESS, "dhcpctl_initialize: %s",
+			isc_result_totext(status));
+
+	status = omapi_object_type_register(&bulk_test_type, "bulk-test",
+					    bulk_test_set_value,
+					    bulk_test_get_value,
+					    0, bulk_test_signal_handler,
+					    bulk_test_stuff_values,
+					    bulk_test_lookup,
+					    bulk_test_create,
+					    0, 0, 0, 0,
+					    sizeof(bulk_test_object_t), 0,
+					    RC_MISC);
+	ATF_REQUIRE(status == ISC_R_SUCCESS);
+
+	omapi_loopback_connect(&connection);
+}
+
+/* A client handle for the object with the given name.  A value of 0
+   isn't set, so the object is only looked up or created. */
+static dhcpctl_handle
+new_object(const char *name, int value) {
+	dhcpctl_handle h = NULL;
+
+	ATF_REQUIRE(dhcpctl_new_object(&h, connection, "bulk-test") ==
+		    ISC_R_SUCCESS);
+	ATF_REQUIRE(dhcpctl_set_string_value(h, name, "name") ==
+		    ISC_R_SUCCESS);
+	if (value != 0)
+		ATF_REQUIRE(dhcpctl_set_int_value(h, value, "value") ==
+			    ISC_R_SUCCESS);
+	return h;
+}
+
+/* The value the server sent back for an object. */
+static unsigned long
+object_value(dhcpctl_handle h) {
+	dhcpctl_data_string v = NULL;
+	unsigned long value;
+
+	ATF_REQUIRE(dhcpctl_get_value(&v, h, "value") == ISC_R_SUCCESS);
+	ATF_REQUIRE(v -> len == 4);
+	value = getULong(v -> value);
+	dhcpctl_data_string_dereference(&v, MDL);
+	return value;
+}
+
+ATF_TC(bulk_round_trip);
+ATF_TC_HEAD(bulk_round_trip, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify a bulk open creates and "
+			  "updates each object and answers for each one");
+}
+
+ATF_TC_BODY(bulk_round_trip, tc)
+{
+	dhcpctl_handle bulk = NULL, h [3];
+	dhcpctl_status waitstatus, s;
+
+	setup();
+
+	/* One object the server already has. */
+	ATF_REQUIRE(bulk_test_create((omapi_object_t **)&h [0], NULL) ==
+		    ISC_R_SUCCESS);
+	strcpy(bulk_test_table [0] -> name, "a");
+	bulk_test_table [0] -> value = 1;
+	omapi_object_dereference((omapi_object_t **)&h [0], MDL);
+
+	ATF_REQUIRE(dhcpctl_new_bulk(&bulk, connection, "bulk-test") ==
+		    ISC_R_SUCCESS);
+	h [0] = new_object("a", 10);
+	h [1] = new_object("b", 20);
+	h [2] = new_object("c", 0);
+	ATF_REQUIRE(dhcpctl_bulk_add(bulk, h [0]) == ISC_R_SUCCESS);
+	ATF_REQUIRE(dhcpctl_bulk_add(bulk, h [1]) == ISC_R_SUCCESS);
+	ATF_REQUIRE(dhcpctl_bulk_add(bulk, h [2]) == ISC_R_SUCCESS);
+
+	ATF_REQUIRE(dhcpctl_bulk_open(bulk, connection,
+				      DHCPCTL_CREATE | DHCPCTL_UPDATE) ==
+		    ISC_R_SUCCESS);
+	ATF_REQUIRE(dhcpctl_wait_for_completion(bulk, &waitstatus) ==
+		    ISC_R_SUCCESS);
+	ATF_CHECK_MSG(waitstatus == ISC_R_SUCCESS, "bulk open: %s",
+		      isc_result_totext(waitstatus));
+
+	/* Every object was opened, in the order they were added. */
+	ATF_CHECK(dhcpctl_bulk_status(bulk, 0, &s) == ISC_R_SUCCESS &&
+		  s == ISC_R_SUCCESS);
+	ATF_CHECK(dhcpctl_bulk_status(bulk, 1, &s) == ISC_R_SUCCESS &&
+		  s == ISC_R_SUCCESS);
+	ATF_CHECK(dhcpctl_bulk_status(bulk, 2, &s) == ISC_R_SUCCESS &&
+		  s == ISC_R_SUCCESS);
+	ATF_CHECK(dhcpctl_bulk_status(bulk, 3, &s) == DHCP_R_INVALIDARG);
+
+	/* The server has the values that were sent ... */
+	ATF_REQUIRE(bulk_test_table [1] != NULL);
+	ATF_REQUIRE(bulk_test_table [2] != NULL);
+	ATF_CHECK_EQ(bulk_test_table [0] -> value, 10);
+	ATF_CHECK_STREQ(bulk_test_table [1] -> name, "b");
+	ATF_CHECK_EQ(bulk_test_table [1] -> value, 20);
+	ATF_CHECK_STREQ(bulk_test_table [2] -> name, "c");
+	ATF_CHECK_EQ(bulk_test_table [2] -> value, 0);
+
+	/* ... and each client object has the server's answer for it. */
+	ATF_CHECK_EQ(object_value(h [0]), 10);
+	ATF_CHECK_EQ(object_value(h [1]), 20);
+	ATF_CHECK_EQ(object_value(h [2]), 0);
+}
+
+ATF_TC(bulk_partial);
+ATF_TC_HEAD(bulk_partial, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify an object that can't be "
+			  "opened doesn't stop the others");
+}
+
+ATF_TC_BODY(bulk_partial, tc)
+{
+	dhcpctl_handle bulk = NULL, h [2];
+	dhcpctl_status waitstatus, s;
+
+	setup();
+
+	ATF_REQUIRE(dhcpctl_new_bulk(&bulk, connection, "bulk-test") ==
+		    ISC_R_SUCCESS);
+	h [0] = new_object("missing", 0);
+	h [1] = new_object("new", 0);
+	ATF_REQUIRE(dhcpctl_bulk_add(bulk, h [0]) == ISC_R_SUCCESS);
+	ATF_REQUIRE(dhcpctl_bulk_add(bulk, h [1]) == ISC_R_SUCCESS);
+
+	/* Without create, neither is found. */
+	ATF_REQUIRE(dhcpctl_bulk_open(bulk, connection, 0) == ISC_R_SUCCESS);
+	ATF_REQUIRE(dhcpctl_wait_for_completion(bulk, &waitstatus) ==
+		    ISC_R_SUCCESS);
+	ATF_CHECK(waitstatus == ISC_R_NOTFOUND);
+	ATF_CHECK(dhcpctl_bulk_status(bulk, 0, &s) == ISC_R_SUCCESS &&
+		  s == ISC_R_NOTFOUND);
+	ATF_CHECK(dhcpctl_bulk_status(bulk, 1, &s) == ISC_R_SUCCESS &&
+		  s == ISC_R_NOTFOUND);
+	ATF_CHECK(bulk_test_table [0] == NULL);
+	omapi_object_dereference(&bulk, MDL);
+
+	ATF_REQUIRE(dhcpctl_new_bulk(&bulk, connection, "bulk-test") ==
+		    ISC_R_SUCCESS);
+	h [0] = new_object("new", 5);
+	h [1] = new_object("new", 6);
+	ATF_REQUIRE(dhcpctl_bulk_add(bulk, h [0]) == ISC_R_SUCCESS);
+	ATF_REQUIRE(dhcpctl_bulk_add(bulk, h [1]) == ISC_R_SUCCESS);
+	ATF_REQUIRE(dhcpctl_bulk_open(bulk, connection,
+				      DHCPCTL_CREATE | DHCPCTL_EXCL) ==
+		    ISC_R_SUCCESS);
+	ATF_REQUIRE(dhcpctl_wait_for_completion(bulk, &waitstatus) ==
+		    ISC_R_SUCCESS);
+
+	/* The second one finds the object the first one created, and
+	   leaves it alone. */
+	ATF_CHECK(waitstatus == ISC_R_EXISTS);
+	ATF_CHECK(dhcpctl_bulk_status(bulk, 0, &s) == ISC_R_SUCCESS &&
+		  s == ISC_R_SUCCESS);
+	ATF_CHECK(dhcpctl_bulk_status(bulk, 1, &s) == ISC_R_SUCCESS &&
+		  s == ISC_R_EXISTS);
+	ATF_REQUIRE(bulk_test_table [0] != NULL);
+	ATF_CHECK_STREQ(bulk_test_table [0] -> name, "new");
+	ATF_CHECK_EQ(bulk_test_table [0] -> value, 5);
+	ATF_CHECK(bulk_test_table [1] == NULL);
+}
+
+ATF_TC(bulk_max);
+ATF_TC_HEAD(bulk_max, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify a group can't hold more than "
+			  "OMAPI_BULK_MAX objects");
+}
+
+ATF_TC_BODY(bulk_max, tc)
+{
+	dhcpctl_handle bulk = NULL, h;
+	int i;
+
+	setup();
+
+	ATF_REQUIRE(dhcpctl_new_bulk(&bulk, connection, "bulk-test") ==
+		    ISC_R_SUCCESS);
+	h = new_object("a", 1);
+	for (i = 0; i < OMAPI_BULK_MAX; i++)
+		ATF_REQUIRE(dhcpctl_bulk_add(bulk, h) == ISC_R_SUCCESS);
+	ATF_CHECK(dhcpctl_bulk_add(bulk, h) == ISC_R_NOSPACE);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, bulk_round_trip);
+	ATF_TP_ADD_TC(tp, bulk_partial);
+	ATF_TP_ADD_TC(tp, bulk_max);
+	return (atf_no_error());
+}
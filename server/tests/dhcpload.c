@@ -0,0 +1,1270 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Put a running server under load.  dhcpload plays the part of a relay
+ * agent with any number of clients behind it, and times the exchanges
+ * the clients have with the server.  This is not run by "make check";
+ * build it with "make dhcpload" in this directory:
+ *
+ *	./dhcpload [-4|-6] -g relay-address -s server [-s server] [options]
+ *
+ * With -4 (the default) each client gets a lease with DISCOVER, OFFER,
+ * REQUEST and ACK; with -6, with SOLICIT, ADVERTISE, REQUEST and REPLY.
+ * Every packet is relayed, so the server chooses the subnet or link from
+ * the relay address (or the -l link address for DHCPv6) and sends its
+ * replies back to the relay address, which must be one the server can
+ * reach.  A DHCPv4 server can be tested on one machine through the
+ * loopback interface, with a subnet declared for 127.0.0.0/8 and the
+ * relay address 127.0.0.2 for example.  The DHCPv6 server doesn't listen
+ * on the loopback interface, so put one end of a veth pair in a network
+ * namespace of its own and run dhcpload there.
+ *
+ * By default each client gets a lease once and dhcpload stops.  Given a
+ * run time with -t, clients that have a lease go on to renew it, release
+ * it or start over without it, in the proportions given with -m, and
+ * clients that have none get one, until the time is up.
+ *
+ *	-g address	the relay agent's address
+ *	-s address	a server; give two for a failover pair.  Packets go
+ *			to every server, except that a DHCPv4 renewal or
+ *			release goes only to the server that gave the lease
+ *	-p port		the servers' port (67 or 547)
+ *	-P port		the relay agent's port, if not the servers' port.
+ *			The relay port option is sent, so the server must
+ *			be built with --enable-relay-port
+ *	-l address	the DHCPv6 link address (the relay address)
+ *	-n clients	the number of clients (1000)
+ *	-M seq|random	whether the clients' MAC addresses follow each other
+ *			or are spread about at random (seq)
+ *	-o oui		the first three octets of the MAC addresses
+ *			(02:00:00)
+ *	-D ll|llt|en|uuid
+ *			the type of DUID the DHCPv6 clients use (ll)
+ *	-C format	a circuit ID (DHCPv4) or interface ID (DHCPv6) to
+ *			send for each client
+ *	-R format	a remote ID to send for each client
+ *	-k circuits	the number of circuits the clients are spread over (1)
+ *	-t seconds	how long to run for (0, each client gets one lease)
+ *	-m renew:release
+ *			the percentage of exchanges by clients with leases
+ *			that renew and that release; the rest start over
+ *			(80:20)
+ *	-r rate		the most exchanges to start in a second (0, as many
+ *			as the window allows)
+ *	-w window	the most exchanges to have under way at once (100)
+ *	-T msecs	how long to wait for a reply before sending again
+ *			(1000)
+ *	-x retries	how many times to send again before giving up (2)
+ *	-S seed		the seed for the random choices (1)
+ *	-v		print progress every second
+ *	-H		print the latency histograms
+ *
+ * In a circuit or remote ID format %c is replaced by the number of the
+ * client's circuit, %n by the number of the client and %m by its MAC
+ * address in hex.
+ *
+ * At the end the number of exchanges of each kind that succeeded, failed
+ * (a NAK, or a status code other than success) or got no reply is
+ * printed, with the 50th, 90th and 99th percentile and the longest time
+ * from the first packet of an exchange to the last reply, retransmissions
+ * included.  A DHCPv4 release gets no reply, so it isn't timed.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <sys/time.h>
+#include <poll.h>
+#include <signal.h>
+
+#define MAX_SERVERS	8
+#define MAX_WINDOW	65536
+#define ENTERPRISE_ISC	2495
+
+/* The kinds of exchange. */
+#define X_INIT		0
+#define X_RENEW		1
+#define X_RELEASE	2
+#define X_KINDS		3
+
+/* What a client is waiting for. */
+#define ST_IDLE		0
+#define ST_SELECTING	1
+#define ST_REQUESTING	2
+#define ST_RENEWING	3
+#define ST_RELEASING	4
+
+/* How an exchange ended. */
+#define E_OK		0
+#define E_FAILED	1
+#define E_TIMEOUT	2
+
+/* The latencies are kept in the histograms "dhcpd -bench" uses; see
+   common/histogram.c. */
+struct kind_stats {
+	u_int64_t started, ok, failed, timedout;
+	struct replay_stats times;
+};
+
+struct server {
+	const char *name;
+	union {
+		struct sockaddr_in sin;
+		struct sockaddr_in6 sin6;
+	} addr;
+	struct in_addr id4;			/* its server identifier */
+	unsigned char duid [128];		/* its DUID */
+	unsigned duid_len;
+	u_int64_t sent, replies;
+};
+
+/* The MAC address, DUID and IAID of a client all come from its number,
+   so aren't kept here. */
+struct client {
+	int state;
+	int kind;
+	int bound;
+	int slot;			/* -1 if no exchange is under way */
+	int tries;
+	int server;			/* the server that gave the lease */
+	int prev, next;			/* in the list waiting for replies */
+	u_int32_t xid;
+	u_int64_t started, sent;
+	struct in_addr addr;
+	struct in6_addr addr6;
+};
+
+static const char *kind_names [2][X_KINDS] = {
+	{ "DORA", "renew", "release" },
+	{ "SARR", "renew", "release" }
+};
+
+static int family = AF_INET;
+static union {
+	struct sockaddr_in sin;
+	struct sockaddr_in6 sin6;
+} relay;
+static struct in6_addr link6;
+static struct server servers [MAX_SERVERS];
+static int nservers;
+static u_int16_t server_port, relay_src_port;
+static int send_relay_port;
+
+static unsigned nclients = 1000;
+static int mac_random;
+static unsigned char oui [3] = { 0x02, 0x00, 0x00 };
+static int client_duid_type = DUID_LL;
+static const char *circuit_fmt, *remote_fmt;
+static unsigned circuits = 1;
+static unsigned duration;
+static unsigned renew_pct = 80, release_pct = 20;
+static unsigned rate;
+static unsigned window = 100;
+static unsigned timeout = 1000;
+static unsigned retries = 2;
+static unsigned seed = 1;
+static int verbose, histograms;
+
+static int sock;
+static struct client *clients;
+static int *slots, *free_slots;
+static unsigned nfree;
+static u_int32_t xid_count;
+static int wait_head = -1, wait_tail = -1;
+static unsigned in_flight;
+static int *ready;
+static unsigned ready_head, ready_count;
+static u_int64_t started_total;
+
+static struct kind_stats stats [X_KINDS];
+static u_int64_t packets_sent, send_errors, retransmits;
+static u_int64_t received, malformed, late, ignored;
+
+static volatile sig_atomic_t interrupted;
+
+static void
+usage(const char *fmt, const char *arg) {
+	if (fmt != NULL) {
+		fprintf(stderr, fmt, arg);
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr,
+		"usage: dhcpload [-4|-6] -g relay-address -s server "
+		"[-s server]\n"
+		"                [-p port] [-P port] [-l link-address] "
+		"[-n clients]\n"
+		"                [-M seq|random] [-o oui] "
+		"[-D ll|llt|en|uuid]\n"
+		"                [-C format] [-R format] [-k circuits] "
+		"[-t seconds]\n"
+		"                [-m renew:release] [-r rate] [-w window] "
+		"[-T msecs]\n"
+		"                [-x retries] [-S seed] [-v] [-H]\n");
+	exit(1);
+}
+
+static unsigned
+number(const char *s, unsigned long min, unsigned long max,
+       const char *what) {
+	unsigned long n;
+	char *end;
+
+	n = strtoul(s, &end, 10);
+	if (*s == '\0' || *end != '\0' || n < min || n > max)
+		usage(what, s);
+	return ((unsigned)n);
+}
+
+static u_int64_t
+usecs_now(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return ((u_int64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
+static void
+interrupt(int sig) {
+	interrupted = 1;
+}
+
+/* A client's MAC address.  Random addresses come from multiplying the
+   client's number by an odd constant, so no two clients share one. */
+static void
+client_hwaddr(unsigned index, unsigned char *hw) {
+	u_int32_t n = index;
+
+	if (mac_random)
+		n = (n * 0x5bd1e9U) ^ (seed * 0x9e3779b9U);
+	memcpy(hw, oui, 3);
+	hw[3] = (n >> 16) & 0xff;
+	hw[4] = (n >> 8) & 0xff;
+	hw[5] = n & 0xff;
+}
+
+static unsigned
+client_duid(unsigned index, unsigned char *duid) {
+	unsigned char hw [6];
+
+	client_hwaddr(index, hw);
+	switch (client_duid_type) {
+	      case DUID_LLT:
+		putUShort(duid, DUID_LLT);
+		putUShort(duid + 2, HTYPE_ETHER);
+		putULong(duid + 4, seed);
+		memcpy(duid + 8, hw, 6);
+		return (14);
+
+	      case DUID_EN:
+		putUShort(duid, DUID_EN);
+		putULong(duid + 2, ENTERPRISE_ISC);
+		putUShort(duid + 6, 0);
+		memcpy(duid + 8, hw, 6);
+		return (14);
+
+	      case DUID_UUID:
+		putUShort(duid, DUID_UUID);
+		putULong(duid + 2, seed);
+		memset(duid + 6, 0, 6);
+		memcpy(duid + 12, hw, 6);
+		return (18);
+
+	      default:
+		putUShort(duid, DUID_LL);
+		putUShort(duid + 2, HTYPE_ETHER);
+		memcpy(duid + 4, hw, 6);
+		return (10);
+	}
+}
+
+/* Fill in a circuit or remote ID format for a client. */
+static unsigned
+expand(const char *fmt, unsigned index, unsigned char *out, unsigned max) {
+	unsigned char hw [6];
+	char buf [16];
+	unsigned n = 0;
+	int len;
+
+	for (; *fmt != '\0' && n < max; fmt++) {
+		if (*fmt != '%' || fmt[1] == '\0') {
+			out[n++] = *fmt;
+			continue;
+		}
+		switch (*++fmt) {
+		      case 'c':
+			len = snprintf(buf, sizeof(buf), "%u",
+				       index % circuits);
+			break;
+		      case 'n':
+			len = snprintf(buf, sizeof(buf), "%u", index);
+			break;
+		      case 'm':
+			client_hwaddr(index, hw);
+			len = snprintf(buf, sizeof(buf),
+				       "%02x%02x%02x%02x%02x%02x",
+				       hw[0], hw[1], hw[2], hw[3], hw[4],
+				       hw[5]);
+			break;
+		      default:
+			buf[0] = *fmt;
+			len = 1;
+			break;
+		}
+		if ((unsigned)len > max - n)
+			len = max - n;
+		memcpy(out + n, buf, len);
+		n += len;
+	}
+	return (n);
+}
+
+static unsigned
+build4(struct client *c, unsigned char *buf, u_int64_t now) {
+	struct dhcp_packet *raw = (struct dhcp_packet *)buf;
+	unsigned index = c - clients;
+	unsigned char *opt, *agent;
+	unsigned len;
+	int type;
+
+	type = c->state == ST_SELECTING ? DHCPDISCOVER :
+	       c->state == ST_RELEASING ? DHCPRELEASE : DHCPREQUEST;
+
+	memset(raw, 0, sizeof(*raw));
+	raw->op = BOOTREQUEST;
+	raw->htype = HTYPE_ETHER;
+	raw->hlen = 6;
+	raw->hops = 1;
+	raw->xid = htonl(c->xid);
+	raw->secs = htons((now - c->started) / 1000000);
+	if (c->state == ST_RENEWING || c->state == ST_RELEASING)
+		raw->ciaddr = c->addr;
+	raw->giaddr = relay.sin.sin_addr;
+	client_hwaddr(index, raw->chaddr);
+
+	memcpy(raw->options, DHCP_OPTIONS_COOKIE, 4);
+	opt = raw->options + 4;
+	*opt++ = DHO_DHCP_MESSAGE_TYPE;
+	*opt++ = 1;
+	*opt++ = type;
+	if (c->state == ST_REQUESTING) {
+		*opt++ = DHO_DHCP_REQUESTED_ADDRESS;
+		*opt++ = 4;
+		memcpy(opt, &c->addr, 4);
+		opt += 4;
+	}
+	if (c->state == ST_REQUESTING || c->state == ST_RELEASING) {
+		*opt++ = DHO_DHCP_SERVER_IDENTIFIER;
+		*opt++ = 4;
+		memcpy(opt, &servers[c->server].id4, 4);
+		opt += 4;
+	}
+	if (type != DHCPRELEASE) {
+		*opt++ = DHO_DHCP_PARAMETER_REQUEST_LIST;
+		*opt++ = 4;
+		*opt++ = DHO_SUBNET_MASK;
+		*opt++ = DHO_ROUTERS;
+		*opt++ = DHO_DOMAIN_NAME_SERVERS;
+		*opt++ = DHO_DHCP_LEASE_TIME;
+	}
+
+	if (circuit_fmt != NULL || remote_fmt != NULL || send_relay_port) {
+		agent = opt;
+		*opt++ = DHO_DHCP_AGENT_OPTIONS;
+		opt++;
+		if (circuit_fmt != NULL) {
+			*opt++ = RAI_CIRCUIT_ID;
+			len = expand(circuit_fmt, index, opt + 1, 64);
+			*opt = len;
+			opt += 1 + len;
+		}
+		if (remote_fmt != NULL) {
+			*opt++ = RAI_REMOTE_ID;
+			len = expand(remote_fmt, index, opt + 1, 64);
+			*opt = len;
+			opt += 1 + len;
+		}
+		if (send_relay_port) {
+			*opt++ = RAI_RELAY_PORT;
+			*opt++ = 0;
+		}
+		agent[1] = opt - agent - 2;
+	}
+	*opt++ = DHO_END;
+
+	len = opt - buf;
+	return (len < BOOTP_MIN_LEN ? BOOTP_MIN_LEN : len);
+}
+
+static unsigned char *
+put_option6(unsigned char *p, unsigned code, const unsigned char *data,
+	    unsigned len) {
+	putUShort(p, code);
+	putUShort(p + 2, len);
+	if (len != 0)
+		memcpy(p + 4, data, len);
+	return (p + 4 + len);
+}
+
+/* Find an option in a run of DHCPv6 options, returning its data. */
+static const unsigned char *
+option6(const unsigned char *p, unsigned len, unsigned code,
+	unsigned *olen) {
+	unsigned n;
+
+	while (len >= 4) {
+		n = getUShort(p + 2);
+		if (n > len - 4)
+			return (NULL);
+		if (getUShort(p) == code) {
+			*olen = n;
+			return (p + 4);
+		}
+		p += 4 + n;
+		len -= 4 + n;
+	}
+	return (NULL);
+}
+
+static unsigned
+build6(struct client *c, unsigned char *buf, u_int64_t now) {
+	unsigned index = c - clients;
+	unsigned char data [256], hw [6], *p, *msg, *ia;
+	u_int64_t elapsed;
+	unsigned len;
+
+	buf[0] = DHCPV6_RELAY_FORW;
+	buf[1] = 0;
+	memcpy(buf + 2, &link6, 16);
+
+	/* The peer address is the client's link-local address. */
+	client_hwaddr(index, hw);
+	memset(buf + 18, 0, 16);
+	buf[18] = 0xfe;
+	buf[19] = 0x80;
+	buf[26] = hw[0] ^ 0x02;
+	buf[27] = hw[1];
+	buf[28] = hw[2];
+	buf[29] = 0xff;
+	buf[30] = 0xfe;
+	memcpy(buf + 31, hw + 3, 3);
+	p = buf + 34;
+
+	if (circuit_fmt != NULL) {
+		len = expand(circuit_fmt, index, data, sizeof(data));
+		p = put_option6(p, D6O_INTERFACE_ID, data, len);
+	}
+	if (remote_fmt != NULL) {
+		putULong(data, ENTERPRISE_ISC);
+		len = expand(remote_fmt, index, data + 4, sizeof(data) - 4);
+		p = put_option6(p, D6O_REMOTE_ID, data, len + 4);
+	}
+	if (send_relay_port) {
+		/* The port of a relay below us, and there is none. */
+		putUShort(data, 0);
+		p = put_option6(p, D6O_RELAY_SOURCE_PORT, data, 2);
+	}
+
+	msg = p + 4;
+	msg[0] = c->state == ST_SELECTING ? DHCPV6_SOLICIT :
+		 c->state == ST_REQUESTING ? DHCPV6_REQUEST :
+		 c->state == ST_RENEWING ? DHCPV6_RENEW : DHCPV6_RELEASE;
+	msg[1] = (c->xid >> 16) & 0xff;
+	msg[2] = (c->xid >> 8) & 0xff;
+	msg[3] = c->xid & 0xff;
+	p = msg + 4;
+
+	len = client_duid(index, data);
+	p = put_option6(p, D6O_CLIENTID, data, len);
+	if (c->state != ST_SELECTING)
+		p = put_option6(p, D6O_SERVERID, servers[c->server].duid,
+				servers[c->server].duid_len);
+	elapsed = (now - c->started) / 10000;
+	putUShort(data, elapsed > 0xffff ? 0xffff : elapsed);
+	p = put_option6(p, D6O_ELAPSED_TIME, data, 2);
+
+	ia = p;
+	putUShort(ia, D6O_IA_NA);
+	putULong(ia + 4, index);
+	putULong(ia + 8, 0);
+	putULong(ia + 12, 0);
+	p = ia + 16;
+	if (c->state != ST_SELECTING) {
+		memcpy(data, &c->addr6, 16);
+		putULong(data + 16, 0);
+		putULong(data + 20, 0);
+		p = put_option6(p, D6O_IAADDR, data, 24);
+	}
+	putUShort(ia + 2, p - ia - 4);
+
+	putUShort(msg - 4, D6O_RELAY_MSG);
+	putUShort(msg - 2, p - msg);
+	return (p - buf);
+}
+
+/* Keep the clients waiting for replies in the order in which they last
+   sent, so the first is always the first to time out. */
+static void
+unwait(struct client *c) {
+	if (c->prev >= 0)
+		clients[c->prev].next = c->next;
+	else if (wait_head == c - clients)
+		wait_head = c->next;
+	else
+		return;
+	if (c->next >= 0)
+		clients[c->next].prev = c->prev;
+	else
+		wait_tail = c->prev;
+	c->prev = c->next = -1;
+}
+
+static void
+await(struct client *c) {
+	unwait(c);
+	c->prev = wait_tail;
+	if (wait_tail >= 0)
+		clients[wait_tail].next = c - clients;
+	else
+		wait_head = c - clients;
+	wait_tail = c - clients;
+}
+
+static void
+transmit(struct client *c, u_int64_t now) {
+	static union {
+		struct dhcp_packet raw;
+		unsigned char data [2048];
+	} buf;
+	unsigned len;
+	int i;
+
+	if (family == AF_INET)
+		len = build4(c, buf.data, now);
+	else
+		len = build6(c, buf.data, now);
+
+	for (i = 0; i < nservers; i++) {
+		/* A DHCPv4 client renews with and releases to the server
+		   that gave it the lease. */
+		if (family == AF_INET && i != c->server &&
+		    (c->state == ST_RENEWING || c->state == ST_RELEASING))
+			continue;
+		if (sendto(sock, buf.data, len, 0,
+			   (struct sockaddr *)&servers[i].addr,
+			   family == AF_INET ? sizeof(struct sockaddr_in) :
+			   sizeof(struct sockaddr_in6)) < 0) {
+			send_errors++;
+			continue;
+		}
+		servers[i].sent++;
+		packets_sent++;
+	}
+
+	c->sent = now;
+	if (family == AF_INET6 || c->state != ST_RELEASING)
+		await(c);
+}
+
+static void
+end_exchange(struct client *c, int result, u_int64_t now) {
+	struct kind_stats *ks = &stats[c->kind];
+	u_int64_t usecs;
+
+	if (result == E_OK) {
+		ks->ok++;
+		if (family == AF_INET6 || c->kind != X_RELEASE) {
+			usecs = now - c->started;
+			if (usecs > 0xffffffff)
+				usecs = 0xffffffff;
+			ks->times.count++;
+			ks->times.usecs += usecs;
+			ks->times.buckets[replay_bucket(usecs)]++;
+			if (usecs > ks->times.max)
+				ks->times.max = usecs;
+		}
+	} else if (result == E_FAILED)
+		ks->failed++;
+	else
+		ks->timedout++;
+
+	unwait(c);
+	slots[c->slot] = -1;
+	free_slots[nfree++] = c->slot;
+	c->slot = -1;
+	c->state = ST_IDLE;
+	in_flight--;
+
+	/* In a timed run the client goes to the back of the queue for its
+	   next exchange. */
+	if (duration != 0) {
+		ready[(ready_head + ready_count) % nclients] = c - clients;
+		ready_count++;
+	}
+}
+
+static void
+start(struct client *c, u_int64_t now) {
+	unsigned r;
+
+	c->kind = X_INIT;
+	if (c->bound) {
+		r = random() % 100;
+		if (r < renew_pct)
+			c->kind = X_RENEW;
+		else if (r < renew_pct + release_pct)
+			c->kind = X_RELEASE;
+		else
+			c->bound = 0;
+	}
+
+	c->slot = free_slots[--nfree];
+	slots[c->slot] = c - clients;
+	xid_count++;
+	if (family == AF_INET)
+		c->xid = (xid_count << 16) | c->slot;
+	else
+		c->xid = ((xid_count & 0xff) << 16) | c->slot;
+	c->started = now;
+	c->tries = 0;
+	stats[c->kind].started++;
+	started_total++;
+	in_flight++;
+
+	switch (c->kind) {
+	      case X_INIT:
+		c->state = ST_SELECTING;
+		transmit(c, now);
+		break;
+
+	      case X_RENEW:
+		c->state = ST_RENEWING;
+		transmit(c, now);
+		break;
+
+	      case X_RELEASE:
+		c->state = ST_RELEASING;
+		transmit(c, now);
+		if (family == AF_INET) {
+			c->bound = 0;
+			end_exchange(c, E_OK, now);
+		}
+		break;
+	}
+}
+
+/* Send again to, or give up on, clients that have waited too long. */
+static void
+expire(u_int64_t now) {
+	struct client *c;
+
+	while (wait_head >= 0) {
+		c = &clients[wait_head];
+		if (c->sent + timeout * 1000ULL > now)
+			break;
+		if (c->tries < retries) {
+			c->tries++;
+			retransmits++;
+			transmit(c, now);
+			continue;
+		}
+		/* A client that can't renew keeps its lease for now. */
+		if (c->state != ST_RENEWING)
+			c->bound = 0;
+		end_exchange(c, E_TIMEOUT, now);
+	}
+}
+
+static struct client *
+find_client(u_int32_t xid) {
+	unsigned slot = xid & 0xffff;
+	struct client *c;
+
+	if (slot >= window || slots[slot] < 0)
+		return (NULL);
+	c = &clients[slots[slot]];
+	return (c->xid == xid ? c : NULL);
+}
+
+static int
+find_server4(struct in_addr from, struct in_addr id) {
+	int i;
+
+	for (i = 0; i < nservers; i++)
+		if (servers[i].addr.sin.sin_addr.s_addr == from.s_addr)
+			return (i);
+	for (i = 0; i < nservers; i++)
+		if (servers[i].addr.sin.sin_addr.s_addr == id.s_addr)
+			return (i);
+	return (0);
+}
+
+static void
+receive4(const unsigned char *buf, unsigned len,
+	 const struct sockaddr_in *from, u_int64_t now) {
+	const struct dhcp_packet *raw = (const struct dhcp_packet *)buf;
+	const unsigned char *opt, *end;
+	struct in_addr id;
+	struct client *c;
+	int type = 0, server;
+
+	if (len < DHCP_FIXED_NON_UDP + 4 || raw->op != BOOTREPLY ||
+	    memcmp(raw->options, DHCP_OPTIONS_COOKIE, 4) != 0) {
+		malformed++;
+		return;
+	}
+
+	id.s_addr = 0;
+	opt = raw->options + 4;
+	end = buf + len;
+	while (opt < end && *opt != DHO_END) {
+		if (*opt == DHO_PAD) {
+			opt++;
+			continue;
+		}
+		if (end - opt < 2 || end - opt < 2 + opt[1])
+			break;
+		if (*opt == DHO_DHCP_MESSAGE_TYPE && opt[1] == 1)
+			type = opt[2];
+		else if (*opt == DHO_DHCP_SERVER_IDENTIFIER && opt[1] == 4)
+			memcpy(&id, opt + 2, 4);
+		opt += 2 + opt[1];
+	}
+	server = find_server4(from->sin_addr, id);
+	servers[server].replies++;
+
+	c = find_client(ntohl(raw->xid));
+	if (c == NULL) {
+		late++;
+		return;
+	}
+
+	switch (c->state) {
+	      case ST_SELECTING:
+		if (type != DHCPOFFER)
+			break;
+		c->addr = raw->yiaddr;
+		c->server = server;
+		servers[server].id4 = id.s_addr != 0 ? id : from->sin_addr;
+		c->state = ST_REQUESTING;
+		c->tries = 0;
+		transmit(c, now);
+		return;
+
+	      case ST_REQUESTING:
+	      case ST_RENEWING:
+		if (type == DHCPACK) {
+			c->addr = raw->yiaddr;
+			c->server = server;
+			c->bound = 1;
+			end_exchange(c, E_OK, now);
+			return;
+		}
+		if (type == DHCPNAK) {
+			c->bound = 0;
+			end_exchange(c, E_FAILED, now);
+			return;
+		}
+		break;
+	}
+	ignored++;
+}
+
+static int
+find_server6(const struct in6_addr *from) {
+	int i;
+
+	for (i = 0; i < nservers; i++)
+		if (!memcmp(&servers[i].addr.sin6.sin6_addr, from,
+			    sizeof(*from)))
+			return (i);
+	return (0);
+}
+
+static void
+receive6(const unsigned char *buf, unsigned len,
+	 const struct sockaddr_in6 *from, u_int64_t now) {
+	const unsigned char *msg, *opt, *ia, *iaaddr = NULL;
+	unsigned mlen, olen, ialen, alen;
+	int server, status = STATUS_Success;
+	struct client *c;
+
+	if (len < 34 || buf[0] != DHCPV6_RELAY_REPL ||
+	    (msg = option6(buf + 34, len - 34, D6O_RELAY_MSG,
+			   &mlen)) == NULL || mlen < 4) {
+		malformed++;
+		return;
+	}
+	server = find_server6(&from->sin6_addr);
+	servers[server].replies++;
+
+	c = find_client((msg[1] << 16) | (msg[2] << 8) | msg[3]);
+	if (c == NULL) {
+		late++;
+		return;
+	}
+
+	/* The status is the message's, or failing that the IA's, and an
+	   address with no valid lifetime left doesn't count. */
+	opt = option6(msg + 4, mlen - 4, D6O_STATUS_CODE, &olen);
+	if (opt != NULL && olen >= 2)
+		status = getUShort(opt);
+	ia = option6(msg + 4, mlen - 4, D6O_IA_NA, &ialen);
+	if (ia != NULL && ialen >= 12) {
+		opt = option6(ia + 12, ialen - 12, D6O_STATUS_CODE, &olen);
+		if (opt != NULL && olen >= 2 && status == STATUS_Success)
+			status = getUShort(opt);
+		iaaddr = option6(ia + 12, ialen - 12, D6O_IAADDR, &alen);
+		if (iaaddr != NULL && (alen < 24 || getULong(iaaddr + 20) == 0))
+			iaaddr = NULL;
+	}
+
+	switch (c->state) {
+	      case ST_SELECTING:
+		if (msg[0] != DHCPV6_ADVERTISE)
+			break;
+		opt = option6(msg + 4, mlen - 4, D6O_SERVERID, &olen);
+		if (status != STATUS_Success || iaaddr == NULL ||
+		    opt == NULL || olen > sizeof(servers[server].duid)) {
+			c->bound = 0;
+			end_exchange(c, E_FAILED, now);
+			return;
+		}
+		memcpy(servers[server].duid, opt, olen);
+		servers[server].duid_len = olen;
+		memcpy(&c->addr6, iaaddr, 16);
+		c->server = server;
+		c->state = ST_REQUESTING;
+		c->tries = 0;
+		transmit(c, now);
+		return;
+
+	      case ST_REQUESTING:
+	      case ST_RENEWING:
+		if (msg[0] != DHCPV6_REPLY)
+			break;
+		if (status == STATUS_Success && iaaddr != NULL) {
+			memcpy(&c->addr6, iaaddr, 16);
+			c->bound = 1;
+			end_exchange(c, E_OK, now);
+		} else {
+			c->bound = 0;
+			end_exchange(c, E_FAILED, now);
+		}
+		return;
+
+	      case ST_RELEASING:
+		if (msg[0] != DHCPV6_REPLY)
+			break;
+		c->bound = 0;
+		end_exchange(c, status == STATUS_Success ? E_OK : E_FAILED, now);
+		return;
+	}
+	ignored++;
+}
+
+static void
+receive(u_int64_t now) {
+	static union {
+		struct dhcp_packet raw;
+		unsigned char data [65536];
+	} buf;
+	union {
+		struct sockaddr_in sin;
+		struct sockaddr_in6 sin6;
+	} from;
+	socklen_t fromlen;
+	ssize_t len;
+	int i;
+
+	/* Take what has come, but not so much that the timers wait. */
+	for (i = 0; i < 256; i++) {
+		fromlen = sizeof(from);
+		len = recvfrom(sock, buf.data, sizeof(buf), 0,
+			       (struct sockaddr *)&from, &fromlen);
+		if (len < 0)
+			return;
+		received++;
+		if (family == AF_INET)
+			receive4(buf.data, len, &from.sin, now);
+		else
+			receive6(buf.data, len, &from.sin6, now);
+	}
+}
+
+static void
+open_socket(void) {
+	int on = 1, size = 4 * 1024 * 1024;
+	char name [INET6_ADDRSTRLEN];
+
+	sock = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0) {
+		perror("socket");
+		exit(1);
+	}
+	/* The server may be listening on the same port on this host. */
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+		perror("SO_REUSEADDR");
+		exit(1);
+	}
+	/* A bigger buffer than the default keeps a burst of replies from
+	   being dropped; it doesn't matter if we can't have it. */
+	(void) setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	(void) setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+	if (bind(sock, (struct sockaddr *)&relay,
+		 family == AF_INET ? sizeof(struct sockaddr_in) :
+		 sizeof(struct sockaddr_in6)) < 0) {
+		inet_ntop(family, family == AF_INET ?
+			  (void *)&relay.sin.sin_addr :
+			  (void *)&relay.sin6.sin6_addr, name, sizeof(name));
+		fprintf(stderr, "can't bind to %s port %u: %s\n", name,
+			ntohs(relay_src_port), strerror(errno));
+		if (errno == EACCES)
+			fprintf(stderr, "use -P to relay from an "
+				"unprivileged port\n");
+		exit(1);
+	}
+	if (fcntl(sock, F_SETFL, O_NONBLOCK) < 0) {
+		perror("O_NONBLOCK");
+		exit(1);
+	}
+}
+
+static void
+parse_address(const char *s, void *sa, u_int16_t port) {
+	struct sockaddr_in *sin = sa;
+	struct sockaddr_in6 *sin6 = sa;
+
+	if (family == AF_INET) {
+		memset(sin, 0, sizeof(*sin));
+		sin->sin_family = AF_INET;
+		sin->sin_port = port;
+		if (inet_pton(AF_INET, s, &sin->sin_addr) != 1)
+			usage("bad IPv4 address %s", s);
+	} else {
+		memset(sin6, 0, sizeof(*sin6));
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = port;
+		if (inet_pton(AF_INET6, s, &sin6->sin6_addr) != 1)
+			usage("bad IPv6 address %s", s);
+	}
+}
+
+static void
+progress(u_int64_t now, u_int64_t begun) {
+	u_int64_t ok = 0, failed = 0, timedout = 0;
+	int i;
+
+	for (i = 0; i < X_KINDS; i++) {
+		ok += stats[i].ok;
+		failed += stats[i].failed;
+		timedout += stats[i].timedout;
+	}
+	printf("%7.1fs: %llu started, %llu done, %llu failed, "
+	       "%llu timed out, %u under way\n", (now - begun) / 1e6,
+	       (unsigned long long)started_total, (unsigned long long)ok,
+	       (unsigned long long)failed, (unsigned long long)timedout,
+	       in_flight);
+	fflush(stdout);
+}
+
+static void
+report(u_int64_t elapsed) {
+	struct kind_stats *ks;
+	u_int64_t ok = 0;
+	double secs = elapsed / 1e6;
+	int i;
+	unsigned b;
+
+	for (i = 0; i < X_KINDS; i++)
+		ok += stats[i].ok;
+	printf("%u clients, %.3f seconds: %llu exchanges done, "
+	       "%.0f exchanges/s\n", nclients, secs, (unsigned long long)ok,
+	       secs > 0 ? ok / secs : 0.0);
+	printf("%llu packets sent (%llu again, %llu errors), "
+	       "%llu received (%llu malformed, %llu late, %llu ignored)\n",
+	       (unsigned long long)packets_sent,
+	       (unsigned long long)retransmits,
+	       (unsigned long long)send_errors, (unsigned long long)received,
+	       (unsigned long long)malformed, (unsigned long long)late,
+	       (unsigned long long)ignored);
+
+	printf("%-8s %10s %10s %8s %8s %8s %8s %8s %8s\n", "exchange",
+	       "started", "done", "failed", "timeout", "p50 us", "p90 us",
+	       "p99 us", "max us");
+	for (i = 0; i < X_KINDS; i++) {
+		ks = &stats[i];
+		if (ks->started == 0)
+			continue;
+		printf("%-8s %10llu %10llu %8llu %8llu",
+		       kind_names[family == AF_INET6][i],
+		       (unsigned long long)ks->started,
+		       (unsigned long long)ks->ok,
+		       (unsigned long long)ks->failed,
+		       (unsigned long long)ks->timedout);
+		if (ks->times.count == 0)
+			printf(" %8s %8s %8s %8s\n", "-", "-", "-", "-");
+		else
+			printf(" %8lu %8lu %8lu %8lu\n",
+			       (unsigned long)replay_percentile(&ks->times, 50),
+			       (unsigned long)replay_percentile(&ks->times, 90),
+			       (unsigned long)replay_percentile(&ks->times, 99),
+			       (unsigned long)ks->times.max);
+	}
+
+	for (i = 0; i < nservers; i++)
+		printf("server %s: %llu sent, %llu replies\n",
+		       servers[i].name, (unsigned long long)servers[i].sent,
+		       (unsigned long long)servers[i].replies);
+
+	if (!histograms)
+		return;
+	for (i = 0; i < X_KINDS; i++) {
+		ks = &stats[i];
+		if (ks->times.count == 0)
+			continue;
+		printf("%s latency:\n", kind_names[family == AF_INET6][i]);
+		for (b = 0; b < REPLAY_BUCKETS; b++)
+			if (ks->times.buckets[b] != 0)
+				printf("  <= %10lu us %10lu\n",
+				       (unsigned long)replay_bucket_limit(b),
+				       (unsigned long)ks->times.buckets[b]);
+	}
+}
+
+int
+main(int argc, char **argv) {
+	const char *relay_name = NULL, *link_name = NULL;
+	const char *server_names [MAX_SERVERS];
+	unsigned port = 0, rport = 0;
+	u_int64_t now, begun, end, deadline, next_progress;
+	struct pollfd pfd;
+	char *arg, *colon;
+	int i, ms;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-4"))
+			family = AF_INET;
+		else if (!strcmp(argv[i], "-6"))
+			family = AF_INET6;
+		else if (!strcmp(argv[i], "-v"))
+			verbose = 1;
+		else if (!strcmp(argv[i], "-H"))
+			histograms = 1;
+		else if (argv[i][0] != '-' || argv[i][1] == '\0' ||
+			 argv[i][2] != '\0' || i + 1 == argc)
+			usage("unknown argument %s", argv[i]);
+		else {
+			arg = argv[++i];
+			switch (argv[i - 1][1]) {
+			      case 'g':
+				relay_name = arg;
+				break;
+			      case 's':
+				if (nservers == MAX_SERVERS)
+					usage("too many servers at %s", arg);
+				server_names[nservers++] = arg;
+				break;
+			      case 'p':
+				port = number(arg, 1, 65535, "bad port %s");
+				break;
+			      case 'P':
+				rport = number(arg, 1, 65535, "bad port %s");
+				break;
+			      case 'l':
+				link_name = arg;
+				break;
+			      case 'n':
+				nclients = number(arg, 1, 1 << 24,
+						  "bad number of clients %s");
+				break;
+			      case 'M':
+				if (!strcmp(arg, "seq"))
+					mac_random = 0;
+				else if (!strcmp(arg, "random"))
+					mac_random = 1;
+				else
+					usage("bad MAC distribution %s", arg);
+				break;
+			      case 'o':
+				if (sscanf(arg, "%hhx:%hhx:%hhx", &oui[0],
+					   &oui[1], &oui[2]) != 3)
+					usage("bad OUI %s", arg);
+				break;
+			      case 'D':
+				if (!strcmp(arg, "ll"))
+					client_duid_type = DUID_LL;
+				else if (!strcmp(arg, "llt"))
+					client_duid_type = DUID_LLT;
+				else if (!strcmp(arg, "en"))
+					client_duid_type = DUID_EN;
+				else if (!strcmp(arg, "uuid"))
+					client_duid_type = DUID_UUID;
+				else
+					usage("bad DUID type %s", arg);
+				break;
+			      case 'C':
+				circuit_fmt = arg;
+				break;
+			      case 'R':
+				remote_fmt = arg;
+				break;
+			      case 'k':
+				circuits = number(arg, 1, 0xffffffff,
+						  "bad number of circuits %s");
+				break;
+			      case 't':
+				duration = number(arg, 0, 86400 * 365,
+						  "bad run time %s");
+				break;
+			      case 'm':
+				colon = strchr(arg, ':');
+				if (colon == NULL)
+					usage("bad mix %s", arg);
+				*colon = '\0';
+				renew_pct = number(arg, 0, 100, "bad mix %s");
+				release_pct = number(colon + 1, 0, 100,
+						     "bad mix %s");
+				if (renew_pct + release_pct > 100)
+					usage("mix %s adds up to more than "
+					      "100", arg);
+				break;
+			      case 'r':
+				rate = number(arg, 0, 0xffffffff,
+					      "bad rate %s");
+				break;
+			      case 'w':
+				window = number(arg, 1, MAX_WINDOW,
+						"bad window %s");
+				break;
+			      case 'T':
+				timeout = number(arg, 1, 3600000,
+						 "bad timeout %s");
+				break;
+			      case 'x':
+				retries = number(arg, 0, 100,
+						 "bad number of retries %s");
+				break;
+			      case 'S':
+				seed = number(arg, 0, 0xffffffff,
+					      "bad seed %s");
+				break;
+			      default:
+				usage("unknown argument %s", argv[i - 1]);
+			}
+		}
+	}
+
+	if (relay_name == NULL)
+		usage("no relay address given with -g", NULL);
+	if (nservers == 0)
+		usage("no server given with -s", NULL);
+	if (port == 0)
+		port = family == AF_INET ? 67 : 547;
+	server_port = htons(port);
+	relay_src_port = htons(rport != 0 ? rport : port);
+	send_relay_port = rport != 0 && rport != port;
+
+	parse_address(relay_name, &relay, relay_src_port);
+	for (i = 0; i < nservers; i++) {
+		servers[i].name = server_names[i];
+		parse_address(server_names[i], &servers[i].addr, server_port);
+	}
+	if (family == AF_INET6) {
+		if (link_name == NULL)
+			link6 = relay.sin6.sin6_addr;
+		else if (inet_pton(AF_INET6, link_name, &link6) != 1)
+			usage("bad IPv6 address %s", link_name);
+	}
+
+	clients = calloc(nclients, sizeof(*clients));
+	slots = calloc(window, sizeof(*slots));
+	free_slots = calloc(window, sizeof(*free_slots));
+	ready = calloc(nclients, sizeof(*ready));
+	if (clients == NULL || slots == NULL || free_slots == NULL ||
+	    ready == NULL) {
+		fprintf(stderr, "no memory for %u clients\n", nclients);
+		return (1);
+	}
+	for (i = 0; i < (int)nclients; i++) {
+		clients[i].slot = -1;
+		clients[i].prev = clients[i].next = -1;
+		ready[i] = i;
+	}
+	ready_count = nclients;
+	for (i = 0; i < (int)window; i++) {
+		slots[i] = -1;
+		free_slots[i] = window - 1 - i;
+	}
+	nfree = window;
+	srandom(seed);
+
+	open_socket();
+	signal(SIGINT, interrupt);
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+
+	begun = usecs_now();
+	end = begun + duration * 1000000ULL;
+	next_progress = begun + 1000000;
+	for (;;) {
+		now = usecs_now();
+		expire(now);
+
+		/* Start what exchanges we may.  In a run that isn't timed,
+		   each client is queued only once. */
+		if (interrupted || (duration != 0 && now >= end))
+			ready_count = 0;
+		while (nfree > 0 && ready_count > 0) {
+			if (rate != 0 && started_total >=
+			    (now - begun) * (double)rate / 1e6 + 1)
+				break;
+			i = ready[ready_head];
+			ready_head = (ready_head + 1) % nclients;
+			ready_count--;
+			start(&clients[i], now);
+		}
+		if (ready_count == 0 && in_flight == 0 &&
+		    (duration == 0 || interrupted || now >= end))
+			break;
+
+		if (verbose && now >= next_progress) {
+			progress(now, begun);
+			next_progress += 1000000;
+		}
+
+		deadline = now + 1000000;
+		if (wait_head >= 0 &&
+		    clients[wait_head].sent + timeout * 1000ULL < deadline)
+			deadline = clients[wait_head].sent + timeout * 1000ULL;
+		if (rate != 0 && nfree > 0 && ready_count > 0 &&
+		    begun + started_total * 1e6 / rate < deadline)
+			deadline = begun + started_total * 1e6 / rate;
+		if (duration != 0 && end > now && end < deadline)
+			deadline = end;
+		if (verbose && next_progress < deadline)
+			deadline = next_progress;
+		ms = deadline > now ? (deadline - now + 999) / 1000 : 0;
+
+		if (poll(&pfd, 1, ms) > 0 && (pfd.revents & POLLIN) != 0)
+			receive(usecs_now());
+	}
+
+	report(usecs_now() - begun);
+	return (0);
+}
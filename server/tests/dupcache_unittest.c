@@ -0,0 +1,418 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <atf-c.h>
+
+/*
+ * Test the duplicate cache: the keys made for DHCPv4 and DHCPv6
+ * messages, and the life of an entry from new through pending to
+ * replied and expired.
+ */
+
+static void
+set_now(long sec, long usec) {
+	cur_tv.tv_sec = sec;
+	cur_tv.tv_usec = usec;
+}
+
+/* A DHCPv4 message with the given type and, if id isn't 0, a client
+   identifier ending in id.  Returns its length. */
+static unsigned
+make_packet4(struct dhcp_packet *raw, int type, unsigned char id) {
+	unsigned char *opt;
+
+	memset(raw, 0, sizeof(*raw));
+	raw->op = BOOTREQUEST;
+	raw->htype = HTYPE_ETHER;
+	raw->hlen = 6;
+	raw->xid = htonl(0x12345678);
+	memcpy(raw->chaddr, "\x00\x11\x22\x33\x44\x55", 6);
+	memcpy(raw->options, DHCP_OPTIONS_COOKIE, 4);
+	opt = raw->options + 4;
+	*opt++ = DHO_DHCP_MESSAGE_TYPE;
+	*opt++ = 1;
+	*opt++ = type;
+	if (id != 0) {
+		*opt++ = DHO_DHCP_CLIENT_IDENTIFIER;
+		*opt++ = 3;
+		*opt++ = 1;
+		*opt++ = 0xaa;
+		*opt++ = id;
+	}
+	*opt++ = DHO_END;
+	return (opt - (unsigned char *)raw);
+}
+
+ATF_TC(dupcache_key4);
+ATF_TC_HEAD(dupcache_key4, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify the keys of DHCPv4 messages");
+}
+
+ATF_TC_BODY(dupcache_key4, tc)
+{
+	struct dhcp_packet raw;
+	unsigned char key [DUPCACHE_KEY_MAX], key2 [DUPCACHE_KEY_MAX];
+	unsigned len, klen, klen2;
+
+	len = make_packet4(&raw, DHCPDISCOVER, 0);
+	klen = dupcache_key4(1, &raw, len, key);
+	ATF_REQUIRE(klen != 0);
+
+	/* The same message is the same key. */
+	klen2 = dupcache_key4(1, &raw, len, key2);
+	ATF_CHECK(klen == klen2 && memcmp(key, key2, klen) == 0);
+
+	/* A request with the same transaction ID is a different message. */
+	len = make_packet4(&raw, DHCPREQUEST, 0);
+	klen2 = dupcache_key4(1, &raw, len, key2);
+	ATF_CHECK(klen2 != 0);
+	ATF_CHECK(klen != klen2 || memcmp(key, key2, klen) != 0);
+
+	/* A different interface, transaction ID, relay or client
+	   identifier each make a different key. */
+	len = make_packet4(&raw, DHCPDISCOVER, 0);
+	klen2 = dupcache_key4(2, &raw, len, key2);
+	ATF_CHECK(klen != klen2 || memcmp(key, key2, klen) != 0);
+
+	raw.xid = htonl(0x12345679);
+	klen2 = dupcache_key4(1, &raw, len, key2);
+	ATF_CHECK(klen != klen2 || memcmp(key, key2, klen) != 0);
+
+	len = make_packet4(&raw, DHCPDISCOVER, 0);
+	raw.giaddr.s_addr = htonl(0x0a000001);
+	klen2 = dupcache_key4(1, &raw, len, key2);
+	ATF_CHECK(klen != klen2 || memcmp(key, key2, klen) != 0);
+
+	len = make_packet4(&raw, DHCPDISCOVER, 1);
+	klen = dupcache_key4(1, &raw, len, key);
+	len = make_packet4(&raw, DHCPDISCOVER, 2);
+	klen2 = dupcache_key4(1, &raw, len, key2);
+	ATF_CHECK(klen != 0 && klen2 != 0);
+	ATF_CHECK(klen != klen2 || memcmp(key, key2, klen) != 0);
+
+	/* Other messages and BOOTP aren't remembered. */
+	len = make_packet4(&raw, DHCPINFORM, 0);
+	ATF_CHECK_EQ(dupcache_key4(1, &raw, len, key), 0);
+	len = make_packet4(&raw, DHCPRELEASE, 0);
+	ATF_CHECK_EQ(dupcache_key4(1, &raw, len, key), 0);
+	raw.options[4] = DHO_END;
+	ATF_CHECK_EQ(dupcache_key4(1, &raw, len, key), 0);
+}
+
+ATF_TC(dupcache_life);
+ATF_TC_HEAD(dupcache_life, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify duplicates are dropped while "
+			  "pending and answered once replied to");
+}
+
+ATF_TC_BODY(dupcache_life, tc)
+{
+	struct interface_info *ip = NULL;
+	struct dupcache_entry *e;
+	struct dhcp_packet raw, reply;
+	struct sockaddr_in to;
+	struct in_addr from;
+	unsigned char key [DUPCACHE_KEY_MAX];
+	u_int32_t slot, serial, old_serial;
+	unsigned len, klen;
+
+	ATF_REQUIRE(interface_allocate(&ip, MDL) == ISC_R_SUCCESS);
+	memset(&to, 0, sizeof(to));
+	from.s_addr = htonl(0x0a000001);
+	memset(&reply, 0, sizeof(reply));
+	reply.op = BOOTREPLY;
+
+	set_now(1000, 0);
+	dupcache_time = 5;
+	dupcache_size = 64;
+	ATF_REQUIRE(dupcache_init());
+
+	len = make_packet4(&raw, DHCPDISCOVER, 0);
+	klen = dupcache_key4(1, &raw, len, key);
+	ATF_REQUIRE(klen != 0);
+
+	/* The first copy is new and becomes the current entry. */
+	ATF_CHECK_EQ(dupcache_check(key, klen, &e), DUPCACHE_NEW);
+	dupcache_current(&slot, &serial);
+	ATF_CHECK(serial != 0);
+
+	/* A copy while it is being handled is dropped. */
+	set_now(1000, 500000);
+	ATF_CHECK_EQ(dupcache_check(key, klen, &e), DUPCACHE_PENDING);
+	dupcache_current(&slot, &old_serial);
+	ATF_CHECK_EQ(old_serial, 0);
+
+	/* Once the reply is sent, copies get it again. */
+	dupcache_reply4(slot, serial, ip, &reply, DHCP_FIXED_NON_UDP, from,
+			&to, NULL);
+	ATF_CHECK_EQ(dupcache_stats.stored, 1);
+	set_now(1004, 0);
+	ATF_CHECK_EQ(dupcache_check(key, klen, &e), DUPCACHE_REPLIED);
+
+	/* A second reply for the same entry isn't kept. */
+	dupcache_reply4(slot, serial, ip, &reply, DHCP_FIXED_NON_UDP, from,
+			&to, NULL);
+	ATF_CHECK_EQ(dupcache_stats.stored, 1);
+
+	/* The time runs from when the reply was sent. */
+	set_now(1005, 400000);
+	ATF_CHECK_EQ(dupcache_check(key, klen, &e), DUPCACHE_REPLIED);
+	set_now(1005, 500000);
+	ATF_CHECK_EQ(dupcache_check(key, klen, &e), DUPCACHE_NEW);
+	dupcache_current(&slot, &old_serial);
+	ATF_CHECK(old_serial != serial);
+
+	/* A reply for an entry that has been flushed isn't kept, and the
+	   entry made again after the flush is still pending. */
+	dupcache_flush();
+	ATF_CHECK_EQ(dupcache_check(key, klen, &e), DUPCACHE_NEW);
+	dupcache_reply4(slot, old_serial, ip, &reply, DHCP_FIXED_NON_UDP,
+			from, &to, NULL);
+	ATF_CHECK_EQ(dupcache_stats.stored, 1);
+	ATF_CHECK_EQ(dupcache_check(key, klen, &e), DUPCACHE_PENDING);
+
+	ATF_CHECK_EQ(dupcache_stats.dropped, 2);
+	ATF_CHECK_EQ(dupcache_stats.evicted, 0);
+
+	dupcache_time = 0;
+	dupcache_init();
+	interface_dereference(&ip, MDL);
+}
+
+ATF_TC(dupcache_evict);
+ATF_TC_HEAD(dupcache_evict, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify the oldest entry in a set is "
+			  "replaced");
+}
+
+ATF_TC_BODY(dupcache_evict, tc)
+{
+	struct dupcache_entry *e;
+	struct dhcp_packet raw;
+	unsigned char key [5][DUPCACHE_KEY_MAX];
+	unsigned klen [5], len;
+	int i;
+
+	/* A single set of four. */
+	set_now(1000, 0);
+	dupcache_time = 60;
+	dupcache_size = 4;
+	ATF_REQUIRE(dupcache_init());
+
+	for (i = 0; i < 5; i++) {
+		len = make_packet4(&raw, DHCPDISCOVER, 0);
+		raw.xid = htonl(i);
+		klen[i] = dupcache_key4(1, &raw, len, key[i]);
+		ATF_REQUIRE(klen[i] != 0);
+	}
+
+	for (i = 0; i < 4; i++) {
+		set_now(1000 + i, 0);
+		ATF_CHECK_EQ(dupcache_check(key[i], klen[i], &e),
+			     DUPCACHE_NEW);
+	}
+	ATF_CHECK_EQ(dupcache_stats.evicted, 0);
+
+	/* The fifth replaces the first, which is then new again. */
+	set_now(1010, 0);
+	ATF_CHECK_EQ(dupcache_check(key[4], klen[4], &e), DUPCACHE_NEW);
+	ATF_CHECK_EQ(dupcache_stats.evicted, 1);
+	ATF_CHECK_EQ(dupcache_check(key[1], klen[1], &e), DUPCACHE_PENDING);
+	ATF_CHECK_EQ(dupcache_check(key[0], klen[0], &e), DUPCACHE_NEW);
+	ATF_CHECK_EQ(dupcache_stats.evicted, 2);
+
+	/* Expired entries are used before live ones are evicted. */
+	set_now(1062, 500000);
+	ATF_CHECK_EQ(dupcache_check(key[1], klen[1], &e), DUPCACHE_NEW);
+	ATF_CHECK_EQ(dupcache_stats.evicted, 2);
+
+	dupcache_time = 0;
+	dupcache_init();
+}
+
+/* A packet handler that answers nothing, and takes the entry as
+   ack_lease() does when take_entry is set. */
+static int handled, take_entry;
+static u_int32_t taken_slot, taken_serial;
+
+static void
+test_handler(struct interface_info *ip, struct dhcp_packet *raw,
+	     unsigned len, unsigned int from_port, struct iaddr from,
+	     struct hardware *hfrom) {
+	handled++;
+	if (take_entry)
+		dupcache_current(&taken_slot, &taken_serial);
+}
+
+ATF_TC(dupcache_unanswered);
+ATF_TC_HEAD(dupcache_unanswered, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify a message that isn't answered "
+			  "is forgotten unless a lease state holds it");
+}
+
+ATF_TC_BODY(dupcache_unanswered, tc)
+{
+	struct interface_info *ip = NULL;
+	struct dupcache_entry *e;
+	struct dhcp_packet raw, reply;
+	struct sockaddr_in to;
+	struct in_addr from;
+	struct iaddr client;
+	unsigned char key [DUPCACHE_KEY_MAX];
+	unsigned len, klen;
+
+	ATF_REQUIRE(interface_allocate(&ip, MDL) == ISC_R_SUCCESS);
+	memset(&to, 0, sizeof(to));
+	memset(&client, 0, sizeof(client));
+	from.s_addr = htonl(0x0a000001);
+	memset(&reply, 0, sizeof(reply));
+	reply.op = BOOTREPLY;
+
+	set_now(1000, 0);
+	dupcache_time = 5;
+	dupcache_size = 64;
+	bootp_packet_handler = test_handler;
+	dupcache_setup();
+	ATF_REQUIRE(bootp_packet_handler != test_handler);
+
+	len = make_packet4(&raw, DHCPREQUEST, 0);
+	klen = dupcache_key4(ip->index, &raw, len, key);
+	ATF_REQUIRE(klen != 0);
+
+	/* Nothing took the entry, as when the request is NAKed, so a
+	   retransmission is handled again. */
+	bootp_packet_handler(ip, &raw, len, 68, client, NULL);
+	bootp_packet_handler(ip, &raw, len, 68, client, NULL);
+	ATF_CHECK_EQ(handled, 2);
+	ATF_CHECK_EQ(dupcache_stats.dropped, 0);
+
+	/* A lease state took it, as for a ping check, so a retransmission
+	   is dropped until the lease state is freed. */
+	take_entry = 1;
+	bootp_packet_handler(ip, &raw, len, 68, client, NULL);
+	take_entry = 0;
+	bootp_packet_handler(ip, &raw, len, 68, client, NULL);
+	ATF_CHECK_EQ(handled, 3);
+	ATF_CHECK_EQ(dupcache_stats.dropped, 1);
+	dupcache_forget(taken_slot, taken_serial);
+	bootp_packet_handler(ip, &raw, len, 68, client, NULL);
+	ATF_CHECK_EQ(handled, 4);
+
+	/* Once answered, freeing the lease state keeps the reply. */
+	take_entry = 1;
+	set_now(1001, 0);
+	dupcache_flush();
+	bootp_packet_handler(ip, &raw, len, 68, client, NULL);
+	take_entry = 0;
+	dupcache_reply4(taken_slot, taken_serial, ip, &reply,
+			DHCP_FIXED_NON_UDP, from, &to, NULL);
+	dupcache_forget(taken_slot, taken_serial);
+	ATF_CHECK_EQ(dupcache_check(key, klen, &e), DUPCACHE_REPLIED);
+
+	dupcache_time = 0;
+	dupcache_init();
+	interface_dereference(&ip, MDL);
+}
+
+#ifdef DHCPv6
+ATF_TC(dupcache_key6);
+ATF_TC_HEAD(dupcache_key6, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify the keys of DHCPv6 messages");
+}
+
+ATF_TC_BODY(dupcache_key6, tc)
+{
+	unsigned char solicit[] = {
+		DHCPV6_SOLICIT, 1, 2, 3,
+		0, D6O_ELAPSED_TIME, 0, 2, 0, 0,
+		0, D6O_CLIENTID, 0, 4, 0, 3, 0, 1
+	};
+	unsigned char relayed[34 + 4 + sizeof(solicit)];
+	unsigned char key [DUPCACHE_KEY_MAX], key2 [DUPCACHE_KEY_MAX];
+	unsigned klen, klen2;
+	struct iaddr from;
+
+	memset(&from, 0, sizeof(from));
+	from.len = 16;
+	from.iabuf[0] = 0xfe;
+	from.iabuf[1] = 0x80;
+	from.iabuf[15] = 1;
+
+	klen = dupcache_key6(1, solicit, sizeof(solicit), 546, &from, 0, key);
+	ATF_REQUIRE(klen != 0);
+	klen2 = dupcache_key6(1, solicit, sizeof(solicit), 546, &from, 1,
+			      key2);
+	ATF_CHECK(klen != klen2 || memcmp(key, key2, klen) != 0);
+
+	/* Relayed from two links. */
+	memset(relayed, 0, sizeof(relayed));
+	relayed[0] = DHCPV6_RELAY_FORW;
+	relayed[2] = 0x20;
+	relayed[35] = D6O_RELAY_MSG;
+	relayed[37] = sizeof(solicit);
+	memcpy(relayed + 38, solicit, sizeof(solicit));
+	klen = dupcache_key6(1, relayed, sizeof(relayed), 547, &from, 1, key);
+	ATF_REQUIRE(klen != 0);
+	relayed[17] = 1;
+	klen2 = dupcache_key6(1, relayed, sizeof(relayed), 547, &from, 1,
+			      key2);
+	ATF_REQUIRE(klen2 != 0);
+	ATF_CHECK(klen != klen2 || memcmp(key, key2, klen) != 0);
+
+	/* A different transaction ID. */
+	relayed[17] = 0;
+	relayed[41] = 4;
+	klen2 = dupcache_key6(1, relayed, sizeof(relayed), 547, &from, 1,
+			      key2);
+	ATF_CHECK(klen != klen2 || memcmp(key, key2, klen) != 0);
+
+	/* Not remembered: a truncated relay message, a relay-reply, an
+	   advertise and a message without a client identifier. */
+	ATF_CHECK_EQ(dupcache_key6(1, relayed, sizeof(relayed) - 1, 547,
+				   &from, 1, key), 0);
+	relayed[0] = DHCPV6_RELAY_REPL;
+	ATF_CHECK_EQ(dupcache_key6(1, relayed, sizeof(relayed), 547,
+				   &from, 1, key), 0);
+	solicit[0] = DHCPV6_ADVERTISE;
+	ATF_CHECK_EQ(dupcache_key6(1, solicit, sizeof(solicit), 546,
+				   &from, 0, key), 0);
+	solicit[0] = DHCPV6_SOLICIT;
+	solicit[11] = D6O_SERVERID;
+	ATF_CHECK_EQ(dupcache_key6(1, solicit, sizeof(solicit), 546,
+				   &from, 0, key), 0);
+}
+#endif
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, dupcache_key4);
+	ATF_TP_ADD_TC(tp, dupcache_life);
+	ATF_TP_ADD_TC(tp, dupcache_evict);
+	ATF_TP_ADD_TC(tp, dupcache_unanswered);
+#ifdef DHCPv6
+	ATF_TP_ADD_TC(tp, dupcache_key6);
+#endif
+	return (atf_no_error());
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+#include <sys/time.h>
+
+#include <atf-c.h>
+
+/*
+ * Test that pool_timer() expires leases in batches.  A pool is set up
+ * from a configuration file, some of its leases are made active as if
+ * they had been read from the lease file, and then the clock is moved
+ * past their end so that they are all due at once.
+ */
+
+#define EXPIRY_TEST_CONF	"expiry_unittest.conf"
+#define EXPIRY_TEST_DB		"expiry_unittest.leases"
+
+#define EXPIRY_TEST_LEASES	25
+#define EXPIRY_TEST_BATCH	10
+
+static const char *one_pool =
+	"subnet 192.0.2.0 netmask 255.255.255.0 {\n"
+	"	pool { range 192.0.2.10 192.0.2.99; }\n"
+	"}\n";
+
+static struct iaddr
+test_addr(int octet) {
+	struct iaddr addr;
+
+	addr.len = 4;
+	addr.iabuf[0] = 192;
+	addr.iabuf[1] = 0;
+	addr.iabuf[2] = 2;
+	addr.iabuf[3] = octet;
+	return (addr);
+}
+
+/* Start the server tables from the configuration, and make leases for
+   the first addresses in the pool active until a minute from now. */
+static struct pool *
+setup(void) {
+	struct lease *lease;
+	struct pool *pool = NULL;
+	isc_result_t status;
+	FILE *f;
+	int i;
+
+	status = dhcp_context_create(DHCP_CONTEXT_PRE_DB, NULL, NULL);
+	ATF_REQUIRE_MSG(status == ISC_R_SUCCESS, "dhcp_context_create: %s",
+			isc_result_totext(status));
+	classification_setup();
+	status = omapi_init();
+	ATF_REQUIRE_MSG(status == ISC_R_SUCCESS, "omapi_init: %s",
+			isc_result_totext(status));
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+
+	gettimeofday(&cur_tv, NULL);
+	initialize_common_option_spaces();
+	initialize_server_option_spaces();
+	root_group_setup();
+
+	f = fopen(EXPIRY_TEST_CONF, "w");
+	ATF_REQUIRE(f != NULL);
+	ATF_REQUIRE(fputs(one_pool, f) >= 0);
+	ATF_REQUIRE(fclose(f) == 0);
+	path_dhcpd_conf = EXPIRY_TEST_CONF;
+	status = readconf();
+	ATF_REQUIRE_MSG(status == ISC_R_SUCCESS, "readconf: %s",
+			isc_result_totext(status));
+
+	for (i = 0; i < EXPIRY_TEST_LEASES; i++) {
+		lease = NULL;
+		ATF_REQUIRE(use_lease_by_ip_addr(&lease, test_addr(10 + i),
+						 MDL));
+		lease->starts = cur_time;
+		lease->ends = cur_time + 60;
+		lease->binding_state = FTS_ACTIVE;
+		lease->next_binding_state = FTS_FREE;
+		lease->rewind_binding_state = FTS_FREE;
+		lease_dereference(&lease, MDL);
+	}
+	expire_all_pools();
+
+	/* The expired leases are written to a lease file of our own. */
+	path_dhcpd_db = EXPIRY_TEST_DB;
+	dont_use_fsync = 1;
+	unlink(EXPIRY_TEST_DB);
+	ATF_REQUIRE(new_lease_file(0));
+
+	ATF_REQUIRE(find_address_pool(&pool, test_addr(10)));
+	return (pool);
+}
+
+static int
+count_queue(LEASE_STRUCT_PTR lq) {
+	struct lease *l;
+	int count = 0;
+
+	for (l = LEASE_GET_FIRSTP(lq); l != NULL; l = LEASE_GET_NEXTP(lq, l))
+		count++;
+	return (count);
+}
+
+/* When the pool's timer is set for, or zero if it isn't set. */
+static time_t
+pool_timer_when(struct pool *pool) {
+	struct timeout *q;
+
+	for (q = timeouts; q != NULL; q = q->next)
+		if (q->func == pool_timer && q->what == pool)
+			return (q->when.tv_sec);
+	return (0);
+}
+
+ATF_TC(expiry_batch);
+
+ATF_TC_HEAD(expiry_batch, tc) {
+	atf_tc_set_md_var(tc, "descr", "pool_timer() expires at most "
+			  "expiry-batch-size leases a run, and runs again "
+			  "at once for the rest.");
+}
+
+ATF_TC_BODY(expiry_batch, tc) {
+	struct pool *pool;
+	int left;
+
+	pool = setup();
+	ATF_REQUIRE_EQ(count_queue(&pool->active), EXPIRY_TEST_LEASES);
+	ATF_CHECK(pool_timer_when(pool) == cur_time + 60);
+
+	expiry_batch_size = EXPIRY_TEST_BATCH;
+	cur_tv.tv_sec += 120;
+
+	/* Each run but the last does a batch and sets the timer for now,
+	   so the next one comes after whatever is waiting. */
+	for (left = EXPIRY_TEST_LEASES; left > EXPIRY_TEST_BATCH;
+	     left -= EXPIRY_TEST_BATCH) {
+		pool_timer(pool);
+		ATF_CHECK_EQ(count_queue(&pool->active),
+			     left - EXPIRY_TEST_BATCH);
+		ATF_CHECK(pool->next_event_time == cur_time);
+		ATF_CHECK(pool_timer_when(pool) == cur_time);
+	}
+	ATF_CHECK_EQ(expiry_stats.deferred, 2);
+	ATF_CHECK_EQ(expiry_stats.batch_max, EXPIRY_TEST_BATCH);
+
+	/* The last does what's left, and with nothing more to expire
+	   doesn't set the timer again. */
+	pool_timer(pool);
+	ATF_CHECK_EQ(count_queue(&pool->active), 0);
+	ATF_CHECK_EQ(count_queue(&pool->free), pool->lease_count -
+		     pool->unused_leases);
+	ATF_CHECK(pool->next_event_time == MIN_TIME);
+	ATF_CHECK_EQ(expiry_stats.deferred, 2);
+	ATF_CHECK_EQ(expiry_stats.runs, 3);
+	ATF_CHECK_EQ(expiry_stats.transitions, EXPIRY_TEST_LEASES);
+
+	unlink(EXPIRY_TEST_DB);
+}
+
+ATF_TC(expiry_unbatched);
+
+ATF_TC_HEAD(expiry_unbatched, tc) {
+	atf_tc_set_md_var(tc, "descr", "With no expiry-batch-size, "
+			  "pool_timer() expires every lease that's due.");
+}
+
+ATF_TC_BODY(expiry_unbatched, tc) {
+	struct pool *pool;
+
+	pool = setup();
+	expiry_batch_size = 0;
+	cur_tv.tv_sec += 120;
+
+	pool_timer(pool);
+	ATF_CHECK_EQ(count_queue(&pool->active), 0);
+	ATF_CHECK_EQ(expiry_stats.deferred, 0);
+	ATF_CHECK_EQ(expiry_stats.batch_max, EXPIRY_TEST_LEASES);
+
+	unlink(EXPIRY_TEST_DB);
+}
+
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, expiry_batch);
+	ATF_TP_ADD_TC(tp, expiry_unbatched);
+
+	return (atf_no_error());
+}
@@ -48,8 +48,8 @@
  * copied from server/mdb.c:2686
  * HASH_FUNCTIONS(lease_ip, const unsigned char *, struct lease, lease_ip_hash_t,
  *                lease_reference, lease_dereference, do_ip4_hash)
- * HASH_FUNCTIONS(lease_id, const unsigned char *, struct lease, lease_id_hash_t,
- *                lease_reference, lease_dereference, do_id_hash)
+ * HASH_FUNCTIONS(client_leases, const unsigned char *, struct client_leases,
+ *                client_leases_hash_t, 0, 0, do_id_hash)
  * HASH_FUNCTIONS (host, const unsigned char *, struct host_decl, host_hash_t,
  *                 host_reference, host_dereference, do_string_hash)
  * HASH_FUNCTIONS (class, const char *, struct class, class_hash_t,
@@ -59,9 +59,9 @@
  * host_hash_t *host_hw_addr_hash;
  * host_hash_t *host_uid_hash;
  * host_hash_t *host_name_hash;
- * lease_id_hash_t *lease_uid_hash;
+ * client_leases_hash_t *lease_uid_hash;
  * lease_ip_hash_t *lease_ip_addr_hash;
- * lease_id_hash_t *lease_hw_addr_hash;
+ * client_leases_hash_t *lease_hw_addr_hash;
  */
 
 /**
@@ -565,7 +565,7 @@ ATF_TC_BODY(uid_hash_rt29851, tc) {
     dhcp_db_objects_setup ();
     dhcp_common_objects_setup ();
 
-    ATF_CHECK(lease_id_new_hash(&lease_uid_hash, LEASE_HASH_SIZE, MDL));
+    ATF_CHECK(client_leases_new_hash(&lease_uid_hash, LEASE_HASH_SIZE, MDL));
 
     ATF_CHECK(lease_allocate (&lease1, MDL) == ISC_R_SUCCESS);
     ATF_CHECK(lease_allocate (&lease2, MDL) == ISC_R_SUCCESS);
@@ -594,12 +594,259 @@ ATF_TC_BODY(uid_hash_rt29851, tc) {
 }
 #endif
 
+static isc_result_t
+lease_foreach_count(const void *name, unsigned len, void *object) {
+    return ISC_R_SUCCESS;
+}
+
+ATF_TC(lease_hash_rehash);
+
+ATF_TC_HEAD(lease_hash_rehash, tc) {
+    atf_tc_set_md_var(tc, "descr", "Verify that a rehashed table keeps "
+                      "its entries");
+}
+
+ATF_TC_BODY(lease_hash_rehash, tc) {
+    lease_ip_hash_t *table = NULL;
+    struct lease *leases[100];
+    struct lease *check;
+    int i;
+
+    dhcp_db_objects_setup ();
+    dhcp_common_objects_setup ();
+
+    ATF_REQUIRE(lease_ip_new_hash(&table, 7, MDL));
+
+    for (i = 0; i < 100; i++) {
+        leases[i] = NULL;
+        ATF_REQUIRE(lease_allocate(&leases[i], MDL) == ISC_R_SUCCESS);
+        leases[i]->ip_addr.len = 4;
+        leases[i]->ip_addr.iabuf[0] = 10;
+        leases[i]->ip_addr.iabuf[3] = i;
+        lease_ip_hash_add(table, leases[i]->ip_addr.iabuf, 4,
+                          leases[i], MDL);
+    }
+
+    ATF_REQUIRE(lease_ip_rehash(&table, 101, MDL));
+    ATF_CHECK_EQ(table->hash_count, 101);
+    ATF_CHECK_EQ(lease_ip_hash_foreach(table, lease_foreach_count), 100);
+
+    for (i = 0; i < 100; i++) {
+        check = NULL;
+        ATF_CHECK(lease_ip_hash_lookup(&check, table,
+                                       leases[i]->ip_addr.iabuf, 4, MDL));
+        ATF_CHECK(check == leases[i]);
+        if (check != NULL) {
+            lease_dereference(&check, MDL);
+        }
+    }
+
+    /* Entries can still be removed after the move. */
+    lease_ip_hash_delete(table, leases[0]->ip_addr.iabuf, 4, MDL);
+    check = NULL;
+    ATF_CHECK(!lease_ip_hash_lookup(&check, table,
+                                    leases[0]->ip_addr.iabuf, 4, MDL));
+
+    for (i = 0; i < 100; i++) {
+        lease_dereference(&leases[i], MDL);
+    }
+}
+
+ATF_TC(client_leases_order);
+
+ATF_TC_HEAD(client_leases_order, tc) {
+    atf_tc_set_md_var(tc, "descr", "Verify that a client's leases are kept "
+                      "in order of preference");
+}
+
+ATF_TC_BODY(client_leases_order, tc) {
+    unsigned char clientid[] = { 0x1, 0x2, 0x3 };
+    struct lease *leases[4];
+    struct client_leases *set;
+    int i;
+
+    dhcp_db_objects_setup ();
+    dhcp_common_objects_setup ();
+
+    lease_uid_hash = NULL;
+    ATF_REQUIRE(client_leases_new_hash(&lease_uid_hash, LEASE_HASH_SIZE,
+                                       MDL));
+
+    for (i = 0; i < 4; i++) {
+        leases[i] = NULL;
+        ATF_REQUIRE(lease_allocate(&leases[i], MDL) == ISC_R_SUCCESS);
+        memcpy(leases[i]->uid_buf, clientid, sizeof(clientid));
+        leases[i]->uid = leases[i]->uid_buf;
+        leases[i]->uid_len = sizeof(clientid);
+    }
+
+    /* An abandoned lease, a free one, and two active ones of which the
+       one that ends later is preferred. */
+    leases[0]->binding_state = FTS_ABANDONED;
+    leases[1]->binding_state = FTS_FREE;
+    leases[2]->binding_state = FTS_ACTIVE;
+    leases[2]->ends = 100;
+    leases[3]->binding_state = FTS_ACTIVE;
+    leases[3]->ends = 200;
+
+    for (i = 0; i < 4; i++) {
+        uid_hash_add(leases[i]);
+    }
+    /* Adding a lease twice doesn't put it in the set twice. */
+    uid_hash_add(leases[1]);
+
+    set = find_client_leases_by_uid(clientid, sizeof(clientid));
+    ATF_REQUIRE(set != NULL);
+    ATF_REQUIRE_EQ(set->count, 4);
+    ATF_CHECK(set->leases[0] == leases[3]);
+    ATF_CHECK(set->leases[1] == leases[2]);
+    ATF_CHECK(set->leases[2] == leases[1]);
+    ATF_CHECK(set->leases[3] == leases[0]);
+    ATF_CHECK_EQ(client_leases_index(set, leases[1]), 2);
+
+    /* Taking one out of the middle keeps the order of the rest. */
+    uid_hash_delete(leases[2]);
+    set = find_client_leases_by_uid(clientid, sizeof(clientid));
+    ATF_REQUIRE(set != NULL);
+    ATF_REQUIRE_EQ(set->count, 3);
+    ATF_CHECK(set->leases[0] == leases[3]);
+    ATF_CHECK(set->leases[1] == leases[1]);
+    ATF_CHECK(set->leases[2] == leases[0]);
+    ATF_CHECK_EQ(client_leases_index(set, leases[2]), 3);
+
+    /* Once the last one is gone, so is the set. */
+    uid_hash_delete(leases[3]);
+    uid_hash_delete(leases[1]);
+    uid_hash_delete(leases[0]);
+    ATF_CHECK(find_client_leases_by_uid(clientid, sizeof(clientid)) == NULL);
+
+    for (i = 0; i < 4; i++) {
+        lease_dereference(&leases[i], MDL);
+    }
+}
+
+#if defined (LAZY_RANGES)
+static struct iaddr
+range_test_addr(int last) {
+    struct iaddr addr;
+
+    addr.len = 4;
+    addr.iabuf[0] = 10;
+    addr.iabuf[1] = 0;
+    addr.iabuf[2] = last >> 8;
+    addr.iabuf[3] = last & 0xff;
+    return (addr);
+}
+
+ATF_TC(lease_range_lookup);
+
+ATF_TC_HEAD(lease_range_lookup, tc) {
+    atf_tc_set_md_var(tc, "descr", "Verify that leases are made for range "
+                      "addresses as they are used, not looked up");
+}
+
+ATF_TC_BODY(lease_range_lookup, tc) {
+    struct shared_network *share = NULL;
+    struct subnet *subnet = NULL;
+    struct pool *pool1 = NULL, *pool2 = NULL, *pool = NULL;
+    struct lease *lease = NULL;
+    int i;
+
+    dhcp_db_objects_setup ();
+    dhcp_common_objects_setup ();
+
+    ATF_REQUIRE(shared_network_allocate(&share, MDL) == ISC_R_SUCCESS);
+    ATF_REQUIRE(subnet_allocate(&subnet, MDL) == ISC_R_SUCCESS);
+    subnet->net = range_test_addr(0);
+    subnet->netmask.len = 4;
+    memset(subnet->netmask.iabuf, 0xff, 2);
+    shared_network_reference(&subnet->shared_network, share, MDL);
+    ATF_REQUIRE(pool_allocate(&pool1, MDL) == ISC_R_SUCCESS);
+    ATF_REQUIRE(pool_allocate(&pool2, MDL) == ISC_R_SUCCESS);
+
+    /* 10.0.0.10-100 and 10.0.0.200-10.0.1.0, given high to low, plus
+       10.0.0.90-95, which were already declared. */
+    new_address_range(NULL, range_test_addr(10), range_test_addr(100),
+                      subnet, pool1, NULL);
+    new_address_range(NULL, range_test_addr(256), range_test_addr(200),
+                      subnet, pool2, NULL);
+    new_address_range(NULL, range_test_addr(90), range_test_addr(95),
+                      subnet, pool2, NULL);
+    ATF_CHECK_EQ(pool1->unused_leases, 91);
+    ATF_CHECK_EQ(pool2->unused_leases, 63);
+
+    /* The addresses declared twice stay in the first range. */
+    ATF_CHECK(check_lease_ranges() != ISC_R_SUCCESS);
+    ATF_CHECK_EQ(pool2->unused_leases, 57);
+
+    ATF_CHECK(!find_lease_by_ip_addr(&lease, range_test_addr(9), MDL));
+    ATF_CHECK(!find_lease_by_ip_addr(&lease, range_test_addr(257), MDL));
+
+    /* Looking an unused address up doesn't make a lease for it. */
+    ATF_CHECK(!find_lease_by_ip_addr(&lease, range_test_addr(92), MDL));
+    ATF_REQUIRE(find_address_pool(&pool, range_test_addr(92)));
+    ATF_CHECK(pool == pool1);
+    pool_dereference(&pool, MDL);
+    ATF_CHECK_EQ(pool1->unused_leases, 91);
+
+    ATF_REQUIRE(use_lease_by_ip_addr(&lease, range_test_addr(92), MDL));
+    ATF_CHECK(lease->pool == pool1);
+    ATF_CHECK(lease->subnet == subnet);
+    ATF_CHECK_EQ(lease->binding_state, FTS_FREE);
+    ATF_CHECK_EQ(pool1->unused_leases, 90);
+    lease_dereference(&lease, MDL);
+
+    /* Once it's used, lookups find the same lease in the hash. */
+    ATF_REQUIRE(find_lease_by_ip_addr(&lease, range_test_addr(92), MDL));
+    ATF_CHECK_EQ(pool1->unused_leases, 90);
+    lease_dereference(&lease, MDL);
+    ATF_REQUIRE(use_lease_by_ip_addr(&lease, range_test_addr(92), MDL));
+    ATF_CHECK_EQ(pool1->unused_leases, 90);
+    lease_dereference(&lease, MDL);
+
+    ATF_REQUIRE(use_lease_by_ip_addr(&lease, range_test_addr(256), MDL));
+    ATF_CHECK(lease->pool == pool2);
+    lease_dereference(&lease, MDL);
+
+    /* Each allocation takes the lowest unused address. */
+    ATF_REQUIRE(use_unused_lease(pool1));
+    lease = LEASE_GET_FIRST(pool1->free);
+    ATF_REQUIRE(lease != NULL);
+    ATF_CHECK_EQ(lease->ip_addr.iabuf[3], 10);
+    ATF_CHECK(lease->pool == pool1);
+    lease = NULL;
+
+    /* The rest of the first pool goes on its free queue. */
+    for (i = 1; use_unused_lease(pool1); i++)
+        ;
+    ATF_CHECK_EQ(i, 90);
+    ATF_CHECK_EQ(pool1->unused_leases, 0);
+    i = 0;
+    for (lease = LEASE_GET_FIRST(pool1->free); lease != NULL;
+         lease = LEASE_GET_NEXT(pool1->free, lease)) {
+        ATF_CHECK(lease->ip_addr.iabuf[3] != 92);
+        i++;
+    }
+    ATF_CHECK_EQ(i, 90);
+
+    pool_dereference(&pool1, MDL);
+    pool_dereference(&pool2, MDL);
+    subnet_dereference(&subnet, MDL);
+    shared_network_dereference(&share, MDL);
+}
+#endif
+
 ATF_TP_ADD_TCS(tp) {
     ATF_TP_ADD_TC(tp, lease_hash_basic_2hosts);
     ATF_TP_ADD_TC(tp, lease_hash_basic_3hosts);
     ATF_TP_ADD_TC(tp, lease_hash_string_2hosts);
     ATF_TP_ADD_TC(tp, lease_hash_string_3hosts);
     ATF_TP_ADD_TC(tp, lease_hash_negative1);
+    ATF_TP_ADD_TC(tp, lease_hash_rehash);
+    ATF_TP_ADD_TC(tp, client_leases_order);
+#if defined (LAZY_RANGES)
+    ATF_TP_ADD_TC(tp, lease_range_lookup);
+#endif
 #if 0 /* see comment in function */
     ATF_TP_ADD_TC(tp, uid_hash_rt29851);
 #endif
@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+#include <omapip/omapip_p.h>
+#include "dhcpctl/dhcpctl.h"
+#include "omapi_loopback.h"
+
+#include <atf-c.h>
+
+/*
+ * Test the lease cursor, over a connection from omapi_loopback.c.  The
+ * server side has one pool of IPv4 leases, 192.0.2.1 up to
+ * 192.0.2.count, in a lease table with as many buckets as the test asks
+ * for; odd addresses are active and even ones free.
+ */
+
+#define CURSOR_TEST_LEASES	30
+
+static dhcpctl_handle connection;
+
+static void
+setup(int leases, unsigned buckets) {
+	struct shared_network *share = NULL;
+	struct pool *pool = NULL;
+	struct lease *lease;
+	isc_result_t status;
+	int i;
+
+	status = dhcpctl_initialize();
+	ATF_REQUIRE_MSG(status == ISC_R_SUCCESS, "dhcpctl_initialize: %s",
+			isc_result_totext(status));
+	dhcp_db_objects_setup();
+
+	ATF_REQUIRE(shared_network_allocate(&share, MDL) == ISC_R_SUCCESS);
+	ATF_REQUIRE(pool_allocate(&pool, MDL) == ISC_R_SUCCESS);
+	shared_network_reference(&pool->shared_network, share, MDL);
+	pool_reference(&share->pools, pool, MDL);
+	shared_network_reference(&shared_networks, share, MDL);
+
+	ATF_REQUIRE(lease_ip_new_hash(&lease_ip_addr_hash, buckets, MDL));
+	for (i = 1; i <= leases; i++) {
+		lease = NULL;
+		ATF_REQUIRE(lease_allocate(&lease, MDL) == ISC_R_SUCCESS);
+		lease->ip_addr.len = 4;
+		lease->ip_addr.iabuf[0] = 192;
+		lease->ip_addr.iabuf[1] = 0;
+		lease->ip_addr.iabuf[2] = 2;
+		lease->ip_addr.iabuf[3] = i;
+		lease->binding_state = (i & 1) ? FTS_ACTIVE : FTS_FREE;
+		pool_reference(&lease->pool, pool, MDL);
+		lease_ip_hash_add(lease_ip_addr_hash, lease->ip_addr.iabuf,
+				  lease->ip_addr.len, lease, MDL);
+		lease_dereference(&lease, MDL);
+	}
+
+	omapi_loopback_connect(&connection);
+}
+
+static unsigned long
+int_value(dhcpctl_handle h, const char *name) {
+	dhcpctl_data_string v = NULL;
+	unsigned long value;
+
+	ATF_REQUIRE_MSG(dhcpctl_get_value(&v, h, name) == ISC_R_SUCCESS,
+			"no %s", name);
+	ATF_REQUIRE(v->len == 4);
+	value = getULong(v->value);
+	dhcpctl_data_string_dereference(&v, MDL);
+	return (value);
+}
+
+/* The last octet of the address of the n'th lease on the page. */
+static int
+page_lease(dhcpctl_handle h, int n) {
+	dhcpctl_data_string v = NULL;
+	char name[64];
+	int octet;
+
+	snprintf(name, sizeof(name), "lease-%d.ip-address", n);
+	ATF_REQUIRE_MSG(dhcpctl_get_value(&v, h, name) == ISC_R_SUCCESS,
+			"no %s", name);
+	ATF_REQUIRE(v->len == 4);
+	octet = v->value[3];
+	dhcpctl_data_string_dereference(&v, MDL);
+	return (octet);
+}
+
+/* Count each lease on the page that was just received in seen[]. */
+static int
+read_page(dhcpctl_handle h, int *seen) {
+	int i, count;
+
+	count = int_value(h, "count");
+	for (i = 0; i < count; i++)
+		seen[page_lease(h, i)]++;
+	return (count);
+}
+
+static void
+wait_for(dhcpctl_handle h) {
+	dhcpctl_status waitstatus;
+
+	ATF_REQUIRE(dhcpctl_wait_for_completion(h, &waitstatus) ==
+		    ISC_R_SUCCESS);
+	ATF_REQUIRE_MSG(waitstatus == ISC_R_SUCCESS, "%s",
+			isc_result_totext(waitstatus));
+}
+
+/* Create a cursor, which brings the first page. */
+static dhcpctl_handle
+new_cursor(int page_size, int state) {
+	dhcpctl_handle h = NULL;
+
+	ATF_REQUIRE(dhcpctl_new_object(&h, connection, "lease-cursor") ==
+		    ISC_R_SUCCESS);
+	ATF_REQUIRE(dhcpctl_set_int_value(h, page_size, "page-size") ==
+		    ISC_R_SUCCESS);
+	if (state != 0)
+		ATF_REQUIRE(dhcpctl_set_int_value(h, state, "state") ==
+			    ISC_R_SUCCESS);
+	ATF_REQUIRE(dhcpctl_open_object(h, connection, DHCPCTL_CREATE) ==
+		    ISC_R_SUCCESS);
+	wait_for(h);
+	return (h);
+}
+
+static void
+refresh(dhcpctl_handle h) {
+	ATF_REQUIRE(dhcpctl_object_refresh(connection, h) == ISC_R_SUCCESS);
+	wait_for(h);
+}
+
+/* Read the rest of the pages, and return how many there were. */
+static int
+read_all(dhcpctl_handle h, int *seen) {
+	int pages;
+
+	read_page(h, seen);
+	for (pages = 1; !int_value(h, "done"); pages++) {
+		ATF_REQUIRE(pages <= 1000);
+		refresh(h);
+		read_page(h, seen);
+	}
+	return (pages);
+}
+
+ATF_TC(lease_cursor_walk);
+ATF_TC_HEAD(lease_cursor_walk, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify a cursor reports every lease "
+			  "once, however the pages fall across buckets");
+}
+
+ATF_TC_BODY(lease_cursor_walk, tc)
+{
+	int seen[CURSOR_TEST_LEASES + 1];
+	dhcpctl_handle h;
+	int i;
+
+	/* Few buckets, so most hold more than a page. */
+	setup(CURSOR_TEST_LEASES, 7);
+	memset(seen, 0, sizeof(seen));
+
+	h = new_cursor(4, 0);
+	ATF_CHECK(read_all(h, seen) >= CURSOR_TEST_LEASES / 4);
+	for (i = 1; i <= CURSOR_TEST_LEASES; i++)
+		ATF_CHECK_EQ_MSG(seen[i], 1, "lease %d seen %d times",
+				 i, seen[i]);
+	ATF_CHECK_EQ(seen[0], 0);
+
+	/* Once done, a refresh brings an empty page. */
+	refresh(h);
+	ATF_CHECK_EQ(int_value(h, "count"), 0);
+	ATF_CHECK_EQ(int_value(h, "done"), 1);
+}
+
+ATF_TC(lease_cursor_state);
+ATF_TC_HEAD(lease_cursor_state, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify a cursor only reports leases "
+			  "in the state asked for");
+}
+
+ATF_TC_BODY(lease_cursor_state, tc)
+{
+	int seen[CURSOR_TEST_LEASES + 1];
+	dhcpctl_handle h;
+	int i;
+
+	setup(CURSOR_TEST_LEASES, 7);
+	memset(seen, 0, sizeof(seen));
+
+	h = new_cursor(5, FTS_ACTIVE);
+	read_all(h, seen);
+	for (i = 1; i <= CURSOR_TEST_LEASES; i++)
+		ATF_CHECK_EQ_MSG(seen[i], i & 1, "lease %d seen %d times",
+				 i, seen[i]);
+}
+
+ATF_TC(lease_cursor_refresh_only);
+ATF_TC_HEAD(lease_cursor_refresh_only, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify only a refresh moves a cursor "
+			  "on to the next page");
+}
+
+ATF_TC_BODY(lease_cursor_refresh_only, tc)
+{
+	dhcpctl_handle h, again = NULL;
+	int first;
+
+	setup(CURSOR_TEST_LEASES, 7);
+
+	h = new_cursor(1, 0);
+	ATF_REQUIRE_EQ(int_value(h, "count"), 1);
+	first = page_lease(h, 0);
+
+	/* Opening the cursor again by its handle sends the same page. */
+	ATF_REQUIRE(dhcpctl_new_object(&again, connection, "lease-cursor") ==
+		    ISC_R_SUCCESS);
+	ATF_REQUIRE(dhcpctl_set_int_value
+		    (again, ((dhcpctl_remote_object_t *)h)->remote_handle,
+		     "handle") == ISC_R_SUCCESS);
+	ATF_REQUIRE(dhcpctl_open_object(again, connection, 0) ==
+		    ISC_R_SUCCESS);
+	wait_for(again);
+	ATF_CHECK_EQ(int_value(again, "count"), 1);
+	ATF_CHECK_EQ(page_lease(again, 0), first);
+
+	/* A refresh brings the next one. */
+	refresh(h);
+	ATF_CHECK_EQ(int_value(h, "count"), 1);
+	ATF_CHECK(page_lease(h, 0) != first);
+}
+
+ATF_TC(lease_cursor_bounded);
+ATF_TC_HEAD(lease_cursor_bounded, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify a refresh stops after "
+			  "looking at a bounded number of buckets");
+}
+
+ATF_TC_BODY(lease_cursor_bounded, tc)
+{
+	int seen[CURSOR_TEST_LEASES + 1];
+	dhcpctl_handle h;
+	int i;
+
+	/* More buckets than a refresh may look at, and only a few
+	   leases in them. */
+	setup(3, LEASE_HASH_SIZE);
+	memset(seen, 0, sizeof(seen));
+
+	h = new_cursor(100, 0);
+	ATF_CHECK_EQ(int_value(h, "done"), 0);
+	ATF_CHECK(read_all(h, seen) > 1);
+	for (i = 1; i <= 3; i++)
+		ATF_CHECK_EQ(seen[i], 1);
+}
+
+ATF_TC(lease_cursor_grown);
+ATF_TC_HEAD(lease_cursor_grown, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify a cursor is interrupted when "
+			  "the lease table grows under it");
+}
+
+ATF_TC_BODY(lease_cursor_grown, tc)
+{
+	int seen[CURSOR_TEST_LEASES + 1];
+	dhcpctl_handle h;
+
+	setup(CURSOR_TEST_LEASES, 7);
+	memset(seen, 0, sizeof(seen));
+
+	h = new_cursor(4, 0);
+	read_page(h, seen);
+	ATF_REQUIRE_EQ(int_value(h, "done"), 0);
+
+	/* As grow_lease_hashes() does when leases are made for a range;
+	   the leases move to other buckets. */
+	ATF_REQUIRE(lease_ip_rehash(&lease_ip_addr_hash, 61, MDL));
+
+	refresh(h);
+	ATF_CHECK_EQ(int_value(h, "count"), 0);
+	ATF_CHECK_EQ(int_value(h, "done"), 1);
+	ATF_CHECK_EQ(int_value(h, "interrupted"), 1);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, lease_cursor_walk);
+	ATF_TP_ADD_TC(tp, lease_cursor_state);
+	ATF_TP_ADD_TC(tp, lease_cursor_refresh_only);
+	ATF_TP_ADD_TC(tp, lease_cursor_bounded);
+	ATF_TP_ADD_TC(tp, lease_cursor_grown);
+	return (atf_no_error());
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Time the lease queue operations that leaseq_unittest checks, on queues
+ * large enough for the layout of the queue to matter.  This is not run by
+ * "make check"; build it with "make leaseq_bench" in this directory in a
+ * tree configured with --enable-binary-leases, once as it is and once with
+ * LEASECHAIN_BLOCKS defined in site.h, to compare the two layouts:
+ *
+ *	./leaseq_bench [leases [rounds]]
+ *
+ * Each line gives the average time of one operation in nanoseconds:
+ *
+ *	fill	adding leases in order of expiry, as at startup
+ *	renew	removing a lease from the middle and adding it at the end,
+ *		as when a client renews
+ *	expire	removing the first lease and adding it to another queue
+ *	random	removing a lease and adding it back at a random time
+ *	drain	removing every lease from the front
+ *
+ * The leases are spread through memory as they would be in a server, so
+ * a queue that reads a lease for each comparison pays for the cache
+ * misses.  Without binary leases the queues are linked lists, which are
+ * walked on every insertion and are not worth timing at this size.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <sys/time.h>
+
+#if defined (BINARY_LEASES)
+/* Lease structures are spread out by this much to defeat the cache. */
+#define LEASE_STRIDE 7
+
+static struct lease *leases;
+static size_t nleases;
+
+static double
+now(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1e9 + tv.tv_usec * 1e3);
+}
+
+static void
+report(const char *name, double start, size_t ops) {
+	printf("%-8s %10.1f ns/op\n", name, (now() - start) / ops);
+}
+
+/* The i'th lease, taken in an order that jumps about in memory. */
+static struct lease *
+lease_at(size_t i) {
+	return (&leases[(i * LEASE_STRIDE) % nleases]);
+}
+
+int
+main(int argc, char **argv) {
+	LEASE_STRUCT lq, other;
+	struct lease *lp, *check;
+	size_t i, j, rounds, ops;
+	double start;
+
+	nleases = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+	rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : nleases;
+	if (nleases == 0 || nleases % LEASE_STRIDE == 0) {
+		fprintf(stderr, "the number of leases must not be a "
+			"multiple of %d\n", LEASE_STRIDE);
+		return (1);
+	}
+
+	leases = calloc(nleases, sizeof(struct lease));
+	if (leases == NULL) {
+		fprintf(stderr, "no memory for %lu leases\n",
+			(unsigned long)nleases);
+		return (1);
+	}
+	srandom(1);
+
+	memset(&lq, 0, sizeof(lq));
+	memset(&other, 0, sizeof(other));
+#if defined (LEASECHAIN_BLOCKS)
+	printf("blocks of %d", LC_BLOCK_SIZE);
+#else
+	printf("pointer array");
+#endif
+	printf(": %lu leases, %lu rounds\n", (unsigned long)nleases,
+	       (unsigned long)rounds);
+
+	/* Keep a reference on each lease so that the queue code never
+	   tries to free one. */
+	for (i = 0; i < nleases; i++) {
+		check = NULL;
+		lease_reference(&check, &leases[i], MDL);
+	}
+
+	start = now();
+	for (i = 0; i < nleases; i++) {
+		lp = lease_at(i);
+		lp->sort_time = i;
+		LEASE_INSERTP(&lq, lp);
+	}
+	report("fill", start, nleases);
+
+	start = now();
+	for (i = 0; i < rounds; i++) {
+		lp = lease_at((i * 7919) % nleases);
+		LEASE_REMOVEP(&lq, lp);
+		lp->sort_time = nleases + i;
+		LEASE_INSERTP(&lq, lp);
+	}
+	report("renew", start, rounds);
+
+	start = now();
+	ops = rounds;
+	for (i = 0; i < rounds; i++) {
+		lp = LEASE_GET_FIRST(lq);
+		LEASE_REMOVEP(&lq, lp);
+		LEASE_INSERTP(&other, lp);
+		if (i % nleases == nleases - 1) {
+			/* Turn the queues around and carry on. */
+			for (j = 0; j < nleases; j++) {
+				lp = LEASE_GET_FIRST(other);
+				LEASE_REMOVEP(&other, lp);
+				LEASE_INSERTP(&lq, lp);
+			}
+			ops += nleases;
+		}
+	}
+	report("expire", start, ops);
+	while ((lp = LEASE_GET_FIRST(other)) != NULL) {
+		LEASE_REMOVEP(&other, lp);
+		LEASE_INSERTP(&lq, lp);
+	}
+
+	start = now();
+	for (i = 0; i < rounds; i++) {
+		lp = lease_at(random() % nleases);
+		LEASE_REMOVEP(&lq, lp);
+		lp->sort_time = random() % (nleases * 2);
+		LEASE_INSERTP(&lq, lp);
+	}
+	report("random", start, rounds);
+
+	start = now();
+	while ((lp = LEASE_GET_FIRST(lq)) != NULL)
+		LEASE_REMOVEP(&lq, lp);
+	report("drain", start, nleases);
+
+	return (0);
+}
+#else /* BINARY_LEASES */
+int
+main(int argc, char **argv) {
+	printf("Configure with --enable-binary-leases to time the lease "
+	       "queues.\n");
+	return (0);
+}
+#endif /* BINARY_LEASES */
@@ -490,6 +490,79 @@ ATF_TC_BODY(leaseq_same_time, tc)
 
 }
 
+/* Test a queue long enough to be split and merged as leases come and go,
+ * and check that it stays sorted and linked.
+ */
+ATF_TC(leaseq_random);
+ATF_TC_HEAD(leaseq_random, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify random additions and removals");
+}
+
+ATF_TC_BODY(leaseq_random, tc)
+{
+	LEASE_STRUCT lq;
+	struct lease test_lease[1000], *check_lease, *prev;
+	int onq[1000];
+	int i, j, count;
+
+	INIT_LQ(lq);
+	srandom(1);
+
+	for (i = 0; i < 1000; i++) {
+		memset(&test_lease[i], 0, sizeof(struct lease));
+		test_lease[i].sort_time = random() % 500;
+		check_lease = NULL;
+		lease_reference(&check_lease, &test_lease[i], MDL);
+		LEASE_INSERTP(&lq, &test_lease[i]);
+		onq[i] = 1;
+	}
+
+	for (j = 0; j < 20; j++) {
+		/* Take out a random half or so, and put back the rest of
+		 * the ones that were out, at new times. */
+		for (i = 0; i < 1000; i++) {
+			if (onq[i] && (random() % 2)) {
+				LEASE_REMOVEP(&lq, &test_lease[i]);
+				onq[i] = 0;
+			} else if (!onq[i]) {
+				test_lease[i].sort_time = random() % 500;
+				LEASE_INSERTP(&lq, &test_lease[i]);
+				onq[i] = 1;
+			}
+		}
+
+		count = 0;
+		prev = NULL;
+		for (check_lease = LEASE_GET_FIRST(lq);
+		     check_lease != NULL;
+		     check_lease = LEASE_GET_NEXT(lq, check_lease)) {
+			if (prev != NULL &&
+			    prev->sort_time > check_lease->sort_time)
+				atf_tc_fail("leases out of order, %d", j);
+#if defined (BINARY_LEASES)
+			if (check_lease->prev != prev)
+				atf_tc_fail("prev pointer wrong, %d", j);
+#endif
+			if (!onq[check_lease - test_lease])
+				atf_tc_fail("removed lease found, %d", j);
+			prev = check_lease;
+			count++;
+		}
+		for (i = 0; i < 1000; i++)
+			count -= onq[i];
+		if (count != 0)
+			atf_tc_fail("wrong number of leases, %d", j);
+	}
+
+	for (i = 0; i < 1000; i++) {
+		if (onq[i])
+			LEASE_REMOVEP(&lq, &test_lease[i]);
+	}
+	if (LEASE_NOT_EMPTY(lq))
+		atf_tc_fail("queue not empty");
+}
+
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, leaseq_basic);
@@ -499,5 +572,6 @@ ATF_TP_ADD_TCS(tp)
 	ATF_TP_ADD_TC(tp, leaseq_cycle);
 	ATF_TP_ADD_TC(tp, leaseq_long);
 	ATF_TP_ADD_TC(tp, leaseq_same_time);
+	ATF_TP_ADD_TC(tp, leaseq_random);
 	return (atf_no_error());
 }
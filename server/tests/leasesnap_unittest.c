@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2022 by Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+#include "dhcpctl/leasesnap.h"
+
+#include <atf-c.h>
+
+/*
+ * Test the lease snapshot.  The server side writes records through
+ * lease_snapshot_lease() and lease_snapshot_release(); we then map
+ * the same file with the libdhcpctl reader and check what it sees.
+ */
+
+#define SNAP_FILE "leasesnap_unittest.snap"
+
+static void
+init_lease(struct lease *lease, int last_octet, binding_state_t state) {
+	memset(lease, 0, sizeof(*lease));
+	lease->ip_addr.len = 4;
+	lease->ip_addr.iabuf[0] = 192;
+	lease->ip_addr.iabuf[1] = 0;
+	lease->ip_addr.iabuf[2] = 2;
+	lease->ip_addr.iabuf[3] = last_octet;
+	lease->binding_state = state;
+	lease->starts = 1000;
+	lease->ends = 2000;
+	lease->cltt = 1000;
+	lease->hardware_addr.hlen = 7;
+	lease->hardware_addr.hbuf[0] = HTYPE_ETHER;
+	lease->hardware_addr.hbuf[6] = last_octet;
+	lease->uid = lease->uid_buf;
+	lease->uid_len = 3;
+	lease->uid_buf[0] = 1;
+	lease->uid_buf[1] = 2;
+	lease->uid_buf[2] = last_octet;
+}
+
+ATF_TC(leasesnap_v4);
+ATF_TC_HEAD(leasesnap_v4, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify DHCPv4 leases reach readers");
+}
+
+ATF_TC_BODY(leasesnap_v4, tc)
+{
+	struct lease lease1, lease2;
+	struct leasesnap_record rec;
+	leasesnap_t *snap = NULL;
+	u_int32_t slot;
+	u_int64_t gen;
+
+	if (lease_snapshot_open(SNAP_FILE, 4) != ISC_R_SUCCESS)
+		atf_tc_fail("can't create snapshot");
+	if (leasesnap_open(&snap, SNAP_FILE) != 0)
+		atf_tc_fail("can't map snapshot");
+
+	if (leasesnap_slots(snap) != 0)
+		atf_tc_fail("new snapshot isn't empty");
+
+	init_lease(&lease1, 10, FTS_ACTIVE);
+	init_lease(&lease2, 11, FTS_FREE);
+	lease_snapshot_lease(&lease1);
+	lease_snapshot_lease(&lease2);
+
+	if (lease1.snap_slot != 1 || lease2.snap_slot != 2)
+		atf_tc_fail("unexpected slots %u %u",
+			    lease1.snap_slot, lease2.snap_slot);
+	if (leasesnap_slots(snap) != 2)
+		atf_tc_fail("high water is %u", leasesnap_slots(snap));
+
+	if (leasesnap_read(snap, 0, &rec) != 1)
+		atf_tc_fail("slot 0 not in use");
+	if (rec.family != LEASESNAP_FAMILY_INET ||
+	    rec.state != LEASESNAP_STATE_ACTIVE ||
+	    memcmp(rec.addr, lease1.ip_addr.iabuf, 4) != 0 ||
+	    rec.ends != 2000 || rec.hw_len != 6 || rec.hw_addr[5] != 10 ||
+	    rec.id_len != 3 || rec.id[2] != 10)
+		atf_tc_fail("slot 0 contents wrong");
+	if (rec.seq & 1)
+		atf_tc_fail("record left marked busy");
+
+	/* Updating a lease reuses its slot and bumps the generation. */
+	gen = leasesnap_generation(snap);
+	lease1.binding_state = FTS_EXPIRED;
+	lease_snapshot_lease(&lease1);
+	if (lease1.snap_slot != 1)
+		atf_tc_fail("lease moved slots");
+	if (leasesnap_generation(snap) == gen)
+		atf_tc_fail("generation not bumped");
+	if (leasesnap_read(snap, 0, &rec) != 1 ||
+	    rec.state != LEASESNAP_STATE_EXPIRED)
+		atf_tc_fail("update not visible");
+
+	/* Released slots read as unused and are handed out again. */
+	slot = lease2.snap_slot;
+	lease_snapshot_release(&lease2.snap_slot);
+	if (lease2.snap_slot != 0)
+		atf_tc_fail("slot not cleared");
+	if (leasesnap_read(snap, slot - 1, &rec) != 0)
+		atf_tc_fail("released slot still in use");
+	lease_snapshot_lease(&lease2);
+	if (lease2.snap_slot != slot)
+		atf_tc_fail("released slot not reused");
+
+	if (leasesnap_read(snap, 4, &rec) != -1)
+		atf_tc_fail("read past the end succeeded");
+
+	leasesnap_close(&snap);
+	lease_snapshot_close();
+	unlink(SNAP_FILE);
+}
+
+ATF_TC(leasesnap_full);
+ATF_TC_HEAD(leasesnap_full, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify a full snapshot is harmless");
+}
+
+ATF_TC_BODY(leasesnap_full, tc)
+{
+	struct lease leases[3];
+	int i;
+
+	if (lease_snapshot_open(SNAP_FILE, 2) != ISC_R_SUCCESS)
+		atf_tc_fail("can't create snapshot");
+
+	for (i = 0; i < 3; i++) {
+		init_lease(&leases[i], 20 + i, FTS_ACTIVE);
+		lease_snapshot_lease(&leases[i]);
+	}
+
+	if (leases[0].snap_slot == 0 || leases[1].snap_slot == 0)
+		atf_tc_fail("first leases not entered");
+	if (leases[2].snap_slot != 0)
+		atf_tc_fail("lease entered into a full snapshot");
+
+	lease_snapshot_close();
+	unlink(SNAP_FILE);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, leasesnap_v4);
+	ATF_TP_ADD_TC(tp, leasesnap_full);
+	return (atf_no_error());
+}
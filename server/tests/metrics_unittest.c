@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+#include <sys/time.h>
+
+#include <atf-c.h>
+
+/*
+ * Test the metrics served to Prometheus: the stage histograms, the
+ * packet counts and the pool gauges, as written by metrics_render().
+ */
+
+static void
+render(struct metrics_buffer *out) {
+	memset(out, 0, sizeof(*out));
+	ATF_REQUIRE(metrics_render(out));
+	ATF_REQUIRE(out->data != NULL);
+	ATF_REQUIRE(out->len < out->size);
+	out->data[out->len] = '\0';
+}
+
+/* Record a time for a stage that is at least usecs long. */
+static void
+record(int stage, long usecs) {
+	struct timeval start;
+
+	gettimeofday(&start, NULL);
+	start.tv_sec -= usecs / 1000000;
+	start.tv_usec -= usecs % 1000000;
+	if (start.tv_usec < 0) {
+		start.tv_sec--;
+		start.tv_usec += 1000000;
+	}
+	metrics_record(stage, &start);
+}
+
+ATF_TC(metrics_histogram);
+ATF_TC_HEAD(metrics_histogram, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify stage times are reported as "
+			  "a cumulative histogram");
+}
+
+ATF_TC_BODY(metrics_histogram, tc)
+{
+	struct metrics_buffer out;
+
+	memset(&metrics_stats, 0, sizeof(metrics_stats));
+	record(METRICS_COMMIT, 300);
+	record(METRICS_COMMIT, 3000000);
+	ATF_CHECK_EQ(metrics_stats.stages[METRICS_COMMIT].count, 2);
+	ATF_CHECK(metrics_stats.stages[METRICS_COMMIT].max >= 3000000);
+
+	render(&out);
+	ATF_CHECK(strstr(out.data, "# TYPE dhcpd_stage_duration_seconds "
+				   "histogram\n") != NULL);
+	ATF_CHECK(strstr(out.data, "dhcpd_stage_duration_seconds_bucket"
+				   "{stage=\"commit\",le=\"0.00025\"} 0\n")
+		  != NULL);
+	ATF_CHECK(strstr(out.data, "dhcpd_stage_duration_seconds_bucket"
+				   "{stage=\"commit\",le=\"2.5\"} 1\n")
+		  != NULL);
+	ATF_CHECK(strstr(out.data, "dhcpd_stage_duration_seconds_bucket"
+				   "{stage=\"commit\",le=\"5\"} 2\n")
+		  != NULL);
+	ATF_CHECK(strstr(out.data, "dhcpd_stage_duration_seconds_bucket"
+				   "{stage=\"commit\",le=\"+Inf\"} 2\n")
+		  != NULL);
+	ATF_CHECK(strstr(out.data, "dhcpd_stage_duration_seconds_count"
+				   "{stage=\"commit\"} 2\n") != NULL);
+
+	/* Stages with nothing recorded are still reported. */
+	ATF_CHECK(strstr(out.data, "dhcpd_stage_duration_seconds_count"
+				   "{stage=\"fsync\"} 0\n") != NULL);
+	dfree(out.data, MDL);
+}
+
+ATF_TC(metrics_packets);
+ATF_TC_HEAD(metrics_packets, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify packet counts are reported "
+			  "by message type");
+}
+
+ATF_TC_BODY(metrics_packets, tc)
+{
+	struct metrics_buffer out;
+
+	memset(&metrics_stats, 0, sizeof(metrics_stats));
+	metrics_stats.packets[0] = 1;
+	metrics_stats.packets[DHCPDISCOVER] = 3;
+	metrics_stats.packets[REPLAY_TYPES - 1] = 4;
+#ifdef DHCPv6
+	metrics_stats.packets6[DHCPV6_SOLICIT] = 2;
+#endif
+
+	render(&out);
+	ATF_CHECK(strstr(out.data, "dhcpd_packets_received_total"
+				   "{family=\"4\",type=\"BOOTP\"} 1\n")
+		  != NULL);
+	ATF_CHECK(strstr(out.data, "dhcpd_packets_received_total"
+				   "{family=\"4\",type=\"DHCPDISCOVER\"} 3\n")
+		  != NULL);
+	ATF_CHECK(strstr(out.data, "dhcpd_packets_received_total"
+				   "{family=\"4\",type=\"other\"} 4\n")
+		  != NULL);
+#ifdef DHCPv6
+	ATF_CHECK(strstr(out.data, "dhcpd_packets_received_total"
+				   "{family=\"6\",type=\"Solicit\"} 2\n")
+		  != NULL);
+#endif
+
+	/* Types never seen aren't reported. */
+	ATF_CHECK(strstr(out.data, "DHCPREQUEST") == NULL);
+	dfree(out.data, MDL);
+}
+
+ATF_TC(metrics_pools);
+ATF_TC_HEAD(metrics_pools, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify pool gauges and the escaping "
+			  "of names in labels");
+}
+
+ATF_TC_BODY(metrics_pools, tc)
+{
+	struct shared_network *share = NULL;
+	struct pool *pool = NULL;
+	struct metrics_buffer out;
+	static char name[] = "lab \"a\\b\"";
+
+	ATF_REQUIRE(shared_network_allocate(&share, MDL) == ISC_R_SUCCESS);
+	ATF_REQUIRE(pool_allocate(&pool, MDL) == ISC_R_SUCCESS);
+	share->name = name;
+	pool->lease_count = 10;
+	pool->free_leases = 6;
+	pool->backup_leases = 1;
+	pool_reference(&share->pools, pool, MDL);
+	shared_network_reference(&shared_networks, share, MDL);
+
+	render(&out);
+	ATF_CHECK(strstr(out.data, "dhcpd_pool_leases"
+				   "{shared_network=\"lab \\\"a\\\\b\\\"\","
+				   "pool=\"0\",state=\"total\"} 10\n")
+		  != NULL);
+	ATF_CHECK(strstr(out.data, "dhcpd_pool_leases"
+				   "{shared_network=\"lab \\\"a\\\\b\\\"\","
+				   "pool=\"0\",state=\"free\"} 6\n")
+		  != NULL);
+	ATF_CHECK(strstr(out.data, "dhcpd_pool_leases"
+				   "{shared_network=\"lab \\\"a\\\\b\\\"\","
+				   "pool=\"0\",state=\"backup\"} 1\n")
+		  != NULL);
+	dfree(out.data, MDL);
+}
+
+ATF_TC(metrics_buffer);
+ATF_TC_HEAD(metrics_buffer, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify the output grows as needed");
+}
+
+ATF_TC_BODY(metrics_buffer, tc)
+{
+	struct metrics_buffer out;
+	int i;
+
+	memset(&out, 0, sizeof(out));
+	out.size = 8;
+	out.data = dmalloc(out.size, MDL);
+	ATF_REQUIRE(out.data != NULL);
+
+	for (i = 0; i < 1000; i++)
+		metrics_printf(&out, "%d\n", i);
+	ATF_CHECK(!out.failed);
+	ATF_CHECK_EQ(out.len, 10 * 2 + 90 * 3 + 900 * 4);
+	ATF_CHECK(out.len < out.size);
+	ATF_CHECK(strncmp(out.data, "0\n1\n2\n", 6) == 0);
+	ATF_CHECK(strncmp(out.data + out.len - 4, "999\n", 4) == 0);
+	dfree(out.data, MDL);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, metrics_histogram);
+	ATF_TP_ADD_TC(tp, metrics_packets);
+	ATF_TP_ADD_TC(tp, metrics_pools);
+	ATF_TP_ADD_TC(tp, metrics_buffer);
+	return (atf_no_error());
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+#include <omapip/omapip_p.h>
+#include "dhcpctl/dhcpctl.h"
+#include "omapi_loopback.h"
+
+#include <atf-c.h>
+
+/*
+ * The OMAPI tests listen for OMAPI connections and connect to themselves
+ * with dhcpctl, so both ends of each message are handled by the same
+ * dispatch loop.  The port listened on is the first one free from
+ * LOOPBACK_PORT, so that tests run at the same time, or a server left
+ * listening, don't make them fail.
+ */
+
+#define LOOPBACK_PORT	17911
+#define LOOPBACK_TRIES	100
+
+/* Listen on a free port, and connect to it. */
+void
+omapi_loopback_connect(dhcpctl_handle *connection) {
+	omapi_object_t *listener;
+	isc_result_t status;
+	unsigned port;
+
+	for (port = LOOPBACK_PORT; port < LOOPBACK_PORT + LOOPBACK_TRIES;
+	     port++) {
+		listener = NULL;
+		status = omapi_generic_new(&listener, MDL);
+		ATF_REQUIRE(status == ISC_R_SUCCESS);
+		status = omapi_protocol_listen(listener, port, 1);
+		if (status != ISC_R_ADDRNOTAVAIL)
+			break;
+	}
+	ATF_REQUIRE_MSG(status == ISC_R_SUCCESS, "omapi_protocol_listen: %s",
+			isc_result_totext(status));
+
+	*connection = NULL;
+	status = dhcpctl_connect(connection, "127.0.0.1", port,
+				 dhcpctl_null_handle);
+	ATF_REQUIRE_MSG(status == ISC_R_SUCCESS, "dhcpctl_connect: %s",
+			isc_result_totext(status));
+}
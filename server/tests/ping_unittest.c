@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+#include "netinet/ip.h"
+#include "netinet/ip_icmp.h"
+
+#include <atf-c.h>
+
+/*
+ * Test the ping table: pinging ahead of offers, the verified state a
+ * ping ahead leaves behind when nobody answers, and matching replies
+ * against the probes we sent.  The ICMP socket is left closed, so no
+ * echo requests actually go out; expired probes are handled by running
+ * the timeouts by hand.
+ */
+
+static struct icmp_state no_socket;
+
+static void
+setup(void) {
+	dhcp_context_create(DHCP_CONTEXT_PRE_DB | DHCP_CONTEXT_POST_DB,
+			    NULL, NULL);
+	no_socket.socket = -1;
+	icmp_state = &no_socket;
+	cur_tv.tv_sec = 1000;
+	cur_tv.tv_usec = 0;
+}
+
+static void
+advance(long sec) {
+	cur_tv.tv_sec += sec;
+	process_outstanding_timeouts(NULL);
+}
+
+static struct lease *
+make_lease(int last_octet) {
+	struct lease *lease = NULL;
+
+	ATF_REQUIRE(lease_allocate(&lease, MDL) == ISC_R_SUCCESS);
+	lease->ip_addr.len = 4;
+	lease->ip_addr.iabuf[0] = 192;
+	lease->ip_addr.iabuf[1] = 0;
+	lease->ip_addr.iabuf[2] = 2;
+	lease->ip_addr.iabuf[3] = last_octet;
+	lease->binding_state = FTS_FREE;
+	lease->sort_time = last_octet;
+	return (lease);
+}
+
+/* A pool with free leases for 192.0.2.1 up to 192.0.2.count. */
+static struct pool *
+make_pool(struct lease **leases, int count) {
+	struct pool *pool = NULL;
+	int i;
+
+	ATF_REQUIRE(pool_allocate(&pool, MDL) == ISC_R_SUCCESS);
+	pool->lease_count = count;
+#if defined (BINARY_LEASES)
+	pool_init_growth(pool);
+#endif
+	for (i = 0; i < count; i++) {
+		leases[i] = make_lease(i + 1);
+		LEASE_INSERTP(&pool->free, leases[i]);
+	}
+	return (pool);
+}
+
+/* An echo reply from an address, as ping_match() is given it. */
+static int
+reply(struct lease *lease, u_int16_t id, u_int16_t seq,
+      struct lease **lpp) {
+	u_int8_t buf[sizeof(struct ip) + sizeof(struct icmp)];
+	struct ip *ip = (struct ip *)buf;
+	struct icmp *icmp = (struct icmp *)(buf + sizeof(struct ip));
+
+	memset(buf, 0, sizeof(buf));
+	IP_V_SET(ip, 4);
+	IP_HL_SET(ip, sizeof(struct ip));
+	icmp->icmp_type = ICMP_ECHOREPLY;
+	icmp->icmp_id = id;
+	icmp->icmp_seq = seq;
+	return (ping_match(lease->ip_addr, buf, sizeof(struct icmp), lpp));
+}
+
+ATF_TC(ping_ahead_pool);
+ATF_TC_HEAD(ping_ahead_pool, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify ping-ahead pings the next "
+			  "free leases once each");
+}
+
+ATF_TC_BODY(ping_ahead_pool, tc)
+{
+	struct lease *leases[4];
+	struct pool *pool;
+	struct timeval expires;
+
+	setup();
+	pool = make_pool(leases, 4);
+
+	/* The first lease is being offered, so it's skipped. */
+	leases[0]->state = (struct lease_state *)1;
+	expires.tv_sec = cur_tv.tv_sec + 1;
+	expires.tv_usec = 0;
+	ping_ahead(pool, 2, &expires, 30);
+	leases[0]->state = NULL;
+	ATF_CHECK_EQ(ping_outstanding(), 2);
+
+	/* Leases already being pinged aren't pinged again. */
+	ping_ahead(pool, 3, &expires, 30);
+	ATF_CHECK_EQ(ping_outstanding(), 3);
+
+	/* Nobody answered, so none of them are outstanding any more. */
+	advance(2);
+	ATF_CHECK_EQ(ping_outstanding(), 0);
+	ATF_CHECK(ping_verified(&leases[0]->ip_addr));
+	ATF_CHECK(ping_verified(&leases[1]->ip_addr));
+	ATF_CHECK(ping_verified(&leases[2]->ip_addr));
+	ATF_CHECK(!ping_verified(&leases[3]->ip_addr));
+}
+
+ATF_TC(ping_verified_lifetime);
+ATF_TC_HEAD(ping_verified_lifetime, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify an unanswered ping ahead is "
+			  "remembered for ping-verified-lifetime");
+}
+
+ATF_TC_BODY(ping_verified_lifetime, tc)
+{
+	struct lease *lease1, *lease2, *lease3;
+	struct timeval expires;
+
+	setup();
+	lease1 = make_lease(1);
+	lease2 = make_lease(2);
+	lease3 = make_lease(3);
+	expires.tv_sec = cur_tv.tv_sec + 1;
+	expires.tv_usec = 0;
+	ping_send(lease1, PING_AHEAD, &expires, 30);
+	ping_send(lease2, PING_AHEAD, &expires, 30);
+	ping_send(lease3, PING_AHEAD, &expires, 0);
+
+	/* Still waiting for an answer, so not verified yet. */
+	ATF_CHECK(!ping_verified(&lease1->ip_addr));
+	ATF_CHECK_EQ(ping_outstanding(), 3);
+
+	advance(1);
+	ATF_CHECK_EQ(ping_outstanding(), 0);
+
+	/* A verification is used up by the offer that relies on it. */
+	ATF_CHECK(ping_verified(&lease1->ip_addr));
+	ATF_CHECK(!ping_verified(&lease1->ip_addr));
+
+	/* A lifetime of 0 doesn't remember anything. */
+	ATF_CHECK(!ping_verified(&lease3->ip_addr));
+
+	/* And it runs out after the lifetime. */
+	advance(30);
+	ATF_CHECK(!ping_verified(&lease2->ip_addr));
+}
+
+ATF_TC(ping_match_reply);
+ATF_TC_HEAD(ping_match_reply, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify replies must match the "
+			  "identifier and sequence number we sent");
+}
+
+ATF_TC_BODY(ping_match_reply, tc)
+{
+	struct lease *lease1, *lease2, *lp = NULL;
+	struct timeval expires;
+	u_int16_t id;
+
+	setup();
+	lease1 = make_lease(1);
+	lease2 = make_lease(2);
+	expires.tv_sec = cur_tv.tv_sec + 1;
+	expires.tv_usec = 0;
+
+	/* Each test runs in its own process, so the first probe sent
+	   has sequence number 1 and the second 2. */
+	id = (u_int16_t)((getpid() & 0xffff) | 1);
+	ping_send(lease1, PING_AHEAD, &expires, 30);
+	ping_send(lease2, PING_OFFER, &expires, 0);
+
+	/* Nothing was sent to this address. */
+	ATF_CHECK_EQ(reply(make_lease(3), id, 1, &lp), 0);
+
+	/* The wrong identifier or sequence number doesn't count. */
+	ATF_CHECK_EQ(reply(lease1, id ^ 0x100, 1, &lp), 0);
+	ATF_CHECK_EQ(reply(lease1, id, 2, &lp), 0);
+	ATF_CHECK_EQ(ping_outstanding(), 2);
+
+	ATF_CHECK_EQ(reply(lease1, id, 1, &lp), PING_AHEAD);
+	ATF_CHECK(lp == lease1);
+	lease_dereference(&lp, MDL);
+	ATF_CHECK_EQ(ping_outstanding(), 1);
+
+	ATF_CHECK_EQ(reply(lease2, id, 2, &lp), PING_OFFER);
+	ATF_CHECK(lp == lease2);
+	lease_dereference(&lp, MDL);
+	ATF_CHECK_EQ(ping_outstanding(), 0);
+
+	/* Answered, so it won't be taken as verified. */
+	advance(2);
+	ATF_CHECK(!ping_verified(&lease1->ip_addr));
+
+	/* A second copy of the reply finds nothing. */
+	ATF_CHECK_EQ(reply(lease1, id, 1, &lp), 0);
+}
+
+ATF_TC(ping_cancel_offer);
+ATF_TC_HEAD(ping_cancel_offer, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify a new ping replaces the old "
+			  "one and cancel forgets it");
+}
+
+ATF_TC_BODY(ping_cancel_offer, tc)
+{
+	struct lease *lease, *other;
+	struct timeval expires;
+
+	setup();
+	lease = make_lease(1);
+	expires.tv_sec = cur_tv.tv_sec + 1;
+	expires.tv_usec = 0;
+
+	ping_send(lease, PING_AHEAD, &expires, 30);
+	ping_send(lease, PING_OFFER, &expires, 0);
+	ATF_CHECK_EQ(ping_outstanding(), 1);
+
+	/* Only the lease the probe was for can cancel it. */
+	other = make_lease(1);
+	ping_cancel(other);
+	ATF_CHECK_EQ(ping_outstanding(), 1);
+	ping_cancel(lease);
+	ATF_CHECK_EQ(ping_outstanding(), 0);
+
+	/* The offer probe is gone, so its timeout does nothing. */
+	advance(2);
+	ATF_CHECK(!ping_verified(&lease->ip_addr));
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, ping_ahead_pool);
+	ATF_TP_ADD_TC(tp, ping_verified_lifetime);
+	ATF_TP_ADD_TC(tp, ping_match_reply);
+	ATF_TP_ADD_TC(tp, ping_cancel_offer);
+	return (atf_no_error());
+}
@@ -0,0 +1,381 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+#include <sys/time.h>
+
+#include <atf-c.h>
+
+/*
+ * Test the configuration reload.  Each test starts the server tables
+ * the way dhcpd does, from a configuration file written to the test's
+ * directory, marks some leases active as if they had been read from the
+ * lease file, then writes a new file and reloads it.  All the addresses
+ * are in 192.0.2.0/24 and are named by their last octet.
+ */
+
+#define RELOAD_TEST_CONF	"reload_unittest.conf"
+
+/* Pools of 10 addresses each at .10, .20 and .30. */
+static const char *three_pools =
+	"subnet 192.0.2.0 netmask 255.255.255.0 {\n"
+	"	pool { range 192.0.2.10 192.0.2.19; }\n"
+	"	pool { range 192.0.2.20 192.0.2.29; }\n"
+	"	pool { range 192.0.2.30 192.0.2.39; }\n"
+	"}\n";
+
+/* The pool at .10 is unchanged, the one at .20 has shrunk, the one at
+   .30 is gone and there is a new one at .40. */
+static const char *three_pools_changed =
+	"subnet 192.0.2.0 netmask 255.255.255.0 {\n"
+	"	pool { range 192.0.2.10 192.0.2.19; }\n"
+	"	pool { range 192.0.2.20 192.0.2.24; }\n"
+	"	pool { range 192.0.2.40 192.0.2.49; }\n"
+	"}\n";
+
+#if defined (FAILOVER_PROTOCOL)
+#define FAILOVER_PEER \
+	"failover peer \"pair\" {\n" \
+	"	primary;\n" \
+	"	address 127.0.0.1;\n" \
+	"	port 647;\n" \
+	"	peer address 127.0.0.2;\n" \
+	"	peer port 847;\n" \
+	"	max-response-delay 60;\n" \
+	"	max-unacked-updates 10;\n" \
+	"	mclt 3600;\n" \
+	"	split 128;\n" \
+	"}\n"
+
+static const char *failover_pool =
+	FAILOVER_PEER
+	"subnet 192.0.2.0 netmask 255.255.255.0 {\n"
+	"	pool {\n"
+	"		failover peer \"pair\";\n"
+	"		range 192.0.2.10 192.0.2.19;\n"
+	"	}\n"
+	"}\n";
+
+static const char *failover_pool_changed =
+	FAILOVER_PEER
+	"subnet 192.0.2.0 netmask 255.255.255.0 {\n"
+	"	pool {\n"
+	"		failover peer \"pair\";\n"
+	"		range 192.0.2.10 192.0.2.29;\n"
+	"	}\n"
+	"}\n";
+#endif
+
+static void
+write_config(const char *text) {
+	FILE *f;
+
+	f = fopen(RELOAD_TEST_CONF, "w");
+	ATF_REQUIRE(f != NULL);
+	ATF_REQUIRE(fputs(text, f) >= 0);
+	ATF_REQUIRE(fclose(f) == 0);
+}
+
+static struct iaddr
+test_addr(int octet) {
+	struct iaddr addr;
+
+	addr.len = 4;
+	addr.iabuf[0] = 192;
+	addr.iabuf[1] = 0;
+	addr.iabuf[2] = 2;
+	addr.iabuf[3] = octet;
+	return (addr);
+}
+
+static void
+setup(const char *config) {
+	isc_result_t status;
+
+	status = dhcp_context_create(DHCP_CONTEXT_PRE_DB, NULL, NULL);
+	ATF_REQUIRE_MSG(status == ISC_R_SUCCESS, "dhcp_context_create: %s",
+			isc_result_totext(status));
+	classification_setup();
+	status = omapi_init();
+	ATF_REQUIRE_MSG(status == ISC_R_SUCCESS, "omapi_init: %s",
+			isc_result_totext(status));
+	dhcp_db_objects_setup();
+	dhcp_common_objects_setup();
+
+	gettimeofday(&cur_tv, NULL);
+	initialize_common_option_spaces();
+	initialize_server_option_spaces();
+	root_group_setup();
+
+	path_dhcpd_conf = RELOAD_TEST_CONF;
+	write_config(config);
+	status = readconf();
+	ATF_REQUIRE_MSG(status == ISC_R_SUCCESS, "readconf: %s",
+			isc_result_totext(status));
+}
+
+/* Make an active lease, as db_startup() would from the lease file. */
+static void
+make_active(int octet) {
+	struct lease *lease = NULL;
+
+	ATF_REQUIRE_MSG(use_lease_by_ip_addr(&lease, test_addr(octet), MDL),
+			"no lease for .%d", octet);
+	lease->starts = cur_time;
+	lease->ends = cur_time + 3600;
+	lease->binding_state = FTS_ACTIVE;
+	lease->next_binding_state = FTS_ACTIVE;
+	lease->rewind_binding_state = FTS_ACTIVE;
+	lease_dereference(&lease, MDL);
+}
+
+/* The lease for an address, which must exist; the caller holds a
+   reference to it. */
+static struct lease *
+get_lease(int octet) {
+	struct lease *lease = NULL;
+
+	ATF_REQUIRE_MSG(find_lease_by_ip_addr(&lease, test_addr(octet), MDL),
+			"no lease for .%d", octet);
+	return (lease);
+}
+
+/* The pool an address is in, which must exist; the caller holds a
+   reference to it. */
+static struct pool *
+get_pool(int octet) {
+	struct pool *pool = NULL;
+
+	ATF_REQUIRE_MSG(find_address_pool(&pool, test_addr(octet)),
+			"no pool for .%d", octet);
+	return (pool);
+}
+
+/* Whether lease is the one in the lease table for an address. */
+static int
+is_lease(int octet, struct lease *lease) {
+	struct lease *l = NULL;
+	int found;
+
+	if (!find_lease_by_ip_addr(&l, test_addr(octet), MDL))
+		return (0);
+	found = (l == lease);
+	lease_dereference(&l, MDL);
+	return (found);
+}
+
+static int
+on_queue(LEASE_STRUCT_PTR lq, struct lease *lease) {
+	struct lease *l;
+
+	for (l = LEASE_GET_FIRSTP(lq); l != NULL; l = LEASE_GET_NEXTP(lq, l))
+		if (l == lease)
+			return (1);
+	return (0);
+}
+
+static int
+count_pools(void) {
+	struct shared_network *share;
+	struct pool *pool;
+	int count = 0;
+
+	for (share = shared_networks; share != NULL; share = share->next)
+		for (pool = share->pools; pool != NULL; pool = pool->next)
+			count++;
+	return (count);
+}
+
+ATF_TC(reload_pools);
+
+ATF_TC_HEAD(reload_pools, tc) {
+	atf_tc_set_md_var(tc, "descr", "Pools that are unchanged, changed, "
+			  "removed and added by a reload.");
+}
+
+ATF_TC_BODY(reload_pools, tc) {
+	struct pool *old10, *old20, *old30, *pool;
+	struct lease *l11, *l21, *l27, *l31, *lease = NULL;
+
+	setup(three_pools);
+	make_active(11);
+	make_active(21);
+	make_active(27);
+	make_active(31);
+	expire_all_pools();
+
+	old10 = get_pool(10);
+	old20 = get_pool(20);
+	old30 = get_pool(30);
+	l11 = get_lease(11);
+	l21 = get_lease(21);
+	l27 = get_lease(27);
+	l31 = get_lease(31);
+	ATF_REQUIRE(on_queue(&old10->active, l11));
+	ATF_REQUIRE(on_queue(&old20->active, l21));
+
+	/* Only a pool whose queues are handed over whole keeps this. */
+	old10->logged = 1;
+	old20->logged = 1;
+
+	write_config(three_pools_changed);
+	ATF_REQUIRE(reload_config() == ISC_R_SUCCESS);
+	ATF_CHECK_EQ(count_pools(), 3);
+
+	/* The unchanged pool took over the old pool's queues. */
+	pool = get_pool(10);
+	ATF_CHECK(pool != old10);
+	ATF_CHECK(pool->logged == 1);
+	ATF_CHECK(pool->lease_count == 10);
+	ATF_CHECK(pool->free_leases == 9);
+	ATF_CHECK(on_queue(&pool->active, l11));
+	ATF_CHECK(!LEASE_NOT_EMPTYP(&old10->active));
+	ATF_CHECK(l11->pool == pool);
+	ATF_CHECK(is_lease(11, l11));
+	lease_dereference(&l11, MDL);
+	pool_dereference(&pool, MDL);
+
+	/* The changed pool had its remaining lease queued again. */
+	pool = get_pool(20);
+	ATF_CHECK(pool != old20);
+	ATF_CHECK(pool->logged == 0);
+	ATF_CHECK(pool->lease_count == 5);
+	ATF_CHECK(pool->free_leases == 4);
+	ATF_CHECK(on_queue(&pool->active, l21));
+	ATF_CHECK(!LEASE_NOT_EMPTYP(&old20->active));
+	ATF_CHECK(l21->pool == pool);
+	ATF_CHECK(l21->subnet == subnets);
+	ATF_CHECK(is_lease(21, l21));
+	lease_dereference(&l21, MDL);
+	pool_dereference(&pool, MDL);
+
+	/* Leases for addresses that are no longer configured are gone. */
+	ATF_CHECK(!find_lease_by_ip_addr(&lease, test_addr(27), MDL));
+	ATF_CHECK(!find_lease_by_ip_addr(&lease, test_addr(31), MDL));
+	ATF_CHECK(!find_address_pool(&pool, test_addr(30)));
+	ATF_CHECK(!on_queue(&old20->active, l27));
+	ATF_CHECK(!on_queue(&old30->active, l31));
+	lease_dereference(&l27, MDL);
+	lease_dereference(&l31, MDL);
+
+	/* The new pool is all free. */
+	pool = get_pool(40);
+	ATF_CHECK(pool->lease_count == 10);
+	ATF_CHECK(pool->free_leases == 10);
+	ATF_CHECK(!LEASE_NOT_EMPTYP(&pool->active));
+	pool_dereference(&pool, MDL);
+
+	pool_dereference(&old10, MDL);
+	pool_dereference(&old20, MDL);
+	pool_dereference(&old30, MDL);
+}
+
+ATF_TC(reload_same);
+
+ATF_TC_HEAD(reload_same, tc) {
+	atf_tc_set_md_var(tc, "descr", "Reloading an unchanged file hands "
+			  "every pool's queues over.");
+}
+
+ATF_TC_BODY(reload_same, tc) {
+	struct pool *old10, *old20, *pool;
+	struct lease *l11, *l21;
+
+	setup(three_pools);
+	make_active(11);
+	make_active(21);
+	expire_all_pools();
+
+	old10 = get_pool(10);
+	old20 = get_pool(20);
+	old10->logged = 1;
+	old20->logged = 1;
+	l11 = get_lease(11);
+	l21 = get_lease(21);
+
+	ATF_REQUIRE(reload_config() == ISC_R_SUCCESS);
+	ATF_CHECK_EQ(count_pools(), 3);
+
+	pool = get_pool(10);
+	ATF_CHECK(pool != old10 && pool->logged == 1);
+	ATF_CHECK(on_queue(&pool->active, l11) && l11->pool == pool);
+	pool_dereference(&pool, MDL);
+
+	pool = get_pool(20);
+	ATF_CHECK(pool != old20 && pool->logged == 1);
+	ATF_CHECK(on_queue(&pool->active, l21) && l21->pool == pool);
+	pool_dereference(&pool, MDL);
+
+	lease_dereference(&l11, MDL);
+	lease_dereference(&l21, MDL);
+	pool_dereference(&old10, MDL);
+	pool_dereference(&old20, MDL);
+}
+
+ATF_TC(reload_failover);
+
+ATF_TC_HEAD(reload_failover, tc) {
+	atf_tc_set_md_var(tc, "descr", "A reload is refused with failover "
+			  "peers and the running pairs are kept.");
+}
+
+ATF_TC_BODY(reload_failover, tc) {
+#if defined (FAILOVER_PROTOCOL)
+	dhcp_failover_state_t *peer;
+	struct shared_network *share;
+	struct pool *pool, *none = NULL;
+	struct lease *l11;
+
+	setup(failover_pool);
+	make_active(11);
+	expire_all_pools();
+
+	peer = failover_states;
+	ATF_REQUIRE(peer != NULL);
+	share = shared_networks;
+	pool = get_pool(11);
+	ATF_REQUIRE(pool->failover_peer == peer);
+	l11 = get_lease(11);
+
+	write_config(failover_pool_changed);
+	ATF_CHECK(reload_config() == ISC_R_NOTIMPLEMENTED);
+
+	/* Nothing was read: the peer, its pool and the lease are the ones
+	   that were running. */
+	ATF_CHECK(failover_states == peer && peer->next == NULL);
+	ATF_CHECK(shared_networks == share);
+	ATF_CHECK(share->pools == pool && pool->next == NULL);
+	ATF_CHECK(pool->failover_peer == peer);
+	ATF_CHECK(on_queue(&pool->active, l11) && l11->pool == pool);
+	ATF_CHECK(is_lease(11, l11));
+	ATF_CHECK(!find_address_pool(&none, test_addr(25)));
+
+	lease_dereference(&l11, MDL);
+	pool_dereference(&pool, MDL);
+#else
+	atf_tc_skip("failover support is not compiled in");
+#endif
+}
+
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, reload_pools);
+	ATF_TP_ADD_TC(tp, reload_same);
+	ATF_TP_ADD_TC(tp, reload_failover);
+
+	return (atf_no_error());
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2024 Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include "dhcpd.h"
+
+#include <atf-c.h>
+
+/*
+ * Test the bookkeeping of the trace replay benchmark: sorting packets by
+ * message type, and the latency histograms the percentiles come from.
+ */
+
+/* Build a DHCPv4 packet with the given options after the cookie, and
+   return its length. */
+static unsigned
+make_packet(struct dhcp_packet *raw, const unsigned char *opts,
+	    unsigned len) {
+	memset(raw, 0, sizeof(*raw));
+	raw->op = BOOTREQUEST;
+	memcpy(raw->options, DHCP_OPTIONS_COOKIE, 4);
+	memcpy(raw->options + 4, opts, len);
+	return (DHCP_FIXED_NON_UDP + 4 + len);
+}
+
+ATF_TC(replay_message_type);
+ATF_TC_HEAD(replay_message_type, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify packets are sorted by type");
+}
+
+ATF_TC_BODY(replay_message_type, tc)
+{
+	struct dhcp_packet raw;
+	static const unsigned char discover[] = { 53, 1, DHCPDISCOVER, 255 };
+	static const unsigned char padded[] = {
+		0, 0, 12, 3, 'a', 'b', 'c', 53, 1, DHCPREQUEST, 255
+	};
+	static const unsigned char odd[] = { 53, 1, 200, 255 };
+	static const unsigned char none[] = { 12, 3, 'a', 'b', 'c', 255 };
+	static const unsigned char cut[] = { 12, 40, 'a', 'b' };
+	unsigned len;
+
+	len = make_packet(&raw, discover, sizeof(discover));
+	ATF_CHECK_EQ(replay_message_type(&raw, len), DHCPDISCOVER);
+
+	len = make_packet(&raw, padded, sizeof(padded));
+	ATF_CHECK_EQ(replay_message_type(&raw, len), DHCPREQUEST);
+
+	len = make_packet(&raw, odd, sizeof(odd));
+	ATF_CHECK_EQ(replay_message_type(&raw, len), REPLAY_TYPES - 1);
+
+	/* No message type, or no cookie, is BOOTP. */
+	len = make_packet(&raw, none, sizeof(none));
+	ATF_CHECK_EQ(replay_message_type(&raw, len), 0);
+	len = make_packet(&raw, discover, sizeof(discover));
+	raw.options[0] = 0;
+	ATF_CHECK_EQ(replay_message_type(&raw, len), 0);
+
+	/* An option that runs off the end of the packet stops the search. */
+	len = make_packet(&raw, cut, sizeof(cut));
+	ATF_CHECK_EQ(replay_message_type(&raw, len), 0);
+}
+
+ATF_TC(replay_buckets);
+ATF_TC_HEAD(replay_buckets, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify latency histogram buckets");
+}
+
+ATF_TC_BODY(replay_buckets, tc)
+{
+	u_int32_t usecs, limit;
+	unsigned bucket, last = 0;
+
+	/* Each time goes in a bucket whose range holds it and is no more
+	   than a sixteenth of it wide, and later times never go in earlier
+	   buckets. */
+	for (usecs = 0; usecs < 1000000; usecs++) {
+		bucket = replay_bucket(usecs);
+		limit = replay_bucket_limit(bucket);
+		ATF_REQUIRE(bucket < REPLAY_BUCKETS);
+		ATF_REQUIRE(limit >= usecs);
+		ATF_REQUIRE(limit - usecs <= usecs / 16);
+		ATF_REQUIRE(bucket == 0 ||
+			    replay_bucket_limit(bucket - 1) < usecs);
+		ATF_REQUIRE(bucket >= last);
+		last = bucket;
+	}
+
+	ATF_CHECK_EQ(replay_bucket(0x80000000), REPLAY_BUCKETS - 16);
+	ATF_CHECK_EQ(replay_bucket(0xffffffff), REPLAY_BUCKETS - 1);
+	ATF_CHECK_EQ(replay_bucket_limit(REPLAY_BUCKETS - 1), 0xffffffff);
+}
+
+ATF_TC(replay_percentile);
+ATF_TC_HEAD(replay_percentile, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Verify latency percentiles");
+}
+
+ATF_TC_BODY(replay_percentile, tc)
+{
+	struct replay_stats *stats = &replay_stats[DHCPDISCOVER];
+	u_int32_t p;
+	int i;
+
+	memset(replay_stats, 0, sizeof(replay_stats));
+	ATF_CHECK_EQ(replay_percentile(stats, 50), 0);
+
+	for (i = 1000; i >= 1; i--)
+		replay_record(DHCPDISCOVER, i, 2);
+	ATF_CHECK_EQ(stats->count, 1000);
+	ATF_CHECK_EQ(stats->allocs, 2000);
+	ATF_CHECK_EQ(stats->max, 1000);
+
+	p = replay_percentile(stats, 50);
+	ATF_CHECK(p >= 500 && p <= 500 + 500 / 16);
+	p = replay_percentile(stats, 99);
+	ATF_CHECK(p >= 990 && p <= 1000);
+	ATF_CHECK_EQ(replay_percentile(stats, 100), 1000);
+
+	/* Small times are kept exactly. */
+	memset(replay_stats, 0, sizeof(replay_stats));
+	for (i = 0; i < 10; i++)
+		replay_record(DHCPDISCOVER, i, 0);
+	ATF_CHECK_EQ(replay_percentile(stats, 50), 4);
+	ATF_CHECK_EQ(replay_percentile(stats, 90), 8);
+	ATF_CHECK_EQ(replay_percentile(stats, 0), 0);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, replay_message_type);
+	ATF_TP_ADD_TC(tp, replay_buckets);
+	ATF_TP_ADD_TC(tp, replay_percentile);
+	return (atf_no_error());
+}